@@ -172,8 +172,11 @@ app_ret_t app_init(App *self) {
 	plog_packager_add_filter(&self->raw_data_packager, "channel/#");
 	plog_packager_add_dst_mq(&self->raw_data_packager, "pkg/channel");
 	plog_packager_add_dst_file(&self->raw_data_packager, self->fifo_fs, "fifo");
-	plog_packager_set_nonce(&self->raw_data_packager, (uint8_t *)"nonce", 5);
-	plog_packager_set_key(&self->raw_data_packager, (uint8_t *)"key", 3);
+	/* Packages are sealed if the key is configured on the system filesystem. */
+	Fs *system_fs = NULL;
+	if (iservicelocator_query_name_type(locator, "system", ISERVICELOCATOR_TYPE_FS, (Interface **)&system_fs) == ISERVICELOCATOR_RET_OK) {
+		plog_packager_load_key(&self->raw_data_packager, system_fs, "pkg.key", "pkg.boot");
+	}
 	plog_packager_start(&self->raw_data_packager, 2048, 3072);
 
 	nbus_mq_init(&self->nbus_mq, self->mq, nbus_root_channel, "mq");
@@ -25,6 +25,8 @@
 
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
 #include "fec_golay.h"
 
 
@@ -42,6 +44,39 @@
  *           correctable bits)
  */
 static uint16_t fec_golay_table[2048];
+static bool fec_golay_table_ready;
+
+
+/**
+ * The code is linear, check bits of a 12 bit word are computed as a XOR of check
+ * bits of its lower and upper 6 bits. Generated from FEC_GOLAY_POLY.
+ *
+ * uint16_t [xxxxpccccccccccc]
+ *
+ * p - parity of the 6 information bits and the check bits
+ * c - check bits
+ */
+static const uint16_t fec_golay_check_lo[64] = {
+	0x000, 0xae3, 0xdc6, 0x725, 0x16f, 0xb8c, 0xca9, 0x64a,
+	0x2de, 0x83d, 0xf18, 0x5fb, 0x3b1, 0x952, 0xe77, 0x494,
+	0x5bc, 0xf5f, 0x87a, 0x299, 0x4d3, 0xe30, 0x915, 0x3f6,
+	0x762, 0xd81, 0xaa4, 0x047, 0x60d, 0xcee, 0xbcb, 0x128,
+	0x99b, 0x378, 0x45d, 0xebe, 0x8f4, 0x217, 0x532, 0xfd1,
+	0xb45, 0x1a6, 0x683, 0xc60, 0xa2a, 0x0c9, 0x7ec, 0xd0f,
+	0xc27, 0x6c4, 0x1e1, 0xb02, 0xd48, 0x7ab, 0x08e, 0xa6d,
+	0xef9, 0x41a, 0x33f, 0x9dc, 0xf96, 0x575, 0x250, 0x8b3,
+};
+
+static const uint16_t fec_golay_check_hi[64] = {
+	0x000, 0xb36, 0xe6c, 0x55a, 0x63b, 0xd0d, 0x857, 0x361,
+	0xe95, 0x5a3, 0x0f9, 0xbcf, 0x8ae, 0x398, 0x6c2, 0xdf4,
+	0x7c9, 0xcff, 0x9a5, 0x293, 0x1f2, 0xac4, 0xf9e, 0x4a8,
+	0x95c, 0x26a, 0x730, 0xc06, 0xf67, 0x451, 0x10b, 0xa3d,
+	0xd71, 0x647, 0x31d, 0x82b, 0xb4a, 0x07c, 0x526, 0xe10,
+	0x3e4, 0x8d2, 0xd88, 0x6be, 0x5df, 0xee9, 0xbb3, 0x085,
+	0xab8, 0x18e, 0x4d4, 0xfe2, 0xc83, 0x7b5, 0x2ef, 0x9d9,
+	0x42d, 0xf1b, 0xa41, 0x177, 0x216, 0x920, 0xc7a, 0x74c,
+};
 
 
 /**
@@ -58,17 +93,10 @@ uint32_t fec_golay_encode(uint32_t codeword) {
 	/* codeword can contain only 12 bits of information, crop the rest */
 	codeword &= 0xfff;
 
-	uint32_t c = codeword;
-
-	for (int i = 0; i < 12; i++) {
-		if (c & 1) {
-			c ^= FEC_GOLAY_POLY;
-		}
-		c >>= 1;
-	}
+	uint32_t c = fec_golay_check_lo[codeword & 0x3f] ^ fec_golay_check_hi[codeword >> 6];
 
 	/* returns original codeword prefixed by 11 checkbits */
-	return codeword | (c << 12);
+	return codeword | ((c & 0x7ff) << 12);
 }
 
 
@@ -77,27 +105,33 @@ uint32_t fec_golay_encode(uint32_t codeword) {
  * value saved in a 32bit unsigned integer right justified.
  */
 uint32_t fec_golay_syndrome(uint32_t codeword) {
-	/* codeword contains 23bits, crop the rest */
-	codeword &= 0x7fffff;
-
-	for (int i = 0; i < 12; i++) {
-		if (codeword & 1) {
-			codeword ^= FEC_GOLAY_POLY;
-		}
-		codeword >>= 1;
-	}
+	/* Check bits recomputed from the information part differ from the received
+	 * ones in the syndrome bits. */
+	uint32_t c = fec_golay_check_lo[codeword & 0x3f] ^ fec_golay_check_hi[(codeword >> 6) & 0x3f];
 
-	return codeword;
+	return (c ^ (codeword >> 12)) & 0x7ff;
 }
 
 
 /**
- * Computes weight of a 23bit codeword (number of '1's)
+ * Computes weight of a 24bit codeword (number of '1's)
  */
 uint32_t fec_golay_weight_codeword(uint32_t codeword) {
 	const uint8_t weights[16] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
 
-	return weights[codeword & 0xf] + weights[(codeword >> 4) & 0xf] +  weights[(codeword >> 8) & 0xf];
+	uint32_t w = 0;
+	for (uint32_t i = 0; i < 24; i += 4) {
+		w += weights[(codeword >> i) & 0xf];
+	}
+	return w;
+}
+
+
+static uint32_t fec_golay_parity(uint32_t v) {
+	v ^= v >> 16;
+	v ^= v >> 8;
+	v ^= v >> 4;
+	return (0x6996 >> (v & 0xf)) & 1;
 }
 
 
@@ -133,23 +167,154 @@ uint32_t fec_golay_correct(uint32_t codeword) {
  * Prepare decoding table (shared global)
  */
 void fec_golay_table_fill(void) {
-	/* Try all combinations of bit errors. Some combinations
-	 * are iterated multiple times. As this is done only once during
-	 * initialization, things are kept simple. */
+	/* The code is perfect, every syndrome corresponds to exactly one error
+	 * pattern of weight 3 or less. Patterns with less than 3 errors repeat
+	 * the bit index. */
 	for (int i = 0; i < 23; i++) {
-		for (int j = 0; j < 23; j++) {
-			for (int k = 0; k < 23; k++) {
+		for (int j = i; j < 23; j++) {
+			for (int k = j; k < 23; k++) {
 				uint32_t pattern = (1 << i) | (1 << j) | (1 << k);
-				uint32_t syn = fec_golay_syndrome(pattern);
-
-				//~ if (golay_weight_codeword(pattern) < table[syn]) {
-					fec_golay_table[syn] = (i << 10) | (j << 5) | (k);
-				//~ }
+				fec_golay_table[fec_golay_syndrome(pattern)] = (i << 10) | (j << 5) | (k);
 			}
 		}
 	}
 	/* First table item doesn't need to be initialized (zero syndrome
 	 * means no need for error correction). Left here for completeness. */
 	fec_golay_table[0] = 0;
+	fec_golay_table_ready = true;
+}
+
+
+size_t fec_golay_encoded_len(size_t len) {
+	return (len + 2) / 3 * 6;
+}
+
+
+/* 12 bit word to a 24 bit codeword with the parity bit, big endian. */
+static void fec_golay_encode_word(uint32_t w, uint8_t *out) {
+	uint32_t c = fec_golay_check_lo[w & 0x3f] ^ fec_golay_check_hi[w >> 6];
+	c = w | (c << 12);
+
+	out[0] = c >> 16;
+	out[1] = c >> 8;
+	out[2] = c;
+}
+
+
+void fec_golay_encode_buf(const uint8_t *data, size_t len, uint8_t *out) {
+	while (len >= 3) {
+		fec_golay_encode_word((data[0] << 4) | (data[1] >> 4), out);
+		fec_golay_encode_word(((data[1] & 0x0f) << 8) | data[2], out + 3);
+		data += 3;
+		len -= 3;
+		out += 6;
+	}
+	if (len > 0) {
+		uint8_t last[3] = {0};
+		memcpy(last, data, len);
+		fec_golay_encode_buf(last, 3, out);
+	}
 }
 
+
+/* Correct a 24 bit codeword, return false if the errors cannot be corrected. */
+static bool fec_golay_decode_word(const uint8_t *in, uint32_t *w, uint32_t *corrected) {
+	uint32_t c = (in[0] << 16) | (in[1] << 8) | in[2];
+	uint32_t syn = fec_golay_syndrome(c);
+	uint32_t errors = 0;
+
+	if (syn != 0) {
+		uint16_t t = fec_golay_table[syn];
+		uint32_t pattern = (1 << ((t >> 10) & 0x1f)) | (1 << ((t >> 5) & 0x1f)) | (1 << (t & 0x1f));
+		c ^= pattern;
+		errors = fec_golay_weight_codeword(pattern);
+	}
+	if (fec_golay_parity(c)) {
+		/* The parity bit is wrong too or there are 4 errors. */
+		if (errors == 3) {
+			return false;
+		}
+		errors++;
+	}
+
+	*w = c & 0xfff;
+	*corrected += errors;
+	return true;
+}
+
+
+size_t fec_golay_decode_buf(const uint8_t *in, size_t len, uint8_t *data, uint32_t *corrected) {
+	if (!fec_golay_table_ready) {
+		return len / 3;
+	}
+
+	uint32_t bits = 0;
+	size_t failed = 0;
+	while (len >= 6) {
+		uint32_t w1 = 0;
+		uint32_t w2 = 0;
+		failed += !fec_golay_decode_word(in, &w1, &bits);
+		failed += !fec_golay_decode_word(in + 3, &w2, &bits);
+		data[0] = w1 >> 4;
+		data[1] = (w1 << 4) | (w2 >> 8);
+		data[2] = w2;
+		in += 6;
+		len -= 6;
+		data += 3;
+	}
+	if (corrected != NULL) {
+		*corrected = bits;
+	}
+	return failed;
+}
+
+
+bool fec_golay_interleave(const uint8_t *in, size_t len, uint8_t *out) {
+	size_t n = len / 3;
+	if (n > FEC_GOLAY_INTERLEAVE_MAX) {
+		return false;
+	}
+	uint32_t acc = 0;
+	uint32_t bits = 0;
+
+	for (size_t j = 0; j < 24; j++) {
+		const uint8_t *p = in + j / 8;
+		uint32_t shift = 7 - j % 8;
+		for (size_t i = 0; i < n; i++) {
+			acc = (acc << 1) | ((p[i * 3] >> shift) & 1);
+			if (++bits == 8) {
+				*out++ = acc;
+				acc = 0;
+				bits = 0;
+			}
+		}
+	}
+
+	return true;
+}
+
+
+bool fec_golay_deinterleave(const uint8_t *in, size_t len, uint8_t *out) {
+	size_t n = len / 3;
+	if (n > FEC_GOLAY_INTERLEAVE_MAX) {
+		return false;
+	}
+	memset(out, 0, n * 3);
+
+	uint32_t acc = 0;
+	uint32_t bits = 0;
+	for (size_t j = 0; j < 24; j++) {
+		uint8_t *p = out + j / 8;
+		uint32_t shift = 7 - j % 8;
+		for (size_t i = 0; i < n; i++) {
+			if (bits == 0) {
+				acc = *in++;
+				bits = 8;
+			}
+			bits--;
+			p[i * 3] |= ((acc >> bits) & 1) << shift;
+		}
+	}
+
+	return true;
+}
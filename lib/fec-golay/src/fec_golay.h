@@ -26,18 +26,65 @@
 #ifndef _FEC_GOLAY_H_
 #define _FEC_GOLAY_H_
 
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
 
 /* Two different polynomials are available */
 //~ #define GOLAY_POLY 0xc75
 #define FEC_GOLAY_POLY 0xae3
 
 
+/* Maximum number of codewords in a single interleaved block. */
+#define FEC_GOLAY_INTERLEAVE_MAX 128
+
+
 uint32_t fec_golay_encode(uint32_t codeword);
 uint32_t fec_golay_syndrome(uint32_t codeword);
 uint32_t fec_golay_weight_codeword(uint32_t codeword);
 uint32_t fec_golay_correct(uint32_t codeword);
+
+/**
+ * Fill the shared decoding table. Must be called once before any codeword is
+ * corrected or decoded, the table is not filled on demand (it is not protected
+ * by any lock).
+ */
 void fec_golay_table_fill(void);
 
+/**
+ * Byte stream encoding. Every 3 bytes of data (two 12 bit words) are encoded
+ * into two 24 bit codewords (6 bytes, big endian). The 24th bit of each codeword
+ * is an overall parity bit used to detect uncorrectable errors. Data is padded
+ * with zeroes to a multiple of 3 bytes.
+ */
+size_t fec_golay_encoded_len(size_t len);
+void fec_golay_encode_buf(const uint8_t *data, size_t len, uint8_t *out);
+
+/**
+ * Decode a byte stream encoded with fec_golay_encode_buf
+ *
+ * @param len Length of the encoded stream, must be a multiple of 6
+ * @param data Decoded data, len / 2 bytes long
+ * @param corrected Number of corrected bit errors. May be NULL.
+ *
+ * @return Number of codewords with errors detected but not corrected. All codewords
+ *         are reported as failed if fec_golay_table_fill was not called yet.
+ */
+size_t fec_golay_decode_buf(const uint8_t *in, size_t len, uint8_t *data, uint32_t *corrected);
+
+/**
+ * Block interleaving of codewords produced by fec_golay_encode_buf. The stream
+ * of len / 3 codewords is transmitted bit by bit, the n-th bit of all codewords
+ * first. A burst of up to 3 * len / 3 bits is spread over all codewords and
+ * corrupts at most 3 bits of each of them.
+ *
+ * @return false if the block is longer than FEC_GOLAY_INTERLEAVE_MAX codewords,
+ *         nothing is written to @p out in that case.
+ */
+bool fec_golay_interleave(const uint8_t *in, size_t len, uint8_t *out);
+bool fec_golay_deinterleave(const uint8_t *in, size_t len, uint8_t *out);
+
 
 
 #endif
@@ -23,37 +23,97 @@
 #define PLUS(v, w) (U32V((v) + (w)))
 #define PLUSONE(v) (PLUS((v), 1))
 
+/* The state is kept in local variables instead of an array to allow the
+ * compiler to keep as much of it in registers as possible. */
 #define QUARTERROUND(a, b, c, d) \
-x[a] = PLUS(x[a], x[b]); x[d] = ROTATE(XOR(x[d], x[a]), 16); \
-x[c] = PLUS(x[c], x[d]); x[b] = ROTATE(XOR(x[b], x[c]), 12); \
-x[a] = PLUS(x[a], x[b]); x[d] = ROTATE(XOR(x[d], x[a]), 8); \
-x[c] = PLUS(x[c], x[d]); x[b] = ROTATE(XOR(x[b], x[c]), 7);
+a = PLUS(a, b); d = ROTATE(XOR(d, a), 16); \
+c = PLUS(c, d); b = ROTATE(XOR(b, c), 12); \
+a = PLUS(a, b); d = ROTATE(XOR(d, a), 8); \
+c = PLUS(c, d); b = ROTATE(XOR(b, c), 7);
+
+static void chacha20_block(const uint32_t input[16], uint32_t output[16]) {
+	uint32_t x0 = input[0], x1 = input[1], x2 = input[2], x3 = input[3];
+	uint32_t x4 = input[4], x5 = input[5], x6 = input[6], x7 = input[7];
+	uint32_t x8 = input[8], x9 = input[9], x10 = input[10], x11 = input[11];
+	uint32_t x12 = input[12], x13 = input[13], x14 = input[14], x15 = input[15];
+
+	for (int i = 20; i > 0; i -= 2) {
+		QUARTERROUND(x0, x4,  x8, x12)
+		QUARTERROUND(x1, x5,  x9, x13)
+		QUARTERROUND(x2, x6, x10, x14)
+		QUARTERROUND(x3, x7, x11, x15)
+		QUARTERROUND(x0, x5, x10, x15)
+		QUARTERROUND(x1, x6, x11, x12)
+		QUARTERROUND(x2, x7,  x8, x13)
+		QUARTERROUND(x3, x4,  x9, x14)
+	}
+
+	output[0] = PLUS(x0, input[0]);
+	output[1] = PLUS(x1, input[1]);
+	output[2] = PLUS(x2, input[2]);
+	output[3] = PLUS(x3, input[3]);
+	output[4] = PLUS(x4, input[4]);
+	output[5] = PLUS(x5, input[5]);
+	output[6] = PLUS(x6, input[6]);
+	output[7] = PLUS(x7, input[7]);
+	output[8] = PLUS(x8, input[8]);
+	output[9] = PLUS(x9, input[9]);
+	output[10] = PLUS(x10, input[10]);
+	output[11] = PLUS(x11, input[11]);
+	output[12] = PLUS(x12, input[12]);
+	output[13] = PLUS(x13, input[13]);
+	output[14] = PLUS(x14, input[14]);
+	output[15] = PLUS(x15, input[15]);
+}
+
+static void chacha20_next_block(chacha20_context *ctx) {
+	ctx->input[12] = PLUSONE(ctx->input[12]);
+	if (ctx->input[12] == 0) {
+		ctx->input[13] = PLUSONE(ctx->input[13]);
+	}
+}
 
 void chacha20_keystream(chacha20_context *ctx, uint8_t output[64]) {
 	uint32_t x[16];
-	int i;
+	chacha20_block(ctx->input, x);
 
-	for (i = 0; i < 16; ++i) {
-		x[i] = ctx->input[i];
+	for (int i = 0; i < 16; ++i) {
+		U32TO8_LITTLE(output + 4 * i, x[i]);
 	}
-	
-	for (i = 20; i > 0; i -= 2) {
-		QUARTERROUND( 0,  4,  8, 12)
-		QUARTERROUND( 1,  5,  9, 13)
-		QUARTERROUND( 2,  6, 10, 14)
-		QUARTERROUND( 3,  7, 11, 15)
-		QUARTERROUND( 0,  5, 10, 15)
-		QUARTERROUND( 1,  6, 11, 12)
-		QUARTERROUND( 2,  7,  8, 13)
-		QUARTERROUND( 3,  4,  9, 14)
+}
+
+void chacha20_keystream_blocks(chacha20_context *ctx, uint8_t *output, uint32_t blocks) {
+	while (blocks > 0) {
+		chacha20_keystream(ctx, output);
+		chacha20_next_block(ctx);
+		output += 64;
+		blocks--;
 	}
-	
-	for (i = 0; i < 16; ++i) {
-		x[i] = PLUS(x[i], ctx->input[i]);
+}
+
+void chacha20_xor(chacha20_context *ctx, uint8_t *out, const uint8_t *in, uint32_t len) {
+	uint32_t x[16];
+
+	/* Whole blocks are processed a word at a time. */
+	while (len >= 64) {
+		chacha20_block(ctx->input, x);
+		chacha20_next_block(ctx);
+		for (int i = 0; i < 16; ++i) {
+			U32TO8_LITTLE(out + 4 * i, XOR(U8TO32_LITTLE(in + 4 * i), x[i]));
+		}
+		out += 64;
+		in += 64;
+		len -= 64;
 	}
-	
-	for (i = 0; i < 16; ++i) {
-		U32TO8_LITTLE(output + 4 * i, x[i]);
+
+	/* The tail consumes a whole keystream block. */
+	if (len > 0) {
+		uint8_t k[64];
+		chacha20_keystream(ctx, k);
+		chacha20_next_block(ctx);
+		for (uint32_t i = 0; i < len; i++) {
+			out[i] = in[i] ^ k[i];
+		}
 	}
 }
 
@@ -26,4 +26,13 @@ void chacha20_keysetup(chacha20_context *ctx, const uint8_t *k, uint32_t kbits);
 void chacha20_nonce(chacha20_context *ctx, const uint8_t *nonce);
 void chacha20_counter(chacha20_context *ctx, uint32_t counter);
 
+/* Generate a number of consecutive 64 byte keystream blocks starting at the
+ * current counter value. The counter is advanced past the generated blocks. */
+void chacha20_keystream_blocks(chacha20_context *ctx, uint8_t *output, uint32_t blocks);
+
+/* XOR len bytes of the input with the keystream. The output may be the same
+ * buffer as the input. The counter is advanced past all blocks used, the
+ * last partial block is discarded. */
+void chacha20_xor(chacha20_context *ctx, uint8_t *out, const uint8_t *in, uint32_t len);
+
 #endif
@@ -12,141 +12,197 @@
  *
  */
 
-/* 91 hashes per 1 MIPS (average on core i3 @6500bogomips) */
-/* 31 hashes per 1 MIPS (core i3 @2660bogomips */
-
-
 #include <stdio.h>
 #include "poly1305.h"
 
-static void add(unsigned int h[17], const unsigned int c[17]) {
-	unsigned int j, u;
+/* The accumulator and the key are kept in 26 bit limbs to allow 32x32 bit
+ * multiplications without any carry propagation inside the block loop.
+ * Based on the public domain poly1305-donna (32 bit) by Andrew Moon. */
 
-	u = 0;
-	for (j = 0; j < 17; ++j) {
-		u += h[j] + c[j];
-		h[j] = u & 255;
-		u >>= 8;
-	}
+static unsigned int u8to32(const unsigned char *p) {
+	return
+		((unsigned int)p[0]) |
+		((unsigned int)p[1] << 8) |
+		((unsigned int)p[2] << 16) |
+		((unsigned int)p[3] << 24);
 }
 
-static void squeeze(unsigned int h[17]) {
-	unsigned int j, u;
-
-	u = 0;
-
-	for (j = 0; j < 16; ++j) {
-		u += h[j];
-		h[j] = u & 255;
-		u >>= 8;
-	}
-
-	u += h[16];
-	h[16] = u & 3;
-	u = 5 * (u >> 2);
+static void u32to8(unsigned char *p, unsigned int v) {
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+}
 
-	for (j = 0; j < 16; ++j) {
-		u += h[j];
-		h[j] = u & 255;
-		u >>= 8;
+static void blocks(poly1305_context *ctx, const unsigned char *in, unsigned long long inlen, unsigned int hibit) {
+	const unsigned int r0 = ctx->r[0];
+	const unsigned int r1 = ctx->r[1];
+	const unsigned int r2 = ctx->r[2];
+	const unsigned int r3 = ctx->r[3];
+	const unsigned int r4 = ctx->r[4];
+	const unsigned int s1 = r1 * 5;
+	const unsigned int s2 = r2 * 5;
+	const unsigned int s3 = r3 * 5;
+	const unsigned int s4 = r4 * 5;
+	unsigned int h0 = ctx->h[0];
+	unsigned int h1 = ctx->h[1];
+	unsigned int h2 = ctx->h[2];
+	unsigned int h3 = ctx->h[3];
+	unsigned int h4 = ctx->h[4];
+
+	while (inlen >= 16) {
+		/* h += m */
+		h0 += (u8to32(in + 0)) & 0x3ffffff;
+		h1 += (u8to32(in + 3) >> 2) & 0x3ffffff;
+		h2 += (u8to32(in + 6) >> 4) & 0x3ffffff;
+		h3 += (u8to32(in + 9) >> 6) & 0x3ffffff;
+		h4 += (u8to32(in + 12) >> 8) | hibit;
+
+		/* h *= r */
+		unsigned long long d0 = ((unsigned long long)h0 * r0) + ((unsigned long long)h1 * s4) + ((unsigned long long)h2 * s3) + ((unsigned long long)h3 * s2) + ((unsigned long long)h4 * s1);
+		unsigned long long d1 = ((unsigned long long)h0 * r1) + ((unsigned long long)h1 * r0) + ((unsigned long long)h2 * s4) + ((unsigned long long)h3 * s3) + ((unsigned long long)h4 * s2);
+		unsigned long long d2 = ((unsigned long long)h0 * r2) + ((unsigned long long)h1 * r1) + ((unsigned long long)h2 * r0) + ((unsigned long long)h3 * s4) + ((unsigned long long)h4 * s3);
+		unsigned long long d3 = ((unsigned long long)h0 * r3) + ((unsigned long long)h1 * r2) + ((unsigned long long)h2 * r1) + ((unsigned long long)h3 * r0) + ((unsigned long long)h4 * s4);
+		unsigned long long d4 = ((unsigned long long)h0 * r4) + ((unsigned long long)h1 * r3) + ((unsigned long long)h2 * r2) + ((unsigned long long)h3 * r1) + ((unsigned long long)h4 * r0);
+
+		/* Partial reduction mod 2^130 - 5 */
+		unsigned int c;
+		c = (unsigned int)(d0 >> 26); h0 = (unsigned int)d0 & 0x3ffffff;
+		d1 += c; c = (unsigned int)(d1 >> 26); h1 = (unsigned int)d1 & 0x3ffffff;
+		d2 += c; c = (unsigned int)(d2 >> 26); h2 = (unsigned int)d2 & 0x3ffffff;
+		d3 += c; c = (unsigned int)(d3 >> 26); h3 = (unsigned int)d3 & 0x3ffffff;
+		d4 += c; c = (unsigned int)(d4 >> 26); h4 = (unsigned int)d4 & 0x3ffffff;
+		h0 += c * 5; c = h0 >> 26; h0 = h0 & 0x3ffffff;
+		h1 += c;
+
+		in += 16;
+		inlen -= 16;
 	}
 
-	u += h[16];
-	h[16] = u;
+	ctx->h[0] = h0;
+	ctx->h[1] = h1;
+	ctx->h[2] = h2;
+	ctx->h[3] = h3;
+	ctx->h[4] = h4;
 }
 
-static const unsigned int minusp[17] = {
-	5, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 252
-};
-
-static void freeze(unsigned int h[17]) {
-	unsigned int horig[17], j, negative;
+void poly1305_init(poly1305_context *ctx, const unsigned char *k) {
+	/* r &= 0xffffffc0ffffffc0ffffffc0fffffff */
+	ctx->r[0] = (u8to32(k + 0)) & 0x3ffffff;
+	ctx->r[1] = (u8to32(k + 3) >> 2) & 0x3ffff03;
+	ctx->r[2] = (u8to32(k + 6) >> 4) & 0x3ffc0ff;
+	ctx->r[3] = (u8to32(k + 9) >> 6) & 0x3f03fff;
+	ctx->r[4] = (u8to32(k + 12) >> 8) & 0x00fffff;
 
-	for (j = 0; j < 17; ++j) {
-		horig[j] = h[j];
+	for (unsigned int j = 0; j < 5; ++j) {
+		ctx->h[j] = 0;
 	}
-  
-	add(h, minusp);
-	negative = -(h[16] >> 7);
-  
-	for (j = 0; j < 17; ++j) {
-		h[j] ^= negative & (horig[j] ^ h[j]);
+	for (unsigned int j = 0; j < 4; ++j) {
+		ctx->pad[j] = u8to32(k + 16 + 4 * j);
 	}
+	ctx->buflen = 0;
 }
 
-static void mulmod(unsigned int h[17], const unsigned int r[17]) {
-	unsigned int hr[17], i, j, u;
-
-	for (i = 0; i < 17; ++i) {
-		u = 0;
-		for (j = 0; j <= i; ++j) {
-			u += h[j] * r[i - j];
+void poly1305_update(poly1305_context *ctx, const unsigned char *in, unsigned long long inlen) {
+	/* Complete the buffered partial block first. */
+	if (ctx->buflen > 0) {
+		while (ctx->buflen < 16 && inlen > 0) {
+			ctx->buf[ctx->buflen++] = *in++;
+			inlen--;
 		}
-		for (j = i + 1; j < 17; ++j) {
-			u += 320 * h[j] * r[i + 17 - j];
+		if (ctx->buflen < 16) {
+			return;
 		}
-		hr[i] = u;
-	}
-	
-	for (i = 0; i < 17; ++i) {
-		h[i] = hr[i];
+		blocks(ctx, ctx->buf, 16, 1 << 24);
+		ctx->buflen = 0;
 	}
-	
-	squeeze(h);
-}
 
-int poly1305(unsigned char *out, const unsigned char *in, unsigned long long inlen, const unsigned char *k) {
-	unsigned int j, r[17], h[17], c[17];
-
-	r[0] = k[0];
-	r[1] = k[1];
-	r[2] = k[2];
-	r[3] = k[3] & 15;
-	r[4] = k[4] & 252;
-	r[5] = k[5];
-	r[6] = k[6];
-	r[7] = k[7] & 15;
-	r[8] = k[8] & 252;
-	r[9] = k[9];
-	r[10] = k[10];
-	r[11] = k[11] & 15;
-	r[12] = k[12] & 252;
-	r[13] = k[13];
-	r[14] = k[14];
-	r[15] = k[15] & 15;
-	r[16] = 0;
-
-	for (j = 0; j < 17; ++j) {
-		h[j] = 0;
+	/* Process all whole blocks at once. */
+	if (inlen >= 16) {
+		unsigned long long whole = inlen & ~15ULL;
+		blocks(ctx, in, whole, 1 << 24);
+		in += whole;
+		inlen -= whole;
 	}
 
 	while (inlen > 0) {
-		for (j = 0; j < 17; ++j) {
-			c[j] = 0;
-		}
-		
-		for (j = 0; (j < 16) && (j < inlen); ++j) {
-			c[j] = in[j];
+		ctx->buf[ctx->buflen++] = *in++;
+		inlen--;
+	}
+}
+
+void poly1305_finish(poly1305_context *ctx, unsigned char *out) {
+	/* The last partial block is padded with a single 1 byte. */
+	if (ctx->buflen > 0) {
+		ctx->buf[ctx->buflen++] = 1;
+		while (ctx->buflen < 16) {
+			ctx->buf[ctx->buflen++] = 0;
 		}
-		
-		c[j] = 1;
-		in += j;
-		inlen -= j;
-		add(h, c);
-		mulmod(h, r);
+		blocks(ctx, ctx->buf, 16, 0);
+		ctx->buflen = 0;
 	}
 
-	freeze(h);
+	unsigned int h0 = ctx->h[0];
+	unsigned int h1 = ctx->h[1];
+	unsigned int h2 = ctx->h[2];
+	unsigned int h3 = ctx->h[3];
+	unsigned int h4 = ctx->h[4];
+	unsigned int c;
+
+	/* Fully carry h. */
+	c = h1 >> 26; h1 &= 0x3ffffff;
+	h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+	h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+	h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+	h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+	h1 += c;
+
+	/* Compute h - p and select it in constant time if h >= p. */
+	unsigned int g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+	unsigned int g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+	unsigned int g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+	unsigned int g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+	unsigned int g4 = h4 + c - (1 << 26);
+
+	unsigned int mask = (g4 >> 31) - 1;
+	g0 &= mask;
+	g1 &= mask;
+	g2 &= mask;
+	g3 &= mask;
+	g4 &= mask;
+	mask = ~mask;
+	h0 = (h0 & mask) | g0;
+	h1 = (h1 & mask) | g1;
+	h2 = (h2 & mask) | g2;
+	h3 = (h3 & mask) | g3;
+	h4 = (h4 & mask) | g4;
+
+	/* h = h % 2^128 */
+	h0 = (h0) | (h1 << 26);
+	h1 = (h1 >> 6) | (h2 << 20);
+	h2 = (h2 >> 12) | (h3 << 14);
+	h3 = (h3 >> 18) | (h4 << 8);
+
+	/* tag = (h + pad) % 2^128 */
+	unsigned long long f;
+	f = (unsigned long long)h0 + ctx->pad[0]; h0 = (unsigned int)f;
+	f = (unsigned long long)h1 + ctx->pad[1] + (f >> 32); h1 = (unsigned int)f;
+	f = (unsigned long long)h2 + ctx->pad[2] + (f >> 32); h2 = (unsigned int)f;
+	f = (unsigned long long)h3 + ctx->pad[3] + (f >> 32); h3 = (unsigned int)f;
+
+	u32to8(out + 0, h0);
+	u32to8(out + 4, h1);
+	u32to8(out + 8, h2);
+	u32to8(out + 12, h3);
+}
+
+int poly1305(unsigned char *out, const unsigned char *in, unsigned long long inlen, const unsigned char *k) {
+	poly1305_context ctx;
+
+	poly1305_init(&ctx, k);
+	poly1305_update(&ctx, in, inlen);
+	poly1305_finish(&ctx, out);
 
-	for (j = 0; j < 16; ++j) {
-		c[j] = k[j + 16];
-	}
-	c[16] = 0;
-	add(h, c);
-	for (j = 0; j < 16; ++j) {
-		out[j] = h[j];
-	}
-	
 	return POLY1305_OK;
 }
 
@@ -21,4 +21,18 @@
 int poly1305(unsigned char *out, const unsigned char *in, unsigned long long inlen, const unsigned char *k);
 #define POLY1305_OK 0
 
+/* Incremental interface. Data can be supplied in chunks of arbitrary size,
+ * the result is the same as if the one-shot poly1305() was used. */
+typedef struct poly1305_context_t {
+	unsigned int r[5];
+	unsigned int h[5];
+	unsigned int pad[4];
+	unsigned char buf[16];
+	unsigned int buflen;
+} poly1305_context;
+
+void poly1305_init(poly1305_context *ctx, const unsigned char *k);
+void poly1305_update(poly1305_context *ctx, const unsigned char *in, unsigned long long inlen);
+void poly1305_finish(poly1305_context *ctx, unsigned char *out);
+
 #endif
@@ -364,6 +364,8 @@ static void can_init(void) {
 	nvic_enable_irq(NVIC_FDCAN1_IT0_IRQ);
 
 	nbus_init(&nbus, &can1.iface);
+	/* The controller is configured for CAN-FD with BRS, use 64 byte fragments with capable peers. */
+	nbus_set_fd(&nbus, true, true);
 
 	nbus_root_init(&nbus_root, &nbus, UNIQUE_ID_REG, UNIQUE_ID_REG_LEN);
 	nbus_log_init(&nbus_log, nbus_root_channel);
@@ -508,6 +508,7 @@ int32_t port_init(void) {
 			mqtt_set_client_id(&mqtt, CONFIG_DEFAULT_MQTT_CUSTOM_ID);
 		#endif
 		mqtt_set_ping_interval(&mqtt, CONFIG_DEFAULT_MQTT_PING_INTERVAL);
+		mqtt_set_publish_window(&mqtt, CONFIG_DEFAULT_MQTT_PUBLISH_WINDOW);
 		mqtt_connect(&mqtt, CONFIG_DEFAULT_MQTT_BROKER_IP, CONFIG_DEFAULT_MQTT_BROKER_PORT);
 		/** @todo advertise the mqtt interface */
 	#endif
@@ -24,7 +24,6 @@
 #include <string.h>
 
 #include "FreeRTOS.h"
-#include "timers.h"
 #include "queue.h"
 #include "task.h"
 #include "semphr.h"
@@ -51,14 +50,9 @@
 /**
  * @todo
  *
- *   - adaptive message sending rate (the rate should be calculated from the block response delivery ratio)
  *   - logging and debug settings
  *   - proper error checking
- *   - piece size calculation
- *   - bitmap size calculation
  *   - transfer rate limiting (+API)
- *   - split file transfer session step
- *   - disable write/read caching, manipulate files directly
  *   - conditional compilation of file request
  */
 
@@ -112,6 +106,10 @@ int32_t file_transfer_receive_handler(FileTransfer *self, const FileTransferMess
 	}
 
 	RELEASE(session->lock);
+
+	/* Step the protocol immediately, do not wait for the next step interval. */
+	xSemaphoreGive(self->main_task_sem);
+
 	return FILE_TRANSFER_RECEIVE_HANDLER_OK;
 }
 
@@ -129,6 +127,7 @@ int32_t file_transfer_init(FileTransfer *self, size_t max_sessions) {
 	}
 	self->session_table_size = max_sessions;
 	memset(self->session_table, 0, sizeof(FtSession) * self->session_table_size);
+	self->max_block_size = FT_MAX_BLOCK_SIZE;
 
 
 	/* Initialize the main protocol task and semaphore. */
@@ -147,15 +146,6 @@ int32_t file_transfer_init(FileTransfer *self, size_t max_sessions) {
 		goto err;
 	}
 
-	/* Initialize the main protocol timer. */
-	self->main_timer = xTimerCreate("filetransfer-timer", FT_STEP_INTERVAL_MS, pdTRUE, (void *)self, file_transfer_timer_callback);
-	if (self->main_timer == NULL) {
-		goto err;
-	}
-	if (xTimerStart(self->main_timer, 10) == pdFAIL) {
-		goto err;
-	}
-
 	/* Enable/disable debugging features. */
 	//~ self->debug = FT_DEBUG_LOGS | FT_DEBUG_MESSAGES;
 
@@ -178,10 +168,6 @@ int32_t file_transfer_free(FileTransfer *self) {
 		free(self->session_table);
 	}
 
-	if (self->main_timer != NULL) {
-		xTimerDelete(self->main_timer, 10);
-	}
-
 	if (self->main_task != NULL) {
 		vTaskDelete(self->main_task);
 	}
@@ -222,6 +208,9 @@ FtSession *file_transfer_init_session(FileTransfer *self) {
 			session = &(self->session_table[i]);
 		}
 	}
+	if (session == NULL) {
+		goto err;
+	}
 
 	session->lock = xSemaphoreCreateMutex();
 	if (session->lock == NULL) {
@@ -233,7 +222,6 @@ FtSession *file_transfer_init_session(FileTransfer *self) {
 	memcpy(session->session_id, &(uint8_t[]){1, 2}, 2);
 	session->session_id_size = 2;
 
-	session->blocks_per_cycle = 5;
 	set_state(self, session, FT_STATE_PREPARED);
 
 	RELEASE(self->session_table_lock);
@@ -258,6 +246,9 @@ FtSession *file_transfer_init_peer_session(FileTransfer *self, const uint8_t *se
 			session = &(self->session_table[i]);
 		}
 	}
+	if (session == NULL) {
+		goto err;
+	}
 
 	session->lock = xSemaphoreCreateMutex();
 	if (session->lock == NULL) {
@@ -270,7 +261,6 @@ FtSession *file_transfer_init_peer_session(FileTransfer *self, const uint8_t *se
 	memcpy(session->session_id, session_id, session_id_size);
 	session->session_id_size = session_id_size;
 
-	session->blocks_per_cycle = 5;
 	set_state(self, session, FT_STATE_PEER);
 
 	RELEASE(self->session_table_lock);
@@ -308,7 +298,6 @@ int32_t file_transfer_send_file(FileTransfer *self, FtSession *session, const ch
 
 	LOCK(session->lock);
 
-	/** @todo save file name, open file, read file properties */
 	size_t fnsize = strlen(file_name);
 	if (fnsize >= FT_MAX_FILE_NAME_SIZE) {
 		fnsize = FT_MAX_FILE_NAME_SIZE - 1;
@@ -316,11 +305,22 @@ int32_t file_transfer_send_file(FileTransfer *self, FtSession *session, const ch
 	memcpy(session->file_name, file_name, fnsize);
 	session->file_name[fnsize] = '\0';
 
-	/** @todo open file, read file properties */
-	session->file_size_bytes = 50000;
-	session->piece_size_blocks = 32;
-	session->block_size_bytes = 32;
+	if (open_file(self, session) != OPEN_FILE_OK) {
+		RELEASE(session->lock);
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("cannot open file '%s'"), file_name);
+		return FILE_TRANSFER_SEND_FILE_FAILED;
+	}
+	session->file_size_bytes = 0;
+	if (self->file_get_size_callback != NULL) {
+		session->file_size_bytes = self->file_get_size_callback(session, session->callback_context, self->file_callback_context);
+	}
+
+	/* The receiver rejects the transfer if the block size is too big. */
+	session->piece_size_blocks = FT_MAX_PIECE_BITMAP_SIZE * 8;
+	session->block_size_bytes = self->max_block_size;
 
+	/* Send the first metadata message in the next step. */
+	session->message_time_ms = FT_FILE_METADATA_MSG_INTERVAL;
 	set_state(self, session, FT_STATE_FILE_METADATA);
 	RELEASE(session->lock);
 
@@ -345,6 +345,8 @@ int32_t file_transfer_receive_file(FileTransfer *self, FtSession *session, const
 	memcpy(session->file_name, file_name, fnsize);
 	session->file_name[fnsize] = '\0';
 
+	/* Send the first file request message in the next step. */
+	session->message_time_ms = FT_FILE_REQUEST_MSG_INTERVAL;
 	set_state(self, session, FT_STATE_FILE_REQUEST);
 	RELEASE(session->lock);
 
@@ -361,7 +363,6 @@ int32_t file_transfer_stop(FileTransfer *self, FtSession *session) {
 	}
 
 	LOCK(session->lock);
-	/** @todo close file here */
 	set_state(self, session, FT_STATE_FINISHED);
 	RELEASE(session->lock);
 
@@ -27,7 +27,6 @@
 #include <stdbool.h>
 
 #include "FreeRTOS.h"
-#include "timers.h"
 #include "queue.h"
 #include "task.h"
 #include "semphr.h"
@@ -55,8 +54,23 @@ enum ft_state {
 
 typedef struct ft_piece {
 	volatile bool used;
+
+	/**
+	 * Receiver: blocks already received. Sender: blocks which should not be sent (not requested by the
+	 * last block request message or already sent).
+	 */
 	uint8_t bitmap[FT_MAX_PIECE_BITMAP_SIZE];
 
+	/**
+	 * Blocks requested and not received yet (receiver only).
+	 */
+	uint8_t requested[FT_MAX_PIECE_BITMAP_SIZE];
+
+	/**
+	 * Time of the last block request message sent for this piece (receiver only).
+	 */
+	uint32_t request_time_ms;
+
 	/**
 	 * Index of the piece within the file. The first piece has index of 0.
 	 */
@@ -74,7 +88,7 @@ typedef struct ft_session_t {
 	enum ft_state state;
 	SemaphoreHandle_t lock;
 
-	uint8_t session_id[FT_SESSION_ID_SIZE];
+	uint8_t session_id[FT_MAX_SESSION_ID_SIZE];
 	size_t session_id_size;
 
 	/* File properties */
@@ -87,16 +101,21 @@ typedef struct ft_session_t {
 	FtPiece pieces[FT_PIECE_CACHE_COUNT];
 	uint32_t next_piece_index;
 
-	/* Number of bits lost in a piece. */
-	uint32_t bits_lost;
+	/* Requested blocks which were not received yet (receiver only). */
+	uint32_t blocks_in_flight;
+
+	/* Number of blocks requested again after the retransmission timeout (receiver only). */
+	uint32_t blocks_lost;
+
+	/* Smoothed time from a block request to the block response and its mean deviation (receiver only). */
+	uint32_t rtt_ms;
+	uint32_t rtt_dev_ms;
 
 	/**
 	 * A variable that may be used by the callback functions to store arbitrary data, such as file descriptors.
 	 */
 	void *callback_context;
-
-	/** @todo block_response_rate_limit */
-	uint8_t blocks_per_cycle;
+	bool file_opened;
 
 	uint32_t transfer_rate_Bps;
 	uint32_t idle_time_ms;
@@ -111,6 +130,12 @@ typedef struct file_transfer_t {
 	size_t session_table_size;
 	SemaphoreHandle_t session_table_lock;
 
+	/**
+	 * Maximum block size this node is able to send or receive (default FT_MAX_BLOCK_SIZE). It should be set
+	 * according to the lower layer MTU. The smaller of the sender and receiver maximum is used for a transfer.
+	 */
+	uint32_t max_block_size;
+
 	/**
 	 * Callbacks for file manipulation.
 	 */
@@ -144,7 +169,6 @@ typedef struct file_transfer_t {
 	#define FILE_TRANSFER_SEND_CALLBACK_FAILED -1
 
 	struct interface_rng *rng;
-	TimerHandle_t main_timer;
 	TaskHandle_t main_task;
 	SemaphoreHandle_t main_task_sem;
 
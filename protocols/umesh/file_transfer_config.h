@@ -28,6 +28,10 @@
 #define FT_MAX_FILE_NAME_SIZE           32
 #endif
 
+/**
+ * The protocol loop is stepped immediately when a message is received. If no message arrives, the loop is stepped
+ * after this interval to handle timeouts and retransmissions.
+ */
 #ifndef FT_STEP_INTERVAL_MS
 #define FT_STEP_INTERVAL_MS             50
 #endif
@@ -47,10 +51,30 @@
 #define FT_SENDER_PIECE_IDLE_MAX        2000
 
 /**
- * How much time can pass from the last block response received on the receiver side before a new block request
- * message is sent to the sender.
+ * Requested blocks which are not received within the retransmission timeout are considered lost and they are
+ * requested again. The timeout is computed from the measured round trip time and it is kept between these limits.
+ */
+#define FT_RECEIVER_RTO_MIN_MS          100
+#define FT_RECEIVER_RTO_MAX_MS          2000
+
+/**
+ * Maximum number of blocks requested by the receiver which were not received yet (blocks in flight). New block
+ * requests are sent as soon as enough blocks arrive to keep the window full.
+ */
+#ifndef FT_WINDOW_BLOCKS
+#define FT_WINDOW_BLOCKS                32
+#endif
+
+/**
+ * Minimum number of free window slots before a new block request is sent. It limits the number of block request
+ * messages if the blocks are arriving one by one.
+ */
+#define FT_REQUEST_MIN_BLOCKS           8
+
+/**
+ * The last block request message (acknowledging the whole file) is repeated to make sure the sender receives it.
  */
-#define FT_RECEIVER_PIECE_IDLE_MAX      500
+#define FT_FINISH_REPEAT                3
 
 /**
  * Nominal and maximum session ID size which can be handled. Session IDs for locally initiated transfers will be set
@@ -69,16 +93,31 @@
 /**
  * Size of the bitmap field in a block request message. If the message has to fit inside the 64 byte message limit,
  * the bitmap size must be 32 bytes at most. Every byte in the bitmap corresponds to 8 block responses, each with
- * a single block of data.
+ * a single block of data. A piece always has FT_MAX_PIECE_BITMAP_SIZE * 8 blocks.
+ */
+#ifndef FT_MAX_PIECE_BITMAP_SIZE
+#define FT_MAX_PIECE_BITMAP_SIZE        8
+#endif
+
+/**
+ * Maximum size of data in a block response message (it must not exceed the size in file_transfer.proto). The block
+ * size used for a transfer is negotiated, it is the smaller of the sender and receiver maximum block size
+ * (FileTransfer.max_block_size). Maximum piece size is calculated as maximum bitmap size multiplied by maximum block
+ * size multiplied by 8. For 8 byte bitmap and 96 byte block size, maximum piece size is 6144 bytes.
+ */
+#ifndef FT_MAX_BLOCK_SIZE
+#define FT_MAX_BLOCK_SIZE               96
+#endif
+
+/**
+ * Size of a block response message without the data. Used to compute the maximum block size from the MTU.
  */
-#define FT_MAX_PIECE_BITMAP_SIZE        4
+#define FT_BLOCK_RESPONSE_OVERHEAD      24
 
 /**
- * Maximum size of data in a block response message. Maximum piece size is calculated as maximum bitmap size
- * multiplied by maximum block size multiplied by 8. For 32 byte bitmap and 32 byte block size, maximum piece size
- * is 8192 bytes.
+ * Block size used if the peer requesting a file does not send its maximum block size.
  */
-#define FT_MAX_BLOCK_SIZE               32
+#define FT_DEFAULT_BLOCK_SIZE           32
 
 #define FT_ENABLE_SUSPEND_RESUME        true
 
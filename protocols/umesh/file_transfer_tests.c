@@ -0,0 +1,447 @@
+/**
+ * File transfer protocol tests
+ *
+ * Copyright (C) 2016, Marek Koza, qyx@krtko.org
+ *
+ * This file is part of uMesh node firmware (http://qyx.krtko.org/projects/umesh)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+
+#include "u_assert.h"
+#include "u_log.h"
+#include "u_test.h"
+
+#include "file_transfer.h"
+#include "file_transfer_tests.h"
+
+#ifdef MODULE_NAME
+#undef MODULE_NAME
+#endif
+#define MODULE_NAME "ft-tests"
+
+
+/**
+ * Two protocol instances are connected with a simulated radio link. Frames take
+ * turns on the air (half-duplex, like with a CSMA MAC), the airtime is computed
+ * from the message size and the link bitrate. Frames are lost independently with
+ * the configured probability.
+ */
+#define FT_TEST_FRAME_OVERHEAD 24 /* L2 header, AE tag, preamble, sync word, CRC */
+#define FT_TEST_QUEUE_LEN 48
+#define FT_TEST_TIME_LIMIT_MS 300000
+
+struct ft_test_frame {
+	FileTransferMessage msg;
+	TickType_t deliver_at;
+};
+
+struct ft_test_node {
+	FileTransfer ft;
+	struct ft_test_node *peer;
+	struct ft_test_link *link;
+
+	QueueHandle_t rxq;
+	volatile bool rx_running;
+
+	uint32_t tx_msgs;
+	uint32_t tx_lost;
+
+	/* Bytes written by the receiver and bytes not matching the source. */
+	uint32_t written;
+	uint32_t errors;
+};
+
+struct ft_test_link {
+	uint32_t file_size;
+	uint32_t loss_permille;
+	uint32_t bitrate;
+	uint32_t latency_ms;
+
+	SemaphoreHandle_t air;
+	uint32_t rnd;
+	volatile bool running;
+
+	struct ft_test_node sender;
+	struct ft_test_node receiver;
+};
+
+static struct ft_test_link ft_test_link;
+
+
+/* Content of the test file, no buffer is needed for large files. */
+static uint8_t file_byte(uint32_t pos) {
+	return (uint8_t)((pos * 2654435761u) >> 24);
+}
+
+
+static uint32_t link_rnd(struct ft_test_link *link) {
+	/* xorshift32, called with the air lock held. */
+	link->rnd ^= link->rnd << 13;
+	link->rnd ^= link->rnd >> 17;
+	link->rnd ^= link->rnd << 5;
+	return link->rnd;
+}
+
+
+static size_t varint_size(uint32_t v) {
+	size_t n = 1;
+	while (v >= 0x80) {
+		v >>= 7;
+		n++;
+	}
+	return n;
+}
+
+
+/* Approximate size of the protobuf encoded message, used to compute the airtime. */
+static size_t encoded_size(const FileTransferMessage *m) {
+	size_t s = 2 + m->session_id.size;
+	size_t c = 0;
+	switch (m->which_content) {
+		case FileTransferMessage_file_metadata_tag: {
+			const FileMetadata *x = &m->content.file_metadata;
+			c = 1 + varint_size(x->file_size_bytes) + 1 + varint_size(x->piece_size_blocks) + 1 + varint_size(x->block_size_bytes);
+			if (x->has_file_name) {
+				c += 2 + x->file_name.size;
+			}
+			break;
+		}
+		case FileTransferMessage_file_request_tag:
+			c = 2 + m->content.file_request.file_name.size + 3;
+			break;
+		case FileTransferMessage_block_request_tag: {
+			const BlockRequest *x = &m->content.block_request;
+			c = 1 + varint_size(x->piece) + 2 + x->bitmap.size + 1 + varint_size(x->transferred_pieces);
+			break;
+		}
+		case FileTransferMessage_block_response_tag: {
+			const BlockResponse *x = &m->content.block_response;
+			c = 1 + varint_size(x->piece) + 1 + varint_size(x->block) + 2 + x->data.size;
+			break;
+		}
+		default:
+			break;
+	}
+	return s + 2 + c;
+}
+
+
+static int32_t send_callback(const FileTransferMessage *msg, FtSession *session, void *context) {
+	(void)session;
+	struct ft_test_node *self = (struct ft_test_node *)context;
+	struct ft_test_link *link = self->link;
+
+	if (!link->running) {
+		return FILE_TRANSFER_SEND_CALLBACK_FAILED;
+	}
+
+	/* Occupy the shared channel for the whole airtime. */
+	size_t bytes = encoded_size(msg) + FT_TEST_FRAME_OVERHEAD;
+	xSemaphoreTake(link->air, portMAX_DELAY);
+	vTaskDelay(pdMS_TO_TICKS((bytes * 8 * 1000 + link->bitrate - 1) / link->bitrate));
+	bool lost = (link_rnd(link) % 1000) < link->loss_permille;
+	xSemaphoreGive(link->air);
+
+	self->tx_msgs++;
+	if (lost) {
+		self->tx_lost++;
+		return FILE_TRANSFER_SEND_CALLBACK_OK;
+	}
+
+	/* The frame is dropped if the receiver is not keeping up, the same as if it was lost. */
+	static struct ft_test_frame frame;
+	xSemaphoreTake(link->air, portMAX_DELAY);
+	frame.msg = *msg;
+	frame.deliver_at = xTaskGetTickCount() + pdMS_TO_TICKS(link->latency_ms);
+	if (xQueueSend(self->peer->rxq, &frame, 0) != pdTRUE) {
+		self->tx_lost++;
+	}
+	xSemaphoreGive(link->air);
+
+	return FILE_TRANSFER_SEND_CALLBACK_OK;
+}
+
+
+static void rx_task(void *p) {
+	struct ft_test_node *self = (struct ft_test_node *)p;
+	/* Too big for the task stack. */
+	static struct ft_test_frame frames[2];
+	struct ft_test_frame *frame = (self == &self->link->sender) ? &frames[0] : &frames[1];
+
+	while (self->link->running) {
+		if (xQueueReceive(self->rxq, frame, pdMS_TO_TICKS(10)) != pdTRUE) {
+			continue;
+		}
+		int32_t d = (int32_t)(frame->deliver_at - xTaskGetTickCount());
+		if (d > 0) {
+			vTaskDelay(d);
+		}
+		if (file_transfer_receive_handler(&self->ft, &frame->msg) == FILE_TRANSFER_RECEIVE_HANDLER_NO_SESSION) {
+			/* A new transfer requested by the peer. */
+			if (file_transfer_init_peer_session(&self->ft, frame->msg.session_id.bytes, frame->msg.session_id.size) != NULL) {
+				file_transfer_receive_handler(&self->ft, &frame->msg);
+			}
+		}
+	}
+
+	self->rx_running = false;
+	vTaskDelete(NULL);
+}
+
+
+static int32_t file_open_callback(FtSession *session, void **session_context, void *context, const char *file_name) {
+	(void)session;
+	(void)file_name;
+	*session_context = context;
+	return FT_FILE_OPEN_CALLBACK_OK;
+}
+
+
+static uint32_t file_get_size_callback(FtSession *session, void *session_context, void *context) {
+	(void)session;
+	(void)session_context;
+	struct ft_test_node *self = (struct ft_test_node *)context;
+	return self->link->file_size;
+}
+
+
+static int32_t file_read_callback(FtSession *session, void *session_context, uint32_t pos, uint8_t *buf, uint32_t len, void *context) {
+	(void)session;
+	(void)session_context;
+	struct ft_test_node *self = (struct ft_test_node *)context;
+	if (pos + len > self->link->file_size) {
+		return FT_FILE_READ_CALLBACK_FAILED;
+	}
+	for (uint32_t i = 0; i < len; i++) {
+		buf[i] = file_byte(pos + i);
+	}
+	return FT_FILE_READ_CALLBACK_OK;
+}
+
+
+static int32_t file_write_callback(FtSession *session, void *session_context, uint32_t pos, const uint8_t *buf, uint32_t len, void *context) {
+	(void)session;
+	(void)session_context;
+	struct ft_test_node *self = (struct ft_test_node *)context;
+	if (pos + len > self->link->file_size) {
+		return FT_FILE_WRITE_CALLBACK_FAILED;
+	}
+	for (uint32_t i = 0; i < len; i++) {
+		if (buf[i] != file_byte(pos + i)) {
+			self->errors++;
+		}
+	}
+	self->written += len;
+	return FT_FILE_WRITE_CALLBACK_OK;
+}
+
+
+static int32_t file_close_callback(FtSession *session, void *session_context, void *context) {
+	(void)session;
+	(void)session_context;
+	(void)context;
+	return FT_FILE_CLOSE_CALLBACK_OK;
+}
+
+
+static bool node_init(struct ft_test_link *link, struct ft_test_node *self, struct ft_test_node *peer) {
+	memset(self, 0, sizeof(struct ft_test_node));
+	self->link = link;
+	self->peer = peer;
+
+	self->rxq = xQueueCreate(FT_TEST_QUEUE_LEN, sizeof(struct ft_test_frame));
+	if (self->rxq == NULL) {
+		return false;
+	}
+	if (file_transfer_init(&self->ft, 2) != FILE_TRANSFER_INIT_OK) {
+		vQueueDelete(self->rxq);
+		return false;
+	}
+	self->ft.file_callback_context = self;
+	self->ft.file_open_callback = file_open_callback;
+	self->ft.file_get_size_callback = file_get_size_callback;
+	self->ft.file_read_callback = file_read_callback;
+	self->ft.file_write_callback = file_write_callback;
+	self->ft.file_close_callback = file_close_callback;
+	self->ft.send_callback = send_callback;
+	self->ft.send_context = self;
+
+	TaskHandle_t task = NULL;
+	self->rx_running = true;
+	xTaskCreate(rx_task, "ft-test-rx", configMINIMAL_STACK_SIZE + 256, (void *)self, 1, &task);
+	if (task == NULL) {
+		self->rx_running = false;
+		file_transfer_free(&self->ft);
+		vQueueDelete(self->rxq);
+		return false;
+	}
+
+	return true;
+}
+
+
+static void node_free(struct ft_test_node *self) {
+	/* The link is not running anymore, wait for the receiving task to finish. */
+	while (self->rx_running) {
+		vTaskDelay(pdMS_TO_TICKS(10));
+	}
+	file_transfer_free(&self->ft);
+	vQueueDelete(self->rxq);
+}
+
+
+static enum ft_state node_state(struct ft_test_node *self) {
+	for (size_t i = 0; i < self->ft.session_table_size; i++) {
+		if (self->ft.session_table[i].state != FT_STATE_EMPTY) {
+			return self->ft.session_table[i].state;
+		}
+	}
+	return FT_STATE_EMPTY;
+}
+
+
+static bool node_done(struct ft_test_node *self) {
+	enum ft_state state = node_state(self);
+	return state == FT_STATE_FINISHED || state == FT_STATE_FAILED;
+}
+
+
+/**
+ * Let the receiver request a file from the sender and wait until both of them
+ * finish. Return true if the whole file was received correctly.
+ */
+static bool transfer(uint32_t file_size, uint32_t loss_permille, uint32_t *time_ms) {
+	struct ft_test_link *link = &ft_test_link;
+	memset(link, 0, sizeof(struct ft_test_link));
+	link->file_size = file_size;
+	link->loss_permille = loss_permille;
+	link->bitrate = 100000;
+	link->latency_ms = 5;
+	link->rnd = 0x12345678;
+	link->running = true;
+
+	link->air = xSemaphoreCreateMutex();
+	if (link->air == NULL) {
+		return false;
+	}
+	if (!node_init(link, &link->sender, &link->receiver)) {
+		vSemaphoreDelete(link->air);
+		return false;
+	}
+	if (!node_init(link, &link->receiver, &link->sender)) {
+		link->running = false;
+		node_free(&link->sender);
+		vSemaphoreDelete(link->air);
+		return false;
+	}
+
+	bool ret = false;
+	TickType_t start = xTaskGetTickCount();
+	FtSession *session = file_transfer_init_session(&link->receiver.ft);
+	if (session != NULL && file_transfer_receive_file(&link->receiver.ft, session, "test.bin") == FILE_TRANSFER_RECEIVE_FILE_OK) {
+		while ((xTaskGetTickCount() - start) < pdMS_TO_TICKS(FT_TEST_TIME_LIMIT_MS)) {
+			if (node_done(&link->receiver) && node_done(&link->sender)) {
+				break;
+			}
+			vTaskDelay(pdMS_TO_TICKS(5));
+		}
+		*time_ms = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+
+		ret = node_state(&link->receiver) == FT_STATE_FINISHED &&
+			node_state(&link->sender) == FT_STATE_FINISHED &&
+			link->receiver.written >= file_size &&
+			link->receiver.errors == 0;
+	}
+
+	link->running = false;
+	node_free(&link->receiver);
+	node_free(&link->sender);
+	vSemaphoreDelete(link->air);
+
+	return ret;
+}
+
+
+/**
+ * Test if an empty file can be transferred.
+ */
+static bool file_transfer_test_empty_file_if_ok(void) {
+	uint32_t time_ms = 0;
+	return transfer(0, 0, &time_ms);
+}
+
+
+/**
+ * Test if files shorter than a block, one byte longer than a block and longer
+ * than a piece (64 blocks) can be transferred.
+ */
+static bool file_transfer_test_short_files_if_ok(void) {
+	uint32_t time_ms = 0;
+	return transfer(1, 0, &time_ms) &&
+		transfer(97, 0, &time_ms) &&
+		transfer(6145, 0, &time_ms);
+}
+
+
+/**
+ * Test if lost blocks and requests are retransmitted and the file is received
+ * correctly over a link with 30 % frame loss.
+ */
+static bool file_transfer_test_lossy_link_if_ok(void) {
+	uint32_t time_ms = 0;
+	return transfer(6145, 300, &time_ms);
+}
+
+
+bool file_transfer_tests(void) {
+	bool res = true;
+
+	res &= u_test(file_transfer_test_empty_file_if_ok());
+	res &= u_test(file_transfer_test_short_files_if_ok());
+	res &= u_test(file_transfer_test_lossy_link_if_ok());
+
+	return res;
+}
+
+
+bool file_transfer_tests_throughput(void) {
+	const uint32_t loss_permille[] = {0, 50, 100, 200};
+	bool res = true;
+
+	for (size_t i = 0; i < sizeof(loss_permille) / sizeof(loss_permille[0]); i++) {
+		uint32_t time_ms = 0;
+		bool r = transfer(256 * 1024, loss_permille[i], &time_ms);
+		u_log(system_log, r ? LOG_TYPE_INFO : LOG_TYPE_ERROR,
+			U_LOG_MODULE_PREFIX("256 KiB, 100 kbit/s, loss %u %%: %s in %u.%03u s"),
+			loss_permille[i] / 10,
+			r ? "received" : "failed",
+			time_ms / 1000,
+			time_ms % 1000
+		);
+		res &= r;
+	}
+
+	return res;
+}
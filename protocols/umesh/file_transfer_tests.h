@@ -0,0 +1,42 @@
+/**
+ * File transfer protocol tests
+ *
+ * Copyright (C) 2016, Marek Koza, qyx@krtko.org
+ *
+ * This file is part of uMesh node firmware (http://qyx.krtko.org/projects/umesh)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FILE_TRANSFER_TESTS_H_
+#define _FILE_TRANSFER_TESTS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Transfer short files between two protocol instances connected with
+ * a simulated lossy half-duplex link.
+ */
+bool file_transfer_tests(void);
+
+/**
+ * Transfer a 256 KiB file over a 100 kbit/s simulated link with 0, 5, 10
+ * and 20 % frame loss and log the transfer time. Each run takes about
+ * a minute of real time.
+ */
+bool file_transfer_tests_throughput(void);
+
+
+#endif
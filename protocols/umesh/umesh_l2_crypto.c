@@ -36,7 +36,7 @@ int32_t umesh_l2_data_authenticate(const uint8_t *data, uint32_t data_len, const
 
 	if (algo == UMESH_L2_AUTH_ALGO_POLY1305) {
 		/* Check parameters for Poly1305. */
-		if (u_assert(key_len >= 16 && tag_len > 0 && tag_len <= 16)) {
+		if (u_assert(key_len >= 32 && tag_len > 0 && tag_len <= 16)) {
 			return UMESH_L2_DATA_AUTHENTICATE_FAILED;
 		}
 
@@ -44,22 +44,15 @@ int32_t umesh_l2_data_authenticate(const uint8_t *data, uint32_t data_len, const
 		uint8_t poly1305_tag[16];
 		poly1305(poly1305_tag, data, data_len, key);
 
-		//~ u_log(system_log, LOG_TYPE_DEBUG, "rx poly len = %u", header_len + len - tag_len);
-
-		if (memcmp(poly1305_tag, tag, tag_len)) {
-			//~ u_log(system_log, LOG_TYPE_DEBUG, "compare %02x%02x%02x%02x != %02x%02x%02x%02x",
-				//~ poly1305_tag[0],
-				//~ poly1305_tag[1],
-				//~ poly1305_tag[2],
-				//~ poly1305_tag[3],
-				//~ tag[0],
-				//~ tag[1],
-				//~ tag[2],
-				//~ tag[3]
-			//~ );
+		/* Compare in constant time, do not leak the position
+		 * of the first differing byte. */
+		uint8_t diff = 0;
+		for (uint32_t i = 0; i < tag_len; i++) {
+			diff |= poly1305_tag[i] ^ tag[i];
+		}
+		if (diff != 0) {
 			return UMESH_L2_DATA_AUTHENTICATE_FAILED;
 		}
-		//~ u_log(system_log, LOG_TYPE_DEBUG, "compare ok, tag_len = %u", tag_len);
 		return UMESH_L2_DATA_AUTHENTICATE_OK;
 	}
 
@@ -68,17 +61,37 @@ int32_t umesh_l2_data_authenticate(const uint8_t *data, uint32_t data_len, const
 }
 
 
-int32_t umesh_l2_get_ctr_keystream(uint8_t *keystream, uint32_t keystream_len, const uint8_t *key, uint32_t key_len, uint32_t nonce, uint32_t counter, enum umesh_l2_enc_algo algo) {
+int32_t umesh_l2_cipher_init(struct umesh_l2_cipher *cipher, const uint8_t *key, uint32_t key_len, enum umesh_l2_enc_algo algo) {
+	if (u_assert(cipher != NULL) ||
+	    u_assert(key != NULL)) {
+		return UMESH_L2_CIPHER_INIT_FAILED;
+	}
 
 	if (algo == UMESH_L2_ENC_ALGO_CHACHA20) {
-		if (u_assert(key_len == 16 || key_len == 32) ||
-		    u_assert(keystream_len <= 64)) {
-			return UMESH_L2_GET_CTR_KEYSTREAM_FAILED;
+		if (u_assert(key_len == 16 || key_len == 32)) {
+			return UMESH_L2_CIPHER_INIT_FAILED;
 		}
 
-		struct chacha20_context_t ctx;
+		chacha20_keysetup(&cipher->chacha20, key, key_len * 8);
+		cipher->algo = algo;
+
+		return UMESH_L2_CIPHER_INIT_OK;
+	}
+
+	return UMESH_L2_CIPHER_INIT_FAILED;
+}
 
-		chacha20_keysetup(&ctx, key, key_len * 8);
+
+int32_t umesh_l2_cipher_process(const struct umesh_l2_cipher *cipher, uint32_t nonce, uint8_t *auth_key, uint8_t *dst, const uint8_t *src, uint32_t len) {
+	if (u_assert(cipher != NULL) ||
+	    u_assert(auth_key != NULL) ||
+	    u_assert(len == 0 || (dst != NULL && src != NULL))) {
+		return UMESH_L2_CIPHER_PROCESS_FAILED;
+	}
+
+	if (cipher->algo == UMESH_L2_ENC_ALGO_CHACHA20) {
+		/* Work on a copy, the cached cipher is shared. */
+		chacha20_context ctx = cipher->chacha20;
 		chacha20_nonce(&ctx, (uint8_t[]) {
 			(nonce >> 24) & 0xff,
 			(nonce >> 16) & 0xff,
@@ -89,52 +102,17 @@ int32_t umesh_l2_get_ctr_keystream(uint8_t *keystream, uint32_t keystream_len, c
 			0,
 			0
 		});
-		chacha20_counter(&ctx, counter);
-		uint8_t k[64];
-		chacha20_keystream(&ctx, k);
-
-		memcpy(keystream, k, keystream_len);
 
-		return UMESH_L2_GET_CTR_KEYSTREAM_OK;
-	}
-
-	return UMESH_L2_GET_CTR_KEYSTREAM_FAILED;
-}
-
-
-int32_t umesh_l2_decrypt(uint8_t *dst, uint32_t dst_len, const uint8_t **src, uint32_t src_len, const uint8_t *key, uint32_t key_len, uint32_t nonce, enum umesh_l2_enc_algo algo) {
-	if (src_len > dst_len || nonce == 0) {
-		return UMESH_L2_DECRYPT_FAILED;
-	}
+		/* The authentication key is the first half of block 0, the
+		 * counter is advanced to 1 afterwards. */
+		uint8_t k[64];
+		chacha20_keystream_blocks(&ctx, k, 1);
+		memcpy(auth_key, k, 32);
 
-	if (algo == UMESH_L2_ENC_ALGO_CHACHA20) {
+		chacha20_xor(&ctx, dst, src, len);
 
-		uint16_t counter = 1;
-		while (src_len > 0) {
-
-			uint8_t keystream[64];
-			umesh_l2_get_ctr_keystream(keystream, sizeof(keystream), key, key_len, nonce, counter, algo);
-			counter++;
-
-			/* We are processing in 64 byte blocks if there is
-			 * enough data. Process the tail as a smaller block. */
-			uint32_t bytes = 64;
-			if (src_len < 64) {
-				bytes = src_len;
-			}
-
-			/* XOR the original data from the packet buffer with
-			 * the generated keystream. Advance to the next block. */
-			for (uint32_t i = 0; i < bytes; i++) {
-				*dst = **src ^ keystream[i];
-				dst++;
-				(*src)++;
-			}
-			src_len -= bytes;
-		}
-		return UMESH_L2_DECRYPT_OK;
+		return UMESH_L2_CIPHER_PROCESS_OK;
 	}
 
-	return UMESH_L2_DECRYPT_FAILED;
+	return UMESH_L2_CIPHER_PROCESS_FAILED;
 }
-
@@ -24,21 +24,40 @@
 
 #include <stdint.h>
 
+#include "umesh_l2_pbuf.h"
+#include "chacha20.h"
+
+
+/**
+ * Cipher with the key already expanded. It is initialized once when a session
+ * key is established and it is shared by all packets using the key.
+ */
+struct umesh_l2_cipher {
+	enum umesh_l2_enc_algo algo;
+	chacha20_context chacha20;
+};
+
 
 int32_t umesh_l2_data_authenticate(const uint8_t *data, uint32_t data_len,
 	const uint8_t *key, uint32_t key_len, const uint8_t *tag, uint32_t tag_len, enum umesh_l2_auth_algo algo);
 #define UMESH_L2_DATA_AUTHENTICATE_OK 0
 #define UMESH_L2_DATA_AUTHENTICATE_FAILED -1
 
-int32_t umesh_l2_get_ctr_keystream(uint8_t *keystream, uint32_t keystream_len, const uint8_t *key, uint32_t key_len,
-	uint32_t nonce, uint32_t counter, enum umesh_l2_enc_algo algo);
-#define UMESH_L2_GET_CTR_KEYSTREAM_OK 0
-#define UMESH_L2_GET_CTR_KEYSTREAM_FAILED -1
+int32_t umesh_l2_cipher_init(struct umesh_l2_cipher *cipher, const uint8_t *key, uint32_t key_len, enum umesh_l2_enc_algo algo);
+#define UMESH_L2_CIPHER_INIT_OK 0
+#define UMESH_L2_CIPHER_INIT_FAILED -1
 
-int32_t umesh_l2_decrypt(uint8_t *dst, uint32_t dst_len, const uint8_t **src, uint32_t src_len,
-	const uint8_t *key, uint32_t key_len, uint32_t nonce, enum umesh_l2_enc_algo algo);
-#define UMESH_L2_DECRYPT_OK 0
-#define UMESH_L2_DECRYPT_FAILED -1
+/**
+ * Process a single packet in the counter mode. Keystream block 0 is used
+ * to derive the one-time authentication key, data are encrypted or decrypted
+ * using blocks starting at 1. The cached cipher is not modified.
+ *
+ * @param auth_key Buffer for the one-time authentication key (32 bytes).
+ * @param dst Output buffer, may be the same as @p src.
+ */
+int32_t umesh_l2_cipher_process(const struct umesh_l2_cipher *cipher, uint32_t nonce, uint8_t *auth_key,
+	uint8_t *dst, const uint8_t *src, uint32_t len);
+#define UMESH_L2_CIPHER_PROCESS_OK 0
+#define UMESH_L2_CIPHER_PROCESS_FAILED -1
 
 #endif
-
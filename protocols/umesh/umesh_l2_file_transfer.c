@@ -261,6 +261,12 @@ int32_t umesh_l2_file_transfer_init(L2FileTransfer *self, uint32_t table_size) {
 		return UMESH_L2_FILE_TRANSFER_INIT_FAILED;
 	}
 
+	/* Use the biggest block which fits in a single L2 packet. */
+	self->file_transfer.max_block_size = self->pbuf.size - FT_BLOCK_RESPONSE_OVERHEAD;
+	if (self->file_transfer.max_block_size > FT_MAX_BLOCK_SIZE) {
+		self->file_transfer.max_block_size = FT_MAX_BLOCK_SIZE;
+	}
+
 	/* Set protocol callbacks. */
 	self->file_transfer.file_callback_context = (void *)self;
 	self->file_transfer.file_open_callback = file_open_callback;
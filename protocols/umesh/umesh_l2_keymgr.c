@@ -259,7 +259,12 @@ static int32_t umesh_l2_keymgr_ake_3dh_result_callback(Ake3dhSession *session, e
 	if (result == AKE_3DH_RESULT_OK) {
 		memcpy(km_session->master_tx_key, session->master_tx_key, UMESH_L2_KEYMGR_MASTER_TX_KEY_SIZE);
 		memcpy(km_session->master_rx_key, session->master_rx_key, UMESH_L2_KEYMGR_MASTER_RX_KEY_SIZE);
-		set_session_state(self, km_session, UMESH_L2_KEYMGR_SESSION_STATE_AUTH);
+		if (umesh_l2_cipher_init(&km_session->tx_cipher, km_session->master_tx_key, UMESH_L2_KEYMGR_MASTER_TX_KEY_SIZE, UMESH_L2_ENC_ALGO_CHACHA20) == UMESH_L2_CIPHER_INIT_OK &&
+		    umesh_l2_cipher_init(&km_session->rx_cipher, km_session->master_rx_key, UMESH_L2_KEYMGR_MASTER_RX_KEY_SIZE, UMESH_L2_ENC_ALGO_CHACHA20) == UMESH_L2_CIPHER_INIT_OK) {
+			set_session_state(self, km_session, UMESH_L2_KEYMGR_SESSION_STATE_AUTH);
+		} else {
+			set_session_state(self, km_session, UMESH_L2_KEYMGR_SESSION_STATE_NAUTH);
+		}
 	}
 	if (result == AKE_3DH_RESULT_FAILED) {
 		set_session_state(self, km_session, UMESH_L2_KEYMGR_SESSION_STATE_NAUTH);
@@ -623,3 +628,30 @@ L2KeyManagerSession *umesh_l2_keymgr_find_session(L2KeyManager *self, uint32_t p
 
 	return best_result;
 }
+
+
+int32_t umesh_l2_keymgr_session_tx_nonce(L2KeyManager *self, L2KeyManagerSession *session, uint16_t *nonce) {
+	if (u_assert(self != NULL) ||
+	    u_assert(session != NULL) ||
+	    u_assert(nonce != NULL)) {
+		return UMESH_L2_KEYMGR_SESSION_TX_NONCE_FAILED;
+	}
+
+	if (session->tx_nonce >= UMESH_L2_KEYMGR_TX_NONCE_COUNT) {
+		return UMESH_L2_KEYMGR_SESSION_TX_NONCE_EXHAUSTED;
+	}
+	*nonce = (uint16_t)session->tx_nonce;
+	session->tx_nonce++;
+
+	if (session->tx_nonce == UMESH_L2_KEYMGR_TX_NONCE_REKEY) {
+		/* Start the key exchange early, the new session should be ready before this one is exhausted. */
+		u_log(system_log, LOG_TYPE_INFO, U_LOG_MODULE_PREFIX("session %p: nonces running out, rekeying"), (void *)session);
+		umesh_l2_keymgr_manage(self, session->peer_tid);
+	}
+	if (session->tx_nonce == UMESH_L2_KEYMGR_TX_NONCE_COUNT) {
+		/* Never use the key again, the newer session is used by the find function. */
+		set_session_state(self, session, UMESH_L2_KEYMGR_SESSION_STATE_EXPIRED);
+	}
+
+	return UMESH_L2_KEYMGR_SESSION_TX_NONCE_OK;
+}
@@ -48,6 +48,7 @@
 
 #include "interface_rng.h"
 #include "ake_3dh.h"
+#include "umesh_l2_crypto.h"
 
 
 enum umesh_l2_keymgr_session_state {
@@ -97,6 +98,13 @@ enum umesh_l2_keymgr_session_state {
 #define UMESH_L2_KEYMGR_MASTER_RX_KEY_SIZE       32
 #define UMESH_L2_KEYMGR_IDENTITY_SIZE            32
 
+/**
+ * The packet counter used as the nonce is 16 bits long. A new session with the peer is started when
+ * UMESH_L2_KEYMGR_TX_NONCE_REKEY nonces are used, the session expires after the last one.
+ */
+#define UMESH_L2_KEYMGR_TX_NONCE_COUNT           65536
+#define UMESH_L2_KEYMGR_TX_NONCE_REKEY           49152
+
 /**
  * A single key management session created between us and our neighbor. There may be neighbors without any
  * active session created (ie. when there are no resources available, a node may decide to create key management
@@ -121,6 +129,16 @@ typedef struct umesh_l2_keymgr_session {
 	uint8_t master_tx_key[UMESH_L2_KEYMGR_MASTER_TX_KEY_SIZE];
 	uint8_t master_rx_key[UMESH_L2_KEYMGR_MASTER_RX_KEY_SIZE];
 
+	/**
+	 * Ciphers set up from the master keys when the session is authenticated. They are used directly by the
+	 * layer 2 send/receive functions to avoid the key setup for every packet.
+	 */
+	struct umesh_l2_cipher tx_cipher;
+	struct umesh_l2_cipher rx_cipher;
+
+	/** Nonce of the next packet encrypted with the tx_cipher. */
+	uint32_t tx_nonce;
+
 	uint8_t peer_identity[UMESH_L2_KEYMGR_IDENTITY_SIZE];
 
 } L2KeyManagerSession;
@@ -185,4 +203,22 @@ int32_t umesh_l2_keymgr_manage(L2KeyManager *self, uint32_t tid);
  */
 L2KeyManagerSession *umesh_l2_keymgr_find_session(L2KeyManager *self, uint32_t peer_tid);
 
+/**
+ * @brief Get a nonce for the next packet encrypted with the session tx cipher
+ *
+ * No nonce is returned twice for the same session (the same key). A new session is started in advance when
+ * UMESH_L2_KEYMGR_TX_NONCE_REKEY nonces were used, the session is expired when the last nonce is used.
+ *
+ * @param self L2 key manager instance
+ * @param session Session the nonce is requested for
+ * @param nonce The nonce to be used for the packet
+ *
+ * @return UMESH_L2_KEYMGR_SESSION_TX_NONCE_EXHAUSTED if all nonces were already used,
+ *         UMESH_L2_KEYMGR_SESSION_TX_NONCE_OK otherwise.
+ */
+int32_t umesh_l2_keymgr_session_tx_nonce(L2KeyManager *self, L2KeyManagerSession *session, uint16_t *nonce);
+#define UMESH_L2_KEYMGR_SESSION_TX_NONCE_OK 0
+#define UMESH_L2_KEYMGR_SESSION_TX_NONCE_FAILED -1
+#define UMESH_L2_KEYMGR_SESSION_TX_NONCE_EXHAUSTED -2
+
 extern const char *umesh_l2_keymgr_states[];
@@ -108,7 +108,6 @@ struct umesh_l2_nbtable_item {
 	int32_t fei_hz;
 	int16_t rssi_10dBm;
 	uint8_t lqi_percent;
-	uint16_t txcounter;
 	uint32_t rx_packets;
 	uint32_t rx_packets_dropped;
 	uint32_t rx_bytes;
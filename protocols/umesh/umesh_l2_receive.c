@@ -37,11 +37,6 @@
 #include "umesh_l2_crypto.h"
 
 
-static const uint8_t test_key[] = {
-	0xb0, 0x03, 0x44, 0xb5, 0xbe, 0x2c, 0x1e, 0x3c, 0x91, 0x29, 0xfe, 0x27, 0x2d, 0x99, 0x10, 0x90,
-	0x3f, 0xce, 0x32, 0xc5, 0x68, 0x16, 0x56, 0x37, 0xfe, 0xda, 0xa8, 0x53, 0x70, 0xae, 0xd1, 0x10
-};
-
 /**
  * @section node-identification Node identification
  *
@@ -236,22 +231,24 @@ int32_t umesh_l2_receive(struct module_umesh *umesh, const uint8_t *data, size_t
 	/* If the STID was parsed successfully, we can assign the packet to an
 	 * existing neighbor (if it is added in the neighbor table). We will
 	 * use this information to update per-neighbor statistics. */
-	uint8_t *peer_key = NULL;
-	uint32_t peer_key_len = 0;
+	const struct umesh_l2_cipher *peer_cipher = NULL;
 	if (umesh_l2_nbtable_find(&(umesh->nbtable), umesh->l2_pbuf.stid, &nbtable_item) == UMESH_L2_NBTABLE_FIND_OK) {
 		umesh->l2_pbuf.known_neighbor = true;
 
-		/** @todo */
-		//~ peer_key = nbtable_item->rxkey;
-		//~ peer_key_len = UMESH_L2_NBTABLE_RXKEY_SIZE;
-		peer_key = test_key;
-		peer_key_len = 32;
+		/* Encrypted packets can be received from neighbors with
+		 * a managed key manager session only. */
+		if (umesh->nbtable.key_manager != NULL) {
+			L2KeyManagerSession *session = umesh_l2_keymgr_find_session(umesh->nbtable.key_manager, umesh->l2_pbuf.stid);
+			if (session != NULL) {
+				peer_cipher = &session->rx_cipher;
+			}
+		}
 	}
 
 	/* Parse and optionally decrypt/authenticate the packet data. Start of
 	 * the header data is passed as the first argument to allow the header
 	 * to be authenticated together with the packet data. */
-	if (umesh_l2_parse_data(data, &pos, len - (pos - data), &(umesh->l2_pbuf), peer_key, peer_key_len) != UMESH_L2_PARSE_DATA_OK) {
+	if (umesh_l2_parse_data(data, &pos, len - (pos - data), &(umesh->l2_pbuf), peer_cipher) != UMESH_L2_PARSE_DATA_OK) {
 		if (umesh->l2_debug_packet_rx_error) {
 			u_log(system_log, LOG_TYPE_DEBUG, "%s: umesh_l2_receive: data failed", umesh->module.name);
 		}
@@ -529,7 +526,7 @@ int32_t umesh_l2_parse_counter(const uint8_t **data, uint32_t *len, uint16_t *co
  * checks or encryption, error checked, error corrected, encrypted or encrypted
  * and authenticated. Complete list of supported modes is in umesh_l2_receive,h
  */
-int32_t umesh_l2_parse_data(const uint8_t *header, const uint8_t **data, uint32_t len, struct umesh_l2_pbuf *pbuf, uint8_t *key, uint32_t key_len) {
+int32_t umesh_l2_parse_data(const uint8_t *header, const uint8_t **data, uint32_t len, struct umesh_l2_pbuf *pbuf, const struct umesh_l2_cipher *cipher) {
 	if (u_assert(data != NULL && *data != NULL && pbuf != NULL && header != NULL && *data > header)) {
 		return UMESH_L2_PARSE_DATA_FAILED;
 	}
@@ -604,23 +601,36 @@ int32_t umesh_l2_parse_data(const uint8_t *header, const uint8_t **data, uint32_
 				return UMESH_L2_PARSE_DATA_NO_DATA;
 			}
 
+			if (cipher == NULL) {
+				return UMESH_L2_PARSE_DATA_FAILED;
+			}
+
+			/* Check if the destination buffer is big enough. */
+			if ((len - 2 - tag_len) > pbuf->size) {
+				return UMESH_L2_PARSE_DATA_TOO_BIG;
+			}
+
 			if (umesh_l2_parse_counter(data, &len, &(pbuf->counter)) != UMESH_L2_PARSE_COUNTER_OK) {
 				return UMESH_L2_PARSE_DATA_FAILED;
 			}
 
-			/* Generate a key for Poly1305. Use Chacha20 counter value
-			 * of zero for this purpose. Verify the data. */
+			/* Decrypt the data in a single pass, the Poly1305 key
+			 * (chacha20 block 0) is generated with it. The packet
+			 * buffer is not valid until the data is verified. */
+			uint32_t data_len = len - tag_len;
 			uint8_t poly1305_key[32];
-			umesh_l2_get_ctr_keystream(poly1305_key, sizeof(poly1305_key), test_key, 32, pbuf->counter, 0, UMESH_L2_ENC_ALGO_CHACHA20);
-			if (umesh_l2_data_authenticate(header, header_len + 2 + len - tag_len, poly1305_key, 16, *data + len - tag_len, tag_len, UMESH_L2_AUTH_ALGO_POLY1305) != UMESH_L2_DATA_AUTHENTICATE_OK) {
+			if (umesh_l2_cipher_process(cipher, pbuf->counter, poly1305_key, pbuf->data, *data, data_len) != UMESH_L2_CIPHER_PROCESS_OK) {
+				return UMESH_L2_PARSE_DATA_FAILED;
+			}
+			if (umesh_l2_data_authenticate(header, header_len + 2 + data_len, poly1305_key, sizeof(poly1305_key), *data + data_len, tag_len, UMESH_L2_AUTH_ALGO_POLY1305) != UMESH_L2_DATA_AUTHENTICATE_OK) {
+				memset(pbuf->data, 0, data_len);
 				return UMESH_L2_PARSE_DATA_AE_FAILED;
 			}
 
-			/* Everything is ok so far, set the packet security and
-			 * decrypt the data.  */
+			/* Everything is ok, set the packet security. */
 			pbuf->sec_type = UMESH_L2_PBUF_SECURITY_AE;
-			pbuf->len = len - tag_len;
-			umesh_l2_decrypt(pbuf->data, pbuf->size, data, pbuf->len, test_key, 32, pbuf->counter, UMESH_L2_ENC_ALGO_CHACHA20);
+			pbuf->len = data_len;
+			(*data) += len;
 
 			break;
 		}
@@ -28,6 +28,7 @@
 #include "hal_module.h"
 #include "interface_mac.h"
 #include "module_umesh.h"
+#include "umesh_l2_crypto.h"
 
 
 void umesh_l2_receive_task(void *p);
@@ -61,7 +62,7 @@ int32_t umesh_l2_parse_counter(const uint8_t **data, uint32_t *len, uint16_t *co
 #define UMESH_L2_PARSE_COUNTER_FAILED -1
 
 /** @todo documentation */
-int32_t umesh_l2_parse_data(const uint8_t *header, const uint8_t **data, uint32_t len, struct umesh_l2_pbuf *pbuf, uint8_t *key, uint32_t key_len);
+int32_t umesh_l2_parse_data(const uint8_t *header, const uint8_t **data, uint32_t len, struct umesh_l2_pbuf *pbuf, const struct umesh_l2_cipher *cipher);
 #define UMESH_L2_PARSE_DATA_OK 0
 #define UMESH_L2_PARSE_DATA_FAILED -1
 #define UMESH_L2_PARSE_DATA_AE_FAILED -2
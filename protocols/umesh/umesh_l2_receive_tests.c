@@ -30,9 +30,17 @@
 
 #include "umesh_l2_receive.h"
 #include "umesh_l2_pbuf.h"
+#include "umesh_l2_crypto.h"
 #include "umesh_l2_receive_tests.h"
 
 
+/* Key used for all ChaCha20-Poly1305 tests. */
+static const uint8_t test_key[32] = {
+	0xb0, 0x03, 0x44, 0xb5, 0xbe, 0x2c, 0x1e, 0x3c, 0x91, 0x29, 0xfe, 0x27, 0x2d, 0x99, 0x10, 0x90,
+	0x3f, 0xce, 0x32, 0xc5, 0x68, 0x16, 0x56, 0x37, 0xfe, 0xda, 0xa8, 0x53, 0x70, 0xae, 0xd1, 0x10
+};
+
+
 /**
  * Test if TID parsing works for TIDs lower than 128. Buffer is long enough.
  */
@@ -345,7 +353,7 @@ static bool umesh_l2_parse_data_empty_packet_if_works(void) {
 	umesh_l2_pbuf_init(&test);
 	test.sec_algo = UMESH_L2_SECURITY_ALGO_NONE;
 
-	int32_t res = umesh_l2_parse_data(buf, &pos, 0, &test, NULL, 0);
+	int32_t res = umesh_l2_parse_data(buf, &pos, 0, &test, NULL);
 
 	bool ret = (pos = buf + 2) && (res == UMESH_L2_PARSE_DATA_OK) && (test.len == 0);
 
@@ -366,7 +374,7 @@ static bool umesh_l2_parse_data_plaintext_small_packet_if_works(void) {
 	umesh_l2_pbuf_init(&test);
 	test.sec_algo = UMESH_L2_SECURITY_ALGO_NONE;
 
-	int32_t res = umesh_l2_parse_data(buf, &pos, 5, &test, NULL, 0);
+	int32_t res = umesh_l2_parse_data(buf, &pos, 5, &test, NULL);
 
 	bool ret = (pos = buf + 7) && (res == UMESH_L2_PARSE_DATA_OK) && (test.len == 5) && !memcmp(buf + 2, test.data, 5);
 
@@ -387,7 +395,7 @@ static bool umesh_l2_parse_data_too_big_packet_if_fails(void) {
 	umesh_l2_pbuf_init(&test);
 	test.sec_algo = UMESH_L2_SECURITY_ALGO_NONE;
 
-	int32_t res = umesh_l2_parse_data(buf, &pos, UMESH_L2_PACKET_SIZE + 1, &test, NULL, 0);
+	int32_t res = umesh_l2_parse_data(buf, &pos, UMESH_L2_PACKET_SIZE + 1, &test, NULL);
 
 	bool ret = (res == UMESH_L2_PARSE_DATA_TOO_BIG);
 
@@ -409,7 +417,7 @@ static bool umesh_l2_parse_data_unsupported_if_fails(void) {
 	/* Set manually to some unsupported method. */
 	test.sec_algo = 7;
 
-	int32_t res = umesh_l2_parse_data(buf, &pos, 1, &test, NULL, 0);
+	int32_t res = umesh_l2_parse_data(buf, &pos, 1, &test, NULL);
 
 	bool ret = (res == UMESH_L2_PARSE_DATA_UNSUPPORTED);
 
@@ -431,7 +439,7 @@ static bool umesh_l2_parse_data_crc16_if_works(void) {
 	umesh_l2_pbuf_init(&test);
 	test.sec_algo = UMESH_L2_SECURITY_ALGO_CRC16_CCITT;
 
-	int32_t res = umesh_l2_parse_data(buf, &pos, 7, &test, NULL, 0);
+	int32_t res = umesh_l2_parse_data(buf, &pos, 7, &test, NULL);
 
 	bool ret = (res == UMESH_L2_PARSE_DATA_OK) && (test.len == 5);
 
@@ -453,7 +461,7 @@ static bool umesh_l2_parse_data_crc16_bad_crc_if_fails(void) {
 	umesh_l2_pbuf_init(&test);
 	test.sec_algo = UMESH_L2_SECURITY_ALGO_CRC16_CCITT;
 
-	int32_t res = umesh_l2_parse_data(buf, &pos, 7, &test, NULL, 0);
+	int32_t res = umesh_l2_parse_data(buf, &pos, 7, &test, NULL);
 
 	bool ret = (res == UMESH_L2_PARSE_DATA_AE_FAILED);
 
@@ -475,7 +483,7 @@ static bool umesh_l2_parse_data_crc16_bad_header_if_fails(void) {
 	umesh_l2_pbuf_init(&test);
 	test.sec_algo = UMESH_L2_SECURITY_ALGO_CRC16_CCITT;
 
-	int32_t res = umesh_l2_parse_data(buf, &pos, 7, &test, NULL, 0);
+	int32_t res = umesh_l2_parse_data(buf, &pos, 7, &test, NULL);
 
 	bool ret = (res == UMESH_L2_PARSE_DATA_AE_FAILED);
 
@@ -497,7 +505,7 @@ static bool umesh_l2_parse_data_crc16_bad_data_if_fails(void) {
 	umesh_l2_pbuf_init(&test);
 	test.sec_algo = UMESH_L2_SECURITY_ALGO_CRC16_CCITT;
 
-	int32_t res = umesh_l2_parse_data(buf, &pos, 7, &test, NULL, 0);
+	int32_t res = umesh_l2_parse_data(buf, &pos, 7, &test, NULL);
 
 	bool ret = (res == UMESH_L2_PARSE_DATA_AE_FAILED);
 
@@ -507,6 +515,127 @@ static bool umesh_l2_parse_data_crc16_bad_data_if_fails(void) {
 }
 
 
+/**
+ * Test if ChaCha20-Poly1305 works (5 byte packet, counter 0x1234).
+ */
+static bool umesh_l2_parse_data_chacha20_poly1305_if_works(void) {
+	const uint8_t buf[13] = {0xff, 0x7f, 0x12, 0x34, 0x32, 0xcd, 0x59, 0x79, 0x2b, 0x53, 0x6b, 0x72, 0x87};
+	const uint8_t *pos = buf + 2;
+
+	struct umesh_l2_cipher cipher;
+	umesh_l2_cipher_init(&cipher, test_key, sizeof(test_key), UMESH_L2_ENC_ALGO_CHACHA20);
+
+	struct umesh_l2_pbuf test;
+	umesh_l2_pbuf_init(&test);
+	test.sec_algo = UMESH_L2_SECURITY_ALGO_CHACHA20_POLY1305_2;
+
+	int32_t res = umesh_l2_parse_data(buf, &pos, 11, &test, &cipher);
+
+	bool ret = (res == UMESH_L2_PARSE_DATA_OK) &&
+		(test.len == 5) &&
+		(test.counter == 0x1234) &&
+		(test.sec_type == UMESH_L2_PBUF_SECURITY_AE) &&
+		(!memcmp(test.data, (uint8_t[]){0x12, 0x34, 0x56, 0x78, 0x90}, 5));
+
+	umesh_l2_pbuf_free(&test);
+
+	return ret;
+}
+
+
+/**
+ * Test if ChaCha20-Poly1305 fails on modified tag (5 byte packet).
+ */
+static bool umesh_l2_parse_data_chacha20_poly1305_bad_tag_if_fails(void) {
+	const uint8_t buf[13] = {0xff, 0x7f, 0x12, 0x34, 0x32, 0xcd, 0x59, 0x79, 0x2b, 0x53, 0x6b, 0x72, 0x88};
+	const uint8_t *pos = buf + 2;
+
+	struct umesh_l2_cipher cipher;
+	umesh_l2_cipher_init(&cipher, test_key, sizeof(test_key), UMESH_L2_ENC_ALGO_CHACHA20);
+
+	struct umesh_l2_pbuf test;
+	umesh_l2_pbuf_init(&test);
+	test.sec_algo = UMESH_L2_SECURITY_ALGO_CHACHA20_POLY1305_2;
+
+	int32_t res = umesh_l2_parse_data(buf, &pos, 11, &test, &cipher);
+
+	bool ret = (res == UMESH_L2_PARSE_DATA_AE_FAILED);
+
+	umesh_l2_pbuf_free(&test);
+
+	return ret;
+}
+
+
+/**
+ * Test if ChaCha20-Poly1305 fails on modified header (5 byte packet).
+ */
+static bool umesh_l2_parse_data_chacha20_poly1305_bad_header_if_fails(void) {
+	const uint8_t buf[13] = {0xff, 0x7e, 0x12, 0x34, 0x32, 0xcd, 0x59, 0x79, 0x2b, 0x53, 0x6b, 0x72, 0x87};
+	const uint8_t *pos = buf + 2;
+
+	struct umesh_l2_cipher cipher;
+	umesh_l2_cipher_init(&cipher, test_key, sizeof(test_key), UMESH_L2_ENC_ALGO_CHACHA20);
+
+	struct umesh_l2_pbuf test;
+	umesh_l2_pbuf_init(&test);
+	test.sec_algo = UMESH_L2_SECURITY_ALGO_CHACHA20_POLY1305_2;
+
+	int32_t res = umesh_l2_parse_data(buf, &pos, 11, &test, &cipher);
+
+	bool ret = (res == UMESH_L2_PARSE_DATA_AE_FAILED);
+
+	umesh_l2_pbuf_free(&test);
+
+	return ret;
+}
+
+
+/**
+ * Test if ChaCha20-Poly1305 fails on modified packet data (5 byte packet).
+ */
+static bool umesh_l2_parse_data_chacha20_poly1305_bad_data_if_fails(void) {
+	const uint8_t buf[13] = {0xff, 0x7f, 0x12, 0x34, 0x33, 0xcd, 0x59, 0x79, 0x2b, 0x53, 0x6b, 0x72, 0x87};
+	const uint8_t *pos = buf + 2;
+
+	struct umesh_l2_cipher cipher;
+	umesh_l2_cipher_init(&cipher, test_key, sizeof(test_key), UMESH_L2_ENC_ALGO_CHACHA20);
+
+	struct umesh_l2_pbuf test;
+	umesh_l2_pbuf_init(&test);
+	test.sec_algo = UMESH_L2_SECURITY_ALGO_CHACHA20_POLY1305_2;
+
+	int32_t res = umesh_l2_parse_data(buf, &pos, 11, &test, &cipher);
+
+	bool ret = (res == UMESH_L2_PARSE_DATA_AE_FAILED);
+
+	umesh_l2_pbuf_free(&test);
+
+	return ret;
+}
+
+
+/**
+ * Test if parsing an encrypted packet fails if no key is available.
+ */
+static bool umesh_l2_parse_data_chacha20_poly1305_no_key_if_fails(void) {
+	const uint8_t buf[13] = {0xff, 0x7f, 0x12, 0x34, 0x32, 0xcd, 0x59, 0x79, 0x2b, 0x53, 0x6b, 0x72, 0x87};
+	const uint8_t *pos = buf + 2;
+
+	struct umesh_l2_pbuf test;
+	umesh_l2_pbuf_init(&test);
+	test.sec_algo = UMESH_L2_SECURITY_ALGO_CHACHA20_POLY1305_2;
+
+	int32_t res = umesh_l2_parse_data(buf, &pos, 11, &test, NULL);
+
+	bool ret = (res == UMESH_L2_PARSE_DATA_FAILED);
+
+	umesh_l2_pbuf_free(&test);
+
+	return ret;
+}
+
+
 bool umesh_l2_receive_tests(void) {
 	bool res = true;
 
@@ -541,5 +670,12 @@ bool umesh_l2_receive_tests(void) {
 	res &= u_test(umesh_l2_parse_data_crc16_bad_header_if_fails());
 	res &= u_test(umesh_l2_parse_data_crc16_bad_data_if_fails());
 
+	/* Data parser tests - ChaCha20-Poly1305. */
+	res &= u_test(umesh_l2_parse_data_chacha20_poly1305_if_works());
+	res &= u_test(umesh_l2_parse_data_chacha20_poly1305_bad_tag_if_fails());
+	res &= u_test(umesh_l2_parse_data_chacha20_poly1305_bad_header_if_fails());
+	res &= u_test(umesh_l2_parse_data_chacha20_poly1305_bad_data_if_fails());
+	res &= u_test(umesh_l2_parse_data_chacha20_poly1305_no_key_if_fails());
+
 	return res;
 }
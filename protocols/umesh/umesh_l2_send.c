@@ -38,11 +38,6 @@
 #include "poly1305.h"
 
 
-static const uint8_t test_key[] = {
-	0xb0, 0x03, 0x44, 0xb5, 0xbe, 0x2c, 0x1e, 0x3c, 0x91, 0x29, 0xfe, 0x27, 0x2d, 0x99, 0x10, 0x90,
-	0x3f, 0xce, 0x32, 0xc5, 0x68, 0x16, 0x56, 0x37, 0xfe, 0xda, 0xa8, 0x53, 0x70, 0xae, 0xd1, 0x10
-};
-
 int32_t umesh_l2_send(struct module_umesh *umesh, struct umesh_l2_pbuf *pbuf) {
 	if (u_assert(pbuf != NULL)) {
 		return UMESH_L2_SEND_FAILED;
@@ -74,19 +69,27 @@ int32_t umesh_l2_send(struct module_umesh *umesh, struct umesh_l2_pbuf *pbuf) {
 		return UMESH_L2_SEND_UNROUTABLE;
 	}
 
-	/* Match the neighbor neighbor. */
-	const uint8_t *key = NULL;
+	/* Match the neighbor neighbor. Encryption is possible only if there is
+	 * a managed key manager session with the neighbor. */
+	const struct umesh_l2_cipher *cipher = NULL;
 	pbuf->counter = 0;
 	if (umesh_l2_nbtable_find(&(umesh->nbtable), pbuf->dtid, &nbtable_item) == UMESH_L2_NBTABLE_FIND_OK) {
 		umesh->l2_pbuf.known_neighbor = true;
 
-		/** @todo */
-		//~ key = nbtable_item->txkey;
-		key = test_key;
-		pbuf->counter = nbtable_item->txcounter;
-		/** @todo this increments the counter also when no encryption
-		 *        is enabled. */
-		nbtable_item->txcounter++;
+		if (umesh->nbtable.key_manager != NULL) {
+			L2KeyManagerSession *session = umesh_l2_keymgr_find_session(umesh->nbtable.key_manager, pbuf->dtid);
+			if (session != NULL) {
+				/* The counter is the nonce, it must never repeat with the same key.
+				 * @todo a nonce is used also when no encryption is enabled. */
+				if (umesh_l2_keymgr_session_tx_nonce(umesh->nbtable.key_manager, session, &pbuf->counter) != UMESH_L2_KEYMGR_SESSION_TX_NONCE_OK) {
+					if (umesh->l2_debug_packet_rx_error) {
+						u_log(system_log, LOG_TYPE_DEBUG, "%s: umesh_l2_send: no nonce left, waiting for a new session", umesh->module.name);
+					}
+					return UMESH_L2_SEND_FAILED;
+				}
+				cipher = &session->tx_cipher;
+			}
+		}
 	}
 
 	/* The L2 packet buffer must be valid and well-formed. Check for common
@@ -129,7 +132,7 @@ int32_t umesh_l2_send(struct module_umesh *umesh, struct umesh_l2_pbuf *pbuf) {
 	}
 
 	/* And finally append the actual packet data. */
-	if (umesh_l2_build_data(pbuf, sandbox, &pos, sizeof(sandbox) - (pos - sandbox), key, 32) != UMESH_L2_BUILD_DATA_OK) {
+	if (umesh_l2_build_data(pbuf, sandbox, &pos, sizeof(sandbox) - (pos - sandbox), cipher) != UMESH_L2_BUILD_DATA_OK) {
 		if (umesh->l2_debug_packet_rx_error) {
 			u_log(system_log, LOG_TYPE_DEBUG, "%s: umesh_l2_send: cannot build packet data", umesh->module.name);
 		}
@@ -260,7 +263,7 @@ int32_t umesh_l2_build_tid(uint32_t tid, uint8_t **data, uint32_t len) {
 }
 
 
-int32_t umesh_l2_build_data(struct umesh_l2_pbuf *pbuf, const uint8_t *header, uint8_t **data, uint32_t len, uint8_t *key, uint32_t key_len) {
+int32_t umesh_l2_build_data(struct umesh_l2_pbuf *pbuf, const uint8_t *header, uint8_t **data, uint32_t len, const struct umesh_l2_cipher *cipher) {
 	if (u_assert(pbuf != NULL && header != NULL && data != NULL && *data != NULL)) {
 		return UMESH_L2_BUILD_DATA_FAILED;
 	}
@@ -337,7 +340,7 @@ int32_t umesh_l2_build_data(struct umesh_l2_pbuf *pbuf, const uint8_t *header, u
 				return UMESH_L2_BUILD_DATA_BUFFER_SMALL;
 			}
 
-			if (key == NULL || (key_len != 16 && key_len != 32)) {
+			if (cipher == NULL) {
 				return UMESH_L2_BUILD_DATA_FAILED;
 			}
 
@@ -348,37 +351,13 @@ int32_t umesh_l2_build_data(struct umesh_l2_pbuf *pbuf, const uint8_t *header, u
 			(*data)++;
 			len -= 2;
 
-			uint32_t remaining = pbuf->len;
-			uint8_t *pos = pbuf->data;
-			uint16_t counter = 1;
-
-			/* Add data in blocks of 64 bytes (chacha20 block size). */
-			while (remaining > 0) {
-
-				uint8_t keystream[64];
-				umesh_l2_get_ctr_keystream(keystream, sizeof(keystream), test_key, 32, pbuf->counter, counter, UMESH_L2_ENC_ALGO_CHACHA20);
-				counter++;
-
-				/* We are processing in 64 byte blocks if there is
-				 * enough data. Process the tail as a smaller block. */
-				uint32_t bytes = 64;
-				if (remaining < 64) {
-					bytes = remaining;
-				}
-
-				/* XOR the original data from the packet buffer with
-				 * the generated keystream. Advance to the next block. */
-				for (uint32_t i = 0; i < bytes; i++) {
-					**data = *pos ^ keystream[i];
-					(*data)++;
-					pos++;
-				}
-				remaining -= bytes;
-			}
-
-
+			/* Encrypt all data in a single pass and get the one-time
+			 * Poly1305 key (chacha20 block 0) with it. */
 			uint8_t poly1305_key[32];
-			umesh_l2_get_ctr_keystream(poly1305_key, sizeof(poly1305_key), test_key, 32, pbuf->counter, 0, UMESH_L2_ENC_ALGO_CHACHA20);
+			if (umesh_l2_cipher_process(cipher, pbuf->counter, poly1305_key, *data, pbuf->data, pbuf->len) != UMESH_L2_CIPHER_PROCESS_OK) {
+				return UMESH_L2_BUILD_DATA_FAILED;
+			}
+			(*data) += pbuf->len;
 
 			/* Compute the Poly1305 authenticating tag. */
 			uint8_t poly1305_tag[16];
@@ -28,6 +28,7 @@
 #include "hal_module.h"
 #include "interface_mac.h"
 #include "module_umesh.h"
+#include "umesh_l2_crypto.h"
 
 
 /**
@@ -129,7 +130,7 @@ int32_t umesh_l2_build_tid(uint32_t tid, uint8_t **data, uint32_t len);
 #define UMESH_L2_BUILD_TID_BUFFER_SMALL -2
 
 /** @todo documentation */
-int32_t umesh_l2_build_data(struct umesh_l2_pbuf *pbuf, const uint8_t *header, uint8_t **data, uint32_t len, uint8_t *key, uint32_t key_len);
+int32_t umesh_l2_build_data(struct umesh_l2_pbuf *pbuf, const uint8_t *header, uint8_t **data, uint32_t len, const struct umesh_l2_cipher *cipher);
 #define UMESH_L2_BUILD_DATA_OK 0
 #define UMESH_L2_BUILD_DATA_FAILED -1
 #define UMESH_L2_BUILD_DATA_BUFFER_SMALL -2
@@ -30,7 +30,17 @@
 
 #include "umesh_l2_send.h"
 #include "umesh_l2_pbuf.h"
+#include "umesh_l2_crypto.h"
+#include "umesh_l2_keymgr.h"
 #include "umesh_l2_send_tests.h"
+#include "chacha20.h"
+
+
+/* Key used for all ChaCha20-Poly1305 tests. */
+static const uint8_t test_key[32] = {
+	0xb0, 0x03, 0x44, 0xb5, 0xbe, 0x2c, 0x1e, 0x3c, 0x91, 0x29, 0xfe, 0x27, 0x2d, 0x99, 0x10, 0x90,
+	0x3f, 0xce, 0x32, 0xc5, 0x68, 0x16, 0x56, 0x37, 0xfe, 0xda, 0xa8, 0x53, 0x70, 0xae, 0xd1, 0x10
+};
 
 
 /**
@@ -258,7 +268,7 @@ static bool umesh_l2_build_data_test_empty_packet_if_works(void) {
 	pbuf.len = 0;
 	pbuf.sec_algo = UMESH_L2_SECURITY_ALGO_NONE;
 
-	int32_t res = umesh_l2_build_data(&pbuf, buf, &pos, 1, NULL, 0);
+	int32_t res = umesh_l2_build_data(&pbuf, buf, &pos, 1, NULL);
 
 	umesh_l2_pbuf_free(&pbuf);
 
@@ -281,7 +291,7 @@ static bool umesh_l2_build_data_test_small_packet_if_works(void) {
 	pbuf.data[2] = 0x56;
 	pbuf.sec_algo = UMESH_L2_SECURITY_ALGO_NONE;
 
-	int32_t res = umesh_l2_build_data(&pbuf, buf, &pos, 3, NULL, 0);
+	int32_t res = umesh_l2_build_data(&pbuf, buf, &pos, 3, NULL);
 
 	umesh_l2_pbuf_free(&pbuf);
 
@@ -310,7 +320,7 @@ static bool umesh_l2_build_data_test_small_packet_small_buffer_if_fails(void) {
 	pbuf.data[2] = 0x56;
 	pbuf.sec_algo = UMESH_L2_SECURITY_ALGO_NONE;
 
-	int32_t res = umesh_l2_build_data(&pbuf, buf, &pos, 2, NULL, 0);
+	int32_t res = umesh_l2_build_data(&pbuf, buf, &pos, 2, NULL);
 
 	umesh_l2_pbuf_free(&pbuf);
 
@@ -329,7 +339,7 @@ static bool umesh_l2_build_data_test_unsupported_if_fails(void) {
 	umesh_l2_pbuf_init(&pbuf);
 	pbuf.sec_algo = 36;
 
-	int32_t res = umesh_l2_build_data(&pbuf, buf, &pos, 1, NULL, 0);
+	int32_t res = umesh_l2_build_data(&pbuf, buf, &pos, 1, NULL);
 
 	umesh_l2_pbuf_free(&pbuf);
 
@@ -351,7 +361,7 @@ static bool umesh_l2_build_data_test_crc16_if_works(void) {
 	pbuf.len = 5;
 	memcpy(pbuf.data, (uint8_t[]){0x12, 0x34, 0x56, 0x78, 0x90}, 5);
 
-	int32_t res = umesh_l2_build_data(&pbuf, buf, &pos, 7, NULL, 0);
+	int32_t res = umesh_l2_build_data(&pbuf, buf, &pos, 7, NULL);
 
 	umesh_l2_pbuf_free(&pbuf);
 
@@ -362,6 +372,164 @@ static bool umesh_l2_build_data_test_crc16_if_works(void) {
 }
 
 
+/**
+ * Test if ChaCha20-Poly1305 works (5 byte packet, counter 0x1234).
+ * Packet is encrypted and a 4 byte tag is appended.
+ */
+static bool umesh_l2_build_data_test_chacha20_poly1305_if_works(void) {
+	uint8_t buf[13] = {0xff, 0x7f, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+	uint8_t *pos = buf + 2;
+
+	struct umesh_l2_cipher cipher;
+	umesh_l2_cipher_init(&cipher, test_key, sizeof(test_key), UMESH_L2_ENC_ALGO_CHACHA20);
+
+	struct umesh_l2_pbuf pbuf;
+	umesh_l2_pbuf_init(&pbuf);
+	pbuf.sec_algo = UMESH_L2_SECURITY_ALGO_CHACHA20_POLY1305_2;
+	pbuf.counter = 0x1234;
+	pbuf.len = 5;
+	memcpy(pbuf.data, (uint8_t[]){0x12, 0x34, 0x56, 0x78, 0x90}, 5);
+
+	int32_t res = umesh_l2_build_data(&pbuf, buf, &pos, 11, &cipher);
+
+	umesh_l2_pbuf_free(&pbuf);
+
+	return
+		(UMESH_L2_BUILD_DATA_OK == res) &&
+		(buf + 13 == pos) &&
+		(!memcmp(buf, (uint8_t[]){0xff, 0x7f, 0x12, 0x34, 0x32, 0xcd, 0x59, 0x79, 0x2b, 0x53, 0x6b, 0x72, 0x87}, 13));
+}
+
+
+/**
+ * Test if ChaCha20-Poly1305 encryption of a packet spanning multiple
+ * keystream blocks (100 bytes) matches the keystream generated block by block.
+ */
+static bool umesh_l2_build_data_test_chacha20_poly1305_long_if_works(void) {
+	uint8_t buf[108] = {0xff, 0x7f};
+	uint8_t *pos = buf + 2;
+
+	struct umesh_l2_cipher cipher;
+	umesh_l2_cipher_init(&cipher, test_key, sizeof(test_key), UMESH_L2_ENC_ALGO_CHACHA20);
+
+	struct umesh_l2_pbuf pbuf;
+	umesh_l2_pbuf_init(&pbuf);
+	pbuf.sec_algo = UMESH_L2_SECURITY_ALGO_CHACHA20_POLY1305_2;
+	pbuf.counter = 0x1234;
+	pbuf.len = 100;
+	for (uint32_t i = 0; i < 100; i++) {
+		pbuf.data[i] = i;
+	}
+
+	int32_t res = umesh_l2_build_data(&pbuf, buf, &pos, 106, &cipher);
+
+	umesh_l2_pbuf_free(&pbuf);
+
+	/* Reference keystream, data blocks start at counter 1. */
+	chacha20_context ctx;
+	chacha20_keysetup(&ctx, test_key, 256);
+	chacha20_nonce(&ctx, (uint8_t[]){0x00, 0x00, 0x12, 0x34, 0, 0, 0, 0});
+	bool ret = (UMESH_L2_BUILD_DATA_OK == res) && (buf + 108 == pos);
+	for (uint32_t block = 0; block < 2; block++) {
+		uint8_t keystream[64];
+		chacha20_counter(&ctx, block + 1);
+		chacha20_keystream(&ctx, keystream);
+		for (uint32_t i = 0; i < 64 && block * 64 + i < 100; i++) {
+			uint32_t n = block * 64 + i;
+			ret &= (buf[4 + n] == (n ^ keystream[i]));
+		}
+	}
+
+	/* Tag of the 100 byte packet. */
+	ret &= !memcmp(buf + 104, (uint8_t[]){0x18, 0x0c, 0x44, 0x5a}, 4);
+
+	return ret;
+}
+
+
+/**
+ * Test if building an encrypted packet fails if no key is available.
+ */
+static bool umesh_l2_build_data_test_chacha20_poly1305_no_key_if_fails(void) {
+	uint8_t buf[13] = {0xff, 0x7f, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+	uint8_t *pos = buf + 2;
+
+	struct umesh_l2_pbuf pbuf;
+	umesh_l2_pbuf_init(&pbuf);
+	pbuf.sec_algo = UMESH_L2_SECURITY_ALGO_CHACHA20_POLY1305_2;
+	pbuf.len = 5;
+
+	int32_t res = umesh_l2_build_data(&pbuf, buf, &pos, 11, NULL);
+
+	umesh_l2_pbuf_free(&pbuf);
+
+	return (UMESH_L2_BUILD_DATA_FAILED == res);
+}
+
+
+/**
+ * Test if packets are encrypted with unique nonces across the 16 bit counter
+ * wrap. A new session is requested in advance, the exhausted session expires
+ * and no more packets can be encrypted with its key.
+ */
+static bool umesh_l2_build_data_test_nonce_wrap_if_rekeys(void) {
+	L2KeyManagerSession table[2];
+	memset(table, 0, sizeof(table));
+	L2KeyManager km = {
+		.session_table = table,
+		.session_table_size = 2,
+	};
+
+	L2KeyManagerSession *session = &table[0];
+	session->peer_tid = 35;
+	session->state = UMESH_L2_KEYMGR_SESSION_STATE_MANAGED;
+	session->state_timeout_ms = UMESH_L2_KEYMGR_TIMEOUT_MANAGED_MS;
+	umesh_l2_cipher_init(&session->tx_cipher, test_key, sizeof(test_key), UMESH_L2_ENC_ALGO_CHACHA20);
+
+	/* The rekey is started when the threshold is reached. */
+	session->tx_nonce = UMESH_L2_KEYMGR_TX_NONCE_REKEY - 1;
+	uint16_t nonce = 0;
+	bool ret = (umesh_l2_keymgr_session_tx_nonce(&km, session, &nonce) == UMESH_L2_KEYMGR_SESSION_TX_NONCE_OK) &&
+		(nonce == UMESH_L2_KEYMGR_TX_NONCE_REKEY - 1) &&
+		(table[1].state == UMESH_L2_KEYMGR_SESSION_STATE_NEW) &&
+		(table[1].peer_tid == 35);
+
+	/* Send the last two packets and try one more after the wrap. */
+	session->tx_nonce = UMESH_L2_KEYMGR_TX_NONCE_COUNT - 2;
+	uint8_t last[2][13];
+	for (size_t i = 0; i < 3; i++) {
+		uint8_t buf[13] = {0xff, 0x7f};
+		uint8_t *pos = buf + 2;
+
+		struct umesh_l2_pbuf pbuf;
+		umesh_l2_pbuf_init(&pbuf);
+		pbuf.sec_algo = UMESH_L2_SECURITY_ALGO_CHACHA20_POLY1305_2;
+		pbuf.len = 5;
+		memcpy(pbuf.data, (uint8_t[]){0x12, 0x34, 0x56, 0x78, 0x90}, 5);
+
+		const struct umesh_l2_cipher *cipher = NULL;
+		L2KeyManagerSession *s = umesh_l2_keymgr_find_session(&km, 35);
+		if (s != NULL && umesh_l2_keymgr_session_tx_nonce(&km, s, &pbuf.counter) == UMESH_L2_KEYMGR_SESSION_TX_NONCE_OK) {
+			cipher = &s->tx_cipher;
+		}
+		int32_t res = umesh_l2_build_data(&pbuf, buf, &pos, 11, cipher);
+		if (i < 2) {
+			ret = ret && (res == UMESH_L2_BUILD_DATA_OK) && (pbuf.counter == UMESH_L2_KEYMGR_TX_NONCE_COUNT - 2 + i);
+			memcpy(last[i], buf, sizeof(buf));
+		} else {
+			/* The new session is not managed yet, nothing is sent. */
+			ret = ret && (res == UMESH_L2_BUILD_DATA_FAILED);
+		}
+		umesh_l2_pbuf_free(&pbuf);
+	}
+
+	return ret &&
+		(session->state == UMESH_L2_KEYMGR_SESSION_STATE_EXPIRED) &&
+		(umesh_l2_keymgr_session_tx_nonce(&km, session, &nonce) == UMESH_L2_KEYMGR_SESSION_TX_NONCE_EXHAUSTED) &&
+		(memcmp(last[0] + 2, last[1] + 2, 2) != 0);
+}
+
+
 bool umesh_l2_send_tests(void) {
 	bool res = true;
 
@@ -390,5 +558,11 @@ bool umesh_l2_send_tests(void) {
 	/* Data builder tests - CRC16. */
 	res &= u_test(umesh_l2_build_data_test_crc16_if_works());
 
+	/* Data builder tests - ChaCha20-Poly1305. */
+	res &= u_test(umesh_l2_build_data_test_chacha20_poly1305_if_works());
+	res &= u_test(umesh_l2_build_data_test_chacha20_poly1305_long_if_works());
+	res &= u_test(umesh_l2_build_data_test_chacha20_poly1305_no_key_if_fails());
+	res &= u_test(umesh_l2_build_data_test_nonce_wrap_if_rekeys());
+
 	return res;
 }
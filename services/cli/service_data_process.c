@@ -60,10 +60,18 @@
 #include "services/data-process/data-process.h"
 #include "services/data-process/sensor-source.h"
 #include "services/data-process/log-sink.h"
+#include "services/data-process/graph-loader.h"
 
 #include "service_data_process.h"
 
 
+/* Graph loaded from a file by the load command. The name of the filesystem
+ * and the path must be set beforehand. */
+static struct dp_loader *graph_loader = NULL;
+static char graph_fs[SERVICE_DATA_PROCESS_PATH_LEN] = "system";
+static char graph_file[SERVICE_DATA_PROCESS_PATH_LEN] = "dp-graph.txt";
+
+
 /**
  * Tables for printing.
  */
@@ -298,7 +306,7 @@ int32_t service_data_process_sensor_source_N_export(struct treecli_parser *parse
 
 	Interface *interface;
 	for (size_t i = 0; (iservicelocator_query_type_id(locator, ISERVICELOCATOR_TYPE_SENSOR, i, &interface)) != ISERVICELOCATOR_RET_FAILED; i++) {
-		ISensor *sensor = (ISensor *)interface;
+		Sensor *sensor = (Sensor *)interface;
 		const char *name = "";
 		iservicelocator_get_name(locator, interface, &name);
 
@@ -399,10 +407,99 @@ int32_t service_data_process_log_sink_add(struct treecli_parser *parser, void *e
 }
 
 
+/**
+ * Graph loading commands.
+ */
+
+int32_t service_data_process_load(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	ServiceCli *cli = (ServiceCli *)parser->context;
+
+	if (graph_loader != NULL) {
+		module_cli_output("a graph is already loaded, unload it first\r\n", cli);
+		return 1;
+	}
+
+	Fs *fs = NULL;
+	if (iservicelocator_query_name_type(locator, graph_fs, ISERVICELOCATOR_TYPE_FS, (Interface **)&fs) != ISERVICELOCATOR_RET_OK) {
+		module_cli_output("cannot find filesystem '", cli);
+		module_cli_output(graph_fs, cli);
+		module_cli_output("'\r\n", cli);
+		return 1;
+	}
+
+	graph_loader = malloc(sizeof(struct dp_loader));
+	if (graph_loader == NULL) {
+		return 1;
+	}
+	dp_loader_init(graph_loader, locator, &data_process_graph);
+	if (dp_loader_load(graph_loader, fs, graph_file) != DATA_PROCESS_RET_OK ||
+	    dp_loader_start(graph_loader) != DATA_PROCESS_RET_OK) {
+		char line[DP_LOADER_ERROR_LEN + 32];
+		snprintf(line, sizeof(line), "cannot load graph, line %lu: %s\r\n", (unsigned long)graph_loader->error_line, graph_loader->error);
+		module_cli_output(line, cli);
+
+		dp_loader_free(graph_loader);
+		free(graph_loader);
+		graph_loader = NULL;
+		return 1;
+	}
+
+	return 0;
+}
+
+
+int32_t service_data_process_unload(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	ServiceCli *cli = (ServiceCli *)parser->context;
+
+	if (graph_loader == NULL) {
+		module_cli_output("no graph loaded\r\n", cli);
+		return 1;
+	}
+
+	/* Stops the graph and removes its nodes from the data-process graph. */
+	dp_loader_free(graph_loader);
+	free(graph_loader);
+	graph_loader = NULL;
+
+	return 0;
+}
+
+
 /**
  * Value manipulation functions.
  */
 
+static void copy_path(char *dst, const void *buf, size_t len) {
+	if (len >= SERVICE_DATA_PROCESS_PATH_LEN) {
+		len = SERVICE_DATA_PROCESS_PATH_LEN - 1;
+	}
+	strncpy(dst, buf, len);
+	dst[len] = '\0';
+}
+
+
+int32_t service_data_process_graph_fs_set(struct treecli_parser *parser, void *ctx, struct treecli_value *value, void *buf, size_t len) {
+	(void)parser;
+	(void)ctx;
+	(void)value;
+
+	copy_path(graph_fs, buf, len);
+	return 0;
+}
+
+
+int32_t service_data_process_graph_file_set(struct treecli_parser *parser, void *ctx, struct treecli_value *value, void *buf, size_t len) {
+	(void)parser;
+	(void)ctx;
+	(void)value;
+
+	copy_path(graph_file, buf, len);
+	return 0;
+}
+
+
 int32_t service_data_process_sensor_source_N_name_set(struct treecli_parser *parser, void *ctx, struct treecli_value *value, void *buf, size_t len) {
 	(void)ctx;
 	(void)value;
@@ -548,7 +645,7 @@ int32_t service_data_process_sensor_source_N_sensor_set(struct treecli_parser *p
 	/* Get the right interface by its name first. */
 	Interface *interface;
 	if (iservicelocator_query_name_type(locator, name, ISERVICELOCATOR_TYPE_SENSOR, &interface) == ISERVICELOCATOR_RET_OK) {
-		ISensor *sensor = (ISensor *)interface;
+		Sensor *sensor = (Sensor *)interface;
 
 		struct dp_graph_node *graph_node = find_node_by_index(data_process_graph.nodes, DP_NODE_SENSOR_SOURCE, DNODE_INDEX(parser, -1));
 		if (graph_node == NULL) {
@@ -34,6 +34,7 @@
 
 
 #define DNODE_INDEX(p, i) p->pos.levels[p->pos.depth + i].dnode_index
+#define SERVICE_DATA_PROCESS_PATH_LEN 32
 
 
 /**
@@ -72,6 +73,11 @@ int32_t service_data_process_log_sink_create(struct treecli_parser *parser, uint
  * Commands for adding and removing items.
  */
 
+int32_t service_data_process_load(struct treecli_parser *parser, void *exec_context);
+int32_t service_data_process_unload(struct treecli_parser *parser, void *exec_context);
+int32_t service_data_process_graph_fs_set(struct treecli_parser *parser, void *ctx, struct treecli_value *value, void *buf, size_t len);
+int32_t service_data_process_graph_file_set(struct treecli_parser *parser, void *ctx, struct treecli_value *value, void *buf, size_t len);
+
 int32_t service_data_process_sensor_source_add(struct treecli_parser *parser, void *exec_context);
 int32_t service_data_process_log_sink_add(struct treecli_parser *parser, void *exec_context);
 
@@ -165,6 +165,138 @@ const struct treecli_node *system_cli_tree = Node {
 							Name "l2receive",
 							Exec ucli_tools_tests_l2receive,
 						},
+						Command {
+							Name "ft",
+							Exec ucli_tools_tests_ft,
+						},
+						Command {
+							Name "ftbench",
+							Exec ucli_tools_tests_ftbench,
+						},
+						#if defined(CONFIG_SERVICE_MQTT_TCPIP)
+						Command {
+							Name "mqtt",
+							Exec ucli_tools_tests_mqtt,
+						},
+						Command {
+							Name "mqttbench",
+							Exec ucli_tools_tests_mqttbench,
+						},
+						#endif
+						#if defined(CONFIG_SERVICE_GSM_QUECTEL)
+						Command {
+							Name "gsm",
+							Exec ucli_tools_tests_gsm,
+						},
+						Command {
+							Name "gsmbench",
+							Exec ucli_tools_tests_gsmbench,
+						},
+						#endif
+						#if defined(CONFIG_SERVICE_PLOG_PACKAGER)
+						Command {
+							Name "pkgcodec",
+							Exec ucli_tools_tests_pkgcodec,
+						},
+						Command {
+							Name "pkgcodecratio",
+							Exec ucli_tools_tests_pkgcodecratio,
+						},
+						Command {
+							Name "packager",
+							Exec ucli_tools_tests_packager,
+						},
+						Command {
+							Name "packagersize",
+							Exec ucli_tools_tests_packagersize,
+						},
+						#endif
+						#if defined(CONFIG_SERVICE_DATA_PROCESS)
+						Command {
+							Name "dp",
+							Exec ucli_tools_tests_dp,
+						},
+						Command {
+							Name "dpbench",
+							Exec ucli_tools_tests_dpbench,
+						},
+						Command {
+							Name "dpstats",
+							Exec ucli_tools_tests_dpstats,
+						},
+						Command {
+							Name "dpstatscost",
+							Exec ucli_tools_tests_dpstatscost,
+						},
+						Command {
+							Name "dpsched",
+							Exec ucli_tools_tests_dpsched,
+						},
+						Command {
+							Name "dpschedlatency",
+							Exec ucli_tools_tests_dpschedlatency,
+						},
+						Command {
+							Name "dploader",
+							Exec ucli_tools_tests_dploader,
+						},
+						#endif
+						#if defined(CONFIG_SERVICE_NBUS)
+						Command {
+							Name "nbus",
+							Exec ucli_tools_tests_nbus,
+						},
+						Command {
+							Name "nbusbench",
+							Exec ucli_tools_tests_nbusbench,
+						},
+						Command {
+							Name "nbuscost",
+							Exec ucli_tools_tests_nbuscost,
+						},
+						#endif
+						#if defined(CONFIG_SERVICE_NBUS_SWITCH)
+						Command {
+							Name "nbusswitch",
+							Exec ucli_tools_tests_nbusswitch,
+						},
+						Command {
+							Name "nbusswitchbench",
+							Exec ucli_tools_tests_nbusswitchbench,
+						},
+						#endif
+						#if defined(CONFIG_SERVICE_NBUS_MQ)
+						Command {
+							Name "nbusmq",
+							Exec ucli_tools_tests_nbusmq,
+						},
+						#endif
+						#if defined(CONFIG_SERVICE_NBUS_FLASH)
+						Command {
+							Name "nbusflash",
+							Exec ucli_tools_tests_nbusflash,
+						},
+						#endif
+						#if defined(CONFIG_SERVICE_RADIO_MAC_SIMPLE)
+						Command {
+							Name "rmac",
+							Exec ucli_tools_tests_rmac,
+						},
+						Command {
+							Name "rmaccost",
+							Exec ucli_tools_tests_rmaccost,
+						},
+						#endif
+						#if defined(CONFIG_SERVICE_RADIO_MAC_SIMPLE_FEC)
+						Command {
+							Name "rmacfec",
+							Exec ucli_tools_tests_rmacfec,
+						},
+						Command {
+							Name "rmacfecbench",
+							Exec ucli_tools_tests_rmacfecbench,
+						},
+						#endif
 						End
 					},
 				},
@@ -424,9 +556,30 @@ const struct treecli_node *system_cli_tree = Node {
 							Name "export",
 							Exec service_data_process_print,
 						},
+						Command {
+							Name "load",
+							Exec service_data_process_load,
+						},
+						Command {
+							Name "unload",
+							Exec service_data_process_unload,
+						},
 						End
 
 					},
+					Values {
+						Value {
+							Name "graph-fs",
+							.set = service_data_process_graph_fs_set,
+							Type TREECLI_VALUE_STR,
+						},
+						Value {
+							Name "graph-file",
+							.set = service_data_process_graph_file_set,
+							Type TREECLI_VALUE_STR,
+						},
+						End
+					},
 					Subnodes {
 						Node {
 							Name "sensor-source",
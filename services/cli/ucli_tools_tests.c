@@ -1,5 +1,40 @@
 #include "umesh_l2_receive_tests.h"
 #include "umesh_l2_send_tests.h"
+#include "file_transfer_tests.h"
+#if defined(CONFIG_SERVICE_MQTT_TCPIP)
+	#include "services/mqtt-tcpip/mqtt_tcpip_tests.h"
+#endif
+#if defined(CONFIG_SERVICE_GSM_QUECTEL)
+	#include "services/gsm-quectel/gsm_quectel_tests.h"
+#endif
+#if defined(CONFIG_SERVICE_PLOG_PACKAGER)
+	#include "services/plog-packager/pkg_codec_tests.h"
+	#include "services/plog-packager/plog_packager_tests.h"
+#endif
+#if defined(CONFIG_SERVICE_DATA_PROCESS)
+	#include "services/data-process/data-process-tests.h"
+	#include "services/data-process/statistics-node-tests.h"
+	#include "services/data-process/graph-scheduler-tests.h"
+	#include "services/data-process/graph-loader-tests.h"
+#endif
+#if defined(CONFIG_SERVICE_NBUS)
+	#include "services/nbus/nbus-tests.h"
+#endif
+#if defined(CONFIG_SERVICE_NBUS_SWITCH)
+	#include "services/nbus-switch/nbus-switch-tests.h"
+#endif
+#if defined(CONFIG_SERVICE_NBUS_MQ)
+	#include "services/nbus-mq/nbus-mq-tests.h"
+#endif
+#if defined(CONFIG_SERVICE_NBUS_FLASH)
+	#include "services/nbus-flash/nbus-flash-tests.h"
+#endif
+#if defined(CONFIG_SERVICE_RADIO_MAC_SIMPLE)
+	#include "services/radio-mac-simple/rmac-tests.h"
+#endif
+#if defined(CONFIG_SERVICE_RADIO_MAC_SIMPLE_FEC)
+	#include "services/radio-mac-simple/rmac-fec-tests.h"
+#endif
 
 
 static int32_t ucli_tools_tests_all(struct treecli_parser *parser, void *exec_context) {
@@ -8,6 +43,7 @@ static int32_t ucli_tools_tests_all(struct treecli_parser *parser, void *exec_co
 
 	umesh_l2_receive_tests();
 	umesh_l2_send_tests();
+	file_transfer_tests();
 
 	return 0;
 }
@@ -30,6 +66,278 @@ static int32_t ucli_tools_tests_l2receive(struct treecli_parser *parser, void *e
 	return 0;
 }
 
+static int32_t ucli_tools_tests_ft(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	(void)parser;
+
+	file_transfer_tests();
+
+	return 0;
+}
+
+static int32_t ucli_tools_tests_ftbench(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	(void)parser;
+
+	file_transfer_tests_throughput();
+
+	return 0;
+}
+
+#if defined(CONFIG_SERVICE_MQTT_TCPIP)
+static int32_t ucli_tools_tests_mqtt(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	(void)parser;
+
+	mqtt_tcpip_tests();
+
+	return 0;
+}
+
+static int32_t ucli_tools_tests_mqttbench(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	(void)parser;
+
+	mqtt_tcpip_tests_throughput();
+
+	return 0;
+}
+#endif
+
+#if defined(CONFIG_SERVICE_GSM_QUECTEL)
+static int32_t ucli_tools_tests_gsm(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	(void)parser;
+
+	gsm_quectel_tests();
+
+	return 0;
+}
+
+static int32_t ucli_tools_tests_gsmbench(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	(void)parser;
+
+	gsm_quectel_tests_throughput();
+
+	return 0;
+}
+#endif
+
+#if defined(CONFIG_SERVICE_PLOG_PACKAGER)
+static int32_t ucli_tools_tests_pkgcodec(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	(void)parser;
+
+	pkg_codec_tests();
+
+	return 0;
+}
+
+static int32_t ucli_tools_tests_pkgcodecratio(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	(void)parser;
+
+	pkg_codec_tests_ratio();
+
+	return 0;
+}
+
+static int32_t ucli_tools_tests_packager(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	(void)parser;
+
+	plog_packager_tests();
+
+	return 0;
+}
+
+static int32_t ucli_tools_tests_packagersize(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	(void)parser;
+
+	plog_packager_tests_size();
+
+	return 0;
+}
+#endif
+
+#if defined(CONFIG_SERVICE_DATA_PROCESS)
+static int32_t ucli_tools_tests_dp(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	(void)parser;
+
+	data_process_tests();
+
+	return 0;
+}
+
+static int32_t ucli_tools_tests_dpbench(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	(void)parser;
+
+	data_process_tests_throughput();
+
+	return 0;
+}
+
+static int32_t ucli_tools_tests_dpstats(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	(void)parser;
+
+	statistics_node_tests();
+
+	return 0;
+}
+
+static int32_t ucli_tools_tests_dpstatscost(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	(void)parser;
+
+	statistics_node_tests_cost();
+
+	return 0;
+}
+
+static int32_t ucli_tools_tests_dpsched(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	(void)parser;
+
+	graph_scheduler_tests();
+
+	return 0;
+}
+
+static int32_t ucli_tools_tests_dpschedlatency(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	(void)parser;
+
+	graph_scheduler_tests_latency();
+
+	return 0;
+}
+
+static int32_t ucli_tools_tests_dploader(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	(void)parser;
+
+	graph_loader_tests();
+
+	return 0;
+}
+#endif
+
+#if defined(CONFIG_SERVICE_NBUS)
+static int32_t ucli_tools_tests_nbus(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	(void)parser;
+
+	nbus_tests();
+
+	return 0;
+}
+
+static int32_t ucli_tools_tests_nbusbench(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	(void)parser;
+
+	nbus_tests_throughput();
+
+	return 0;
+}
+
+static int32_t ucli_tools_tests_nbuscost(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	(void)parser;
+
+	nbus_tests_cost();
+
+	return 0;
+}
+#endif
+
+#if defined(CONFIG_SERVICE_NBUS_SWITCH)
+static int32_t ucli_tools_tests_nbusswitch(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	(void)parser;
+
+	nbus_switch_tests();
+
+	return 0;
+}
+
+static int32_t ucli_tools_tests_nbusswitchbench(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	(void)parser;
+
+	nbus_switch_tests_throughput();
+
+	return 0;
+}
+#endif
+
+#if defined(CONFIG_SERVICE_NBUS_MQ)
+static int32_t ucli_tools_tests_nbusmq(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	(void)parser;
+
+	nbus_mq_tests();
+
+	return 0;
+}
+#endif
+
+#if defined(CONFIG_SERVICE_NBUS_FLASH)
+static int32_t ucli_tools_tests_nbusflash(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	(void)parser;
+
+	nbus_flash_tests();
+
+	return 0;
+}
+#endif
+
+#if defined(CONFIG_SERVICE_RADIO_MAC_SIMPLE)
+static int32_t ucli_tools_tests_rmac(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	(void)parser;
+
+	rmac_tests();
+
+	return 0;
+}
+
+static int32_t ucli_tools_tests_rmaccost(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	(void)parser;
+
+	rmac_tests_cost();
+
+	return 0;
+}
+#endif
+
+#if defined(CONFIG_SERVICE_RADIO_MAC_SIMPLE_FEC)
+static int32_t ucli_tools_tests_rmacfec(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	(void)parser;
+
+	rmac_fec_tests();
+
+	return 0;
+}
+
+static int32_t ucli_tools_tests_rmacfecbench(struct treecli_parser *parser, void *exec_context) {
+	(void)exec_context;
+	(void)parser;
+
+	rmac_fec_tests_throughput();
+
+	return 0;
+}
+#endif
+
 
 static int32_t ucli_tools_tests_ftsend(struct treecli_parser *parser, void *exec_context) {
 	(void)exec_context;
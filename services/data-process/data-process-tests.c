@@ -0,0 +1,414 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * data-process edge tests
+ *
+ * Copyright (c) 2021, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "u_assert.h"
+#include "u_log.h"
+#include "u_test.h"
+
+#include "data-process.h"
+#include "statistics-node.h"
+#include "data-process-tests.h"
+
+#ifdef MODULE_NAME
+#undef MODULE_NAME
+#endif
+#define MODULE_NAME "data-process-tests"
+
+#define DP_TEST_INPUTS 8
+#define DP_TEST_TIMEOUT_MS 30000
+#define DP_TEST_STACK_SIZE (configMINIMAL_STACK_SIZE + 256)
+
+
+/* Write float values from @p from one by one. The first one is marked
+ * with @p first_flags, the last one with @p last_flags. */
+static void write_values(struct dp_output *out, uint32_t from, uint32_t count, enum dp_data_flags first_flags, enum dp_data_flags last_flags) {
+	for (uint32_t i = from; i < from + count; i++) {
+		float value = (float)i;
+		struct dp_data data = {
+			.len = 1,
+			.flags = DP_DATA_NONE,
+			.type = DP_DATA_TYPE_FLOAT,
+			.content.dp_float = &value,
+		};
+		if (i == from) {
+			data.flags |= first_flags;
+		}
+		if (i == from + count - 1) {
+			data.flags |= last_flags;
+		}
+		dp_output_write(out, &data);
+	}
+}
+
+
+/* The test reads inputs without a task, do not block on an empty one. */
+static bool input_available(struct dp_input *in) {
+	return in->batch_pos < in->batch.len || uxQueueMessagesWaiting(in->queue) > 0;
+}
+
+
+/* Read @p count values starting with @p from. Frame flags are checked if
+ * @p frame_len is not zero, frames start at multiples of frame_len. */
+static bool read_values(struct dp_input *in, uint32_t from, uint32_t count, uint32_t frame_len) {
+	for (uint32_t i = from; i < from + count; i++) {
+		struct dp_data data;
+		if (!input_available(in) || dp_input_read(in, &data) != DATA_PROCESS_RET_OK) {
+			u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("value %u missing"), i);
+			return false;
+		}
+		if (*data.content.dp_float != (float)i) {
+			u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("value %u expected, got %d"), i, (int)*data.content.dp_float);
+			return false;
+		}
+		if (frame_len > 0) {
+			enum dp_data_flags flags = DP_DATA_NONE;
+			if (i % frame_len == 0) {
+				flags |= DP_DATA_FRAME_START;
+			}
+			if (i % frame_len == frame_len - 1) {
+				flags |= DP_DATA_FRAME_END;
+			}
+			if (data.flags != flags) {
+				u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("value %u flags %u, expected %u"), i, data.flags, flags);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+
+/* Two frames of 5 values are written. The end of the first frame must be
+ * sent immediately even if the batch is not full. */
+static bool dp_test_frames_if_batched(size_t batch_len) {
+	struct dp_output out;
+	struct dp_input in;
+	dp_output_init(&out, DP_DATA_TYPE_FLOAT);
+	dp_input_init(&in, DP_DATA_TYPE_FLOAT);
+	dp_input_set_queue(&in, 16, DP_BACKPRESSURE_BLOCK);
+	dp_connect_input_to_output(&in, &out);
+	dp_output_set_batch(&out, batch_len);
+
+	write_values(&out, 0, 5, DP_DATA_FRAME_START, DP_DATA_FRAME_END);
+	bool ret = read_values(&in, 0, 5, 5) && !input_available(&in);
+	write_values(&out, 5, 5, DP_DATA_FRAME_START, DP_DATA_FRAME_END);
+	ret = ret && read_values(&in, 5, 5, 5) && !input_available(&in);
+
+	dp_input_free(&in);
+	dp_output_free(&out);
+	return ret;
+}
+
+
+static bool dp_test_frames_if_batch_1(void) {
+	return dp_test_frames_if_batched(1);
+}
+
+
+static bool dp_test_frames_if_batch_3(void) {
+	return dp_test_frames_if_batched(3);
+}
+
+
+static bool dp_test_frames_if_batch_max(void) {
+	return dp_test_frames_if_batched(DATA_PROCESS_BATCH_LEN);
+}
+
+
+/* Values are sent in batches of batch_len, the rest on flush. */
+static bool dp_test_batch_if_flushed(void) {
+	struct dp_output out;
+	struct dp_input in;
+	dp_output_init(&out, DP_DATA_TYPE_FLOAT);
+	dp_input_init(&in, DP_DATA_TYPE_FLOAT);
+	dp_input_set_queue(&in, 16, DP_BACKPRESSURE_BLOCK);
+	dp_connect_input_to_output(&in, &out);
+	dp_output_set_batch(&out, 3);
+
+	write_values(&out, 0, 7, DP_DATA_NONE, DP_DATA_NONE);
+	bool ret = uxQueueMessagesWaiting(in.queue) == 2;
+	dp_output_flush(&out);
+	ret = ret && uxQueueMessagesWaiting(in.queue) == 3;
+
+	/* A batch is read at once. */
+	struct dp_data data;
+	ret = ret && dp_input_read_batch(&in, &data) == DATA_PROCESS_RET_OK && data.len == 3 && data.content.dp_float[2] == 2.0f;
+	ret = ret && read_values(&in, 3, 4, 0) && !input_available(&in);
+
+	dp_input_free(&in);
+	dp_output_free(&out);
+	return ret;
+}
+
+
+static bool dp_test_drop_if_full(enum dp_backpressure backpressure, uint32_t first) {
+	struct dp_output out;
+	struct dp_input in;
+	dp_output_init(&out, DP_DATA_TYPE_FLOAT);
+	dp_input_init(&in, DP_DATA_TYPE_FLOAT);
+	dp_input_set_queue(&in, 2, backpressure);
+	dp_connect_input_to_output(&in, &out);
+
+	write_values(&out, 0, 5, DP_DATA_NONE, DP_DATA_NONE);
+	bool ret = in.dropped == 3 && read_values(&in, first, 2, 0) && !input_available(&in);
+
+	dp_input_free(&in);
+	dp_output_free(&out);
+	return ret;
+}
+
+
+static bool dp_test_drop_newest_if_full(void) {
+	return dp_test_drop_if_full(DP_BACKPRESSURE_DROP_NEWEST, 0);
+}
+
+
+static bool dp_test_drop_oldest_if_full(void) {
+	return dp_test_drop_if_full(DP_BACKPRESSURE_DROP_OLDEST, 3);
+}
+
+
+/* There is no limit of inputs connected to an output. A freed input is
+ * disconnected, freeing the output disconnects all inputs. */
+static bool dp_test_fanout_if_copied(void) {
+	struct dp_output out;
+	struct dp_input in[DP_TEST_INPUTS];
+	dp_output_init(&out, DP_DATA_TYPE_FLOAT);
+	dp_output_set_batch(&out, 2);
+	for (size_t i = 0; i < DP_TEST_INPUTS; i++) {
+		dp_input_init(&in[i], DP_DATA_TYPE_FLOAT);
+		dp_connect_input_to_output(&in[i], &out);
+	}
+
+	bool ret = true;
+	write_values(&out, 0, 4, DP_DATA_NONE, DP_DATA_NONE);
+	for (size_t i = 0; i < DP_TEST_INPUTS; i++) {
+		ret = ret && read_values(&in[i], 0, 4, 0);
+	}
+
+	dp_input_free(&in[3]);
+	write_values(&out, 4, 2, DP_DATA_NONE, DP_DATA_NONE);
+	for (size_t i = 0; i < DP_TEST_INPUTS; i++) {
+		if (i != 3) {
+			ret = ret && read_values(&in[i], 4, 2, 0);
+		}
+	}
+
+	dp_output_free(&out);
+	for (size_t i = 0; i < DP_TEST_INPUTS; i++) {
+		if (i != 3) {
+			ret = ret && dp_input_is_connected(&in[i]) != DATA_PROCESS_RET_OK;
+			dp_input_free(&in[i]);
+		}
+	}
+	return ret;
+}
+
+
+static bool dp_test_connect_if_type_mismatch(void) {
+	struct dp_output out;
+	struct dp_input in;
+	dp_output_init(&out, DP_DATA_TYPE_UINT32);
+	dp_input_init(&in, DP_DATA_TYPE_FLOAT);
+
+	bool ret = dp_connect_input_to_output(&in, &out) != DATA_PROCESS_RET_OK && !dp_output_is_connected(&out);
+
+	dp_input_free(&in);
+	dp_output_free(&out);
+	return ret;
+}
+
+
+/* An interrupted read returns no data, the next one continues normally. */
+static bool dp_test_read_if_interrupted(void) {
+	struct dp_output out;
+	struct dp_input in;
+	dp_output_init(&out, DP_DATA_TYPE_FLOAT);
+	dp_input_init(&in, DP_DATA_TYPE_FLOAT);
+	dp_connect_input_to_output(&in, &out);
+
+	struct dp_data data;
+	dp_input_interrupt(&in);
+	bool ret = dp_input_read(&in, &data) == DATA_PROCESS_RET_EMPTY;
+	write_values(&out, 0, 2, DP_DATA_NONE, DP_DATA_NONE);
+	ret = ret && read_values(&in, 0, 2, 0) && !input_available(&in);
+
+	dp_input_free(&in);
+	dp_output_free(&out);
+	return ret;
+}
+
+
+bool data_process_tests(void) {
+	bool res = true;
+
+	res &= u_test(dp_test_frames_if_batch_1());
+	res &= u_test(dp_test_frames_if_batch_3());
+	res &= u_test(dp_test_frames_if_batch_max());
+	res &= u_test(dp_test_batch_if_flushed());
+	res &= u_test(dp_test_drop_newest_if_full());
+	res &= u_test(dp_test_drop_oldest_if_full());
+	res &= u_test(dp_test_fanout_if_copied());
+	res &= u_test(dp_test_connect_if_type_mismatch());
+	res &= u_test(dp_test_read_if_interrupted());
+
+	return res;
+}
+
+
+/* Source writing consecutive float values as fast as possible. */
+struct dp_test_source {
+	struct dp_output out;
+	uint32_t count;
+	volatile bool done;
+};
+
+/* Sink counting the values and the number of reads. */
+struct dp_test_sink {
+	struct dp_input in;
+	uint32_t expected;
+	uint32_t received;
+	uint32_t reads;
+	bool check_order;
+	uint32_t errors;
+	float last;
+	volatile bool done;
+};
+
+struct dp_test_graph {
+	struct dp_test_source source;
+	struct dp_statistics_node statistics;
+	struct dp_test_sink sink;
+};
+
+
+static void dp_test_source_task(void *p) {
+	struct dp_test_source *self = (struct dp_test_source *)p;
+
+	write_values(&self->out, 0, self->count, DP_DATA_NONE, DP_DATA_NONE);
+	dp_output_flush(&self->out);
+
+	self->done = true;
+	vTaskDelete(NULL);
+}
+
+
+static void dp_test_sink_task(void *p) {
+	struct dp_test_sink *self = (struct dp_test_sink *)p;
+
+	while (self->received < self->expected) {
+		struct dp_data data;
+		if (dp_input_read_batch(&self->in, &data) != DATA_PROCESS_RET_OK) {
+			continue;
+		}
+		self->reads++;
+		for (size_t i = 0; i < data.len; i++) {
+			if (self->check_order && data.content.dp_float[i] != (float)self->received) {
+				self->errors++;
+			}
+			self->last = data.content.dp_float[i];
+			self->received++;
+		}
+	}
+
+	self->done = true;
+	vTaskDelete(NULL);
+}
+
+
+static bool wait_done(volatile bool *done) {
+	TickType_t start = xTaskGetTickCount();
+	while (!*done) {
+		if ((xTaskGetTickCount() - start) > pdMS_TO_TICKS(DP_TEST_TIMEOUT_MS)) {
+			return false;
+		}
+		vTaskDelay(1);
+	}
+	return true;
+}
+
+
+/* Send @p count values from the source to the sink, directly or through
+ * the statistics node. Only the source output is batched, the statistics
+ * node sends every value as a separate frame. */
+static bool graph_rate(struct dp_test_graph *self, bool statistics, size_t batch_len, uint32_t count, uint32_t *time_ms) {
+	memset(self, 0, sizeof(struct dp_test_graph));
+	self->source.count = count;
+	self->sink.expected = count;
+	self->sink.check_order = !statistics;
+
+	dp_output_init(&self->source.out, DP_DATA_TYPE_FLOAT);
+	dp_output_set_batch(&self->source.out, batch_len);
+	dp_input_init(&self->sink.in, DP_DATA_TYPE_FLOAT);
+	if (statistics) {
+		dp_statistics_node_init(&self->statistics, "statistics", DP_DATA_TYPE_FLOAT);
+		dp_statistics_node_set_window(&self->statistics, 10);
+		dp_connect_input_to_output(&self->statistics.in, &self->source.out);
+		dp_connect_input_to_output(&self->sink.in, &self->statistics.out_avg_floating);
+		dp_statistics_node_start(&self->statistics);
+	} else {
+		dp_connect_input_to_output(&self->sink.in, &self->source.out);
+	}
+
+	TickType_t start = xTaskGetTickCount();
+	xTaskCreate(dp_test_sink_task, "dp-test-sink", DP_TEST_STACK_SIZE, (void *)&self->sink, 1, NULL);
+	xTaskCreate(dp_test_source_task, "dp-test-source", DP_TEST_STACK_SIZE, (void *)&self->source, 1, NULL);
+	bool ret = wait_done(&self->source.done) && wait_done(&self->sink.done);
+	*time_ms = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+
+	if (statistics) {
+		dp_statistics_node_stop(&self->statistics);
+		dp_statistics_node_free(&self->statistics);
+		/* Mean of the last 10 values. */
+		float d = self->sink.last - ((float)(count - 1) - 4.5f);
+		ret = ret && d > -0.01f && d < 0.01f;
+	}
+	dp_output_free(&self->source.out);
+	dp_input_free(&self->sink.in);
+
+	return ret && self->sink.errors == 0;
+}
+
+
+bool data_process_tests_throughput(void) {
+	struct dp_test_graph *self = malloc(sizeof(struct dp_test_graph));
+	if (self == NULL) {
+		return false;
+	}
+
+	const size_t batch_len[] = {1, 4, DATA_PROCESS_BATCH_LEN};
+	const uint32_t count = 20000;
+	bool res = true;
+
+	for (size_t s = 0; s < 2; s++) {
+		for (size_t i = 0; i < sizeof(batch_len) / sizeof(batch_len[0]); i++) {
+			uint32_t time_ms = 0;
+			bool r = graph_rate(self, s == 1, batch_len[i], count, &time_ms);
+			if (time_ms == 0) {
+				time_ms = 1;
+			}
+			u_log(system_log, r ? LOG_TYPE_INFO : LOG_TYPE_ERROR,
+				U_LOG_MODULE_PREFIX("%s, batch %u: %u values in %u ms (%u values/s), %u batches read by the sink"),
+				(s == 1) ? "source -> statistics -> sink" : "source -> sink",
+				batch_len[i], count, time_ms, (uint32_t)((uint64_t)count * 1000 / time_ms), self->sink.reads
+			);
+			res &= r;
+		}
+	}
+
+	free(self);
+	return res;
+}
@@ -0,0 +1,26 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * data-process edge tests
+ *
+ * Copyright (c) 2021, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * Pass values over batched edges between outputs and inputs. Values must be
+ * received in order with correct frame flags, backpressure policies must
+ * drop the right batches and an output must feed any number of inputs.
+ */
+bool data_process_tests(void);
+
+/**
+ * Run a source -> statistics -> sink graph, each node in its own task, with
+ * several batch lengths. Log the number of values per second and the number
+ * of batches read by the sink. It bounds the number of reader wakeups and
+ * context switches.
+ */
+bool data_process_tests_throughput(void);
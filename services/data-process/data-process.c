@@ -26,13 +26,20 @@
 #include "stdint.h"
 #include "stdbool.h"
 #include "stdlib.h"
+#include "string.h"
 
 #include "FreeRTOS.h"
-#include "semphr.h"
+#include "queue.h"
 #include "u_assert.h"
 #include "u_log.h"
 
 #include "data-process.h"
+#include "graph-scheduler.h"
+
+#ifdef MODULE_NAME
+#undef MODULE_NAME
+#endif
+#define MODULE_NAME "data-process"
 
 /* There is a single flow graph in the system (now). */
 struct dp_graph data_process_graph;
@@ -106,29 +113,68 @@ dp_ret_t dp_graph_remove_node(struct dp_graph *self, void *node, const char *nam
 		return DATA_PROCESS_RET_FAILED;
 	}
 
-	/* If the node requested for removal is the only node in the list,
-	 * delete it and set the list pointer to NULL. */
-	if (self->nodes->next == NULL && (self->nodes->node == node || (name != NULL && (strcmp(name, self->nodes->name) != 0)))) {
-		free(self->nodes);
-		self->nodes = NULL;
-		return DATA_PROCESS_RET_OK;
-	}
-
-	/* Otherwise try to find the corresponding node and remove it. */
-	struct dp_graph_node *cur = self->nodes;
-	while (cur->next != NULL) {
-		if (cur->next->node == node || (name != NULL && (strcmp(name, cur->next->name) != 0))) {
-			struct dp_graph_node *tmp = cur->next->next;
-			free(cur->next);
-			cur->next = tmp;
+	/* Find the node by its reference or by its name and unlink it. */
+	struct dp_graph_node **cur = &self->nodes;
+	while (*cur != NULL) {
+		if ((*cur)->node == node || (name != NULL && !strcmp(name, (*cur)->name))) {
+			struct dp_graph_node *tmp = *cur;
+			*cur = tmp->next;
+			free(tmp);
 			return DATA_PROCESS_RET_OK;
 		}
+		cur = &(*cur)->next;
 	}
 
 	return DATA_PROCESS_RET_FAILED;
 }
 
 
+static size_t dp_data_type_size(enum dp_data_type type) {
+	switch (type) {
+		case DP_DATA_TYPE_UINT32:
+			return sizeof(uint32_t);
+		case DP_DATA_TYPE_INT32:
+			return sizeof(int32_t);
+		case DP_DATA_TYPE_FLOAT:
+			return sizeof(float);
+		case DP_DATA_TYPE_BYTE:
+			return sizeof(uint8_t);
+		default:
+			return 0;
+	}
+}
+
+
+dp_ret_t dp_node_add_input(struct dp_graph_node_descriptor *node, struct dp_input *input) {
+	if (u_assert(node != NULL) ||
+	    u_assert(input != NULL) ||
+	    u_assert(input->owner == NULL)) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	input->owner = node;
+	input->owner_next = node->inputs;
+	node->inputs = input;
+
+	return DATA_PROCESS_RET_OK;
+}
+
+
+dp_ret_t dp_node_add_output(struct dp_graph_node_descriptor *node, struct dp_output *output) {
+	if (u_assert(node != NULL) ||
+	    u_assert(output != NULL) ||
+	    u_assert(output->owner == NULL)) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	output->owner = node;
+	output->owner_next = node->outputs;
+	node->outputs = output;
+
+	return DATA_PROCESS_RET_OK;
+}
+
+
 dp_ret_t dp_input_init(struct dp_input *self, enum dp_data_type type) {
 	if (u_assert(self != NULL)) {
 		return DATA_PROCESS_RET_FAILED;
@@ -136,15 +182,11 @@ dp_ret_t dp_input_init(struct dp_input *self, enum dp_data_type type) {
 
 	memset(self, 0, sizeof(struct dp_input));
 	self->type = type;
+	self->queue_depth = DATA_PROCESS_QUEUE_DEPTH;
+	self->backpressure = DP_BACKPRESSURE_BLOCK;
 
-	self->data_can_read = xSemaphoreCreateBinary();
-	if (self->data_can_read == NULL) {
-		dp_input_free(self);
-		return DATA_PROCESS_RET_FAILED;
-	}
-	self->data_has_read = xSemaphoreCreateBinary();
-	if (self->data_has_read == NULL) {
-		dp_input_free(self);
+	self->queue = xQueueCreate(self->queue_depth, sizeof(struct dp_batch));
+	if (self->queue == NULL) {
 		return DATA_PROCESS_RET_FAILED;
 	}
 
@@ -160,11 +202,23 @@ dp_ret_t dp_input_free(struct dp_input *self) {
 		return DATA_PROCESS_RET_FAILED;
 	}
 
-	if (self->data_can_read != NULL) {
-		vSemaphoreDelete(self->data_can_read);
+	/* Unlink the input from its output if it is still connected. */
+	if (self->output != NULL) {
+		struct dp_input **i = &self->output->inputs;
+		while (*i != NULL) {
+			if (*i == self) {
+				*i = self->next;
+				break;
+			}
+			i = &(*i)->next;
+		}
+		self->output = NULL;
+		self->next = NULL;
 	}
-	if (self->data_has_read != NULL) {
-		vSemaphoreDelete(self->data_has_read);
+
+	if (self->queue != NULL) {
+		vQueueDelete(self->queue);
+		self->queue = NULL;
 	}
 
 	self->initialized = false;
@@ -178,6 +232,33 @@ dp_ret_t dp_input_is_connected(struct dp_input *self) {
 		return DATA_PROCESS_RET_FAILED;
 	}
 
+	if (self->output == NULL) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	return DATA_PROCESS_RET_OK;
+}
+
+
+dp_ret_t dp_input_set_queue(struct dp_input *self, size_t depth, enum dp_backpressure backpressure) {
+	if (u_assert(self != NULL) ||
+	    u_assert(self->initialized == true) ||
+	    u_assert(self->output == NULL) ||
+	    u_assert(depth > 0)) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	if (depth != self->queue_depth) {
+		QueueHandle_t queue = xQueueCreate(depth, sizeof(struct dp_batch));
+		if (queue == NULL) {
+			return DATA_PROCESS_RET_FAILED;
+		}
+		vQueueDelete(self->queue);
+		self->queue = queue;
+		self->queue_depth = depth;
+	}
+	self->backpressure = backpressure;
+
 	return DATA_PROCESS_RET_OK;
 }
 
@@ -193,16 +274,54 @@ dp_ret_t dp_connect_input_to_output(struct dp_input *self, struct dp_output *out
 		return DATA_PROCESS_RET_FAILED;
 	}
 
-	for (size_t i = 0; i < DATA_PROCESS_MAX_INPUTS; i++) {
-		if (output->inputs[i] == NULL) {
-			output->inputs[i] = self;
-			self->output = output;
-			return DATA_PROCESS_RET_OK;
+	/* An input can be connected to a single output only. */
+	if (u_assert(self->output == NULL)) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	self->next = output->inputs;
+	output->inputs = self;
+	self->output = output;
+
+	return DATA_PROCESS_RET_OK;
+}
+
+
+static dp_ret_t dp_input_receive(struct dp_input *self) {
+	/* Nodes executed by a scheduler must not block. */
+	TickType_t timeout = portMAX_DELAY;
+	if (self->owner != NULL && self->owner->scheduler != NULL) {
+		timeout = 0;
+	}
+
+	/* Wait for a new batch only if the current one is fully consumed. */
+	while (self->batch_pos >= self->batch.len) {
+		if (xQueueReceive(self->queue, &self->batch, timeout) != pdTRUE) {
+			return (timeout == 0) ? DATA_PROCESS_RET_EMPTY : DATA_PROCESS_RET_FAILED;
+		}
+		self->batch_pos = 0;
+
+		/* An empty batch is sent by dp_input_interrupt. */
+		if (self->batch.len == 0) {
+			return DATA_PROCESS_RET_EMPTY;
 		}
 	}
 
-	/* No free space found. */
-	return DATA_PROCESS_RET_FAILED;
+	return DATA_PROCESS_RET_OK;
+}
+
+
+dp_ret_t dp_input_interrupt(struct dp_input *self) {
+	if (u_assert(self != NULL) ||
+	    u_assert(self->initialized == true)) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	/* If the queue is full, the reader is not waiting. */
+	struct dp_batch empty = {0};
+	xQueueSendToFront(self->queue, &empty, 0);
+
+	return DATA_PROCESS_RET_OK;
 }
 
 
@@ -212,13 +331,47 @@ dp_ret_t dp_input_read(struct dp_input *self, struct dp_data *data) {
 		return DATA_PROCESS_RET_FAILED;
 	}
 
-	/* Wait for the data to appear on the input first. */
-	xSemaphoreTake(self->data_can_read, portMAX_DELAY);
+	dp_ret_t ret = dp_input_receive(self);
+	if (ret != DATA_PROCESS_RET_OK) {
+		return ret;
+	}
+
+	/* Frame flags are relevant only for the first/last value of a batch. */
+	data->flags = DP_DATA_NONE;
+	if (self->batch_pos == 0) {
+		data->flags |= self->batch.flags & DP_DATA_FRAME_START;
+	}
+	if (self->batch_pos == (size_t)(self->batch.len - 1)) {
+		data->flags |= self->batch.flags & DP_DATA_FRAME_END;
+	}
+	data->type = self->batch.type;
+	data->len = 1;
+	data->content.dp_bype = (uint8_t *)self->batch.values + self->batch_pos * dp_data_type_size(self->batch.type);
+	self->batch_pos++;
+
+	return DATA_PROCESS_RET_OK;
+}
+
+
+dp_ret_t dp_input_read_batch(struct dp_input *self, struct dp_data *data) {
+	if (u_assert(self != NULL) ||
+	    u_assert(data != NULL)) {
+		return DATA_PROCESS_RET_FAILED;
+	}
 
-	memcpy(data, self->data, sizeof(struct dp_data));
+	dp_ret_t ret = dp_input_receive(self);
+	if (ret != DATA_PROCESS_RET_OK) {
+		return ret;
+	}
 
-	/* And signalize the output that the data is successfully read. */
-	xSemaphoreGive(self->data_has_read);
+	data->flags = self->batch.flags;
+	if (self->batch_pos > 0) {
+		data->flags &= ~DP_DATA_FRAME_START;
+	}
+	data->type = self->batch.type;
+	data->len = self->batch.len - self->batch_pos;
+	data->content.dp_bype = (uint8_t *)self->batch.values + self->batch_pos * dp_data_type_size(self->batch.type);
+	self->batch_pos = self->batch.len;
 
 	return DATA_PROCESS_RET_OK;
 }
@@ -231,6 +384,8 @@ dp_ret_t dp_output_init(struct dp_output *self, enum dp_data_type type) {
 
 	memset(self, 0, sizeof(struct dp_output));
 	self->type = type;
+	self->pending.type = type;
+	self->batch_len = 1;
 
 	self->initialized = true;
 
@@ -244,6 +399,14 @@ dp_ret_t dp_output_free(struct dp_output *self) {
 		return DATA_PROCESS_RET_FAILED;
 	}
 
+	/* Disconnect all inputs. */
+	while (self->inputs != NULL) {
+		struct dp_input *i = self->inputs;
+		self->inputs = i->next;
+		i->output = NULL;
+		i->next = NULL;
+	}
+
 	self->initialized = false;
 
 	return DATA_PROCESS_RET_OK;
@@ -255,13 +418,85 @@ bool dp_output_is_connected(struct dp_output *self) {
 		return false;
 	}
 
-	for (size_t i = 0; i < DATA_PROCESS_MAX_INPUTS; i++) {
-		if (self->inputs != NULL) {
-			return true;
-		}
+	return self->inputs != NULL;
+}
+
+
+dp_ret_t dp_output_set_batch(struct dp_output *self, size_t batch_len) {
+	if (u_assert(self != NULL) ||
+	    u_assert(batch_len > 0 && batch_len <= DATA_PROCESS_BATCH_LEN)) {
+		return DATA_PROCESS_RET_FAILED;
 	}
 
-	return false;
+	self->batch_len = batch_len;
+
+	return DATA_PROCESS_RET_OK;
+}
+
+
+static void dp_input_enqueue(struct dp_input *self, const struct dp_batch *batch) {
+	/* Writes from within the scheduler task are processed in the same pass,
+	 * the reader is stepped after the writer. */
+	struct dp_scheduler *scheduler = (self->owner != NULL) ? self->owner->scheduler : NULL;
+	bool notify = scheduler != NULL && !dp_scheduler_is_current(scheduler);
+
+	switch (self->backpressure) {
+		case DP_BACKPRESSURE_BLOCK:
+			if (dp_scheduler_is_current(scheduler)) {
+				/* The reader is stepped by the same task later in the pass.
+				 * Blocking would deadlock, drop the batch if it doesn't fit. */
+				if (xQueueSend(self->queue, batch, 0) != pdTRUE) {
+					if (self->dropped == 0) {
+						u_log(system_log, LOG_TYPE_WARN, U_LOG_MODULE_PREFIX("scheduled input full, dropping data, increase the queue depth"));
+					}
+					self->dropped++;
+				}
+				break;
+			}
+			xQueueSend(self->queue, batch, portMAX_DELAY);
+			break;
+
+		case DP_BACKPRESSURE_DROP_NEWEST:
+			if (xQueueSend(self->queue, batch, 0) != pdTRUE) {
+				self->dropped++;
+			}
+			break;
+
+		case DP_BACKPRESSURE_DROP_OLDEST:
+			while (xQueueSend(self->queue, batch, 0) != pdTRUE) {
+				struct dp_batch old;
+				if (xQueueReceive(self->queue, &old, 0) == pdTRUE) {
+					self->dropped++;
+				}
+			}
+			break;
+
+		default:
+			break;
+	}
+
+	if (notify) {
+		dp_scheduler_notify(scheduler);
+	}
+}
+
+
+dp_ret_t dp_output_flush(struct dp_output *self) {
+	if (u_assert(self != NULL)) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	if (self->pending.len == 0) {
+		return DATA_PROCESS_RET_OK;
+	}
+
+	for (struct dp_input *i = self->inputs; i != NULL; i = i->next) {
+		dp_input_enqueue(i, &self->pending);
+	}
+	self->pending.len = 0;
+	self->pending.flags = DP_DATA_NONE;
+
+	return DATA_PROCESS_RET_OK;
 }
 
 
@@ -271,23 +506,48 @@ dp_ret_t dp_output_write(struct dp_output *self, struct dp_data *data) {
 		return DATA_PROCESS_RET_FAILED;
 	}
 
-	for (size_t i = 0; i < DATA_PROCESS_MAX_INPUTS; i++) {
-		/* Write data only to connected inputs. */
-		if (self->inputs[i] != NULL) {
-			/* Check if the data types are the same. */
-			if (u_assert(data->type == self->type && data->type == self->inputs[i]->type)) {
-				return DATA_PROCESS_RET_FAILED;
-			}
+	/* Check if the data types are the same. Inputs are checked when connected. */
+	if (u_assert(data->type == self->type)) {
+		return DATA_PROCESS_RET_FAILED;
+	}
 
-			/* Overwrite the shared pointer to the data being sent. */
-			self->inputs[i]->data = data;
+	/* Nobody is listening, do not bother copying the data. */
+	if (self->inputs == NULL) {
+		return DATA_PROCESS_RET_OK;
+	}
 
-			/* Signalize the input to read the data. */
-			xSemaphoreGive(self->inputs[i]->data_can_read);
+	/* A new frame always starts a new batch. */
+	if (data->flags & DP_DATA_FRAME_START) {
+		dp_output_flush(self);
+		self->pending.flags |= DP_DATA_FRAME_START;
+	}
 
-			/* And wait until the data is read. */
-			xSemaphoreTake(self->inputs[i]->data_has_read, portMAX_DELAY);
+	size_t size = dp_data_type_size(self->type);
+	const uint8_t *src = data->content.dp_bype;
+	size_t remaining = data->len;
+	while (remaining > 0) {
+		size_t n = self->batch_len - self->pending.len;
+		if (n > remaining) {
+			n = remaining;
 		}
+		memcpy((uint8_t *)self->pending.values + self->pending.len * size, src, n * size);
+		self->pending.len += n;
+		src += n * size;
+		remaining -= n;
+
+		if (self->pending.len >= self->batch_len) {
+			if (remaining == 0) {
+				self->pending.flags |= data->flags & DP_DATA_FRAME_END;
+			}
+			dp_output_flush(self);
+		}
+	}
+
+	/* Do not keep the end of a frame waiting. If the last batch was already
+	 * flushed above, it carries the flag and there is nothing left to mark. */
+	if ((data->flags & DP_DATA_FRAME_END) && self->pending.len > 0) {
+		self->pending.flags |= DP_DATA_FRAME_END;
+		dp_output_flush(self);
 	}
 
 	return DATA_PROCESS_RET_OK;
@@ -52,14 +52,31 @@
 #include "stdbool.h"
 #include "stdlib.h"
 
-/* Maximum number of connected inputs for a single output. */
-#define DATA_PROCESS_MAX_INPUTS 4
+#include "config.h"
+#include "FreeRTOS.h"
+#include "queue.h"
+
+/* Maximum number of values carried by a single batch over an edge. */
+#if defined(CONFIG_DATA_PROCESS_BATCH_LEN)
+	#define DATA_PROCESS_BATCH_LEN CONFIG_DATA_PROCESS_BATCH_LEN
+#else
+	#define DATA_PROCESS_BATCH_LEN 8
+#endif
+
+/* Default number of batches an input can hold before backpressure applies. */
+#if defined(CONFIG_DATA_PROCESS_QUEUE_DEPTH)
+	#define DATA_PROCESS_QUEUE_DEPTH CONFIG_DATA_PROCESS_QUEUE_DEPTH
+#else
+	#define DATA_PROCESS_QUEUE_DEPTH 4
+#endif
 
 #define DP_NODE_NAME_MAX_LEN 16
 
 typedef enum {
 	DATA_PROCESS_RET_OK = 0,
 	DATA_PROCESS_RET_FAILED,
+	/* No data available on a non-blocking input. */
+	DATA_PROCESS_RET_EMPTY,
 } dp_ret_t;
 
 enum dp_data_flags {
@@ -96,27 +113,57 @@ struct dp_data {
 	enum dp_data_type type;
 };
 
+/* What the output does if a connected input queue is full. */
+enum dp_backpressure {
+	/* Wait until the input reads some data (the output is throttled). */
+	DP_BACKPRESSURE_BLOCK = 0,
+	/* Discard the batch being written. */
+	DP_BACKPRESSURE_DROP_NEWEST,
+	/* Discard the oldest batch waiting in the queue. */
+	DP_BACKPRESSURE_DROP_OLDEST,
+};
+
+/* A batch of values passed between outputs and inputs by value. Values are
+ * stored packed according to their type, the storage is word aligned to
+ * be accessible using any of the dp_data_content pointers. */
+struct dp_batch {
+	uint32_t values[DATA_PROCESS_BATCH_LEN];
+	uint16_t len;
+	uint8_t flags;
+	uint8_t type;
+};
+
 /* Forward declaration. */
 struct dp_output;
 struct dp_input;
+struct dp_graph_node_descriptor;
+struct dp_scheduler;
 
 struct dp_input {
 	bool initialized;
 
+	/* Node the input belongs to and the next input of the same node.
+	 * NULL if the input was not registered with dp_node_add_input. */
+	struct dp_graph_node_descriptor *owner;
+	struct dp_input *owner_next;
+
 	/* Reference to the connected output. NULL if disconnected. */
 	struct dp_output *output;
 
-	/* Shared buffer for data to be passed from the corresponding output. */
-	struct dp_data *data;
+	/* Next input connected to the same output. */
+	struct dp_input *next;
 
-	/* This semaphore is signalled when the output has written data
-	 * to the shared buffer. The input can read the data now. */
-	SemaphoreHandle_t data_can_read;
+	/* Bounded queue of batches written by the output. */
+	QueueHandle_t queue;
+	size_t queue_depth;
+	enum dp_backpressure backpressure;
 
-	/* The output then waits until the data is read. The input signals this
-	 * semaphore to len the output know it can continue (and overwrite the
-	 * shared buffer with a new data. */
-	SemaphoreHandle_t data_has_read;
+	/* Number of batches discarded because the queue was full. */
+	uint32_t dropped;
+
+	/* The batch currently being read by dp_input_read. */
+	struct dp_batch batch;
+	size_t batch_pos;
 
 	/* Type of the input. */
 	enum dp_data_type type;
@@ -125,9 +172,18 @@ struct dp_input {
 struct dp_output {
 	bool initialized;
 
-	/* References to all inputs connected to this output. Each connected
+	/* Node the output belongs to and the next output of the same node. */
+	struct dp_graph_node_descriptor *owner;
+	struct dp_output *owner_next;
+
+	/* Linked list of all inputs connected to this output. Each connected
 	 * input must have a reference pointing back to the output itself. */
-	struct dp_input *inputs[DATA_PROCESS_MAX_INPUTS];
+	struct dp_input *inputs;
+
+	/* Values are accumulated here until batch_len of them is available
+	 * or until the frame ends. */
+	struct dp_batch pending;
+	size_t batch_len;
 
 	/* Type of the output. */
 	enum dp_data_type type;
@@ -148,6 +204,22 @@ struct dp_graph_node_descriptor {
 	struct dp_output *(*get_output_by_name)(const char *name, void *context);
 	void *context;
 
+	/**
+	 * Process all data available on the node inputs without blocking.
+	 * Used if the node is executed by a cooperative scheduler. Sources
+	 * produce their data when due and set @p sleep_ms to the time remaining
+	 * until they need to be stepped again. Nodes which only process data
+	 * written to their inputs leave @p sleep_ms unchanged. NULL if the node
+	 * can run in its own task only.
+	 */
+	dp_ret_t (*step)(void *context, uint32_t *sleep_ms);
+
+	/* Lists of inputs and outputs registered by the node. */
+	struct dp_input *inputs;
+	struct dp_output *outputs;
+
+	/* Scheduler executing the node. NULL if the node runs its own task. */
+	struct dp_scheduler *scheduler;
 };
 
 struct dp_graph_node {
@@ -176,6 +248,20 @@ dp_ret_t dp_graph_remove_node(struct dp_graph *self, void *node, const char *nam
 
 
 
+/**
+ * @brief Register an input as belonging to the node
+ *
+ * Registered inputs are used to find edges between nodes and they are
+ * read without blocking if the node is executed by a cooperative scheduler.
+ */
+dp_ret_t dp_node_add_input(struct dp_graph_node_descriptor *node, struct dp_input *input);
+
+/**
+ * @brief Register an output as belonging to the node
+ */
+dp_ret_t dp_node_add_output(struct dp_graph_node_descriptor *node, struct dp_output *output);
+
+
 /**
  * @brief Initialize the input instance
  */
@@ -196,11 +282,41 @@ dp_ret_t dp_input_is_connected(struct dp_input *self);
  */
 dp_ret_t dp_connect_input_to_output(struct dp_input *self, struct dp_output *output);
 
+/**
+ * @brief Set the queue depth and the backpressure policy of the input
+ *
+ * The input must not be connected.
+ *
+ * @param depth Number of batches the input is able to hold
+ */
+dp_ret_t dp_input_set_queue(struct dp_input *self, size_t depth, enum dp_backpressure backpressure);
+
+/**
+ * @brief Wake up a task waiting for data on the input
+ *
+ * The blocked dp_input_read or dp_input_read_batch returns
+ * DATA_PROCESS_RET_EMPTY. Used to stop node tasks.
+ */
+dp_ret_t dp_input_interrupt(struct dp_input *self);
+
 /**
  * @brief Read a single piece of data from the input
+ *
+ * The content pointer is valid until the next read from the same input.
+ * Inputs of nodes run by a cooperative scheduler never block, they return
+ * DATA_PROCESS_RET_EMPTY if there is no data available.
  */
 dp_ret_t dp_input_read(struct dp_input *self, struct dp_data *data);
 
+/**
+ * @brief Read all remaining values of the current batch at once
+ *
+ * Waits for a new batch if the current one is already consumed. @p data len
+ * is set to the number of values read. The content pointer is valid until
+ * the next read from the same input.
+ */
+dp_ret_t dp_input_read_batch(struct dp_input *self, struct dp_data *data);
+
 
 /**
  * @brief Initialize the output instance
@@ -218,7 +334,23 @@ dp_ret_t dp_output_free(struct dp_output *self);
 bool dp_output_is_connected(struct dp_output *self);
 
 /**
- * @brief Write a single piece of data to the output
+ * @brief Set the number of values accumulated before a batch is sent
+ *
+ * The default is 1 (every write is sent immediately). Larger batches reduce
+ * the number of queue operations and context switches at the cost of latency.
+ * A batch is always sent at the end of a frame.
+ */
+dp_ret_t dp_output_set_batch(struct dp_output *self, size_t batch_len);
+
+/**
+ * @brief Write a piece of data to the output
+ *
+ * The data is copied, @p data can be reused as soon as the function returns.
  */
 dp_ret_t dp_output_write(struct dp_output *self, struct dp_data *data);
 
+/**
+ * @brief Send all values accumulated in the output to the connected inputs
+ */
+dp_ret_t dp_output_flush(struct dp_output *self);
+
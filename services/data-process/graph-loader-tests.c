@@ -0,0 +1,373 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Declarative data-process graph loader tests
+ *
+ * Copyright (c) 2021, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "u_assert.h"
+#include "u_log.h"
+#include "u_test.h"
+
+#include <interfaces/fs.h>
+#include <interfaces/servicelocator.h>
+#include <interfaces/sensor.h>
+
+#include "data-process.h"
+#include "statistics-node.h"
+#include "graph-loader.h"
+#include "graph-loader-tests.h"
+
+#ifdef MODULE_NAME
+#undef MODULE_NAME
+#endif
+#define MODULE_NAME "dp-loader-tests"
+
+#define LOADER_TEST_FILE "graph.txt"
+#define LOADER_TEST_FILE_SIZE 512
+/* Files are read in short chunks to split lines between reads. */
+#define LOADER_TEST_READ_LEN 7
+#define LOADER_TEST_VALUES 10
+#define LOADER_TEST_TIMEOUT_MS 2000
+
+
+struct loader_test {
+	/* Fs stand-in with a single file kept in memory. */
+	Fs fs;
+	char file[LOADER_TEST_FILE_SIZE];
+	size_t file_len;
+	size_t file_pos;
+
+	/* Service locator resolving a single sensor returning consecutive
+	 * values starting from zero. */
+	IServiceLocator locator;
+	Sensor sensor;
+	uint32_t sensor_value;
+
+	struct dp_graph graph;
+	struct dp_loader loader;
+
+	/* Connected to an output of the loaded graph and read by the test. */
+	struct dp_input in;
+};
+
+
+static fs_ret_t test_fs_open(Fs *fs, File *f, const char *path, enum fs_mode mode) {
+	struct loader_test *self = (struct loader_test *)fs->parent;
+	(void)mode;
+	if (strcmp(path, LOADER_TEST_FILE)) {
+		return FS_RET_FAILED;
+	}
+	f->ptr = self;
+	self->file_pos = 0;
+	return FS_RET_OK;
+}
+
+
+static fs_ret_t test_fs_read(Fs *fs, File *f, void *buf, size_t len, size_t *read) {
+	struct loader_test *self = (struct loader_test *)fs->parent;
+	(void)f;
+	size_t rem = self->file_len - self->file_pos;
+	if (len > rem) {
+		len = rem;
+	}
+	if (len > LOADER_TEST_READ_LEN) {
+		len = LOADER_TEST_READ_LEN;
+	}
+	memcpy(buf, self->file + self->file_pos, len);
+	self->file_pos += len;
+	*read = len;
+	return FS_RET_OK;
+}
+
+
+static fs_ret_t test_fs_close(Fs *fs, File *f) {
+	(void)fs;
+	f->ptr = NULL;
+	return FS_RET_OK;
+}
+
+
+static const struct fs_vmt test_fs_vmt = {
+	.open = test_fs_open,
+	.read = test_fs_read,
+	.close = test_fs_close,
+};
+
+
+static sensor_ret_t test_sensor_value_f(Sensor *sensor, float *value) {
+	struct loader_test *self = (struct loader_test *)sensor->parent;
+	*value = (float)self->sensor_value++;
+	return SENSOR_RET_OK;
+}
+
+
+static const struct sensor_vmt test_sensor_vmt = {
+	.value_f = test_sensor_value_f,
+};
+
+
+static iservicelocator_ret_t test_locator_query_name_type(void *context, char *name, enum iservicelocator_type type, Interface **result) {
+	struct loader_test *self = (struct loader_test *)context;
+	if (type != ISERVICELOCATOR_TYPE_SENSOR || strcmp(name, "counter")) {
+		return ISERVICELOCATOR_RET_FAILED;
+	}
+	*result = (Interface *)&self->sensor;
+	return ISERVICELOCATOR_RET_OK;
+}
+
+
+static void loader_test_setup(struct loader_test *self, const char *text) {
+	memset(self, 0, sizeof(struct loader_test));
+	self->fs.vmt = &test_fs_vmt;
+	self->fs.parent = self;
+	strlcpy(self->file, text, sizeof(self->file));
+	self->file_len = strlen(self->file);
+
+	iservicelocator_init(&self->locator);
+	self->locator.vmt.query_name_type = test_locator_query_name_type;
+	self->locator.vmt.context = self;
+	self->sensor.vmt = &test_sensor_vmt;
+	self->sensor.parent = self;
+
+	dp_graph_init(&self->graph);
+	dp_loader_init(&self->loader, &self->locator, &self->graph);
+}
+
+
+/* Free the loader, all nodes must be removed from the graph. */
+static bool loader_test_free(struct loader_test *self) {
+	dp_loader_free(&self->loader);
+	bool ret = self->graph.nodes == NULL;
+	dp_graph_free(&self->graph);
+	iservicelocator_free(&self->locator);
+	return ret;
+}
+
+
+static bool loader_test_error(struct loader_test *self, const char *error, uint32_t line) {
+	if (strncmp(self->loader.error, error, strlen(error)) || self->loader.error_line != line) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("expected '%s' on line %u, got '%s' on line %u"), error, line, self->loader.error, self->loader.error_line);
+		return false;
+	}
+	return true;
+}
+
+
+static struct loader_test *loader_test;
+
+
+/* Nodes are created in the order of the description and registered in the graph. */
+static bool graph_loader_test_load_if_valid(void) {
+	struct loader_test *self = loader_test;
+	loader_test_setup(self,
+		"# counter -> statistics -> log\n"
+		"\n"
+		"node c sensor-source sensor=counter interval=10 multiplier=2\n"
+		"node s statistics window=60\n"
+		"node l log-sink\n"
+		"connect c.out s.in depth=8 policy=drop-oldest\n"
+		"connect s.avg l.in batch=4"
+	);
+
+	bool ret = dp_loader_load(&self->loader, &self->fs, LOADER_TEST_FILE) == DATA_PROCESS_RET_OK;
+	const char *names[] = {"c", "s", "l"};
+	const enum dp_node_type types[] = {DP_NODE_SENSOR_SOURCE, DP_NODE_STATISTICS_NODE, DP_NODE_LOG_SINK};
+	struct dp_graph_node *node = self->graph.nodes;
+	for (size_t i = 0; i < 3; i++) {
+		struct dp_loader_node *ln = dp_loader_find_node(&self->loader, names[i]);
+		ret = ret && ln != NULL && node != NULL && node->node == ln->node && node->type == types[i] && !strcmp(node->name, names[i]);
+		node = (node != NULL) ? node->next : NULL;
+	}
+	ret = ret && node == NULL;
+
+	struct dp_loader_node *s = dp_loader_find_node(&self->loader, "s");
+	if (ret) {
+		struct dp_statistics_node *stats = (struct dp_statistics_node *)s->node;
+		ret = stats->in.queue_depth == 8 &&
+		      stats->in.backpressure == DP_BACKPRESSURE_DROP_OLDEST &&
+		      stats->out_avg.batch_len == 4 &&
+		      stats->history_len == 60;
+	}
+
+	struct dp_loader_mem mem = {0};
+	ret = ret && dp_loader_validate(&self->loader, &mem) == DATA_PROCESS_RET_OK;
+	ret = ret && mem.queues > 0 && mem.stacks > 0 && mem.runtime > 0 &&
+	      mem.total == mem.nodes + mem.queues + mem.runtime + mem.stacks;
+
+	return loader_test_free(self) && ret;
+}
+
+
+static bool graph_loader_test_load_if_missing(void) {
+	struct loader_test *self = loader_test;
+	loader_test_setup(self, "node s statistics\n");
+
+	bool ret = dp_loader_load(&self->loader, &self->fs, "missing.txt") != DATA_PROCESS_RET_OK;
+
+	return loader_test_free(self) && ret;
+}
+
+
+/* The first error and its line is reported. Nodes created before the
+ * error are freed with the loader. */
+static bool graph_loader_test_load_if_invalid(void) {
+	struct loader_test *self = loader_test;
+	const struct {
+		const char *text;
+		const char *error;
+		uint32_t line;
+	} invalid[] = {
+		{"node a statistics\nnode b nonexistent\n", "unknown node type", 2},
+		{"node a statistics\nnode a log-sink\n", "duplicate node", 2},
+		{"node a statistics window=x\n", "bad parameter", 1},
+		{"node a statistics\nmode cooperative\n", "mode must precede nodes", 2},
+		{"node a statistics\nconnect a.avg b.in\n", "unknown node", 2},
+		{"node a statistics\nnode b log-sink\nconnect a.average b.in\n", "unknown output", 3},
+		{"node a statistics\nnode b log-sink\nconnect a.avg b.input\n", "unknown input", 3},
+		{"node a statistics\nnode b statistics\nconnect a.count b.in\n", "type mismatch", 3},
+		{"node a log-sink\nnode b statistics\nconnect b.avg a.in\nconnect b.var a.in\n", "input already connected", 4},
+		{"node a statistics\nnode b log-sink\nconnect a.avg b.in policy=fifo\n", "bad parameter", 3},
+		{"node c sensor-source sensor=missing\n", "bad parameter", 1},
+		{"# comment\nnodes a statistics\n", "unknown statement", 2},
+	};
+
+	bool ret = true;
+	for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+		loader_test_setup(self, invalid[i].text);
+		ret &= dp_loader_load(&self->loader, &self->fs, LOADER_TEST_FILE) != DATA_PROCESS_RET_OK;
+		ret &= loader_test_error(self, invalid[i].error, invalid[i].line);
+		ret &= loader_test_free(self);
+	}
+
+	/* A line longer than DP_LOADER_LINE_MAX. */
+	loader_test_setup(self, "node a statistics\n# ");
+	memset(self->file + self->file_len, 'x', DP_LOADER_LINE_MAX);
+	self->file_len += DP_LOADER_LINE_MAX;
+	ret &= dp_loader_load(&self->loader, &self->fs, LOADER_TEST_FILE) != DATA_PROCESS_RET_OK;
+	ret &= loader_test_error(self, "line too long", 2);
+	ret &= loader_test_free(self);
+
+	return ret;
+}
+
+
+static bool graph_loader_test_validate_if_invalid(void) {
+	struct loader_test *self = loader_test;
+	const struct {
+		const char *text;
+		const char *error;
+	} invalid[] = {
+		{"node s statistics\nnode l log-sink\nconnect s.avg l.in\n", "input not connected"},
+		{"node c sensor-source\nnode l log-sink\nconnect c.out l.in\n", "node not configured"},
+		{"mode cooperative\nnode a statistics\nnode b statistics\nconnect a.avg b.in\nconnect b.avg a.in\n", "graph contains a cycle"},
+	};
+
+	bool ret = true;
+	for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+		loader_test_setup(self, invalid[i].text);
+		ret &= dp_loader_load(&self->loader, &self->fs, LOADER_TEST_FILE) == DATA_PROCESS_RET_OK;
+		ret &= dp_loader_validate(&self->loader, NULL) != DATA_PROCESS_RET_OK;
+		ret &= dp_loader_start(&self->loader) != DATA_PROCESS_RET_OK;
+		ret &= loader_test_error(self, invalid[i].error, 0);
+		ret &= loader_test_free(self);
+	}
+
+	return ret;
+}
+
+
+/* Read values from the test input, they must be consecutive multiples of 2. */
+static bool loader_test_receive(struct loader_test *self, uint32_t count) {
+	for (uint32_t i = 0; i < count; i++) {
+		TickType_t start = xTaskGetTickCount();
+		while (uxQueueMessagesWaiting(self->in.queue) == 0 && self->in.batch_pos >= self->in.batch.len) {
+			if ((xTaskGetTickCount() - start) > pdMS_TO_TICKS(LOADER_TEST_TIMEOUT_MS)) {
+				u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("received %u values of %u"), i, count);
+				return false;
+			}
+			vTaskDelay(1);
+		}
+		struct dp_data data;
+		if (dp_input_read(&self->in, &data) != DATA_PROCESS_RET_OK ||
+		    data.content.dp_float[0] != (float)(2 * i)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+static bool loader_test_run(struct loader_test *self, const char *mode) {
+	char text[LOADER_TEST_FILE_SIZE];
+	snprintf(text, sizeof(text),
+		"mode %s\n"
+		"node c sensor-source sensor=counter interval=5 multiplier=2\n"
+		"node s statistics window=1\n"
+		"node l log-sink\n"
+		"connect c.out s.in\n"
+		"connect s.avg-floating l.in\n",
+		mode
+	);
+	loader_test_setup(self, text);
+
+	bool ret = dp_loader_load(&self->loader, &self->fs, LOADER_TEST_FILE) == DATA_PROCESS_RET_OK;
+	struct dp_loader_node *s = dp_loader_find_node(&self->loader, "s");
+	if (ret && s != NULL) {
+		/* Read the data passing the statistics node. */
+		struct dp_statistics_node *stats = (struct dp_statistics_node *)s->node;
+		dp_input_init(&self->in, DP_DATA_TYPE_FLOAT);
+		dp_input_set_queue(&self->in, 2 * LOADER_TEST_VALUES, DP_BACKPRESSURE_DROP_NEWEST);
+		dp_connect_input_to_output(&self->in, &stats->out_avg_floating);
+
+		ret = dp_loader_start(&self->loader) == DATA_PROCESS_RET_OK;
+		ret = ret && self->loader.running && loader_test_receive(self, LOADER_TEST_VALUES);
+		if (self->loader.running) {
+			dp_loader_stop(&self->loader);
+		}
+		dp_input_free(&self->in);
+	}
+
+	return loader_test_free(self) && ret;
+}
+
+
+static bool graph_loader_test_run_if_tasks(void) {
+	return loader_test_run(loader_test, "tasks");
+}
+
+
+static bool graph_loader_test_run_if_cooperative(void) {
+	return loader_test_run(loader_test, "cooperative");
+}
+
+
+bool graph_loader_tests(void) {
+	loader_test = malloc(sizeof(struct loader_test));
+	if (loader_test == NULL) {
+		return false;
+	}
+	bool res = true;
+
+	res &= u_test(graph_loader_test_load_if_valid());
+	res &= u_test(graph_loader_test_load_if_missing());
+	res &= u_test(graph_loader_test_load_if_invalid());
+	res &= u_test(graph_loader_test_validate_if_invalid());
+	res &= u_test(graph_loader_test_run_if_tasks());
+	res &= u_test(graph_loader_test_run_if_cooperative());
+
+	free(loader_test);
+	loader_test = NULL;
+
+	return res;
+}
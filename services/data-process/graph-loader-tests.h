@@ -0,0 +1,18 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Declarative data-process graph loader tests
+ *
+ * Copyright (c) 2021, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * Load graph descriptions from a file, check the errors reported for
+ * invalid ones, validate the loaded graphs and run them with a task per
+ * node and with the cooperative scheduler.
+ */
+bool graph_loader_tests(void);
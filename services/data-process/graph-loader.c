@@ -0,0 +1,726 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Declarative data-process graph loader
+ *
+ * Copyright (c) 2021, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "u_assert.h"
+#include "u_log.h"
+
+#include <interfaces/fs.h>
+#include <interfaces/servicelocator.h>
+#include <interfaces/sensor.h>
+
+#include "data-process.h"
+#include "graph-scheduler.h"
+#include "graph-loader.h"
+#include "sensor-source.h"
+#include "statistics-node.h"
+#include "log-sink.h"
+
+#ifdef MODULE_NAME
+#undef MODULE_NAME
+#endif
+#define MODULE_NAME "dp-loader"
+
+/* Approximate heap overhead of a single FreeRTOS queue and task. */
+#define DP_LOADER_QUEUE_OVERHEAD 80
+#define DP_LOADER_TASK_OVERHEAD 96
+
+
+static bool parse_uint32(const char *s, uint32_t *value) {
+	char *end = NULL;
+	unsigned long v = strtoul(s, &end, 10);
+	if (end == s || *end != '\0') {
+		return false;
+	}
+	*value = (uint32_t)v;
+	return true;
+}
+
+
+static bool parse_float(const char *s, float *value) {
+	char *end = NULL;
+	float v = strtof(s, &end);
+	if (end == s || *end != '\0') {
+		return false;
+	}
+	*value = v;
+	return true;
+}
+
+
+/************************************ Node classes ************************************/
+
+static dp_ret_t sensor_source_init(void *node) {
+	return dp_sensor_source_init((struct dp_sensor_source *)node);
+}
+
+
+static dp_ret_t sensor_source_free(void *node) {
+	return dp_sensor_source_free((struct dp_sensor_source *)node);
+}
+
+
+static dp_ret_t sensor_source_set(void *node, const char *key, const char *value, struct dp_loader *loader) {
+	struct dp_sensor_source *self = (struct dp_sensor_source *)node;
+
+	if (!strcmp(key, "sensor")) {
+		Interface *interface = NULL;
+		if (loader->locator == NULL ||
+		    iservicelocator_query_name_type(loader->locator, (char *)value, ISERVICELOCATOR_TYPE_SENSOR, &interface) != ISERVICELOCATOR_RET_OK) {
+			return DATA_PROCESS_RET_FAILED;
+		}
+		return dp_sensor_source_set_sensor(self, (Sensor *)interface);
+	}
+	if (!strcmp(key, "interval")) {
+		uint32_t interval_ms = 0;
+		if (!parse_uint32(value, &interval_ms)) {
+			return DATA_PROCESS_RET_FAILED;
+		}
+		return dp_sensor_source_interval(self, interval_ms);
+	}
+	if (!strcmp(key, "offset")) {
+		float offset = 0.0f;
+		if (!parse_float(value, &offset)) {
+			return DATA_PROCESS_RET_FAILED;
+		}
+		return dp_sensor_source_set_offset_multiplier(self, offset, self->multiplier);
+	}
+	if (!strcmp(key, "multiplier")) {
+		float multiplier = 0.0f;
+		if (!parse_float(value, &multiplier)) {
+			return DATA_PROCESS_RET_FAILED;
+		}
+		return dp_sensor_source_set_offset_multiplier(self, self->offset, multiplier);
+	}
+
+	return DATA_PROCESS_RET_FAILED;
+}
+
+
+static dp_ret_t sensor_source_validate(void *node) {
+	struct dp_sensor_source *self = (struct dp_sensor_source *)node;
+	if (self->sensor == NULL) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+	return DATA_PROCESS_RET_OK;
+}
+
+
+static dp_ret_t sensor_source_start(void *node) {
+	return dp_sensor_source_start((struct dp_sensor_source *)node);
+}
+
+
+static dp_ret_t sensor_source_stop(void *node) {
+	return dp_sensor_source_stop((struct dp_sensor_source *)node);
+}
+
+
+static const struct dp_node_class sensor_source_class = {
+	.name = "sensor-source",
+	.type = DP_NODE_SENSOR_SOURCE,
+	.size = sizeof(struct dp_sensor_source),
+	.stack_size = (configMINIMAL_STACK_SIZE + 128) * sizeof(StackType_t),
+	.init = sensor_source_init,
+	.free = sensor_source_free,
+	.set = sensor_source_set,
+	.validate = sensor_source_validate,
+	.start = sensor_source_start,
+	.stop = sensor_source_stop,
+};
+
+
+static dp_ret_t statistics_init(void *node) {
+	/* Only float statistics are implemented. */
+	return dp_statistics_node_init((struct dp_statistics_node *)node, "statistics", DP_DATA_TYPE_FLOAT);
+}
+
+
+static dp_ret_t statistics_free(void *node) {
+	return dp_statistics_node_free((struct dp_statistics_node *)node);
+}
+
+
+static dp_ret_t statistics_set(void *node, const char *key, const char *value, struct dp_loader *loader) {
+	(void)loader;
+	struct dp_statistics_node *self = (struct dp_statistics_node *)node;
+
+	if (!strcmp(key, "window")) {
+		uint32_t window_len = 0;
+		if (!parse_uint32(value, &window_len)) {
+			return DATA_PROCESS_RET_FAILED;
+		}
+		return dp_statistics_node_set_window(self, window_len);
+	}
+
+	return DATA_PROCESS_RET_FAILED;
+}
+
+
+static dp_ret_t statistics_start(void *node) {
+	return dp_statistics_node_start((struct dp_statistics_node *)node);
+}
+
+
+static dp_ret_t statistics_stop(void *node) {
+	return dp_statistics_node_stop((struct dp_statistics_node *)node);
+}
+
+
+static size_t statistics_runtime_size(void *node) {
+	struct dp_statistics_node *self = (struct dp_statistics_node *)node;
+	return self->history_len * (sizeof(float) + 2 * sizeof(struct dp_statistics_deque_item));
+}
+
+
+static const struct dp_node_class statistics_class = {
+	.name = "statistics",
+	.type = DP_NODE_STATISTICS_NODE,
+	.size = sizeof(struct dp_statistics_node),
+	.stack_size = (configMINIMAL_STACK_SIZE + 256) * sizeof(StackType_t),
+	.init = statistics_init,
+	.free = statistics_free,
+	.set = statistics_set,
+	.start = statistics_start,
+	.stop = statistics_stop,
+	.runtime_size = statistics_runtime_size,
+};
+
+
+static dp_ret_t log_sink_init(void *node) {
+	return dp_log_sink_init((struct dp_log_sink *)node, DP_DATA_TYPE_FLOAT);
+}
+
+
+static dp_ret_t log_sink_free(void *node) {
+	return dp_log_sink_free((struct dp_log_sink *)node);
+}
+
+
+static dp_ret_t log_sink_start(void *node) {
+	return dp_log_sink_start((struct dp_log_sink *)node);
+}
+
+
+static dp_ret_t log_sink_stop(void *node) {
+	return dp_log_sink_stop((struct dp_log_sink *)node);
+}
+
+
+static const struct dp_node_class log_sink_class = {
+	.name = "log-sink",
+	.type = DP_NODE_LOG_SINK,
+	.size = sizeof(struct dp_log_sink),
+	.stack_size = (configMINIMAL_STACK_SIZE + 128) * sizeof(StackType_t),
+	.init = log_sink_init,
+	.free = log_sink_free,
+	.start = log_sink_start,
+	.stop = log_sink_stop,
+};
+
+
+const struct dp_node_class *const dp_node_classes[] = {
+	&sensor_source_class,
+	&statistics_class,
+	&log_sink_class,
+	NULL
+};
+
+
+static const struct dp_node_class *find_class(const char *name) {
+	for (size_t i = 0; dp_node_classes[i] != NULL; i++) {
+		if (!strcmp(dp_node_classes[i]->name, name)) {
+			return dp_node_classes[i];
+		}
+	}
+	return NULL;
+}
+
+
+/************************************ Parser ************************************/
+
+static dp_ret_t loader_error(struct dp_loader *self, const char *msg, const char *arg) {
+	/* Keep the first error only. */
+	if (self->error[0] == '\0') {
+		if (arg[0] != '\0') {
+			snprintf(self->error, sizeof(self->error), "%s '%s'", msg, arg);
+		} else {
+			snprintf(self->error, sizeof(self->error), "%s", msg);
+		}
+	}
+	return DATA_PROCESS_RET_FAILED;
+}
+
+
+static size_t tokenize(char *line, char **tokens, size_t max) {
+	size_t n = 0;
+	while (*line != '\0' && n < max) {
+		while (*line == ' ' || *line == '\t' || *line == '\r') {
+			*line++ = '\0';
+		}
+		if (*line == '\0') {
+			break;
+		}
+		tokens[n++] = line;
+		while (*line != '\0' && *line != ' ' && *line != '\t' && *line != '\r') {
+			line++;
+		}
+	}
+	return n;
+}
+
+
+/* Split <node>.<port> and resolve the node. */
+static struct dp_loader_node *parse_port(struct dp_loader *self, char *s, char **port) {
+	char *dot = strchr(s, '.');
+	if (dot == NULL) {
+		return NULL;
+	}
+	*dot = '\0';
+	*port = dot + 1;
+	return dp_loader_find_node(self, s);
+}
+
+
+static dp_ret_t parse_mode(struct dp_loader *self, char **tokens, size_t n) {
+	if (n != 2) {
+		return loader_error(self, "wrong mode", "");
+	}
+	if (self->nodes != NULL) {
+		return loader_error(self, "mode must precede nodes", tokens[1]);
+	}
+	if (!strcmp(tokens[1], "cooperative")) {
+		self->cooperative = true;
+	} else if (!strcmp(tokens[1], "tasks")) {
+		self->cooperative = false;
+	} else {
+		return loader_error(self, "unknown mode", tokens[1]);
+	}
+	return DATA_PROCESS_RET_OK;
+}
+
+
+static dp_ret_t parse_node(struct dp_loader *self, char **tokens, size_t n) {
+	if (n < 3) {
+		return loader_error(self, "wrong node definition", "");
+	}
+	if (strlen(tokens[1]) >= DP_NODE_NAME_MAX_LEN) {
+		return loader_error(self, "node name too long", tokens[1]);
+	}
+	if (dp_loader_find_node(self, tokens[1]) != NULL) {
+		return loader_error(self, "duplicate node", tokens[1]);
+	}
+	const struct dp_node_class *cls = find_class(tokens[2]);
+	if (cls == NULL) {
+		return loader_error(self, "unknown node type", tokens[2]);
+	}
+
+	struct dp_loader_node *ln = calloc(1, sizeof(struct dp_loader_node));
+	void *node = calloc(1, cls->size);
+	if (ln == NULL || node == NULL) {
+		free(ln);
+		free(node);
+		return loader_error(self, "out of memory", tokens[1]);
+	}
+	if (cls->init(node) != DATA_PROCESS_RET_OK) {
+		free(ln);
+		free(node);
+		return loader_error(self, "cannot initialize", tokens[1]);
+	}
+	strlcpy(ln->name, tokens[1], sizeof(ln->name));
+	ln->cls = cls;
+	ln->node = node;
+	if (self->graph != NULL && dp_graph_add_node(self->graph, node, cls->type, ln->name) != DATA_PROCESS_RET_OK) {
+		cls->free(node);
+		free(ln);
+		free(node);
+		return loader_error(self, "cannot register", tokens[1]);
+	}
+
+	/* Append to keep the order of the description. */
+	struct dp_loader_node **last = &self->nodes;
+	while (*last != NULL) {
+		last = &(*last)->next;
+	}
+	*last = ln;
+
+	if (self->cooperative) {
+		struct dp_graph_node_descriptor *d = (struct dp_graph_node_descriptor *)node;
+		if (d->step == NULL) {
+			return loader_error(self, "node cannot run cooperatively", tokens[1]);
+		}
+		if (dp_scheduler_add_node(&self->scheduler, d) != DATA_PROCESS_RET_OK) {
+			return loader_error(self, "cannot schedule", tokens[1]);
+		}
+	}
+
+	for (size_t i = 3; i < n; i++) {
+		char *eq = strchr(tokens[i], '=');
+		if (eq == NULL) {
+			return loader_error(self, "expected key=value", tokens[i]);
+		}
+		*eq = '\0';
+		if (cls->set == NULL || cls->set(node, tokens[i], eq + 1, self) != DATA_PROCESS_RET_OK) {
+			return loader_error(self, "bad parameter", tokens[i]);
+		}
+	}
+
+	return DATA_PROCESS_RET_OK;
+}
+
+
+static dp_ret_t parse_connect(struct dp_loader *self, char **tokens, size_t n) {
+	if (n < 3) {
+		return loader_error(self, "wrong connection", "");
+	}
+
+	char *out_name = NULL;
+	char *in_name = NULL;
+	struct dp_loader_node *from = parse_port(self, tokens[1], &out_name);
+	struct dp_loader_node *to = parse_port(self, tokens[2], &in_name);
+	if (from == NULL) {
+		return loader_error(self, "unknown node", tokens[1]);
+	}
+	if (to == NULL) {
+		return loader_error(self, "unknown node", tokens[2]);
+	}
+
+	struct dp_graph_node_descriptor *fd = (struct dp_graph_node_descriptor *)from->node;
+	struct dp_graph_node_descriptor *td = (struct dp_graph_node_descriptor *)to->node;
+	struct dp_output *out = fd->get_output_by_name(out_name, fd->context);
+	struct dp_input *in = td->get_input_by_name(in_name, td->context);
+	if (out == NULL) {
+		return loader_error(self, "unknown output", out_name);
+	}
+	if (in == NULL) {
+		return loader_error(self, "unknown input", in_name);
+	}
+
+	size_t depth = in->queue_depth;
+	enum dp_backpressure policy = in->backpressure;
+	for (size_t i = 3; i < n; i++) {
+		char *eq = strchr(tokens[i], '=');
+		if (eq == NULL) {
+			return loader_error(self, "expected key=value", tokens[i]);
+		}
+		*eq = '\0';
+		const char *value = eq + 1;
+		uint32_t v = 0;
+		if (!strcmp(tokens[i], "depth") && parse_uint32(value, &v) && v > 0) {
+			depth = v;
+		} else if (!strcmp(tokens[i], "batch") && parse_uint32(value, &v) && v > 0 && v <= DATA_PROCESS_BATCH_LEN) {
+			dp_output_set_batch(out, v);
+		} else if (!strcmp(tokens[i], "policy") && !strcmp(value, "block")) {
+			policy = DP_BACKPRESSURE_BLOCK;
+		} else if (!strcmp(tokens[i], "policy") && !strcmp(value, "drop-newest")) {
+			policy = DP_BACKPRESSURE_DROP_NEWEST;
+		} else if (!strcmp(tokens[i], "policy") && !strcmp(value, "drop-oldest")) {
+			policy = DP_BACKPRESSURE_DROP_OLDEST;
+		} else {
+			return loader_error(self, "bad parameter", tokens[i]);
+		}
+	}
+
+	if (in->output != NULL) {
+		return loader_error(self, "input already connected", in_name);
+	}
+	if (in->type != out->type) {
+		return loader_error(self, "type mismatch", in_name);
+	}
+	if (dp_input_set_queue(in, depth, policy) != DATA_PROCESS_RET_OK) {
+		return loader_error(self, "cannot set queue", in_name);
+	}
+	if (dp_connect_input_to_output(in, out) != DATA_PROCESS_RET_OK) {
+		return loader_error(self, "cannot connect", in_name);
+	}
+
+	return DATA_PROCESS_RET_OK;
+}
+
+
+/************************************ Loader API ************************************/
+
+dp_ret_t dp_loader_init(struct dp_loader *self, IServiceLocator *locator, struct dp_graph *graph) {
+	if (u_assert(self != NULL)) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	memset(self, 0, sizeof(struct dp_loader));
+	self->locator = locator;
+	self->graph = graph;
+	if (dp_scheduler_init(&self->scheduler) != DATA_PROCESS_RET_OK) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	self->initialized = true;
+	return DATA_PROCESS_RET_OK;
+}
+
+
+dp_ret_t dp_loader_free(struct dp_loader *self) {
+	if (u_assert(self != NULL) ||
+	    u_assert(self->initialized == true)) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	if (self->running) {
+		dp_loader_stop(self);
+	}
+	dp_scheduler_free(&self->scheduler);
+
+	while (self->nodes != NULL) {
+		struct dp_loader_node *ln = self->nodes;
+		self->nodes = ln->next;
+		if (self->graph != NULL) {
+			dp_graph_remove_node(self->graph, ln->node, NULL);
+		}
+		ln->cls->free(ln->node);
+		free(ln->node);
+		free(ln);
+	}
+
+	self->initialized = false;
+	return DATA_PROCESS_RET_OK;
+}
+
+
+struct dp_loader_node *dp_loader_find_node(struct dp_loader *self, const char *name) {
+	if (u_assert(self != NULL) ||
+	    u_assert(name != NULL)) {
+		return NULL;
+	}
+
+	for (struct dp_loader_node *ln = self->nodes; ln != NULL; ln = ln->next) {
+		if (!strcmp(ln->name, name)) {
+			return ln;
+		}
+	}
+	return NULL;
+}
+
+
+dp_ret_t dp_loader_parse_line(struct dp_loader *self, char *line) {
+	if (u_assert(self != NULL) ||
+	    u_assert(self->initialized == true) ||
+	    u_assert(self->running == false) ||
+	    u_assert(line != NULL)) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	char *tokens[DP_LOADER_TOKENS_MAX];
+	size_t n = tokenize(line, tokens, DP_LOADER_TOKENS_MAX);
+	if (n == 0 || tokens[0][0] == '#') {
+		return DATA_PROCESS_RET_OK;
+	}
+
+	if (!strcmp(tokens[0], "mode")) {
+		return parse_mode(self, tokens, n);
+	}
+	if (!strcmp(tokens[0], "node")) {
+		return parse_node(self, tokens, n);
+	}
+	if (!strcmp(tokens[0], "connect")) {
+		return parse_connect(self, tokens, n);
+	}
+
+	return loader_error(self, "unknown statement", tokens[0]);
+}
+
+
+dp_ret_t dp_loader_parse(struct dp_loader *self, char *text) {
+	if (u_assert(self != NULL) ||
+	    u_assert(text != NULL)) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	uint32_t line_num = 0;
+	while (text != NULL && *text != '\0') {
+		char *eol = strchr(text, '\n');
+		if (eol != NULL) {
+			*eol = '\0';
+		}
+		line_num++;
+		if (dp_loader_parse_line(self, text) != DATA_PROCESS_RET_OK) {
+			self->error_line = line_num;
+			u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("line %u: %s"), line_num, self->error);
+			return DATA_PROCESS_RET_FAILED;
+		}
+		text = (eol != NULL) ? eol + 1 : NULL;
+	}
+
+	return DATA_PROCESS_RET_OK;
+}
+
+
+dp_ret_t dp_loader_load(struct dp_loader *self, Fs *fs, const char *path) {
+	if (u_assert(self != NULL) ||
+	    u_assert(fs != NULL) ||
+	    u_assert(path != NULL)) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	File f;
+	if (fs->vmt->open(fs, &f, path, FS_MODE_READONLY) != FS_RET_OK) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("cannot open '%s'"), path);
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	/* Read the file in chunks and parse it line by line, only a single
+	 * line is kept in memory. */
+	dp_ret_t ret = DATA_PROCESS_RET_OK;
+	char line[DP_LOADER_LINE_MAX];
+	size_t line_len = 0;
+	uint32_t line_num = 0;
+	bool eof = false;
+	while (!eof && ret == DATA_PROCESS_RET_OK) {
+		char buf[32];
+		size_t read = 0;
+		if (fs->vmt->read(fs, &f, buf, sizeof(buf), &read) != FS_RET_OK || read == 0) {
+			/* Parse the last line without a newline. */
+			eof = true;
+			buf[0] = '\n';
+			read = 1;
+		}
+		for (size_t i = 0; i < read && ret == DATA_PROCESS_RET_OK; i++) {
+			if (buf[i] != '\n') {
+				if (line_len >= sizeof(line) - 1) {
+					ret = loader_error(self, "line too long", "");
+					self->error_line = line_num + 1;
+					break;
+				}
+				line[line_len++] = buf[i];
+				continue;
+			}
+			line[line_len] = '\0';
+			line_len = 0;
+			line_num++;
+			if (dp_loader_parse_line(self, line) != DATA_PROCESS_RET_OK) {
+				self->error_line = line_num;
+				ret = DATA_PROCESS_RET_FAILED;
+			}
+		}
+	}
+	fs->vmt->close(fs, &f);
+
+	if (ret != DATA_PROCESS_RET_OK) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("%s:%u: %s"), path, self->error_line, self->error);
+	}
+	return ret;
+}
+
+
+dp_ret_t dp_loader_validate(struct dp_loader *self, struct dp_loader_mem *mem) {
+	if (u_assert(self != NULL) ||
+	    u_assert(self->initialized == true)) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	struct dp_loader_mem m = {0};
+	for (struct dp_loader_node *ln = self->nodes; ln != NULL; ln = ln->next) {
+		struct dp_graph_node_descriptor *d = (struct dp_graph_node_descriptor *)ln->node;
+
+		if (ln->cls->validate != NULL && ln->cls->validate(ln->node) != DATA_PROCESS_RET_OK) {
+			return loader_error(self, "node not configured", ln->name);
+		}
+		for (struct dp_input *i = d->inputs; i != NULL; i = i->owner_next) {
+			if (i->output == NULL) {
+				return loader_error(self, "input not connected", ln->name);
+			}
+			m.queues += i->queue_depth * sizeof(struct dp_batch) + DP_LOADER_QUEUE_OVERHEAD;
+		}
+
+		m.nodes += sizeof(struct dp_loader_node) + ln->cls->size;
+		if (ln->cls->runtime_size != NULL) {
+			m.runtime += ln->cls->runtime_size(ln->node);
+		}
+		if (!self->cooperative) {
+			m.stacks += ln->cls->stack_size + DP_LOADER_TASK_OVERHEAD;
+		}
+	}
+	if (self->cooperative) {
+		if (dp_scheduler_sort(&self->scheduler) != DATA_PROCESS_RET_OK) {
+			return loader_error(self, "graph contains a cycle", "");
+		}
+		m.stacks = DP_SCHEDULER_STACK_SIZE * sizeof(StackType_t) + DP_LOADER_TASK_OVERHEAD;
+	}
+	m.total = m.nodes + m.queues + m.runtime + m.stacks;
+
+	if (mem != NULL) {
+		*mem = m;
+	}
+	return DATA_PROCESS_RET_OK;
+}
+
+
+dp_ret_t dp_loader_start(struct dp_loader *self) {
+	if (u_assert(self != NULL) ||
+	    u_assert(self->initialized == true) ||
+	    u_assert(self->running == false)) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	struct dp_loader_mem mem;
+	if (dp_loader_validate(self, &mem) != DATA_PROCESS_RET_OK) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("invalid graph: %s"), self->error);
+		return DATA_PROCESS_RET_FAILED;
+	}
+	u_log(system_log, LOG_TYPE_INFO,
+		U_LOG_MODULE_PREFIX("starting graph, memory required %u B (nodes %u B, queues %u B, runtime %u B, stacks %u B)"),
+		mem.total, mem.nodes, mem.queues, mem.runtime, mem.stacks
+	);
+
+	struct dp_loader_node *ln = self->nodes;
+	for (; ln != NULL; ln = ln->next) {
+		if (ln->cls->start(ln->node) != DATA_PROCESS_RET_OK) {
+			loader_error(self, "cannot start", ln->name);
+			goto err;
+		}
+	}
+	if (self->cooperative) {
+		if (dp_scheduler_start(&self->scheduler, "dp-graph", 1) != DATA_PROCESS_RET_OK) {
+			loader_error(self, "cannot start scheduler", "");
+			goto err;
+		}
+	}
+
+	self->running = true;
+	return DATA_PROCESS_RET_OK;
+
+err:
+	u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("%s"), self->error);
+	/* Stop the nodes which were already started. */
+	for (struct dp_loader_node *s = self->nodes; s != ln; s = s->next) {
+		s->cls->stop(s->node);
+	}
+	return DATA_PROCESS_RET_FAILED;
+}
+
+
+dp_ret_t dp_loader_stop(struct dp_loader *self) {
+	if (u_assert(self != NULL) ||
+	    u_assert(self->running == true)) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	if (self->cooperative) {
+		dp_scheduler_stop(&self->scheduler);
+	}
+	for (struct dp_loader_node *ln = self->nodes; ln != NULL; ln = ln->next) {
+		ln->cls->stop(ln->node);
+	}
+
+	self->running = false;
+	return DATA_PROCESS_RET_OK;
+}
@@ -0,0 +1,159 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Declarative data-process graph loader
+ *
+ * Copyright (c) 2021, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+/**
+ * Builds data-process graphs from a line based text description instead
+ * of wiring nodes in C. Empty lines and lines starting with # are ignored.
+ *
+ *     # run all nodes in a single task (default is a task per node)
+ *     mode cooperative
+ *
+ *     # node <name> <type> [<parameter>=<value> ...]
+ *     node t sensor-source sensor=temp1 interval=1000
+ *     node s statistics window=60
+ *     node l log-sink
+ *
+ *     # connect <node>.<output> <node>.<input> [depth=<n>] [policy=<p>] [batch=<n>]
+ *     connect t.out s.in
+ *     connect s.avg l.in depth=8 policy=drop-oldest
+ *
+ * depth and policy (block, drop-newest, drop-oldest) configure the queue
+ * of the input, batch sets the number of values the output accumulates
+ * before sending them.
+ *
+ * Node types are looked up in a static registry (dp_node_classes).
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <interfaces/fs.h>
+#include <interfaces/servicelocator.h>
+
+#include "data-process.h"
+#include "graph-scheduler.h"
+
+#define DP_LOADER_LINE_MAX 128
+#define DP_LOADER_TOKENS_MAX 10
+#define DP_LOADER_ERROR_LEN 48
+
+struct dp_loader;
+
+/* A node type which can be instantiated by the loader. The node structure
+ * must start with a struct dp_graph_node_descriptor. */
+struct dp_node_class {
+	const char *name;
+	enum dp_node_type type;
+	size_t size;
+
+	/* Stack of the node task in bytes when running in its own task. */
+	size_t stack_size;
+
+	dp_ret_t (*init)(void *node);
+	dp_ret_t (*free)(void *node);
+	dp_ret_t (*set)(void *node, const char *key, const char *value, struct dp_loader *loader);
+	dp_ret_t (*validate)(void *node);
+	dp_ret_t (*start)(void *node);
+	dp_ret_t (*stop)(void *node);
+
+	/* Memory allocated by the node when started. Optional. */
+	size_t (*runtime_size)(void *node);
+};
+
+extern const struct dp_node_class *const dp_node_classes[];
+
+struct dp_loader_node {
+	char name[DP_NODE_NAME_MAX_LEN];
+	const struct dp_node_class *cls;
+	void *node;
+	struct dp_loader_node *next;
+};
+
+/* Memory required to run the loaded graph, in bytes. */
+struct dp_loader_mem {
+	size_t nodes;
+	size_t queues;
+	size_t runtime;
+	size_t stacks;
+	size_t total;
+};
+
+struct dp_loader {
+	bool initialized;
+	bool cooperative;
+	bool running;
+
+	IServiceLocator *locator;
+
+	/* Graph the loaded nodes are registered in. May be NULL. */
+	struct dp_graph *graph;
+
+	struct dp_loader_node *nodes;
+	struct dp_scheduler scheduler;
+
+	/* Description of the first error encountered. */
+	uint32_t error_line;
+	char error[DP_LOADER_ERROR_LEN];
+};
+
+
+/**
+ * @brief Initialize the loader
+ *
+ * @param locator Used to resolve interfaces referenced by node parameters.
+ * @param graph Nodes created by the loader are added to this graph to make
+ *              them visible to the rest of the system (eg. the CLI). May be NULL.
+ */
+dp_ret_t dp_loader_init(struct dp_loader *self, IServiceLocator *locator, struct dp_graph *graph);
+
+/**
+ * @brief Stop the graph if running and free all nodes created by the loader
+ *
+ * The nodes are removed from the graph they were registered in.
+ */
+dp_ret_t dp_loader_free(struct dp_loader *self);
+
+/**
+ * @brief Parse a single line of the graph description
+ */
+dp_ret_t dp_loader_parse_line(struct dp_loader *self, char *line);
+
+/**
+ * @brief Parse a whole graph description
+ *
+ * @param text Zero terminated description. It is modified during parsing.
+ */
+dp_ret_t dp_loader_parse(struct dp_loader *self, char *text);
+
+/**
+ * @brief Load a graph description from a file
+ */
+dp_ret_t dp_loader_load(struct dp_loader *self, Fs *fs, const char *path);
+
+/**
+ * @brief Check the loaded graph and compute the memory it requires
+ *
+ * All registered inputs must be connected, all nodes must be configured
+ * and cooperative graphs must not contain cycles.
+ *
+ * @param mem Memory required to start the graph. May be NULL.
+ */
+dp_ret_t dp_loader_validate(struct dp_loader *self, struct dp_loader_mem *mem);
+
+/**
+ * @brief Validate and start all nodes of the loaded graph
+ *
+ * The memory required to run the graph is logged before the nodes are started.
+ */
+dp_ret_t dp_loader_start(struct dp_loader *self);
+dp_ret_t dp_loader_stop(struct dp_loader *self);
+
+struct dp_loader_node *dp_loader_find_node(struct dp_loader *self, const char *name);
@@ -0,0 +1,474 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Cooperative data-process scheduler tests
+ *
+ * Copyright (c) 2021, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "u_assert.h"
+#include "u_log.h"
+#include "u_test.h"
+
+#include "data-process.h"
+#include "graph-scheduler.h"
+#include "statistics-node.h"
+#include "graph-scheduler-tests.h"
+
+#ifdef MODULE_NAME
+#undef MODULE_NAME
+#endif
+#define MODULE_NAME "dp-scheduler-tests"
+
+/* The latency benchmark graph has 5 relays and a sink. */
+#define SCHED_TEST_RELAYS 5
+#define SCHED_TEST_TIMEOUT_MS 5000
+#define SCHED_TEST_WAKEUP_MS 20
+#define SCHED_TEST_LATENCY_VALUES 1000
+
+
+/* Scheduled source writing consecutive values in an interval. */
+struct sched_test_source {
+	struct dp_graph_node_descriptor descriptor;
+	struct dp_output out;
+	uint32_t count;
+	uint32_t sent;
+	uint32_t interval_ms;
+	TickType_t next;
+};
+
+/* Sink checking the order of values. It runs in its own task if not
+ * scheduled. The test task is notified on every value received. */
+struct sched_test_sink {
+	struct dp_graph_node_descriptor descriptor;
+	struct dp_input in;
+	volatile uint32_t received;
+	uint32_t errors;
+	TaskHandle_t notify;
+	volatile bool can_run;
+	volatile bool running;
+};
+
+struct sched_test {
+	bool cooperative;
+	size_t relays;
+	struct dp_scheduler scheduler;
+
+	/* Written by the test task if the graph has no source. */
+	struct dp_output entry;
+	bool has_source;
+	struct sched_test_source source;
+
+	/* Statistics nodes with a window of 1 value pass the values unchanged. */
+	struct dp_statistics_node relay[SCHED_TEST_RELAYS];
+	struct sched_test_sink sink;
+};
+
+
+static dp_ret_t sched_test_source_step(void *context, uint32_t *sleep_ms) {
+	struct sched_test_source *self = (struct sched_test_source *)context;
+
+	if (self->sent >= self->count) {
+		return DATA_PROCESS_RET_OK;
+	}
+
+	TickType_t now = xTaskGetTickCount();
+	if ((int32_t)(now - self->next) >= 0) {
+		float value = (float)self->sent;
+		struct dp_data data = {
+			.len = 1,
+			.flags = DP_DATA_NONE,
+			.type = DP_DATA_TYPE_FLOAT,
+			.content.dp_float = &value,
+		};
+		dp_output_write(&self->out, &data);
+		self->sent++;
+		self->next = now + pdMS_TO_TICKS(self->interval_ms);
+	}
+	*sleep_ms = (self->next - now) * portTICK_PERIOD_MS;
+
+	return DATA_PROCESS_RET_OK;
+}
+
+
+static void sched_test_source_init(struct sched_test_source *self, uint32_t count, uint32_t interval_ms) {
+	dp_output_init(&self->out, DP_DATA_TYPE_FLOAT);
+	self->count = count;
+	self->interval_ms = interval_ms;
+	self->next = xTaskGetTickCount();
+	self->descriptor.step = sched_test_source_step;
+	self->descriptor.context = (void *)self;
+	dp_node_add_output(&self->descriptor, &self->out);
+}
+
+
+static void sched_test_sink_process(struct sched_test_sink *self, struct dp_data *data) {
+	for (size_t i = 0; i < data->len; i++) {
+		if (data->content.dp_float[i] != (float)self->received) {
+			self->errors++;
+		}
+		self->received++;
+	}
+	if (self->notify != NULL) {
+		xTaskNotifyGive(self->notify);
+	}
+}
+
+
+static dp_ret_t sched_test_sink_step(void *context, uint32_t *sleep_ms) {
+	struct sched_test_sink *self = (struct sched_test_sink *)context;
+	(void)sleep_ms;
+
+	struct dp_data data;
+	while (self->can_run && dp_input_read_batch(&self->in, &data) == DATA_PROCESS_RET_OK) {
+		sched_test_sink_process(self, &data);
+	}
+
+	return DATA_PROCESS_RET_OK;
+}
+
+
+static void sched_test_sink_task(void *p) {
+	struct sched_test_sink *self = (struct sched_test_sink *)p;
+
+	self->running = true;
+	while (self->can_run) {
+		struct dp_data data;
+		if (dp_input_read_batch(&self->in, &data) == DATA_PROCESS_RET_OK) {
+			sched_test_sink_process(self, &data);
+		}
+	}
+	self->running = false;
+
+	vTaskDelete(NULL);
+}
+
+
+static void sched_test_sink_init(struct sched_test_sink *self) {
+	dp_input_init(&self->in, DP_DATA_TYPE_FLOAT);
+	self->notify = xTaskGetCurrentTaskHandle();
+	self->descriptor.step = sched_test_sink_step;
+	self->descriptor.context = (void *)self;
+	dp_node_add_input(&self->descriptor, &self->in);
+}
+
+
+static void sched_test_sink_start(struct sched_test_sink *self) {
+	self->can_run = true;
+	if (self->descriptor.scheduler != NULL) {
+		dp_scheduler_attach_node(self->descriptor.scheduler, &self->descriptor);
+		return;
+	}
+	self->running = true;
+	xTaskCreate(sched_test_sink_task, "dp-test-sink", configMINIMAL_STACK_SIZE + 128, (void *)self, 1, NULL);
+}
+
+
+static void sched_test_sink_stop(struct sched_test_sink *self) {
+	self->can_run = false;
+	if (self->descriptor.scheduler != NULL) {
+		dp_scheduler_detach_node(self->descriptor.scheduler, &self->descriptor);
+		return;
+	}
+	dp_input_interrupt(&self->in);
+	while (self->running) {
+		vTaskDelay(1);
+	}
+}
+
+
+/* A chain of @p relays statistics nodes between the source (or the entry
+ * output written by the test) and the sink. */
+static void sched_test_setup(struct sched_test *self, bool cooperative, size_t relays, uint32_t source_count) {
+	memset(self, 0, sizeof(struct sched_test));
+	self->cooperative = cooperative;
+	self->relays = relays;
+	if (cooperative) {
+		dp_scheduler_init(&self->scheduler);
+	}
+
+	dp_output_init(&self->entry, DP_DATA_TYPE_FLOAT);
+	struct dp_output *prev = &self->entry;
+	if (source_count > 0) {
+		self->has_source = true;
+		sched_test_source_init(&self->source, source_count, 1);
+		prev = &self->source.out;
+	}
+	for (size_t i = 0; i < relays; i++) {
+		dp_statistics_node_init(&self->relay[i], "relay", DP_DATA_TYPE_FLOAT);
+		dp_statistics_node_set_window(&self->relay[i], 1);
+		dp_connect_input_to_output(&self->relay[i].in, prev);
+		prev = &self->relay[i].out_avg_floating;
+	}
+	sched_test_sink_init(&self->sink);
+	dp_connect_input_to_output(&self->sink.in, prev);
+
+	if (cooperative) {
+		/* Added in the reverse order, the scheduler must sort them. */
+		dp_scheduler_add_node(&self->scheduler, &self->sink.descriptor);
+		for (size_t i = 0; i < relays; i++) {
+			dp_scheduler_add_node(&self->scheduler, &self->relay[i].descriptor);
+		}
+		if (self->has_source) {
+			dp_scheduler_add_node(&self->scheduler, &self->source.descriptor);
+		}
+	}
+}
+
+
+static bool sched_test_start(struct sched_test *self) {
+	sched_test_sink_start(&self->sink);
+	for (size_t i = 0; i < self->relays; i++) {
+		dp_statistics_node_start(&self->relay[i]);
+	}
+	if (self->cooperative) {
+		return dp_scheduler_start(&self->scheduler, "dp-test", 1) == DATA_PROCESS_RET_OK;
+	}
+	return true;
+}
+
+
+static void sched_test_stop(struct sched_test *self) {
+	if (self->cooperative && self->scheduler.running) {
+		dp_scheduler_stop(&self->scheduler);
+	}
+	sched_test_sink_stop(&self->sink);
+	for (size_t i = 0; i < self->relays; i++) {
+		dp_statistics_node_stop(&self->relay[i]);
+	}
+}
+
+
+static void sched_test_free(struct sched_test *self) {
+	if (self->cooperative) {
+		dp_scheduler_free(&self->scheduler);
+	}
+	for (size_t i = 0; i < self->relays; i++) {
+		dp_statistics_node_free(&self->relay[i]);
+	}
+	dp_input_free(&self->sink.in);
+	if (self->has_source) {
+		dp_output_free(&self->source.out);
+	}
+	dp_output_free(&self->entry);
+}
+
+
+static void write_value(struct dp_output *out, uint32_t i) {
+	float value = (float)i;
+	struct dp_data data = {
+		.len = 1,
+		.flags = DP_DATA_NONE,
+		.type = DP_DATA_TYPE_FLOAT,
+		.content.dp_float = &value,
+	};
+	dp_output_write(out, &data);
+}
+
+
+/* Wait until the sink receives @p count values in total. */
+static bool wait_received(struct sched_test *self, uint32_t count) {
+	TickType_t start = xTaskGetTickCount();
+	while (self->sink.received < count) {
+		if ((xTaskGetTickCount() - start) > pdMS_TO_TICKS(SCHED_TEST_TIMEOUT_MS)) {
+			u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("received %u values of %u"), self->sink.received, count);
+			return false;
+		}
+		ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));
+	}
+	return true;
+}
+
+
+static struct sched_test *sched_test;
+
+
+static bool graph_scheduler_test_sort_if_topological(void) {
+	struct sched_test *self = sched_test;
+	sched_test_setup(self, true, 4, 1);
+
+	bool ret = dp_scheduler_sort(&self->scheduler) == DATA_PROCESS_RET_OK;
+	struct dp_graph_node_descriptor *order[] = {
+		&self->source.descriptor,
+		&self->relay[0].descriptor,
+		&self->relay[1].descriptor,
+		&self->relay[2].descriptor,
+		&self->relay[3].descriptor,
+		&self->sink.descriptor,
+	};
+	struct dp_scheduler_node *n = self->scheduler.nodes;
+	for (size_t i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+		ret = ret && n != NULL && n->node == order[i];
+		n = (n != NULL) ? n->next : NULL;
+	}
+
+	sched_test_free(self);
+	return ret && n == NULL;
+}
+
+
+/* A cycle is refused and no node is lost. */
+static bool graph_scheduler_test_sort_if_cycle(void) {
+	struct dp_scheduler scheduler;
+	struct dp_statistics_node *relay = sched_test->relay;
+
+	dp_scheduler_init(&scheduler);
+	for (size_t i = 0; i < 2; i++) {
+		dp_statistics_node_init(&relay[i], "relay", DP_DATA_TYPE_FLOAT);
+		dp_scheduler_add_node(&scheduler, &relay[i].descriptor);
+	}
+	dp_connect_input_to_output(&relay[0].in, &relay[1].out_avg_floating);
+	dp_connect_input_to_output(&relay[1].in, &relay[0].out_avg_floating);
+
+	bool ret = dp_scheduler_sort(&scheduler) != DATA_PROCESS_RET_OK;
+	size_t nodes = 0;
+	for (struct dp_scheduler_node *n = scheduler.nodes; n != NULL; n = n->next) {
+		nodes++;
+	}
+
+	dp_scheduler_free(&scheduler);
+	for (size_t i = 0; i < 2; i++) {
+		dp_statistics_node_free(&relay[i]);
+	}
+	return ret && nodes == 2;
+}
+
+
+/* Values produced by a scheduled source pass the whole graph in order. */
+static bool graph_scheduler_test_run_if_equal(void) {
+	struct sched_test *self = sched_test;
+	sched_test_setup(self, true, 4, 200);
+
+	bool ret = sched_test_start(self) && wait_received(self, 200);
+	sched_test_stop(self);
+	sched_test_free(self);
+
+	return ret && self->sink.errors == 0;
+}
+
+
+/* The scheduler sleeps with no deadline, a value written from another
+ * task must wake it immediately. */
+static bool graph_scheduler_test_wake_if_written(void) {
+	struct sched_test *self = sched_test;
+	sched_test_setup(self, true, 4, 0);
+
+	bool ret = sched_test_start(self);
+	uint32_t max_ms = 0;
+	for (uint32_t i = 0; i < 10 && ret; i++) {
+		vTaskDelay(pdMS_TO_TICKS(50));
+		TickType_t start = xTaskGetTickCount();
+		write_value(&self->entry, i);
+		ret = wait_received(self, i + 1);
+		uint32_t time_ms = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+		if (time_ms > max_ms) {
+			max_ms = time_ms;
+		}
+	}
+	sched_test_stop(self);
+	sched_test_free(self);
+
+	u_log(system_log, LOG_TYPE_DEBUG, U_LOG_MODULE_PREFIX("max wakeup latency %u ms"), max_ms);
+	return ret && self->sink.errors == 0 && max_ms <= SCHED_TEST_WAKEUP_MS;
+}
+
+
+/* A node stopped and started again while the graph runs keeps the data
+ * written in the meantime. */
+static bool graph_scheduler_test_node_if_restarted(void) {
+	struct sched_test *self = sched_test;
+	sched_test_setup(self, true, 3, 0);
+
+	bool ret = sched_test_start(self);
+	for (uint32_t i = 0; i < 3; i++) {
+		write_value(&self->entry, i);
+	}
+	ret = ret && wait_received(self, 3);
+
+	dp_statistics_node_stop(&self->relay[1]);
+	for (uint32_t i = 3; i < 6; i++) {
+		write_value(&self->entry, i);
+	}
+	vTaskDelay(pdMS_TO_TICKS(50));
+	ret = ret && self->sink.received == 3;
+	dp_statistics_node_start(&self->relay[1]);
+	ret = ret && wait_received(self, 6);
+
+	sched_test_stop(self);
+	sched_test_free(self);
+	return ret && self->sink.errors == 0;
+}
+
+
+bool graph_scheduler_tests(void) {
+	sched_test = malloc(sizeof(struct sched_test));
+	if (sched_test == NULL) {
+		return false;
+	}
+	bool res = true;
+
+	res &= u_test(graph_scheduler_test_sort_if_topological());
+	res &= u_test(graph_scheduler_test_sort_if_cycle());
+	res &= u_test(graph_scheduler_test_run_if_equal());
+	res &= u_test(graph_scheduler_test_wake_if_written());
+	res &= u_test(graph_scheduler_test_node_if_restarted());
+
+	free(sched_test);
+	sched_test = NULL;
+
+	return res;
+}
+
+
+/* Write values one by one, each of them must reach the sink before the
+ * next one is written. */
+static bool sched_test_latency(struct sched_test *self, bool cooperative, size_t *heap, uint32_t *time_ms) {
+	sched_test_setup(self, cooperative, SCHED_TEST_RELAYS, 0);
+
+	size_t free_before = xPortGetFreeHeapSize();
+	bool ret = sched_test_start(self);
+	*heap = free_before - xPortGetFreeHeapSize();
+
+	TickType_t start = xTaskGetTickCount();
+	for (uint32_t i = 0; i < SCHED_TEST_LATENCY_VALUES && ret; i++) {
+		write_value(&self->entry, i);
+		ret = wait_received(self, i + 1);
+	}
+	*time_ms = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+
+	sched_test_stop(self);
+	sched_test_free(self);
+	return ret && self->sink.errors == 0;
+}
+
+
+bool graph_scheduler_tests_latency(void) {
+	struct sched_test *self = malloc(sizeof(struct sched_test));
+	if (self == NULL) {
+		return false;
+	}
+	bool res = true;
+
+	for (size_t i = 0; i < 2; i++) {
+		size_t heap = 0;
+		uint32_t time_ms = 0;
+		bool r = sched_test_latency(self, i == 1, &heap, &time_ms);
+		u_log(system_log, r ? LOG_TYPE_INFO : LOG_TYPE_ERROR,
+			U_LOG_MODULE_PREFIX("%s, %u nodes: %u B of heap used by start, %u values in %u ms (%u us per value)"),
+			(i == 1) ? "cooperative" : "task per node", SCHED_TEST_RELAYS + 1, heap,
+			SCHED_TEST_LATENCY_VALUES, time_ms, time_ms * 1000 / SCHED_TEST_LATENCY_VALUES
+		);
+		res &= r;
+	}
+
+	free(self);
+	return res;
+}
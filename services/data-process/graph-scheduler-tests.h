@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Cooperative data-process scheduler tests
+ *
+ * Copyright (c) 2021, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * Sort graphs topologically, refuse cycles, run a graph within a single
+ * task and wake the scheduler when data is written from another task.
+ */
+bool graph_scheduler_tests(void);
+
+/**
+ * Run a 6-node graph with a task per node and with the cooperative scheduler.
+ * Log the heap used to start the graph and the end-to-end latency of a value
+ * written to the graph from another task.
+ */
+bool graph_scheduler_tests_latency(void);
@@ -0,0 +1,305 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Cooperative single-task scheduler for data-process graphs
+ *
+ * Copyright (c) 2021, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#include "u_assert.h"
+#include "u_log.h"
+
+#include "data-process.h"
+#include "graph-scheduler.h"
+
+#ifdef MODULE_NAME
+#undef MODULE_NAME
+#endif
+#define MODULE_NAME "dp-scheduler"
+
+
+static void dp_scheduler_task(void *p) {
+	struct dp_scheduler *self = (struct dp_scheduler *)p;
+
+	/* The task may run before xTaskCreate returns the handle. Set it before
+	 * any node is stepped, dp_scheduler_is_current depends on it. */
+	self->task = xTaskGetCurrentTaskHandle();
+	while (self->can_run) {
+		uint32_t sleep_ms = DP_SCHEDULER_NO_DEADLINE;
+		xSemaphoreTake(self->lock, portMAX_DELAY);
+		for (struct dp_scheduler_node *n = self->nodes; n != NULL; n = n->next) {
+			if (!n->attached) {
+				continue;
+			}
+			uint32_t node_sleep_ms = DP_SCHEDULER_NO_DEADLINE;
+			n->node->step(n->node->context, &node_sleep_ms);
+			if (node_sleep_ms < sleep_ms) {
+				sleep_ms = node_sleep_ms;
+			}
+		}
+		xSemaphoreGive(self->lock);
+
+		/* Sleep until the nearest source is due or until data is written
+		 * to a scheduled input from another task. Sleep at least a single
+		 * tick to let lower priority tasks run. */
+		TickType_t ticks = portMAX_DELAY;
+		if (sleep_ms != DP_SCHEDULER_NO_DEADLINE) {
+			ticks = pdMS_TO_TICKS(sleep_ms);
+			if (ticks == 0) {
+				ticks = 1;
+			}
+		}
+		ulTaskNotifyTake(pdTRUE, ticks);
+	}
+	self->running = false;
+
+	vTaskDelete(NULL);
+}
+
+
+static struct dp_scheduler_node *find_node(struct dp_scheduler *self, struct dp_graph_node_descriptor *node) {
+	for (struct dp_scheduler_node *n = self->nodes; n != NULL; n = n->next) {
+		if (n->node == node) {
+			return n;
+		}
+	}
+	return NULL;
+}
+
+
+/* Call the callback for every scheduled node connected to an output of @p n. */
+static void for_each_successor(struct dp_scheduler *self, struct dp_scheduler_node *n, void (*cb)(struct dp_scheduler_node *s)) {
+	for (struct dp_output *o = n->node->outputs; o != NULL; o = o->owner_next) {
+		for (struct dp_input *i = o->inputs; i != NULL; i = i->next) {
+			struct dp_scheduler_node *s = find_node(self, i->owner);
+			if (s != NULL) {
+				cb(s);
+			}
+		}
+	}
+}
+
+
+static void indegree_inc(struct dp_scheduler_node *s) {
+	s->indegree++;
+}
+
+
+static void indegree_dec(struct dp_scheduler_node *s) {
+	s->indegree--;
+}
+
+
+/* Kahn's algorithm. The node list is rebuilt in the topological order. */
+dp_ret_t dp_scheduler_sort(struct dp_scheduler *self) {
+	if (u_assert(self != NULL)) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	for (struct dp_scheduler_node *n = self->nodes; n != NULL; n = n->next) {
+		n->indegree = 0;
+	}
+	for (struct dp_scheduler_node *n = self->nodes; n != NULL; n = n->next) {
+		for_each_successor(self, n, indegree_inc);
+	}
+
+	struct dp_scheduler_node *sorted = NULL;
+	struct dp_scheduler_node **sorted_last = &sorted;
+	while (self->nodes != NULL) {
+		/* Find a node with no remaining predecessors and move it. */
+		struct dp_scheduler_node **n = &self->nodes;
+		while (*n != NULL && (*n)->indegree > 0) {
+			n = &(*n)->next;
+		}
+		if (*n == NULL) {
+			/* Put the remaining nodes back to not lose them. */
+			*sorted_last = self->nodes;
+			self->nodes = sorted;
+			return DATA_PROCESS_RET_FAILED;
+		}
+		struct dp_scheduler_node *m = *n;
+		*n = m->next;
+		m->next = NULL;
+		*sorted_last = m;
+		sorted_last = &m->next;
+
+		/* Successors are still in the unsorted list, find_node works on it. */
+		for_each_successor(self, m, indegree_dec);
+	}
+	self->nodes = sorted;
+
+	return DATA_PROCESS_RET_OK;
+}
+
+
+dp_ret_t dp_scheduler_init(struct dp_scheduler *self) {
+	if (u_assert(self != NULL)) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	memset(self, 0, sizeof(struct dp_scheduler));
+	self->lock = xSemaphoreCreateMutex();
+	if (self->lock == NULL) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+	self->initialized = true;
+
+	return DATA_PROCESS_RET_OK;
+}
+
+
+dp_ret_t dp_scheduler_free(struct dp_scheduler *self) {
+	if (u_assert(self != NULL) ||
+	    u_assert(self->initialized == true) ||
+	    u_assert(self->running == false)) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	while (self->nodes != NULL) {
+		struct dp_scheduler_node *n = self->nodes;
+		self->nodes = n->next;
+		n->node->scheduler = NULL;
+		free(n);
+	}
+	vSemaphoreDelete(self->lock);
+	self->lock = NULL;
+	self->initialized = false;
+
+	return DATA_PROCESS_RET_OK;
+}
+
+
+dp_ret_t dp_scheduler_add_node(struct dp_scheduler *self, struct dp_graph_node_descriptor *node) {
+	if (u_assert(self != NULL) ||
+	    u_assert(self->initialized == true) ||
+	    u_assert(self->running == false) ||
+	    u_assert(node != NULL) ||
+	    u_assert(node->step != NULL) ||
+	    u_assert(node->scheduler == NULL)) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	struct dp_scheduler_node *n = calloc(1, sizeof(struct dp_scheduler_node));
+	if (n == NULL) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+	n->node = node;
+	n->attached = true;
+	n->next = self->nodes;
+	self->nodes = n;
+	node->scheduler = self;
+
+	return DATA_PROCESS_RET_OK;
+}
+
+
+dp_ret_t dp_scheduler_detach_node(struct dp_scheduler *self, struct dp_graph_node_descriptor *node) {
+	if (u_assert(self != NULL) ||
+	    u_assert(self->initialized == true) ||
+	    u_assert(node != NULL) ||
+	    u_assert(dp_scheduler_is_current(self) == false)) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	/* The node may be stepped right now, wait for the pass to finish. */
+	xSemaphoreTake(self->lock, portMAX_DELAY);
+	struct dp_scheduler_node *n = find_node(self, node);
+	if (n != NULL) {
+		n->attached = false;
+	}
+	xSemaphoreGive(self->lock);
+
+	return (n != NULL) ? DATA_PROCESS_RET_OK : DATA_PROCESS_RET_FAILED;
+}
+
+
+dp_ret_t dp_scheduler_attach_node(struct dp_scheduler *self, struct dp_graph_node_descriptor *node) {
+	if (u_assert(self != NULL) ||
+	    u_assert(self->initialized == true) ||
+	    u_assert(node != NULL)) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	xSemaphoreTake(self->lock, portMAX_DELAY);
+	struct dp_scheduler_node *n = find_node(self, node);
+	if (n != NULL) {
+		n->attached = true;
+	}
+	xSemaphoreGive(self->lock);
+
+	/* The node may want to be stepped sooner than the scheduler wakes up. */
+	dp_scheduler_notify(self);
+
+	return (n != NULL) ? DATA_PROCESS_RET_OK : DATA_PROCESS_RET_FAILED;
+}
+
+
+dp_ret_t dp_scheduler_start(struct dp_scheduler *self, const char *name, UBaseType_t priority) {
+	if (u_assert(self != NULL) ||
+	    u_assert(self->initialized == true) ||
+	    u_assert(self->running == false)) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	if (dp_scheduler_sort(self) != DATA_PROCESS_RET_OK) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("the graph contains a cycle, cannot schedule"));
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	/* Set before the task is created, dp_scheduler_stop may be called
+	 * before the task runs. */
+	self->can_run = true;
+	self->running = true;
+	xTaskCreate(dp_scheduler_task, name, DP_SCHEDULER_STACK_SIZE, (void *)self, priority, &self->task);
+	if (self->task == NULL) {
+		self->can_run = false;
+		self->running = false;
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	return DATA_PROCESS_RET_OK;
+}
+
+
+dp_ret_t dp_scheduler_stop(struct dp_scheduler *self) {
+	if (u_assert(self != NULL) ||
+	    u_assert(self->running == true)) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	self->can_run = false;
+	dp_scheduler_notify(self);
+	while (self->running) {
+		vTaskDelay(1);
+	}
+	self->task = NULL;
+
+	return DATA_PROCESS_RET_OK;
+}
+
+
+bool dp_scheduler_is_current(struct dp_scheduler *self) {
+	if (self == NULL || self->task == NULL) {
+		return false;
+	}
+
+	return xTaskGetCurrentTaskHandle() == self->task;
+}
+
+
+void dp_scheduler_notify(struct dp_scheduler *self) {
+	/* Not started yet, the first pass processes all data anyway. */
+	if (self == NULL || self->task == NULL) {
+		return;
+	}
+
+	xTaskNotifyGive(self->task);
+}
@@ -0,0 +1,120 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Cooperative single-task scheduler for data-process graphs
+ *
+ * Copyright (c) 2021, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+/**
+ * Nodes added to a scheduler do not create their own tasks. All of them are
+ * stepped from a single task in a topological order (sources first), data
+ * written by a source is processed by the whole graph within a single pass.
+ * Inputs of scheduled nodes never block, the scheduler task sleeps only
+ * until the nearest source wants to produce data.
+ *
+ * Nodes doing blocking I/O should keep running in their own task. They can be
+ * connected to scheduled nodes, writing to an input of a scheduled node from
+ * another task wakes the scheduler using a task notification. The scheduler
+ * never polls, a graph with no sources waiting sleeps until data arrives.
+ *
+ * A BLOCK input of a scheduled node cannot block the scheduler task. If it is
+ * full when written from within the scheduler, the batch is dropped and
+ * counted. The queue depth must be sufficient for the data a single step of
+ * the writer produces.
+ *
+ * Usage: initialize the nodes, add them to the scheduler, connect them, start
+ * the nodes and then start the scheduler. Nodes detach themselves when they
+ * are stopped and attach again when they are started.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+#include "data-process.h"
+
+/* A step method leaves the sleep time at this value if the node does not
+ * need to be stepped again until new data arrives. */
+#define DP_SCHEDULER_NO_DEADLINE UINT32_MAX
+#define DP_SCHEDULER_STACK_SIZE (configMINIMAL_STACK_SIZE + 384)
+
+struct dp_scheduler_node {
+	struct dp_graph_node_descriptor *node;
+	uint32_t indegree;
+	/* Detached nodes are not stepped. */
+	bool attached;
+	struct dp_scheduler_node *next;
+};
+
+struct dp_scheduler {
+	bool initialized;
+
+	/* Nodes in the order they are stepped. Sorted by dp_scheduler_start. */
+	struct dp_scheduler_node *nodes;
+
+	/* Held by the scheduler task for the whole pass over the nodes. */
+	SemaphoreHandle_t lock;
+
+	volatile bool can_run;
+	volatile bool running;
+	TaskHandle_t task;
+};
+
+
+dp_ret_t dp_scheduler_init(struct dp_scheduler *self);
+dp_ret_t dp_scheduler_free(struct dp_scheduler *self);
+
+/**
+ * @brief Add a node to the scheduler
+ *
+ * The node must implement the step method and it must not be started yet.
+ */
+dp_ret_t dp_scheduler_add_node(struct dp_scheduler *self, struct dp_graph_node_descriptor *node);
+
+/**
+ * @brief Stop stepping the node
+ *
+ * Waits until the current pass over the nodes is finished. The node is not
+ * stepped after the function returns and it is safe to free its resources.
+ * Must not be called from within the scheduler task.
+ */
+dp_ret_t dp_scheduler_detach_node(struct dp_scheduler *self, struct dp_graph_node_descriptor *node);
+
+/**
+ * @brief Resume stepping a node previously detached
+ */
+dp_ret_t dp_scheduler_attach_node(struct dp_scheduler *self, struct dp_graph_node_descriptor *node);
+
+/**
+ * @brief Sort the nodes topologically
+ *
+ * @return DATA_PROCESS_RET_FAILED if the graph contains a cycle.
+ */
+dp_ret_t dp_scheduler_sort(struct dp_scheduler *self);
+
+/**
+ * @brief Sort the nodes topologically and start the scheduler task
+ *
+ * @return DATA_PROCESS_RET_FAILED if the graph contains a cycle.
+ */
+dp_ret_t dp_scheduler_start(struct dp_scheduler *self, const char *name, UBaseType_t priority);
+dp_ret_t dp_scheduler_stop(struct dp_scheduler *self);
+
+/**
+ * @brief Wake up the scheduler task to step the nodes
+ *
+ * Called when data is written to an input of a scheduled node from another
+ * task. Must not be called from an interrupt.
+ */
+void dp_scheduler_notify(struct dp_scheduler *self);
+
+/**
+ * @brief Check if the caller runs within the scheduler task
+ */
+bool dp_scheduler_is_current(struct dp_scheduler *self);
@@ -33,6 +33,7 @@
 #include "u_log.h"
 
 #include "data-process.h"
+#include "graph-scheduler.h"
 #include "log-sink.h"
 
 #ifdef MODULE_NAME
@@ -41,26 +42,35 @@
 #define MODULE_NAME "dp-log-sink"
 
 
+static dp_ret_t dp_log_sink_process(struct dp_log_sink *self, struct dp_data *data) {
+	if (u_assert(data->type == self->type)) {
+		/* Wrong data, stop the node. */
+		u_log(system_log, LOG_TYPE_ERROR, "wrong data type on the input, stopping");
+		return DATA_PROCESS_RET_FAILED;
+	}
+	if (data->type == DP_DATA_TYPE_FLOAT) {
+		u_log(system_log, LOG_TYPE_INFO, "%d.%03d", (int)(*data->content.dp_float), (int)(*data->content.dp_float * 1000.0));
+		return DATA_PROCESS_RET_OK;
+	}
+
+	/* Unsupported data type, stop the node. */
+	u_log(system_log, LOG_TYPE_ERROR, "unsupported data type, stopping");
+	return DATA_PROCESS_RET_FAILED;
+}
+
+
 static void dp_log_sink_task(void *p) {
 	struct dp_log_sink *self = (struct dp_log_sink *)p;
 
 	self->running = true;
 	while (self->can_run) {
 		struct dp_data data;
-		dp_input_read(&self->in, &data);
-		if (u_assert(data.type == self->type)) {
-			/* Wrong data, stop the node. */
-			u_log(system_log, LOG_TYPE_ERROR, "wrong data type on the input, stopping");
-			break;
-		}
-		if (data.type == DP_DATA_TYPE_FLOAT) {
-			u_log(system_log, LOG_TYPE_INFO, "%d.%03d", (int)(*data.content.dp_float), (int)(*data.content.dp_float * 1000.0));
+		if (dp_input_read(&self->in, &data) != DATA_PROCESS_RET_OK) {
 			continue;
 		}
-
-		/* Unsupported data type, stop the node. */
-		u_log(system_log, LOG_TYPE_ERROR, "unsupported data type, stopping");
-		break;
+		if (dp_log_sink_process(self, &data) != DATA_PROCESS_RET_OK) {
+			break;
+		}
 	}
 	self->running = false;
 
@@ -68,6 +78,23 @@ static void dp_log_sink_task(void *p) {
 }
 
 
+static dp_ret_t dp_log_sink_step(void *context, uint32_t *sleep_ms) {
+	struct dp_log_sink *self = (struct dp_log_sink *)context;
+	(void)sleep_ms;
+
+	struct dp_data data;
+	while (self->can_run && dp_input_read(&self->in, &data) == DATA_PROCESS_RET_OK) {
+		if (dp_log_sink_process(self, &data) != DATA_PROCESS_RET_OK) {
+			self->can_run = false;
+			self->running = false;
+			return DATA_PROCESS_RET_FAILED;
+		}
+	}
+
+	return DATA_PROCESS_RET_OK;
+}
+
+
 static struct dp_input *get_input_by_name(const char *name, void *context) {
 	if (name == NULL) {
 		return NULL;
@@ -102,7 +129,9 @@ dp_ret_t dp_log_sink_init(struct dp_log_sink *self, enum dp_data_type type) {
 	dp_input_init(&self->in, self->type);
 	self->descriptor.get_input_by_name = get_input_by_name;
 	self->descriptor.get_output_by_name = get_output_by_name;
+	self->descriptor.step = dp_log_sink_step;
 	self->descriptor.context = (void *)self;
+	dp_node_add_input(&self->descriptor, &self->in);
 
 	self->initialized = true;
 
@@ -129,6 +158,11 @@ dp_ret_t dp_log_sink_start(struct dp_log_sink *self) {
 	}
 
 	self->can_run = true;
+	if (self->descriptor.scheduler != NULL) {
+		dp_scheduler_attach_node(self->descriptor.scheduler, &self->descriptor);
+		self->running = true;
+		return DATA_PROCESS_RET_OK;
+	}
 	xTaskCreate(dp_log_sink_task, "dp-log-sink", configMINIMAL_STACK_SIZE + 128, (void *)self, 1, &self->task);
 	if (self->task == NULL) {
 		return DATA_PROCESS_RET_FAILED;
@@ -145,6 +179,14 @@ dp_ret_t dp_log_sink_stop(struct dp_log_sink *self) {
 	}
 
 	self->can_run = false;
+	if (self->descriptor.scheduler != NULL) {
+		/* The scheduler may be stepping the node right now. */
+		dp_scheduler_detach_node(self->descriptor.scheduler, &self->descriptor);
+		self->running = false;
+		return DATA_PROCESS_RET_OK;
+	}
+	/* The task may be waiting for data. */
+	dp_input_interrupt(&self->in);
 	while (self->running) {
 		vTaskDelay(1);
 	}
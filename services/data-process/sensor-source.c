@@ -34,6 +34,7 @@
 
 #include "interfaces/sensor.h"
 #include "data-process.h"
+#include "graph-scheduler.h"
 #include "sensor-source.h"
 
 #ifdef MODULE_NAME
@@ -42,26 +43,34 @@
 #define MODULE_NAME "dp-sensor-source"
 
 
+static void dp_sensor_source_read(struct dp_sensor_source *self) {
+	if (dp_output_is_connected(&self->out)) {
+		float value = 0.0f;
+		if (self->sensor->vmt->value_f == NULL ||
+		    self->sensor->vmt->value_f(self->sensor, &value) != SENSOR_RET_OK) {
+			return;
+		}
+
+		value *= self->multiplier;
+		value += self->offset;
+
+		struct dp_data data = {
+			.len = 1,
+			.flags = DP_DATA_FRAME_START | DP_DATA_FRAME_END,
+			.type = DP_DATA_TYPE_FLOAT,
+			.content.dp_float = &value,
+		};
+		dp_output_write(&self->out, &data);
+	}
+}
+
+
 static void dp_sensor_source_task(void *p) {
 	struct dp_sensor_source *self = (struct dp_sensor_source *)p;
 
 	self->running = true;
 	while (self->can_run) {
-		if (dp_output_is_connected(&self->out)) {
-			float value;
-			interface_sensor_value(self->sensor, &value);
-
-			value *= self->multiplier;
-			value += self->offset;
-
-			struct dp_data data = {
-				.len = 1,
-				.flags = DP_DATA_FRAME_START | DP_DATA_FRAME_END,
-				.type = DP_DATA_TYPE_FLOAT,
-				.content.dp_float = &value,
-			};
-			dp_output_write(&self->out, &data);
-		}
+		dp_sensor_source_read(self);
 		vTaskDelay(self->interval_ms);
 	}
 	self->running = false;
@@ -70,6 +79,27 @@ static void dp_sensor_source_task(void *p) {
 }
 
 
+static dp_ret_t dp_sensor_source_step(void *context, uint32_t *sleep_ms) {
+	struct dp_sensor_source *self = (struct dp_sensor_source *)context;
+
+	if (!self->can_run) {
+		return DATA_PROCESS_RET_OK;
+	}
+
+	TickType_t now = xTaskGetTickCount();
+	TickType_t interval = pdMS_TO_TICKS(self->interval_ms);
+	if ((TickType_t)(now - self->last_read) >= interval) {
+		dp_sensor_source_read(self);
+		self->last_read = now;
+	}
+
+	TickType_t remaining = interval - (TickType_t)(now - self->last_read);
+	*sleep_ms = remaining * portTICK_PERIOD_MS;
+
+	return DATA_PROCESS_RET_OK;
+}
+
+
 static struct dp_input *get_input_by_name(const char *name, void *context) {
 	(void)name;
 	(void)context;
@@ -104,7 +134,9 @@ dp_ret_t dp_sensor_source_init(struct dp_sensor_source *self) {
 	dp_output_init(&self->out, DP_DATA_TYPE_FLOAT);
 	self->descriptor.get_input_by_name = get_input_by_name;
 	self->descriptor.get_output_by_name = get_output_by_name;
+	self->descriptor.step = dp_sensor_source_step;
 	self->descriptor.context = (void *)self;
+	dp_node_add_output(&self->descriptor, &self->out);
 
 	self->initialized = true;
 
@@ -131,6 +163,13 @@ dp_ret_t dp_sensor_source_start(struct dp_sensor_source *self) {
 	}
 
 	self->can_run = true;
+	if (self->descriptor.scheduler != NULL) {
+		dp_scheduler_attach_node(self->descriptor.scheduler, &self->descriptor);
+		/* Stepped by the scheduler, read the sensor on the first step. */
+		self->last_read = xTaskGetTickCount() - pdMS_TO_TICKS(self->interval_ms);
+		self->running = true;
+		return DATA_PROCESS_RET_OK;
+	}
 	xTaskCreate(dp_sensor_source_task, "dp-sensor-source", configMINIMAL_STACK_SIZE + 128, (void *)self, 1, &self->task);
 	if (self->task == NULL) {
 		return DATA_PROCESS_RET_FAILED;
@@ -147,6 +186,12 @@ dp_ret_t dp_sensor_source_stop(struct dp_sensor_source *self) {
 	}
 
 	self->can_run = false;
+	if (self->descriptor.scheduler != NULL) {
+		/* The scheduler may be stepping the node right now. */
+		dp_scheduler_detach_node(self->descriptor.scheduler, &self->descriptor);
+		self->running = false;
+		return DATA_PROCESS_RET_OK;
+	}
 	while (self->running) {
 		vTaskDelay(1);
 	}
@@ -155,7 +200,7 @@ dp_ret_t dp_sensor_source_stop(struct dp_sensor_source *self) {
 }
 
 
-dp_ret_t dp_sensor_source_set_sensor(struct dp_sensor_source *self, ISensor *sensor) {
+dp_ret_t dp_sensor_source_set_sensor(struct dp_sensor_source *self, Sensor *sensor) {
 	if (u_assert(self != NULL) ||
 	    u_assert(sensor != NULL) ||
 	    u_assert(self->running == false)) {
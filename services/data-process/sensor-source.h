@@ -51,8 +51,9 @@ struct dp_sensor_source {
 	volatile bool running;
 	TaskHandle_t task;
 	uint32_t interval_ms;
+	TickType_t last_read;
 
-	ISensor *sensor;
+	Sensor *sensor;
 	float offset;
 	float multiplier;
 };
@@ -62,7 +63,7 @@ dp_ret_t dp_sensor_source_init(struct dp_sensor_source *self);
 dp_ret_t dp_sensor_source_free(struct dp_sensor_source *self);
 dp_ret_t dp_sensor_source_start(struct dp_sensor_source *self);
 dp_ret_t dp_sensor_source_stop(struct dp_sensor_source *self);
-dp_ret_t dp_sensor_source_set_sensor(struct dp_sensor_source *self, ISensor *sensor);
+dp_ret_t dp_sensor_source_set_sensor(struct dp_sensor_source *self, Sensor *sensor);
 dp_ret_t dp_sensor_source_interval(struct dp_sensor_source *self, uint32_t interval_ms);
 dp_ret_t dp_sensor_source_set_offset_multiplier(struct dp_sensor_source *self, float offset, float multiplier);
 
@@ -0,0 +1,337 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * data-process statistics node tests
+ *
+ * Copyright (c) 2021, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "u_assert.h"
+#include "u_log.h"
+#include "u_test.h"
+
+#include "data-process.h"
+#include "statistics-node.h"
+#include "statistics-node-tests.h"
+
+#ifdef MODULE_NAME
+#undef MODULE_NAME
+#endif
+#define MODULE_NAME "dp-statistics-tests"
+
+#define STATISTICS_TEST_SAMPLES 3000
+#define STATISTICS_TEST_NODE_WINDOW 4
+#define STATISTICS_TEST_NODE_SAMPLES 12
+#define STATISTICS_TEST_TIMEOUT_MS 5000
+#define STATISTICS_TEST_COST_SAMPLES 1000000
+#define STATISTICS_TEST_COST_TABLE 1024
+
+
+static uint32_t rnd_state = 1;
+static int32_t rnd(int32_t range) {
+	rnd_state = rnd_state * 1103515245 + 12345;
+	return (int32_t)((rnd_state >> 8) % (2 * range + 1)) - range;
+}
+
+
+enum statistics_test_stream {
+	/* Uniform noise around zero. */
+	STREAM_NOISE,
+	/* Random walk far from zero, the mean is much larger than the variance. */
+	STREAM_WALK,
+	/* Constant value, the variance must not go negative. */
+	STREAM_CONSTANT,
+	/* Long monotonic runs, the deques are filled up to the window length. */
+	STREAM_SAW,
+};
+
+
+static void fill_stream(float *v, size_t len, enum statistics_test_stream stream) {
+	float walk = 1000.0f;
+	for (size_t i = 0; i < len; i++) {
+		switch (stream) {
+			case STREAM_NOISE:
+				v[i] = (float)rnd(1000) / 10.0f;
+				break;
+			case STREAM_WALK:
+				walk += (float)rnd(100) / 100.0f;
+				v[i] = walk;
+				break;
+			case STREAM_CONSTANT:
+				v[i] = 3.3f;
+				break;
+			case STREAM_SAW:
+				v[i] = (float)((i / 700) % 2 ? (700 - i % 700) : (i % 700));
+				break;
+		}
+	}
+}
+
+
+struct statistics_ref {
+	double mean;
+	double var;
+	float min;
+	float max;
+	uint32_t count;
+};
+
+
+/* Brute-force statistics of the window ending with the value @p end. */
+static void statistics_ref(const float *v, size_t end, uint32_t window_len, struct statistics_ref *r) {
+	size_t start = (end + 1 > window_len) ? end + 1 - window_len : 0;
+	r->count = end + 1 - start;
+	r->min = v[start];
+	r->max = v[start];
+	double sum = 0.0;
+	for (size_t i = start; i <= end; i++) {
+		sum += v[i];
+		if (v[i] < r->min) {
+			r->min = v[i];
+		}
+		if (v[i] > r->max) {
+			r->max = v[i];
+		}
+	}
+	r->mean = sum / r->count;
+	double m2 = 0.0;
+	for (size_t i = start; i <= end; i++) {
+		m2 += (v[i] - r->mean) * (v[i] - r->mean);
+	}
+	r->var = m2 / r->count;
+}
+
+
+static bool close_to(double value, double ref, double tolerance) {
+	double d = value - ref;
+	return d <= tolerance && d >= -tolerance;
+}
+
+
+/* Mean and variance are computed in float, the allowed error is relative to
+ * the magnitude of the values and to the variance itself. Min, max and count
+ * must be exact. */
+static bool statistics_window_if_equal(const float *v, size_t len, uint32_t window_len) {
+	struct dp_statistics_window w;
+	if (dp_statistics_window_init(&w, window_len) != DATA_PROCESS_RET_OK) {
+		return false;
+	}
+
+	bool ret = true;
+	for (size_t i = 0; i < len && ret; i++) {
+		dp_statistics_window_add(&w, v[i]);
+
+		struct statistics_ref r;
+		statistics_ref(v, i, window_len, &r);
+		double scale = (r.max > -r.min) ? r.max : -r.min;
+		double mean_tolerance = 1e-5 * scale + 1e-5;
+		double var_tolerance = 1e-3 * r.var + 1e-5 * scale * scale + 1e-5;
+		if (w.count != r.count ||
+		    dp_statistics_window_min(&w) != r.min ||
+		    dp_statistics_window_max(&w) != r.max ||
+		    !close_to(dp_statistics_window_mean(&w), r.mean, mean_tolerance) ||
+		    !close_to(dp_statistics_window_var(&w), r.var, var_tolerance) ||
+		    dp_statistics_window_var(&w) < 0.0f) {
+			u_log(system_log, LOG_TYPE_ERROR,
+				U_LOG_MODULE_PREFIX("window %u, sample %u: count %u/%u, min %d/%d, max %d/%d, mean*1000 %d/%d, var*1000 %d/%d"),
+				window_len, i, w.count, r.count,
+				(int32_t)dp_statistics_window_min(&w), (int32_t)r.min,
+				(int32_t)dp_statistics_window_max(&w), (int32_t)r.max,
+				(int32_t)(dp_statistics_window_mean(&w) * 1000.0f), (int32_t)(r.mean * 1000.0),
+				(int32_t)(dp_statistics_window_var(&w) * 1000.0f), (int32_t)(r.var * 1000.0)
+			);
+			ret = false;
+		}
+	}
+
+	dp_statistics_window_free(&w);
+	return ret;
+}
+
+
+static bool statistics_stream_if_equal(enum statistics_test_stream stream) {
+	float *v = malloc(STATISTICS_TEST_SAMPLES * sizeof(float));
+	if (v == NULL) {
+		return false;
+	}
+	fill_stream(v, STATISTICS_TEST_SAMPLES, stream);
+
+	const uint32_t window_len[] = {1, 3, 10, 100, 1000};
+	bool ret = true;
+	for (size_t i = 0; i < sizeof(window_len) / sizeof(window_len[0]); i++) {
+		ret &= statistics_window_if_equal(v, STATISTICS_TEST_SAMPLES, window_len[i]);
+	}
+
+	free(v);
+	return ret;
+}
+
+
+static bool statistics_test_noise_if_equal(void) {
+	return statistics_stream_if_equal(STREAM_NOISE);
+}
+
+
+static bool statistics_test_walk_if_equal(void) {
+	return statistics_stream_if_equal(STREAM_WALK);
+}
+
+
+static bool statistics_test_constant_if_equal(void) {
+	return statistics_stream_if_equal(STREAM_CONSTANT);
+}
+
+
+static bool statistics_test_saw_if_equal(void) {
+	return statistics_stream_if_equal(STREAM_SAW);
+}
+
+
+/* Wait until @p count values are queued in the input, it is read without a task. */
+static bool wait_values(struct dp_input *in, uint32_t count) {
+	TickType_t start = xTaskGetTickCount();
+	while (uxQueueMessagesWaiting(in->queue) < count) {
+		if ((xTaskGetTickCount() - start) > pdMS_TO_TICKS(STATISTICS_TEST_TIMEOUT_MS)) {
+			return false;
+		}
+		vTaskDelay(1);
+	}
+	return true;
+}
+
+
+static float read_float(struct dp_input *in) {
+	struct dp_data data;
+	if (dp_input_read(in, &data) != DATA_PROCESS_RET_OK) {
+		return -1.0f;
+	}
+	if (data.type == DP_DATA_TYPE_UINT32) {
+		return (float)*data.content.dp_uint32;
+	}
+	return *data.content.dp_float;
+}
+
+
+/* Windowed outputs are written once per window, floating outputs for every
+ * value. The node runs in its own task. */
+static bool statistics_test_node_if_equal(void) {
+	struct dp_statistics_node node;
+	struct dp_output src;
+	struct dp_input avg, min, max, avg_floating, max_floating, count;
+	dp_statistics_node_init(&node, "statistics", DP_DATA_TYPE_FLOAT);
+	dp_statistics_node_set_window(&node, STATISTICS_TEST_NODE_WINDOW);
+	dp_output_init(&src, DP_DATA_TYPE_FLOAT);
+	dp_input_init(&avg, DP_DATA_TYPE_FLOAT);
+	dp_input_init(&min, DP_DATA_TYPE_FLOAT);
+	dp_input_init(&max, DP_DATA_TYPE_FLOAT);
+	dp_input_init(&avg_floating, DP_DATA_TYPE_FLOAT);
+	dp_input_init(&max_floating, DP_DATA_TYPE_FLOAT);
+	dp_input_init(&count, DP_DATA_TYPE_UINT32);
+	dp_input_set_queue(&avg_floating, STATISTICS_TEST_NODE_SAMPLES, DP_BACKPRESSURE_BLOCK);
+	dp_input_set_queue(&max_floating, STATISTICS_TEST_NODE_SAMPLES, DP_BACKPRESSURE_BLOCK);
+	dp_input_set_queue(&count, STATISTICS_TEST_NODE_SAMPLES, DP_BACKPRESSURE_BLOCK);
+	dp_connect_input_to_output(&node.in, &src);
+	dp_connect_input_to_output(&avg, &node.out_avg);
+	dp_connect_input_to_output(&min, &node.out_min);
+	dp_connect_input_to_output(&max, &node.out_max);
+	dp_connect_input_to_output(&avg_floating, &node.out_avg_floating);
+	dp_connect_input_to_output(&max_floating, &node.out_max_floating);
+	dp_connect_input_to_output(&count, &node.out_count);
+	dp_statistics_node_start(&node);
+
+	float v[STATISTICS_TEST_NODE_SAMPLES];
+	fill_stream(v, STATISTICS_TEST_NODE_SAMPLES, STREAM_NOISE);
+	struct dp_data data = {
+		.len = STATISTICS_TEST_NODE_SAMPLES,
+		.flags = DP_DATA_FRAME_START | DP_DATA_FRAME_END,
+		.type = DP_DATA_TYPE_FLOAT,
+		.content.dp_float = v,
+	};
+	dp_output_write(&src, &data);
+
+	const uint32_t windows = STATISTICS_TEST_NODE_SAMPLES / STATISTICS_TEST_NODE_WINDOW;
+	bool ret = wait_values(&avg_floating, STATISTICS_TEST_NODE_SAMPLES) &&
+	           wait_values(&max_floating, STATISTICS_TEST_NODE_SAMPLES) &&
+	           wait_values(&count, STATISTICS_TEST_NODE_SAMPLES) &&
+	           wait_values(&avg, windows) && wait_values(&min, windows) && wait_values(&max, windows);
+
+	for (size_t i = 0; i < STATISTICS_TEST_NODE_SAMPLES && ret; i++) {
+		struct statistics_ref r;
+		statistics_ref(v, i, STATISTICS_TEST_NODE_WINDOW, &r);
+		ret &= close_to(read_float(&avg_floating), r.mean, 1e-3);
+		ret &= read_float(&max_floating) == r.max;
+		ret &= read_float(&count) == (float)r.count;
+		if ((i + 1) % STATISTICS_TEST_NODE_WINDOW == 0) {
+			ret &= close_to(read_float(&avg), r.mean, 1e-3);
+			ret &= read_float(&min) == r.min;
+			ret &= read_float(&max) == r.max;
+		}
+	}
+
+	dp_statistics_node_stop(&node);
+	dp_statistics_node_free(&node);
+	dp_output_free(&src);
+	dp_input_free(&avg);
+	dp_input_free(&min);
+	dp_input_free(&max);
+	dp_input_free(&avg_floating);
+	dp_input_free(&max_floating);
+	dp_input_free(&count);
+
+	return ret;
+}
+
+
+bool statistics_node_tests(void) {
+	bool res = true;
+
+	res &= u_test(statistics_test_noise_if_equal());
+	res &= u_test(statistics_test_walk_if_equal());
+	res &= u_test(statistics_test_constant_if_equal());
+	res &= u_test(statistics_test_saw_if_equal());
+	res &= u_test(statistics_test_node_if_equal());
+
+	return res;
+}
+
+
+bool statistics_node_tests_cost(void) {
+	float *table = malloc(STATISTICS_TEST_COST_TABLE * sizeof(float));
+	if (table == NULL) {
+		return false;
+	}
+	fill_stream(table, STATISTICS_TEST_COST_TABLE, STREAM_NOISE);
+
+	const uint32_t window_len[] = {10, 1000, 100000};
+	for (size_t i = 0; i < sizeof(window_len) / sizeof(window_len[0]); i++) {
+		struct dp_statistics_window w;
+		if (dp_statistics_window_init(&w, window_len[i]) != DATA_PROCESS_RET_OK) {
+			u_log(system_log, LOG_TYPE_WARN, U_LOG_MODULE_PREFIX("window %u: cannot allocate, skipped"), window_len[i]);
+			continue;
+		}
+
+		TickType_t start = xTaskGetTickCount();
+		for (uint32_t s = 0; s < STATISTICS_TEST_COST_SAMPLES; s++) {
+			dp_statistics_window_add(&w, table[s % STATISTICS_TEST_COST_TABLE]);
+		}
+		uint32_t time_ms = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+		dp_statistics_window_free(&w);
+
+		u_log(system_log, LOG_TYPE_INFO,
+			U_LOG_MODULE_PREFIX("window %u: %u samples in %u ms (%u ns/sample)"),
+			window_len[i], STATISTICS_TEST_COST_SAMPLES, time_ms,
+			(uint32_t)((uint64_t)time_ms * 1000000 / STATISTICS_TEST_COST_SAMPLES)
+		);
+	}
+
+	free(table);
+	return true;
+}
@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * data-process statistics node tests
+ *
+ * Copyright (c) 2021, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * Compare the sliding window statistics with a brute-force computation over
+ * the window for random streams and several window lengths. The node
+ * outputs are checked in a running graph.
+ */
+bool statistics_node_tests(void);
+
+/**
+ * Log the cost of a single sample added to windows of 10, 1k and 100k
+ * values. Windows which cannot be allocated are skipped.
+ */
+bool statistics_node_tests_cost(void);
@@ -26,6 +26,7 @@
 #include "stdint.h"
 #include "stdbool.h"
 #include "stdlib.h"
+#include "string.h"
 
 #include "FreeRTOS.h"
 #include "task.h"
@@ -33,6 +34,7 @@
 #include "u_log.h"
 
 #include "data-process.h"
+#include "graph-scheduler.h"
 #include "statistics-node.h"
 
 #ifdef MODULE_NAME
@@ -41,79 +43,266 @@
 #define MODULE_NAME "dp-statistics"
 
 
+/* Drop items which are no longer in the window from the front of the deque. */
+static void deque_expire(struct dp_statistics_deque *d, uint32_t window_len, uint32_t seq) {
+	while (d->len > 0 && (uint32_t)(seq - d->items[d->head].seq) >= window_len) {
+		d->head = (d->head + 1) % window_len;
+		d->len--;
+	}
+}
+
+
+/* Push a new value to the back of the deque removing all values which cannot
+ * become the extreme anymore. For the min deque, values greater or equal
+ * to the new one are removed, for the max deque it is the opposite. */
+static void deque_push(struct dp_statistics_deque *d, uint32_t window_len, float value, uint32_t seq, bool min) {
+	while (d->len > 0) {
+		float back = d->items[(d->head + d->len - 1) % window_len].value;
+		if ((min && back < value) || (!min && back > value)) {
+			break;
+		}
+		d->len--;
+	}
+	d->items[(d->head + d->len) % window_len] = (struct dp_statistics_deque_item) {
+		.value = value,
+		.seq = seq,
+	};
+	d->len++;
+}
+
+
+dp_ret_t dp_statistics_window_init(struct dp_statistics_window *self, uint32_t window_len) {
+	if (u_assert(self != NULL) ||
+	    u_assert(window_len > 0)) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	memset(self, 0, sizeof(struct dp_statistics_window));
+	self->window_len = window_len;
+
+	self->history = calloc(window_len, sizeof(float));
+	self->min.items = calloc(window_len, sizeof(struct dp_statistics_deque_item));
+	self->max.items = calloc(window_len, sizeof(struct dp_statistics_deque_item));
+	if (self->history == NULL || self->min.items == NULL || self->max.items == NULL) {
+		dp_statistics_window_free(self);
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	return DATA_PROCESS_RET_OK;
+}
+
+
+void dp_statistics_window_free(struct dp_statistics_window *self) {
+	free(self->history);
+	free(self->min.items);
+	free(self->max.items);
+	self->history = NULL;
+	self->min.items = NULL;
+	self->max.items = NULL;
+}
+
+
+void dp_statistics_window_add(struct dp_statistics_window *self, float value) {
+	if (self->count < self->window_len) {
+		/* The window is not full yet, standard Welford update. */
+		self->count++;
+		float delta = value - self->mean;
+		self->mean += delta / (float)self->count;
+		self->m2 += delta * (value - self->mean);
+	} else {
+		/* Replace the oldest value with the new one. */
+		float old = self->history[self->pos];
+		float old_mean = self->mean;
+		self->mean += (value - old) / (float)self->count;
+		self->m2 += (value - old) * (value - self->mean + old - old_mean);
+	}
+	self->history[self->pos] = value;
+	self->pos = (self->pos + 1) % self->window_len;
+
+	deque_expire(&self->min, self->window_len, self->seq);
+	deque_expire(&self->max, self->window_len, self->seq);
+	deque_push(&self->min, self->window_len, value, self->seq, true);
+	deque_push(&self->max, self->window_len, value, self->seq, false);
+	self->seq++;
+
+	/* Running sums accumulate rounding errors when values are replaced.
+	 * Recompute them from the history once per window, this keeps the
+	 * amortized cost per sample constant. */
+	if (self->count == self->window_len && self->pos == 0) {
+		float sum = 0.0f;
+		for (uint32_t i = 0; i < self->window_len; i++) {
+			sum += self->history[i];
+		}
+		self->mean = sum / (float)self->window_len;
+		float m2 = 0.0f;
+		for (uint32_t i = 0; i < self->window_len; i++) {
+			float d = self->history[i] - self->mean;
+			m2 += d * d;
+		}
+		self->m2 = m2;
+	}
+}
+
+
+float dp_statistics_window_mean(struct dp_statistics_window *self) {
+	return self->mean;
+}
+
+
+/* Population variance of the values in the window. */
+float dp_statistics_window_var(struct dp_statistics_window *self) {
+	if (self->count == 0 || self->m2 < 0.0f) {
+		return 0.0f;
+	}
+	return self->m2 / (float)self->count;
+}
+
+
+float dp_statistics_window_min(struct dp_statistics_window *self) {
+	if (self->min.len == 0) {
+		return 0.0f;
+	}
+	return self->min.items[self->min.head].value;
+}
+
+
+float dp_statistics_window_max(struct dp_statistics_window *self) {
+	if (self->max.len == 0) {
+		return 0.0f;
+	}
+	return self->max.items[self->max.head].value;
+}
+
+
+static void write_float(struct dp_output *out, float value, enum dp_data_flags flags) {
+	struct dp_data data = {
+		.len = 1,
+		.flags = flags,
+		.type = DP_DATA_TYPE_FLOAT,
+		.content.dp_float = &value,
+	};
+	dp_output_write(out, &data);
+}
+
+
+static void dp_statistics_node_process(struct dp_statistics_node *self, struct dp_data *data_in) {
+	struct dp_statistics_window *w = &self->window;
+
+	switch (self->type) {
+		case DP_DATA_TYPE_FLOAT: {
+			for (size_t i = 0; i < data_in->len; i++) {
+				dp_statistics_window_add(w, data_in->content.dp_float[i]);
+
+				float avg = dp_statistics_window_mean(w);
+				float var = dp_statistics_window_var(w);
+				float min = dp_statistics_window_min(w);
+				float max = dp_statistics_window_max(w);
+				enum dp_data_flags flags = DP_DATA_FRAME_START | DP_DATA_FRAME_END;
+
+				/* Output computed values every window_len values. */
+				if (w->pos == 0) {
+					write_float(&self->out_avg, avg, flags);
+					write_float(&self->out_var, var, flags);
+					write_float(&self->out_min, min, flags);
+					write_float(&self->out_max, max, flags);
+				}
+
+				/* Output floating computed values every time a new value is read. */
+				write_float(&self->out_avg_floating, avg, flags);
+				write_float(&self->out_var_floating, var, flags);
+				write_float(&self->out_min_floating, min, flags);
+				write_float(&self->out_max_floating, max, flags);
+
+				uint32_t count = w->count;
+				struct dp_data data_count = {
+					.len = 1,
+					.flags = flags,
+					.type = DP_DATA_TYPE_UINT32,
+					.content.dp_uint32 = &count,
+				};
+				dp_output_write(&self->out_count, &data_count);
+			}
+			break;
+		}
+		default:
+			/* Nothing. */
+			break;
+	}
+}
+
+
 static void dp_statistics_node_task(void *p) {
 	struct dp_statistics_node *self = (struct dp_statistics_node *)p;
 
 	self->running = true;
 	while (self->can_run) {
 		struct dp_data data_in;
-		dp_input_read(&self->in, &data_in);
-
-		/* Add the current value to the history. */
-		self->history[self->history_pos] = data_in.content;
-		self->history_pos = (self->history_pos + 1) % self->history_len;
-
-
-		/* Compute floating min, max, avg. */
-		switch (self->type) {
-			case DP_DATA_TYPE_FLOAT: {
-				/* Initialize. */
-				float avg = 0.0;
-				float min = 0.0;
-				float max = 0.0;
-
-				/* Compute. */
-				for (uint32_t i = 0; i < self->history_len; i++) {
-					avg += *self->history[i].dp_float;
-					if (*data_in.content.dp_float < min) {
-						min = *data_in.content.dp_float;
-					}
-					if (*data_in.content.dp_float > max) {
-						max = *data_in.content.dp_float;
-					}
-				}
-				avg /= (float)self->history_len;
+		if (dp_input_read_batch(&self->in, &data_in) != DATA_PROCESS_RET_OK) {
+			continue;
+		}
+		dp_statistics_node_process(self, &data_in);
+	}
+	self->running = false;
 
-				/* Prepare the output value. */
-				struct dp_data data_out = {
-					.len = 1,
-					.flags = DP_DATA_FRAME_START | DP_DATA_FRAME_END,
-					.type = self->type,
-					/* Do not initialize content. */
-				};
+	vTaskDelete(NULL);
+}
 
-				/* Output computed values every self->history_len values. */
-				if (self->history_pos == 0) {
-					data_out.content.dp_float = &avg;
-					dp_output_write(&self->out_avg, &data_out);
 
-					data_out.content.dp_float = &min;
-					dp_output_write(&self->out_min, &data_out);
+static dp_ret_t dp_statistics_node_step(void *context, uint32_t *sleep_ms) {
+	struct dp_statistics_node *self = (struct dp_statistics_node *)context;
+	(void)sleep_ms;
 
-					data_out.content.dp_float = &max;
-					dp_output_write(&self->out_max, &data_out);
-				}
+	struct dp_data data_in;
+	while (self->can_run && dp_input_read_batch(&self->in, &data_in) == DATA_PROCESS_RET_OK) {
+		dp_statistics_node_process(self, &data_in);
+	}
 
-				/* Output floating computed values every time a new value is read. */
-				data_out.content.dp_float = &avg;
-				dp_output_write(&self->out_avg_floating, &data_out);
+	return DATA_PROCESS_RET_OK;
+}
 
-				data_out.content.dp_float = &min;
-				dp_output_write(&self->out_min_floating, &data_out);
 
-				data_out.content.dp_float = &max;
-				dp_output_write(&self->out_max_floating, &data_out);
+static struct dp_input *get_input_by_name(const char *name, void *context) {
+	if (name == NULL) {
+		return NULL;
+	}
 
-				break;
-			}
-			default:
-				/* Nothing. */
-				break;
+	struct dp_statistics_node *self = (struct dp_statistics_node *)context;
+	if (!strcmp(name, "in") || !strcmp(name, "default")) {
+		return &(self->in);
+	}
+
+	return NULL;
+}
+
+
+static struct dp_output *get_output_by_name(const char *name, void *context) {
+	if (name == NULL) {
+		return NULL;
+	}
+
+	struct dp_statistics_node *self = (struct dp_statistics_node *)context;
+	const struct {
+		const char *name;
+		struct dp_output *output;
+	} outputs[] = {
+		{"avg", &self->out_avg},
+		{"var", &self->out_var},
+		{"min", &self->out_min},
+		{"max", &self->out_max},
+		{"avg-floating", &self->out_avg_floating},
+		{"var-floating", &self->out_var_floating},
+		{"min-floating", &self->out_min_floating},
+		{"max-floating", &self->out_max_floating},
+		{"count", &self->out_count},
+		{"default", &self->out_avg_floating},
+	};
+	for (size_t i = 0; i < sizeof(outputs) / sizeof(outputs[0]); i++) {
+		if (!strcmp(name, outputs[i].name)) {
+			return outputs[i].output;
 		}
 	}
-	self->running = false;
 
-	vTaskDelete(NULL);
+	return NULL;
 }
 
 
@@ -128,15 +317,34 @@ dp_ret_t dp_statistics_node_init(struct dp_statistics_node *self, const char *na
 	/* Default value. */
 	self->history_len = 10;
 
+	self->name = name;
 	self->type = type;
 
 	dp_output_init(&self->out_avg, type);
+	dp_output_init(&self->out_var, type);
 	dp_output_init(&self->out_min, type);
 	dp_output_init(&self->out_max, type);
 	dp_output_init(&self->out_avg_floating, type);
+	dp_output_init(&self->out_var_floating, type);
 	dp_output_init(&self->out_min_floating, type);
 	dp_output_init(&self->out_max_floating, type);
+	dp_output_init(&self->out_count, DP_DATA_TYPE_UINT32);
 	dp_input_init(&self->in, type);
+
+	self->descriptor.get_input_by_name = get_input_by_name;
+	self->descriptor.get_output_by_name = get_output_by_name;
+	self->descriptor.step = dp_statistics_node_step;
+	self->descriptor.context = (void *)self;
+	dp_node_add_input(&self->descriptor, &self->in);
+	dp_node_add_output(&self->descriptor, &self->out_avg);
+	dp_node_add_output(&self->descriptor, &self->out_var);
+	dp_node_add_output(&self->descriptor, &self->out_min);
+	dp_node_add_output(&self->descriptor, &self->out_max);
+	dp_node_add_output(&self->descriptor, &self->out_avg_floating);
+	dp_node_add_output(&self->descriptor, &self->out_var_floating);
+	dp_node_add_output(&self->descriptor, &self->out_min_floating);
+	dp_node_add_output(&self->descriptor, &self->out_max_floating);
+	dp_node_add_output(&self->descriptor, &self->out_count);
 	self->initialized = true;
 
 	return DATA_PROCESS_RET_OK;
@@ -149,11 +357,33 @@ dp_ret_t dp_statistics_node_free(struct dp_statistics_node *self) {
 		return DATA_PROCESS_RET_FAILED;
 	}
 
+	dp_output_free(&self->out_avg);
+	dp_output_free(&self->out_var);
+	dp_output_free(&self->out_min);
+	dp_output_free(&self->out_max);
 	dp_output_free(&self->out_avg_floating);
+	dp_output_free(&self->out_var_floating);
 	dp_output_free(&self->out_min_floating);
 	dp_output_free(&self->out_max_floating);
+	dp_output_free(&self->out_count);
 	dp_input_free(&self->in);
 
+	self->initialized = false;
+
+	return DATA_PROCESS_RET_OK;
+}
+
+
+dp_ret_t dp_statistics_node_set_window(struct dp_statistics_node *self, uint32_t window_len) {
+	if (u_assert(self != NULL) ||
+	    u_assert(self->initialized == true) ||
+	    u_assert(self->running == false) ||
+	    u_assert(window_len > 0)) {
+		return DATA_PROCESS_RET_FAILED;
+	}
+
+	self->history_len = window_len;
+
 	return DATA_PROCESS_RET_OK;
 }
 
@@ -164,16 +394,20 @@ dp_ret_t dp_statistics_node_start(struct dp_statistics_node *self) {
 		return DATA_PROCESS_RET_FAILED;
 	}
 
-	/* Allocate the history buffer first. */
-	self->history = calloc(sizeof(union dp_data_content), self->history_len);
-	if (self->history == NULL) {
+	/* Allocate the window buffers first. */
+	if (dp_statistics_window_init(&self->window, self->history_len) != DATA_PROCESS_RET_OK) {
 		return DATA_PROCESS_RET_FAILED;
 	}
-	self->history_pos = 0;
 
 	self->can_run = true;
+	if (self->descriptor.scheduler != NULL) {
+		dp_scheduler_attach_node(self->descriptor.scheduler, &self->descriptor);
+		self->running = true;
+		return DATA_PROCESS_RET_OK;
+	}
 	xTaskCreate(dp_statistics_node_task, "dp-statistics", configMINIMAL_STACK_SIZE + 256, (void *)self, 1, &self->task);
 	if (self->task == NULL) {
+		dp_statistics_window_free(&self->window);
 		return DATA_PROCESS_RET_FAILED;
 	}
 
@@ -188,12 +422,19 @@ dp_ret_t dp_statistics_node_stop(struct dp_statistics_node *self) {
 	}
 
 	self->can_run = false;
+	if (self->descriptor.scheduler != NULL) {
+		/* The scheduler may be stepping the node right now. */
+		dp_scheduler_detach_node(self->descriptor.scheduler, &self->descriptor);
+		self->running = false;
+	} else {
+		/* The task may be waiting for data. */
+		dp_input_interrupt(&self->in);
+	}
 	while (self->running) {
 		vTaskDelay(1);
 	}
 
-	free(self->history);
+	dp_statistics_window_free(&self->window);
 
 	return DATA_PROCESS_RET_OK;
 }
-
@@ -24,8 +24,10 @@
  */
 
 /**
- * This is a statistics node which keeps history of a configurable number of
- * values and computes average, min and max.
+ * This is a statistics node which computes mean, variance, min and max of
+ * the last window_len values. All statistics are updated in constant time per
+ * sample. Mean and variance use running Welford sums, min and max are tracked
+ * using monotonic deques of indices into the value history.
  */
 
 #pragma once
@@ -40,28 +42,67 @@
 #include "data-process.h"
 
 
+/* Monotonic deque of values in the window together with their sequence numbers. */
+struct dp_statistics_deque_item {
+	float value;
+	uint32_t seq;
+};
+
+struct dp_statistics_deque {
+	struct dp_statistics_deque_item *items;
+	uint32_t head;
+	uint32_t len;
+};
+
+struct dp_statistics_window {
+	/* Ring buffer of the last window_len values. */
+	float *history;
+	uint32_t window_len;
+
+	uint32_t pos;
+
+	/* Sequence number of the next value. */
+	uint32_t seq;
+	uint32_t count;
+
+	/* Running mean and sum of squared differences from the mean. */
+	float mean;
+	float m2;
+
+	struct dp_statistics_deque min;
+	struct dp_statistics_deque max;
+};
+
 struct dp_statistics_node {
+	struct dp_graph_node_descriptor descriptor;
+
 	const char *name;
 	enum dp_data_type type;
 
 	struct dp_input in;
 
+	/* Computed once per window_len values. */
 	struct dp_output out_avg;
+	struct dp_output out_var;
 	struct dp_output out_min;
 	struct dp_output out_max;
 
+	/* Computed for every value over the last window_len values. */
 	struct dp_output out_avg_floating;
+	struct dp_output out_var_floating;
 	struct dp_output out_min_floating;
 	struct dp_output out_max_floating;
 
+	/* Number of values currently in the window (DP_DATA_TYPE_UINT32). */
+	struct dp_output out_count;
+
 	bool initialized;
 	volatile bool can_run;
 	volatile bool running;
 	TaskHandle_t task;
 
-	union dp_data_content *history;
 	uint32_t history_len;
-	uint32_t history_pos;
+	struct dp_statistics_window window;
 };
 
 
@@ -70,3 +111,19 @@ dp_ret_t dp_statistics_node_free(struct dp_statistics_node *self);
 dp_ret_t dp_statistics_node_start(struct dp_statistics_node *self);
 dp_ret_t dp_statistics_node_stop(struct dp_statistics_node *self);
 
+/**
+ * @brief Set the number of values the statistics are computed from
+ *
+ * The node must not be running.
+ */
+dp_ret_t dp_statistics_node_set_window(struct dp_statistics_node *self, uint32_t window_len);
+
+
+/* Window statistics used by the node, usable standalone. */
+dp_ret_t dp_statistics_window_init(struct dp_statistics_window *self, uint32_t window_len);
+void dp_statistics_window_free(struct dp_statistics_window *self);
+void dp_statistics_window_add(struct dp_statistics_window *self, float value);
+float dp_statistics_window_mean(struct dp_statistics_window *self);
+float dp_statistics_window_var(struct dp_statistics_window *self);
+float dp_statistics_window_min(struct dp_statistics_window *self);
+float dp_statistics_window_max(struct dp_statistics_window *self);
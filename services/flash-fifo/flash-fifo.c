@@ -522,6 +522,28 @@ static fs_ret_t fs_write(Fs *self, File *f, const void *buf, size_t len, size_t
 }
 
 
+/* Lock single concurrent operation */
+static fs_ret_t fs_fstat(Fs *self, File *f, struct fs_stat *s) {
+	FlashFifo *ff = (FlashFifo *)self->parent;
+	if (f->handle != FS_FILE_WRITING) {
+		return FS_RET_FAILED;
+	}
+	xSemaphoreTake(ff->lock, portMAX_DELAY);
+
+	/* The FIFO has no size. Report the write position in the head block
+	 * instead to let the writer align its writes to flash pages. */
+	struct flash_fifo_header h = {0};
+	read_header(ff, ff->head, &h);
+	s->size = 0;
+	if (h.magic == FLASH_FIFO_MAGIC_HEAD) {
+		s->size = bitmap_to_offset(ff, h.bitmap, FLASH_FIFO_BITMAP_SIZE / 32);
+	}
+
+	xSemaphoreGive(ff->lock);
+	return FS_RET_OK;
+}
+
+
 /* No locking required here */
 static fs_ret_t fs_info(Fs *self, struct fs_info *info) {
 	if (u_assert(self != NULL)) {
@@ -542,6 +564,7 @@ static const struct fs_vmt vmt = {
 	.close = fs_close,
 	.read = fs_read,
 	.write = fs_write,
+	.fstat = fs_fstat,
 	.remove = fs_remove,
 	.info = fs_info
 };
@@ -163,6 +163,16 @@ static fs_ret_t fs_spiffs_fs_write(Fs *self, File *f, const void *buf, size_t le
 }
 
 
+static fs_ret_t fs_spiffs_fs_fstat(Fs *self, File *f, struct fs_stat *s) {
+	FS_IMPL_HEADER
+	spiffs_stat st = {0};
+	SPIFFS_fstat(&fs_spiffs->spiffs, (spiffs_file)f->handle, &st);
+	FS_CHECK_ERRNO
+	s->size = st.size;
+	return FS_RET_OK;
+}
+
+
 static fs_ret_t fs_spiffs_fs_fflush(Fs *self, File *f) {
 	FS_IMPL_HEADER
 	SPIFFS_fflush(&fs_spiffs->spiffs, (spiffs_file)f->handle);
@@ -221,6 +231,7 @@ static const struct fs_vmt vmt = {
 	.rename = fs_spiffs_fs_rename,
 	.read = fs_spiffs_fs_read,
 	.write = fs_spiffs_fs_write,
+	.fstat = fs_spiffs_fs_fstat,
 	.fflush = fs_spiffs_fs_fflush,
 	.info = fs_spiffs_fs_info,
 	.opendir = fs_spiffs_fs_opendir,
@@ -61,7 +61,6 @@
  *   - keep common things here (init, free), split the rest
  *   - move main loop and response loop to dedicated files
  *   - move all commands to a single task, use direct to task notifications
- *   - generic response/URC parser
  *   - consolidate string operations
  */
 
@@ -82,50 +81,118 @@ static const char *gsm_quectel_tcpip_states[GSM_QUECTEL_TCPIP_STATUS_MAX] = {
 	"PDP_DEACT",
 };
 
-static gsm_quectel_ret_t read_line(GsmQuectel *self, char *buf, size_t max_buf, size_t *len) {
+/* Read more data from the modem to the parser buffer, return the number of bytes read.
+ * Wait ~10 ms for the first byte to avoid looping fast, then get everything already
+ * received without waiting. */
+static size_t parser_fill(GsmQuectel *self) {
+	/* Discard data which was already processed. */
+	if (self->parser_pos > 0) {
+		memmove(self->parser_buf, self->parser_buf + self->parser_pos, self->parser_len - self->parser_pos);
+		self->parser_len -= self->parser_pos;
+		self->parser_pos = 0;
+	}
+
+	size_t space = sizeof(self->parser_buf) - self->parser_len;
+	if (space == 0) {
+		return 0;
+	}
+
+	int r = interface_stream_read_timeout(self->usart, self->parser_buf + self->parser_len, 1, 10);
+	if (r <= 0) {
+		return 0;
+	}
+	self->parser_len += r;
+	size_t read = r;
+
+	if (space > 1) {
+		r = interface_stream_read_timeout(self->usart, self->parser_buf + self->parser_len, space - 1, 0);
+		if (r > 0) {
+			self->parser_len += r;
+			read += r;
+		}
+	}
+
+	return read;
+}
+
+
+/* Get the next non-empty line from the parser buffer. The line is null terminated
+ * in place and it is valid until the next read from the modem. */
+static gsm_quectel_ret_t read_line(GsmQuectel *self, char **line, size_t *len) {
 	if (u_assert(self != NULL) ||
-	    u_assert(buf != NULL) ||
-	    u_assert(max_buf > 0) ||
+	    u_assert(line != NULL) ||
 	    u_assert(len != NULL)) {
 		return GSM_QUECTEL_RET_FAILED;
 	}
 
-	uint8_t c;
-	*len = 0;
-	while (true) {
-		/* Read with a timeout of ~10ms to avoid looping fast. */
-		int r = interface_stream_read_timeout(self->usart, &c, 1, 10);
-
-		/* Wait for a newline even if no character is received. */
-		if (r == 0) {
-			continue;
+	do {
+		/* Eat all newline characters until a valid line begins. */
+		while (self->parser_pos < self->parser_len &&
+		       (self->parser_buf[self->parser_pos] == '\r' || self->parser_buf[self->parser_pos] == '\n')) {
+			self->parser_pos++;
 		}
 
-		if (c == '\n' || c == '\r') {
-			if (*len > 0) {
-				/* At least some non-whitespace characters were received. End with
-				 * reception of the current line. */
+		uint8_t *start = self->parser_buf + self->parser_pos;
+		size_t available = self->parser_len - self->parser_pos;
+		for (size_t i = 0; i < available; i++) {
+			if (start[i] == '\r' || start[i] == '\n') {
+				start[i] = '\0';
+				self->parser_pos += i + 1;
+				*line = (char *)start;
+				*len = i;
 				return GSM_QUECTEL_RET_OK;
-			} else {
-				/* If no non-whitespace characters were received yet, just eat
-				 * all newline characters until a valid line begins. */
-				continue;
 			}
 		}
 
-		/* A valid character is received. If there is enough buffer space, save it. */
-		if (*len < max_buf) {
-			buf[*len] = c;
-			(*len)++;
-		} else {
-			/* The line is too long. Drop the current character and wait for the
-			 * end of line anyway.*/
+		if (available == sizeof(self->parser_buf)) {
+			/* The line is too long to fit in the buffer. Drop it. */
+			u_log(system_log, LOG_TYPE_WARN, U_LOG_MODULE_PREFIX("response line too long, dropping"));
+			self->parser_pos = self->parser_len;
+		}
+	} while (parser_fill(self) > 0);
+
+	return GSM_QUECTEL_RET_FAILED;
+}
+
+
+/* The response line was terminated by CR, the raw data follow after the LF. */
+static void skip_lf(GsmQuectel *self) {
+	if (self->parser_pos == self->parser_len) {
+		parser_fill(self);
+	}
+	if (self->parser_pos < self->parser_len && self->parser_buf[self->parser_pos] == '\n') {
+		self->parser_pos++;
+	}
+}
+
+
+/* Move exactly len bytes of raw data from the modem to the rxdata stream buffer. Data
+ * already in the parser buffer are used first, the rest is read in blocks. */
+static gsm_quectel_ret_t read_data(GsmQuectel *self, size_t len) {
+	uint32_t timeout = 0;
+	while (len > 0) {
+		size_t available = self->parser_len - self->parser_pos;
+		if (available == 0) {
+			if (parser_fill(self) == 0) {
+				timeout++;
+				if (timeout >= 10) {
+					return GSM_QUECTEL_RET_FAILED;
+				}
+			}
 			continue;
 		}
+		timeout = 0;
+
+		if (available > len) {
+			available = len;
+		}
+		/* Free space was checked when the data was requested. Drop anything which doesn't fit. */
+		xStreamBufferSend(self->rxdata, self->parser_buf + self->parser_pos, available, 0);
+		self->parser_pos += available;
+		len -= available;
 	}
 
-	/* Unreachable. Return FAILED to avoid warning. */
-	return GSM_QUECTEL_RET_FAILED;
+	return GSM_QUECTEL_RET_OK;
 }
 
 
@@ -236,11 +303,10 @@ static gsm_quectel_ret_t command(GsmQuectel *self, enum gsm_quectel_command comm
 			break;
 
 		case GSM_QUECTEL_CMD_IP_RECV: {
+				/* Read as much data as fits in the rxdata buffer. */
 				size_t free = xStreamBufferSpacesAvailable(self->rxdata);
-				if (free > 16) {
-					free = 16;
-				}
 				if (free > 0) {
+					self->ip_recv_requested = free;
 					snprintf(command_str, sizeof(command_str), "AT+QIRD=0,1,0,%u", free);
 				}
 			}
@@ -278,6 +344,11 @@ static gsm_quectel_ret_t command(GsmQuectel *self, enum gsm_quectel_command comm
 	self->command_response = GSM_QUECTEL_CMD_RESPONSE_ERROR;
 	self->cme_error_code = 0;
 
+	/* Reset the semaphore to avoid taking it immediatelly (if an unrelated response
+	 * was received prior to taking it). It must be done before sending the command
+	 * as the response may be processed before we start waiting for it. */
+	xSemaphoreTake(self->response_lock, 0);
+
 	//~ u_log(system_log, LOG_TYPE_DEBUG, U_LOG_MODULE_PREFIX("sending command"));
 	if (write_line(self, command_str, strlen(command_str)) != GSM_QUECTEL_RET_OK) {
 		r = GSM_QUECTEL_RET_FAILED;
@@ -294,10 +365,6 @@ static gsm_quectel_ret_t command(GsmQuectel *self, enum gsm_quectel_command comm
 		write_line(self, "\r\n", 2);
 	}
 
-	/* Reset the semaphore to avoid taking it immediatelly (if an unrelated response
-	 * was received prior to taking it). */
-	xSemaphoreTake(self->response_lock, 0);
-
 	/* Wait for the response. */
 	if (xSemaphoreTake(self->response_lock, timeout_ms) == pdFALSE) {
 		/* No response was received within the specified timeout. */
@@ -340,276 +407,323 @@ static gsm_quectel_ret_t wait_for_modem(GsmQuectel *self, uint32_t timeout_ms) {
 }
 
 
-static void gsm_quectel_process_task(void *p) {
-	GsmQuectel *self = (GsmQuectel *)p;
+/* Response and URC handlers follow. They are called from the process task for each
+ * received line matching a prefix in the response table. */
 
-	while (self->can_run) {
-		size_t len;
-		char buf[256];
-		read_line(self, buf, sizeof(buf) - 1, &len);
-		buf[len] = '\0';
+static void command_finished(GsmQuectel *self, enum gsm_quectel_command_response response) {
+	self->current_command = GSM_QUECTEL_CMD_NONE;
+	self->command_response = response;
+	xSemaphoreGive(self->response_lock);
+}
 
-		if (self->debug_responses) {
-			u_log(system_log, LOG_TYPE_DEBUG, U_LOG_MODULE_PREFIX("-> %s"), buf);
-		}
 
-		if (!strcmp(buf, "OK")) {
+static void response_ok(GsmQuectel *self, char *line, size_t len) {
+	(void)line;
+	(void)len;
+	/* The TCP/IP status is received after OK, see response_tcpip_state(). */
+	if (self->current_command != GSM_QUECTEL_CMD_TCPIP_STAT) {
+		command_finished(self, GSM_QUECTEL_CMD_RESPONSE_OK);
+	}
+}
 
-			if (self->current_command != GSM_QUECTEL_CMD_TCPIP_STAT) {
-				self->current_command = GSM_QUECTEL_CMD_NONE;
-				self->command_response = GSM_QUECTEL_CMD_RESPONSE_OK;
-				xSemaphoreGive(self->response_lock);
-			}
-			continue;
-		}
-		if (!strcmp(buf, "SEND OK") && self->current_command == GSM_QUECTEL_CMD_IP_SEND) {
-			self->current_command = GSM_QUECTEL_CMD_NONE;
-			self->command_response = GSM_QUECTEL_CMD_RESPONSE_OK;
-			xSemaphoreGive(self->response_lock);
-			continue;
-		}
-		if (!strcmp(buf, "CLOSE OK") && self->current_command == GSM_QUECTEL_CMD_IP_CLOSE) {
-			self->current_command = GSM_QUECTEL_CMD_NONE;
-			self->command_response = GSM_QUECTEL_CMD_RESPONSE_OK;
-			xSemaphoreGive(self->response_lock);
-			continue;
-		}
-		if (!strcmp(buf, "DEACT OK") && self->current_command == GSM_QUECTEL_CMD_DEACTIVATE_CONTEXT) {
-			self->current_command = GSM_QUECTEL_CMD_NONE;
-			self->command_response = GSM_QUECTEL_CMD_RESPONSE_OK;
-			xSemaphoreGive(self->response_lock);
-			continue;
-		}
-		if (!strcmp(buf, "ERROR")) {
-			self->current_command = GSM_QUECTEL_CMD_NONE;
-			self->command_response = GSM_QUECTEL_CMD_RESPONSE_ERROR;
-			xSemaphoreGive(self->response_lock);
-			continue;
+
+static void response_done(GsmQuectel *self, char *line, size_t len) {
+	(void)line;
+	(void)len;
+	command_finished(self, GSM_QUECTEL_CMD_RESPONSE_OK);
+}
+
+
+static void response_error(GsmQuectel *self, char *line, size_t len) {
+	(void)line;
+	(void)len;
+	command_finished(self, GSM_QUECTEL_CMD_RESPONSE_ERROR);
+}
+
+
+static void response_cme_error(GsmQuectel *self, char *line, size_t len) {
+	(void)len;
+	self->cme_error_code = strtoul(line + 11, NULL, 10);
+	command_finished(self, GSM_QUECTEL_CMD_RESPONSE_CME);
+}
+
+
+static void response_ignore(GsmQuectel *self, char *line, size_t len) {
+	(void)self;
+	(void)line;
+	(void)len;
+}
+
+
+static void response_imsi(GsmQuectel *self, char *line, size_t len) {
+	if (len == 15) {
+		strcpy(self->imsi, line);
+	}
+}
+
+
+static void response_imei(GsmQuectel *self, char *line, size_t len) {
+	if (len == 15) {
+		strcpy(self->imei, line);
+	}
+}
+
+
+static void response_local_ip(GsmQuectel *self, char *line, size_t len) {
+	/* Non-standard command, there is no OK response, we need to handle it. */
+	if (len <= 15) {
+		strcpy(self->local_ip, line);
+		command_finished(self, GSM_QUECTEL_CMD_RESPONSE_OK);
+	}
+}
+
+
+static void response_pdp_inactive(GsmQuectel *self, char *line, size_t len) {
+	(void)line;
+	(void)len;
+	self->pdp_active = false;
+}
+
+
+static void response_pdp_active(GsmQuectel *self, char *line, size_t len) {
+	(void)line;
+	(void)len;
+	self->pdp_active = true;
+}
+
+
+static void response_tcpip_state(GsmQuectel *self, char *line, size_t len) {
+	(void)len;
+
+	/* TCP/IP status is processed as an URC command as the response from the AT+QISTAT
+	 * AT command is not consistent with other commands (the state is received AFTER
+	 * the command is finished with OK. State names are the same as in the
+	 * gsm_quectel_tcpip_states table with spaces instead of underscores. */
+	const char *state = line + 7;
+	enum gsm_quectel_tcpip_status status = GSM_QUECTEL_TCPIP_STATUS_UNKNOWN;
+	for (size_t i = GSM_QUECTEL_TCPIP_STATUS_UNKNOWN + 1; i < GSM_QUECTEL_TCPIP_STATUS_MAX; i++) {
+		const char *name = gsm_quectel_tcpip_states[i];
+		size_t j = 0;
+		while (name[j] != '\0' && (state[j] == name[j] || (name[j] == '_' && state[j] == ' '))) {
+			j++;
 		}
-		if (!strncmp(buf, "+CME ERROR:", 11)) {
-			self->current_command = GSM_QUECTEL_CMD_NONE;
-			self->command_response = GSM_QUECTEL_CMD_RESPONSE_CME;
-			xSemaphoreGive(self->response_lock);
-			continue;
+		if (name[j] == '\0') {
+			status = i;
+			break;
 		}
+	}
+	self->tcpip_status = status;
 
-		if (self->current_command == GSM_QUECTEL_CMD_GET_IMSI && len == 15) {
-			strcpy(self->imsi, buf);
-			continue;
-		}
+	command_finished(self, GSM_QUECTEL_CMD_RESPONSE_OK);
+}
 
-		if (self->current_command == GSM_QUECTEL_CMD_GET_IMEI && len == 15) {
-			strcpy(self->imei, buf);
-			continue;
-		}
 
-		/* Non-standard command, there is no OK response, we need to handle it. */
-		if (self->current_command == GSM_QUECTEL_CMD_GET_IP && len <= 15) {
-			strcpy(self->local_ip, buf);
-			self->command_response = GSM_QUECTEL_CMD_RESPONSE_OK;
-			xSemaphoreGive(self->response_lock);
-			continue;
-		}
+static void response_registration(GsmQuectel *self, char *line, size_t len) {
+	(void)len;
+	if (!strncmp(line, "+CREG: 2,1", 10)) {
+		self->registered = true;
+		self->cellular_status = CELLULAR_MODEM_STATUS_REGISTERED_HOME;
+	} else if (!strncmp(line, "+CREG: 2,5", 10)) {
+		self->registered = false;
+		self->cellular_status = CELLULAR_MODEM_STATUS_REGISTERED_ROAMING;
+	} else if (!strncmp(line, "+CREG: 2,2", 10)) {
+		self->registered = false;
+		self->cellular_status = CELLULAR_MODEM_STATUS_SEARCHING;
+	} else {
+		self->registered = false;
+		self->cellular_status = CELLULAR_MODEM_STATUS_NOT_REGISTERED;
+	}
+}
 
-		if (self->current_command == GSM_QUECTEL_CMD_PDP_STATUS) {
-			if (!strcmp(buf, "+CGACT: 1,0")) {
-				self->pdp_active = false;
-				continue;
-			}
 
-			if (!strcmp(buf, "+CGACT: 1,1")) {
-				self->pdp_active = true;
-				continue;
-			}
-		}
+static void response_ip_recv(GsmQuectel *self, char *line, size_t len) {
+	(void)len;
 
-		if (self->current_command == GSM_QUECTEL_CMD_TCPIP_STAT) {
-			/* TCP/IP status is processed as an URC command as the response from the AT+QISTAT
-			 * AT command is not consistent with other commands (the state is received AFTER
-			 * the command is finished with OK. */
-			if (!strncmp(buf, "STATE", 5)) {
-				self->current_command = GSM_QUECTEL_CMD_NONE;
-				self->command_response = GSM_QUECTEL_CMD_RESPONSE_OK;
-				xSemaphoreGive(self->response_lock);
+	/* +QIRD: <address>:<port>,TCP,<length> followed by the data itself. */
+	const char *length = strrchr(line, ',');
+	if (length == NULL) {
+		return;
+	}
+	size_t data_len = strtoul(length + 1, NULL, 10);
 
-				self->tcpip_status = GSM_QUECTEL_TCPIP_STATUS_UNKNOWN;
-				// u_log(system_log, LOG_TYPE_DEBUG, U_LOG_MODULE_PREFIX("-> %s"), buf);
+	skip_lf(self);
+	if (read_data(self, data_len) != GSM_QUECTEL_RET_OK) {
+		u_log(system_log, LOG_TYPE_WARN, U_LOG_MODULE_PREFIX("timeout while reading socket data"));
+		return;
+	}
 
-				if (!strncmp(buf, "STATE: IP INITIAL", 17)) {
-					self->tcpip_status = GSM_QUECTEL_TCPIP_STATUS_IP_INITIAL;
-				}
-				if (!strncmp(buf, "STATE: IP START", 15)) {
-					self->tcpip_status = GSM_QUECTEL_TCPIP_STATUS_IP_START;
-				}
-				if (!strncmp(buf, "STATE: IP CONFIG", 16)) {
-					self->tcpip_status = GSM_QUECTEL_TCPIP_STATUS_IP_CONFIG;
-				}
-				if (!strncmp(buf, "STATE: IP IND", 13)) {
-					self->tcpip_status = GSM_QUECTEL_TCPIP_STATUS_IP_IND;
-				}
-				if (!strncmp(buf, "STATE: IP GPRSACT", 17)) {
-					self->tcpip_status = GSM_QUECTEL_TCPIP_STATUS_IP_GPRSACT;
-				}
-				if (!strncmp(buf, "STATE: IP STATUS", 16)) {
-					self->tcpip_status = GSM_QUECTEL_TCPIP_STATUS_IP_STATUS;
-				}
-				if (!strncmp(buf, "STATE: TCP CONNECTING", 21)) {
-					self->tcpip_status = GSM_QUECTEL_TCPIP_STATUS_TCP_CONNECTING;
-				}
-				if (!strncmp(buf, "STATE: UDP CONNECTING", 21)) {
-					self->tcpip_status = GSM_QUECTEL_TCPIP_STATUS_UDP_CONNECTING;
-				}
-				if (!strncmp(buf, "STATE: IP CLOSE", 15)) {
-					self->tcpip_status = GSM_QUECTEL_TCPIP_STATUS_IP_CLOSE;
-				}
-				if (!strncmp(buf, "STATE: CONNECT OK", 17)) {
-					self->tcpip_status = GSM_QUECTEL_TCPIP_STATUS_CONNECT_OK;
-				}
-				if (!strncmp(buf, "STATE: PDP DEACT", 16)) {
-					self->tcpip_status = GSM_QUECTEL_TCPIP_STATUS_PDP_DEACT;
-				}
+	/* If the modem returned as much as requested, there may be more data waiting. */
+	if (data_len >= self->ip_recv_requested) {
+		self->data_pending = true;
+	}
+}
 
-				// u_log(system_log, LOG_TYPE_DEBUG, U_LOG_MODULE_PREFIX("parsed state = %s"), gsm_quectel_tcpip_states[self->tcpip_status]);
 
-				continue;
-			}
+static void response_operator(GsmQuectel *self, char *line, size_t len) {
+	(void)len;
+	strncpy(self->operator, line + 11, sizeof(self->operator));
+	self->operator[sizeof(self->operator) - 1] = '\0';
+}
 
-		}
 
-		if (self->current_command == GSM_QUECTEL_CMD_GET_REGISTRATION) {
-			if (!strncmp(buf, "+CREG: 2,", 9)) {
-				if (!strncmp(buf, "+CREG: 2,1", 10)) {
-					self->registered = true;
-					self->cellular_status = CELLULAR_MODEM_STATUS_REGISTERED_HOME;
-				} else if (!strncmp(buf, "+CREG: 2,5", 10)) {
-					self->registered = false;
-					self->cellular_status = CELLULAR_MODEM_STATUS_REGISTERED_ROAMING;
-				} else if (!strncmp(buf, "+CREG: 2,2", 10)) {
-					self->registered = false;
-					self->cellular_status = CELLULAR_MODEM_STATUS_SEARCHING;
-				} else {
-					self->registered = false;
-					self->cellular_status = CELLULAR_MODEM_STATUS_NOT_REGISTERED;
-				}
-				continue;
-			}
-		}
+static void response_no_operator(GsmQuectel *self, char *line, size_t len) {
+	(void)line;
+	(void)len;
+	strcpy(self->operator, "");
+}
 
-		if (self->current_command == GSM_QUECTEL_CMD_IP_RECV) {
-			if (!strncmp(buf, "+QIRD:", 6)) {
-				/* Parse the QIRD response to find out length of the data. */
-				size_t i = strlen(buf);
-				while (buf[i] != ',' && i > 0) {
-					i--;
-				}
-				if (i == 0) {
-					continue;
-				}
-				/* Move one character right, the number of bytes field starts there. Read it. */
-				i++;
-				uint32_t len = 0;
-				sscanf(&(buf[i]), "%u", &len);
 
-				/* CR is being processed by the previous readline command. Read the LF byte. */
-				uint8_t lf = 0;
-				interface_stream_read_timeout(self->usart, &lf, 1, 100);
+static void response_ussd(GsmQuectel *self, char *line, size_t len) {
+	(void)len;
+	snprintf(self->ussd_response_string, self->ussd_response_size, "%s", line + 7);
+}
 
 
-				// u_log(system_log, LOG_TYPE_WARN, U_LOG_MODULE_PREFIX("avail %d"), len);
+static void urc_ring(GsmQuectel *self, char *line, size_t len) {
+	(void)self;
+	(void)line;
+	(void)len;
+	/* Incoming call. */
+	u_log(system_log, LOG_TYPE_INFO, U_LOG_MODULE_PREFIX("incoming call"));
+}
 
-				/* Read the exact number of bytes now. */
-				while (len > 0) {
-					uint8_t data[16];
-					size_t can_read = sizeof(data);
-					if (can_read > len) {
-						can_read = len;
-					}
 
-					// u_log(system_log, LOG_TYPE_WARN, U_LOG_MODULE_PREFIX("reading %u space %u"), can_read, xStreamBufferSpacesAvailable(self->rxdata));
+static void urc_cfun(GsmQuectel *self, char *line, size_t len) {
+	(void)len;
+	if (!strcmp(line, "+CFUN: 0")) {
+		self->modem_status = GSM_QUECTEL_MODEM_STATUS_MINIMUM;
+	}
+	if (!strcmp(line, "+CFUN: 1")) {
+		self->modem_status = GSM_QUECTEL_MODEM_STATUS_FULL;
+	}
+	if (!strcmp(line, "+CFUN: 4")) {
+		self->modem_status = GSM_QUECTEL_MODEM_STATUS_RFKILL;
+	}
+}
 
-					int r = interface_stream_read_timeout(self->usart, data, can_read, 100);
-					if (r > 0) {
-						int w = xStreamBufferSend(self->rxdata, data, r, 0);
-						// u_log(system_log, LOG_TYPE_WARN, U_LOG_MODULE_PREFIX("rxdata %d"), w);
-						if (r != w) {
-							// u_log(system_log, LOG_TYPE_WARN, U_LOG_MODULE_PREFIX("rx overflow"));
-						}
-						len -= w;
-					}
-				}
-			}
-			continue;
-		}
 
+static void urc_data_received(GsmQuectel *self, char *line, size_t len) {
+	(void)line;
+	(void)len;
+	/* The modem received some data and its buffer was empty before. The URC is
+	 * not repeated until all data is read. Let the main task read it. */
+	self->data_pending = true;
+	xSemaphoreGive(self->data_waiting);
+}
 
-		if (self->current_command == GSM_QUECTEL_CMD_GET_OPERATOR) {
-			if (!strncmp(buf, "+COPS: 0,0,", 11)) {
-				strncpy(self->operator, buf + 11, sizeof(self->operator));
-				self->operator[sizeof(self->operator) - 1] = '\0';
-			} else {
-				strcpy(self->operator, "");
-			}
-			continue;
-		}
 
+static void urc_sms(GsmQuectel *self, char *line, size_t len) {
+	/* The message text follows on the next line. */
+	if (read_line(self, &line, &len) != GSM_QUECTEL_RET_OK) {
+		return;
+	}
+	u_log(system_log, LOG_TYPE_INFO, U_LOG_MODULE_PREFIX("incoming SMS: '%s'"), line);
+	if (len == 5 && !memcmp(line, "reset", 5)) {
+		u_log(system_log, LOG_TYPE_INFO, U_LOG_MODULE_PREFIX("reset requested by SMS"));
 
-		if (self->current_command == GSM_QUECTEL_CMD_SEND_USSD) {
-			if (!strncmp(buf, "+CUSD: ", 7)) {
-				snprintf(self->ussd_response_string, self->ussd_response_size, "%s", buf + 7);
-			}
-			continue;
+		/* Wait until the watchdog resets the device. */
+		while (1) {
+			;
 		}
+	}
+}
 
 
-		if (self->current_command == GSM_QUECTEL_CMD_SETUP_SMS_NOTIFICATION) {
-			continue;
-		}
+static void urc_unknown(GsmQuectel *self, char *line, size_t len) {
+	(void)self;
+	(void)len;
+	u_log(system_log, LOG_TYPE_INFO, U_LOG_MODULE_PREFIX("URC: %s"), line);
+}
 
 
-		if (self->current_command == GSM_QUECTEL_CMD_NONE) {
-			if (!strcmp(buf, "RING")) {
-				/* Incoming call. */
-				u_log(system_log, LOG_TYPE_INFO, U_LOG_MODULE_PREFIX("incoming call"));
-				continue;
-			}
+/* Match the whole line, not only the prefix. */
+#define RESPONSE_EXACT (1 << 0)
+/* Process the line regardless of the command currently running. */
+#define RESPONSE_ANY_COMMAND (1 << 1)
+#define RESPONSE(p, f, c, h) {p, sizeof(p) - 1, f, c, h}
 
-			if (!strncmp(buf, "+CFUN: ", 7)) {
-				if (!strcmp(buf, "+CFUN: 0")) {
-					self->modem_status = GSM_QUECTEL_MODEM_STATUS_MINIMUM;
-				}
-				if (!strcmp(buf, "+CFUN: 1")) {
-					self->modem_status = GSM_QUECTEL_MODEM_STATUS_FULL;
-				}
-				if (!strcmp(buf, "+CFUN: 4")) {
-					self->modem_status = GSM_QUECTEL_MODEM_STATUS_RFKILL;
-				}
-				continue;
-			}
+struct gsm_quectel_response {
+	const char *prefix;
+	size_t prefix_len;
+	uint32_t flags;
+	enum gsm_quectel_command command;
+	void (*handler)(GsmQuectel *self, char *line, size_t len);
+};
 
-			if (!strncmp(buf, "+QIRDI:", 7)) {
-				xSemaphoreGive(self->data_waiting);
-				continue;
-			}
+/* The first matching entry is used. An empty prefix matches any line. */
+static const struct gsm_quectel_response gsm_quectel_responses[] = {
+	/* Final result codes. */
+	RESPONSE("OK", RESPONSE_EXACT | RESPONSE_ANY_COMMAND, GSM_QUECTEL_CMD_NONE, response_ok),
+	RESPONSE("SEND OK", RESPONSE_EXACT, GSM_QUECTEL_CMD_IP_SEND, response_done),
+	RESPONSE("CLOSE OK", RESPONSE_EXACT, GSM_QUECTEL_CMD_IP_CLOSE, response_done),
+	RESPONSE("DEACT OK", RESPONSE_EXACT, GSM_QUECTEL_CMD_DEACTIVATE_CONTEXT, response_done),
+	RESPONSE("ERROR", RESPONSE_EXACT | RESPONSE_ANY_COMMAND, GSM_QUECTEL_CMD_NONE, response_error),
+	RESPONSE("+CME ERROR:", RESPONSE_ANY_COMMAND, GSM_QUECTEL_CMD_NONE, response_cme_error),
+
+	/* URCs may be received at any time, even when a command is running. */
+	RESPONSE("RING", RESPONSE_EXACT | RESPONSE_ANY_COMMAND, GSM_QUECTEL_CMD_NONE, urc_ring),
+	RESPONSE("+CFUN: ", RESPONSE_ANY_COMMAND, GSM_QUECTEL_CMD_NONE, urc_cfun),
+	RESPONSE("+QIRDI:", RESPONSE_ANY_COMMAND, GSM_QUECTEL_CMD_NONE, urc_data_received),
+	RESPONSE("+CMT: ", RESPONSE_ANY_COMMAND, GSM_QUECTEL_CMD_NONE, urc_sms),
+
+	/* Intermediate responses of commands. */
+	RESPONSE("", 0, GSM_QUECTEL_CMD_GET_IMSI, response_imsi),
+	RESPONSE("", 0, GSM_QUECTEL_CMD_GET_IMEI, response_imei),
+	RESPONSE("", 0, GSM_QUECTEL_CMD_GET_IP, response_local_ip),
+	RESPONSE("+CGACT: 1,0", RESPONSE_EXACT, GSM_QUECTEL_CMD_PDP_STATUS, response_pdp_inactive),
+	RESPONSE("+CGACT: 1,1", RESPONSE_EXACT, GSM_QUECTEL_CMD_PDP_STATUS, response_pdp_active),
+	RESPONSE("STATE: ", 0, GSM_QUECTEL_CMD_TCPIP_STAT, response_tcpip_state),
+	RESPONSE("+CREG: 2,", 0, GSM_QUECTEL_CMD_GET_REGISTRATION, response_registration),
+	RESPONSE("+QIRD:", 0, GSM_QUECTEL_CMD_IP_RECV, response_ip_recv),
+	RESPONSE("", 0, GSM_QUECTEL_CMD_IP_RECV, response_ignore),
+	RESPONSE("+COPS: 0,0,", 0, GSM_QUECTEL_CMD_GET_OPERATOR, response_operator),
+	RESPONSE("", 0, GSM_QUECTEL_CMD_GET_OPERATOR, response_no_operator),
+	RESPONSE("+CUSD: ", 0, GSM_QUECTEL_CMD_SEND_USSD, response_ussd),
+	RESPONSE("", 0, GSM_QUECTEL_CMD_SEND_USSD, response_ignore),
+	RESPONSE("", 0, GSM_QUECTEL_CMD_SETUP_SMS_NOTIFICATION, response_ignore),
+
+	/* Unsolicited messages not handled above. */
+	RESPONSE("+", 0, GSM_QUECTEL_CMD_NONE, urc_unknown),
+};
 
-			if (!strncmp(buf, "+CMT: ", 6)) {
-				read_line(self, buf, sizeof(buf) - 1, &len);
-				buf[len] = '\0';
-				u_log(system_log, LOG_TYPE_INFO, U_LOG_MODULE_PREFIX("incoming SMS: '%s'"), buf);
-				if (len == 5 && !memcmp(buf, "reset", 5)) {
-					u_log(system_log, LOG_TYPE_INFO, U_LOG_MODULE_PREFIX("reset requested by SMS"));
 
-					/* Wait until the watchdog resets the device. */
-					while (1) {
-						;
-					}
-				}
-				continue;
-			}
+static void process_line(GsmQuectel *self, char *line, size_t len) {
+	enum gsm_quectel_command current_command = self->current_command;
 
-			if (!strncmp(buf, "+", 1)) {
-				u_log(system_log, LOG_TYPE_INFO, U_LOG_MODULE_PREFIX("URC: %s"), buf);
-			}
+	for (size_t i = 0; i < sizeof(gsm_quectel_responses) / sizeof(gsm_quectel_responses[0]); i++) {
+		const struct gsm_quectel_response *r = &(gsm_quectel_responses[i]);
+
+		if (!(r->flags & RESPONSE_ANY_COMMAND) && r->command != current_command) {
+			continue;
+		}
+		if (len < r->prefix_len || memcmp(line, r->prefix, r->prefix_len)) {
+			continue;
+		}
+		if ((r->flags & RESPONSE_EXACT) && len != r->prefix_len) {
+			continue;
 		}
+
+		r->handler(self, line, len);
+		return;
+	}
+}
+
+
+static void gsm_quectel_process_task(void *p) {
+	GsmQuectel *self = (GsmQuectel *)p;
+
+	while (self->can_run) {
+		char *line = NULL;
+		size_t len = 0;
+		if (read_line(self, &line, &len) != GSM_QUECTEL_RET_OK) {
+			continue;
+		}
+
+		if (self->debug_responses) {
+			u_log(system_log, LOG_TYPE_DEBUG, U_LOG_MODULE_PREFIX("-> %s"), line);
+		}
+
+		process_line(self, line, len);
 	}
 
 	vTaskDelete(NULL);
@@ -640,8 +754,23 @@ static void gsm_quectel_main_task(void *p) {
 	while (self->can_run) {
 
 		if (self->tcp_ready && self->tcpip_ready) {
-			/* Check for data every cycle. */
-			command(self, GSM_QUECTEL_CMD_IP_RECV, 1000);
+			/* Read data announced by the +QIRDI URC as long as there is some space
+			 * in the rxdata buffer. The flag is set again by the response if there
+			 * is more data to read or if a new URC arrives in the meantime. */
+			TickType_t recv_start = xTaskGetTickCount();
+			while (self->data_pending && xStreamBufferSpacesAvailable(self->rxdata) > 0) {
+				self->data_pending = false;
+				command(self, GSM_QUECTEL_CMD_IP_RECV, 1000);
+
+				/* Do not starve the periodic tasks below during a long download.
+				 * Continue immediately in the next cycle. */
+				if ((xTaskGetTickCount() - recv_start) >= pdMS_TO_TICKS(100)) {
+					if (self->data_pending) {
+						xSemaphoreGive(self->data_waiting);
+					}
+					break;
+				}
+			}
 		}
 
 		if ((cnt % 20) == 0) {
@@ -652,6 +781,10 @@ static void gsm_quectel_main_task(void *p) {
 
 		/* Get status every 5 seconds. */
 		if ((cnt % 50) == 0) {
+			/* Check for data in case an URC was missed. */
+			if (self->tcp_ready) {
+				self->data_pending = true;
+			}
 			if (self->modem_status == GSM_QUECTEL_MODEM_STATUS_FULL) {
 				command(self, GSM_QUECTEL_CMD_SET_CHARACTER_SET, 300);
 				command(self, GSM_QUECTEL_CMD_SETUP_SMS_TEXT_MODE, 300);
@@ -854,9 +987,14 @@ static tcpip_ret_t gsm_quectel_tcpip_socket_receive(void *context, uint8_t *data
 		return TCPIP_RET_DISCONNECTED;
 	}
 
-	command(self, GSM_QUECTEL_CMD_IP_RECV, 1000);
+	/* Data are read from the modem by the main task. */
 	int r = xStreamBufferReceive(self->rxdata, data, len, 100);
 
+	/* Some space was freed, let the main task read more if the modem has any. */
+	if (r > 0 && self->data_pending) {
+		xSemaphoreGive(self->data_waiting);
+	}
+
 	*read = r;
 	if (r) {
 		// u_log(system_log, LOG_TYPE_DEBUG, U_LOG_MODULE_PREFIX("read %d bytes"), r);
@@ -1004,7 +1142,7 @@ gsm_quectel_ret_t gsm_quectel_init(GsmQuectel *self) {
 		return GSM_QUECTEL_RET_FAILED;
 	}
 
-	self->rxdata = xStreamBufferCreate(128, 1);
+	self->rxdata = xStreamBufferCreate(GSM_QUECTEL_RXDATA_SIZE, 1);
 	if (self->rxdata == NULL) {
 		return GSM_QUECTEL_RET_FAILED;
 	}
@@ -1093,6 +1231,7 @@ gsm_quectel_ret_t gsm_quectel_set_pwrkey(GsmQuectel *self, uint32_t port, uint32
 
 	self->pwrkey_port = port;
 	self->pwrkey_pin = pin;
+	self->power_control = true;
 
 	return GSM_QUECTEL_RET_OK;
 }
@@ -1115,6 +1254,11 @@ gsm_quectel_ret_t gsm_quectel_power(GsmQuectel *self, bool power) {
 		return GSM_QUECTEL_RET_FAILED;
 	}
 
+	/* The modem is powered all the time (or it is simulated in the tests). */
+	if (self->power_control == false) {
+		return GSM_QUECTEL_RET_OK;
+	}
+
 	if (power) {
 		u_log(system_log, LOG_TYPE_INFO, U_LOG_MODULE_PREFIX("powering up"));
 		if (gpio_get(self->vddext_port, self->vddext_pin)) {
@@ -34,6 +34,14 @@
 #include "interfaces/tcpip.h"
 #include "interfaces/cellular.h"
 
+/* Data received from the modem are read in blocks to the parser buffer and split
+ * to lines there. It must be able to hold the longest response line. */
+#define GSM_QUECTEL_PARSER_BUFFER_SIZE 256
+
+/* Size of the buffer for data received from the TCP socket. Data are read from
+ * the modem as long as there is some free space. */
+#define GSM_QUECTEL_RXDATA_SIZE 512
+
 
 typedef enum {
 	GSM_QUECTEL_RET_OK = 0,
@@ -114,6 +122,9 @@ typedef struct {
 	uint32_t vddext_port;
 	uint32_t vddext_pin;
 
+	/* The modem is powered up and down using the PWRKEY pin. */
+	bool power_control;
+
 	bool can_run;
 	bool running;
 
@@ -143,13 +154,17 @@ typedef struct {
 	const uint8_t *data_to_send;
 	size_t data_to_send_len;
 
-	// uint8_t *data_to_receive;
-	// size_t data_to_receive_len;
-	// size_t data_to_receive_read;
+	/* Set by the +QIRDI URC if the modem has some data to read, cleared when all data is read. */
+	volatile bool data_pending;
+	size_t ip_recv_requested;
 	SemaphoreHandle_t data_waiting;
 
 	StreamBufferHandle_t rxdata;
 
+	uint8_t parser_buf[GSM_QUECTEL_PARSER_BUFFER_SIZE];
+	size_t parser_pos;
+	size_t parser_len;
+
 	ITcpIpSocket tcpip_socket;
 	volatile bool tcpip_socket_used;
 	const char *tcpip_address;
@@ -0,0 +1,566 @@
+/*
+ * Quectel M66 driver tests
+ *
+ * Copyright (C) 2017, Marek Koza, qyx@krtko.org
+ *
+ * This file is part of uMesh node firmware (http://qyx.krtko.org/projects/umesh)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#include "stream_buffer.h"
+#include "u_assert.h"
+#include "u_log.h"
+#include "u_test.h"
+
+#include "module.h"
+#include "interface_stream.h"
+#include "interfaces/tcpip.h"
+#include "gsm_quectel.h"
+#include "gsm_quectel_tests.h"
+
+#ifdef MODULE_NAME
+#undef MODULE_NAME
+#endif
+#define MODULE_NAME "gsm-tests"
+
+
+/**
+ * The driver is connected to a simulated M66 modem using an in-memory stream
+ * interface. The modem answers the AT commands used by the driver after
+ * a configurable latency and paces its output to the UART baudrate. It walks
+ * through the TCP/IP states, announces received socket data with the +QIRDI
+ * URC and returns it using AT+QIRD. Data received from the network follow
+ * a known byte pattern which is checked by the reader.
+ */
+#define GSM_TEST_UART_BUFFER_SIZE 256
+#define GSM_TEST_UART_CHUNK 16
+#define GSM_TEST_LINE_SIZE 300
+#define GSM_TEST_NETWORK_BUFFER_SIZE 4096
+#define GSM_TEST_MAX_READ 1500
+#define GSM_TEST_CFUN_DELAY_MS 50
+#define GSM_TEST_CONNECT_TIMEOUT_MS 30000
+#define GSM_TEST_IMSI "231011234567890"
+#define GSM_TEST_IMEI "861234567890123"
+#define GSM_TEST_LOCAL_IP "10.0.0.2"
+
+struct gsm_test_modem {
+	GsmQuectel gsm;
+	struct interface_stream usart;
+	ITcpIpSocket *socket;
+	TaskHandle_t task;
+	bool started;
+
+	/* Modem to driver and driver to modem directions. */
+	StreamBufferHandle_t tx;
+	StreamBufferHandle_t rx;
+	volatile uint32_t uart_reads;
+	uint64_t wire_time_us;
+
+	volatile uint32_t baudrate;
+	volatile uint32_t latency_ms;
+	/* Network data rate in B/s, 0 = as fast as the modem buffer is read. */
+	volatile uint32_t network_rate;
+	volatile bool network_enabled;
+	/* Add a fixed amount of data regardless of the network settings. */
+	volatile uint32_t inject;
+	/* Send the +QIRDI URC in the middle of the next command response. */
+	volatile bool urc_in_response;
+	volatile bool urc_held;
+	/* The driver sets the character set when it checks for missed URCs. */
+	volatile uint32_t polls;
+
+	const char *state;
+	TickType_t cfun_at;
+
+	/* Data received from the network waiting in the modem. */
+	size_t net_len;
+	uint32_t net_off;
+	TickType_t net_last;
+	bool urc_armed;
+
+	char line[GSM_TEST_LINE_SIZE];
+	size_t line_len;
+
+	/* Offset of the next byte expected by the reader. */
+	uint32_t rx_off;
+	uint32_t errors;
+};
+
+static struct gsm_test_modem gsm_test_modem;
+
+
+static uint8_t pattern(uint32_t off) {
+	return (uint8_t)(off * 131 + (off >> 8) * 7 + 3);
+}
+
+
+static int32_t usart_read_timeout(void *context, uint8_t *buf, uint32_t len, uint32_t timeout) {
+	struct gsm_test_modem *self = (struct gsm_test_modem *)context;
+
+	self->uart_reads++;
+	return xStreamBufferReceive(self->tx, buf, len, pdMS_TO_TICKS(timeout));
+}
+
+
+static int32_t usart_read(void *context, uint8_t *buf, uint32_t len) {
+	return usart_read_timeout(context, buf, len, portMAX_DELAY);
+}
+
+
+static int32_t usart_write(void *context, const uint8_t *buf, uint32_t len) {
+	struct gsm_test_modem *self = (struct gsm_test_modem *)context;
+
+	return xStreamBufferSend(self->rx, buf, len, portMAX_DELAY);
+}
+
+
+/* Send the data to the driver as fast as the UART would at the current baudrate. */
+static void modem_write(struct gsm_test_modem *self, const uint8_t *data, size_t len) {
+	while (len > 0) {
+		size_t n = (len > GSM_TEST_UART_CHUNK) ? GSM_TEST_UART_CHUNK : len;
+
+		uint64_t now_us = (uint64_t)xTaskGetTickCount() * portTICK_PERIOD_MS * 1000;
+		if (self->wire_time_us < now_us) {
+			self->wire_time_us = now_us;
+		}
+		self->wire_time_us += (uint64_t)n * 10 * 1000000 / self->baudrate;
+		TickType_t wait = (self->wire_time_us - now_us) / 1000 / portTICK_PERIOD_MS;
+		if (wait > 0) {
+			vTaskDelay(wait);
+		}
+
+		xStreamBufferSend(self->tx, data, n, portMAX_DELAY);
+		data += n;
+		len -= n;
+	}
+}
+
+
+static void modem_puts(struct gsm_test_modem *self, const char *s) {
+	modem_write(self, (const uint8_t *)s, strlen(s));
+}
+
+
+static void modem_read_data(struct gsm_test_modem *self, size_t len) {
+	if (len > GSM_TEST_MAX_READ) {
+		len = GSM_TEST_MAX_READ;
+	}
+	if (len > self->net_len) {
+		len = self->net_len;
+	}
+
+	if (len > 0) {
+		char header[48];
+		snprintf(header, sizeof(header), "\r\n+QIRD: 10.0.0.1:1883,TCP,%u\r\n", (unsigned int)len);
+		modem_puts(self, header);
+
+		while (len > 0) {
+			uint8_t chunk[GSM_TEST_UART_CHUNK];
+			size_t n = (len > sizeof(chunk)) ? sizeof(chunk) : len;
+			for (size_t i = 0; i < n; i++) {
+				chunk[i] = pattern(self->net_off + i);
+			}
+			modem_write(self, chunk, n);
+			self->net_off += n;
+			self->net_len -= n;
+			len -= n;
+		}
+	}
+	modem_puts(self, "\r\nOK\r\n");
+
+	/* The URC is sent again when new data arrives to an empty buffer. */
+	if (self->net_len == 0) {
+		self->urc_armed = true;
+	}
+}
+
+
+static void modem_command(struct gsm_test_modem *self, const char *c) {
+	vTaskDelay(pdMS_TO_TICKS(self->latency_ms));
+
+	if (self->urc_held) {
+		/* The driver is waiting for the response of the command just received. */
+		modem_puts(self, "\r\n+QIRDI: 0,1,0\r\n");
+		self->urc_held = false;
+	}
+
+	if (!strcmp(c, "ATE0")) {
+		modem_puts(self, "\r\nOK\r\n");
+		self->cfun_at = xTaskGetTickCount() + pdMS_TO_TICKS(GSM_TEST_CFUN_DELAY_MS);
+	} else if (!strcmp(c, "AT+CIMI")) {
+		modem_puts(self, "\r\n" GSM_TEST_IMSI "\r\n\r\nOK\r\n");
+	} else if (!strcmp(c, "AT+GSN")) {
+		modem_puts(self, "\r\n" GSM_TEST_IMEI "\r\n\r\nOK\r\n");
+	} else if (!strcmp(c, "AT+COPS?")) {
+		modem_puts(self, "\r\n+COPS: 0,0,\"SimNet\"\r\n\r\nOK\r\n");
+	} else if (!strcmp(c, "AT+CREG?")) {
+		modem_puts(self, "\r\n+CREG: 2,1,\"0000\",\"0000\"\r\n\r\nOK\r\n");
+	} else if (!strncmp(c, "AT+CSCS=", 8)) {
+		self->polls++;
+		modem_puts(self, "\r\nOK\r\n");
+	} else if (!strcmp(c, "AT+QISTAT")) {
+		/* The state is sent after the final result code. */
+		char response[48];
+		snprintf(response, sizeof(response), "\r\nOK\r\n\r\nSTATE: %s\r\n", self->state);
+		modem_puts(self, response);
+	} else if (!strncmp(c, "AT+QIREGAPP=", 12)) {
+		self->state = "IP START";
+		modem_puts(self, "\r\nOK\r\n");
+	} else if (!strcmp(c, "AT+QIACT")) {
+		self->state = "IP GPRSACT";
+		modem_puts(self, "\r\nOK\r\n");
+	} else if (!strcmp(c, "AT+QILOCIP")) {
+		self->state = "IP STATUS";
+		modem_puts(self, "\r\n" GSM_TEST_LOCAL_IP "\r\n");
+	} else if (!strncmp(c, "AT+QIOPEN=", 10)) {
+		modem_puts(self, "\r\nOK\r\n");
+		self->state = "CONNECT OK";
+		modem_puts(self, "\r\nCONNECT OK\r\n");
+	} else if (!strcmp(c, "AT+QICLOSE")) {
+		self->state = "IP CLOSE";
+		modem_puts(self, "\r\nCLOSE OK\r\n");
+	} else if (!strncmp(c, "AT+QIRD=0,1,0,", 14)) {
+		if (strcmp(self->state, "CONNECT OK")) {
+			modem_puts(self, "\r\nERROR\r\n");
+		} else {
+			modem_read_data(self, strtoul(c + 14, NULL, 10));
+		}
+	} else {
+		modem_puts(self, "\r\nOK\r\n");
+	}
+}
+
+
+/* Receive data from the network to the modem buffer. */
+static void modem_network(struct gsm_test_modem *self) {
+	TickType_t now = xTaskGetTickCount();
+	size_t add = 0;
+
+	if (self->network_enabled) {
+		if (self->network_rate > 0) {
+			add = (now - self->net_last) * portTICK_PERIOD_MS * self->network_rate / 1000;
+			if (add > 0) {
+				self->net_last = now;
+			}
+		} else {
+			add = GSM_TEST_NETWORK_BUFFER_SIZE;
+		}
+	} else {
+		self->net_last = now;
+	}
+
+	if (self->inject > 0) {
+		add += self->inject;
+		self->inject = 0;
+	}
+
+	if (add > GSM_TEST_NETWORK_BUFFER_SIZE - self->net_len) {
+		add = GSM_TEST_NETWORK_BUFFER_SIZE - self->net_len;
+	}
+	self->net_len += add;
+
+	if (self->net_len > 0 && self->urc_armed) {
+		self->urc_armed = false;
+		if (self->urc_in_response) {
+			self->urc_held = true;
+		} else {
+			modem_puts(self, "\r\n+QIRDI: 0,1,0\r\n");
+		}
+	}
+}
+
+
+static void modem_task(void *p) {
+	struct gsm_test_modem *self = (struct gsm_test_modem *)p;
+
+	while (true) {
+		uint8_t c;
+		if (xStreamBufferReceive(self->rx, &c, 1, 1) == 1) {
+			if (c == '\r' || c == '\n') {
+				if (self->line_len > 0) {
+					self->line[self->line_len] = '\0';
+					modem_command(self, self->line);
+					self->line_len = 0;
+				}
+			} else if (self->line_len < (sizeof(self->line) - 1)) {
+				self->line[self->line_len] = c;
+				self->line_len++;
+			}
+		}
+
+		if (self->cfun_at != 0 && (int32_t)(xTaskGetTickCount() - self->cfun_at) >= 0) {
+			self->cfun_at = 0;
+			modem_puts(self, "\r\n+CFUN: 1\r\n");
+		}
+
+		modem_network(self);
+	}
+}
+
+
+static void modem_setup(struct gsm_test_modem *self, uint32_t baudrate, uint32_t latency_ms, uint32_t network_rate) {
+	self->baudrate = baudrate;
+	self->latency_ms = latency_ms;
+	self->network_rate = network_rate;
+}
+
+
+/* Start the modem and the driver. They are kept running for all tests. */
+static bool modem_start(struct gsm_test_modem *self) {
+	if (self->started) {
+		return true;
+	}
+
+	self->tx = xStreamBufferCreate(GSM_TEST_UART_BUFFER_SIZE, 1);
+	self->rx = xStreamBufferCreate(GSM_TEST_UART_BUFFER_SIZE, 1);
+	if (self->tx == NULL || self->rx == NULL) {
+		return false;
+	}
+
+	modem_setup(self, 115200, 5, 0);
+	self->state = "IP INITIAL";
+	self->urc_armed = true;
+
+	interface_stream_init(&self->usart);
+	self->usart.vmt.context = (void *)self;
+	self->usart.vmt.read = usart_read;
+	self->usart.vmt.read_timeout = usart_read_timeout;
+	self->usart.vmt.write = usart_write;
+
+	xTaskCreate(modem_task, "gsm_test", configMINIMAL_STACK_SIZE + 256, (void *)self, 1, &(self->task));
+	if (self->task == NULL) {
+		return false;
+	}
+
+	if (gsm_quectel_init(&self->gsm) != GSM_QUECTEL_RET_OK ||
+	    gsm_quectel_set_usart(&self->gsm, &self->usart) != GSM_QUECTEL_RET_OK ||
+	    gsm_quectel_start(&self->gsm) != GSM_QUECTEL_RET_OK) {
+		return false;
+	}
+
+	self->started = true;
+	return true;
+}
+
+
+/* Wait until the GPRS context is active and connect the socket. */
+static bool modem_connect(struct gsm_test_modem *self) {
+	if (self->socket != NULL) {
+		return true;
+	}
+
+	TickType_t start = xTaskGetTickCount();
+	while (self->gsm.tcpip_ready == false) {
+		if ((xTaskGetTickCount() - start) >= pdMS_TO_TICKS(GSM_TEST_CONNECT_TIMEOUT_MS)) {
+			return false;
+		}
+		vTaskDelay(pdMS_TO_TICKS(100));
+	}
+
+	ITcpIpSocket *socket = NULL;
+	if (tcpip_create_client_socket(gsm_quectel_tcpip(&self->gsm), &socket) != TCPIP_RET_OK) {
+		return false;
+	}
+	if (tcpip_socket_connect(socket, "10.0.0.1", 1883) != TCPIP_RET_OK) {
+		tcpip_release_client_socket(gsm_quectel_tcpip(&self->gsm), socket);
+		return false;
+	}
+
+	self->socket = socket;
+	return true;
+}
+
+
+/* Receive socket data for the specified time and check them. */
+static uint32_t download(struct gsm_test_modem *self, uint32_t time_ms) {
+	uint32_t received = 0;
+
+	TickType_t start = xTaskGetTickCount();
+	while ((xTaskGetTickCount() - start) < pdMS_TO_TICKS(time_ms)) {
+		uint8_t buf[128];
+		size_t len = 0;
+		if (tcpip_socket_receive(self->socket, buf, sizeof(buf), &len) == TCPIP_RET_OK) {
+			for (size_t i = 0; i < len; i++) {
+				if (buf[i] != pattern(self->rx_off + i)) {
+					self->errors++;
+				}
+			}
+			self->rx_off += len;
+			received += len;
+		}
+	}
+
+	return received;
+}
+
+
+/* Stop the network and read everything buffered in the modem and in the driver. */
+static void drain(struct gsm_test_modem *self) {
+	self->network_enabled = false;
+	while (download(self, 500) > 0) {
+		;
+	}
+}
+
+
+static bool gsm_quectel_test_connect_if_ok(void) {
+	struct gsm_test_modem *self = &gsm_test_modem;
+	if (!modem_start(self) || !modem_connect(self)) {
+		return false;
+	}
+
+	/* Identification is refreshed periodically. */
+	TickType_t start = xTaskGetTickCount();
+	while (strcmp(self->gsm.imsi, GSM_TEST_IMSI) || strcmp(self->gsm.imei, GSM_TEST_IMEI)) {
+		if ((xTaskGetTickCount() - start) >= pdMS_TO_TICKS(10000)) {
+			return false;
+		}
+		vTaskDelay(pdMS_TO_TICKS(100));
+	}
+
+	return !strcmp(self->gsm.local_ip, GSM_TEST_LOCAL_IP) &&
+	       self->gsm.modem_status == GSM_QUECTEL_MODEM_STATUS_FULL &&
+	       self->gsm.registered &&
+	       self->gsm.tcp_ready;
+}
+
+
+static bool gsm_quectel_test_receive_if_ok(void) {
+	struct gsm_test_modem *self = &gsm_test_modem;
+	if (!modem_start(self) || !modem_connect(self)) {
+		return false;
+	}
+
+	drain(self);
+	modem_setup(self, 460800, 5, 0);
+	self->errors = 0;
+
+	self->network_enabled = true;
+	uint32_t received = download(self, 2000);
+	drain(self);
+
+	return received > GSM_TEST_NETWORK_BUFFER_SIZE && self->errors == 0;
+}
+
+
+static bool gsm_quectel_test_urc_if_handled_during_command(void) {
+	struct gsm_test_modem *self = &gsm_test_modem;
+	if (!modem_start(self) || !modem_connect(self)) {
+		return false;
+	}
+
+	drain(self);
+	modem_setup(self, 115200, 5, 0);
+	self->errors = 0;
+
+	/* The data must be read shortly after the URC, not by the periodic check
+	 * done every 5 seconds. Start right after the check and the read it
+	 * triggers are finished. */
+	uint32_t polls = self->polls;
+	TickType_t start = xTaskGetTickCount();
+	while (self->polls == polls) {
+		if ((xTaskGetTickCount() - start) >= pdMS_TO_TICKS(10000)) {
+			return false;
+		}
+		vTaskDelay(pdMS_TO_TICKS(10));
+	}
+	vTaskDelay(pdMS_TO_TICKS(500));
+
+	self->urc_in_response = true;
+	self->inject = 100;
+	uint32_t received = 0;
+	start = xTaskGetTickCount();
+	while (received < 100 && (xTaskGetTickCount() - start) < pdMS_TO_TICKS(2000)) {
+		received += download(self, 100);
+	}
+	self->urc_in_response = false;
+
+	return received == 100 && self->urc_held == false && self->errors == 0;
+}
+
+
+bool gsm_quectel_tests(void) {
+	bool res = true;
+
+	res &= u_test(gsm_quectel_test_connect_if_ok());
+	res &= u_test(gsm_quectel_test_receive_if_ok());
+	res &= u_test(gsm_quectel_test_urc_if_handled_during_command());
+
+	return res;
+}
+
+
+bool gsm_quectel_tests_throughput(void) {
+	struct gsm_test_modem *self = &gsm_test_modem;
+	if (!modem_start(self) || !modem_connect(self)) {
+		return false;
+	}
+
+	const struct {
+		uint32_t baudrate;
+		uint32_t latency_ms;
+		uint32_t network_rate;
+	} runs[] = {
+		{115200, 5, 0},
+		{460800, 5, 0},
+		{115200, 20, 0},
+		{115200, 5, 4096},
+	};
+	const uint32_t time_ms = 10000;
+	bool res = true;
+
+	for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+		drain(self);
+		modem_setup(self, runs[i].baudrate, runs[i].latency_ms, runs[i].network_rate);
+		self->errors = 0;
+		uint32_t reads = self->uart_reads;
+
+		self->network_enabled = true;
+		uint32_t received = download(self, time_ms);
+		self->network_enabled = false;
+		reads = self->uart_reads - reads;
+
+		bool r = received > 0 && self->errors == 0;
+		if (received == 0) {
+			received = 1;
+		}
+		char network[16] = "unlimited";
+		if (runs[i].network_rate > 0) {
+			snprintf(network, sizeof(network), "%u B/s", (unsigned int)runs[i].network_rate);
+		}
+		/* Download rate in hundredths of KB/s. */
+		uint32_t rate = received * 100 / 1024 * 1000 / time_ms;
+		u_log(system_log, r ? LOG_TYPE_INFO : LOG_TYPE_ERROR,
+			U_LOG_MODULE_PREFIX("%u Bd, latency %u ms, network %s: %u B in %u ms (%u.%02u KB/s), %u UART reads/KB, %u errors"),
+			runs[i].baudrate, runs[i].latency_ms, network, received, time_ms,
+			rate / 100, rate % 100, reads * 1024 / received, self->errors
+		);
+		res &= r;
+	}
+
+	drain(self);
+	modem_setup(self, 115200, 5, 0);
+
+	return res;
+}
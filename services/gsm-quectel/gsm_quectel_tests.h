@@ -0,0 +1,38 @@
+/*
+ * Quectel M66 driver tests
+ *
+ * Copyright (C) 2017, Marek Koza, qyx@krtko.org
+ *
+ * This file is part of uMesh node firmware (http://qyx.krtko.org/projects/umesh)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * Run the driver against a simulated M66 modem connected with an in-memory
+ * stream interface. Connecting, downloading socket data and handling an URC
+ * received in the middle of a command response is tested.
+ */
+bool gsm_quectel_tests(void);
+
+/**
+ * Download socket data from the simulated modem for 10 seconds with different
+ * UART baudrates, command latencies and network data rates. Log the download
+ * rate and the number of UART reads per KB. It takes about a minute.
+ */
+bool gsm_quectel_tests_throughput(void);
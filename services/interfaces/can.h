@@ -22,6 +22,10 @@ typedef enum {
 struct can_message {
 	bool rtr;
 	bool extid;
+	/* CAN-FD frame format. Set to send frames longer than 8 bytes. */
+	bool fd;
+	/* Switch to the data bit-rate for the data phase of a CAN-FD frame. */
+	bool brs;
 	uint32_t id;
 	size_t len;
 	/* Contains both classic CAN and CAN-FD messages. */
@@ -41,6 +41,15 @@
 #define MODULE_NAME "mqtt-fserver"
 
 
+/* Do not wait for the acknowledgement of the reply, the client is already waiting
+ * for it before sending the next block. */
+static void reply(MqttFileServer *self, const uint8_t *buf, size_t len) {
+	if (queue_publish_enqueue_message(&self->pub, buf, len, MQTT_FILE_SERVER_PUBLISH_TIMEOUT_MS) != MQTT_RET_OK) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("cannot queue the reply"));
+	}
+}
+
+
 static void mqtt_file_server_task(void *p) {
 	MqttFileServer *self = (MqttFileServer *)p;
 	sha256_ctx sha;
@@ -70,7 +79,7 @@ static void mqtt_file_server_task(void *p) {
 				u_log(system_log, LOG_TYPE_INFO, U_LOG_MODULE_PREFIX("file '%s' opened"), filename);
 
 				uint8_t opened[1] = {'o'};
-				queue_publish_send_message(&self->pub, opened, 1);
+				reply(self, opened, 1);
 
 				continue;
 			}
@@ -84,7 +93,7 @@ static void mqtt_file_server_task(void *p) {
 				u_log(system_log, LOG_TYPE_INFO, U_LOG_MODULE_PREFIX("end sha256=%02x%02x%02x%02x"), digest[0], digest[1], digest[2], digest[3]);
 				sffs_close(&f);
 				uint8_t hash[5] = {'h', digest[0], digest[1], digest[2], digest[3]};
-				queue_publish_send_message(&self->pub, hash, 5);
+				reply(self, hash, 5);
 				continue;
 			}
 
@@ -96,7 +105,7 @@ static void mqtt_file_server_task(void *p) {
 				if (bn < expect_bn) {
 					/* The same block is received for the second time,
 					 * ignore it, but confirm it. */
-					queue_publish_send_message(&self->pub, confirm, 3);
+					reply(self, confirm, 3);
 					continue;
 				} else if (bn > expect_bn) {
 					/* Very new block, this should not happen if the new block
@@ -112,7 +121,7 @@ static void mqtt_file_server_task(void *p) {
 				sffs_write(&f, buf + 6, block_len);
 				sha256_update(&sha, buf + 6, block_len);
 				u_log(system_log, LOG_TYPE_DEBUG, U_LOG_MODULE_PREFIX("block num=%u len=%u written"), bn, block_len);
-				queue_publish_send_message(&self->pub, confirm, 3);
+				reply(self, confirm, 3);
 				expect_bn = bn + 1;
 				continue;
 			}
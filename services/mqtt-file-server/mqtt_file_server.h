@@ -31,6 +31,8 @@
 #define MQTT_FILE_SERVER_TOPIC_LEN 64
 #define MQTT_FILE_SERVER_SUB_TOPIC "in"
 #define MQTT_FILE_SERVER_PUB_TOPIC "out"
+/* Maximum time to wait for a free slot in the MQTT queue when replying. */
+#define MQTT_FILE_SERVER_PUBLISH_TIMEOUT_MS 1000
 
 typedef enum {
 	MQTT_FILE_SERVER_RET_OK = 0,
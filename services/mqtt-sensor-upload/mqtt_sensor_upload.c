@@ -61,13 +61,16 @@ static void sensor_upload_task(void *p) {
 			snprintf(topic, sizeof(topic), "%s/%s", self->topic_prefix, name);
 
 			/** @todo this is meh. We are using only a single publish instance
-			 *        and the topic is changed for every sensor. */
+			 *        and the topic is changed for every sensor. The topic
+			 *        is copied to the queue together with the message. */
 			self->pub.topic_name = topic;
 
 			char line[32];
 			snprintf(line, sizeof(line), "%ld.%03u", (int32_t)value, abs(value * 1000) % 1000);
 
-			queue_publish_send_message(&self->pub, (uint8_t *)line, strlen(line));
+			if (queue_publish_enqueue_message(&self->pub, (uint8_t *)line, strlen(line), SENSOR_UPLOAD_PUBLISH_TIMEOUT_MS) != MQTT_RET_OK) {
+				u_log(system_log, LOG_TYPE_WARN, U_LOG_MODULE_PREFIX("cannot queue value of sensor '%s'"), name);
+			}
 			vTaskDelay(200);
 
 		}
@@ -28,6 +28,8 @@
 #include "services/mqtt-tcpip/mqtt_tcpip.h"
 
 #define SENSOR_UPLOAD_MAX_SENSORS 12
+/* A value is dropped if the MQTT queue stays full (eg. when disconnected). */
+#define SENSOR_UPLOAD_PUBLISH_TIMEOUT_MS 1000
 
 typedef enum {
 	MQTT_SENSOR_UPLOAD_RET_OK = 0,
@@ -53,50 +53,66 @@ static const char *mqtt_state_strings[] = {
 };
 
 
-static bool match_topic(const char *filter, const char *topic) {
-	if (*filter == '#') {
-		return true;
-	}
+/* MQTT topic filter matching as defined in the MQTT 3.1.1 specification.
+ *
+ * sport/tennis/player1/#, sport/tennis/player1 -> true
+ * sport/tennis/player1/#, sport/tennis/player1/score/wimbledon -> true
+ * sport/#, sport -> true
+ * #, anything -> true
+ * sport/tennis#, anything -> false
+ * sport/tennis/+, sport/tennis/player1 -> true
+ * sport/tennis/+, sport/tennis/player1/ranking -> false
+ *
+ * The topic is not null terminated, it points directly to the received packet. */
+static bool match_topic(const char *filter, const char *topic, size_t topic_len) {
+	const char *end = topic + topic_len;
 
-	char last_filter = '\0';
 	while (true) {
-		printf("%c == %c\n", *filter, *topic);
-		if (*filter == '#' && *topic != '\0') {
-			topic++;
-			continue;
-		}
-		if (*filter == '+' && *topic != '\0' && *topic != '/') {
-			topic++;
-			continue;
-		}
-		if (*filter == '+' && *topic == '/') {
-			last_filter = *filter;
-			filter++;
-			continue;
-		}
-		if (*filter == '#' && last_filter != '/') {
-			break;
-		}
-		if (*filter == '+' && last_filter != '/') {
-			break;
+		if (*filter == '#') {
+			/* Matches the parent level and any number of child levels. */
+			return true;
 		}
-		if ((*filter == '/' || *filter == '#' || *filter == '+') && *topic == '\0') {
-			last_filter = *filter;
+		if (*filter == '+') {
+			/* Matches exactly one level. */
+			while (topic < end && *topic != '/') {
+				topic++;
+			}
 			filter++;
-			continue;
+		} else {
+			while (*filter != '\0' && *filter != '/' && topic < end && *filter == *topic) {
+				filter++;
+				topic++;
+			}
+			if (*filter != '\0' && *filter != '/') {
+				return false;
+			}
+			if (topic < end && *topic != '/') {
+				return false;
+			}
 		}
-		if (*filter == '\0' && *topic == '\0') {
-			return true;
+
+		/* Both the filter and the topic are at the end of a level. */
+		if (*filter == '\0') {
+			return topic == end;
 		}
-		if (*filter == *topic) {
-			topic++;
-			last_filter = *filter;
-			filter++;
-			continue;
+		if (topic == end) {
+			/* sport/# matches sport */
+			return filter[1] == '#' && filter[2] == '\0';
 		}
-		break;
+		filter++;
+		topic++;
 	}
-	return false;
+}
+
+
+/* FNV-1a hash of the first topic level, used to index subscriptions. */
+static uint32_t topic_level_hash(const char *topic, size_t topic_len) {
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < topic_len && topic[i] != '/'; i++) {
+		hash ^= (uint8_t)topic[i];
+		hash *= 16777619u;
+	}
+	return hash;
 }
 
 
@@ -119,16 +135,222 @@ static void clear_reconnect_timeout(Mqtt *self) {
 }
 
 
-/* Return a new and fresh MQTT packet ID as dictated in the spec. */
-static int get_packet_id(Mqtt *self) {
-	self->last_packet_id++;
-	if (self->last_packet_id >= MQTT_MAX_PACKET_ID) {
-		self->last_packet_id = 1;
+static bool packet_id_in_flight(Mqtt *self, int packet_id) {
+	for (size_t i = 0; i < MQTT_OUT_QUEUE_LEN; i++) {
+		if (self->out[i].state != MQTT_OUT_FREE && self->out[i].packet_id == packet_id) {
+			return true;
+		}
 	}
+	return false;
+}
+
+
+/* Return a new and fresh MQTT packet ID as dictated in the spec. IDs of messages
+ * waiting for an acknowledgement are skipped. */
+static int get_packet_id(Mqtt *self) {
+	do {
+		self->last_packet_id++;
+		if (self->last_packet_id >= MQTT_MAX_PACKET_ID) {
+			self->last_packet_id = 1;
+		}
+	} while (packet_id_in_flight(self, self->last_packet_id));
 	return self->last_packet_id;
 }
 
 
+/* Outgoing message queue helpers follow. The queue is shared between the MQTT task
+ * and tasks publishing messages, it must be locked using out_lock. */
+
+static struct mqtt_out_message *out_alloc(Mqtt *self, TickType_t timeout) {
+	if (xSemaphoreTake(self->out_free, timeout) == pdFALSE) {
+		return NULL;
+	}
+
+	xSemaphoreTake(self->out_lock, portMAX_DELAY);
+	struct mqtt_out_message *m = NULL;
+	for (size_t i = 0; i < MQTT_OUT_QUEUE_LEN; i++) {
+		if (self->out[i].state == MQTT_OUT_FREE) {
+			m = &(self->out[i]);
+			break;
+		}
+	}
+	/* The semaphore counts free slots, there must be one. */
+	u_assert(m != NULL);
+	memset(m, 0, sizeof(struct mqtt_out_message));
+	m->seq = self->out_seq++;
+	xSemaphoreGive(self->out_lock);
+
+	return m;
+}
+
+
+/* Release the message and let the caller know if it is waiting. The queue must be locked. */
+static void out_complete(Mqtt *self, struct mqtt_out_message *m, mqtt_ret_t ret) {
+	if (m->state == MQTT_OUT_IN_FLIGHT) {
+		self->out_in_flight--;
+	}
+	if (m->notify) {
+		m->publish->ret = ret;
+		xSemaphoreGive(m->publish->msg_sent_lock);
+	}
+	m->state = MQTT_OUT_FREE;
+	xSemaphoreGive(self->out_free);
+}
+
+
+/* Find the oldest message waiting to be published. */
+static struct mqtt_out_message *out_next_queued(Mqtt *self) {
+	xSemaphoreTake(self->out_lock, portMAX_DELAY);
+	struct mqtt_out_message *m = NULL;
+	for (size_t i = 0; i < MQTT_OUT_QUEUE_LEN; i++) {
+		if (self->out[i].state == MQTT_OUT_QUEUED && (m == NULL || (int32_t)(self->out[i].seq - m->seq) < 0)) {
+			m = &(self->out[i]);
+		}
+	}
+	xSemaphoreGive(self->out_lock);
+	return m;
+}
+
+
+/* Check if there is a message which can be published right now. */
+static bool out_can_publish(Mqtt *self) {
+	return self->out_in_flight < self->publish_window && out_next_queued(self) != NULL;
+}
+
+
+/* Return true if the oldest unacknowledged message waits longer than allowed. */
+static bool out_puback_timeout(Mqtt *self) {
+	TickType_t now = xTaskGetTickCount();
+	bool timeout = false;
+
+	xSemaphoreTake(self->out_lock, portMAX_DELAY);
+	for (size_t i = 0; i < MQTT_OUT_QUEUE_LEN; i++) {
+		if (self->out[i].state == MQTT_OUT_IN_FLIGHT &&
+		    (now - self->out[i].sent_time) >= pdMS_TO_TICKS(MQTT_PUBACK_TIMEOUT_MS)) {
+			timeout = true;
+		}
+	}
+	xSemaphoreGive(self->out_lock);
+
+	return timeout;
+}
+
+
+/* After a reconnect, publish all unacknowledged messages again with the DUP flag set. */
+static void out_requeue(Mqtt *self) {
+	xSemaphoreTake(self->out_lock, portMAX_DELAY);
+	for (size_t i = 0; i < MQTT_OUT_QUEUE_LEN; i++) {
+		if (self->out[i].state == MQTT_OUT_IN_FLIGHT) {
+			self->out[i].state = MQTT_OUT_QUEUED;
+			self->out[i].duplicate = true;
+		}
+	}
+	self->out_in_flight = 0;
+	xSemaphoreGive(self->out_lock);
+}
+
+
+/* Acknowledgements of pipelined messages are not matched by the WolfMQTT library
+ * as it expects a single message to be published at a time. The last packet received
+ * is still in the RX buffer, check if it is a PUBACK and find the acknowledged message
+ * in the queue. Acknowledgements may arrive in any order. */
+static void out_process_puback(Mqtt *self) {
+	if (MQTT_PACKET_TYPE_GET(self->mqtt_rx_buf[0]) != MQTT_PACKET_TYPE_PUBLISH_ACK) {
+		return;
+	}
+
+	MqttPublishResp resp;
+	memset(&resp, 0, sizeof(MqttPublishResp));
+	int rc = MqttDecode_PublishResp(self->mqtt_rx_buf, MQTT_RX_BUFFER_SIZE, MQTT_PACKET_TYPE_PUBLISH_ACK, &resp);
+	/* Do not process the same packet twice. */
+	self->mqtt_rx_buf[0] = 0;
+	if (rc <= 0) {
+		return;
+	}
+
+	xSemaphoreTake(self->out_lock, portMAX_DELAY);
+	for (size_t i = 0; i < MQTT_OUT_QUEUE_LEN; i++) {
+		if (self->out[i].state == MQTT_OUT_IN_FLIGHT && self->out[i].packet_id == resp.packet_id) {
+			out_complete(self, &(self->out[i]), MQTT_RET_OK);
+			break;
+		}
+	}
+	xSemaphoreGive(self->out_lock);
+}
+
+
+/* Write the whole packet, retry a few times if the socket is busy. */
+static int write_packet(Mqtt *self, uint8_t *buf, int len) {
+	uint32_t count = 0;
+	int rc = 0;
+	while ((rc = MqttPacket_Write(&self->mqtt_client, buf, len)) == MQTT_CODE_CONTINUE) {
+		count++;
+		if (count >= 5) {
+			break;
+		}
+		vTaskDelay(10);
+	}
+	if (rc == len) {
+		return MQTT_CODE_SUCCESS;
+	}
+	if (rc >= 0) {
+		return MQTT_CODE_ERROR_NETWORK;
+	}
+	return rc;
+}
+
+
+/* Publish a queued message without waiting for the acknowledgement. QoS 0 messages
+ * are released immediately, QoS 1 messages are moved to the in-flight window. */
+static int out_publish(Mqtt *self, struct mqtt_out_message *m) {
+	if (m->publish->qos > MQTT_QOS_0 && m->packet_id == 0) {
+		m->packet_id = get_packet_id(self);
+	}
+
+	MqttPublish msg;
+	memset(&msg, 0, sizeof(MqttPublish));
+	msg.retain = 0;
+	msg.qos = m->publish->qos;
+	msg.duplicate = m->duplicate;
+	msg.topic_name = m->topic_name;
+	msg.packet_id = m->packet_id;
+	msg.buffer = (byte *)m->buffer;
+	msg.total_len = m->data_len;
+
+	int len = MqttEncode_Publish(self->mqtt_tx_buf, MQTT_TX_BUFFER_SIZE, &msg);
+	if (len <= 0) {
+		return len;
+	}
+	int rc = write_packet(self, self->mqtt_tx_buf, len);
+
+	/* The payload which does not fit in the TX buffer is written in chunks. */
+	while (rc == MQTT_CODE_SUCCESS && msg.buffer_pos < msg.total_len) {
+		size_t chunk = msg.total_len - msg.buffer_pos;
+		if (chunk > MQTT_TX_BUFFER_SIZE) {
+			chunk = MQTT_TX_BUFFER_SIZE;
+		}
+		memcpy(self->mqtt_tx_buf, &msg.buffer[msg.buffer_pos], chunk);
+		rc = write_packet(self, self->mqtt_tx_buf, chunk);
+		msg.buffer_pos += chunk;
+	}
+	if (rc != MQTT_CODE_SUCCESS) {
+		return rc;
+	}
+
+	xSemaphoreTake(self->out_lock, portMAX_DELAY);
+	if (msg.qos == MQTT_QOS_0) {
+		out_complete(self, m, MQTT_RET_OK);
+	} else {
+		m->state = MQTT_OUT_IN_FLIGHT;
+		m->sent_time = xTaskGetTickCount();
+		self->out_in_flight++;
+	}
+	xSemaphoreGive(self->out_lock);
+
+	return MQTT_CODE_SUCCESS;
+}
+
+
 /* Callback functions for the WolfMQTT library (MqttNet) follow. */
 
 static int net_connect(void *context, const char *host, word16 port, int timeout_ms) {
@@ -196,40 +418,55 @@ static int net_disconnect(void *context) {
 }
 
 
+static void deliver_message(QueueSubscribe *q, MqttMessage *message) {
+	if (message->total_len <= q->buffer_size) {
+		memcpy(q->buffer, message->buffer, message->total_len);
+		*(q->data_len) = message->total_len;
+
+		size_t len = message->topic_name_len;
+		if (len >= sizeof(q->msg_topic)) {
+			len = sizeof(q->msg_topic) - 1;
+		}
+		memcpy(q->msg_topic, message->topic_name, len);
+		q->msg_topic[len] = '\0';
+
+		q->ret = MQTT_RET_OK;
+	} else {
+		q->ret = MQTT_RET_FAILED;
+	}
+	xSemaphoreGive(q->msg_wait_lock);
+}
+
+
 static int mqtt_msg(MqttClient *client, MqttMessage *message, byte msg_new, byte msg_done) {
 	Mqtt *self = (Mqtt *)client->ctx;
 	(void)msg_new;
 	(void)msg_done;
 
-	/** @todo do not convert the topic to  null terminated string, use memcmp instead if strcmp */
-	char topic[64];
-	size_t len = message->topic_name_len;
-	if (len >= sizeof(topic)) {
-		len = sizeof(topic) - 1;
-	}
-	memcpy(topic, message->topic_name, len);
-	topic[len] = '\0';
+	const char *topic = message->topic_name;
+	size_t topic_len = message->topic_name_len;
 
-	/* Iterate over all subscriptions and try to match the topic. */
-	/** @todo more advanced topic matching */
-	QueueSubscribe *q = self->subscribes;
+	/* Only subscriptions with the same first level and subscriptions starting with
+	 * a wildcard can match. Topics starting with '$' are not matched by wildcards. */
+	QueueSubscribe *q = self->subscribe_index[topic_level_hash(topic, topic_len) % MQTT_SUBSCRIBE_INDEX_SIZE];
 	while (q != NULL) {
-		if (match_topic(q->topic_name, topic)) {
-			if (message->total_len <= q->buffer_size) {
-				memcpy(q->buffer, message->buffer, message->total_len);
-				*(q->data_len) = message->total_len;
-				strcpy(q->msg_topic, topic);
-				q->ret = MQTT_RET_OK;
-			} else {
-				q->ret = MQTT_RET_FAILED;
+		if (match_topic(q->topic_name, topic, topic_len)) {
+			deliver_message(q, message);
+		}
+		q = q->index_next;
+	}
+	if (topic_len == 0 || topic[0] != '$') {
+		q = self->subscribe_wildcard;
+		while (q != NULL) {
+			if (match_topic(q->topic_name, topic, topic_len)) {
+				deliver_message(q, message);
 			}
-			xSemaphoreGive(q->msg_wait_lock);
+			q = q->index_next;
 		}
-		q = q->next;
 	}
 
 	if (self->debug) {
-		u_log(system_log, LOG_TYPE_DEBUG, U_LOG_MODULE_PREFIX("message received topic='%s', len=%u"), topic, message->total_len);
+		u_log(system_log, LOG_TYPE_DEBUG, U_LOG_MODULE_PREFIX("message received topic='%.*s', len=%u"), (int)topic_len, topic, message->total_len);
 	}
 
 	return MQTT_CODE_SUCCESS;
@@ -320,6 +557,9 @@ static mqtt_ret_t mqtt_step(Mqtt *self) {
 				}
 				self->new_subscription = true;
 
+				/* Messages not acknowledged before the connection was lost are published again. */
+				out_requeue(self);
+
 				self->state = MQTT_STATE_CONNECTED;
 			} else {
 				/* If there is a protocol error while trying to connect, disconnect the socket and
@@ -331,26 +571,47 @@ static mqtt_ret_t mqtt_step(Mqtt *self) {
 		}
 
 		case MQTT_STATE_SUBSCRIBE: {
+			/* Collect as many pending subscriptions as fit in a single SUBSCRIBE packet.
+			 * The packet contains a fixed header (3 bytes at most for the TX buffer size),
+			 * the packet ID and a length prefixed topic filter with a QoS byte for each topic. */
+			MqttTopic topics_to_subscribe[MQTT_SUBSCRIBE_BATCH_MAX];
+			QueueSubscribe *batch[MQTT_SUBSCRIBE_BATCH_MAX];
+			memset(topics_to_subscribe, 0, sizeof(topics_to_subscribe));
+			size_t topic_count = 0;
+			size_t packet_len = 3 + 2;
 
 			QueueSubscribe *q = self->subscribes;
-			while (q != NULL && q->subscribed == true) {
+			while (q != NULL && topic_count < MQTT_SUBSCRIBE_BATCH_MAX) {
+				if (q->subscribed == false) {
+					size_t len = 2 + strlen(q->topic_name) + 1;
+					if (packet_len + len > MQTT_TX_BUFFER_SIZE) {
+						if (topic_count > 0) {
+							/* Leave it for the next packet. */
+							break;
+						}
+						/* Never fits, do not try again. */
+						u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("topic name='%s' too long, cannot subscribe"), q->topic_name);
+						q->subscribed = true;
+					} else {
+						topics_to_subscribe[topic_count].qos = q->qos;
+						topics_to_subscribe[topic_count].topic_filter = q->topic_name;
+						batch[topic_count] = q;
+						topic_count++;
+						packet_len += len;
+					}
+				}
 				q = q->next;
 			}
-			if (q == NULL || q->subscribed == true) {
+			if (topic_count == 0) {
 				/* No new subscriptions found. */
 				self->new_subscription = false;
 				self->state = MQTT_STATE_CONNECTED;
 				break;
 			}
 
-			MqttTopic topics_to_subscribe[1];
-			memset(topics_to_subscribe, 0, sizeof(topics_to_subscribe));
-			topics_to_subscribe[0].qos = q->qos;
-			topics_to_subscribe[0].topic_filter = q->topic_name;
-
 			MqttSubscribe sub;
 			memset(&sub, 0, sizeof(sub));
-			sub.topic_count = 1;
+			sub.topic_count = topic_count;
 			sub.topics = topics_to_subscribe;
 			sub.packet_id = get_packet_id(self);
 
@@ -368,12 +629,19 @@ static mqtt_ret_t mqtt_step(Mqtt *self) {
 				vTaskDelay(500);
 			}
 			if (rc == MQTT_CODE_SUCCESS) {
-				u_log(system_log, LOG_TYPE_INFO, U_LOG_MODULE_PREFIX("subscribed to a topic name='%s', qos=%d"), sub.topics[0].topic_filter, sub.topics[0].qos);
-				q->subscribed = true;
+				for (size_t i = 0; i < topic_count; i++) {
+					if (sub.topics[i].return_code == MQTT_SUBSCRIBE_ACK_CODE_FAILURE) {
+						/* Rejected by the broker, do not try again until reconnect. */
+						u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("subscription to a topic name='%s' rejected"), sub.topics[i].topic_filter);
+					} else {
+						u_log(system_log, LOG_TYPE_INFO, U_LOG_MODULE_PREFIX("subscribed to a topic name='%s', qos=%d"), sub.topics[i].topic_filter, sub.topics[i].qos);
+					}
+					batch[i]->subscribed = true;
+				}
 				self->state = MQTT_STATE_CONNECTED;
 			} else {
-				/* We were not able to subscribe to a topic. Try again. */
-				u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("cannot subscribe to a topic name='%s', qos=%d, '%s'"), sub.topics[0].topic_filter, sub.topics[0].qos, MqttClient_ReturnCodeToString(rc));
+				/* We were not able to subscribe. Try again. */
+				u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("cannot subscribe to %u topics, '%s'"), (unsigned int)topic_count, MqttClient_ReturnCodeToString(rc));
 				vTaskDelay(1000);
 			}
 			break;
@@ -383,32 +651,34 @@ static mqtt_ret_t mqtt_step(Mqtt *self) {
 		case MQTT_STATE_CONNECTED: {
 			clear_reconnect_timeout(self);
 
-			/* Check if a MQTT Ping needs to be sent. */
-			if (self->time_from_last_ping_ms >= self->ping_interval_ms) {
-				self->state = MQTT_STATE_PING;
+			/* If the broker does not acknowledge published messages, reconnect. */
+			if (out_puback_timeout(self)) {
+				u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("publish acknowledgement timeout, disconnecting"));
+				self->state = MQTT_STATE_DISCONNECT;
 				break;
 			}
 
-			/* If there is a newly added subscription, process it. */
-			if (self->new_subscription) {
-				self->state = MQTT_STATE_SUBSCRIBE;
+			/* Ping and subscribe wait for their own response and drop any other packet
+			 * received in the meantime. Stop publishing and wait until all acknowledgements
+			 * of messages in flight are received first. */
+			bool ping = self->time_from_last_ping_ms >= self->ping_interval_ms;
+			if ((ping || self->new_subscription) && self->out_in_flight == 0) {
+				self->state = ping ? MQTT_STATE_PING : MQTT_STATE_SUBSCRIBE;
 				break;
 			}
 
-			/* If a new message has to be published, publish it. */
-			QueuePublish *q = self->publishes;
-			while (q != NULL) {
-				if (q->new_message) {
-					self->state = MQTT_STATE_PUBLISH;
-					break;
-				}
-				q = q->next;
+			/* If a new message has to be published and the window is not full, publish it. */
+			if (!ping && !self->new_subscription && out_can_publish(self)) {
+				self->state = MQTT_STATE_PUBLISH;
+				break;
 			}
 
-			/* Otherwise wait for a message. */
+			/* Otherwise wait for a message or an acknowledgement. */
 			int rc = MqttClient_WaitMessage(&self->mqtt_client, 100);
 			self->time_from_last_ping_ms += 100;
-			if (rc == MQTT_CODE_CONTINUE) {
+			if (rc == MQTT_CODE_SUCCESS) {
+				out_process_puback(self);
+			} else if (rc == MQTT_CODE_CONTINUE) {
 				break;
 			} else if (rc == MQTT_CODE_ERROR_NETWORK) {
 				self->state = MQTT_STATE_DISCONNECT;
@@ -444,51 +714,23 @@ static mqtt_ret_t mqtt_step(Mqtt *self) {
 		}
 
 		case MQTT_STATE_PUBLISH: {
-			/* Find the first message ready to be sent. */
-			QueuePublish *q = self->publishes;
-			while (q != NULL) {
-				if (q->new_message) {
-					break;
-				}
-				q = q->next;
-			}
-			if (q == NULL) {
-				/* We did not find any message to send. */
-				self->state = MQTT_STATE_CONNECTED;
-				break;
-			}
-
-			MqttPublish msg;
-			memset(&msg, 0, sizeof(MqttPublish));
-			msg.retain = 0;
-			msg.qos = q->qos;
-			msg.duplicate = 0;
-			msg.topic_name = q->topic_name;
-			msg.packet_id = get_packet_id(self);
-			msg.buffer = q->buffer;
-			msg.total_len = q->data_len;
-
-			uint32_t count = 0;
-			int rc = 0;
-			while ((rc = MqttClient_Publish(&self->mqtt_client, &msg)) == MQTT_CODE_CONTINUE) {
-				count++;
-				if (count >= 5) {
+			/* Publish queued messages until the in-flight window is full. */
+			struct mqtt_out_message *m = NULL;
+			while (self->out_in_flight < self->publish_window && (m = out_next_queued(self)) != NULL) {
+				/* QoS 0 messages are released after publishing, do not touch them afterwards. */
+				QueuePublish *q = m->publish;
+				int rc = out_publish(self, m);
+				if (rc != MQTT_CODE_SUCCESS) {
+					/* The message stays queued and it is published again after reconnect. */
+					u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("cannot publish message to name='%s', qos=%d, '%s'"), m->topic_name, q->qos, MqttClient_ReturnCodeToString(rc));
+					self->state = MQTT_STATE_DISCONNECT;
 					break;
 				}
-				vTaskDelay(500);
-			}
-			if (rc == MQTT_CODE_SUCCESS) {
 				if (self->debug) {
-					u_log(system_log, LOG_TYPE_DEBUG, U_LOG_MODULE_PREFIX("published to topic name='%s', qos=%d"), msg.topic_name, msg.qos);
+					u_log(system_log, LOG_TYPE_DEBUG, U_LOG_MODULE_PREFIX("published to topic name='%s', qos=%d"), q->topic_name, q->qos);
 				}
-				q->new_message = false;
-				q->ret = MQTT_RET_OK;
-				xSemaphoreGive(q->msg_sent_lock);
-				self->state = MQTT_STATE_CONNECTED;
-			} else {
-				u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("cannot publish message to name='%s', qos=%d, '%s'"), msg.topic_name, msg.qos, MqttClient_ReturnCodeToString(rc));
-				q->ret = MQTT_RET_FAILED;
-				xSemaphoreGive(q->msg_sent_lock);
+			}
+			if (self->state == MQTT_STATE_PUBLISH) {
 				self->state = MQTT_STATE_CONNECTED;
 			}
 			break;
@@ -539,8 +781,16 @@ mqtt_ret_t mqtt_init(Mqtt *self, ITcpIp *tcpip) {
 	clear_reconnect_timeout(self);
 	self->ping_interval_ms = 60000;
 	self->debug = false;
+	self->publish_window = MQTT_PUBLISH_WINDOW_DEFAULT;
 	self->state = MQTT_STATE_INIT;
 
+	self->out_lock = xSemaphoreCreateMutex();
+	self->out_free = xSemaphoreCreateCounting(MQTT_OUT_QUEUE_LEN, MQTT_OUT_QUEUE_LEN);
+	if (self->out_lock == NULL || self->out_free == NULL) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("cannot create the outgoing queue"));
+		return MQTT_RET_FAILED;
+	}
+
 	self->can_run = true;
 	xTaskCreate(mqtt_task, "mqtt", configMINIMAL_STACK_SIZE + 384, (void *)self, 1, &(self->task));
 	if (self->task == NULL) {
@@ -613,6 +863,21 @@ mqtt_ret_t mqtt_set_ping_interval(Mqtt *self, uint32_t ping_interval_ms) {
 }
 
 
+mqtt_ret_t mqtt_set_publish_window(Mqtt *self, uint32_t window) {
+	if (u_assert(self != NULL) ||
+	    u_assert(window > 0)) {
+		return MQTT_RET_FAILED;
+	}
+
+	if (window > MQTT_OUT_QUEUE_LEN) {
+		window = MQTT_OUT_QUEUE_LEN;
+	}
+	self->publish_window = window;
+
+	return MQTT_RET_OK;
+}
+
+
 mqtt_ret_t mqtt_add_subscribe(Mqtt *self, QueueSubscribe *subscribe) {
 	if (u_assert(self != NULL) ||
 	    u_assert(subscribe != NULL)) {
@@ -623,6 +888,17 @@ mqtt_ret_t mqtt_add_subscribe(Mqtt *self, QueueSubscribe *subscribe) {
 	subscribe->parent = self;
 	subscribe->subscribed = false;
 	self->subscribes = subscribe;
+
+	/* Add the subscription to the index used to match received messages. */
+	const char *filter = subscribe->topic_name;
+	if (filter[0] == '+' || filter[0] == '#') {
+		subscribe->index_next = self->subscribe_wildcard;
+		self->subscribe_wildcard = subscribe;
+	} else {
+		uint32_t i = topic_level_hash(filter, strlen(filter)) % MQTT_SUBSCRIBE_INDEX_SIZE;
+		subscribe->index_next = self->subscribe_index[i];
+		self->subscribe_index[i] = subscribe;
+	}
 	self->new_subscription = true;
 
 	return MQTT_RET_OK;
@@ -670,7 +946,6 @@ mqtt_ret_t mqtt_add_publish(Mqtt *self, QueuePublish *publish) {
 
 	publish->next = self->publishes;
 	publish->parent = self;
-	publish->new_message = false;
 	self->publishes = publish;
 
 	return MQTT_RET_OK;
@@ -697,15 +972,62 @@ mqtt_ret_t queue_publish_init(QueuePublish *self, const char *topic_name, int qo
 
 mqtt_ret_t queue_publish_send_message(QueuePublish *self, uint8_t *buffer, size_t data_len) {
 	if (u_assert(self != NULL) ||
+	    u_assert(self->parent != NULL) ||
 	    u_assert(buffer != NULL)) {
 		return MQTT_RET_FAILED;
 	}
+	Mqtt *mqtt = self->parent;
 
-	self->buffer = buffer;
-	self->data_len = data_len;
-	self->new_message = true;
+	struct mqtt_out_message *m = out_alloc(mqtt, portMAX_DELAY);
+	if (m == NULL) {
+		return MQTT_RET_FAILED;
+	}
+
+	/* The caller waits until the message is acknowledged, the buffer can be used
+	 * directly without copying. */
+	m->publish = self;
+	m->buffer = buffer;
+	m->data_len = data_len;
+	m->topic_name = self->topic_name;
+	m->notify = true;
+
+	xSemaphoreTake(mqtt->out_lock, portMAX_DELAY);
+	m->state = MQTT_OUT_QUEUED;
+	xSemaphoreGive(mqtt->out_lock);
 
 	xSemaphoreTake(self->msg_sent_lock, portMAX_DELAY);
 	return self->ret;
+}
+
 
+mqtt_ret_t queue_publish_enqueue_message(QueuePublish *self, const uint8_t *buffer, size_t data_len, uint32_t timeout_ms) {
+	if (u_assert(self != NULL) ||
+	    u_assert(self->parent != NULL) ||
+	    u_assert(buffer != NULL)) {
+		return MQTT_RET_FAILED;
+	}
+	Mqtt *mqtt = self->parent;
+
+	size_t topic_len = strlen(self->topic_name);
+	if (data_len > MQTT_OUT_MESSAGE_SIZE || topic_len >= MQTT_OUT_TOPIC_SIZE) {
+		return MQTT_RET_FAILED;
+	}
+
+	struct mqtt_out_message *m = out_alloc(mqtt, pdMS_TO_TICKS(timeout_ms));
+	if (m == NULL) {
+		return MQTT_RET_FAILED;
+	}
+
+	memcpy(m->data, buffer, data_len);
+	memcpy(m->topic, self->topic_name, topic_len + 1);
+	m->publish = self;
+	m->buffer = m->data;
+	m->data_len = data_len;
+	m->topic_name = m->topic;
+
+	xSemaphoreTake(mqtt->out_lock, portMAX_DELAY);
+	m->state = MQTT_OUT_QUEUED;
+	xSemaphoreGive(mqtt->out_lock);
+
+	return MQTT_RET_OK;
 }
@@ -38,6 +38,31 @@
 #define MQTT_RECONNECT_TIMEOUT_MAX_MS 30000
 #define MQTT_STATE_TIMEOUT 100
 
+/* Outgoing message queue. Messages waiting to be published and messages published
+ * with QoS 1 waiting for the acknowledgement are kept in the queue. It is not cleared
+ * on reconnect, unacknowledged messages are published again. */
+#define MQTT_OUT_QUEUE_LEN 8
+#define MQTT_OUT_MESSAGE_SIZE 96
+/* Queued messages keep a copy of the topic name, the publisher may change it
+ * before the message is published. */
+#define MQTT_OUT_TOPIC_SIZE 64
+
+/* Default number of QoS 1 messages published without waiting for their acknowledgement.
+ * It can be changed up to MQTT_OUT_QUEUE_LEN using mqtt_set_publish_window(). */
+#define MQTT_PUBLISH_WINDOW_DEFAULT 4
+
+/* If a published message is not acknowledged within this time, the connection is
+ * considered broken and it is reconnected. */
+#define MQTT_PUBACK_TIMEOUT_MS 10000
+
+/* Pending subscriptions are sent in a single SUBSCRIBE packet as long as they fit
+ * in the TX buffer. WolfMQTT decodes a limited number of SUBACK return codes. */
+#define MQTT_SUBSCRIBE_BATCH_MAX 8
+
+/* Subscriptions are indexed by a hash of the first topic filter level. Only a single
+ * bucket and subscriptions starting with a wildcard are tried for a received message. */
+#define MQTT_SUBSCRIBE_INDEX_SIZE 16
+
 
 struct mqtt;
 
@@ -103,8 +128,9 @@ enum mqtt_state {
 	MQTT_STATE_PING,
 
 	/**
-	 * A new message arrived and needs to be published. Iterate over all publish
-	 * structures and find the first one. Pop it and publish to the broker. Return to
+	 * New messages were queued and the in-flight window is not full. Publish queued
+	 * messages in the order they were queued until the window is full. Acknowledgements
+	 * are received in the CONNECTED state, possibly out of order. Return to
 	 * the CONNECTED state as soon as possible.
 	 */
 	MQTT_STATE_PUBLISH,
@@ -121,27 +147,55 @@ typedef struct queue_subscribe {
 	uint8_t *buffer;
 	size_t buffer_size;
 	size_t *data_len;
+	/* Topic of the last received message, truncated if it is longer. */
 	char msg_topic[64];
 	mqtt_ret_t ret;
 
 	struct queue_subscribe *next;
+	struct queue_subscribe *index_next;
 } QueueSubscribe;
 
 
 typedef struct queue_publish {
 	const char *topic_name;
 	int qos;
-	volatile bool new_message;
 	struct mqtt *parent;
 	SemaphoreHandle_t msg_sent_lock;
-	uint8_t *buffer;
-	size_t data_len;
 	mqtt_ret_t ret;
 
 	struct queue_publish *next;
 } QueuePublish;
 
 
+enum mqtt_out_state {
+	MQTT_OUT_FREE = 0,
+	MQTT_OUT_QUEUED,
+	MQTT_OUT_IN_FLIGHT,
+};
+
+struct mqtt_out_message {
+	enum mqtt_out_state state;
+	QueuePublish *publish;
+
+	/* Points to the data array or to the caller buffer if the caller is waiting
+	 * for the message to be acknowledged. */
+	const uint8_t *buffer;
+	size_t data_len;
+	uint8_t data[MQTT_OUT_MESSAGE_SIZE];
+
+	/* Points to the topic array or to the topic name of the publish instance. */
+	const char *topic_name;
+	char topic[MQTT_OUT_TOPIC_SIZE];
+
+	/* Messages are published in the order they were queued. */
+	uint32_t seq;
+	uint16_t packet_id;
+	bool duplicate;
+	bool notify;
+	TickType_t sent_time;
+};
+
+
 typedef struct mqtt {
 	Module module;
 
@@ -172,9 +226,19 @@ typedef struct mqtt {
 
 	/* Message subscriptions and messages to publish. */
 	QueueSubscribe *subscribes;
+	QueueSubscribe *subscribe_index[MQTT_SUBSCRIBE_INDEX_SIZE];
+	QueueSubscribe *subscribe_wildcard;
 	bool new_subscription;
 	QueuePublish *publishes;
 
+	/* Outgoing message queue and the QoS 1 in-flight window. */
+	struct mqtt_out_message out[MQTT_OUT_QUEUE_LEN];
+	SemaphoreHandle_t out_lock;
+	SemaphoreHandle_t out_free;
+	uint32_t out_seq;
+	uint32_t out_in_flight;
+	uint32_t publish_window;
+
 	/* Configuration values/switches. */
 	bool debug;
 	uint32_t ping_interval_ms;
@@ -186,6 +250,7 @@ mqtt_ret_t mqtt_free(Mqtt *self);
 mqtt_ret_t mqtt_connect(Mqtt *self, const char *address, uint16_t port);
 mqtt_ret_t mqtt_set_client_id(Mqtt *self, const char *client_id);
 mqtt_ret_t mqtt_set_ping_interval(Mqtt *self, uint32_t ping_interval_ms);
+mqtt_ret_t mqtt_set_publish_window(Mqtt *self, uint32_t window);
 
 mqtt_ret_t mqtt_add_subscribe(Mqtt *self, QueueSubscribe *subscribe);
 mqtt_ret_t queue_subscribe_init(QueueSubscribe *self, const char *topic_name, int qos);
@@ -193,4 +258,10 @@ mqtt_ret_t queue_subscribe_receive_message(QueueSubscribe *self, uint8_t *buffer
 
 mqtt_ret_t mqtt_add_publish(Mqtt *self, QueuePublish *publish);
 mqtt_ret_t queue_publish_init(QueuePublish *self, const char *topic_name, int qos);
+
+/* Publish a message and wait until it is acknowledged (or sent if QoS 0). */
 mqtt_ret_t queue_publish_send_message(QueuePublish *self, uint8_t *buffer, size_t data_len);
+
+/* Copy a message and the current topic name to the outgoing queue and return without
+ * waiting for the acknowledgement. Wait up to timeout_ms for a free slot in the queue. */
+mqtt_ret_t queue_publish_enqueue_message(QueuePublish *self, const uint8_t *buffer, size_t data_len, uint32_t timeout_ms);
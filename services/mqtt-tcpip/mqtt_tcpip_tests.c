@@ -0,0 +1,814 @@
+/*
+ * MQTT client service tests
+ *
+ * Copyright (C) 2017, Marek Koza, qyx@krtko.org
+ *
+ * This file is part of uMesh node firmware (http://qyx.krtko.org/projects/umesh)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+#include "u_assert.h"
+#include "u_log.h"
+#include "u_test.h"
+
+#include "interfaces/tcpip.h"
+#include "mqtt_tcpip.h"
+#include "mqtt_tcpip_tests.h"
+
+#ifdef MODULE_NAME
+#undef MODULE_NAME
+#endif
+#define MODULE_NAME "mqtt-tests"
+
+
+/**
+ * The MQTT client is connected to a broker stand-in using an in-memory ITcpIp
+ * interface. Data is delivered after half of the round trip time, each socket
+ * send costs a fixed time plus the time to transmit the data at the link bitrate
+ * (like a cellular modem does). The broker acknowledges everything it receives
+ * and records published messages. The message payload starts with a 16 bit
+ * sequence number used to check ordering, duplicates and lost messages.
+ */
+#define MQTT_TEST_CHUNK_SIZE 32
+#define MQTT_TEST_QUEUE_LEN 64
+#define MQTT_TEST_PARSE_BUFFER_SIZE 256
+#define MQTT_TEST_MAX_SEQ 512
+#define MQTT_TEST_SEND_OVERHEAD_MS 20
+#define MQTT_TEST_BITRATE 64000
+#define MQTT_TEST_TOPIC "test/node1/value"
+#define MQTT_TEST_PAYLOAD_LEN 40
+#define MQTT_TEST_TIMEOUT_MS 60000
+
+/* Subscriptions used to check topic matching and other subscriptions filling
+ * SUBSCRIBE packets to check batching. */
+#define MQTT_TEST_MATCH_FILTERS 7
+#define MQTT_TEST_BULK_FILTERS 24
+
+struct mqtt_test_chunk {
+	TickType_t deliver_at;
+	size_t len;
+	uint8_t data[MQTT_TEST_CHUNK_SIZE];
+};
+
+struct mqtt_test_broker {
+	ITcpIp tcpip;
+	ITcpIpSocket socket;
+	Mqtt mqtt;
+	QueuePublish pub;
+	bool started;
+
+	/* Client to broker and broker to client directions. */
+	QueueHandle_t up;
+	QueueHandle_t down;
+	struct mqtt_test_chunk rx_chunk;
+	size_t rx_pos;
+
+	uint32_t rtt_ms;
+	volatile bool connected;
+	volatile bool broken;
+	volatile uint32_t generation;
+
+	QueueSubscribe match[MQTT_TEST_MATCH_FILTERS];
+	uint8_t match_buf[MQTT_TEST_MATCH_FILTERS][8];
+	size_t match_len[MQTT_TEST_MATCH_FILTERS];
+	QueueSubscribe bulk[MQTT_TEST_BULK_FILTERS];
+	char bulk_filter[MQTT_TEST_BULK_FILTERS][32];
+
+	/* Break the connection when the n-th QoS 1 message is received, do not acknowledge it. */
+	uint32_t drop_at;
+
+	uint8_t buf[MQTT_TEST_PARSE_BUFFER_SIZE];
+	size_t buf_len;
+
+	volatile uint32_t connects;
+	volatile uint32_t received;
+	volatile uint32_t duplicates;
+	volatile uint32_t out_of_order;
+	volatile uint32_t pubacks;
+	volatile uint32_t subscribe_packets;
+	int32_t last_seq;
+	uint8_t seen[MQTT_TEST_MAX_SEQ / 8];
+	char topics[2][MQTT_OUT_TOPIC_SIZE];
+};
+
+static struct mqtt_test_broker mqtt_test_broker;
+
+static const char *match_filters[MQTT_TEST_MATCH_FILTERS] = {
+	"test/a/b",
+	"test/+/b",
+	"test/#",
+	"+/a/#",
+	"#",
+	"$SYS/#",
+	"test/a/b/+",
+};
+
+
+static void line_push(QueueHandle_t q, const uint8_t *data, size_t len, uint32_t delay_ms) {
+	TickType_t deliver_at = xTaskGetTickCount() + pdMS_TO_TICKS(delay_ms);
+	while (len > 0) {
+		struct mqtt_test_chunk chunk;
+		chunk.deliver_at = deliver_at;
+		chunk.len = (len > MQTT_TEST_CHUNK_SIZE) ? MQTT_TEST_CHUNK_SIZE : len;
+		memcpy(chunk.data, data, chunk.len);
+		xQueueSend(q, &chunk, portMAX_DELAY);
+		data += chunk.len;
+		len -= chunk.len;
+	}
+}
+
+
+/* Wait until the oldest chunk in the queue can be delivered. */
+static bool line_pop(QueueHandle_t q, struct mqtt_test_chunk *chunk, TickType_t timeout) {
+	if (xQueuePeek(q, chunk, timeout) == pdFALSE) {
+		return false;
+	}
+	int32_t d = (int32_t)(chunk->deliver_at - xTaskGetTickCount());
+	if (d > 0) {
+		vTaskDelay(d);
+	}
+	return xQueueReceive(q, chunk, 0) == pdTRUE;
+}
+
+
+static tcpip_ret_t socket_connect(void *context, const char *address, uint16_t port) {
+	struct mqtt_test_broker *self = (struct mqtt_test_broker *)context;
+	(void)address;
+	(void)port;
+
+	xQueueReset(self->up);
+	xQueueReset(self->down);
+	self->rx_pos = 0;
+	self->rx_chunk.len = 0;
+	self->generation++;
+	vTaskDelay(pdMS_TO_TICKS(self->rtt_ms));
+	self->broken = false;
+	self->connected = true;
+	self->connects++;
+
+	return TCPIP_RET_OK;
+}
+
+
+static tcpip_ret_t socket_disconnect(void *context) {
+	struct mqtt_test_broker *self = (struct mqtt_test_broker *)context;
+	self->connected = false;
+	return TCPIP_RET_OK;
+}
+
+
+static tcpip_ret_t socket_send(void *context, const uint8_t *data, size_t len, size_t *written) {
+	struct mqtt_test_broker *self = (struct mqtt_test_broker *)context;
+	if (!self->connected || self->broken) {
+		return TCPIP_RET_DISCONNECTED;
+	}
+
+	vTaskDelay(pdMS_TO_TICKS(MQTT_TEST_SEND_OVERHEAD_MS + len * 8 * 1000 / MQTT_TEST_BITRATE));
+	line_push(self->up, data, len, self->rtt_ms / 2);
+	*written = len;
+
+	return TCPIP_RET_OK;
+}
+
+
+static tcpip_ret_t socket_receive(void *context, uint8_t *data, size_t len, size_t *read) {
+	struct mqtt_test_broker *self = (struct mqtt_test_broker *)context;
+
+	TickType_t start = xTaskGetTickCount();
+	while (self->rx_pos >= self->rx_chunk.len) {
+		if (!self->connected || self->broken) {
+			return TCPIP_RET_DISCONNECTED;
+		}
+		if ((xTaskGetTickCount() - start) >= pdMS_TO_TICKS(100)) {
+			return TCPIP_RET_NODATA;
+		}
+		if (line_pop(self->down, &self->rx_chunk, pdMS_TO_TICKS(10))) {
+			self->rx_pos = 0;
+		}
+	}
+
+	size_t available = self->rx_chunk.len - self->rx_pos;
+	if (len > available) {
+		len = available;
+	}
+	memcpy(data, &self->rx_chunk.data[self->rx_pos], len);
+	self->rx_pos += len;
+	*read = len;
+
+	return TCPIP_RET_OK;
+}
+
+
+static tcpip_ret_t create_client_socket(void *context, ITcpIpSocket **socket) {
+	struct mqtt_test_broker *self = (struct mqtt_test_broker *)context;
+	*socket = &self->socket;
+	return TCPIP_RET_OK;
+}
+
+
+static void broker_reply(struct mqtt_test_broker *self, const uint8_t *data, size_t len) {
+	line_push(self->down, data, len, self->rtt_ms / 2);
+}
+
+
+static void broker_process_publish(struct mqtt_test_broker *self, uint8_t flags, const uint8_t *v, size_t len) {
+	uint8_t qos = (flags >> 1) & 3;
+	size_t topic_len = (v[0] << 8) | v[1];
+	size_t header_len = 2 + topic_len + (qos ? 2 : 0);
+	if (len < header_len + 2) {
+		return;
+	}
+
+	uint32_t seq = (v[header_len] << 8) | v[header_len + 1];
+	if (seq < MQTT_TEST_MAX_SEQ && (self->seen[seq / 8] & (1 << (seq % 8)))) {
+		self->duplicates++;
+	} else {
+		if (seq < MQTT_TEST_MAX_SEQ) {
+			self->seen[seq / 8] |= 1 << (seq % 8);
+		}
+		if ((int32_t)seq < self->last_seq) {
+			self->out_of_order++;
+		}
+		self->last_seq = seq;
+		if (self->received < 2 && topic_len < MQTT_OUT_TOPIC_SIZE) {
+			memcpy(self->topics[self->received], &v[2], topic_len);
+			self->topics[self->received][topic_len] = '\0';
+		}
+		self->received++;
+	}
+
+	if (qos > 0) {
+		self->pubacks++;
+		if (self->drop_at != 0 && self->pubacks == self->drop_at) {
+			self->broken = true;
+			return;
+		}
+		uint8_t puback[4] = {0x40, 2, v[2 + topic_len], v[3 + topic_len]};
+		broker_reply(self, puback, sizeof(puback));
+	}
+}
+
+
+static void broker_process_subscribe(struct mqtt_test_broker *self, const uint8_t *v, size_t len) {
+	/* Grant the requested QoS for all topic filters. */
+	uint8_t suback[4 + MQTT_SUBSCRIBE_BATCH_MAX] = {0x90, 2, v[0], v[1]};
+	size_t pos = 2;
+	while (pos + 2 < len && suback[1] < 2 + MQTT_SUBSCRIBE_BATCH_MAX) {
+		pos += 2 + ((v[pos] << 8) | v[pos + 1]);
+		suback[2 + suback[1]] = v[pos];
+		suback[1]++;
+		pos++;
+	}
+	broker_reply(self, suback, 2 + suback[1]);
+	self->subscribe_packets++;
+}
+
+
+/* Publish a message to the client with QoS 0. */
+static void broker_publish(struct mqtt_test_broker *self, const char *topic, const uint8_t *data, size_t len) {
+	uint8_t publish[MQTT_RX_BUFFER_SIZE];
+	size_t topic_len = strlen(topic);
+	size_t rem = 2 + topic_len + len;
+	if (u_assert(rem < 128) || u_assert(rem + 2 <= sizeof(publish))) {
+		return;
+	}
+
+	publish[0] = 0x30;
+	publish[1] = rem;
+	publish[2] = topic_len >> 8;
+	publish[3] = topic_len & 0xff;
+	memcpy(&publish[4], topic, topic_len);
+	memcpy(&publish[4 + topic_len], data, len);
+	broker_reply(self, publish, rem + 2);
+}
+
+
+/* Process all complete packets in the buffer. */
+static void broker_process(struct mqtt_test_broker *self) {
+	while (self->buf_len >= 2) {
+		size_t pos = 1;
+		size_t rem = 0;
+		size_t mul = 1;
+		while (pos < self->buf_len && (self->buf[pos] & 0x80)) {
+			rem += (self->buf[pos] & 0x7f) * mul;
+			mul *= 128;
+			pos++;
+		}
+		if (pos >= self->buf_len) {
+			return;
+		}
+		rem += self->buf[pos] * mul;
+		pos++;
+		if (pos + rem > MQTT_TEST_PARSE_BUFFER_SIZE) {
+			/* Cannot be ever processed. */
+			self->buf_len = 0;
+			return;
+		}
+		if (self->buf_len < pos + rem) {
+			return;
+		}
+
+		const uint8_t *v = &self->buf[pos];
+		switch (self->buf[0] >> 4) {
+			case 1: {
+				/* CONNECT */
+				uint8_t connack[4] = {0x20, 2, 0, 0};
+				broker_reply(self, connack, sizeof(connack));
+				break;
+			}
+			case 3:
+				broker_process_publish(self, self->buf[0] & 0x0f, v, rem);
+				break;
+			case 8:
+				broker_process_subscribe(self, v, rem);
+				break;
+			case 12: {
+				/* PINGREQ */
+				uint8_t pingresp[2] = {0xd0, 0};
+				broker_reply(self, pingresp, sizeof(pingresp));
+				break;
+			}
+			default:
+				break;
+		}
+
+		memmove(self->buf, &self->buf[pos + rem], self->buf_len - pos - rem);
+		self->buf_len -= pos + rem;
+	}
+}
+
+
+static void broker_task(void *p) {
+	struct mqtt_test_broker *self = (struct mqtt_test_broker *)p;
+	uint32_t generation = self->generation;
+	struct mqtt_test_chunk chunk;
+
+	while (true) {
+		bool have_chunk = line_pop(self->up, &chunk, pdMS_TO_TICKS(10));
+		if (generation != self->generation) {
+			/* A new connection, drop everything received before. */
+			generation = self->generation;
+			self->buf_len = 0;
+			continue;
+		}
+		if (!have_chunk || self->broken) {
+			continue;
+		}
+		if (self->buf_len + chunk.len <= MQTT_TEST_PARSE_BUFFER_SIZE) {
+			memcpy(&self->buf[self->buf_len], chunk.data, chunk.len);
+			self->buf_len += chunk.len;
+		}
+		broker_process(self);
+	}
+}
+
+
+static void broker_reset(struct mqtt_test_broker *self, uint32_t rtt_ms) {
+	self->rtt_ms = rtt_ms;
+	self->drop_at = 0;
+	self->received = 0;
+	self->duplicates = 0;
+	self->out_of_order = 0;
+	self->pubacks = 0;
+	self->subscribe_packets = 0;
+	self->connects = 0;
+	self->last_seq = -1;
+	memset(self->seen, 0, sizeof(self->seen));
+	memset(self->topics, 0, sizeof(self->topics));
+}
+
+
+static bool broker_received_all(struct mqtt_test_broker *self, uint32_t count) {
+	for (uint32_t i = 0; i < count; i++) {
+		if ((self->seen[i / 8] & (1 << (i % 8))) == 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+/* Wait until all messages are received by the broker and acknowledged. */
+static bool wait_idle(struct mqtt_test_broker *self, uint32_t count) {
+	TickType_t start = xTaskGetTickCount();
+	while ((xTaskGetTickCount() - start) < pdMS_TO_TICKS(MQTT_TEST_TIMEOUT_MS)) {
+		if (broker_received_all(self, count) &&
+		    self->mqtt.out_in_flight == 0 &&
+		    uxSemaphoreGetCount(self->mqtt.out_free) == MQTT_OUT_QUEUE_LEN) {
+			return true;
+		}
+		vTaskDelay(pdMS_TO_TICKS(10));
+	}
+	return false;
+}
+
+
+static bool all_subscribed(struct mqtt_test_broker *self) {
+	QueueSubscribe *q = self->mqtt.subscribes;
+	while (q != NULL) {
+		if (!q->subscribed) {
+			return false;
+		}
+		q = q->next;
+	}
+	return true;
+}
+
+
+/* Break the connection and return the time until all topics are subscribed again. */
+static bool resubscribe(struct mqtt_test_broker *self, uint32_t *time_ms) {
+	self->broken = true;
+	TickType_t start = xTaskGetTickCount();
+	while ((xTaskGetTickCount() - start) < pdMS_TO_TICKS(MQTT_TEST_TIMEOUT_MS)) {
+		if (self->connects > 0 && self->mqtt.state == MQTT_STATE_CONNECTED && all_subscribed(self)) {
+			*time_ms = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+			return true;
+		}
+		vTaskDelay(pdMS_TO_TICKS(10));
+	}
+	return false;
+}
+
+
+static bool wait_connected(struct mqtt_test_broker *self) {
+	TickType_t start = xTaskGetTickCount();
+	while (self->mqtt.state != MQTT_STATE_CONNECTED) {
+		if ((xTaskGetTickCount() - start) >= pdMS_TO_TICKS(MQTT_TEST_TIMEOUT_MS)) {
+			return false;
+		}
+		vTaskDelay(pdMS_TO_TICKS(10));
+	}
+	return true;
+}
+
+
+/* Start the client and the broker stand-in once, they are shared by all tests. */
+static bool broker_start(struct mqtt_test_broker *self) {
+	if (self->started) {
+		return wait_connected(self);
+	}
+
+	memset(self, 0, sizeof(struct mqtt_test_broker));
+	broker_reset(self, 100);
+	self->up = xQueueCreate(MQTT_TEST_QUEUE_LEN, sizeof(struct mqtt_test_chunk));
+	self->down = xQueueCreate(MQTT_TEST_QUEUE_LEN, sizeof(struct mqtt_test_chunk));
+	if (self->up == NULL || self->down == NULL) {
+		return false;
+	}
+
+	tcpip_init(&self->tcpip);
+	self->tcpip.vmt.create_client_socket = create_client_socket;
+	self->tcpip.vmt.context = (void *)self;
+	tcpip_socket_init(&self->socket);
+	self->socket.vmt.connect = socket_connect;
+	self->socket.vmt.disconnect = socket_disconnect;
+	self->socket.vmt.send = socket_send;
+	self->socket.vmt.receive = socket_receive;
+	self->socket.vmt.context = (void *)self;
+
+	TaskHandle_t task = NULL;
+	xTaskCreate(broker_task, "mqtt-broker", configMINIMAL_STACK_SIZE + 256, (void *)self, 1, &task);
+	if (task == NULL) {
+		return false;
+	}
+
+	if (mqtt_init(&self->mqtt, &self->tcpip) != MQTT_RET_OK) {
+		return false;
+	}
+	for (size_t i = 0; i < MQTT_TEST_MATCH_FILTERS; i++) {
+		queue_subscribe_init(&self->match[i], match_filters[i], 0);
+		/* Messages are checked without waiting in queue_subscribe_receive_message. */
+		self->match[i].buffer = self->match_buf[i];
+		self->match[i].buffer_size = sizeof(self->match_buf[i]);
+		self->match[i].data_len = &self->match_len[i];
+		mqtt_add_subscribe(&self->mqtt, &self->match[i]);
+	}
+	for (size_t i = 0; i < MQTT_TEST_BULK_FILTERS; i++) {
+		snprintf(self->bulk_filter[i], sizeof(self->bulk_filter[i]), "bulk/node1/sensor%u/cmd/#", (unsigned int)i);
+		queue_subscribe_init(&self->bulk[i], self->bulk_filter[i], 1);
+		mqtt_add_subscribe(&self->mqtt, &self->bulk[i]);
+	}
+	queue_publish_init(&self->pub, MQTT_TEST_TOPIC, 1);
+	mqtt_add_publish(&self->mqtt, &self->pub);
+	mqtt_connect(&self->mqtt, "broker", 1883);
+	self->started = true;
+
+	if (!wait_connected(self)) {
+		return false;
+	}
+	TickType_t start = xTaskGetTickCount();
+	while (!all_subscribed(self)) {
+		if ((xTaskGetTickCount() - start) >= pdMS_TO_TICKS(MQTT_TEST_TIMEOUT_MS)) {
+			return false;
+		}
+		vTaskDelay(pdMS_TO_TICKS(10));
+	}
+
+	return true;
+}
+
+
+static void make_message(uint8_t *msg, uint32_t seq) {
+	memset(msg, 0, MQTT_TEST_PAYLOAD_LEN);
+	msg[0] = seq >> 8;
+	msg[1] = seq & 0xff;
+}
+
+
+/**
+ * Test if messages published with queue_publish_send_message are acknowledged
+ * and received by the broker.
+ */
+static bool mqtt_tcpip_test_send_message_if_ok(void) {
+	struct mqtt_test_broker *self = &mqtt_test_broker;
+	if (!broker_start(self)) {
+		return false;
+	}
+	broker_reset(self, 100);
+
+	for (uint32_t i = 0; i < 5; i++) {
+		uint8_t msg[MQTT_TEST_PAYLOAD_LEN];
+		make_message(msg, i);
+		if (queue_publish_send_message(&self->pub, msg, sizeof(msg)) != MQTT_RET_OK) {
+			return false;
+		}
+	}
+
+	return wait_idle(self, 5) && self->received == 5 && self->duplicates == 0;
+}
+
+
+/**
+ * Test if enqueued messages are published in the order they were queued
+ * without duplicates, the window being smaller than the queue.
+ */
+static bool mqtt_tcpip_test_enqueue_if_in_order(void) {
+	struct mqtt_test_broker *self = &mqtt_test_broker;
+	if (!broker_start(self)) {
+		return false;
+	}
+	broker_reset(self, 100);
+	mqtt_set_publish_window(&self->mqtt, 4);
+
+	for (uint32_t i = 0; i < 50; i++) {
+		uint8_t msg[MQTT_TEST_PAYLOAD_LEN];
+		make_message(msg, i);
+		if (queue_publish_enqueue_message(&self->pub, msg, sizeof(msg), MQTT_TEST_TIMEOUT_MS) != MQTT_RET_OK) {
+			return false;
+		}
+	}
+
+	return wait_idle(self, 50) &&
+		self->received == 50 &&
+		self->duplicates == 0 &&
+		self->out_of_order == 0;
+}
+
+
+/**
+ * Test if the message and the topic are copied when enqueued, the publisher
+ * is free to change both before the message is published.
+ */
+static bool mqtt_tcpip_test_enqueue_if_topic_copied(void) {
+	struct mqtt_test_broker *self = &mqtt_test_broker;
+	if (!broker_start(self)) {
+		return false;
+	}
+	broker_reset(self, 100);
+
+	uint8_t msg[MQTT_TEST_PAYLOAD_LEN];
+	char topic[MQTT_OUT_TOPIC_SIZE];
+	for (uint32_t i = 0; i < 2; i++) {
+		make_message(msg, i);
+		strcpy(topic, i ? "test/node1/b" : "test/node1/a");
+		self->pub.topic_name = topic;
+		queue_publish_enqueue_message(&self->pub, msg, sizeof(msg), MQTT_TEST_TIMEOUT_MS);
+	}
+	/* Overwrite both before they are published. */
+	memset(msg, 0xff, sizeof(msg));
+	strcpy(topic, "test/node1/c");
+	bool ret = wait_idle(self, 2);
+	self->pub.topic_name = MQTT_TEST_TOPIC;
+
+	return ret &&
+		self->received == 2 &&
+		!strcmp(self->topics[0], "test/node1/a") &&
+		!strcmp(self->topics[1], "test/node1/b");
+}
+
+
+/**
+ * Test if messages unacknowledged when the connection breaks are published
+ * again after reconnect and no message is lost.
+ */
+static bool mqtt_tcpip_test_reconnect_if_not_lost(void) {
+	struct mqtt_test_broker *self = &mqtt_test_broker;
+	if (!broker_start(self)) {
+		return false;
+	}
+	broker_reset(self, 100);
+	self->drop_at = 10;
+
+	for (uint32_t i = 0; i < 30; i++) {
+		uint8_t msg[MQTT_TEST_PAYLOAD_LEN];
+		make_message(msg, i);
+		if (queue_publish_enqueue_message(&self->pub, msg, sizeof(msg), MQTT_TEST_TIMEOUT_MS) != MQTT_RET_OK) {
+			return false;
+		}
+	}
+
+	return wait_idle(self, 30) && self->connects == 1;
+}
+
+
+/**
+ * Test if all topics are subscribed again after reconnect and multiple topic
+ * filters are sent in a single SUBSCRIBE packet.
+ */
+static bool mqtt_tcpip_test_subscribe_if_batched(void) {
+	struct mqtt_test_broker *self = &mqtt_test_broker;
+	if (!broker_start(self)) {
+		return false;
+	}
+	broker_reset(self, 100);
+
+	uint32_t time_ms = 0;
+	if (!resubscribe(self, &time_ms)) {
+		return false;
+	}
+
+	/* At least two filters per packet in average, the TX buffer is the limit here. */
+	return self->connects == 1 &&
+		self->subscribe_packets * 2 <= MQTT_TEST_MATCH_FILTERS + MQTT_TEST_BULK_FILTERS;
+}
+
+
+/* Publish a message and return a bitmask of match filters which received it. */
+static uint32_t matched(struct mqtt_test_broker *self, const char *topic) {
+	for (size_t i = 0; i < MQTT_TEST_MATCH_FILTERS; i++) {
+		xSemaphoreTake(self->match[i].msg_wait_lock, 0);
+	}
+
+	const uint8_t data[4] = {0xde, 0xad, 0xbe, 0xef};
+	broker_publish(self, topic, data, sizeof(data));
+	vTaskDelay(pdMS_TO_TICKS(self->rtt_ms + 300));
+
+	uint32_t mask = 0;
+	for (size_t i = 0; i < MQTT_TEST_MATCH_FILTERS; i++) {
+		if (xSemaphoreTake(self->match[i].msg_wait_lock, 0) == pdTRUE &&
+		    self->match[i].ret == MQTT_RET_OK &&
+		    self->match_len[i] == sizeof(data)) {
+			mask |= 1 << i;
+		}
+	}
+	return mask;
+}
+
+
+/**
+ * Test if received messages are delivered to subscriptions with matching topic
+ * filters only, following the MQTT 3.1.1 wildcard rules.
+ */
+static bool mqtt_tcpip_test_match_if_ok(void) {
+	struct mqtt_test_broker *self = &mqtt_test_broker;
+	if (!broker_start(self)) {
+		return false;
+	}
+	broker_reset(self, 100);
+
+	/* Bits are indices to match_filters. */
+	return matched(self, "test/a/b") == 0x1f &&
+		matched(self, "test/a/b/c") == 0x5c &&
+		matched(self, "test/x/b") == 0x16 &&
+		matched(self, "test/a") == 0x1c &&
+		matched(self, "test") == 0x14 &&
+		matched(self, "other/a") == 0x18 &&
+		matched(self, "test/a/b/c/d") == 0x1c &&
+		matched(self, "$SYS/uptime") == 0x20 &&
+		matched(self, "bulk/node1/sensor1") == 0x10;
+}
+
+
+/**
+ * Test if a topic longer than the msg_topic buffer is matched and truncated safely.
+ */
+static bool mqtt_tcpip_test_match_long_topic_if_truncated(void) {
+	struct mqtt_test_broker *self = &mqtt_test_broker;
+	if (!broker_start(self)) {
+		return false;
+	}
+	broker_reset(self, 100);
+
+	char topic[101];
+	memset(topic, 'x', sizeof(topic) - 1);
+	memcpy(topic, "test/a/b/", 9);
+	topic[sizeof(topic) - 1] = '\0';
+
+	/* "test/a/b/+" matches, the last level is long. */
+	return matched(self, topic) == 0x5c &&
+		strlen(self->match[6].msg_topic) == sizeof(self->match[6].msg_topic) - 1 &&
+		!memcmp(self->match[6].msg_topic, topic, sizeof(self->match[6].msg_topic) - 1);
+}
+
+
+bool mqtt_tcpip_tests(void) {
+	bool res = true;
+
+	res &= u_test(mqtt_tcpip_test_send_message_if_ok());
+	res &= u_test(mqtt_tcpip_test_enqueue_if_in_order());
+	res &= u_test(mqtt_tcpip_test_enqueue_if_topic_copied());
+	res &= u_test(mqtt_tcpip_test_reconnect_if_not_lost());
+	res &= u_test(mqtt_tcpip_test_subscribe_if_batched());
+	res &= u_test(mqtt_tcpip_test_match_if_ok());
+	res &= u_test(mqtt_tcpip_test_match_long_topic_if_truncated());
+
+	return res;
+}
+
+
+/* Publish count messages, return the time it took until all of them were acknowledged. */
+static bool publish_rate(struct mqtt_test_broker *self, uint32_t rtt_ms, uint32_t window, uint32_t count, uint32_t *time_ms) {
+	broker_reset(self, rtt_ms);
+	mqtt_set_publish_window(&self->mqtt, window);
+
+	TickType_t start = xTaskGetTickCount();
+	for (uint32_t i = 0; i < count; i++) {
+		uint8_t msg[MQTT_TEST_PAYLOAD_LEN];
+		make_message(msg, i);
+		if (queue_publish_enqueue_message(&self->pub, msg, sizeof(msg), MQTT_TEST_TIMEOUT_MS) != MQTT_RET_OK) {
+			return false;
+		}
+	}
+	bool ret = wait_idle(self, count);
+	*time_ms = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+
+	return ret && *time_ms > 0 && self->duplicates == 0;
+}
+
+
+bool mqtt_tcpip_tests_throughput(void) {
+	struct mqtt_test_broker *self = &mqtt_test_broker;
+	if (!broker_start(self)) {
+		return false;
+	}
+
+	const uint32_t rtt_ms[] = {100, 300, 600};
+	const uint32_t window[] = {1, 4, 8};
+	const uint32_t count = 40;
+	bool res = true;
+
+	for (size_t i = 0; i < sizeof(rtt_ms) / sizeof(rtt_ms[0]); i++) {
+		for (size_t j = 0; j < sizeof(window) / sizeof(window[0]); j++) {
+			uint32_t time_ms = 0;
+			bool r = publish_rate(self, rtt_ms[i], window[j], count, &time_ms);
+			if (time_ms == 0) {
+				time_ms = 1;
+			}
+			u_log(system_log, r ? LOG_TYPE_INFO : LOG_TYPE_ERROR,
+				U_LOG_MODULE_PREFIX("rtt %u ms, window %u: %u messages in %u ms (%u.%02u msg/s)"),
+				rtt_ms[i], window[j], count, time_ms,
+				count * 1000 / time_ms, (count * 100000 / time_ms) % 100
+			);
+			res &= r;
+		}
+	}
+
+	/* Time from a connection loss until all topics are subscribed again. */
+	for (size_t i = 0; i < sizeof(rtt_ms) / sizeof(rtt_ms[0]); i++) {
+		uint32_t time_ms = 0;
+		broker_reset(self, rtt_ms[i]);
+		bool r = resubscribe(self, &time_ms);
+		u_log(system_log, r ? LOG_TYPE_INFO : LOG_TYPE_ERROR,
+			U_LOG_MODULE_PREFIX("rtt %u ms: %u topics subscribed in %u ms using %u packets"),
+			rtt_ms[i], MQTT_TEST_MATCH_FILTERS + MQTT_TEST_BULK_FILTERS, time_ms, self->subscribe_packets
+		);
+		res &= r;
+	}
+
+	broker_reset(self, 100);
+	mqtt_set_publish_window(&self->mqtt, MQTT_PUBLISH_WINDOW_DEFAULT);
+
+	return res;
+}
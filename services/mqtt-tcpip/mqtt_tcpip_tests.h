@@ -0,0 +1,38 @@
+/*
+ * MQTT client service tests
+ *
+ * Copyright (C) 2017, Marek Koza, qyx@krtko.org
+ *
+ * This file is part of uMesh node firmware (http://qyx.krtko.org/projects/umesh)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * Run the MQTT client against a broker stand-in connected with an in-memory
+ * ITcpIp interface adding a configurable round trip time. Publishing,
+ * reconnecting, subscription batching and topic matching is tested.
+ */
+bool mqtt_tcpip_tests(void);
+
+/**
+ * Publish messages with different in-flight windows and round trip times
+ * and log the message rate. Log the time needed to subscribe all topics
+ * again after reconnect. It takes a bit more than a minute.
+ */
+bool mqtt_tcpip_tests_throughput(void);
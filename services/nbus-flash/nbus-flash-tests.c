@@ -0,0 +1,579 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * NBUS flash access service tests
+ *
+ * Copyright (c) 2024, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include <main.h>
+#include <cbor.h>
+#include "u_test.h"
+
+#include <interfaces/can.h>
+#include <interfaces/flash.h>
+#include <interfaces/servicelocator.h>
+#include <services/nbus/nbus.h>
+#include <blake2.h>
+#include "nbus-flash.h"
+#include "nbus-flash-tests.h"
+
+#ifdef MODULE_NAME
+#undef MODULE_NAME
+#endif
+#define MODULE_NAME "nbus-flash-tests"
+
+/**
+ * The service accesses a RAM flash stand-in registered in the service locator
+ * and it is connected to a peer channel over a loopback CAN bus. The peer
+ * channel has the same parent short-id and name, hence the same channel-id.
+ * The RAM flash refuses writes crossing a page boundary like spi-flash does.
+ * Ranges start and end unaligned to check the first and the last block.
+ */
+#define NBUS_FLASH_TEST_QUEUE_LEN 64
+#define NBUS_FLASH_TEST_TIMEOUT_MS 1000
+#define NBUS_FLASH_TEST_SHORT_ID 0x7e572000
+#define NBUS_FLASH_TEST_NAME "flash-test"
+#define NBUS_FLASH_TEST_DEVICE "test-ram"
+#define NBUS_FLASH_TEST_SIZE 4096
+#define NBUS_FLASH_TEST_PAGE 256
+#define NBUS_FLASH_TEST_ADDR 37
+#define NBUS_FLASH_TEST_LEN 3001
+/* Block lost during the streaming write */
+#define NBUS_FLASH_TEST_LOST 3
+#define NBUS_FLASH_TEST_WINDOW 2
+
+/* One side of the loopback bus, advertisements are dropped as the service
+ * and the peer channel use the same short-id. */
+struct nbus_flash_test_port {
+	Can can;
+	QueueHandle_t rx;
+	struct nbus_flash_test_port *peer;
+};
+
+struct nbus_flash_test {
+	struct nbus_flash_test_port port[2];
+	Nbus nbus[2];
+	NbusChannel parent[2];
+	NbusChannel peer;
+	NbusFlash service;
+
+	/* RAM flash stand-in, writes crossing a page are counted. */
+	Flash flash;
+	uint8_t ram[NBUS_FLASH_TEST_SIZE];
+	uint32_t crossed;
+
+	/* Contents expected in the flash and the range read back. */
+	uint8_t image[NBUS_FLASH_TEST_SIZE];
+	uint8_t received[NBUS_FLASH_TEST_SIZE];
+
+	/* Last packet received by the peer channel */
+	uint8_t buf[NBUS_CHANNEL_MTU];
+	size_t len;
+	nbus_endpoint_t ep;
+};
+
+/* The service channel cannot be removed from the nbus instance and the flash
+ * cannot be removed from the service locator, the test setup is created on
+ * the first run and never freed. */
+static struct nbus_flash_test *nbus_flash_test = NULL;
+
+
+static can_ret_t nbus_flash_test_port_send(Can *can, const struct can_message *msg, uint32_t timeout_ms) {
+	struct nbus_flash_test_port *self = can->parent;
+
+	struct nbus_id id;
+	nbus_parse_id(msg->id, &id);
+	if (id.opcode == NBUS_OP_ADVERTISEMENT) {
+		return CAN_RET_OK;
+	}
+	if (xQueueSend(self->peer->rx, msg, pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+		return CAN_RET_FAILED;
+	}
+	return CAN_RET_OK;
+}
+
+
+static can_ret_t nbus_flash_test_port_receive(Can *can, struct can_message *msg, uint32_t timeout_ms) {
+	struct nbus_flash_test_port *self = can->parent;
+
+	if (xQueueReceive(self->rx, msg, pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+		return CAN_RET_FAILED;
+	}
+	return CAN_RET_OK;
+}
+
+
+static const struct can_vmt nbus_flash_test_port_vmt = {
+	.send = nbus_flash_test_port_send,
+	.receive = nbus_flash_test_port_receive,
+};
+
+
+static flash_ret_t test_flash_get_size(Flash *flash, uint32_t i, size_t *size, flash_block_ops_t *ops) {
+	(void)flash;
+	if (i == 0) {
+		*size = NBUS_FLASH_TEST_SIZE;
+		*ops = FLASH_BLOCK_OPS_READ | FLASH_BLOCK_OPS_ERASE;
+		return FLASH_RET_OK;
+	}
+	if (i == 1) {
+		*size = NBUS_FLASH_TEST_PAGE;
+		*ops = FLASH_BLOCK_OPS_WRITE;
+		return FLASH_RET_OK;
+	}
+	return FLASH_RET_BAD_ARG;
+}
+
+
+static flash_ret_t test_flash_erase(Flash *flash, const size_t addr, size_t len) {
+	struct nbus_flash_test *self = flash->parent;
+	if (addr + len > NBUS_FLASH_TEST_SIZE) {
+		return FLASH_RET_BAD_ARG;
+	}
+	memset(self->ram + addr, 0xff, len);
+	return FLASH_RET_OK;
+}
+
+
+static flash_ret_t test_flash_write(Flash *flash, const size_t addr, const void *buf, size_t len) {
+	struct nbus_flash_test *self = flash->parent;
+	if (len == 0 || addr + len > NBUS_FLASH_TEST_SIZE) {
+		return FLASH_RET_BAD_ARG;
+	}
+	if (addr / NBUS_FLASH_TEST_PAGE != (addr + len - 1) / NBUS_FLASH_TEST_PAGE) {
+		self->crossed++;
+		return FLASH_RET_BAD_ARG;
+	}
+	memcpy(self->ram + addr, buf, len);
+	return FLASH_RET_OK;
+}
+
+
+static flash_ret_t test_flash_read(Flash *flash, const size_t addr, void *buf, size_t len) {
+	struct nbus_flash_test *self = flash->parent;
+	if (addr + len > NBUS_FLASH_TEST_SIZE) {
+		return FLASH_RET_BAD_ARG;
+	}
+	memcpy(buf, self->ram + addr, len);
+	return FLASH_RET_OK;
+}
+
+
+static const struct flash_vmt test_flash_vmt = {
+	.get_size = test_flash_get_size,
+	.erase = test_flash_erase,
+	.write = test_flash_write,
+	.read = test_flash_read,
+};
+
+
+static struct nbus_flash_test *nbus_flash_test_get(void) {
+	if (nbus_flash_test != NULL) {
+		return nbus_flash_test;
+	}
+
+	struct nbus_flash_test *self = calloc(1, sizeof(struct nbus_flash_test));
+	if (self == NULL) {
+		return NULL;
+	}
+	self->flash.vmt = &test_flash_vmt;
+	self->flash.parent = self;
+
+	for (size_t i = 0; i < 2; i++) {
+		struct nbus_flash_test_port *port = &self->port[i];
+		port->can.vmt = &nbus_flash_test_port_vmt;
+		port->can.parent = port;
+		port->peer = &self->port[1 - i];
+		port->rx = xQueueCreate(NBUS_FLASH_TEST_QUEUE_LEN, sizeof(struct can_message));
+		if (port->rx == NULL || nbus_init(&self->nbus[i], &port->can) != NBUS_RET_OK) {
+			return NULL;
+		}
+		if (nbus_channel_init(&self->parent[i], "test") != NBUS_RET_OK) {
+			return NULL;
+		}
+		nbus_channel_set_explicit_short_id(&self->parent[i], NBUS_FLASH_TEST_SHORT_ID);
+	}
+
+	/* The service is added to the instance of its parent, the peer channel
+	 * gets the same short-id derived from the parent on the other side. */
+	if (iservicelocator_add(locator, ISERVICELOCATOR_TYPE_FLASH, (Interface *)&self->flash, NBUS_FLASH_TEST_DEVICE) != ISERVICELOCATOR_RET_OK) {
+		return NULL;
+	}
+	if (nbus_add_channel(&self->nbus[0], &self->parent[0]) != NBUS_RET_OK ||
+	    nbus_flash_init(&self->service, &self->parent[0], NBUS_FLASH_TEST_NAME) != NBUS_FLASH_RET_OK) {
+		return NULL;
+	}
+	if (nbus_channel_init(&self->peer, NBUS_FLASH_TEST_NAME) != NBUS_RET_OK) {
+		return NULL;
+	}
+	nbus_channel_set_parent(&self->peer, &self->parent[1]);
+	if (nbus_add_channel(&self->nbus[1], &self->peer) != NBUS_RET_OK) {
+		return NULL;
+	}
+
+	/* The loopback bus doesn't pace the streaming read, packets arriving while
+	 * the test is not receiving would be dropped. Retransmit them. */
+	if (nbus_channel_set_reliable(&self->service.channel, NBUS_FLASH_TEST_WINDOW) != NBUS_RET_OK ||
+	    nbus_channel_set_reliable(&self->peer, NBUS_FLASH_TEST_WINDOW) != NBUS_RET_OK) {
+		return NULL;
+	}
+
+	nbus_flash_test = self;
+	return self;
+}
+
+
+static bool nbus_flash_test_start(struct nbus_flash_test *self) {
+	/* Channel-ids are assigned by the housekeeping task. */
+	TickType_t start = xTaskGetTickCount();
+	while (!self->peer.channel_id_valid || !self->service.channel.channel_id_valid) {
+		if ((xTaskGetTickCount() - start) > pdMS_TO_TICKS(NBUS_FLASH_TEST_TIMEOUT_MS * 2)) {
+			u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("no channel-id assigned"));
+			return false;
+		}
+		vTaskDelay(pdMS_TO_TICKS(10));
+	}
+	if (self->peer.channel_id != self->service.channel.channel_id) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("channel-ids differ"));
+		return false;
+	}
+
+	/* Skip packets left from the previous run. */
+	nbus_endpoint_t ep = 0;
+	size_t len = 0;
+	while (nbus_channel_receive(&self->peer, &ep, self->buf, sizeof(self->buf), &len, 100) == NBUS_RET_OK) {
+		;
+	}
+	return true;
+}
+
+
+static bool nbus_flash_test_receive(struct nbus_flash_test *self) {
+	if (nbus_channel_receive(&self->peer, &self->ep, self->buf, sizeof(self->buf), &self->len, NBUS_FLASH_TEST_TIMEOUT_MS) != NBUS_RET_OK) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("no response"));
+		return false;
+	}
+	return true;
+}
+
+
+/* Receive a map on the main endpoint, fail on an error response. */
+static bool nbus_flash_test_response(struct nbus_flash_test *self, CborValue *map) {
+	if (!nbus_flash_test_receive(self)) {
+		return false;
+	}
+	CborParser parser;
+	cbor_parser_init(self->buf, self->len, 0, &parser, map);
+	if (self->ep != NBUS_FLASH_MAIN_EP || !cbor_value_is_map(map)) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("unexpected packet on ep %u"), self->ep);
+		return false;
+	}
+	CborValue err;
+	cbor_value_map_find_value(map, "err", &err);
+	if (cbor_value_is_valid(&err)) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("error response"));
+		return false;
+	}
+	return true;
+}
+
+
+static bool nbus_flash_test_get_uint(CborValue *map, const char *key, uint32_t *v) {
+	CborValue value;
+	cbor_value_map_find_value(map, key, &value);
+	if (!cbor_value_is_valid(&value) || !cbor_value_is_unsigned_integer(&value)) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("'%s' missing"), key);
+		return false;
+	}
+	uint64_t uint = 0;
+	cbor_value_get_uint64(&value, &uint);
+	*v = uint;
+	return true;
+}
+
+
+/* Compare the hash in the map with the hash of the range of the image. */
+static bool nbus_flash_test_hash(struct nbus_flash_test *self, CborValue *map, uint32_t addr, uint32_t len) {
+	CborValue value;
+	cbor_value_map_find_value(map, "h", &value);
+	if (!cbor_value_is_valid(&value) || !cbor_value_is_byte_string(&value)) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("hash missing"));
+		return false;
+	}
+	uint8_t h[NBUS_FLASH_HASH_LEN];
+	size_t h_len = sizeof(h);
+	cbor_value_copy_byte_string(&value, h, &h_len, NULL);
+
+	uint8_t expected[NBUS_FLASH_HASH_LEN];
+	blake2s(expected, sizeof(expected), self->image + addr, len, NULL, 0);
+	if (h_len != sizeof(h) || memcmp(h, expected, sizeof(h)) != 0) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("hash mismatch"));
+		return false;
+	}
+	return true;
+}
+
+
+/* Send a command with the session-id and the range (if not zero) and receive the response. */
+static bool nbus_flash_test_command(struct nbus_flash_test *self, const char *c, uint32_t sid, uint32_t addr, uint32_t len, CborValue *map) {
+	CborEncoder encoder;
+	cbor_encoder_init(&encoder, self->buf, sizeof(self->buf), 0);
+	CborEncoder encoder_map;
+	cbor_encoder_create_map(&encoder, &encoder_map, CborIndefiniteLength);
+	cbor_encode_text_stringz(&encoder_map, "c");
+	cbor_encode_text_stringz(&encoder_map, c);
+	cbor_encode_text_stringz(&encoder_map, "n");
+	cbor_encode_text_stringz(&encoder_map, NBUS_FLASH_TEST_DEVICE);
+	if (sid != 0) {
+		cbor_encode_text_stringz(&encoder_map, "sid");
+		cbor_encode_uint(&encoder_map, sid);
+		cbor_encode_text_stringz(&encoder_map, "addr");
+		cbor_encode_uint(&encoder_map, addr);
+		cbor_encode_text_stringz(&encoder_map, "len");
+		cbor_encode_uint(&encoder_map, len);
+	}
+	cbor_encoder_close_container(&encoder, &encoder_map);
+
+	size_t tx_len = cbor_encoder_get_buffer_size(&encoder, self->buf);
+	if (nbus_channel_send(&self->peer, NBUS_FLASH_MAIN_EP, self->buf, tx_len) != NBUS_RET_OK) {
+		return false;
+	}
+	return nbus_flash_test_response(self, map);
+}
+
+
+static bool nbus_flash_test_open(struct nbus_flash_test *self, uint32_t *sid) {
+	CborValue map;
+	return nbus_flash_test_command(self, "open", 0, 0, 0, &map) && nbus_flash_test_get_uint(&map, "sid", sid);
+}
+
+
+static bool nbus_flash_test_close(struct nbus_flash_test *self, uint32_t sid) {
+	CborValue map;
+	return nbus_flash_test_command(self, "close", sid, 0, 0, &map);
+}
+
+
+/* Length of the block at the position @p pos, blocks end on addresses aligned to @p bl. */
+static size_t nbus_flash_test_block_len(uint32_t addr, uint32_t len, uint32_t pos, uint32_t bl) {
+	size_t l = bl - (addr + pos) % bl;
+	if (l > len - pos) {
+		l = len - pos;
+	}
+	return l;
+}
+
+
+static void nbus_flash_test_fill(uint8_t *buf, size_t len, uint32_t seed) {
+	for (size_t i = 0; i < len; i++) {
+		buf[i] = (uint8_t)(seed * 31 + i * 7 + (i >> 8));
+	}
+}
+
+
+static bool nbus_flash_test_send_block(struct nbus_flash_test *self, uint32_t sid, uint32_t seq, uint32_t addr, size_t len) {
+	struct nbus_flash_data_msg msg = {
+		.sid = sid,
+		.seq = seq,
+	};
+	memcpy(self->buf, &msg, sizeof(msg));
+	memcpy(self->buf + sizeof(msg), self->image + addr, len);
+	return nbus_channel_send(&self->peer, NBUS_FLASH_DATA_EP, self->buf, sizeof(msg) + len) == NBUS_RET_OK;
+}
+
+
+/**
+ * Send blocks of the range starting with @p seq, the lost block is skipped once.
+ * Check the acknowledgement of every window and the hash of the whole range.
+ */
+static bool nbus_flash_test_swrite_blocks(struct nbus_flash_test *self, uint32_t sid, uint32_t addr, uint32_t len, uint32_t seq, uint32_t bl, uint32_t win, uint32_t lost) {
+	/* Skip blocks already written. */
+	uint32_t pos = 0;
+	for (uint32_t i = 0; i < seq; i++) {
+		pos += nbus_flash_test_block_len(addr, len, pos, bl);
+	}
+
+	uint32_t unacked = 0;
+	while (pos < len) {
+		size_t l = nbus_flash_test_block_len(addr, len, pos, bl);
+		if (seq == lost) {
+			/* The next block reveals the gap and it is acknowledged immediately. */
+			pos += l;
+			seq++;
+			l = nbus_flash_test_block_len(addr, len, pos, bl);
+			CborValue map;
+			uint32_t next = 0;
+			if (!nbus_flash_test_send_block(self, sid, seq, addr + pos, l) ||
+			    !nbus_flash_test_response(self, &map) || !nbus_flash_test_get_uint(&map, "next", &next) || next != lost) {
+				u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("gap at block %u not reported"), lost);
+				return false;
+			}
+			return true;
+		}
+		if (!nbus_flash_test_send_block(self, sid, seq, addr + pos, l)) {
+			return false;
+		}
+		pos += l;
+		seq++;
+		unacked++;
+
+		if (unacked == win || pos == len) {
+			CborValue map;
+			uint32_t next = 0;
+			if (!nbus_flash_test_response(self, &map) || !nbus_flash_test_get_uint(&map, "next", &next) || next != seq) {
+				u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("block %u not acknowledged"), seq - 1);
+				return false;
+			}
+			if (pos == len && !nbus_flash_test_hash(self, &map, addr, len)) {
+				return false;
+			}
+			unacked = 0;
+		}
+	}
+	return true;
+}
+
+
+static bool nbus_flash_test_swrite(struct nbus_flash_test *self, uint32_t sid, uint32_t addr, uint32_t len, uint32_t lost) {
+	CborValue map;
+	uint32_t next = 0;
+	uint32_t win = 0;
+	uint32_t bl = 0;
+	if (!nbus_flash_test_command(self, "swrite", sid, addr, len, &map) ||
+	    !nbus_flash_test_get_uint(&map, "next", &next) ||
+	    !nbus_flash_test_get_uint(&map, "win", &win) ||
+	    !nbus_flash_test_get_uint(&map, "bl", &bl) || bl == 0 || win == 0) {
+		return false;
+	}
+	if (!nbus_flash_test_swrite_blocks(self, sid, addr, len, next, bl, win, lost)) {
+		return false;
+	}
+	if (lost == UINT32_MAX) {
+		return true;
+	}
+
+	/* Resume with the same range, the lost block is expected next. */
+	if (!nbus_flash_test_command(self, "swrite", sid, addr, len, &map) || !nbus_flash_test_get_uint(&map, "next", &next) || next != lost) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("not resumed at block %u"), lost);
+		return false;
+	}
+	return nbus_flash_test_swrite_blocks(self, sid, addr, len, next, bl, win, UINT32_MAX);
+}
+
+
+static bool nbus_flash_test_sread_if_unaligned(void) {
+	struct nbus_flash_test *self = nbus_flash_test_get();
+	if (self == NULL || !nbus_flash_test_start(self)) {
+		return false;
+	}
+	nbus_flash_test_fill(self->image, sizeof(self->image), 1);
+	memcpy(self->ram, self->image, sizeof(self->ram));
+
+	uint32_t sid = 0;
+	if (!nbus_flash_test_open(self, &sid)) {
+		return false;
+	}
+	CborValue map;
+	uint32_t bl = 0;
+	const uint32_t addr = NBUS_FLASH_TEST_ADDR;
+	const uint32_t len = NBUS_FLASH_TEST_LEN;
+	bool ret = nbus_flash_test_command(self, "sread", sid, addr, len, &map) && nbus_flash_test_get_uint(&map, "bl", &bl) && bl > 0;
+
+	/* Blocks follow in order, the summary is sent after the last one. */
+	memset(self->received, 0, sizeof(self->received));
+	uint32_t seq = 0;
+	uint32_t pos = 0;
+	while (ret) {
+		if (!nbus_flash_test_receive(self)) {
+			ret = false;
+			break;
+		}
+		if (self->ep == NBUS_FLASH_MAIN_EP) {
+			break;
+		}
+		struct nbus_flash_data_msg msg;
+		size_t l = self->len - sizeof(msg);
+		memcpy(&msg, self->buf, sizeof(msg));
+		if (self->ep != NBUS_FLASH_DATA_EP || msg.sid != sid || msg.seq != seq ||
+		    pos >= len || l != nbus_flash_test_block_len(addr, len, pos, bl)) {
+			u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("unexpected block %u at %u, %u bytes"), msg.seq, pos, l);
+			ret = false;
+			break;
+		}
+		memcpy(self->received + pos, self->buf + sizeof(msg), l);
+		pos += l;
+		seq++;
+	}
+
+	uint32_t blocks = 0;
+	uint32_t summary_sid = 0;
+	if (ret) {
+		CborParser parser;
+		cbor_parser_init(self->buf, self->len, 0, &parser, &map);
+		ret = nbus_flash_test_get_uint(&map, "sid", &summary_sid) && summary_sid == sid &&
+		      nbus_flash_test_get_uint(&map, "seq", &blocks) && blocks == seq &&
+		      nbus_flash_test_hash(self, &map, addr, len);
+	}
+	if (ret && (pos != len || memcmp(self->received, self->image + addr, len) != 0)) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("%u of %u bytes read back"), pos, len);
+		ret = false;
+	}
+
+	ret &= nbus_flash_test_close(self, sid);
+	return ret;
+}
+
+
+static bool nbus_flash_test_swrite_range(uint32_t lost) {
+	struct nbus_flash_test *self = nbus_flash_test_get();
+	if (self == NULL || !nbus_flash_test_start(self)) {
+		return false;
+	}
+	memset(self->ram, 0xff, sizeof(self->ram));
+	memcpy(self->image, self->ram, sizeof(self->image));
+	nbus_flash_test_fill(self->image + NBUS_FLASH_TEST_ADDR, NBUS_FLASH_TEST_LEN, lost);
+	self->crossed = 0;
+
+	uint32_t sid = 0;
+	if (!nbus_flash_test_open(self, &sid)) {
+		return false;
+	}
+	bool ret = nbus_flash_test_swrite(self, sid, NBUS_FLASH_TEST_ADDR, NBUS_FLASH_TEST_LEN, lost);
+
+	/* Nothing is written outside of the range. */
+	if (ret && (self->crossed > 0 || memcmp(self->ram, self->image, sizeof(self->ram)) != 0)) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("flash contents differ, %u writes crossed a page"), self->crossed);
+		ret = false;
+	}
+
+	ret &= nbus_flash_test_close(self, sid);
+	return ret;
+}
+
+
+static bool nbus_flash_test_swrite_if_unaligned(void) {
+	return nbus_flash_test_swrite_range(UINT32_MAX);
+}
+
+
+static bool nbus_flash_test_swrite_resume_if_lost(void) {
+	return nbus_flash_test_swrite_range(NBUS_FLASH_TEST_LOST);
+}
+
+
+bool nbus_flash_tests(void) {
+	bool res = true;
+
+	res &= u_test(nbus_flash_test_sread_if_unaligned());
+	res &= u_test(nbus_flash_test_swrite_if_unaligned());
+	res &= u_test(nbus_flash_test_swrite_resume_if_lost());
+
+	return res;
+}
@@ -0,0 +1,19 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * NBUS flash access service tests
+ *
+ * Copyright (c) 2024, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * Read and write unaligned ranges of a RAM flash in the streaming mode over
+ * a loopback CAN bus. Check the block sequence, the block alignment, the
+ * batched acknowledgements, the range hash and the flash contents, including
+ * a streaming write resumed after a block was lost.
+ */
+bool nbus_flash_tests(void);
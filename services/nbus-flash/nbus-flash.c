@@ -62,6 +62,92 @@ static bool cbor_map_get_uint(CborValue *map, const char *key, uint32_t *i) {
 }
 
 
+static struct nbus_flash_session *find_session(NbusFlash *self, uint32_t sid) {
+	for (size_t i = 0; i < NBUS_FLASH_MAX_SESSIONS; i++) {
+		struct nbus_flash_session *s = &self->sessions[i];
+		if (s->flash != NULL && s->sid == sid) {
+			return s;
+		}
+	}
+	return NULL;
+}
+
+
+static struct nbus_flash_session *get_session(NbusFlash *self, CborValue *imap, CborEncoder *omap) {
+	uint32_t sid;
+	struct nbus_flash_session *s = NULL;
+	if (cbor_map_get_uint(imap, "sid", &sid)) {
+		s = find_session(self, sid);
+	}
+	if (s == NULL) {
+		cbor_encode_text_stringz(omap, "err");
+		cbor_encode_text_stringz(omap, "session error");
+	}
+	return s;
+}
+
+
+static void stream_start(struct nbus_flash_session *s, enum nbus_flash_stream stream, uint32_t addr, uint32_t len) {
+	s->stream = stream;
+	s->addr = addr;
+	s->len = len;
+	s->seq = 0;
+	s->pos = 0;
+	s->unacked = 0;
+	s->gap = false;
+	blake2s_init(&s->hash, NBUS_FLASH_HASH_LEN);
+}
+
+
+/**
+ * @brief Get the streaming block size of a flash device
+ *
+ * Drivers write a single page at once at most (spi-flash refuses to cross
+ * a page boundary). Use the smallest writable block size, halved until it
+ * fits a single packet.
+ */
+static uint32_t nbus_flash_block_len(Flash *flash) {
+	size_t page = 0;
+	if (flash->vmt->get_size != NULL) {
+		uint32_t step = 0;
+		size_t size = 0;
+		flash_block_ops_t ops;
+		while (flash->vmt->get_size(flash, step, &size, &ops) == FLASH_RET_OK) {
+			if ((ops & FLASH_BLOCK_OPS_WRITE) && size > 0 && (page == 0 || size < page)) {
+				page = size;
+			}
+			step++;
+		}
+	}
+	if (page == 0) {
+		/* No page size restriction reported. */
+		return NBUS_FLASH_DATA_LEN;
+	}
+	while (page > NBUS_FLASH_DATA_LEN) {
+		page /= 2;
+	}
+	return page;
+}
+
+
+/* Blocks end on addresses aligned to the block size, they never cross a page. */
+static size_t stream_block_len(struct nbus_flash_session *s) {
+	size_t len = s->block_len - (s->addr + s->pos) % s->block_len;
+	if (len > s->len - s->pos) {
+		len = s->len - s->pos;
+	}
+	return len;
+}
+
+
+static void encode_hash(struct nbus_flash_session *s, CborEncoder *omap) {
+	uint8_t h[NBUS_FLASH_HASH_LEN];
+	blake2s_final(&s->hash, h, sizeof(h));
+	cbor_encode_text_stringz(omap, "h");
+	cbor_encode_byte_string(omap, h, sizeof(h));
+}
+
+
 static nbus_flash_ret_t process_cc_info(NbusFlash *self, CborValue *imap, CborEncoder *omap) {
 	char dev_name[16];
 	cbor_map_get_str(imap, "n", dev_name, sizeof(dev_name));
@@ -93,6 +179,10 @@ static nbus_flash_ret_t process_cc_info(NbusFlash *self, CborValue *imap, CborEn
 
 			cbor_encoder_close_container(omap, &size_list);
 		}
+
+		/* Streaming mode block size. */
+		cbor_encode_text_stringz(omap, "bl");
+		cbor_encode_uint(omap, nbus_flash_block_len(flash));
 	} else {
 		cbor_encode_text_stringz(omap, "err");
 		cbor_encode_text_stringz(omap, "device not found");
@@ -127,23 +217,35 @@ static nbus_flash_ret_t process_cc_list(NbusFlash *self, CborValue *imap, CborEn
 
 
 static nbus_flash_ret_t process_cc_open(NbusFlash *self, CborValue *imap, CborEncoder *omap) {
-/*
-	if (self->flash != NULL) {
+	struct nbus_flash_session *s = NULL;
+	for (size_t i = 0; i < NBUS_FLASH_MAX_SESSIONS; i++) {
+		if (self->sessions[i].flash == NULL) {
+			s = &self->sessions[i];
+			break;
+		}
+	}
+	if (s == NULL) {
 		cbor_encode_text_stringz(omap, "err");
-		cbor_encode_text_stringz(omap, "session already opened, only one supported");
+		cbor_encode_text_stringz(omap, "too many sessions");
 		return NBUS_FLASH_RET_FAILED;
 	}
-*/
+
 	char dev_name[16];
 	cbor_map_get_str(imap, "n", dev_name, sizeof(dev_name));
 
 	Flash *flash = NULL;
 	if (iservicelocator_query_name_type(locator, dev_name, ISERVICELOCATOR_TYPE_FLASH, (Interface **)&flash) == ISERVICELOCATOR_RET_OK) {
-		self->flash = flash;
-		self->sid = (uint32_t)flash;
+		memset(s, 0, sizeof(struct nbus_flash_session));
+		s->flash = flash;
+		s->block_len = nbus_flash_block_len(flash);
+		/* Zero is not a valid session ID. */
+		if (self->next_sid == 0) {
+			self->next_sid++;
+		}
+		s->sid = self->next_sid++;
 
 		cbor_encode_text_stringz(omap, "sid");
-		cbor_encode_uint(omap, self->sid);
+		cbor_encode_uint(omap, s->sid);
 	} else {
 		cbor_encode_text_stringz(omap, "err");
 		cbor_encode_text_stringz(omap, "device not found");
@@ -154,27 +256,26 @@ static nbus_flash_ret_t process_cc_open(NbusFlash *self, CborValue *imap, CborEn
 
 
 static nbus_flash_ret_t process_cc_close(NbusFlash *self, CborValue *imap, CborEncoder *omap) {
-	if (self->flash == NULL) {
-		cbor_encode_text_stringz(omap, "err");
-		cbor_encode_text_stringz(omap, "no session opened");
+	struct nbus_flash_session *s = get_session(self, imap, omap);
+	if (s == NULL) {
 		return NBUS_FLASH_RET_FAILED;
 	}
 
 	cbor_encode_text_stringz(omap, "sid");
-	cbor_encode_uint(omap, self->sid);
+	cbor_encode_uint(omap, s->sid);
 
-	self->flash = NULL;
-	self->sid = 0;
+	/* Stops any streaming transfer in progress. */
+	s->stream = NBUS_FLASH_STREAM_NONE;
+	s->flash = NULL;
+	s->sid = 0;
 
 	return NBUS_FLASH_RET_OK;
 }
 
 
 static nbus_flash_ret_t process_cc_erase(NbusFlash *self, CborValue *imap, CborEncoder *omap) {
-	uint32_t sid;
-	if (!cbor_map_get_uint(imap, "sid", &sid) || self->flash == NULL || sid != self->sid) {
-		cbor_encode_text_stringz(omap, "err");
-		cbor_encode_text_stringz(omap, "session error");
+	struct nbus_flash_session *s = get_session(self, imap, omap);
+	if (s == NULL) {
 		return NBUS_FLASH_RET_FAILED;
 	}
 
@@ -186,7 +287,7 @@ static nbus_flash_ret_t process_cc_erase(NbusFlash *self, CborValue *imap, CborE
 		return NBUS_FLASH_RET_FAILED;
 	}
 
-	if (self->flash->vmt->erase != NULL && self->flash->vmt->erase(self->flash, addr, len) != FLASH_RET_OK) {
+	if (s->flash->vmt->erase != NULL && s->flash->vmt->erase(s->flash, addr, len) != FLASH_RET_OK) {
 		cbor_encode_text_stringz(omap, "err");
 		cbor_encode_text_stringz(omap, "erasing failed");
 		return NBUS_FLASH_RET_FAILED;
@@ -201,10 +302,8 @@ static nbus_flash_ret_t process_cc_erase(NbusFlash *self, CborValue *imap, CborE
 
 
 static nbus_flash_ret_t process_cc_write(NbusFlash *self, CborValue *imap, CborEncoder *omap) {
-	uint32_t sid;
-	if (!cbor_map_get_uint(imap, "sid", &sid) || self->flash == NULL || sid != self->sid) {
-		cbor_encode_text_stringz(omap, "err");
-		cbor_encode_text_stringz(omap, "session error");
+	struct nbus_flash_session *s = get_session(self, imap, omap);
+	if (s == NULL) {
 		return NBUS_FLASH_RET_FAILED;
 	}
 
@@ -222,7 +321,7 @@ static nbus_flash_ret_t process_cc_write(NbusFlash *self, CborValue *imap, CborE
 		return NBUS_FLASH_RET_FAILED;
 	}
 
-	if (self->flash->vmt->write != NULL && self->flash->vmt->write(self->flash, addr, buf, len) != FLASH_RET_OK) {
+	if (s->flash->vmt->write != NULL && s->flash->vmt->write(s->flash, addr, buf, len) != FLASH_RET_OK) {
 		cbor_encode_text_stringz(omap, "err");
 		cbor_encode_text_stringz(omap, "writing failed");
 		return NBUS_FLASH_RET_FAILED;
@@ -236,10 +335,8 @@ static nbus_flash_ret_t process_cc_write(NbusFlash *self, CborValue *imap, CborE
 
 
 static nbus_flash_ret_t process_cc_read(NbusFlash *self, CborValue *imap, CborEncoder *omap) {
-	uint32_t sid;
-	if (!cbor_map_get_uint(imap, "sid", &sid) || self->flash == NULL || sid != self->sid) {
-		cbor_encode_text_stringz(omap, "err");
-		cbor_encode_text_stringz(omap, "session error");
+	struct nbus_flash_session *s = get_session(self, imap, omap);
+	if (s == NULL) {
 		return NBUS_FLASH_RET_FAILED;
 	}
 
@@ -252,7 +349,7 @@ static nbus_flash_ret_t process_cc_read(NbusFlash *self, CborValue *imap, CborEn
 	}
 
 	uint8_t buf[NBUS_FLASH_BLOCK_LEN];
-	if (self->flash->vmt->read != NULL && self->flash->vmt->read(self->flash, addr, buf, len) != FLASH_RET_OK) {
+	if (s->flash->vmt->read != NULL && s->flash->vmt->read(s->flash, addr, buf, len) != FLASH_RET_OK) {
 		cbor_encode_text_stringz(omap, "err");
 		cbor_encode_text_stringz(omap, "reading failed");
 		return NBUS_FLASH_RET_FAILED;
@@ -265,6 +362,136 @@ static nbus_flash_ret_t process_cc_read(NbusFlash *self, CborValue *imap, CborEn
 }
 
 
+static nbus_flash_ret_t process_cc_sread(NbusFlash *self, CborValue *imap, CborEncoder *omap) {
+	struct nbus_flash_session *s = get_session(self, imap, omap);
+	if (s == NULL) {
+		return NBUS_FLASH_RET_FAILED;
+	}
+
+	uint32_t addr;
+	uint32_t len;
+	if (!cbor_map_get_uint(imap, "addr", &addr) || !cbor_map_get_uint(imap, "len", &len) || s->flash->vmt->read == NULL) {
+		cbor_encode_text_stringz(omap, "err");
+		cbor_encode_text_stringz(omap, "bad arguments");
+		return NBUS_FLASH_RET_FAILED;
+	}
+
+	/* The first block is pushed after the response is sent. */
+	stream_start(s, NBUS_FLASH_STREAM_NONE, addr, len);
+	self->stream_pending = s;
+
+	cbor_encode_text_stringz(omap, "sid");
+	cbor_encode_uint(omap, s->sid);
+	cbor_encode_text_stringz(omap, "bl");
+	cbor_encode_uint(omap, s->block_len);
+
+	return NBUS_FLASH_RET_OK;
+}
+
+
+static nbus_flash_ret_t process_cc_swrite(NbusFlash *self, CborValue *imap, CborEncoder *omap) {
+	struct nbus_flash_session *s = get_session(self, imap, omap);
+	if (s == NULL) {
+		return NBUS_FLASH_RET_FAILED;
+	}
+
+	uint32_t addr;
+	uint32_t len;
+	if (!cbor_map_get_uint(imap, "addr", &addr) || !cbor_map_get_uint(imap, "len", &len) || s->flash->vmt->write == NULL) {
+		cbor_encode_text_stringz(omap, "err");
+		cbor_encode_text_stringz(omap, "bad arguments");
+		return NBUS_FLASH_RET_FAILED;
+	}
+
+	/* Resume if the same range is being written already. */
+	if (s->stream != NBUS_FLASH_STREAM_WRITE || s->addr != addr || s->len != len) {
+		stream_start(s, NBUS_FLASH_STREAM_WRITE, addr, len);
+	}
+	s->unacked = 0;
+	s->gap = false;
+
+	cbor_encode_text_stringz(omap, "sid");
+	cbor_encode_uint(omap, s->sid);
+	cbor_encode_text_stringz(omap, "next");
+	cbor_encode_uint(omap, s->seq);
+	cbor_encode_text_stringz(omap, "win");
+	cbor_encode_uint(omap, NBUS_FLASH_ACK_BATCH);
+	cbor_encode_text_stringz(omap, "bl");
+	cbor_encode_uint(omap, s->block_len);
+
+	return NBUS_FLASH_RET_OK;
+}
+
+
+/**
+ * @brief Write a block of a streaming write transfer
+ *
+ * @return Length of the acknowledgement prepared in the tx_buf, 0 if none.
+ */
+static size_t process_data_block(NbusFlash *self, uint8_t *buf, size_t len) {
+	struct nbus_flash_data_msg msg;
+	if (len < sizeof(msg)) {
+		return 0;
+	}
+	memcpy(&msg, buf, sizeof(msg));
+	uint8_t *data = buf + sizeof(msg);
+	size_t data_len = len - sizeof(msg);
+
+	struct nbus_flash_session *s = find_session(self, msg.sid);
+	if (s == NULL || s->stream != NBUS_FLASH_STREAM_WRITE) {
+		return 0;
+	}
+
+	CborEncoder encoder;
+	cbor_encoder_init(&encoder, self->tx_buf, NBUS_FLASH_TX_BUF_LEN, 0);
+	CborEncoder encoder_map;
+	cbor_encoder_create_map(&encoder, &encoder_map, CborIndefiniteLength);
+	cbor_encode_text_stringz(&encoder_map, "sid");
+	cbor_encode_uint(&encoder_map, s->sid);
+
+	if (msg.seq == s->seq) {
+		if (data_len != stream_block_len(s)) {
+			return 0;
+		}
+		if (s->flash->vmt->write(s->flash, s->addr + s->pos, data, data_len) != FLASH_RET_OK) {
+			s->stream = NBUS_FLASH_STREAM_NONE;
+			cbor_encode_text_stringz(&encoder_map, "err");
+			cbor_encode_text_stringz(&encoder_map, "writing failed");
+			goto ack;
+		}
+		blake2s_update(&s->hash, data, data_len);
+		s->pos += data_len;
+		s->seq++;
+		s->unacked++;
+		s->gap = false;
+
+		if (s->pos == s->len) {
+			s->stream = NBUS_FLASH_STREAM_NONE;
+			cbor_encode_text_stringz(&encoder_map, "next");
+			cbor_encode_uint(&encoder_map, s->seq);
+			encode_hash(s, &encoder_map);
+			goto ack;
+		}
+		if (s->unacked < NBUS_FLASH_ACK_BATCH) {
+			return 0;
+		}
+	} else if ((int32_t)(msg.seq - s->seq) > 0 && s->gap == false) {
+		/* A block is missing. Report it once, the host continues with the next
+		 * expected block. Duplicates are ignored. */
+		s->gap = true;
+	} else {
+		return 0;
+	}
+	cbor_encode_text_stringz(&encoder_map, "next");
+	cbor_encode_uint(&encoder_map, s->seq);
+
+ack:
+	s->unacked = 0;
+	cbor_encoder_close_container(&encoder, &encoder_map);
+	return cbor_encoder_get_buffer_size(&encoder, self->tx_buf);
+}
+
+
 static nbus_flash_ret_t process_main_ep(NbusFlash *self, uint8_t *buf, size_t len) {
 	CborParser parser;
 	CborValue map;
@@ -286,6 +513,7 @@ static nbus_flash_ret_t process_main_ep(NbusFlash *self, uint8_t *buf, size_t le
 
 			nbus_flash_ret_t ret = NBUS_FLASH_RET_FAILED;
 
+			xSemaphoreTake(self->lock, portMAX_DELAY);
 			if (!strcmp(s, "list")) {
 				ret = process_cc_list(self, &map, &encoder_map);
 			} else if (!strcmp(s, "info")) {
@@ -300,13 +528,29 @@ static nbus_flash_ret_t process_main_ep(NbusFlash *self, uint8_t *buf, size_t le
 				ret = process_cc_write(self, &map, &encoder_map);
 			} else if (!strcmp(s, "read")) {
 				ret = process_cc_read(self, &map, &encoder_map);
+			} else if (!strcmp(s, "sread")) {
+				ret = process_cc_sread(self, &map, &encoder_map);
+			} else if (!strcmp(s, "swrite")) {
+				ret = process_cc_swrite(self, &map, &encoder_map);
 			};
+			xSemaphoreGive(self->lock);
 
 			/* Close the container and send the map in all circumstances (even if empty). */
 			cbor_encoder_close_container(&encoder, &encoder_map);
 			size_t tx_len = cbor_encoder_get_buffer_size(&encoder, self->tx_buf);
 			nbus_channel_send(&self->channel, NBUS_FLASH_MAIN_EP, self->tx_buf, tx_len);
 
+			/* Start the streaming read requested. */
+			if (self->stream_pending != NULL) {
+				xSemaphoreTake(self->lock, portMAX_DELAY);
+				if (self->stream_pending->flash != NULL) {
+					self->stream_pending->stream = NBUS_FLASH_STREAM_READ;
+				}
+				self->stream_pending = NULL;
+				xSemaphoreGive(self->lock);
+				xSemaphoreGive(self->stream_wake);
+			}
+
 			return ret;
 		}
 	}
@@ -328,6 +572,92 @@ static void nbus_task(void *p) {
 		if (ret == NBUS_RET_OK && ep == NBUS_FLASH_MAIN_EP) {
 			process_main_ep(self, self->rx_buf, len);
 		}
+		if (ret == NBUS_RET_OK && ep == NBUS_FLASH_DATA_EP) {
+			xSemaphoreTake(self->lock, portMAX_DELAY);
+			size_t tx_len = process_data_block(self, self->rx_buf, len);
+			xSemaphoreGive(self->lock);
+			if (tx_len > 0) {
+				nbus_channel_send(&self->channel, NBUS_FLASH_MAIN_EP, self->tx_buf, tx_len);
+			}
+		}
+	}
+
+	vTaskDelete(NULL);
+}
+
+
+/**
+ * @brief Prepare the next packet of a streaming read
+ *
+ * @return Length of the packet prepared in the stream_buf, the endpoint is returned in @p ep.
+ */
+static size_t stream_read_block(NbusFlash *self, struct nbus_flash_session *s, nbus_endpoint_t *ep) {
+	if (s->pos < s->len) {
+		struct nbus_flash_data_msg msg = {
+			.sid = s->sid,
+			.seq = s->seq,
+		};
+		size_t len = stream_block_len(s);
+		uint8_t *data = self->stream_buf + sizeof(msg);
+		if (s->flash->vmt->read(s->flash, s->addr + s->pos, data, len) == FLASH_RET_OK) {
+			memcpy(self->stream_buf, &msg, sizeof(msg));
+			blake2s_update(&s->hash, data, len);
+			s->pos += len;
+			s->seq++;
+			*ep = NBUS_FLASH_DATA_EP;
+			return sizeof(msg) + len;
+		}
+	}
+
+	/* Finished or failed, send the summary. */
+	CborEncoder encoder;
+	cbor_encoder_init(&encoder, self->stream_buf, sizeof(self->stream_buf), 0);
+	CborEncoder encoder_map;
+	cbor_encoder_create_map(&encoder, &encoder_map, CborIndefiniteLength);
+	cbor_encode_text_stringz(&encoder_map, "sid");
+	cbor_encode_uint(&encoder_map, s->sid);
+	if (s->pos == s->len) {
+		cbor_encode_text_stringz(&encoder_map, "seq");
+		cbor_encode_uint(&encoder_map, s->seq);
+		encode_hash(s, &encoder_map);
+	} else {
+		cbor_encode_text_stringz(&encoder_map, "err");
+		cbor_encode_text_stringz(&encoder_map, "reading failed");
+	}
+	cbor_encoder_close_container(&encoder, &encoder_map);
+	s->stream = NBUS_FLASH_STREAM_NONE;
+
+	*ep = NBUS_FLASH_MAIN_EP;
+	return cbor_encoder_get_buffer_size(&encoder, self->stream_buf);
+}
+
+
+static void stream_task(void *p) {
+	NbusFlash *self = p;
+
+	while (true) {
+		xSemaphoreTake(self->lock, portMAX_DELAY);
+		struct nbus_flash_session *s = NULL;
+		for (size_t i = 0; i < NBUS_FLASH_MAX_SESSIONS; i++) {
+			size_t n = (self->stream_next + i) % NBUS_FLASH_MAX_SESSIONS;
+			if (self->sessions[n].flash != NULL && self->sessions[n].stream == NBUS_FLASH_STREAM_READ) {
+				s = &self->sessions[n];
+				self->stream_next = (n + 1) % NBUS_FLASH_MAX_SESSIONS;
+				break;
+			}
+		}
+		if (s == NULL) {
+			xSemaphoreGive(self->lock);
+			xSemaphoreTake(self->stream_wake, portMAX_DELAY);
+			continue;
+		}
+
+		nbus_endpoint_t ep = 0;
+		size_t len = stream_read_block(self, s, &ep);
+		xSemaphoreGive(self->lock);
+
+		/* Blocks until the packet is sent, the bus paces the stream. */
+		nbus_channel_send(&self->channel, ep, self->stream_buf, len);
 	}
 
 	vTaskDelete(NULL);
@@ -342,11 +672,22 @@ nbus_flash_ret_t nbus_flash_init(NbusFlash *self, NbusChannel *parent, const cha
 	nbus_channel_set_interface(&self->channel, NBUS_FLASH_INTERFACE_NAME, NBUS_FLASH_INTERFACE_VERSION);
 	nbus_add_channel(parent->nbus, &self->channel);
 
+	self->lock = xSemaphoreCreateMutex();
+	self->stream_wake = xSemaphoreCreateBinary();
+	if (self->lock == NULL || self->stream_wake == NULL) {
+		return NBUS_FLASH_RET_FAILED;
+	}
+
 	xTaskCreate(nbus_task, "nbus-flash", configMINIMAL_STACK_SIZE + 256, (void *)self, 1, &(self->nbus_task));
 	if (self->nbus_task == NULL) {
 		return NBUS_FLASH_RET_FAILED;
 	}
 
+	xTaskCreate(stream_task, "nbus-flash-st", configMINIMAL_STACK_SIZE + 256, (void *)self, 1, &(self->stream_task));
+	if (self->stream_task == NULL) {
+		return NBUS_FLASH_RET_FAILED;
+	}
+
 	return NBUS_FLASH_RET_OK;
 }
 
@@ -14,14 +14,49 @@
 #include <main.h>
 #include <services/nbus/nbus.h>
 #include <interfaces/flash.h>
+#include <blake2.h>
 
+/**
+ * Commands are CBOR maps sent to NBUS_FLASH_MAIN_EP, key "c" contains the command
+ * name. Flash devices are accessed through sessions, up to NBUS_FLASH_MAX_SESSIONS
+ * sessions may be opened concurrently.
+ *
+ * Besides the single block read and write commands, a whole range can be transferred
+ * in a streaming mode. Data blocks are sent to NBUS_FLASH_DATA_EP as binary packets
+ * (struct nbus_flash_data_msg followed by up to bl bytes). The block size bl is the
+ * page size of the device reduced to fit NBUS_FLASH_DATA_LEN, it is returned by the
+ * info, sread and swrite commands. The range is split into blocks at addresses
+ * aligned to bl, the first block is shorter if the range starts unaligned. No block
+ * crosses a page boundary.
+ *
+ * - sread (sid, addr, len) - blocks of the range are pushed back-to-back. The last
+ *   block is followed by a map {sid, seq, h} on the main endpoint, where seq is the
+ *   number of blocks sent and h is the BLAKE2s-128 hash of the range.
+ * - swrite (sid, addr, len) - the device responds with {sid, next, win}, the host
+ *   sends blocks starting with next. The device acknowledges every win blocks with
+ *   {sid, next} and the whole range with {sid, next, h}. A missing block is reported
+ *   immediately by an acknowledgement, the host continues with next. Repeating swrite
+ *   with the same range resumes an interrupted transfer.
+ */
 
 #define NBUS_FLASH_MAIN_EP 1
-#define NBUS_FLASH_RX_BUF_LEN 320
+#define NBUS_FLASH_DATA_EP 2
+#define NBUS_FLASH_RX_BUF_LEN NBUS_CHANNEL_MTU
 #define NBUS_FLASH_TX_BUF_LEN 320
 #define NBUS_FLASH_INTERFACE_NAME "flash"
-#define NBUS_FLASH_INTERFACE_VERSION "1.0.0"
+#define NBUS_FLASH_INTERFACE_VERSION "1.1.0"
 #define NBUS_FLASH_BLOCK_LEN 256
+#define NBUS_FLASH_MAX_SESSIONS 4
+
+/* Streaming mode block size and the number of blocks acknowledged at once. */
+#define NBUS_FLASH_DATA_LEN (NBUS_CHANNEL_MTU - sizeof(struct nbus_flash_data_msg))
+#define NBUS_FLASH_ACK_BATCH 8
+#define NBUS_FLASH_HASH_LEN 16
+
+struct __attribute__((__packed__)) nbus_flash_data_msg {
+	uint32_t sid;
+	uint32_t seq;
+};
 
 typedef enum {
 	NBUS_FLASH_RET_OK = 0,
@@ -29,16 +64,51 @@ typedef enum {
 } nbus_flash_ret_t;
 
 
+enum nbus_flash_stream {
+	NBUS_FLASH_STREAM_NONE = 0,
+	NBUS_FLASH_STREAM_READ,
+	NBUS_FLASH_STREAM_WRITE,
+};
+
+struct nbus_flash_session {
+	/* NULL if the session is not opened. */
+	Flash *flash;
+	uint32_t sid;
+	/* Streaming mode block size, see nbus_flash_block_len(). */
+	uint32_t block_len;
+
+	/* Range of the streaming transfer in progress. */
+	enum nbus_flash_stream stream;
+	uint32_t addr;
+	uint32_t len;
+
+	/* Next block to be sent or expected, bytes transferred so far. */
+	uint32_t seq;
+	uint32_t pos;
+	uint32_t unacked;
+	/* A missing block was already reported. */
+	bool gap;
+	blake2s_state hash;
+};
+
+
 typedef struct nbus_flash {
 	NbusChannel channel;
 	TaskHandle_t nbus_task;
 	uint8_t rx_buf[NBUS_FLASH_RX_BUF_LEN];
 	uint8_t tx_buf[NBUS_FLASH_TX_BUF_LEN];
 
-	/* Single session support now. */
-	uint32_t sid;
-	Flash *flash;
+	struct nbus_flash_session sessions[NBUS_FLASH_MAX_SESSIONS];
+	uint32_t next_sid;
+	SemaphoreHandle_t lock;
 
+	/* Streaming reads are sent by a separate task, sessions are served round-robin. */
+	TaskHandle_t stream_task;
+	SemaphoreHandle_t stream_wake;
+	size_t stream_next;
+	/* Session with a streaming read to be started after the response is sent. */
+	struct nbus_flash_session *stream_pending;
+	uint8_t stream_buf[NBUS_CHANNEL_MTU];
 } NbusFlash;
 
 
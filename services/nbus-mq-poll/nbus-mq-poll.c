@@ -26,14 +26,15 @@
 static nbus_mq_ret_t prepare_buffer(NbusMq *self, struct nbus_mq_msg_buffer *buf) {
 	buf->state = NBUS_MQ_MB_STATE_ACTIVE;
 	buf->len = 0;
+	buf->msgs = 0;
 
 	/* Encode header. */
 	uint8_t cbor[128];
 	CborEncoder encoder;
 	cbor_encoder_init(&encoder, cbor, sizeof(cbor), 0);
-	cbor_encode_text_stringz(&encoder, "h");
+	cbor_encode_uint(&encoder, NBUS_MQ_KEY_HOST);
 	cbor_encode_text_stringz(&encoder, identity_device_name);
-	cbor_encode_text_stringz(&encoder, "d");
+	cbor_encode_uint(&encoder, NBUS_MQ_KEY_MSGS);
 	size_t cbor_len = cbor_encoder_get_buffer_size(&encoder, cbor);
 
 	/* Start a top level CBOR map */
@@ -55,6 +56,7 @@ static nbus_mq_ret_t close_buffer(NbusMq *self, struct nbus_mq_msg_buffer *buf)
 	/* Close the map container. */
 	buf->data[buf->len++] = 0xff;
 
+	buf->seq = self->msg_buffer_seq++;
 	buf->state = NBUS_MQ_MB_STATE_FULL;
 	return NBUS_MQ_RET_OK;
 }
@@ -90,10 +92,11 @@ static struct nbus_mq_msg_buffer *get_active_buffer(NbusMq *self) {
 static struct nbus_mq_msg_buffer *get_ready_buffer(NbusMq *self) {
 	struct nbus_mq_msg_buffer *b = NULL;
 
+	/* Select the oldest one, parts of a split array must be sent in order. */
 	for (size_t i = 0; i < NBUS_MQ_MSG_BUFFERS; i++) {
-		if (self->msg_buffers[i].state == NBUS_MQ_MB_STATE_FULL) {
-			b = &(self->msg_buffers[i]);
-			break;
+		struct nbus_mq_msg_buffer *f = &(self->msg_buffers[i]);
+		if (f->state == NBUS_MQ_MB_STATE_FULL && (b == NULL || (int32_t)(f->seq - b->seq) < 0)) {
+			b = f;
 		}
 	}
 
@@ -101,58 +104,113 @@ static struct nbus_mq_msg_buffer *get_ready_buffer(NbusMq *self) {
 }
 
 
-static nbus_mq_ret_t save_msg_to_buffer(NbusMq *self, const char *topic, NdArray *ndarray, struct timespec *ts) {
+/* RFC 8746 typed array tags (little endian). */
+static const uint8_t typed_array_tag[] = {
+	[DTYPE_UINT8] = 64,
+	[DTYPE_UINT16] = 69,
+	[DTYPE_UINT32] = 70,
+	[DTYPE_UINT64] = 71,
+	[DTYPE_INT8] = 72,
+	[DTYPE_INT16] = 77,
+	[DTYPE_INT32] = 78,
+	[DTYPE_INT64] = 79,
+	[DTYPE_FLOAT] = 85,
+	[DTYPE_DOUBLE] = 86,
+};
+
+
+/* Maximum length of an encoded message excluding the array data. */
+static size_t msg_overhead(const char *topic) {
+	/* Map header, 5 keys, 64 bit timestamp, topic string header, 32 bit offset
+	 * and total, typed array tag, byte string header up to 65535 bytes. */
+	return 1 + 5 + 9 + 3 + strlen(topic) + 2 * 5 + 2 + 3;
+}
 
-	/* Encode CBOR here */
-	/** @todo meh! */
-	uint8_t cbor[128];
-	CborEncoder encoder;
-	cbor_encoder_init(&encoder, cbor, sizeof(cbor), 0);
 
-	cbor_encode_text_stringz(&encoder, "ts");
-	cbor_encode_uint(&encoder, ts->tv_sec);
-	cbor_encode_text_stringz(&encoder, "to");
-	cbor_encode_text_stringz(&encoder, topic);
-	cbor_encode_text_stringz(&encoder, "v");
+static nbus_mq_ret_t encode_msg(uint8_t *buf, size_t size, size_t *len, const char *topic, NdArray *ndarray, struct timespec *ts, size_t offset, size_t count) {
+	bool split = count < ndarray->asize;
+	const uint8_t *data = (const uint8_t *)ndarray->buf + offset * ndarray->dsize;
+	size_t data_len = count * ndarray->dsize;
+
+	CborEncoder encoder;
+	CborEncoder map;
+	cbor_encoder_init(&encoder, buf, size, 0);
+	cbor_encoder_create_map(&encoder, &map, split ? 5 : 3);
+
+	cbor_encode_uint(&map, NBUS_MQ_KEY_TS);
+	cbor_encode_uint(&map, ts->tv_sec);
+	cbor_encode_uint(&map, NBUS_MQ_KEY_TOPIC);
+	cbor_encode_text_stringz(&map, topic);
+	cbor_encode_uint(&map, NBUS_MQ_KEY_VALUE);
 	switch (ndarray->dtype) {
-		case DTYPE_FLOAT:
-			cbor_encode_float(&encoder, *(float *)ndarray->buf);
+		case DTYPE_CHAR:
+			cbor_encode_text_string(&map, (const char *)data, data_len);
+			break;
+		case DTYPE_BYTE:
+			cbor_encode_byte_string(&map, data, data_len);
 			break;
 		default:
-			cbor_encode_undefined(&encoder);
-	}
-	size_t cbor_len = cbor_encoder_get_buffer_size(&encoder, cbor);
-
-	struct nbus_mq_msg_buffer *b = get_active_buffer(self);
-	if (b == NULL) {
-		/* Ok nope, no buffer to save the message to */
-		return NBUS_MQ_RET_FAILED;
+			cbor_encode_tag(&map, typed_array_tag[ndarray->dtype]);
+			cbor_encode_byte_string(&map, data, data_len);
+			break;
 	}
-	/* Always keep 2bytes for finishing both array and map and 2 bytes for start/finish of the current value map. */
-	if ((2 + cbor_len + 2 + b->len) > NBUS_MQ_MSG_BUFFER_SIZE) {
-		/* We had some buffer but unfortunately there was not enough space.
-		 * Try to find a new one. */
-		close_buffer(self, b);
-		b = get_active_buffer(self);
+	if (split) {
+		cbor_encode_uint(&map, NBUS_MQ_KEY_OFFSET);
+		cbor_encode_uint(&map, offset);
+		cbor_encode_uint(&map, NBUS_MQ_KEY_TOTAL);
+		cbor_encode_uint(&map, ndarray->asize);
 	}
-	if (b == NULL) {
-		/* Still nothing, no new buffer can be found (all full). */
+	cbor_encoder_close_container(&encoder, &map);
+
+	if (cbor_encoder_get_extra_bytes_needed(&encoder) > 0) {
 		return NBUS_MQ_RET_FAILED;
 	}
+	*len = cbor_encoder_get_buffer_size(&encoder, buf);
+	return NBUS_MQ_RET_OK;
+}
 
-	/* Start a map. */
-	b->data[b->len++] = 0xbf;
-
-	memcpy(b->data + b->len, cbor, cbor_len);
-	b->len += cbor_len;
 
-	/* Finish the map. */
-	b->data[b->len++] = 0xff;
+static nbus_mq_ret_t save_msg_to_buffer(NbusMq *self, const char *topic, NdArray *ndarray, struct timespec *ts) {
+	/* Always keep 2 bytes for finishing both array and map. */
+	const size_t max_len = NBUS_MQ_MSG_BUFFER_SIZE - 2;
+	size_t overhead = msg_overhead(topic);
+
+	size_t offset = 0;
+	do {
+		struct nbus_mq_msg_buffer *b = get_active_buffer(self);
+		if (b == NULL) {
+			/* Ok nope, no buffer to save the message to (all full). */
+			return NBUS_MQ_RET_FAILED;
+		}
 
-	// u_log(system_log, LOG_TYPE_DEBUG, U_LOG_MODULE_PREFIX("added len %u to buf %p, cur len %u"), cbor_len, b, b->len);
+		size_t count = ndarray->asize - offset;
+		size_t space = 0;
+		if ((b->len + overhead) < max_len) {
+			space = (max_len - b->len - overhead) / ndarray->dsize;
+		}
+		if (count > space) {
+			/* The rest of the array doesn't fit. Split it only if a reasonable part
+			 * fits, otherwise try to find a new buffer first. */
+			if (b->msgs > 0 && (space * ndarray->dsize) < (NBUS_MQ_MSG_BUFFER_SIZE / 4)) {
+				close_buffer(self, b);
+				continue;
+			}
+			if (space == 0) {
+				/* Not even a single sample fits an empty buffer. */
+				return NBUS_MQ_RET_FAILED;
+			}
+			count = space;
+		}
 
+		size_t len = 0;
+		if (encode_msg(b->data + b->len, max_len - b->len, &len, topic, ndarray, ts, offset, count) != NBUS_MQ_RET_OK) {
+			return NBUS_MQ_RET_FAILED;
+		}
+		b->len += len;
+		b->msgs++;
+		offset += count;
+	} while (offset < ndarray->asize);
 
-	/** @todo continue here */
 	return NBUS_MQ_RET_OK;
 }
 
@@ -233,7 +291,7 @@ nbus_mq_ret_t nbus_mq_start(NbusMq *self, const char *topic) {
 	self->mqc->vmt->subscribe(self->mqc, topic);
 
 	/** @todo how to allocate the ndarray to hold received messages? */
-	if (ndarray_init_empty(&self->rx_buf, DTYPE_UINT8, NBUS_MQ_MSG_BUFFER_SIZE) != NDARRAY_RET_OK) {
+	if (ndarray_init_empty(&self->rx_buf, DTYPE_UINT8, NBUS_MQ_RX_BUF_SIZE) != NDARRAY_RET_OK) {
 		goto err;
 	}
 
@@ -16,13 +16,47 @@
 #include <interfaces/mq.h>
 #include <types/ndarray.h>
 
+/**
+ * Messages received from the message queue are serialised into buffers sent
+ * as a response to a request on endpoint 1. A buffer is a CBOR map:
+ *
+ *     {0: <device name>, 1: [<message>, <message>, ...]}
+ *
+ * Each message is a CBOR map with integer keys:
+ *
+ *     0 - timestamp (seconds)
+ *     1 - topic
+ *     2 - value, all samples of the NdArray. Numeric dtypes are encoded as
+ *         a RFC 8746 little endian typed array (a tagged byte string),
+ *         DTYPE_CHAR as a text string and DTYPE_BYTE as a plain byte string.
+ *     3 - index of the first sample, present only if the array was split
+ *     4 - number of samples of the whole array, present only if the array was split
+ *
+ * Arrays not fitting the space left in a buffer are split into several messages,
+ * possibly spanning multiple buffers (nbus packets).
+ */
 
-/* Maximum length of the CBOR array containing serialised messages (in bytes). */
-#define NBUS_MQ_MSG_BUFFER_SIZE 128
+/* Maximum length of the CBOR array containing serialised messages (in bytes).
+ * Every buffer is sent as a single nbus packet. */
+#define NBUS_MQ_MSG_BUFFER_SIZE 256
 #define NBUS_MQ_MSG_BUFFERS 4
 #define NBUS_MQ_MAX_TOPIC_LEN 32
 #define NBUS_MQ_NBUS_BUF_LEN 256
 
+/* Maximum size of a received NdArray (in bytes). */
+#define NBUS_MQ_RX_BUF_SIZE 512
+
+/* Buffer map keys */
+#define NBUS_MQ_KEY_HOST 0
+#define NBUS_MQ_KEY_MSGS 1
+
+/* Message map keys */
+#define NBUS_MQ_KEY_TS 0
+#define NBUS_MQ_KEY_TOPIC 1
+#define NBUS_MQ_KEY_VALUE 2
+#define NBUS_MQ_KEY_OFFSET 3
+#define NBUS_MQ_KEY_TOTAL 4
+
 
 typedef enum {
 	NBUS_MQ_RET_OK = 0,
@@ -39,7 +73,11 @@ struct nbus_mq_msg_buffer {
 	enum nbus_mq_msg_buffer_state state;
 	uint8_t data[NBUS_MQ_MSG_BUFFER_SIZE];
 	size_t len;
+	size_t msgs;
 	time_t time_base;
+
+	/* Buffers are sent in the order they were filled. */
+	uint32_t seq;
 };
 
 
@@ -51,6 +89,7 @@ typedef struct nbus_mq {
 
 	/* Input message buffers. */
 	struct nbus_mq_msg_buffer msg_buffers[NBUS_MQ_MSG_BUFFERS];
+	uint32_t msg_buffer_seq;
 
 	/* Message queue reception */
 	Mq *mq;
@@ -0,0 +1,631 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * NBUS message queue bridge tests
+ *
+ * Copyright (c) 2023, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include <main.h>
+#include "u_test.h"
+
+#include <interfaces/can.h>
+#include <interfaces/mq.h>
+#include <types/ndarray.h>
+#include <services/nbus/nbus.h>
+#include "nbus-mq.h"
+#include "nbus-mq-tests.h"
+
+#ifdef MODULE_NAME
+#undef MODULE_NAME
+#endif
+#define MODULE_NAME "nbus-mq-tests"
+
+/**
+ * The bridge receives messages from a Mq stand-in and it is connected to
+ * a peer channel over a loopback CAN bus. The peer channel has the same
+ * parent short-id and name, hence the same channel-id. Arrays are published
+ * one by one, followed by a filler message closing the buffer. Buffers are
+ * requested until an empty one is received and parts of the array are
+ * assembled and compared with the published one.
+ */
+#define NBUS_MQ_TEST_QUEUE_LEN 64
+#define NBUS_MQ_TEST_TIMEOUT_MS 1000
+#define NBUS_MQ_TEST_SHORT_ID 0x7e571000
+#define NBUS_MQ_TEST_NAME "mq-test"
+#define NBUS_MQ_TEST_FILLER_TOPIC "test/filler"
+#define NBUS_MQ_TEST_FILLER_LEN 200
+#define NBUS_MQ_TEST_BASE_TIME 1700000000
+#define NBUS_MQ_TEST_INDEFINITE UINT64_MAX
+
+/* CBOR major types */
+#define CBOR_UINT 0
+#define CBOR_BYTES 2
+#define CBOR_TEXT 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+#define CBOR_TAG 6
+#define CBOR_SIMPLE 7
+
+struct nbus_mq_test_msg {
+	char topic[NBUS_MQ_MAX_TOPIC_LEN];
+	struct timespec ts;
+	enum dtype dtype;
+	size_t asize;
+	uint8_t data[NBUS_MQ_RX_BUF_SIZE];
+};
+
+/* One side of the loopback bus, advertisements are dropped as the bridge
+ * and the peer channel use the same short-id. */
+struct nbus_mq_test_port {
+	Can can;
+	QueueHandle_t rx;
+	struct nbus_mq_test_port *peer;
+};
+
+struct nbus_mq_test {
+	struct nbus_mq_test_port port[2];
+	Nbus nbus[2];
+	NbusChannel parent[2];
+	NbusChannel peer;
+	NbusMq bridge;
+
+	/* Mq stand-in, the message is saved by the bridge when it asks for the next one. */
+	Mq mq;
+	MqClient client;
+	QueueHandle_t mq_rx;
+	SemaphoreHandle_t mq_done;
+	bool mq_pending;
+	struct nbus_mq_test_msg rx_msg;
+
+	/* The array published and the array assembled from the buffers received. */
+	struct nbus_mq_test_msg expected;
+	struct nbus_mq_test_msg received;
+	size_t received_len;
+	size_t parts;
+	uint32_t errors;
+
+	uint8_t buf[NBUS_MQ_NBUS_BUF_LEN];
+};
+
+/* A message decoded from a buffer. */
+struct nbus_mq_test_part {
+	char topic[NBUS_MQ_MAX_TOPIC_LEN];
+	uint64_t ts;
+	enum dtype dtype;
+	const uint8_t *data;
+	size_t len;
+	bool split;
+	uint64_t offset;
+	uint64_t total;
+};
+
+/* The bridge channel cannot be removed from the nbus instance, the test
+ * setup is created on the first run and never freed. */
+static struct nbus_mq_test *nbus_mq_test = NULL;
+
+/* RFC 8746 typed array tags (little endian) */
+static const uint64_t nbus_mq_test_tags[] = {
+	[DTYPE_CHAR] = 0,
+	[DTYPE_BYTE] = 0,
+	[DTYPE_INT8] = 72,
+	[DTYPE_UINT8] = 64,
+	[DTYPE_INT16] = 77,
+	[DTYPE_UINT16] = 69,
+	[DTYPE_INT32] = 78,
+	[DTYPE_UINT32] = 70,
+	[DTYPE_INT64] = 79,
+	[DTYPE_UINT64] = 71,
+	[DTYPE_FLOAT] = 85,
+	[DTYPE_DOUBLE] = 86,
+};
+
+
+static can_ret_t nbus_mq_test_port_send(Can *can, const struct can_message *msg, uint32_t timeout_ms) {
+	struct nbus_mq_test_port *self = can->parent;
+
+	struct nbus_id id;
+	nbus_parse_id(msg->id, &id);
+	if (id.opcode == NBUS_OP_ADVERTISEMENT) {
+		return CAN_RET_OK;
+	}
+	if (xQueueSend(self->peer->rx, msg, pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+		return CAN_RET_FAILED;
+	}
+	return CAN_RET_OK;
+}
+
+
+static can_ret_t nbus_mq_test_port_receive(Can *can, struct can_message *msg, uint32_t timeout_ms) {
+	struct nbus_mq_test_port *self = can->parent;
+
+	if (xQueueReceive(self->rx, msg, pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+		return CAN_RET_FAILED;
+	}
+	return CAN_RET_OK;
+}
+
+
+static const struct can_vmt nbus_mq_test_port_vmt = {
+	.send = nbus_mq_test_port_send,
+	.receive = nbus_mq_test_port_receive,
+};
+
+
+static mq_ret_t test_mq_subscribe(MqClient *self, const char *filter) {
+	(void)self;
+	(void)filter;
+	return MQ_RET_OK;
+}
+
+
+static mq_ret_t test_mq_unsubscribe(MqClient *self, const char *filter) {
+	(void)self;
+	(void)filter;
+	return MQ_RET_OK;
+}
+
+
+static mq_ret_t test_mq_receive(MqClient *client, char *topic, size_t topic_size, struct ndarray *array, struct timespec *ts) {
+	struct nbus_mq_test *self = (struct nbus_mq_test *)client->parent->parent;
+	struct nbus_mq_test_msg *msg = &self->rx_msg;
+
+	/* The previous message was saved meanwhile. */
+	if (self->mq_pending) {
+		self->mq_pending = false;
+		xSemaphoreGive(self->mq_done);
+	}
+	if (xQueueReceive(self->mq_rx, msg, pdMS_TO_TICKS(100)) != pdTRUE) {
+		return MQ_RET_TIMEOUT;
+	}
+	self->mq_pending = true;
+
+	size_t dsize = ndarray_get_dsize(msg->dtype);
+	if (msg->asize * dsize > array->bufsize) {
+		return MQ_RET_FAILED;
+	}
+	strlcpy(topic, msg->topic, topic_size);
+	*ts = msg->ts;
+	array->dtype = msg->dtype;
+	array->dsize = dsize;
+	array->asize = msg->asize;
+	memcpy(array->buf, msg->data, msg->asize * dsize);
+	return MQ_RET_OK;
+}
+
+
+static mq_ret_t test_mq_publish(MqClient *client, const char *topic, const struct ndarray *array, const struct timespec *ts) {
+	(void)client;
+	(void)topic;
+	(void)array;
+	(void)ts;
+	return MQ_RET_FAILED;
+}
+
+
+static mq_ret_t test_mq_close(MqClient *self) {
+	(void)self;
+	return MQ_RET_OK;
+}
+
+
+static mq_ret_t test_mq_set_timeout(MqClient *client, uint32_t timeout_ms) {
+	(void)client;
+	(void)timeout_ms;
+	return MQ_RET_OK;
+}
+
+
+static struct mq_client_vmt test_mq_client_vmt = {
+	.subscribe = test_mq_subscribe,
+	.unsubscribe = test_mq_unsubscribe,
+	.receive = test_mq_receive,
+	.publish = test_mq_publish,
+	.close = test_mq_close,
+	.set_timeout = test_mq_set_timeout,
+};
+
+
+static MqClient *test_mq_open(Mq *mq) {
+	struct nbus_mq_test *self = (struct nbus_mq_test *)mq->parent;
+	return &self->client;
+}
+
+
+static const struct mq_vmt test_mq_vmt = {
+	.open = test_mq_open,
+};
+
+
+static struct nbus_mq_test *nbus_mq_test_get(void) {
+	if (nbus_mq_test != NULL) {
+		return nbus_mq_test;
+	}
+
+	struct nbus_mq_test *self = calloc(1, sizeof(struct nbus_mq_test));
+	if (self == NULL) {
+		return NULL;
+	}
+	self->mq.vmt = &test_mq_vmt;
+	self->mq.parent = self;
+	self->client.vmt = &test_mq_client_vmt;
+	self->client.parent = &self->mq;
+	self->mq_rx = xQueueCreate(1, sizeof(struct nbus_mq_test_msg));
+	self->mq_done = xSemaphoreCreateBinary();
+	if (self->mq_rx == NULL || self->mq_done == NULL) {
+		return NULL;
+	}
+
+	for (size_t i = 0; i < 2; i++) {
+		struct nbus_mq_test_port *port = &self->port[i];
+		port->can.vmt = &nbus_mq_test_port_vmt;
+		port->can.parent = port;
+		port->peer = &self->port[1 - i];
+		port->rx = xQueueCreate(NBUS_MQ_TEST_QUEUE_LEN, sizeof(struct can_message));
+		if (port->rx == NULL || nbus_init(&self->nbus[i], &port->can) != NBUS_RET_OK) {
+			return NULL;
+		}
+		if (nbus_channel_init(&self->parent[i], "test") != NBUS_RET_OK) {
+			return NULL;
+		}
+		nbus_channel_set_explicit_short_id(&self->parent[i], NBUS_MQ_TEST_SHORT_ID);
+	}
+
+	/* The bridge is added to the instance of its parent, the peer channel
+	 * gets the same short-id derived from the parent on the other side. */
+	if (nbus_add_channel(&self->nbus[0], &self->parent[0]) != NBUS_RET_OK ||
+	    nbus_mq_init(&self->bridge, &self->mq, &self->parent[0], NBUS_MQ_TEST_NAME) != NBUS_MQ_RET_OK) {
+		return NULL;
+	}
+	if (nbus_channel_init(&self->peer, NBUS_MQ_TEST_NAME) != NBUS_RET_OK) {
+		return NULL;
+	}
+	nbus_channel_set_parent(&self->peer, &self->parent[1]);
+	if (nbus_add_channel(&self->nbus[1], &self->peer) != NBUS_RET_OK) {
+		return NULL;
+	}
+
+	nbus_mq_test = self;
+	return self;
+}
+
+
+/* CBOR reader. Indefinite length items have NBUS_MQ_TEST_INDEFINITE length. */
+struct cbor_reader {
+	const uint8_t *buf;
+	size_t len;
+};
+
+static bool reader_head(struct cbor_reader *r, uint8_t *major, uint64_t *v) {
+	if (r->len == 0) {
+		return false;
+	}
+	uint8_t b = *r->buf++;
+	r->len--;
+	*major = b >> 5;
+	uint8_t ai = b & 0x1f;
+	if (ai < 24) {
+		*v = ai;
+		return true;
+	}
+	if (ai == 31) {
+		*v = NBUS_MQ_TEST_INDEFINITE;
+		return true;
+	}
+	if (ai > 27) {
+		return false;
+	}
+	size_t n = 1U << (ai - 24);
+	if (r->len < n) {
+		return false;
+	}
+	*v = 0;
+	for (size_t i = 0; i < n; i++) {
+		*v = (*v << 8) | *r->buf++;
+	}
+	r->len -= n;
+	return true;
+}
+
+
+static bool reader_uint(struct cbor_reader *r, uint64_t *v) {
+	uint8_t major = 0;
+	return reader_head(r, &major, v) && major == CBOR_UINT;
+}
+
+
+static bool reader_string(struct cbor_reader *r, uint8_t major, const uint8_t **data, size_t *len) {
+	uint8_t m = 0;
+	uint64_t v = 0;
+	if (!reader_head(r, &m, &v) || m != major || v > r->len) {
+		return false;
+	}
+	*data = r->buf;
+	*len = v;
+	r->buf += v;
+	r->len -= v;
+	return true;
+}
+
+
+static bool reader_break(struct cbor_reader *r) {
+	if (r->len > 0 && *r->buf == 0xff) {
+		r->buf++;
+		r->len--;
+		return true;
+	}
+	return false;
+}
+
+
+/* Value of a message, the dtype is selected by the typed array tag. */
+static bool reader_value(struct cbor_reader *r, struct nbus_mq_test_part *part) {
+	if (r->len == 0) {
+		return false;
+	}
+	uint8_t major = *r->buf >> 5;
+	if (major == CBOR_TEXT) {
+		part->dtype = DTYPE_CHAR;
+		return reader_string(r, CBOR_TEXT, &part->data, &part->len);
+	}
+	if (major == CBOR_BYTES) {
+		part->dtype = DTYPE_BYTE;
+		return reader_string(r, CBOR_BYTES, &part->data, &part->len);
+	}
+
+	uint64_t tag = 0;
+	if (!reader_head(r, &major, &tag) || major != CBOR_TAG) {
+		return false;
+	}
+	for (enum dtype dtype = DTYPE_INT8; dtype <= DTYPE_DOUBLE; dtype++) {
+		if (nbus_mq_test_tags[dtype] == tag) {
+			part->dtype = dtype;
+			return reader_string(r, CBOR_BYTES, &part->data, &part->len);
+		}
+	}
+	u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("unknown tag %u"), (uint32_t)tag);
+	return false;
+}
+
+
+static bool reader_msg(struct cbor_reader *r, struct nbus_mq_test_part *part) {
+	memset(part, 0, sizeof(struct nbus_mq_test_part));
+	uint8_t major = 0;
+	uint64_t n = 0;
+	if (!reader_head(r, &major, &n) || major != CBOR_MAP) {
+		return false;
+	}
+
+	bool total = false;
+	for (uint64_t i = 0; i < n; i++) {
+		uint64_t key = 0;
+		const uint8_t *topic = NULL;
+		size_t topic_len = 0;
+		if (!reader_uint(r, &key)) {
+			return false;
+		}
+		switch (key) {
+			case NBUS_MQ_KEY_TS:
+				if (!reader_uint(r, &part->ts)) {
+					return false;
+				}
+				break;
+			case NBUS_MQ_KEY_TOPIC:
+				if (!reader_string(r, CBOR_TEXT, &topic, &topic_len) || topic_len >= sizeof(part->topic)) {
+					return false;
+				}
+				memcpy(part->topic, topic, topic_len);
+				break;
+			case NBUS_MQ_KEY_VALUE:
+				if (!reader_value(r, part)) {
+					return false;
+				}
+				break;
+			case NBUS_MQ_KEY_OFFSET:
+				part->split = true;
+				if (!reader_uint(r, &part->offset)) {
+					return false;
+				}
+				break;
+			case NBUS_MQ_KEY_TOTAL:
+				total = true;
+				if (!reader_uint(r, &part->total)) {
+					return false;
+				}
+				break;
+			default:
+				return false;
+		}
+	}
+	/* The offset and the total count are present only together. */
+	return part->split == total;
+}
+
+
+/* Append a part of the array published, parts of other arrays are ignored. */
+static void nbus_mq_test_append(struct nbus_mq_test *self, const struct nbus_mq_test_part *part) {
+	struct nbus_mq_test_msg *e = &self->expected;
+	if (strcmp(part->topic, e->topic) != 0) {
+		return;
+	}
+
+	size_t dsize = ndarray_get_dsize(e->dtype);
+	size_t offset = part->split ? part->offset : 0;
+	size_t total = part->split ? part->total : part->len / dsize;
+	if (part->dtype != e->dtype || part->ts != (uint64_t)e->ts.tv_sec || total != e->asize ||
+	    offset * dsize != self->received_len || (part->len % dsize) != 0 ||
+	    self->received_len + part->len > sizeof(self->received.data)) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("unexpected part of %s at %u"), part->topic, offset);
+		self->errors++;
+		return;
+	}
+	memcpy(self->received.data + self->received_len, part->data, part->len);
+	self->received_len += part->len;
+	self->parts++;
+}
+
+
+/* Decode a buffer, return the number of messages it contains. */
+static bool nbus_mq_test_decode(struct nbus_mq_test *self, const uint8_t *buf, size_t len, size_t *msgs) {
+	struct cbor_reader r = {.buf = buf, .len = len};
+	uint8_t major = 0;
+	uint64_t v = 0;
+	*msgs = 0;
+
+	if (!reader_head(&r, &major, &v) || major != CBOR_MAP || v != NBUS_MQ_TEST_INDEFINITE) {
+		return false;
+	}
+	if (reader_break(&r)) {
+		/* An empty map, nothing to send. */
+		return r.len == 0;
+	}
+
+	const uint8_t *host = NULL;
+	size_t host_len = 0;
+	if (!reader_uint(&r, &v) || v != NBUS_MQ_KEY_HOST || !reader_string(&r, CBOR_TEXT, &host, &host_len)) {
+		return false;
+	}
+	if (!reader_uint(&r, &v) || v != NBUS_MQ_KEY_MSGS || !reader_head(&r, &major, &v) || major != CBOR_ARRAY) {
+		return false;
+	}
+	while (!reader_break(&r)) {
+		struct nbus_mq_test_part part;
+		if (!reader_msg(&r, &part)) {
+			return false;
+		}
+		nbus_mq_test_append(self, &part);
+		(*msgs)++;
+	}
+	return reader_break(&r) && r.len == 0;
+}
+
+
+static bool nbus_mq_test_publish(struct nbus_mq_test *self, const struct nbus_mq_test_msg *msg) {
+	xSemaphoreTake(self->mq_done, 0);
+	if (xQueueSend(self->mq_rx, msg, pdMS_TO_TICKS(NBUS_MQ_TEST_TIMEOUT_MS)) != pdTRUE) {
+		return false;
+	}
+	return xSemaphoreTake(self->mq_done, pdMS_TO_TICKS(NBUS_MQ_TEST_TIMEOUT_MS)) == pdTRUE;
+}
+
+
+/* Request buffers until an empty one is received. */
+static bool nbus_mq_test_drain(struct nbus_mq_test *self) {
+	for (size_t i = 0; i <= NBUS_MQ_MSG_BUFFERS; i++) {
+		uint8_t req = 0;
+		if (nbus_channel_send(&self->peer, 1, &req, sizeof(req)) != NBUS_RET_OK) {
+			return false;
+		}
+		nbus_endpoint_t ep = 0;
+		size_t len = 0;
+		if (nbus_channel_receive(&self->peer, &ep, self->buf, sizeof(self->buf), &len, NBUS_MQ_TEST_TIMEOUT_MS) != NBUS_RET_OK || ep != 1) {
+			u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("no response"));
+			return false;
+		}
+		size_t msgs = 0;
+		if (!nbus_mq_test_decode(self, self->buf, len, &msgs)) {
+			u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("cannot decode a buffer"));
+			return false;
+		}
+		if (msgs == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+
+static bool nbus_mq_test_round_trip(struct nbus_mq_test *self, enum dtype dtype, size_t asize, uint32_t seed) {
+	struct nbus_mq_test_msg *e = &self->expected;
+	memset(e, 0, sizeof(struct nbus_mq_test_msg));
+	snprintf(e->topic, sizeof(e->topic), "test/%u/%u", dtype, (uint32_t)asize);
+	e->ts.tv_sec = NBUS_MQ_TEST_BASE_TIME + seed;
+	e->dtype = dtype;
+	e->asize = asize;
+	size_t len = asize * ndarray_get_dsize(dtype);
+	for (size_t i = 0; i < len; i++) {
+		e->data[i] = (uint8_t)(seed * 31 + i * 7);
+	}
+	self->received_len = 0;
+	self->parts = 0;
+	self->errors = 0;
+
+	/* The filler doesn't fit the rest of the buffer, the buffer is closed. */
+	struct nbus_mq_test_msg *filler = &self->received;
+	memset(filler, 0, sizeof(struct nbus_mq_test_msg));
+	strlcpy(filler->topic, NBUS_MQ_TEST_FILLER_TOPIC, sizeof(filler->topic));
+	filler->dtype = DTYPE_BYTE;
+	filler->asize = NBUS_MQ_TEST_FILLER_LEN;
+	if (!nbus_mq_test_publish(self, e) || !nbus_mq_test_publish(self, filler)) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("bridge not receiving"));
+		return false;
+	}
+	memset(&self->received, 0, sizeof(struct nbus_mq_test_msg));
+	if (!nbus_mq_test_drain(self)) {
+		return false;
+	}
+
+	if (self->errors > 0 || self->parts == 0 || self->received_len != len || memcmp(self->received.data, e->data, len) != 0) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("%s: %u of %u bytes received in %u parts"), e->topic, self->received_len, len, self->parts);
+		return false;
+	}
+	return true;
+}
+
+
+static bool nbus_mq_test_start(struct nbus_mq_test *self) {
+	/* Channel-ids are assigned by the housekeeping task. */
+	TickType_t start = xTaskGetTickCount();
+	while (!self->peer.channel_id_valid || !self->bridge.channel.channel_id_valid) {
+		if ((xTaskGetTickCount() - start) > pdMS_TO_TICKS(NBUS_MQ_TEST_TIMEOUT_MS * 2)) {
+			u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("no channel-id assigned"));
+			return false;
+		}
+		vTaskDelay(pdMS_TO_TICKS(10));
+	}
+	if (self->peer.channel_id != self->bridge.channel.channel_id) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("channel-ids differ"));
+		return false;
+	}
+	if (nbus_mq_start(&self->bridge, "#") != NBUS_MQ_RET_OK) {
+		return false;
+	}
+	/* Skip buffers left from the previous run. */
+	return nbus_mq_test_drain(self);
+}
+
+
+static bool nbus_mq_test_round_trip_if_any_dtype(void) {
+	struct nbus_mq_test *self = nbus_mq_test_get();
+	if (self == NULL || !nbus_mq_test_start(self)) {
+		return false;
+	}
+
+	/* The largest arrays are split into several buffers. */
+	bool ret = true;
+	uint32_t seed = 0;
+	for (enum dtype dtype = DTYPE_CHAR; ret && dtype <= DTYPE_DOUBLE; dtype++) {
+		const size_t sizes[] = {0, 1, 7, 33, NBUS_MQ_RX_BUF_SIZE / ndarray_get_dsize(dtype)};
+		for (size_t i = 0; ret && i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+			ret = nbus_mq_test_round_trip(self, dtype, sizes[i], seed++);
+		}
+	}
+
+	nbus_mq_stop(&self->bridge);
+	return ret;
+}
+
+
+bool nbus_mq_tests(void) {
+	bool res = true;
+
+	res &= u_test(nbus_mq_test_round_trip_if_any_dtype());
+
+	return res;
+}
@@ -0,0 +1,19 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * NBUS message queue bridge tests
+ *
+ * Copyright (c) 2023, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * Publish NdArrays of every dtype and size to a bridge connected to a peer
+ * channel over a loopback CAN bus. Request the buffers, decode them and
+ * check the typed array tag, the timestamp and all samples of every array,
+ * including arrays split into several parts.
+ */
+bool nbus_mq_tests(void);
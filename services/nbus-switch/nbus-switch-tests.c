@@ -0,0 +1,370 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * nbus switch tests
+ *
+ * Copyright (c) 2023, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <main.h>
+#include "u_test.h"
+
+#include <interfaces/can.h>
+#include "nbus-switch.h"
+#include "nbus-switch-tests.h"
+#include "services/nbus/nbus.h"
+
+#ifdef MODULE_NAME
+#undef MODULE_NAME
+#endif
+#define MODULE_NAME "nbus-switch-tests"
+
+#define NBUS_SWITCH_TEST_PORTS 3
+/* Channel-ids learned in both directions, two records each. */
+#define NBUS_SWITCH_TEST_IDS 125
+/* Requests of this channel are never answered. */
+#define NBUS_SWITCH_TEST_UNKNOWN 0xfff0
+/* Frames generated by a port and not yet forwarded. Less than the egress
+ * queue length, no frames are dropped unless they are sent to several ports. */
+#define NBUS_SWITCH_TEST_CREDITS 4
+#define NBUS_SWITCH_TEST_TIMEOUT_MS 2000
+#define NBUS_SWITCH_TEST_SETTLE_MS 20
+#define NBUS_SWITCH_TEST_FRAMES 100
+#define NBUS_SWITCH_TEST_STALL_FRAMES 1000
+#define NBUS_SWITCH_TEST_BENCH_FRAMES 20000
+
+struct nbus_switch_test;
+
+/* A virtual port. Frames are generated by the receive method while the
+ * port has credits. A credit is returned to the source port of every frame
+ * the switch sends. */
+struct nbus_switch_test_port {
+	Can can;
+	struct nbus_switch_test *parent;
+	uint8_t index;
+
+	SemaphoreHandle_t credits;
+	enum nbus_direction direction;
+	const channel_t *ids;
+	size_t ids_len;
+	volatile uint32_t generate;
+	volatile uint32_t generated;
+
+	/* Sending to the port blocks for the whole timeout and fails. */
+	volatile bool stalled;
+
+	/* Frames sent to the port by the switch. */
+	volatile uint32_t received;
+	uint32_t misrouted;
+	/* Frames dropped by the switch because the port egress queue was full. */
+	uint32_t dropped;
+	uint32_t tx_dropped;
+};
+
+struct nbus_switch_test {
+	NbusSwitch sw;
+	struct nbus_switch_test_port port[NBUS_SWITCH_TEST_PORTS];
+	channel_t ids[NBUS_SWITCH_TEST_IDS];
+};
+
+/* The switch cannot be stopped, it is created on the first run and never freed. */
+static struct nbus_switch_test *nbus_switch_test = NULL;
+
+
+static can_ret_t nbus_switch_test_port_send(Can *can, const struct can_message *msg, uint32_t timeout_ms) {
+	struct nbus_switch_test_port *self = can->parent;
+
+	if (self->stalled) {
+		vTaskDelay(pdMS_TO_TICKS(timeout_ms));
+		return CAN_RET_FAILED;
+	}
+
+	uint8_t source = msg->buf[0];
+	if (source == self->index || source >= NBUS_SWITCH_TEST_PORTS) {
+		self->misrouted++;
+	} else {
+		xSemaphoreGive(self->parent->port[source].credits);
+	}
+	self->received++;
+	return CAN_RET_OK;
+}
+
+
+static can_ret_t nbus_switch_test_port_receive(Can *can, struct can_message *msg, uint32_t timeout_ms) {
+	struct nbus_switch_test_port *self = can->parent;
+
+	if (xSemaphoreTake(self->credits, pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+		return CAN_RET_FAILED;
+	}
+	if (self->generated >= self->generate) {
+		return CAN_RET_FAILED;
+	}
+
+	struct nbus_id id = {
+		.channel = self->ids[self->generated % self->ids_len],
+		.direction = self->direction,
+		.opcode = NBUS_OP_DATA_MIN,
+	};
+	memset(msg, 0, sizeof(struct can_message));
+	msg->id = nbus_build_id(&id);
+	msg->extid = true;
+	msg->len = 8;
+	msg->buf[0] = self->index;
+	self->generated++;
+
+	return CAN_RET_OK;
+}
+
+
+static const struct can_vmt nbus_switch_test_port_vmt = {
+	.send = nbus_switch_test_port_send,
+	.receive = nbus_switch_test_port_receive,
+};
+
+
+static struct nbus_switch_test *nbus_switch_test_get(void) {
+	if (nbus_switch_test != NULL) {
+		return nbus_switch_test;
+	}
+
+	struct nbus_switch_test *self = calloc(1, sizeof(struct nbus_switch_test));
+	if (self == NULL) {
+		return NULL;
+	}
+	if (nbus_switch_init(&self->sw) != NBUS_SWITCH_RET_OK) {
+		return NULL;
+	}
+	for (size_t i = 0; i < NBUS_SWITCH_TEST_PORTS; i++) {
+		struct nbus_switch_test_port *port = &self->port[i];
+		port->can.vmt = &nbus_switch_test_port_vmt;
+		port->can.parent = port;
+		port->parent = self;
+		port->index = i;
+		port->credits = xSemaphoreCreateCounting(NBUS_SWITCH_TEST_CREDITS, 0);
+		if (port->credits == NULL) {
+			return NULL;
+		}
+		if (nbus_switch_add_port(&self->sw, &port->can) != NBUS_SWITCH_RET_OK) {
+			return NULL;
+		}
+	}
+
+	/* Unique channel-ids spread over the whole range. */
+	uint32_t id = 1;
+	for (size_t i = 0; i < NBUS_SWITCH_TEST_IDS; i++) {
+		id = id * 1103515245 + 12345;
+		self->ids[i] = (channel_t)(i * (0x10000 / NBUS_SWITCH_TEST_IDS) + (id >> 16) % (0x10000 / NBUS_SWITCH_TEST_IDS));
+	}
+
+	nbus_switch_test = self;
+	return self;
+}
+
+
+/* Frames sent or dropped by the switch since the counters were cleared. */
+static uint32_t nbus_switch_test_received(struct nbus_switch_test *self) {
+	uint32_t received = 0;
+	for (size_t i = 0; i < NBUS_SWITCH_TEST_PORTS; i++) {
+		self->port[i].dropped = self->sw.ports[i].tx_dropped - self->port[i].tx_dropped;
+		received += self->port[i].received + self->port[i].dropped;
+	}
+	return received;
+}
+
+
+/**
+ * @brief Generate frames on a port and wait until they are forwarded
+ *
+ * Counters of all ports are cleared first. If @p expected is not zero, wait
+ * until the switch sends or drops @p expected frames in total and check no
+ * more frames are sent. Otherwise wait until all frames are generated and let the switch
+ * forward them.
+ */
+static bool nbus_switch_test_run(struct nbus_switch_test *self, size_t port, enum nbus_direction dir, const channel_t *ids, size_t ids_len, uint32_t frames, uint32_t expected) {
+	for (size_t i = 0; i < NBUS_SWITCH_TEST_PORTS; i++) {
+		self->port[i].received = 0;
+		self->port[i].misrouted = 0;
+		self->port[i].dropped = 0;
+		self->port[i].tx_dropped = self->sw.ports[i].tx_dropped;
+	}
+
+	struct nbus_switch_test_port *p = &self->port[port];
+	p->direction = dir;
+	p->ids = ids;
+	p->ids_len = ids_len;
+	p->generated = 0;
+	p->generate = frames;
+	for (size_t i = 0; i < NBUS_SWITCH_TEST_CREDITS; i++) {
+		xSemaphoreGive(p->credits);
+	}
+
+	TickType_t start = xTaskGetTickCount();
+	while ((expected > 0) ? (nbus_switch_test_received(self) < expected) : (p->generated < frames)) {
+		if ((xTaskGetTickCount() - start) > pdMS_TO_TICKS(NBUS_SWITCH_TEST_TIMEOUT_MS)) {
+			u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("%u frames generated, %u sent"), p->generated, nbus_switch_test_received(self));
+			return false;
+		}
+		vTaskDelay(1);
+	}
+	vTaskDelay(pdMS_TO_TICKS(NBUS_SWITCH_TEST_SETTLE_MS));
+	uint32_t received = nbus_switch_test_received(self);
+
+	for (size_t i = 0; i < NBUS_SWITCH_TEST_PORTS; i++) {
+		if (self->port[i].misrouted > 0) {
+			u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("frames sent back to the source port"));
+			return false;
+		}
+	}
+	return expected == 0 || received == expected;
+}
+
+
+/* Learn the channels in both directions, responses on port @p device. */
+static bool nbus_switch_test_learn(struct nbus_switch_test *self, size_t device, const channel_t *ids, size_t ids_len) {
+	return nbus_switch_test_run(self, device, NBUS_DIR_RESPONSE, ids, ids_len, ids_len, 0) &&
+	       nbus_switch_test_run(self, 0, NBUS_DIR_REQUEST, ids, ids_len, ids_len, 0);
+}
+
+
+static bool nbus_switch_test_forward_if_learned(void) {
+	struct nbus_switch_test *self = nbus_switch_test_get();
+	if (self == NULL || !nbus_switch_test_learn(self, 1, &self->ids[0], 1)) {
+		return false;
+	}
+
+	return nbus_switch_test_run(self, 0, NBUS_DIR_REQUEST, &self->ids[0], 1, NBUS_SWITCH_TEST_FRAMES, NBUS_SWITCH_TEST_FRAMES) &&
+	       self->port[1].received == NBUS_SWITCH_TEST_FRAMES &&
+	       nbus_switch_test_run(self, 1, NBUS_DIR_RESPONSE, &self->ids[0], 1, NBUS_SWITCH_TEST_FRAMES, NBUS_SWITCH_TEST_FRAMES) &&
+	       self->port[0].received == NBUS_SWITCH_TEST_FRAMES;
+}
+
+
+static bool nbus_switch_test_flood_if_unknown(void) {
+	struct nbus_switch_test *self = nbus_switch_test_get();
+	if (self == NULL) {
+		return false;
+	}
+	static const channel_t unknown = NBUS_SWITCH_TEST_UNKNOWN;
+
+	/* The response direction is never learned, requests are sent to all other ports. */
+	return nbus_switch_test_run(self, 0, NBUS_DIR_REQUEST, &unknown, 1, NBUS_SWITCH_TEST_FRAMES, NBUS_SWITCH_TEST_FRAMES * 2) &&
+	       self->port[1].received + self->port[1].dropped == NBUS_SWITCH_TEST_FRAMES &&
+	       self->port[2].received + self->port[2].dropped == NBUS_SWITCH_TEST_FRAMES;
+}
+
+
+static bool nbus_switch_test_forward_if_moved(void) {
+	struct nbus_switch_test *self = nbus_switch_test_get();
+	if (self == NULL || !nbus_switch_test_learn(self, 1, &self->ids[1], 1)) {
+		return false;
+	}
+
+	/* The device answers from another port, requests follow it. */
+	return nbus_switch_test_run(self, 2, NBUS_DIR_RESPONSE, &self->ids[1], 1, 1, 1) &&
+	       self->port[0].received == 1 &&
+	       nbus_switch_test_run(self, 0, NBUS_DIR_REQUEST, &self->ids[1], 1, NBUS_SWITCH_TEST_FRAMES, NBUS_SWITCH_TEST_FRAMES) &&
+	       self->port[2].received == NBUS_SWITCH_TEST_FRAMES;
+}
+
+
+static bool nbus_switch_test_drop_if_same_port(void) {
+	struct nbus_switch_test *self = nbus_switch_test_get();
+	if (self == NULL || !nbus_switch_test_learn(self, 0, &self->ids[2], 1)) {
+		return false;
+	}
+
+	/* Both sides of the channel are behind the same port. No credits are
+	 * returned, do not generate more frames than the initial credits. */
+	return nbus_switch_test_run(self, 0, NBUS_DIR_REQUEST, &self->ids[2], 1, NBUS_SWITCH_TEST_CREDITS, 0) &&
+	       nbus_switch_test_received(self) == 0;
+}
+
+
+/* Send requests of a learned and an unknown channel, return the time spent. */
+static bool nbus_switch_test_stall(struct nbus_switch_test *self, const channel_t *ids, uint32_t *time_ms) {
+	TickType_t start = xTaskGetTickCount();
+	if (!nbus_switch_test_run(self, 0, NBUS_DIR_REQUEST, ids, 2, NBUS_SWITCH_TEST_STALL_FRAMES, 0)) {
+		return false;
+	}
+	*time_ms = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS - NBUS_SWITCH_TEST_SETTLE_MS;
+
+	/* All frames reach the device port, credits are returned by it. */
+	return self->port[1].received == NBUS_SWITCH_TEST_STALL_FRAMES;
+}
+
+
+static bool nbus_switch_test_forward_if_stalled(void) {
+	struct nbus_switch_test *self = nbus_switch_test_get();
+	if (self == NULL || !nbus_switch_test_learn(self, 1, &self->ids[3], 1)) {
+		return false;
+	}
+	const channel_t ids[2] = {self->ids[3], NBUS_SWITCH_TEST_UNKNOWN};
+
+	/* Half of the frames are sent to port 2 too. A stalled port 2 must not
+	 * slow down forwarding to port 1, its frames are dropped instead. */
+	uint32_t idle_ms = 0;
+	uint32_t stalled_ms = 0;
+	bool ret = nbus_switch_test_stall(self, ids, &idle_ms);
+	self->port[2].stalled = true;
+	ret = ret && nbus_switch_test_stall(self, ids, &stalled_ms) && self->port[2].dropped > 0;
+	self->port[2].stalled = false;
+
+	u_log(system_log, LOG_TYPE_DEBUG,
+		U_LOG_MODULE_PREFIX("%u frames in %u ms with port 2 idle, %u ms with port 2 stalled (%u frames dropped)"),
+		NBUS_SWITCH_TEST_STALL_FRAMES, idle_ms, stalled_ms, self->port[2].dropped
+	);
+
+	/* Let the port send the frames still queued. */
+	vTaskDelay(pdMS_TO_TICKS(NBUS_SWITCH_TX_TIMEOUT_MS + NBUS_SWITCH_TEST_SETTLE_MS));
+	return ret;
+}
+
+
+bool nbus_switch_tests(void) {
+	bool res = true;
+
+	res &= u_test(nbus_switch_test_forward_if_learned());
+	res &= u_test(nbus_switch_test_flood_if_unknown());
+	res &= u_test(nbus_switch_test_forward_if_moved());
+	res &= u_test(nbus_switch_test_drop_if_same_port());
+	res &= u_test(nbus_switch_test_forward_if_stalled());
+
+	return res;
+}
+
+
+bool nbus_switch_tests_throughput(void) {
+	struct nbus_switch_test *self = nbus_switch_test_get();
+	if (self == NULL) {
+		return false;
+	}
+	bool res = true;
+
+	const size_t records[] = {10, 250};
+	for (size_t i = 0; i < sizeof(records) / sizeof(records[0]); i++) {
+		size_t ids_len = records[i] / 2;
+		bool r = nbus_switch_test_learn(self, 1, self->ids, ids_len) && self->sw.channels >= records[i];
+
+		/* Requests are forwarded to the device port only. */
+		TickType_t start = xTaskGetTickCount();
+		r = r && nbus_switch_test_run(self, 0, NBUS_DIR_REQUEST, self->ids, ids_len, NBUS_SWITCH_TEST_BENCH_FRAMES, NBUS_SWITCH_TEST_BENCH_FRAMES);
+		uint32_t time_ms = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS - NBUS_SWITCH_TEST_SETTLE_MS;
+		if (time_ms == 0) {
+			time_ms = 1;
+		}
+
+		u_log(system_log, r ? LOG_TYPE_INFO : LOG_TYPE_ERROR,
+			U_LOG_MODULE_PREFIX("%u channel records: %u frames in %u ms (%u frames/s), %u dropped"),
+			records[i], NBUS_SWITCH_TEST_BENCH_FRAMES, time_ms, NBUS_SWITCH_TEST_BENCH_FRAMES * 1000 / time_ms,
+			self->port[1].dropped
+		);
+		res &= r;
+	}
+
+	return res;
+}
@@ -0,0 +1,26 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * nbus switch tests
+ *
+ * Copyright (c) 2023, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * Pass frames through a switch with virtual ports. Check frames of learned
+ * channels are forwarded to a single port, frames of unknown channels are
+ * sent to all other ports and frames are never sent back to their source.
+ * A stalled port must not slow down forwarding to the other ports.
+ */
+bool nbus_switch_tests(void);
+
+/**
+ * Forward frames between two virtual ports with 10 and 250 channel records
+ * learned (a channel-id learned in both directions takes two records).
+ * Log the number of frames forwarded per second.
+ */
+bool nbus_switch_tests_throughput(void);
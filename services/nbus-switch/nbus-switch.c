@@ -20,49 +20,138 @@
 #define MODULE_NAME "nbus-switch"
 
 
+static uint32_t channel_slot(channel_t id, enum nbus_direction dir) {
+	/* Fibonacci hashing of the 18 bit channel/direction key. */
+	uint32_t key = ((uint32_t)id << 2) | (dir & 0x3);
+	return (key * 2654435769U) >> (32 - NBUS_SWITCH_CHANNEL_SLOTS_LOG2);
+}
+
+
 static nbus_switch_ret_t find_channel(NbusSwitch *self, channel_t id, enum nbus_direction dir, struct nbus_switch_channel **ch) {
-	/** @todo a more performant search */
-	/* Find channel with a matching channel number. */
-	struct nbus_switch_channel *found = NULL;
-	for (uint32_t i = 0; i < NBUS_SWITCH_MAX_CHANNELS; i++) {
-		if (self->ch[i].port != NULL && self->ch[i].ch == id && self->ch[i].dir == dir) {
-			found = &(self->ch[i]);
-			/* We are happy with the first one. */
-			break;
+	/* Probe until an empty slot is found. The table is never full. */
+	for (uint32_t i = channel_slot(id, dir); self->ch[i].port != NULL; i = (i + 1) & (NBUS_SWITCH_CHANNEL_SLOTS - 1)) {
+		if (self->ch[i].ch == id && self->ch[i].dir == dir) {
+			*ch = &(self->ch[i]);
+			return NBUS_SWITCH_RET_OK;
 		}
 	}
-	if (found == NULL) {
+	return NBUS_SWITCH_RET_FAILED;
+}
+
+
+/**
+ * @brief Add a new channel record to the table
+ *
+ * The channel must not be in the table already. Port of the returned record
+ * is set by the caller, the slot is considered empty until then.
+ */
+static nbus_switch_ret_t add_channel(NbusSwitch *self, channel_t id, enum nbus_direction dir, struct nbus_switch_channel **ch) {
+	if (self->channels >= NBUS_SWITCH_MAX_CHANNELS) {
+		/* No empty record is available to add the channel. */
 		return NBUS_SWITCH_RET_FAILED;
 	}
+	uint32_t i = channel_slot(id, dir);
+	while (self->ch[i].port != NULL) {
+		i = (i + 1) & (NBUS_SWITCH_CHANNEL_SLOTS - 1);
+	}
+	struct nbus_switch_channel *found = &(self->ch[i]);
+	found->ch = id;
+	found->dir = dir;
+	found->frames = 0;
+	found->last_access = 0;
+	self->channels++;
 	*ch = found;
 	return NBUS_SWITCH_RET_OK;
 }
 
 
-static nbus_switch_ret_t add_channel(NbusSwitch *self, struct nbus_switch_channel **ch) {
-	struct nbus_switch_channel *found = NULL;
-	for (uint32_t i = 0; i < NBUS_SWITCH_MAX_CHANNELS; i++) {
-		if (self->ch[i].port == NULL) {
-			found = &(self->ch[i]);
+/**
+ * @brief Remove the channel record in the slot @p i
+ *
+ * Records following in the same probe sequence are shifted back to fill the
+ * gap. No tombstones are left, lookups stop at the first empty slot.
+ */
+static void remove_channel(NbusSwitch *self, uint32_t i) {
+	const uint32_t mask = NBUS_SWITCH_CHANNEL_SLOTS - 1;
+	uint32_t j = i;
+	while (true) {
+		j = (j + 1) & mask;
+		if (self->ch[j].port == NULL) {
 			break;
 		}
+		/* Move the record at j to the gap at i only if its home slot
+		 * is not cyclically within (i, j]. */
+		uint32_t home = channel_slot(self->ch[j].ch, self->ch[j].dir);
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			self->ch[i] = self->ch[j];
+			i = j;
+		}
 	}
-	if (found == NULL) {
-		/* No empty record is available to add the channel. */
-		return NBUS_SWITCH_RET_FAILED;
+	memset(&(self->ch[i]), 0, sizeof(struct nbus_switch_channel));
+	self->channels--;
+}
+
+
+/**
+ * @brief Remove channels not accessed for NBUS_SWITCH_MAX_LIFETIME aging intervals
+ */
+static void age_channels(NbusSwitch *self) {
+	for (uint32_t i = 0; i < NBUS_SWITCH_CHANNEL_SLOTS; i++) {
+		if (self->ch[i].port != NULL && self->ch[i].last_access <= NBUS_SWITCH_MAX_LIFETIME) {
+			self->ch[i].last_access++;
+		}
+	}
+	/* Removal shifts records back, check the same slot again after removing. */
+	for (uint32_t i = 0; i < NBUS_SWITCH_CHANNEL_SLOTS; i++) {
+		while (self->ch[i].port != NULL && self->ch[i].last_access > NBUS_SWITCH_MAX_LIFETIME) {
+			remove_channel(self, i);
+		}
 	}
-	*ch = found;
-	return NBUS_SWITCH_RET_OK;
 }
 
 
-static nbus_switch_ret_t nbus_switch_send_port(NbusSwitch *self, struct nbus_switch_port *port, struct can_message *msg) {
-	(void)self;
-	if (port->can->vmt->send(port->can, msg, 100) != CAN_RET_OK) {
-		port->tx_errors++;
+static void msg_ref(struct nbus_switch_msg *m) {
+	taskENTER_CRITICAL();
+	m->refs++;
+	taskEXIT_CRITICAL();
+}
+
+
+/**
+ * @brief Release a frame reference, return the frame to the pool when the last one is released
+ */
+static void msg_unref(NbusSwitch *self, struct nbus_switch_msg *m) {
+	taskENTER_CRITICAL();
+	uint8_t refs = --m->refs;
+	taskEXIT_CRITICAL();
+
+	if (refs == 0) {
+		xQueueSend(self->free, &m, 0);
+	}
+}
+
+
+/* Frames of a single channel must never be reordered. The priority is
+ * therefore derived from the channel-id only. Lower channel-ids win
+ * the bus arbitration, they are sent first by the switch too. */
+static uint32_t msg_priority(struct can_message *msg) {
+	return (msg->id >> 12 & 0xffff) * NBUS_SWITCH_TX_PRIORITIES >> 16;
+}
+
+
+/**
+ * @brief Queue the frame for sending to the port @p port
+ *
+ * Never blocks. The frame is dropped if the port egress queue is full.
+ */
+static nbus_switch_ret_t nbus_switch_send_port(NbusSwitch *self, struct nbus_switch_port *port, struct nbus_switch_msg *m) {
+	msg_ref(m);
+	if (xQueueSend(port->txq[msg_priority(&m->msg)], &m, 0) != pdTRUE) {
+		port->tx_dropped++;
+		msg_unref(self, m);
 		return NBUS_SWITCH_RET_FAILED;
 	}
-	port->tx_frames++;
+	xSemaphoreGive(port->tx_pending);
 	return NBUS_SWITCH_RET_OK;
 }
 
@@ -70,36 +159,31 @@ static nbus_switch_ret_t nbus_switch_send_port(NbusSwitch *self, struct nbus_swi
 /**
  * @brief Send to all allocated ports except the port @p except
  */
-static nbus_switch_ret_t nbus_switch_send_multi(NbusSwitch *self, struct nbus_switch_port *except, struct can_message *msg) {
+static nbus_switch_ret_t nbus_switch_send_multi(NbusSwitch *self, struct nbus_switch_port *except, struct nbus_switch_msg *m) {
 	for (uint32_t i = 0; i < NBUS_SWITCH_MAX_PORTS; i++) {
 		if (self->ports[i].parent != NULL && &(self->ports[i]) != except) {
-			nbus_switch_send_port(self, &(self->ports[i]), msg);
+			nbus_switch_send_port(self, &(self->ports[i]), m);
 		}
 	}
 	return NBUS_SWITCH_RET_OK;
 }
 
 
-static nbus_switch_ret_t nbus_switch_process(NbusSwitch *self, struct nbus_switch_port *port, struct can_message *msg) {
+static nbus_switch_ret_t nbus_switch_process(NbusSwitch *self, struct nbus_switch_msg *m) {
+	struct nbus_switch_port *port = m->port;
 	struct nbus_id sid = {0};
-	nbus_parse_id(msg->id, &sid);
-
-	// nbus_switch_send_multi(self, port, msg);
-	// return NBUS_SWITCH_RET_OK;
+	nbus_parse_id(m->msg.id, &sid);
 
 	if (sid.direction == NBUS_DIR_PUBLISH) {
 	// if (true) {
 		/* Send to all ports except @p port. */
-		nbus_switch_send_multi(self, port, msg);
+		nbus_switch_send_multi(self, port, m);
 	} else {
 		/* Find the channel associated with the source of the message and add it if not found. */
 		struct nbus_switch_channel *sch = NULL;
 		if (find_channel(self, sid.channel, sid.direction, &sch) != NBUS_SWITCH_RET_OK) {
-			if (add_channel(self, &sch) == NBUS_SWITCH_RET_OK) {
+			if (add_channel(self, sid.channel, sid.direction, &sch) == NBUS_SWITCH_RET_OK) {
 				sch->port = port;
-				sch->dir = sid.direction;
-				sch->ch = sid.channel;
-				sch->frames = 0;
 			}
 		}
 		if (sch != NULL) {
@@ -121,13 +205,13 @@ static nbus_switch_ret_t nbus_switch_process(NbusSwitch *self, struct nbus_switc
 			/* Ho ho ho, hold your horses. Do not forward the frame if both the source and
 			 * the destination port are the same. */
 			if (port != sch->port) {
-				nbus_switch_send_port(self, sch->port, msg);
+				nbus_switch_send_port(self, sch->port, m);
 			}
 			sch->last_access = 0;
 		} else {
 			/* Not found. Do not add it because we don't have the required information yet.
 			 * Broadcast the frame instead and wait for the response. */
-			nbus_switch_send_multi(self, port, msg);
+			nbus_switch_send_multi(self, port, m);
 		}
 	}
 	return NBUS_SWITCH_RET_OK;
@@ -137,31 +221,55 @@ static nbus_switch_ret_t nbus_switch_process(NbusSwitch *self, struct nbus_switc
 static void nbus_switch_process_task(void *p) {
 	NbusSwitch *self = (NbusSwitch *)p;
 
+	TickType_t next_aging = xTaskGetTickCount() + pdMS_TO_TICKS(NBUS_SWITCH_AGING_INTERVAL_MS);
 	while (true) {
-		struct nbus_switch_iq_item item;
-		if (xQueueReceive(self->iq, &item, portMAX_DELAY) == pdTRUE) {
-			nbus_switch_process(self, item.port, &item.msg);
+		/* Channel aging is done in the process task too. The channel table has
+		 * a single owner and needs no locking. */
+		TickType_t now = xTaskGetTickCount();
+		if ((int32_t)(now - next_aging) >= 0) {
+			age_channels(self);
+			next_aging += pdMS_TO_TICKS(NBUS_SWITCH_AGING_INTERVAL_MS);
+			continue;
+		}
+
+		struct nbus_switch_msg *m = NULL;
+		if (xQueueReceive(self->iq, &m, next_aging - now) == pdTRUE) {
+			nbus_switch_process(self, m);
+			/* Release the reference of the receive task. */
+			msg_unref(self, m);
 		}
 	}
 }
 
 
-static void nbus_switch_housekeeping_task(void *p) {
-	NbusSwitch *self = (NbusSwitch *)p;
+static void nbus_switch_transmit_task(void *p) {
+	struct nbus_switch_port *port = (struct nbus_switch_port *)p;
+	NbusSwitch *self = port->parent;
 
 	while (true) {
-		for (uint32_t i = 0; i < NBUS_SWITCH_MAX_CHANNELS; i++) {
-			if (self->ch[i].port != NULL) {
-				self->ch[i].last_access++;
-			}
-
-			if (self->ch[i].last_access > NBUS_SWITCH_MAX_LIFETIME) {
-				memset(&(self->ch[i]), 0, sizeof(struct nbus_switch_channel));
+		if (xSemaphoreTake(port->tx_pending, portMAX_DELAY) != pdTRUE) {
+			continue;
+		}
+		/* The semaphore counts queued frames, one of the queues is not empty. */
+		struct nbus_switch_msg *m = NULL;
+		for (uint32_t i = 0; i < NBUS_SWITCH_TX_PRIORITIES; i++) {
+			if (xQueueReceive(port->txq[i], &m, 0) == pdTRUE) {
+				break;
 			}
 		}
+		if (m == NULL) {
+			continue;
+		}
 
-		vTaskDelay(1000);
+		/* A congested or dead port blocks its own transmit task only. */
+		if (port->can->vmt->send(port->can, &m->msg, NBUS_SWITCH_TX_TIMEOUT_MS) == CAN_RET_OK) {
+			port->tx_frames++;
+		} else {
+			port->tx_errors++;
+		}
+		msg_unref(self, m);
 	}
+	vTaskDelete(NULL);
 }
 
 
@@ -169,29 +277,41 @@ static void nbus_switch_receive_task(void *p) {
 	struct nbus_switch_port *port = (struct nbus_switch_port *)p;
 	NbusSwitch *self = port->parent;
 
+	/* Frame allocated from the pool, kept until it is passed to the process task. */
+	struct nbus_switch_msg *m = NULL;
 	while (true) {
 		gpio_toggle(LED_WH_PORT, LED_WH_PIN);
 
+		if (m == NULL && xQueueReceive(self->free, &m, 0) != pdTRUE) {
+			m = NULL;
+		}
+
+		/* Receive the frame directly into the pool. If the pool is exhausted,
+		 * the frame is received anyway and dropped. */
+		struct can_message scratch;
+		struct can_message *msg = (m != NULL) ? &m->msg : &scratch;
+
 		/** @todo adjust the timeout */
-		struct can_message msg = {0};
-		if (port->can->vmt->receive(port->can, &msg, 2000) != CAN_RET_OK) {
+		if (port->can->vmt->receive(port->can, msg, 2000) != CAN_RET_OK) {
 			continue;
 		}
 
 		/* We are using 29 bit identifiers exclusively. Do not even try to parse 11 bit IDs. */
-		if (msg.extid == false) {
+		if (msg->extid == false) {
 			port->rx_errors++;
 			continue;
 		}
+		if (m == NULL) {
+			port->rx_dropped++;
+			continue;
+		}
 
-		/* Put the whole message in the queue. No oher locking required. Drop the frame
-		 * if the queue is full. We don't have anything other to do with it. */
-		struct nbus_switch_iq_item item = {
-			port = port,
-			msg = msg,
-		};
-		if (xQueueSend(self->iq, &item, 0) == pdTRUE) {
+		/* Pass the frame reference to the process task. No other locking required. */
+		m->port = port;
+		m->refs = 1;
+		if (xQueueSend(self->iq, &m, 0) == pdTRUE) {
 			port->rx_frames++;
+			m = NULL;
 		} else {
 			port->rx_dropped++;
 		}
@@ -203,18 +323,23 @@ static void nbus_switch_receive_task(void *p) {
 nbus_switch_ret_t nbus_switch_init(NbusSwitch *self) {
 	memset(self, 0, sizeof(NbusSwitch));
 
-	self->iq = xQueueCreate(NBUS_SWITCH_IQ_SIZE, sizeof(struct nbus_switch_iq_item));
-	if (self->iq == NULL) {
+	self->free = xQueueCreate(NBUS_SWITCH_POOL_SIZE, sizeof(struct nbus_switch_msg *));
+	if (self->free == NULL) {
 		return NBUS_SWITCH_RET_FAILED;
 	}
+	for (uint32_t i = 0; i < NBUS_SWITCH_POOL_SIZE; i++) {
+		struct nbus_switch_msg *m = &(self->pool[i]);
+		xQueueSend(self->free, &m, 0);
+	}
 
-	xTaskCreate(nbus_switch_process_task, "nbus-proc", configMINIMAL_STACK_SIZE + 256, (void *)self, 1, &(self->process_task));
-	if (self->process_task == NULL) {
+	/* Large enough to hold all frames of the pool. */
+	self->iq = xQueueCreate(NBUS_SWITCH_POOL_SIZE, sizeof(struct nbus_switch_msg *));
+	if (self->iq == NULL) {
 		return NBUS_SWITCH_RET_FAILED;
 	}
 
-	xTaskCreate(nbus_switch_housekeeping_task, "nbus-hk", configMINIMAL_STACK_SIZE + 128, (void *)self, 1, &(self->housekeeping_task));
-	if (self->housekeeping_task == NULL) {
+	xTaskCreate(nbus_switch_process_task, "nbus-proc", configMINIMAL_STACK_SIZE + 256, (void *)self, 1, &(self->process_task));
+	if (self->process_task == NULL) {
 		return NBUS_SWITCH_RET_FAILED;
 	}
 
@@ -239,15 +364,49 @@ nbus_switch_ret_t nbus_switch_add_port(NbusSwitch *self, Can *can) {
 		return NBUS_SWITCH_RET_FAILED;
 	}
 
+	for (uint32_t i = 0; i < NBUS_SWITCH_TX_PRIORITIES; i++) {
+		port->txq[i] = xQueueCreate(NBUS_SWITCH_TXQ_SIZE, sizeof(struct nbus_switch_msg *));
+		if (port->txq[i] == NULL) {
+			goto err;
+		}
+	}
+	port->tx_pending = xSemaphoreCreateCounting(NBUS_SWITCH_TXQ_SIZE * NBUS_SWITCH_TX_PRIORITIES, 0);
+	if (port->tx_pending == NULL) {
+		goto err;
+	}
+
 	port->can = can;
 	port->parent = self;
 
+	xTaskCreate(nbus_switch_transmit_task, "nbus-swtx", configMINIMAL_STACK_SIZE + 128, (void *)port, 2, &(port->transmit_task));
+	if (port->transmit_task == NULL) {
+		goto err;
+	}
+
 	xTaskCreate(nbus_switch_receive_task, "nbus-sw", configMINIMAL_STACK_SIZE + 256, (void *)port, 2, &(port->receive_task));
 	if (port->receive_task == NULL) {
-		port->parent = NULL;
-		port->can = NULL;
-		return NBUS_SWITCH_RET_FAILED;
+		goto err;
 	}
 
 	return NBUS_SWITCH_RET_OK;
+
+err:
+	/* The transmit task may be already waiting for frames, delete it first. */
+	if (port->transmit_task != NULL) {
+		vTaskDelete(port->transmit_task);
+		port->transmit_task = NULL;
+	}
+	if (port->tx_pending != NULL) {
+		vSemaphoreDelete(port->tx_pending);
+		port->tx_pending = NULL;
+	}
+	for (uint32_t i = 0; i < NBUS_SWITCH_TX_PRIORITIES; i++) {
+		if (port->txq[i] != NULL) {
+			vQueueDelete(port->txq[i]);
+			port->txq[i] = NULL;
+		}
+	}
+	port->parent = NULL;
+	port->can = NULL;
+	return NBUS_SWITCH_RET_FAILED;
 }
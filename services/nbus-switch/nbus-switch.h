@@ -16,9 +16,20 @@
 
 
 #define NBUS_SWITCH_MAX_CHANNELS 256
+/* Size of the open addressing channel table. Kept at least twice
+ * NBUS_SWITCH_MAX_CHANNELS to keep the probe sequences short. */
+#define NBUS_SWITCH_CHANNEL_SLOTS_LOG2 9
+#define NBUS_SWITCH_CHANNEL_SLOTS (1 << NBUS_SWITCH_CHANNEL_SLOTS_LOG2)
 #define NBUS_SWITCH_MAX_PORTS 4
-#define NBUS_SWITCH_IQ_SIZE 128
+/* Egress queue length of a single port and priority. */
+#define NBUS_SWITCH_TXQ_SIZE 8
+/* Number of frames being forwarded at once, shared by all ports. Larger than
+ * all egress queues together, stalled ports cannot exhaust the pool. */
+#define NBUS_SWITCH_POOL_SIZE 96
+#define NBUS_SWITCH_TX_PRIORITIES 2
+#define NBUS_SWITCH_TX_TIMEOUT_MS 100
 #define NBUS_SWITCH_MAX_LIFETIME 10
+#define NBUS_SWITCH_AGING_INTERVAL_MS 1000
 
 typedef enum {
 	NBUS_SWITCH_RET_OK = 0,
@@ -34,38 +45,60 @@ struct nbus_switch_port {
 	Can *can;
 	NbusSwitch *parent;
 	TaskHandle_t receive_task;
+	TaskHandle_t transmit_task;
+
+	/* Egress queues of frames (struct nbus_switch_msg pointers), one
+	 * for each priority. Lower index is served first. */
+	QueueHandle_t txq[NBUS_SWITCH_TX_PRIORITIES];
+	/* Counts frames waiting in all egress queues. */
+	SemaphoreHandle_t tx_pending;
+
 	uint32_t tx_frames;
 	uint32_t rx_frames;
 	uint32_t rx_errors;
 	uint32_t tx_errors;
 	uint32_t rx_dropped;
+	/* Frames dropped because the egress queue was full. */
+	uint32_t tx_dropped;
 };
 
-struct __attribute__((__packed__)) nbus_switch_channel {
-	channel_t ch;
-	enum nbus_direction dir;
+/* A slot of the channel table is empty if port is NULL. */
+struct nbus_switch_channel {
 	struct nbus_switch_port *port;
 	uint32_t frames;
-	uint32_t last_access;
+	channel_t ch;
+	uint8_t dir;
+	uint8_t last_access;
 };
 
 
-struct nbus_switch_iq_item {
-	struct nbus_switch_port *port;
+/* A received frame. Frames are allocated from a pool and passed by reference
+ * to all egress queues they are forwarded to. */
+struct nbus_switch_msg {
 	struct can_message msg;
+	/* Ingress port */
+	struct nbus_switch_port *port;
+	/* Number of queues and tasks holding the frame. */
+	uint8_t refs;
 };
 
 
 typedef struct nbus_switch {
 
-	/* Channel lookup table */
-	struct nbus_switch_channel ch[NBUS_SWITCH_MAX_CHANNELS];
+	/* Channel lookup table, open addressing with linear probing keyed by
+	 * the channel ID and direction. Accessed by the process task only. */
+	struct nbus_switch_channel ch[NBUS_SWITCH_CHANNEL_SLOTS];
+	uint32_t channels;
 
 	struct nbus_switch_port ports[NBUS_SWITCH_MAX_PORTS];
 
+	struct nbus_switch_msg pool[NBUS_SWITCH_POOL_SIZE];
+	/* Free frames of the pool */
+	QueueHandle_t free;
+
+	/* Received frames waiting to be processed. */
 	QueueHandle_t iq;
 	TaskHandle_t process_task;
-	TaskHandle_t housekeeping_task;
 } NbusSwitch;
 
 
@@ -0,0 +1,997 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * nbus tests
+ *
+ * Copyright (c) 2023, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <main.h>
+#include "u_test.h"
+
+#include <interfaces/can.h>
+#include "nbus.h"
+#include "nbus-tests.h"
+
+#ifdef MODULE_NAME
+#undef MODULE_NAME
+#endif
+#define MODULE_NAME "nbus-tests"
+
+#define NBUS_TEST_QUEUE_LEN 96
+#define NBUS_TEST_TIMEOUT_MS 1000
+#define NBUS_TEST_EP 1
+#define NBUS_TEST_SHORT_ID 0x7e570000
+#define NBUS_TEST_BENCH_LEN 512
+#define NBUS_TEST_BENCH_PACKETS 200
+#define NBUS_TEST_ROUNDS 50
+#define NBUS_TEST_RELIABLE_WINDOW 4
+#define NBUS_TEST_RELIABLE_PACKETS 100
+/* One of NBUS_TEST_LOSS frames is dropped on a lossy bus. */
+#define NBUS_TEST_LOSS 32
+#define NBUS_TEST_CAPTURE 16
+#define NBUS_TEST_AUTH_LEN 32
+/* Packets are reassembled by direction and stream. */
+#define NBUS_TEST_KEYS (NBUS_RX_CONTEXTS + 1)
+
+/* Tests use their own pair of channels. Channels cannot be removed from
+ * a nbus instance, the pairs are kept for the next run. */
+enum nbus_test_pair {
+	NBUS_TEST_PAIR_FD = 0,
+	NBUS_TEST_PAIR_CLASSIC,
+	NBUS_TEST_PAIR_NO_BRS,
+	NBUS_TEST_PAIR_BENCH,
+	NBUS_TEST_PAIR_INTERLEAVED,
+	NBUS_TEST_PAIR_EXPIRED,
+	NBUS_TEST_PAIR_RELIABLE,
+	NBUS_TEST_PAIR_AUTH,
+	NBUS_TEST_PAIRS,
+};
+
+/* One side of the loopback bus. Frames sent are queued for the peer port,
+ * advertisements are dropped as both sides of a pair use the same short-id. */
+struct nbus_test_port {
+	Can can;
+	QueueHandle_t rx;
+	struct nbus_test_port *peer;
+
+	/* Drop one of loss frames randomly, 0 = lossless. */
+	uint32_t loss;
+	uint32_t loss_state;
+
+	/* Keep frames sent instead of passing them to the peer port. */
+	bool capture;
+	struct can_message captured[NBUS_TEST_CAPTURE];
+	size_t captured_len;
+
+	uint32_t frames;
+	uint32_t lost;
+	uint32_t fd_frames;
+	uint32_t brs_frames;
+	uint32_t bytes;
+	size_t max_len;
+};
+
+struct nbus_test_bus {
+	struct nbus_test_port port[2];
+	Nbus nbus[2];
+	NbusChannel pair[NBUS_TEST_PAIRS][2];
+	bool pair_added[NBUS_TEST_PAIRS];
+	uint8_t buf[NBUS_CHANNEL_MTU];
+};
+
+/* A packet injected into the receive queue of a port frame by frame as if
+ * it was sent by another node. */
+struct nbus_test_packet {
+	nbus_channel_id_t channel;
+	enum nbus_direction direction;
+	uint8_t stream;
+	nbus_endpoint_t ep;
+	size_t len;
+	uint32_t seed;
+
+	/* The next frame to inject, 0 is the leading frame. */
+	size_t frame;
+	size_t sent;
+	bool done;
+};
+
+/* nbus instances cannot be stopped, the bus is created on the first run
+ * and never freed. */
+static struct nbus_test_bus *nbus_test_bus = NULL;
+
+/* Epochs are never repeated with the same key, not even in the next run. */
+static uint32_t nbus_test_epoch = 0;
+static const uint8_t nbus_test_key[NBUS_KEY_SIZE] = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+};
+
+
+static can_ret_t nbus_test_port_send(Can *can, const struct can_message *msg, uint32_t timeout_ms) {
+	struct nbus_test_port *self = can->parent;
+
+	struct nbus_id id;
+	nbus_parse_id(msg->id, &id);
+	if (id.opcode == NBUS_OP_ADVERTISEMENT) {
+		return CAN_RET_OK;
+	}
+
+	self->frames++;
+	self->bytes += msg->len;
+	if (msg->fd) {
+		self->fd_frames++;
+	}
+	if (msg->brs) {
+		self->brs_frames++;
+	}
+	if (msg->len > self->max_len) {
+		self->max_len = msg->len;
+	}
+
+	if (self->capture) {
+		if (self->captured_len < NBUS_TEST_CAPTURE) {
+			self->captured[self->captured_len++] = *msg;
+		}
+		return CAN_RET_OK;
+	}
+
+	if (self->loss > 0) {
+		/* The port has its own generator, it is called from nbus tasks. */
+		self->loss_state = self->loss_state * 1103515245 + 12345;
+		if (((self->loss_state >> 8) % self->loss) == 0) {
+			self->lost++;
+			return CAN_RET_OK;
+		}
+	}
+
+	if (xQueueSend(self->peer->rx, msg, pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+		return CAN_RET_FAILED;
+	}
+	return CAN_RET_OK;
+}
+
+
+static can_ret_t nbus_test_port_receive(Can *can, struct can_message *msg, uint32_t timeout_ms) {
+	struct nbus_test_port *self = can->parent;
+
+	if (xQueueReceive(self->rx, msg, pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+		return CAN_RET_FAILED;
+	}
+	return CAN_RET_OK;
+}
+
+
+static const struct can_vmt nbus_test_port_vmt = {
+	.send = nbus_test_port_send,
+	.receive = nbus_test_port_receive,
+};
+
+
+static void nbus_test_port_clear(struct nbus_test_port *self) {
+	self->frames = 0;
+	self->lost = 0;
+	self->fd_frames = 0;
+	self->brs_frames = 0;
+	self->bytes = 0;
+	self->max_len = 0;
+}
+
+
+static struct nbus_test_bus *nbus_test_bus_get(void) {
+	if (nbus_test_bus != NULL) {
+		return nbus_test_bus;
+	}
+
+	struct nbus_test_bus *self = calloc(1, sizeof(struct nbus_test_bus));
+	if (self == NULL) {
+		return NULL;
+	}
+	for (size_t i = 0; i < 2; i++) {
+		struct nbus_test_port *port = &self->port[i];
+		port->can.vmt = &nbus_test_port_vmt;
+		port->can.parent = port;
+		port->peer = &self->port[1 - i];
+		port->rx = xQueueCreate(NBUS_TEST_QUEUE_LEN, sizeof(struct can_message));
+		if (port->rx == NULL) {
+			return NULL;
+		}
+	}
+	for (size_t i = 0; i < 2; i++) {
+		if (nbus_init(&self->nbus[i], &self->port[i].can) != NBUS_RET_OK) {
+			return NULL;
+		}
+	}
+
+	nbus_test_bus = self;
+	return self;
+}
+
+
+/**
+ * @brief Get a pair of channels with the same channel-id on both nbus instances
+ *
+ * The first channel belongs to the instance on port 0, the second one to the
+ * instance on port 1. Frame counters of both ports are cleared.
+ */
+static NbusChannel *nbus_test_pair_get(struct nbus_test_bus *self, enum nbus_test_pair pair) {
+	NbusChannel *ch = self->pair[pair];
+
+	if (self->pair_added[pair] == false) {
+		for (size_t i = 0; i < 2; i++) {
+			if (nbus_channel_init(&ch[i], "test") != NBUS_RET_OK) {
+				return NULL;
+			}
+			nbus_channel_set_explicit_short_id(&ch[i], NBUS_TEST_SHORT_ID + pair);
+			if (nbus_add_channel(&self->nbus[i], &ch[i]) != NBUS_RET_OK) {
+				return NULL;
+			}
+		}
+		self->pair_added[pair] = true;
+	}
+
+	/* Channel-ids are assigned by the housekeeping task. */
+	TickType_t start = xTaskGetTickCount();
+	while (!ch[0].channel_id_valid || !ch[1].channel_id_valid) {
+		if ((xTaskGetTickCount() - start) > pdMS_TO_TICKS(NBUS_TEST_TIMEOUT_MS * 2)) {
+			u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("no channel-id assigned"));
+			return NULL;
+		}
+		vTaskDelay(pdMS_TO_TICKS(10));
+	}
+
+	/* Start with classic CAN fragments until a leading frame is received. */
+	ch[0].frag_size = NBUS_FRAG_SIZE_CLASSIC;
+	ch[1].frag_size = NBUS_FRAG_SIZE_CLASSIC;
+	nbus_test_port_clear(&self->port[0]);
+	nbus_test_port_clear(&self->port[1]);
+
+	return ch;
+}
+
+
+static uint8_t nbus_test_byte(uint32_t seed, size_t i) {
+	return (uint8_t)(seed + i * 7);
+}
+
+
+static void nbus_test_fill(uint8_t *buf, size_t len, uint32_t seed) {
+	for (size_t i = 0; i < len; i++) {
+		buf[i] = nbus_test_byte(seed, i);
+	}
+}
+
+
+static bool nbus_test_check(const uint8_t *buf, size_t len, uint32_t seed) {
+	for (size_t i = 0; i < len; i++) {
+		if (buf[i] != nbus_test_byte(seed, i)) {
+			u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("packet data differ at %u"), i);
+			return false;
+		}
+	}
+	return true;
+}
+
+
+static uint32_t rnd_state = 1;
+static uint32_t rnd(uint32_t range) {
+	rnd_state = rnd_state * 1103515245 + 12345;
+	return (rnd_state >> 8) % range;
+}
+
+
+/* Send a packet from tx to rx and check it is received unchanged. */
+static bool nbus_test_send(struct nbus_test_bus *self, NbusChannel *tx, NbusChannel *rx, size_t len, uint32_t seed) {
+	nbus_test_fill(self->buf, len, seed);
+	if (nbus_channel_send(tx, NBUS_TEST_EP, self->buf, len) != NBUS_RET_OK) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("cannot send a packet"));
+		return false;
+	}
+
+	nbus_endpoint_t ep = 0;
+	size_t rlen = 0;
+	memset(self->buf, 0, len);
+	if (nbus_channel_receive(rx, &ep, self->buf, sizeof(self->buf), &rlen, NBUS_TEST_TIMEOUT_MS) != NBUS_RET_OK) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("packet not received"));
+		return false;
+	}
+	if (ep != NBUS_TEST_EP || rlen != len) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("received ep %u len %u"), ep, rlen);
+		return false;
+	}
+	return nbus_test_check(self->buf, len, seed);
+}
+
+
+/* A request from ch[0] followed by a response from ch[1]. The last packet is
+ * sent from ch[0] again, port counters are cleared before each packet. */
+static bool nbus_test_exchange(struct nbus_test_bus *self, NbusChannel *ch, size_t len) {
+	if (!nbus_test_send(self, &ch[0], &ch[1], len, 1)) {
+		return false;
+	}
+	nbus_test_port_clear(&self->port[1]);
+	if (!nbus_test_send(self, &ch[1], &ch[0], len, 2)) {
+		return false;
+	}
+	nbus_test_port_clear(&self->port[0]);
+	return nbus_test_send(self, &ch[0], &ch[1], len, 3);
+}
+
+
+static bool nbus_test_fd_if_both_fd(void) {
+	struct nbus_test_bus *self = nbus_test_bus_get();
+	if (self == NULL) {
+		return false;
+	}
+	nbus_set_fd(&self->nbus[0], true, true);
+	nbus_set_fd(&self->nbus[1], true, true);
+	NbusChannel *ch = nbus_test_pair_get(self, NBUS_TEST_PAIR_FD);
+	if (ch == NULL || !nbus_test_exchange(self, ch, 200)) {
+		return false;
+	}
+
+	/* Both sides switch to 64 byte fragments after receiving a leading frame. */
+	return ch[0].frag_size == NBUS_FRAG_SIZE_FD && ch[1].frag_size == NBUS_FRAG_SIZE_FD &&
+	       self->port[0].max_len == NBUS_FRAG_SIZE_FD && self->port[1].max_len == NBUS_FRAG_SIZE_FD &&
+	       self->port[0].fd_frames == self->port[0].frames && self->port[0].brs_frames == self->port[0].frames &&
+	       self->port[1].fd_frames == self->port[1].frames && self->port[1].brs_frames == self->port[1].frames;
+}
+
+
+static bool nbus_test_classic_if_peer_classic(void) {
+	struct nbus_test_bus *self = nbus_test_bus_get();
+	if (self == NULL) {
+		return false;
+	}
+	nbus_set_fd(&self->nbus[0], true, true);
+	nbus_set_fd(&self->nbus[1], false, false);
+	NbusChannel *ch = nbus_test_pair_get(self, NBUS_TEST_PAIR_CLASSIC);
+	if (ch == NULL || !nbus_test_exchange(self, ch, 200)) {
+		return false;
+	}
+
+	/* The classic CAN peer ignores the FD flag, the CAN-FD peer falls back to
+	 * 8 byte fragments after receiving a leading frame without it. */
+	return ch[0].frag_size == NBUS_FRAG_SIZE_CLASSIC && ch[1].frag_size == NBUS_FRAG_SIZE_CLASSIC &&
+	       self->port[0].max_len == NBUS_FRAG_SIZE_CLASSIC && self->port[1].max_len == NBUS_FRAG_SIZE_CLASSIC &&
+	       self->port[0].fd_frames == 0 && self->port[1].fd_frames == 0;
+}
+
+
+static bool nbus_test_fd_if_brs_disabled(void) {
+	struct nbus_test_bus *self = nbus_test_bus_get();
+	if (self == NULL) {
+		return false;
+	}
+	nbus_set_fd(&self->nbus[0], true, false);
+	nbus_set_fd(&self->nbus[1], true, false);
+	NbusChannel *ch = nbus_test_pair_get(self, NBUS_TEST_PAIR_NO_BRS);
+	if (ch == NULL || !nbus_test_exchange(self, ch, 200)) {
+		return false;
+	}
+
+	return self->port[0].max_len == NBUS_FRAG_SIZE_FD && self->port[1].max_len == NBUS_FRAG_SIZE_FD &&
+	       self->port[0].fd_frames == self->port[0].frames && self->port[0].brs_frames == 0 &&
+	       self->port[1].fd_frames == self->port[1].frames && self->port[1].brs_frames == 0;
+}
+
+
+/* Packets with different keys are assembled in separate contexts. */
+static void nbus_test_packet_init(struct nbus_test_packet *self, NbusChannel *ch, size_t key, size_t len, uint32_t seed) {
+	memset(self, 0, sizeof(struct nbus_test_packet));
+	self->channel = ch->channel_id;
+	self->direction = (enum nbus_direction)(key / NBUS_STREAMS);
+	self->stream = key % NBUS_STREAMS;
+	self->ep = NBUS_TEST_EP + key;
+	self->len = len;
+	self->seed = seed;
+}
+
+
+/* Inject the next frame of a packet using 8 byte fragments. */
+static bool nbus_test_packet_inject(struct nbus_test_packet *self, struct nbus_test_port *port) {
+	struct nbus_id id = {
+		.channel = self->channel,
+		.direction = self->direction,
+		.stream = self->stream,
+	};
+	struct can_message msg = {0};
+	msg.extid = true;
+
+	if (self->frame == 0) {
+		struct nbus_leading_frame_msg lf = {
+			.counter = self->seed,
+			.len = self->len,
+			.flags = 0,
+		};
+		id.opcode = NBUS_OP_LEADING_MIN + self->ep;
+		memcpy(msg.buf, &lf, sizeof(lf));
+		msg.len = sizeof(lf);
+	} else if (self->sent < self->len) {
+		size_t len = self->len - self->sent;
+		if (len > NBUS_FRAG_SIZE_CLASSIC) {
+			len = NBUS_FRAG_SIZE_CLASSIC;
+		}
+		id.opcode = NBUS_OP_DATA_MIN + self->frame - 1;
+		for (size_t i = 0; i < len; i++) {
+			msg.buf[i] = nbus_test_byte(self->seed, self->sent + i);
+		}
+		msg.len = len;
+		self->sent += len;
+	} else {
+		/* The channel is not authenticated, the trailing frame is empty. */
+		id.opcode = NBUS_OP_TRAILING;
+		msg.len = NBUS_FRAG_SIZE_CLASSIC;
+		self->done = true;
+	}
+	self->frame++;
+	msg.id = nbus_build_id(&id);
+
+	return xQueueSend(port->rx, &msg, pdMS_TO_TICKS(NBUS_TEST_TIMEOUT_MS)) == pdTRUE;
+}
+
+
+static bool nbus_test_packet_receive(struct nbus_test_bus *self, NbusChannel *ch, struct nbus_test_packet *p, size_t count, uint32_t *seen) {
+	nbus_endpoint_t ep = 0;
+	size_t len = 0;
+	if (nbus_channel_receive(ch, &ep, self->buf, sizeof(self->buf), &len, NBUS_TEST_TIMEOUT_MS) != NBUS_RET_OK) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("packet not received"));
+		return false;
+	}
+	size_t key = ep - NBUS_TEST_EP;
+	if (ep < NBUS_TEST_EP || key >= count || (*seen & (1U << key))) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("unexpected packet ep %u"), ep);
+		return false;
+	}
+	*seen |= 1U << key;
+
+	/* Responses are sent over the stream the packet was received from. */
+	return len == p[key].len && nbus_test_check(self->buf, len, p[key].seed) && ch->rx_stream == p[key].stream;
+}
+
+
+static bool nbus_test_reassembly_if_interleaved(void) {
+	struct nbus_test_bus *self = nbus_test_bus_get();
+	if (self == NULL) {
+		return false;
+	}
+	nbus_set_fd(&self->nbus[0], false, false);
+	nbus_set_fd(&self->nbus[1], false, false);
+	NbusChannel *ch = nbus_test_pair_get(self, NBUS_TEST_PAIR_INTERLEAVED);
+	if (ch == NULL) {
+		return false;
+	}
+
+	/* Fragments of packets of all contexts are interleaved randomly, the order
+	 * of fragments of a single packet is kept. */
+	struct nbus_test_packet p[NBUS_RX_CONTEXTS];
+	for (uint32_t round = 0; round < NBUS_TEST_ROUNDS; round++) {
+		for (size_t i = 0; i < NBUS_RX_CONTEXTS; i++) {
+			nbus_test_packet_init(&p[i], &ch[1], i, 1 + rnd(NBUS_CHANNEL_MTU), round * NBUS_RX_CONTEXTS + i);
+		}
+		size_t remaining = NBUS_RX_CONTEXTS;
+		while (remaining > 0) {
+			struct nbus_test_packet *pi = &p[rnd(NBUS_RX_CONTEXTS)];
+			if (pi->done) {
+				continue;
+			}
+			if (!nbus_test_packet_inject(pi, &self->port[1])) {
+				return false;
+			}
+			if (pi->done) {
+				remaining--;
+			}
+		}
+
+		uint32_t seen = 0;
+		for (size_t i = 0; i < NBUS_RX_CONTEXTS; i++) {
+			if (!nbus_test_packet_receive(self, &ch[1], p, NBUS_RX_CONTEXTS, &seen)) {
+				u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("round %u failed"), round);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+
+static bool nbus_test_context_if_expired(void) {
+	struct nbus_test_bus *self = nbus_test_bus_get();
+	if (self == NULL) {
+		return false;
+	}
+	nbus_set_fd(&self->nbus[0], false, false);
+	nbus_set_fd(&self->nbus[1], false, false);
+	NbusChannel *ch = nbus_test_pair_get(self, NBUS_TEST_PAIR_EXPIRED);
+	if (ch == NULL) {
+		return false;
+	}
+
+	/* Stall packets in all contexts after their leading frame. */
+	struct nbus_test_packet p[NBUS_TEST_KEYS];
+	for (size_t i = 0; i < NBUS_TEST_KEYS; i++) {
+		nbus_test_packet_init(&p[i], &ch[1], i, 16, i);
+	}
+	for (size_t i = 0; i < NBUS_RX_CONTEXTS; i++) {
+		if (!nbus_test_packet_inject(&p[i], &self->port[1])) {
+			return false;
+		}
+	}
+
+	/* No context is free for another packet until the stalled ones expire. */
+	struct nbus_test_packet *last = &p[NBUS_RX_CONTEXTS];
+	for (size_t i = 0; i < 2; i++) {
+		nbus_test_packet_init(last, &ch[1], NBUS_RX_CONTEXTS, 16, NBUS_RX_CONTEXTS);
+		while (!last->done) {
+			if (!nbus_test_packet_inject(last, &self->port[1])) {
+				return false;
+			}
+		}
+		if (i == 0) {
+			nbus_endpoint_t ep = 0;
+			size_t len = 0;
+			if (nbus_channel_receive(&ch[1], &ep, self->buf, sizeof(self->buf), &len, 50) != NBUS_RET_VOID) {
+				u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("packet received with all contexts busy"));
+				return false;
+			}
+			vTaskDelay(pdMS_TO_TICKS(NBUS_RX_TIMEOUT_MS + 50));
+		}
+	}
+	uint32_t seen = 0;
+	if (!nbus_test_packet_receive(self, &ch[1], p, NBUS_TEST_KEYS, &seen)) {
+		return false;
+	}
+
+	/* Fragments of an expired packet are dropped. */
+	while (!p[0].done) {
+		if (!nbus_test_packet_inject(&p[0], &self->port[1])) {
+			return false;
+		}
+	}
+	nbus_endpoint_t ep = 0;
+	size_t len = 0;
+	return nbus_channel_receive(&ch[1], &ep, self->buf, sizeof(self->buf), &len, 50) == NBUS_RET_VOID;
+}
+
+
+static bool nbus_test_in_order_if_lossy(void) {
+	struct nbus_test_bus *self = nbus_test_bus_get();
+	if (self == NULL) {
+		return false;
+	}
+	nbus_set_fd(&self->nbus[0], false, false);
+	nbus_set_fd(&self->nbus[1], false, false);
+	NbusChannel *ch = nbus_test_pair_get(self, NBUS_TEST_PAIR_RELIABLE);
+	if (ch == NULL || nbus_channel_set_reliable(&ch[0], NBUS_TEST_RELIABLE_WINDOW) != NBUS_RET_OK) {
+		return false;
+	}
+	uint32_t retransmitted = ch[0].reliable.retransmitted;
+
+	/* Both data frames and acknowledgements are lost. */
+	self->port[0].loss = NBUS_TEST_LOSS;
+	self->port[1].loss = NBUS_TEST_LOSS;
+
+	/* Fill the window and receive the packets afterwards. Packets which don't
+	 * fit the free receive contexts are lost too and retransmitted later. */
+	bool ret = true;
+	size_t len[NBUS_TEST_RELIABLE_WINDOW];
+	for (uint32_t i = 0; ret && i < NBUS_TEST_RELIABLE_PACKETS; i += NBUS_TEST_RELIABLE_WINDOW) {
+		for (uint32_t j = 0; ret && j < NBUS_TEST_RELIABLE_WINDOW; j++) {
+			len[j] = 1 + rnd(64);
+			nbus_test_fill(self->buf, len[j], i + j);
+			ret = nbus_channel_send(&ch[0], NBUS_TEST_EP, self->buf, len[j]) == NBUS_RET_OK;
+		}
+		for (uint32_t j = 0; ret && j < NBUS_TEST_RELIABLE_WINDOW; j++) {
+			nbus_endpoint_t ep = 0;
+			size_t rlen = 0;
+			if (nbus_channel_receive(&ch[1], &ep, self->buf, sizeof(self->buf), &rlen, NBUS_TEST_TIMEOUT_MS) != NBUS_RET_OK) {
+				u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("packet %u not received"), i + j);
+				ret = false;
+			} else {
+				/* Packets are received in order, each of them once. */
+				ret = ep == NBUS_TEST_EP && rlen == len[j] && nbus_test_check(self->buf, rlen, i + j);
+			}
+		}
+	}
+	ret = ret && nbus_channel_flush(&ch[0], NBUS_TEST_TIMEOUT_MS) == NBUS_RET_OK;
+	u_log(system_log, LOG_TYPE_DEBUG, U_LOG_MODULE_PREFIX("%u frames lost, %u packets retransmitted"),
+		self->port[0].lost + self->port[1].lost, ch[0].reliable.retransmitted - retransmitted
+	);
+
+	self->port[0].loss = 0;
+	self->port[1].loss = 0;
+	nbus_endpoint_t ep = 0;
+	size_t rlen = 0;
+	ret = ret && nbus_channel_receive(&ch[1], &ep, self->buf, sizeof(self->buf), &rlen, 50) == NBUS_RET_VOID;
+	ret = ret && self->port[0].lost > 0 && ch[0].reliable.retransmitted > retransmitted;
+
+	nbus_channel_set_reliable(&ch[0], 0);
+	return ret;
+}
+
+
+/**
+ * @brief Get the authenticated pair of channels
+ *
+ * The first channel is an initiator. Both sides use the same epoch, the pair
+ * is returned after both sides learn it. NBUS_MAC_NONE disables the authentication.
+ */
+static NbusChannel *nbus_test_auth_pair_get(struct nbus_test_bus *self, enum nbus_mac mac) {
+	nbus_set_fd(&self->nbus[0], true, true);
+	nbus_set_fd(&self->nbus[1], true, true);
+	NbusChannel *ch = nbus_test_pair_get(self, NBUS_TEST_PAIR_AUTH);
+	if (ch == NULL) {
+		return NULL;
+	}
+	nbus_channel_set_initiator(&ch[0], true);
+	nbus_channel_set_initiator(&ch[1], false);
+
+	nbus_test_epoch++;
+	for (size_t i = 0; i < 2; i++) {
+		if (nbus_channel_set_key(&ch[i], mac, nbus_test_key, sizeof(nbus_test_key), nbus_test_epoch) != NBUS_RET_OK) {
+			return NULL;
+		}
+	}
+
+	/* Sync requests are repeated by the housekeeping task. */
+	TickType_t start = xTaskGetTickCount();
+	while (mac != NBUS_MAC_NONE && (!ch[0].auth.synced || !ch[1].auth.synced)) {
+		if ((xTaskGetTickCount() - start) > pdMS_TO_TICKS(NBUS_TEST_TIMEOUT_MS)) {
+			u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("epochs not synced"));
+			return NULL;
+		}
+		vTaskDelay(pdMS_TO_TICKS(10));
+	}
+	nbus_test_port_clear(&self->port[0]);
+	nbus_test_port_clear(&self->port[1]);
+
+	return ch;
+}
+
+
+/* Disable the authentication of the pair for the other tests. */
+static bool nbus_test_auth_pair_release(NbusChannel *ch) {
+	return nbus_channel_set_key(&ch[0], NBUS_MAC_NONE, NULL, 0, 0) == NBUS_RET_OK &&
+	       nbus_channel_set_key(&ch[1], NBUS_MAC_NONE, NULL, 0, 0) == NBUS_RET_OK;
+}
+
+
+/* Send a packet from ch[0] and keep its frames on port 0. */
+static bool nbus_test_capture(struct nbus_test_bus *self, NbusChannel *ch, uint32_t seed) {
+	struct nbus_test_port *port = &self->port[0];
+	port->captured_len = 0;
+	port->capture = true;
+	nbus_test_fill(self->buf, NBUS_TEST_AUTH_LEN, seed);
+	nbus_ret_t ret = nbus_channel_send(&ch[0], NBUS_TEST_EP, self->buf, NBUS_TEST_AUTH_LEN);
+	port->capture = false;
+
+	return ret == NBUS_RET_OK && port->captured_len > 2 && port->captured_len < NBUS_TEST_CAPTURE;
+}
+
+
+/* A modification of captured frames. */
+struct nbus_test_tamper {
+	/* Index of the frame modified, NBUS_TEST_CAPTURE = all frames. */
+	size_t frame;
+	/* Index of the byte modified, -1 = the frame identifier. */
+	int byte;
+	uint32_t mask;
+};
+
+static const struct nbus_test_tamper nbus_test_untampered = {.frame = 0, .byte = -1, .mask = 0};
+
+
+/* Inject frames captured on port 0 to port 1. */
+static bool nbus_test_inject(struct nbus_test_bus *self, const struct nbus_test_tamper *tamper) {
+	struct nbus_test_port *port = &self->port[0];
+	for (size_t i = 0; i < port->captured_len; i++) {
+		struct can_message msg = port->captured[i];
+		if (i == tamper->frame || tamper->frame == NBUS_TEST_CAPTURE) {
+			if (tamper->byte < 0) {
+				msg.id ^= tamper->mask;
+			} else {
+				msg.buf[tamper->byte] ^= tamper->mask;
+			}
+		}
+		if (xQueueSend(self->port[1].rx, &msg, pdMS_TO_TICKS(NBUS_TEST_TIMEOUT_MS)) != pdTRUE) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+/* Check whether ch[1] received the captured packet. */
+static bool nbus_test_received(struct nbus_test_bus *self, NbusChannel *ch, uint32_t seed) {
+	nbus_endpoint_t ep = 0;
+	size_t len = 0;
+	if (nbus_channel_receive(&ch[1], &ep, self->buf, sizeof(self->buf), &len, 100) != NBUS_RET_OK) {
+		return false;
+	}
+	return ep == NBUS_TEST_EP && len == NBUS_TEST_AUTH_LEN && nbus_test_check(self->buf, len, seed);
+}
+
+
+static bool nbus_test_auth_if_same_epoch(void) {
+	struct nbus_test_bus *self = nbus_test_bus_get();
+	if (self == NULL) {
+		return false;
+	}
+
+	const enum nbus_mac macs[] = {NBUS_MAC_SIPHASH, NBUS_MAC_BLAKE2S};
+	for (size_t i = 0; i < sizeof(macs) / sizeof(macs[0]); i++) {
+		NbusChannel *ch = nbus_test_auth_pair_get(self, macs[i]);
+		if (ch == NULL || !nbus_test_exchange(self, ch, 100)) {
+			return false;
+		}
+		if (ch[0].auth.rejected > 0 || ch[1].auth.rejected > 0 || !nbus_test_auth_pair_release(ch)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+static bool nbus_test_reject_if_reflected(void) {
+	struct nbus_test_bus *self = nbus_test_bus_get();
+	if (self == NULL) {
+		return false;
+	}
+	NbusChannel *ch = nbus_test_auth_pair_get(self, NBUS_MAC_SIPHASH);
+	if (ch == NULL) {
+		return false;
+	}
+
+	/* Frames sent by ch[1] are received by ch[1] itself. */
+	struct nbus_test_port *port = &self->port[1];
+	port->peer = port;
+	nbus_test_fill(self->buf, NBUS_TEST_AUTH_LEN, 1);
+	bool ret = nbus_channel_send(&ch[1], NBUS_TEST_EP, self->buf, NBUS_TEST_AUTH_LEN) == NBUS_RET_OK;
+	ret = ret && !nbus_test_received(self, ch, 1) && ch[1].auth.rejected == 1;
+
+	/* A new epoch is set. The sync requests reflected must not be accepted as
+	 * the response of the peer. */
+	nbus_test_epoch++;
+	ret = ret && nbus_channel_set_key(&ch[1], NBUS_MAC_SIPHASH, nbus_test_key, sizeof(nbus_test_key), nbus_test_epoch) == NBUS_RET_OK;
+	vTaskDelay(pdMS_TO_TICKS(300));
+	ret = ret && !ch[1].auth.synced && ch[1].auth.rejected > 0;
+	port->peer = &self->port[0];
+
+	return nbus_test_auth_pair_release(ch) && ret;
+}
+
+
+static bool nbus_test_reject_if_tampered(void) {
+	struct nbus_test_bus *self = nbus_test_bus_get();
+	if (self == NULL) {
+		return false;
+	}
+	NbusChannel *ch = nbus_test_auth_pair_get(self, NBUS_MAC_SIPHASH);
+	if (ch == NULL || !nbus_test_capture(self, ch, 1)) {
+		return false;
+	}
+	size_t trailing = self->port[0].captured_len - 1;
+
+	/* Modify the data, the counter and the MAC in the trailing frame, the
+	 * endpoint, the leading frame counter, the stream and the direction. */
+	const struct nbus_test_tamper tamper[] = {
+		{.frame = 1, .byte = 0, .mask = 0x01},
+		{.frame = trailing, .byte = 0, .mask = 0x01},
+		{.frame = trailing, .byte = 4, .mask = 0x80},
+		{.frame = 0, .byte = -1, .mask = 0x02},
+		{.frame = 0, .byte = 0, .mask = 0x01},
+		{.frame = NBUS_TEST_CAPTURE, .byte = -1, .mask = 1 << 8},
+		{.frame = NBUS_TEST_CAPTURE, .byte = -1, .mask = 1 << 10},
+	};
+	bool ret = true;
+	for (size_t i = 0; ret && i < sizeof(tamper) / sizeof(tamper[0]); i++) {
+		uint32_t rejected = ch[1].auth.rejected;
+		ret = nbus_test_inject(self, &tamper[i]) && !nbus_test_received(self, ch, 1) && ch[1].auth.rejected > rejected;
+		if (!ret) {
+			u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("tampered packet %u accepted"), i);
+		}
+	}
+
+	/* The original packet is still accepted. */
+	ret = ret && nbus_test_inject(self, &nbus_test_untampered) && nbus_test_received(self, ch, 1);
+
+	return nbus_test_auth_pair_release(ch) && ret;
+}
+
+
+static bool nbus_test_reject_if_replayed(void) {
+	struct nbus_test_bus *self = nbus_test_bus_get();
+	if (self == NULL) {
+		return false;
+	}
+	NbusChannel *ch = nbus_test_auth_pair_get(self, NBUS_MAC_SIPHASH);
+	if (ch == NULL || !nbus_test_capture(self, ch, 1)) {
+		return false;
+	}
+
+	bool ret = nbus_test_inject(self, &nbus_test_untampered) && nbus_test_received(self, ch, 1);
+	ret = ret && nbus_test_inject(self, &nbus_test_untampered) && !nbus_test_received(self, ch, 1) && ch[1].auth.replayed == 1;
+
+	/* A newer packet is accepted, the recorded one is still not. */
+	ret = ret && nbus_test_send(self, &ch[0], &ch[1], NBUS_TEST_AUTH_LEN, 2);
+	ret = ret && nbus_test_inject(self, &nbus_test_untampered) && !nbus_test_received(self, ch, 1) && ch[1].auth.replayed == 2;
+
+	/* The peer sets a new epoch. Packets recorded with the previous one are rejected. */
+	nbus_test_epoch++;
+	ret = ret && nbus_channel_set_key(&ch[1], NBUS_MAC_SIPHASH, nbus_test_key, sizeof(nbus_test_key), nbus_test_epoch) == NBUS_RET_OK;
+	TickType_t start = xTaskGetTickCount();
+	while (ret && !ch[1].auth.synced) {
+		ret = (xTaskGetTickCount() - start) <= pdMS_TO_TICKS(NBUS_TEST_TIMEOUT_MS);
+		vTaskDelay(pdMS_TO_TICKS(10));
+	}
+	ret = ret && nbus_test_inject(self, &nbus_test_untampered) && !nbus_test_received(self, ch, 1) && ch[1].auth.rejected == 1;
+
+	return nbus_test_auth_pair_release(ch) && ret;
+}
+
+
+static bool nbus_test_key_if_bad_param(void) {
+	struct nbus_test_bus *self = nbus_test_bus_get();
+	if (self == NULL) {
+		return false;
+	}
+	nbus_set_fd(&self->nbus[0], false, false);
+	nbus_set_fd(&self->nbus[1], false, false);
+	NbusChannel *ch = nbus_test_pair_get(self, NBUS_TEST_PAIR_AUTH);
+	if (ch == NULL) {
+		return false;
+	}
+
+	/* BLAKE2s trailing frames don't fit classic CAN frames. */
+	bool ret = nbus_channel_set_key(&ch[0], NBUS_MAC_SIPHASH, nbus_test_key, NBUS_KEY_SIZE - 1, 1) == NBUS_RET_BAD_PARAM &&
+	           nbus_channel_set_key(&ch[0], NBUS_MAC_SIPHASH, NULL, NBUS_KEY_SIZE, 1) == NBUS_RET_BAD_PARAM &&
+	           nbus_channel_set_key(&ch[0], NBUS_MAC_BLAKE2S, nbus_test_key, NBUS_KEY_SIZE, 1) == NBUS_RET_BAD_PARAM;
+
+	/* Packets are not sent until the peer epoch is known. */
+	nbus_test_epoch++;
+	ret = ret && nbus_channel_set_key(&ch[0], NBUS_MAC_SIPHASH, nbus_test_key, NBUS_KEY_SIZE, nbus_test_epoch) == NBUS_RET_OK;
+	ret = ret && nbus_channel_send(&ch[0], NBUS_TEST_EP, self->buf, NBUS_TEST_AUTH_LEN) == NBUS_RET_FAILED;
+
+	/* A removed key disables the authentication. */
+	return nbus_test_auth_pair_release(ch) && ret && nbus_test_exchange(self, ch, NBUS_TEST_AUTH_LEN);
+}
+
+
+static bool nbus_test_add_if_limited(void) {
+	/* Channels are only linked by nbus_add_channel, they need not be initialised. */
+	Nbus *nbus = calloc(1, sizeof(Nbus));
+	NbusChannel *ch = calloc(NBUS_MAX_CHANNELS + 1, sizeof(NbusChannel));
+	bool ret = nbus != NULL && ch != NULL;
+
+	for (size_t i = 0; ret && i < NBUS_MAX_CHANNELS; i++) {
+		ret = nbus_add_channel(nbus, &ch[i]) == NBUS_RET_OK;
+	}
+	ret = ret && nbus_add_channel(nbus, &ch[NBUS_MAX_CHANNELS]) == NBUS_RET_FAILED && nbus->channels == NBUS_MAX_CHANNELS;
+
+	free(ch);
+	free(nbus);
+	return ret;
+}
+
+
+bool nbus_tests(void) {
+	bool res = true;
+
+	res &= u_test(nbus_test_fd_if_both_fd());
+	res &= u_test(nbus_test_classic_if_peer_classic());
+	res &= u_test(nbus_test_fd_if_brs_disabled());
+	res &= u_test(nbus_test_reassembly_if_interleaved());
+	res &= u_test(nbus_test_context_if_expired());
+	res &= u_test(nbus_test_in_order_if_lossy());
+	res &= u_test(nbus_test_auth_if_same_epoch());
+	res &= u_test(nbus_test_reject_if_reflected());
+	res &= u_test(nbus_test_reject_if_tampered());
+	res &= u_test(nbus_test_reject_if_replayed());
+	res &= u_test(nbus_test_key_if_bad_param());
+	res &= u_test(nbus_test_add_if_limited());
+
+	return res;
+}
+
+
+static bool nbus_test_bench(struct nbus_test_bus *self, bool fd, uint32_t *time_ms) {
+	nbus_set_fd(&self->nbus[0], fd, fd);
+	nbus_set_fd(&self->nbus[1], fd, fd);
+	NbusChannel *ch = nbus_test_pair_get(self, NBUS_TEST_PAIR_BENCH);
+	if (ch == NULL) {
+		return false;
+	}
+	/* Let both sides negotiate the fragment size first. */
+	if (!nbus_test_exchange(self, ch, 8)) {
+		return false;
+	}
+	nbus_test_port_clear(&self->port[0]);
+
+	TickType_t start = xTaskGetTickCount();
+	for (uint32_t i = 0; i < NBUS_TEST_BENCH_PACKETS; i++) {
+		if (!nbus_test_send(self, &ch[0], &ch[1], NBUS_TEST_BENCH_LEN, i)) {
+			return false;
+		}
+	}
+	*time_ms = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+
+	return ch[0].frag_size == (fd ? NBUS_FRAG_SIZE_FD : NBUS_FRAG_SIZE_CLASSIC);
+}
+
+
+bool nbus_tests_throughput(void) {
+	struct nbus_test_bus *self = nbus_test_bus_get();
+	if (self == NULL) {
+		return false;
+	}
+	bool res = true;
+
+	for (size_t i = 0; i < 2; i++) {
+		bool fd = (i == 1);
+		uint32_t time_ms = 0;
+		bool r = nbus_test_bench(self, fd, &time_ms);
+		struct nbus_test_port *port = &self->port[0];
+		u_log(system_log, r ? LOG_TYPE_INFO : LOG_TYPE_ERROR,
+			U_LOG_MODULE_PREFIX("%u B fragments: %u frames, %u B per %u B packet, %u packets in %u ms (%u us per packet)"),
+			fd ? NBUS_FRAG_SIZE_FD : NBUS_FRAG_SIZE_CLASSIC,
+			port->frames / NBUS_TEST_BENCH_PACKETS, port->bytes / NBUS_TEST_BENCH_PACKETS, NBUS_TEST_BENCH_LEN,
+			NBUS_TEST_BENCH_PACKETS, time_ms, time_ms * 1000 / NBUS_TEST_BENCH_PACKETS
+		);
+		res &= r;
+	}
+
+	return res;
+}
+
+
+static bool nbus_test_bench_auth(struct nbus_test_bus *self, enum nbus_mac mac, uint32_t *time_ms) {
+	NbusChannel *ch = nbus_test_auth_pair_get(self, mac);
+	if (ch == NULL) {
+		return false;
+	}
+	bool ret = nbus_test_exchange(self, ch, 8);
+	nbus_test_port_clear(&self->port[0]);
+
+	TickType_t start = xTaskGetTickCount();
+	for (uint32_t i = 0; ret && i < NBUS_TEST_BENCH_PACKETS; i++) {
+		ret = nbus_test_send(self, &ch[0], &ch[1], NBUS_TEST_BENCH_LEN, i);
+	}
+	*time_ms = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+
+	return nbus_test_auth_pair_release(ch) && ret;
+}
+
+
+bool nbus_tests_cost(void) {
+	struct nbus_test_bus *self = nbus_test_bus_get();
+	if (self == NULL) {
+		return false;
+	}
+	bool res = true;
+
+	const struct {
+		enum nbus_mac mac;
+		const char *name;
+	} macs[] = {
+		{NBUS_MAC_NONE, "none"},
+		{NBUS_MAC_SIPHASH, "SipHash-2-4"},
+		{NBUS_MAC_BLAKE2S, "BLAKE2s-96"},
+	};
+	for (size_t i = 0; i < sizeof(macs) / sizeof(macs[0]); i++) {
+		uint32_t time_ms = 0;
+		bool r = nbus_test_bench_auth(self, macs[i].mac, &time_ms);
+		struct nbus_test_port *port = &self->port[0];
+		u_log(system_log, r ? LOG_TYPE_INFO : LOG_TYPE_ERROR,
+			U_LOG_MODULE_PREFIX("%s: %u B per %u B packet, %u packets in %u ms (%u us per packet)"),
+			macs[i].name, port->bytes / NBUS_TEST_BENCH_PACKETS, NBUS_TEST_BENCH_LEN,
+			NBUS_TEST_BENCH_PACKETS, time_ms, time_ms * 1000 / NBUS_TEST_BENCH_PACKETS
+		);
+		res &= r;
+	}
+
+	return res;
+}
@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * nbus tests
+ *
+ * Copyright (c) 2023, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * Connect two nbus instances with a loopback CAN bus and exchange packets
+ * between them. Check the fragment size negotiated by CAN-FD and classic
+ * CAN peers and the bit-rate switch flag of the frames sent. Reassemble
+ * packets with interleaved fragments and reuse contexts of stalled packets.
+ * Deliver reliable mode packets in order over a bus losing frames. Exchange
+ * authenticated packets between sides using the same epoch, reject packets
+ * reflected, modified or replayed.
+ */
+bool nbus_tests(void);
+
+/**
+ * Send 512 byte packets over the loopback bus using 8 and 64 byte fragments.
+ * Log the number of frames and bytes sent per packet and the time spent.
+ */
+bool nbus_tests_throughput(void);
+
+/**
+ * Send 512 byte packets over the loopback bus without authentication and
+ * authenticated using SipHash and BLAKE2s. Log the time spent per packet.
+ */
+bool nbus_tests_cost(void);
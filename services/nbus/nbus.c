@@ -16,6 +16,7 @@
 #include <interfaces/can.h>
 #include "nbus.h"
 #include "blake2s-siv.h"
+#include "siphash.h"
 #include "cc-rpc.h"
 
 #define MODULE_NAME "nbus"
@@ -24,22 +25,46 @@
  * @brief NBUS tl;dr
  *
  * NBUS uses a CAN2.0b or CAN-FD frames with 29 bit identifiers arranged as:
- * rrrr cccc cccc cccc cccc DDrr oooo oooo
+ * rrrr cccc cccc cccc cccc DDss oooo oooo
  *
  * - r - reserved for future use
  * - c - 16 bit channel identifier
  * - DD - request = 01, response = 01, publish = 10, subscribe = 11
+ * - ss - stream, fragments of packets sent over different streams may interleave.
+ *        The receiver reassembles packets of each direction and stream separately.
+ *        The sender selects the stream with nbus_channel_send_stream, responses
+ *        use the stream of the last received packet.
  * - o - opcode, these bits are the last, all opcodes within a channel are equal priority
  *
  * Opcodes:
  * 0x00-0x3f - leading fragment, endpoints 0-63, 0 is the descriptor endpoint
  *             counter (4 bytes)
  *             frame length (2 bytes)
- *             flags (2 bytes)
- * 0x40-0xbf - data fragment
- * 0xc0      - blake2s-SIV trailing fragment
- *             MAC (8, 16 or 32 bytes allowed)
+ *             flags (2 bytes), bit 0 = the sender accepts 64 byte CAN-FD fragments,
+ *             bit 1 = reliable stream packet (counter is the sequence number),
+ *             bit 2 = first packet of a new reliable stream,
+ *             bit 3 = reliable stream acknowledgement (authenticated channels)
+ * 0x40-0xbf - data fragment, 8 bytes for classic CAN peers, up to 64 bytes
+ *             for CAN-FD peers. CAN-FD fragments are padded to a valid
+ *             CAN-FD length, the padding is ignored by the receiver.
+ * 0xc0      - trailing fragment
+ *             8 zero bytes if the channel is not authenticated, otherwise
+ *             message counter (4 bytes)
+ *             MAC (4 bytes SipHash or 12 bytes BLAKE2s)
  * 0xc1      - short-ID advertisement
+ *             Never authenticated. A forged advertisement can only make the
+ *             channel drop its channel-id and choose a new one.
+ * 0xc2      - reliable stream acknowledgement
+ *             next expected sequence number (4 bytes)
+ *             bitmap of packets received out of order (4 bytes)
+ *             Not used on authenticated channels, the acknowledgement is sent
+ *             as an authenticated packet with the bit 3 flag set instead.
+ * 0xc3      - authentication session synchronisation, the request direction
+ *             asks the peer for a response
+ *             epoch of the sender (4 bytes)
+ *             MAC (4 bytes SipHash or 12 bytes BLAKE2s) of the channel, direction,
+ *             direction of the sender's packets, sender epoch and the requester
+ *             epoch (responses only)
  *
  * @todo
  *
@@ -59,6 +84,7 @@ void nbus_parse_id(uint32_t id, struct nbus_id *sid) {
 	sid->channel = (id >> 12) & 0xffff;
 	sid->opcode = id & 0xff;
 	sid->direction = (id >> 10) & 0x3;
+	sid->stream = (id >> 8) & 0x3;
 }
 
 
@@ -66,6 +92,7 @@ uint32_t nbus_build_id(struct nbus_id *id) {
 	uint32_t r = 0U;
 	r += id->channel << 12;
 	r += id->direction << 10;
+	r += id->stream << 8;
 	r += id->opcode;
 	return r;
 }
@@ -81,12 +108,17 @@ uint32_t nbus_build_id(struct nbus_id *id) {
  * Beware the data buffer is not yet assigned nor allocated. Use @p nbus_txpacket_buf_ref or @p nbus_txpacket_buf_copy
  * to set the packet data.
  */
-static nbus_ret_t nbus_txpacket_init(NbusTxPacket *self, nbus_channel_id_t channel_id, nbus_endpoint_t ep, uint32_t packet_counter) {
+static nbus_ret_t nbus_txpacket_init(NbusTxPacket *self, nbus_channel_id_t channel_id, enum nbus_direction direction, nbus_endpoint_t ep, uint8_t stream, uint32_t packet_counter, size_t frag_size, uint16_t flags) {
 	memset(self, 0, sizeof(NbusTxPacket));
 
 	self->channel_id = channel_id;
+	self->direction = direction;
 	self->ep = ep;
+	self->stream = stream;
 	self->packet_counter = packet_counter;
+	self->frag_size = frag_size;
+	self->flags = flags;
+	self->trailing_len = NBUS_SIV_LEN;
 	self->state = NBUS_TXP_LEADING;
 	return NBUS_RET_OK;
 }
@@ -111,7 +143,8 @@ static nbus_ret_t nbus_txpacket_get_fragment(NbusTxPacket *self, struct nbus_id
 	switch (self->state) {
 		case NBUS_TXP_LEADING: {
 			id->channel = self->channel_id;
-			id->direction = NBUS_DIR_RESPONSE;
+			id->direction = self->direction;
+			id->stream = self->stream;
 			id->opcode = NBUS_OP_LEADING_MIN + self->ep;
 
 			struct nbus_leading_frame_msg lfbuf = {
@@ -122,7 +155,7 @@ static nbus_ret_t nbus_txpacket_get_fragment(NbusTxPacket *self, struct nbus_id
 				 * value as we sent before. */
 				.counter = self->packet_counter,
 				.len = self->len,
-				.flags = 0
+				.flags = self->flags
 			};
 			memcpy(data, &lfbuf, sizeof(lfbuf));
 			*len = sizeof(lfbuf);
@@ -135,13 +168,13 @@ static nbus_ret_t nbus_txpacket_get_fragment(NbusTxPacket *self, struct nbus_id
 		case NBUS_TXP_DATA: {
 			/* Construct and send the frame containing the chunk data. */
 			id->channel = self->channel_id;
-			id->direction = NBUS_DIR_RESPONSE;
+			id->direction = self->direction;
+			id->stream = self->stream;
 			id->opcode = NBUS_OP_DATA_MIN + self->next_frag;
 
 			size_t frag_len = self->len - self->packet_sent;
-			/** @todo limit properly to CAN MTU */
-			if (frag_len > 8) {
-				frag_len = 8;
+			if (frag_len > self->frag_size) {
+				frag_len = self->frag_size;
 			}
 			memcpy(data, (uint8_t *)self->buf + self->packet_sent, frag_len);
 			*len = frag_len;
@@ -155,12 +188,12 @@ static nbus_ret_t nbus_txpacket_get_fragment(NbusTxPacket *self, struct nbus_id
 		}
 		case NBUS_TXP_TRAILING: {
 			id->channel = self->channel_id;
-			id->direction = NBUS_DIR_RESPONSE;
+			id->direction = self->direction;
+			id->stream = self->stream;
 			id->opcode = NBUS_OP_TRAILING;
 
-			uint8_t siv[NBUS_SIV_LEN] = {0};
-			memcpy(data, siv, sizeof(siv));
-			*len = sizeof(siv);
+			memcpy(data, self->trailing, self->trailing_len);
+			*len = self->trailing_len;
 
 			self->state = NBUS_TXP_DONE;
 			break;
@@ -186,11 +219,6 @@ static nbus_ret_t nbus_rxpacket_init(NbusRxPacket *self, size_t max_size) {
 	}
 	self->buf_size = max_size;
 
-	self->done = xSemaphoreCreateBinary();
-	if (self->done == NULL) {
-		return NBUS_RET_FAILED;
-	}
-
 	self->state = NBUS_RXP_READY;
 	return NBUS_RET_OK;
 }
@@ -200,26 +228,26 @@ static nbus_ret_t nbus_rxpacket_free(NbusRxPacket *self) {
 	free(self->buf);
 	self->buf = NULL;
 	self->buf_size = 0;
-	vSemaphoreDelete(self->done);
 	return NBUS_RET_OK;
 }
 
 
 static nbus_ret_t nbus_rxpacket_reset(NbusRxPacket *self) {
+	self->held = false;
 	self->state = NBUS_RXP_READY;
 	return NBUS_RET_OK;
 }
 
 
-static nbus_ret_t nbus_rxpacket_wait(NbusRxPacket *self, uint32_t timeout_ms) {
-	if (self->state == NBUS_RXP_DONE) {
-		return NBUS_RET_OK;
-	}
-	if (xSemaphoreTake(self->done, timeout_ms) == pdTRUE) {
-		return NBUS_RET_OK;
-	}
+/* A context is busy if it is assembling a packet or if it holds a complete
+ * packet not yet received by the channel user. */
+static bool nbus_rxpacket_busy(NbusRxPacket *self) {
+	return self->state == NBUS_RXP_DATA || self->state == NBUS_RXP_TRAILING || self->state == NBUS_RXP_DONE;
+}
+
 
-	return NBUS_RET_VOID;
+static bool nbus_rxpacket_expired(NbusRxPacket *self, TickType_t now) {
+	return (now - self->last_update) > pdMS_TO_TICKS(NBUS_RX_TIMEOUT_MS);
 }
 
 
@@ -233,17 +261,13 @@ static nbus_ret_t nbus_rxpacket_append(NbusRxPacket *self, struct nbus_id *id, v
 	switch (id->opcode) {
 		case NBUS_OP_LEADING_MIN ... NBUS_OP_LEADING_MAX: {
 			/* Leading frame is always dominant wrt. packet processing. Whatever the actual state is,
-			 * a leading frame always causes its reset. Consider generating a warning if a different
-			 * endpoint packet is currently being assembled as this means the endpoint data is
-			 * interleaved (forbidden condition). */
+			 * a leading frame always causes its reset. The context is selected by the channel
+			 * (see nbus_channel_rx_context), a complete packet is never overwritten. */
 			nbus_endpoint_t ep = id->opcode - NBUS_OP_LEADING_MIN;
 			struct nbus_leading_frame_msg *lf = buf;
 
-			/* The previous packet was correctly finished and set to the DONE state but nobody
-			 * bothered to get its data and reset the FSM back. */
-			if (self->state == NBUS_RXP_DONE) {
-				u_log(system_log, LOG_TYPE_WARN, U_LOG_MODULE_PREFIX("nobody receiving"));
-				self->state = NBUS_RXP_READY;
+			if (len < sizeof(struct nbus_leading_frame_msg)) {
+				return NBUS_RET_FAILED;
 			}
 
 			if (self->state != NBUS_RXP_READY) {
@@ -264,6 +288,11 @@ static nbus_ret_t nbus_rxpacket_append(NbusRxPacket *self, struct nbus_id *id, v
 			self->expected_packet_size = lf->len;
 			self->frame_expected = 0;
 			self->ep = ep;
+			self->flags = lf->flags;
+			self->counter = lf->counter;
+			self->held = false;
+			self->direction = id->direction;
+			self->stream = id->stream;
 
 			self->state = NBUS_RXP_DATA;
 
@@ -272,14 +301,24 @@ static nbus_ret_t nbus_rxpacket_append(NbusRxPacket *self, struct nbus_id *id, v
 		}
 
 		case NBUS_OP_DATA_MIN ... NBUS_OP_DATA_MAX: {
+			/* A fragment was lost. Invalidate the packet, otherwise fragments of the next
+			 * packet with a missing leading frame could be appended to it. */
 			if (self->state != NBUS_RXP_DATA) {
+				self->state = NBUS_RXP_INVALID;
 				return NBUS_RET_FAILED;
 			}
 			uint32_t frame = id->opcode - NBUS_OP_DATA_MIN;
 			if (self->frame_expected != frame) {
 				// u_log(system_log, LOG_TYPE_DEBUG, U_LOG_MODULE_PREFIX("enexpected frame %u"), frame);
+				self->state = NBUS_RXP_INVALID;
 				return NBUS_RET_FAILED;
 			}
+			/* The last CAN-FD fragment may be padded to the nearest valid CAN-FD frame length.
+			 * Classic CAN frames are never padded. */
+			size_t remaining = self->expected_packet_size - self->packet_size;
+			if (len > NBUS_FRAG_SIZE_CLASSIC && len > remaining) {
+				len = remaining;
+			}
 			/* Do not receive more data than is the maximum packet size (checked during the leading
 			 * frame processing). */
 			if ((self->packet_size + len) > self->expected_packet_size) {
@@ -304,20 +343,12 @@ static nbus_ret_t nbus_rxpacket_append(NbusRxPacket *self, struct nbus_id *id, v
 				self->state = NBUS_RXP_INVALID;
 				return NBUS_RET_FAILED;
 			}
-			/* Do not check packet size. It is correct if the state is ok. */
-
-			/** @todo check the MAC here */
-
+			/* Do not check packet size. It is correct if the state is ok.
+			 * The MAC is verified by the channel (nbus_auth_verify). */
 			self->state = NBUS_RXP_DONE;
-			xSemaphoreGive(self->done);
 			break;
 		}
 
-		case NBUS_OP_ADVERTISEMENT:
-			/* An advertisement opcode has been received for the same channel-id. This basically means
-			 * there is a channel-id conflict on the bus. Retreat by invalidating the current channel-id. */
-			return NBUS_RET_INVALID;
-
 		default:
 			return NBUS_RET_FAILED;
 	}
@@ -325,6 +356,320 @@ static nbus_ret_t nbus_rxpacket_append(NbusRxPacket *self, struct nbus_id *id, v
 }
 
 
+/**********************************************************************************************************************
+ * nbus message authentication
+ *
+ * A single MAC is computed using the whole key over a header identifying the packet followed by the packet data. The
+ * header contains the epochs of the sender and the receiver. The message counter is incremented for every packet sent
+ * (including retransmissions) and it is used for replay protection only. It is independent of the leading frame
+ * counter.
+ *
+ * Both sides learn the epoch of the peer using a request/response exchange of NBUS_OP_SYNC frames. The response MAC
+ * covers the requester epoch, a recorded response is never accepted by a restarted requester. A newer epoch of
+ * the peer starts a new replay window, older epochs are ignored.
+ *
+ * The epochs of the two sides may be equal. The MAC input of both packets and sync frames contains the direction of
+ * the packets sent by the signing side (request for the initiator, response for the peripheral). The receiver
+ * verifies them with the direction of the peer, frames of this side reflected back to it are rejected.
+ **********************************************************************************************************************/
+
+/* The first byte of the MAC input, separates packets and sync frames. */
+#define NBUS_MAC_TYPE_PACKET 0
+#define NBUS_MAC_TYPE_SYNC 1
+
+struct __attribute__((__packed__)) nbus_mac_header {
+	uint8_t type;
+	uint32_t tx_epoch;
+	uint32_t rx_epoch;
+	uint32_t mac_counter;
+	uint16_t channel;
+	uint8_t direction;
+	uint8_t stream;
+	uint8_t ep;
+	uint32_t counter;
+	uint16_t len;
+	uint16_t flags;
+};
+
+struct __attribute__((__packed__)) nbus_sync_header {
+	uint8_t type;
+	uint16_t channel;
+	uint8_t direction;
+	/* Direction of the packets sent by the side sending the frame. */
+	uint8_t sender;
+	uint32_t epoch;
+	/* Epoch of the requester in a response, zero in a request. */
+	uint32_t requester_epoch;
+};
+
+
+static nbus_ret_t nbus_channel_send_frame(NbusChannel *self, struct nbus_id *id, void *buf, size_t len);
+
+
+static size_t nbus_auth_mac_len(enum nbus_mac mac) {
+	switch (mac) {
+		case NBUS_MAC_SIPHASH:
+			return NBUS_MAC_SIPHASH_LEN;
+		case NBUS_MAC_BLAKE2S:
+			return NBUS_MAC_BLAKE2S_LEN;
+		default:
+			return 0;
+	}
+}
+
+
+static void nbus_auth_mac(struct nbus_auth *self, const void *h, size_t hlen, const void *buf, size_t len, uint8_t *mac) {
+	switch (self->mac) {
+		case NBUS_MAC_SIPHASH: {
+			struct siphash_state s;
+			siphash_init(&s, self->key);
+			siphash_update(&s, h, hlen);
+			siphash_update(&s, buf, len);
+			uint64_t r = siphash_final(&s);
+			for (size_t i = 0; i < NBUS_MAC_SIPHASH_LEN; i++) {
+				mac[i] = (uint8_t)(r >> (8 * i));
+			}
+			break;
+		}
+		case NBUS_MAC_BLAKE2S: {
+			blake2s_state s;
+			blake2s_init_key(&s, NBUS_MAC_BLAKE2S_LEN, self->key, NBUS_KEY_SIZE);
+			blake2s_update(&s, h, hlen);
+			blake2s_update(&s, buf, len);
+			blake2s_final(&s, mac, NBUS_MAC_BLAKE2S_LEN);
+			break;
+		}
+		default:
+			break;
+	}
+}
+
+
+static bool nbus_auth_mac_equal(const uint8_t *a, const uint8_t *b, size_t len) {
+	/* Compare in constant time. */
+	uint8_t diff = 0;
+	for (size_t i = 0; i < len; i++) {
+		diff |= a[i] ^ b[i];
+	}
+	return diff == 0;
+}
+
+
+/* Packets of the peer are sent in the opposite direction. */
+static enum nbus_direction nbus_channel_peer_direction(NbusChannel *self) {
+	return (self->direction == NBUS_DIR_REQUEST) ? NBUS_DIR_RESPONSE : NBUS_DIR_REQUEST;
+}
+
+
+static void nbus_auth_send_sync(NbusChannel *self, enum nbus_direction direction) {
+	struct nbus_auth *a = &self->auth;
+	struct nbus_sync_header h = {
+		.type = NBUS_MAC_TYPE_SYNC,
+		.channel = self->channel_id,
+		.direction = direction,
+		.sender = self->direction,
+		.epoch = a->epoch,
+		.requester_epoch = (direction == NBUS_DIR_RESPONSE) ? a->peer_epoch : 0,
+	};
+	struct nbus_sync_msg msg = {
+		.epoch = a->epoch,
+	};
+	nbus_auth_mac(a, &h, sizeof(h), NULL, 0, msg.mac);
+
+	struct nbus_id id = {
+		.channel = self->channel_id,
+		.direction = direction,
+		.opcode = NBUS_OP_SYNC,
+	};
+	nbus_channel_send_frame(self, &id, &msg, sizeof(msg.epoch) + nbus_auth_mac_len(a->mac));
+}
+
+
+/**
+ * @brief Process a NBUS_OP_SYNC frame received from the peer
+ *
+ * Requests are answered even if the epoch is already known, the previous
+ * response may have been lost.
+ */
+static void nbus_auth_process_sync(NbusChannel *self, struct nbus_id *id, const void *buf, size_t len) {
+	struct nbus_auth *a = &self->auth;
+	size_t mac_len = nbus_auth_mac_len(a->mac);
+	if (mac_len == 0 || (id->direction != NBUS_DIR_REQUEST && id->direction != NBUS_DIR_RESPONSE)) {
+		return;
+	}
+
+	struct nbus_sync_msg msg;
+	if (len < sizeof(msg.epoch) + mac_len) {
+		a->rejected++;
+		return;
+	}
+	memcpy(&msg, buf, sizeof(msg.epoch) + mac_len);
+
+	struct nbus_sync_header h = {
+		.type = NBUS_MAC_TYPE_SYNC,
+		.channel = self->channel_id,
+		.direction = id->direction,
+		.sender = nbus_channel_peer_direction(self),
+		.epoch = msg.epoch,
+		.requester_epoch = (id->direction == NBUS_DIR_RESPONSE) ? a->epoch : 0,
+	};
+	uint8_t mac[NBUS_MAC_MAX_LEN];
+	nbus_auth_mac(a, &h, sizeof(h), NULL, 0, mac);
+	if (!nbus_auth_mac_equal(mac, msg.mac, mac_len)) {
+		a->rejected++;
+		return;
+	}
+
+	/* Packets are signed using the epochs under the tx lock, do not change them meanwhile. */
+	xSemaphoreTake(self->tx_lock, portMAX_DELAY);
+	if (a->synced && (int32_t)(msg.epoch - a->peer_epoch) < 0) {
+		/* An old epoch, probably a recorded frame. */
+		a->replayed++;
+		xSemaphoreGive(self->tx_lock);
+		return;
+	}
+	if (!a->synced || msg.epoch != a->peer_epoch) {
+		/* The peer was restarted, start a new replay window. */
+		a->peer_epoch = msg.epoch;
+		a->rx_counter = 0;
+		a->rx_window = 0;
+		a->synced = true;
+	}
+	xSemaphoreGive(self->tx_lock);
+
+	if (id->direction == NBUS_DIR_REQUEST) {
+		nbus_auth_send_sync(self, NBUS_DIR_RESPONSE);
+	}
+}
+
+
+/**
+ * @brief Prepare the trailing frame of a packet to be sent
+ */
+static nbus_ret_t nbus_auth_sign(struct nbus_auth *self, NbusTxPacket *p) {
+	if (self->mac == NBUS_MAC_NONE) {
+		return NBUS_RET_OK;
+	}
+	/* The peer wouldn't be able to verify the packet. */
+	if (!self->synced) {
+		return NBUS_RET_FAILED;
+	}
+	/* Never reuse a counter value. A new key must be set. */
+	if (self->tx_counter == UINT32_MAX) {
+		return NBUS_RET_FAILED;
+	}
+	self->tx_counter++;
+
+	struct nbus_mac_header h = {
+		.type = NBUS_MAC_TYPE_PACKET,
+		.tx_epoch = self->epoch,
+		.rx_epoch = self->peer_epoch,
+		.mac_counter = self->tx_counter,
+		.channel = p->channel_id,
+		.direction = p->direction,
+		.stream = p->stream,
+		.ep = p->ep,
+		.counter = p->packet_counter,
+		.len = p->len,
+		.flags = p->flags,
+	};
+	struct nbus_trailing_frame_msg tf = {
+		.counter = self->tx_counter,
+	};
+	nbus_auth_mac(self, &h, sizeof(h), p->buf, p->len, tf.mac);
+
+	p->trailing_len = sizeof(tf.counter) + nbus_auth_mac_len(self->mac);
+	memcpy(p->trailing, &tf, p->trailing_len);
+	return NBUS_RET_OK;
+}
+
+
+static bool nbus_auth_replayed(struct nbus_auth *self, uint32_t counter) {
+	uint32_t d = self->rx_counter - counter;
+	if ((int32_t)d < 0) {
+		/* Newer than any counter received. */
+		return false;
+	}
+	if (d == 0 || d > NBUS_REPLAY_WINDOW) {
+		return true;
+	}
+	return self->rx_window & (1UL << (d - 1));
+}
+
+
+static void nbus_auth_update_window(struct nbus_auth *self, uint32_t counter) {
+	uint32_t d = counter - self->rx_counter;
+	if ((int32_t)d > 0) {
+		/* Slide the window, the previous highest counter becomes bit d - 1. */
+		if (d > NBUS_REPLAY_WINDOW) {
+			self->rx_window = 0;
+		} else {
+			self->rx_window = ((d < 32) ? (self->rx_window << d) : 0) | (1UL << (d - 1));
+		}
+		self->rx_counter = counter;
+	} else {
+		self->rx_window |= 1UL << (self->rx_counter - counter - 1);
+	}
+}
+
+
+/**
+ * @brief Verify the MAC and the counter of a completely received packet
+ *
+ * @param direction Direction of the packets sent by the peer
+ * @param buf Content of the trailing frame
+ */
+static nbus_ret_t nbus_auth_verify(struct nbus_auth *self, nbus_channel_id_t channel, enum nbus_direction direction, NbusRxPacket *ctx, const void *buf, size_t len) {
+	if (self->mac == NBUS_MAC_NONE) {
+		return NBUS_RET_OK;
+	}
+	/* Not synced yet or a packet of this side reflected back to it. */
+	if (!self->synced || ctx->direction != direction) {
+		self->rejected++;
+		return NBUS_RET_FAILED;
+	}
+
+	/* CAN-FD trailing frames may be padded. */
+	size_t mac_len = nbus_auth_mac_len(self->mac);
+	struct nbus_trailing_frame_msg tf;
+	if (len < sizeof(tf.counter) + mac_len) {
+		self->rejected++;
+		return NBUS_RET_FAILED;
+	}
+	memcpy(&tf, buf, sizeof(tf.counter) + mac_len);
+
+	struct nbus_mac_header h = {
+		.type = NBUS_MAC_TYPE_PACKET,
+		.tx_epoch = self->peer_epoch,
+		.rx_epoch = self->epoch,
+		.mac_counter = tf.counter,
+		.channel = channel,
+		.direction = direction,
+		.stream = ctx->stream,
+		.ep = ctx->ep,
+		.counter = ctx->counter,
+		.len = ctx->packet_size,
+		.flags = ctx->flags,
+	};
+	uint8_t mac[NBUS_MAC_MAX_LEN];
+	nbus_auth_mac(self, &h, sizeof(h), ctx->buf, ctx->packet_size, mac);
+
+	if (!nbus_auth_mac_equal(mac, tf.mac, mac_len)) {
+		self->rejected++;
+		return NBUS_RET_FAILED;
+	}
+
+	/* Only authenticated counters update the window. */
+	if (nbus_auth_replayed(self, tf.counter)) {
+		self->replayed++;
+		return NBUS_RET_FAILED;
+	}
+	nbus_auth_update_window(self, tf.counter);
+
+	return NBUS_RET_OK;
+}
+
+
 /**********************************************************************************************************************
  * nbus channel implementation
  **********************************************************************************************************************/
@@ -333,6 +678,11 @@ nbus_ret_t nbus_add_channel(Nbus *self, NbusChannel *channel) {
 	if (channel == NULL) {
 		return NBUS_RET_BAD_PARAM;
 	}
+	if (self->channels >= NBUS_MAX_CHANNELS) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("too many channels"));
+		return NBUS_RET_FAILED;
+	}
+	self->channels++;
 	channel->next = self->first;
 	channel->nbus = self;
 	self->first = channel;
@@ -356,43 +706,201 @@ nbus_ret_t nbus_channel_process_cc(NbusChannel *self, void *buf, size_t len) {
 
 
 nbus_ret_t nbus_channel_receive(NbusChannel *self, nbus_endpoint_t *ep, void *buf, size_t buf_size, size_t *len, uint32_t timeout_ms) {
-	nbus_ret_t ret = nbus_rxpacket_wait(&self->rxpacket, timeout_ms);
-	if (ret != NBUS_RET_OK) {
-		return ret;
+	uint8_t i = 0;
+	if (xQueueReceive(self->rxdone, &i, pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+		return NBUS_RET_VOID;
 	}
+	NbusRxPacket *rxpacket = &self->rxpacket[i];
+
+	/* Respond over the stream the packet was received from. */
+	self->rx_stream = rxpacket->stream;
 
 	/** @todo steal this thread for EP 0 processing. Check if ep == 0 and call c&c process. Return VOID. */
-	if (self->rxpacket.ep == 0) {
-		nbus_channel_process_cc(self, self->rxpacket.buf, self->rxpacket.packet_size);
-		nbus_rxpacket_reset(&self->rxpacket);
+	if (rxpacket->ep == 0) {
+		nbus_channel_process_cc(self, rxpacket->buf, rxpacket->packet_size);
+		nbus_rxpacket_reset(rxpacket);
 		return NBUS_RET_VOID;
 	}
 
-	if (self->rxpacket.packet_size > buf_size) {
-		nbus_rxpacket_reset(&self->rxpacket);
+	if (rxpacket->packet_size > buf_size) {
+		nbus_rxpacket_reset(rxpacket);
 		return NBUS_RET_BIG;
 	}
-	memcpy(buf, self->rxpacket.buf, self->rxpacket.packet_size);
-	*len = self->rxpacket.packet_size;
-	*ep = self->rxpacket.ep;
+	memcpy(buf, rxpacket->buf, rxpacket->packet_size);
+	*len = rxpacket->packet_size;
+	*ep = rxpacket->ep;
 
-	nbus_rxpacket_reset(&self->rxpacket);
+	nbus_rxpacket_reset(rxpacket);
 	return NBUS_RET_OK;
 }
 
 
+/**
+ * @brief Select a reassembly context for a received frame
+ *
+ * Data and trailing frames are appended to the context assembling a packet
+ * of the same direction and stream. A leading frame restarts such context,
+ * takes a free one or reuses a context which timed out. Contexts holding
+ * a complete packet are left untouched until the packet is received.
+ */
+static NbusRxPacket *nbus_channel_rx_context(NbusChannel *self, struct nbus_id *id, TickType_t now) {
+	NbusRxPacket *free_ctx = NULL;
+
+	for (size_t i = 0; i < NBUS_RX_CONTEXTS; i++) {
+		NbusRxPacket *ctx = &self->rxpacket[i];
+		if (ctx->state == NBUS_RXP_EMPTY) {
+			/* Buffer allocation failed. */
+			continue;
+		}
+		if (ctx->state == NBUS_RXP_DATA || ctx->state == NBUS_RXP_TRAILING) {
+			if (nbus_rxpacket_expired(ctx, now)) {
+				nbus_rxpacket_reset(ctx);
+			} else if (ctx->direction == id->direction && ctx->stream == id->stream) {
+				return ctx;
+			}
+		}
+		if (!nbus_rxpacket_busy(ctx) && free_ctx == NULL) {
+			free_ctx = ctx;
+		}
+	}
+
+	if (id->opcode > NBUS_OP_LEADING_MAX) {
+		/* Not a leading frame and no packet is being assembled. */
+		return NULL;
+	}
+	return free_ctx;
+}
+
+
+static void nbus_reliable_rx(NbusChannel *self, NbusRxPacket *ctx);
+static void nbus_reliable_process_ack(NbusChannel *self, void *buf, size_t len);
+
+
+static nbus_ret_t nbus_channel_rx_frame(NbusChannel *self, struct nbus_id *id, void *buf, size_t len) {
+	if (id->opcode == NBUS_OP_ADVERTISEMENT) {
+		/* An advertisement opcode has been received for the same channel-id. This basically means
+		 * there is a channel-id conflict on the bus. Retreat by invalidating the current channel-id. */
+		return NBUS_RET_INVALID;
+	}
+	if (id->opcode == NBUS_OP_SYNC) {
+		nbus_auth_process_sync(self, id, buf, len);
+		return NBUS_RET_OK;
+	}
+	if (id->opcode == NBUS_OP_ACK) {
+		if (self->auth.mac != NBUS_MAC_NONE) {
+			/* Authenticated channels accept acknowledgement packets only. */
+			self->auth.rejected++;
+			return NBUS_RET_FAILED;
+		}
+		nbus_reliable_process_ack(self, buf, len);
+		return NBUS_RET_OK;
+	}
+
+	TickType_t now = xTaskGetTickCount();
+	NbusRxPacket *ctx = nbus_channel_rx_context(self, id, now);
+	if (ctx == NULL) {
+		if (id->opcode <= NBUS_OP_LEADING_MAX) {
+			u_log(system_log, LOG_TYPE_WARN, U_LOG_MODULE_PREFIX("no free rx context, nobody receiving"));
+		}
+		return NBUS_RET_FAILED;
+	}
+
+	nbus_ret_t ret = nbus_rxpacket_append(ctx, id, buf, len);
+	if (ret != NBUS_RET_OK) {
+		return ret;
+	}
+	ctx->last_update = now;
+
+	if (id->opcode <= NBUS_OP_LEADING_MAX) {
+		/* Respond with fragments the peer is able to receive. */
+		if (self->nbus->fd && (ctx->flags & NBUS_LF_FLAG_FD)) {
+			self->frag_size = NBUS_FRAG_SIZE_FD;
+		} else {
+			self->frag_size = NBUS_FRAG_SIZE_CLASSIC;
+		}
+	}
+
+	if (ctx->state == NBUS_RXP_DONE) {
+		/* The packet was completed by the trailing frame in buf. */
+		if (nbus_auth_verify(&self->auth, self->channel_id, nbus_channel_peer_direction(self), ctx, buf, len) != NBUS_RET_OK) {
+			nbus_rxpacket_reset(ctx);
+			return NBUS_RET_FAILED;
+		}
+		if (ctx->flags & NBUS_LF_FLAG_ACK) {
+			nbus_reliable_process_ack(self, ctx->buf, ctx->packet_size);
+			nbus_rxpacket_reset(ctx);
+		} else if (ctx->flags & NBUS_LF_FLAG_RELIABLE) {
+			/* Pass in order, hold or drop. */
+			nbus_reliable_rx(self, ctx);
+		} else {
+			/* The packet is complete, pass it to the receiving thread. The queue
+			 * is long enough to hold all contexts. */
+			uint8_t i = ctx - self->rxpacket;
+			xQueueSend(self->rxdone, &i, 0);
+		}
+	}
+
+	return NBUS_RET_OK;
+}
+
+
+
+static uint32_t nbus_channel_slot(nbus_channel_id_t id) {
+	return ((uint32_t)id * 2654435769U) >> (32 - NBUS_CHANNEL_SLOTS_LOG2);
+}
+
 
 static NbusChannel *nbus_channel_find_by_id(Nbus *self, nbus_channel_id_t id) {
-	NbusChannel *ch = self->first;
-	NbusChannel *found = NULL;
-	while (ch) {
+	/* The table is never full, an empty slot terminates the probe sequence. */
+	for (uint32_t i = nbus_channel_slot(id); self->chtable[i] != NULL; i = (i + 1) & (NBUS_CHANNEL_SLOTS - 1)) {
+		NbusChannel *ch = self->chtable[i];
 		if (ch->channel_id_valid && ch->channel_id == id) {
-			found = ch;
+			return ch;
+		}
+	}
+	return NULL;
+}
+
+
+static void nbus_chtable_add(Nbus *self, NbusChannel *channel) {
+	uint32_t i = nbus_channel_slot(channel->channel_id);
+	while (self->chtable[i] != NULL) {
+		i = (i + 1) & (NBUS_CHANNEL_SLOTS - 1);
+	}
+	self->chtable[i] = channel;
+}
+
+
+/**
+ * @brief Remove the channel from the lookup table if present
+ *
+ * Channels following in the same probe sequence are shifted back to fill the
+ * gap, no tombstones are left. The channel must still have the channel-id it
+ * was added with.
+ */
+static void nbus_chtable_remove(Nbus *self, NbusChannel *channel) {
+	const uint32_t mask = NBUS_CHANNEL_SLOTS - 1;
+	uint32_t i = nbus_channel_slot(channel->channel_id);
+	while (self->chtable[i] != channel) {
+		if (self->chtable[i] == NULL) {
+			return;
+		}
+		i = (i + 1) & mask;
+	}
+
+	uint32_t j = i;
+	while (true) {
+		j = (j + 1) & mask;
+		if (self->chtable[j] == NULL) {
 			break;
 		}
-		ch = ch->next;
+		uint32_t home = nbus_channel_slot(self->chtable[j]->channel_id);
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			self->chtable[i] = self->chtable[j];
+			i = j;
+		}
 	}
-	return found;
+	self->chtable[i] = NULL;
 }
 
 
@@ -418,16 +926,8 @@ static void nbus_receive_task(void *p) {
 		}
 
 		/* Push the frame into the RX packet FSM. Check the result. */
-		nbus_ret_t ret = nbus_rxpacket_append(&channel->rxpacket, &id, msg.buf, msg.len);
-		if (ret == NBUS_RET_OK) {
-			if (channel->rxpacket.state == NBUS_RXP_DATA) {
-				/* Reception started, block any transmit attempt. */
-				/** @todo lock here */
-			} else if (channel->rxpacket.state == NBUS_RXP_DONE) {
-				/* The packet is complete, unlock the receiving tread if required. */
-				/** @todo unlock rx */
-			}
-		} else if (ret == NBUS_RET_INVALID) {
+		nbus_ret_t ret = nbus_channel_rx_frame(channel, &id, msg.buf, msg.len);
+		if (ret == NBUS_RET_INVALID) {
 			channel->channel_id_valid = false;
 		}
 	}
@@ -478,6 +978,8 @@ static cbor_rpc_ret_t nbus_channel_cc_read_version(CborRpc *self, char *buf, siz
 nbus_ret_t nbus_channel_init(NbusChannel *self, const char *name) {
 	memset(self, 0, sizeof(NbusChannel));
 	self->name = name;
+	self->direction = NBUS_DIR_RESPONSE;
+	self->frag_size = NBUS_FRAG_SIZE_CLASSIC;
 	cbor_rpc_init(&self->ccrpc);
 	self->ccrpc.parent = self;
 
@@ -501,13 +1003,45 @@ nbus_ret_t nbus_channel_init(NbusChannel *self, const char *name) {
 	self->version_handler.v_string.read = &nbus_channel_cc_read_version;
 	cbor_rpc_add_handler(&self->ccrpc, &self->version_handler);
 
-	/* RX packet instance is created only once. */
-	nbus_rxpacket_init(&self->rxpacket, NBUS_CHANNEL_MTU);
+	self->tx_lock = xSemaphoreCreateMutex();
+	if (self->tx_lock == NULL) {
+		return NBUS_RET_FAILED;
+	}
+
+	/* RX packet instances are created only once. */
+	for (size_t i = 0; i < NBUS_RX_CONTEXTS; i++) {
+		if (nbus_rxpacket_init(&self->rxpacket[i], NBUS_CHANNEL_MTU) != NBUS_RET_OK) {
+			u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("cannot allocate rx context"));
+			return NBUS_RET_FAILED;
+		}
+	}
+	self->rxdone = xQueueCreate(NBUS_RX_CONTEXTS, sizeof(uint8_t));
+	if (self->rxdone == NULL) {
+		return NBUS_RET_FAILED;
+	}
 
 	return NBUS_RET_OK;
 }
 
 
+/* Round the length up to the nearest valid CAN-FD frame length. */
+static size_t nbus_fd_frame_len(size_t len) {
+	if (len <= 8) {
+		return len;
+	}
+	if (len <= 24) {
+		return (len + 3) & ~(size_t)3;
+	}
+	if (len <= 32) {
+		return 32;
+	}
+	if (len <= 48) {
+		return 48;
+	}
+	return 64;
+}
+
+
 static nbus_ret_t nbus_channel_send_frame(NbusChannel *self, struct nbus_id *id, void *buf, size_t len) {
 	Nbus *nbus = self->nbus;
 
@@ -517,6 +1051,14 @@ static nbus_ret_t nbus_channel_send_frame(NbusChannel *self, struct nbus_id *id,
 	memcpy(&msg.buf, buf, len);
 	msg.len = len;
 
+	/* Use CAN-FD frames for the whole packet if the peer supports them. Frames
+	 * longer than a classic CAN frame are always sent as CAN-FD. */
+	if (self->frag_size > NBUS_FRAG_SIZE_CLASSIC || len > NBUS_FRAG_SIZE_CLASSIC) {
+		msg.fd = true;
+		msg.brs = nbus->brs;
+		msg.len = nbus_fd_frame_len(len);
+	}
+
 	if (nbus->can == NULL || nbus->can->vmt->send == NULL) {
 		return NBUS_RET_FAILED;
 	}
@@ -536,36 +1078,435 @@ static nbus_ret_t nbus_channel_send_frame(NbusChannel *self, struct nbus_id *id,
 
 
 
-nbus_ret_t nbus_channel_send(NbusChannel *self, nbus_endpoint_t ep, void *buf, size_t len) {
-	if (len > NBUS_CHANNEL_MTU) {
-		return NBUS_RET_BAD_PARAM;
-	}
-	if (self->channel_id_valid == false) {
-		return NBUS_RET_VOID;
+static nbus_ret_t nbus_channel_send_packet(NbusChannel *self, uint8_t stream, nbus_endpoint_t ep, uint32_t counter, uint16_t flags, void *buf, size_t len) {
+	if (self->nbus->fd) {
+		flags |= NBUS_LF_FLAG_FD;
 	}
 
-	/** @todo acquire channel lock */
-	nbus_txpacket_init(&self->txpacket, self->channel_id, ep, self->packet_counter);
+	xSemaphoreTake(self->tx_lock, portMAX_DELAY);
+	nbus_txpacket_init(&self->txpacket, self->channel_id, self->direction, ep, stream, counter, self->frag_size, flags);
 	nbus_txpacket_buf_ref(&self->txpacket, buf, len);
+	if (nbus_auth_sign(&self->auth, &self->txpacket) != NBUS_RET_OK) {
+		xSemaphoreGive(self->tx_lock);
+		return NBUS_RET_FAILED;
+	}
 
 	struct nbus_id sid = {0};
-	uint8_t framebuf[8];
+	uint8_t framebuf[NBUS_FRAG_SIZE_FD];
 	size_t framelen = 0;
 	while (nbus_txpacket_get_fragment(&self->txpacket, &sid, framebuf, &framelen) == NBUS_RET_OK) {
 		nbus_channel_send_frame(self, &sid, framebuf, framelen);
 	}
-	/** @todo release channel lock */
+	xSemaphoreGive(self->tx_lock);
 
 	return NBUS_RET_OK;
 }
 
 
+static nbus_ret_t nbus_reliable_send(NbusChannel *self, uint8_t stream, nbus_endpoint_t ep, void *buf, size_t len);
+
+nbus_ret_t nbus_channel_send_stream(NbusChannel *self, uint8_t stream, nbus_endpoint_t ep, void *buf, size_t len) {
+	if (len > NBUS_CHANNEL_MTU || stream >= NBUS_STREAMS) {
+		return NBUS_RET_BAD_PARAM;
+	}
+	if (self->channel_id_valid == false) {
+		return NBUS_RET_VOID;
+	}
+
+	if (self->reliable.window > 0) {
+		return nbus_reliable_send(self, stream, ep, buf, len);
+	}
+	return nbus_channel_send_packet(self, stream, ep, self->packet_counter, 0, buf, len);
+}
+
+
+nbus_ret_t nbus_channel_send(NbusChannel *self, nbus_endpoint_t ep, void *buf, size_t len) {
+	return nbus_channel_send_stream(self, self->rx_stream, ep, buf, len);
+}
+
+
+/**********************************************************************************************************************
+ * nbus reliable mode
+ *
+ * Packets sent in the reliable mode are numbered by the leading frame counter. The receiver passes them to the
+ * channel user in order and acknowledges every packet with an NBUS_OP_ACK frame containing the next expected
+ * sequence number and a bitmap of packets received out of order. The sender keeps up to window packets in flight,
+ * retransmits packets reported missing once and all unacknowledged packets after NBUS_RELIABLE_RTO_MS. Timeouts are
+ * handled by the housekeeping task, packets are retransmitted even if the sender is not sending anymore.
+ **********************************************************************************************************************/
+
+static void nbus_reliable_send_ack(NbusChannel *self, uint8_t stream) {
+	struct nbus_ack_msg ack = {
+		.next = self->reliable.rx_next,
+	};
+	for (size_t i = 0; i < NBUS_RX_CONTEXTS; i++) {
+		NbusRxPacket *ctx = &self->rxpacket[i];
+		uint32_t d = ctx->counter - self->reliable.rx_next - 1;
+		if (ctx->held && d < NBUS_RELIABLE_MAX_WINDOW) {
+			ack.sack |= 1UL << d;
+		}
+	}
+
+	if (self->auth.mac != NBUS_MAC_NONE) {
+		/* A forged acknowledgement would make the sender drop packets
+		 * not received yet. Send it authenticated. */
+		nbus_channel_send_packet(self, stream, 0, self->packet_counter, NBUS_LF_FLAG_ACK, &ack, sizeof(ack));
+		return;
+	}
+
+	struct nbus_id id = {
+		.channel = self->channel_id,
+		.direction = self->direction,
+		.stream = stream,
+		.opcode = NBUS_OP_ACK,
+	};
+	nbus_channel_send_frame(self, &id, &ack, sizeof(ack));
+}
+
+
+static void nbus_reliable_deliver(NbusChannel *self, NbusRxPacket *ctx) {
+	uint8_t i = ctx - self->rxpacket;
+	ctx->held = false;
+	xQueueSend(self->rxdone, &i, 0);
+	self->reliable.rx_next++;
+}
+
+
+/**
+ * @brief Process a complete packet of the peer's reliable stream
+ *
+ * Called from the receive task. Packets received out of order are held in their
+ * reassembly contexts as long as at least one context is left free for the
+ * missing packet.
+ */
+static void nbus_reliable_rx(NbusChannel *self, NbusRxPacket *ctx) {
+	int32_t d = ctx->counter - self->reliable.rx_next;
+
+	if ((ctx->flags & NBUS_LF_FLAG_RESTART) && (d > 0 || d < -NBUS_RELIABLE_MAX_WINDOW)) {
+		/* The peer started a new stream, forget the packets held from the previous one. */
+		for (size_t i = 0; i < NBUS_RX_CONTEXTS; i++) {
+			if (self->rxpacket[i].held) {
+				nbus_rxpacket_reset(&self->rxpacket[i]);
+			}
+		}
+		self->reliable.rx_next = ctx->counter;
+		d = 0;
+	}
+
+	if (d == 0) {
+		nbus_reliable_deliver(self, ctx);
+
+		/* Pass all held packets following the delivered one. */
+		bool found = true;
+		while (found) {
+			found = false;
+			for (size_t i = 0; i < NBUS_RX_CONTEXTS; i++) {
+				NbusRxPacket *h = &self->rxpacket[i];
+				if (h->held && h->counter == self->reliable.rx_next) {
+					nbus_reliable_deliver(self, h);
+					found = true;
+				}
+			}
+		}
+	} else if (d > 0 && d <= NBUS_RELIABLE_MAX_WINDOW) {
+		size_t free_contexts = 0;
+		bool duplicate = false;
+		for (size_t i = 0; i < NBUS_RX_CONTEXTS; i++) {
+			NbusRxPacket *h = &self->rxpacket[i];
+			if (h->state != NBUS_RXP_EMPTY && !nbus_rxpacket_busy(h)) {
+				free_contexts++;
+			}
+			if (h->held && h->counter == ctx->counter) {
+				duplicate = true;
+			}
+		}
+		if (free_contexts > 0 && !duplicate) {
+			ctx->held = true;
+		} else {
+			nbus_rxpacket_reset(ctx);
+		}
+	} else {
+		/* Already received, the acknowledgement was probably lost. */
+		nbus_rxpacket_reset(ctx);
+	}
+
+	nbus_reliable_send_ack(self, ctx->stream);
+}
+
+
+static void nbus_reliable_process_ack(NbusChannel *self, void *buf, size_t len) {
+	struct nbus_reliable *r = &self->reliable;
+	if (r->window == 0 || len < sizeof(struct nbus_ack_msg)) {
+		return;
+	}
+	struct nbus_ack_msg ack;
+	memcpy(&ack, buf, sizeof(ack));
+
+	xSemaphoreTake(r->lock, portMAX_DELAY);
+	/* Ignore acknowledgements outside of the window. */
+	if ((ack.next - r->base) <= (r->next - r->base)) {
+		if (ack.next != r->base) {
+			r->base = ack.next;
+			r->retries = 0;
+			r->rto_start = xTaskGetTickCount();
+		}
+		for (uint32_t i = 0; i < NBUS_RELIABLE_MAX_WINDOW; i++) {
+			uint32_t seq = ack.next + 1 + i;
+			if ((ack.sack & (1UL << i)) && (seq - r->base) < (r->next - r->base)) {
+				r->slots[seq % r->window].acked = true;
+				r->gap = true;
+			}
+		}
+	}
+	xSemaphoreGive(r->lock);
+	xSemaphoreGive(r->ack);
+}
+
+
+static void nbus_reliable_retransmit(NbusChannel *self, struct nbus_reliable_slot *slot) {
+	struct nbus_reliable *r = &self->reliable;
+	nbus_channel_send_packet(self, slot->stream, slot->ep, slot->seq, slot->flags, r->buf + (slot->seq % r->window) * NBUS_CHANNEL_MTU, slot->len);
+	r->retransmitted++;
+}
+
+
+/**
+ * @brief Retransmit lost packets
+ *
+ * All unacknowledged packets are retransmitted on @p timeout. Otherwise only
+ * packets reported missing by the receiver are retransmitted (once). Called
+ * with the window locked, the slots cannot be reused meanwhile.
+ */
+static void nbus_reliable_retransmit_lost(NbusChannel *self, bool timeout) {
+	struct nbus_reliable *r = &self->reliable;
+	bool gap = r->gap;
+	r->gap = false;
+
+	for (uint32_t seq = r->base; seq != r->next; seq++) {
+		struct nbus_reliable_slot *slot = &r->slots[seq % r->window];
+		if (slot->acked) {
+			continue;
+		}
+		if (timeout) {
+			nbus_reliable_retransmit(self, slot);
+		} else if (gap && !slot->fast_retransmitted) {
+			/* Retransmit holes followed by an acknowledged packet only. */
+			for (uint32_t s = seq + 1; s != r->next; s++) {
+				if (r->slots[s % r->window].acked) {
+					slot->fast_retransmitted = true;
+					nbus_reliable_retransmit(self, slot);
+					break;
+				}
+			}
+		}
+	}
+}
+
+
+/**
+ * @brief Retransmit packets not acknowledged within NBUS_RELIABLE_RTO_MS
+ *
+ * Called periodically by the housekeeping task. The stream is broken and all
+ * packets in flight are dropped after NBUS_RELIABLE_MAX_RETRIES timeouts.
+ */
+static void nbus_reliable_poll(NbusChannel *self) {
+	struct nbus_reliable *r = &self->reliable;
+	if (r->window == 0) {
+		return;
+	}
+
+	xSemaphoreTake(r->lock, portMAX_DELAY);
+	TickType_t now = xTaskGetTickCount();
+	if (r->base != r->next && (now - r->rto_start) >= pdMS_TO_TICKS(NBUS_RELIABLE_RTO_MS)) {
+		r->retries++;
+		if (r->retries > NBUS_RELIABLE_MAX_RETRIES) {
+			/* Give up, drop all packets in flight and start over. */
+			r->base = r->next;
+			r->retries = 0;
+			r->restart = true;
+			r->broken = true;
+			xSemaphoreGive(r->lock);
+			xSemaphoreGive(r->ack);
+			u_log(system_log, LOG_TYPE_WARN, U_LOG_MODULE_PREFIX("reliable stream broken"));
+			return;
+		}
+		nbus_reliable_retransmit_lost(self, true);
+		r->rto_start = now;
+	}
+	xSemaphoreGive(r->lock);
+}
+
+
+/**
+ * @brief Wait for an acknowledgement
+ *
+ * Packets reported missing by the receiver are retransmitted immediately,
+ * timeouts are handled by nbus_reliable_poll.
+ *
+ * @return NBUS_RET_FAILED if the stream was broken meanwhile.
+ */
+static nbus_ret_t nbus_reliable_wait(NbusChannel *self) {
+	struct nbus_reliable *r = &self->reliable;
+	xSemaphoreTake(r->ack, pdMS_TO_TICKS(NBUS_RELIABLE_RTO_MS));
+
+	xSemaphoreTake(r->lock, portMAX_DELAY);
+	if (r->broken) {
+		r->broken = false;
+		xSemaphoreGive(r->lock);
+		return NBUS_RET_FAILED;
+	}
+	if (r->gap) {
+		nbus_reliable_retransmit_lost(self, false);
+	}
+	xSemaphoreGive(r->lock);
+
+	return NBUS_RET_OK;
+}
+
+
+static nbus_ret_t nbus_reliable_send(NbusChannel *self, uint8_t stream, nbus_endpoint_t ep, void *buf, size_t len) {
+	struct nbus_reliable *r = &self->reliable;
+
+	while (true) {
+		xSemaphoreTake(r->lock, portMAX_DELAY);
+		if ((r->next - r->base) < r->window) {
+			uint32_t seq = r->next++;
+			struct nbus_reliable_slot *slot = &r->slots[seq % r->window];
+			slot->seq = seq;
+			slot->stream = stream;
+			slot->ep = ep;
+			slot->flags = NBUS_LF_FLAG_RELIABLE;
+			if (r->restart) {
+				slot->flags |= NBUS_LF_FLAG_RESTART;
+				r->restart = false;
+			}
+			slot->len = len;
+			slot->acked = false;
+			slot->fast_retransmitted = false;
+			memcpy(r->buf + (seq % r->window) * NBUS_CHANNEL_MTU, buf, len);
+			if (r->base == seq) {
+				/* The window was empty, start the timeout now. */
+				r->rto_start = xTaskGetTickCount();
+			}
+			xSemaphoreGive(r->lock);
+
+			return nbus_channel_send_packet(self, stream, ep, seq, slot->flags, buf, len);
+		}
+		xSemaphoreGive(r->lock);
+
+		/* The window is full. */
+		if (nbus_reliable_wait(self) != NBUS_RET_OK) {
+			return NBUS_RET_FAILED;
+		}
+	}
+}
+
+
+nbus_ret_t nbus_channel_set_reliable(NbusChannel *self, size_t window) {
+	struct nbus_reliable *r = &self->reliable;
+	if (window > NBUS_RELIABLE_MAX_WINDOW) {
+		return NBUS_RET_BAD_PARAM;
+	}
+	if (r->lock == NULL) {
+		r->lock = xSemaphoreCreateMutex();
+		r->ack = xSemaphoreCreateBinary();
+		if (r->lock == NULL || r->ack == NULL) {
+			return NBUS_RET_FAILED;
+		}
+	}
+
+	xSemaphoreTake(r->lock, portMAX_DELAY);
+	free(r->buf);
+	r->buf = NULL;
+	r->window = 0;
+	if (window > 0) {
+		r->buf = malloc(window * NBUS_CHANNEL_MTU);
+		if (r->buf == NULL) {
+			xSemaphoreGive(r->lock);
+			return NBUS_RET_FAILED;
+		}
+		r->window = window;
+	}
+	/* Packets in flight are dropped. Start a new stream with a sequence number
+	 * unlikely to collide with the previous one if the device was restarted. */
+	r->next += self->short_id ^ (xTaskGetTickCount() * 2654435769U);
+	r->base = r->next;
+	r->restart = true;
+	xSemaphoreGive(r->lock);
+
+	return NBUS_RET_OK;
+}
+
+
+nbus_ret_t nbus_channel_set_key(NbusChannel *self, enum nbus_mac mac, const uint8_t *key, size_t len, uint32_t epoch) {
+	if (mac != NBUS_MAC_NONE && (key == NULL || len != NBUS_KEY_SIZE)) {
+		return NBUS_RET_BAD_PARAM;
+	}
+	if (mac == NBUS_MAC_BLAKE2S && self->nbus != NULL && self->nbus->fd == false) {
+		/* The trailing frame doesn't fit a classic CAN frame. */
+		return NBUS_RET_BAD_PARAM;
+	}
+
+	xSemaphoreTake(self->tx_lock, portMAX_DELAY);
+	struct nbus_auth *a = &self->auth;
+	memset(a, 0, sizeof(struct nbus_auth));
+	a->mac = mac;
+	if (mac != NBUS_MAC_NONE) {
+		memcpy(a->key, key, NBUS_KEY_SIZE);
+		a->epoch = epoch;
+	}
+	xSemaphoreGive(self->tx_lock);
+
+	/* Ask the peer for its epoch, the request is repeated by the housekeeping
+	 * task until a response is received. */
+	if (mac != NBUS_MAC_NONE && self->channel_id_valid) {
+		nbus_auth_send_sync(self, NBUS_DIR_REQUEST);
+	}
+
+	return NBUS_RET_OK;
+}
+
+
+nbus_ret_t nbus_channel_flush(NbusChannel *self, uint32_t timeout_ms) {
+	struct nbus_reliable *r = &self->reliable;
+	if (r->window == 0) {
+		return NBUS_RET_OK;
+	}
+
+	TickType_t start = xTaskGetTickCount();
+	while (r->base != r->next) {
+		if ((xTaskGetTickCount() - start) > pdMS_TO_TICKS(timeout_ms)) {
+			return NBUS_RET_VOID;
+		}
+		if (nbus_reliable_wait(self) != NBUS_RET_OK) {
+			return NBUS_RET_FAILED;
+		}
+	}
+
+	/* Packets may have been dropped while nobody was waiting. */
+	xSemaphoreTake(r->lock, portMAX_DELAY);
+	bool broken = r->broken;
+	r->broken = false;
+	xSemaphoreGive(r->lock);
+
+	return broken ? NBUS_RET_FAILED : NBUS_RET_OK;
+}
+
+
 nbus_ret_t nbus_channel_set_explicit_short_id(NbusChannel *self, nbus_short_id_t short_id) {
 	self->short_id = short_id;
 	return NBUS_RET_OK;
 }
 
 
+nbus_ret_t nbus_channel_set_initiator(NbusChannel *self, bool initiator) {
+	xSemaphoreTake(self->tx_lock, portMAX_DELAY);
+	self->direction = initiator ? NBUS_DIR_REQUEST : NBUS_DIR_RESPONSE;
+	xSemaphoreGive(self->tx_lock);
+	return NBUS_RET_OK;
+}
+
+
 nbus_ret_t nbus_channel_set_parent(NbusChannel *self, NbusChannel *parent) {
 	/* Create the current channel short-id by hashing parent's short-id with
 	 * the current channel name. */
@@ -620,6 +1561,10 @@ static void nbus_generate_short_ids(Nbus *self) {
 	NbusChannel *ch = self->first;
 	while (ch) {
 		if (ch->channel_id_valid == false) {
+			/* The channel-id was invalidated by the receive task. The lookup table
+			 * still contains the channel hashed by its old value. */
+			nbus_chtable_remove(self, ch);
+
 			/* If the channel-id is not yet valid (the channel is new), channel_id member contains
 			 * zero as the spec mandates. Channel-id for a new channel is created from the current
 			 * channel-id with the same algo using the zero value. */
@@ -627,6 +1572,7 @@ static void nbus_generate_short_ids(Nbus *self) {
 			blake2s_update(&b2, &ch->short_id, sizeof(ch->short_id));
 			blake2s_update(&b2, &ch->channel_id, sizeof(ch->channel_id));
 			blake2s_final(&b2, &ch->channel_id, sizeof(ch->channel_id));
+			nbus_chtable_add(self, ch);
 			ch->channel_id_valid = true;
 			u_log(system_log, LOG_TYPE_INFO, U_LOG_MODULE_PREFIX("assign new channel ID %d for 0x%08x"), ch->channel_id, ch->short_id);
 			advertise_channel_id(ch);
@@ -638,17 +1584,51 @@ static void nbus_generate_short_ids(Nbus *self) {
 
 static void nbus_housekeeping_task(void *p) {
 	Nbus *self = (Nbus *)p;
+	TickType_t last_adv = xTaskGetTickCount() - pdMS_TO_TICKS(1000);
 
 	while (true) {
-		nbus_send_adv(self);
+		TickType_t now = xTaskGetTickCount();
+		if ((now - last_adv) >= pdMS_TO_TICKS(1000)) {
+			nbus_send_adv(self);
+
+			nbus_generate_short_ids(self);
+
+			for (NbusChannel *ch = self->first; ch != NULL; ch = ch->next) {
+				if (ch->auth.mac != NBUS_MAC_NONE && !ch->auth.synced && ch->channel_id_valid) {
+					nbus_auth_send_sync(ch, NBUS_DIR_REQUEST);
+				}
+			}
+			last_adv = now;
+		}
 
-		nbus_generate_short_ids(self);
-		vTaskDelay(1000);
+		/* Check retransmission timeouts often if any channel is reliable. */
+		bool reliable = false;
+		for (NbusChannel *ch = self->first; ch != NULL; ch = ch->next) {
+			if (ch->reliable.window > 0) {
+				nbus_reliable_poll(ch);
+				reliable = true;
+			}
+		}
+		vTaskDelay(reliable ? pdMS_TO_TICKS(NBUS_RELIABLE_RTO_MS / 2) : pdMS_TO_TICKS(100));
 	}
 	vTaskDelete(NULL);
 }
 
 
+nbus_ret_t nbus_set_fd(Nbus *self, bool fd, bool brs) {
+	self->fd = fd;
+	self->brs = fd && brs;
+
+	if (!fd) {
+		for (NbusChannel *ch = self->first; ch != NULL; ch = ch->next) {
+			ch->frag_size = NBUS_FRAG_SIZE_CLASSIC;
+		}
+	}
+
+	return NBUS_RET_OK;
+}
+
+
 nbus_ret_t nbus_init(Nbus *self, Can *can) {
 	memset(self, 0, sizeof(Nbus));
 	self->can = can;
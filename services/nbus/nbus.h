@@ -30,23 +30,78 @@ struct __attribute__((__packed__)) nbus_id {
 	uint8_t res1:4;
 	nbus_channel_id_t channel:16;
 	enum nbus_direction direction:2;
-	uint8_t res2:2;
+	uint8_t stream:2;
 	nbus_opcode_t opcode:8;
 };
 
 
 #define NBUS_CHANNEL_MTU (64*8)
 
+/* Number of packets a channel can reassemble at once. Each context allocates
+ * NBUS_CHANNEL_MTU bytes. */
+#if defined(CONFIG_NBUS_RX_CONTEXTS)
+	#define NBUS_RX_CONTEXTS CONFIG_NBUS_RX_CONTEXTS
+#else
+	#define NBUS_RX_CONTEXTS 2
+#endif
+
+/* A partially received packet is discarded if no fragment is received
+ * within this time. */
+#if defined(CONFIG_NBUS_RX_TIMEOUT_MS)
+	#define NBUS_RX_TIMEOUT_MS CONFIG_NBUS_RX_TIMEOUT_MS
+#else
+	#define NBUS_RX_TIMEOUT_MS 200
+#endif
+
+#define NBUS_STREAMS 4
+
+/* Reliable mode parameters. The window is limited by the width of the
+ * selective acknowledgement bitmap. */
+#define NBUS_RELIABLE_MAX_WINDOW 32
+#if defined(CONFIG_NBUS_RELIABLE_RTO_MS)
+	#define NBUS_RELIABLE_RTO_MS CONFIG_NBUS_RELIABLE_RTO_MS
+#else
+	#define NBUS_RELIABLE_RTO_MS 50
+#endif
+#define NBUS_RELIABLE_MAX_RETRIES 10
+
+/* Size of the channel lookup table. The table is kept at most half full,
+ * up to NBUS_MAX_CHANNELS channels (16 by default) may be added to a single
+ * nbus instance. Each slot takes a single pointer. */
+#if defined(CONFIG_NBUS_CHANNEL_SLOTS_LOG2)
+	#define NBUS_CHANNEL_SLOTS_LOG2 CONFIG_NBUS_CHANNEL_SLOTS_LOG2
+#else
+	#define NBUS_CHANNEL_SLOTS_LOG2 5
+#endif
+#define NBUS_CHANNEL_SLOTS (1 << NBUS_CHANNEL_SLOTS_LOG2)
+#define NBUS_MAX_CHANNELS (NBUS_CHANNEL_SLOTS / 2)
+
+/* Data fragment size used with classic CAN peers and with CAN-FD peers. */
+#define NBUS_FRAG_SIZE_CLASSIC 8
+#define NBUS_FRAG_SIZE_FD 64
+
 #define NBUS_OP_LEADING_MIN 0x00
 #define NBUS_OP_LEADING_MAX 0x3f
 #define NBUS_OP_DATA_MIN 0x40
 #define NBUS_OP_DATA_MAX 0xbf
 #define NBUS_OP_TRAILING 0xc0
 #define NBUS_OP_ADVERTISEMENT 0xc1
+#define NBUS_OP_ACK 0xc2
+#define NBUS_OP_SYNC 0xc3
 
 #define NBUS_KEY_SIZE 16
 #define NBUS_SIV_LEN 8
 
+/* Length of the truncated MAC of each algorithm. The trailing frame carries
+ * a 4 byte message counter followed by the MAC. */
+#define NBUS_MAC_SIPHASH_LEN 4
+#define NBUS_MAC_BLAKE2S_LEN 12
+#define NBUS_MAC_MAX_LEN 12
+
+/* Number of counters preceding the highest one received which are still
+ * accepted (if not received yet). */
+#define NBUS_REPLAY_WINDOW 32
+
 #define NBUS_ADV_TIME 10
 
 struct __attribute__((__packed__)) nbus_leading_frame_msg {
@@ -55,6 +110,40 @@ struct __attribute__((__packed__)) nbus_leading_frame_msg {
 	uint16_t flags;
 };
 
+/* Trailing frame of an authenticated packet. */
+struct __attribute__((__packed__)) nbus_trailing_frame_msg {
+	uint32_t counter;
+	uint8_t mac[NBUS_MAC_MAX_LEN];
+};
+
+/* Authentication session synchronisation. */
+struct __attribute__((__packed__)) nbus_sync_msg {
+	uint32_t epoch;
+	uint8_t mac[NBUS_MAC_MAX_LEN];
+};
+
+/* Leading frame flags */
+/* The sender is able to receive CAN-FD fragments up to NBUS_FRAG_SIZE_FD bytes. */
+#define NBUS_LF_FLAG_FD 0x0001
+/* The packet is a part of the reliable stream of the channel, the counter
+ * is its sequence number. The receiver acknowledges it with NBUS_OP_ACK. */
+#define NBUS_LF_FLAG_RELIABLE 0x0002
+/* The first packet of a new reliable stream. The receiver restarts its
+ * sequence numbering unless the packet is a recent duplicate. */
+#define NBUS_LF_FLAG_RESTART 0x0004
+/* The packet contains a struct nbus_ack_msg. Authenticated channels send
+ * acknowledgements as packets instead of NBUS_OP_ACK frames. */
+#define NBUS_LF_FLAG_ACK 0x0008
+
+/* Acknowledgement of the reliable stream packets. */
+struct __attribute__((__packed__)) nbus_ack_msg {
+	/* Sequence number of the next packet expected in order. All previous
+	 * packets were received (cumulative acknowledgement). */
+	uint32_t next;
+	/* Bit i is set if the packet next + 1 + i was received out of order. */
+	uint32_t sack;
+};
+
 
 typedef enum {
 	NBUS_RET_OK = 0,
@@ -86,8 +175,14 @@ typedef struct nbus_txpacket {
 	enum nbus_txp_state state;
 
 	nbus_channel_id_t channel_id;
+	enum nbus_direction direction;
 	nbus_endpoint_t ep;
+	uint8_t stream;
 	uint32_t packet_counter;
+	uint16_t flags;
+
+	/* Maximum length of a data fragment. */
+	size_t frag_size;
 
 	/* Progress variables */
 	size_t next_frag;
@@ -97,6 +192,10 @@ typedef struct nbus_txpacket {
 	/* Preallocated scratchpad. */
 	void *buf;
 	size_t len;
+
+	/* Content of the trailing frame, all zeros if the channel is not authenticated. */
+	uint8_t trailing[sizeof(struct nbus_trailing_frame_msg)];
+	size_t trailing_len;
 } NbusTxPacket;
 
 /**********************************************************************************************************************
@@ -114,10 +213,16 @@ enum nbus_rxp_state {
 	NBUS_RXP_INVALID_ID,
 };
 
-/* Buffer for assembling fragmented received packets. Beware there
- * is only one buffer for all endpoints. Endpoint packets cannot interleave. */
+/* Reassembly context for fragmented received packets. Data fragments do not
+ * carry the endpoint, a context is therefore identified by the direction
+ * and stream of the frames. Packets sent over different streams may interleave. */
 typedef struct nbus_rxpacket {
 	enum nbus_rxp_state state;
+	enum nbus_direction direction;
+	uint8_t stream;
+
+	/* Tick count of the last accepted fragment. */
+	TickType_t last_update;
 
 	uint8_t *buf;
 	size_t buf_size;
@@ -127,9 +232,88 @@ typedef struct nbus_rxpacket {
 	size_t expected_packet_size;
 	nbus_endpoint_t ep;
 
-	SemaphoreHandle_t done;
+	/* Leading frame flags and counter of the packet being received. */
+	uint16_t flags;
+	uint32_t counter;
+
+	/* A complete reliable stream packet received out of order, waiting
+	 * for the missing packets. */
+	bool held;
 } NbusRxPacket;
 
+/* A packet of the reliable stream waiting for acknowledgement. */
+struct nbus_reliable_slot {
+	uint32_t seq;
+	uint8_t stream;
+	nbus_endpoint_t ep;
+	uint16_t flags;
+	size_t len;
+	bool acked;
+	/* Already retransmitted because of a gap reported by the receiver. */
+	bool fast_retransmitted;
+};
+
+struct nbus_reliable {
+	/* Maximum number of unacknowledged packets, 0 if the reliable mode is disabled. */
+	size_t window;
+	/* window * NBUS_CHANNEL_MTU bytes */
+	uint8_t *buf;
+	struct nbus_reliable_slot slots[NBUS_RELIABLE_MAX_WINDOW];
+
+	/* The oldest unacknowledged and the next sequence number to be sent. */
+	uint32_t base;
+	uint32_t next;
+	/* The next sequence number expected from the peer. */
+	uint32_t rx_next;
+	/* The next packet starts a new stream. */
+	bool restart;
+
+	/* Protects the window, given when an acknowledgement is received. */
+	SemaphoreHandle_t lock;
+	SemaphoreHandle_t ack;
+	bool gap;
+
+	/* Tick count the retransmission timeout is measured from. */
+	TickType_t rto_start;
+	/* The housekeeping task gave up retransmitting, packets in flight were dropped. */
+	bool broken;
+
+	uint32_t retries;
+	uint32_t retransmitted;
+};
+
+/* Message authentication algorithms. */
+enum nbus_mac {
+	NBUS_MAC_NONE = 0,
+	/* SipHash-2-4 truncated to 32 bits, fits a classic CAN trailing frame. */
+	NBUS_MAC_SIPHASH,
+	/* BLAKE2s-96, the trailing frame requires CAN-FD. */
+	NBUS_MAC_BLAKE2S,
+};
+
+struct nbus_auth {
+	enum nbus_mac mac;
+	uint8_t key[NBUS_KEY_SIZE];
+
+	/* Epoch of this side, never repeated with the same key. The epoch of the
+	 * peer is learned using NBUS_OP_SYNC, packets are sent and received only
+	 * if it is known (synced). */
+	uint32_t epoch;
+	uint32_t peer_epoch;
+	bool synced;
+
+	/* Counter of the last packet sent. */
+	uint32_t tx_counter;
+
+	/* The highest counter received and a bitmap of the preceding NBUS_REPLAY_WINDOW
+	 * counters already received, bit i is set for rx_counter - 1 - i. */
+	uint32_t rx_counter;
+	uint32_t rx_window;
+
+	uint32_t rejected;
+	uint32_t replayed;
+};
+
 /**********************************************************************************************************************
  * NBUS channel & related declarations
  **********************************************************************************************************************/
@@ -143,13 +327,23 @@ typedef struct nbus_channel {
 	nbus_channel_id_t channel_id;
 	bool channel_id_valid;
 	nbus_short_id_t short_id;
+	/* Direction of the packets sent, NBUS_DIR_REQUEST for an initiator,
+	 * NBUS_DIR_RESPONSE for a peripheral (default). */
+	enum nbus_direction direction;
 	const char *name;
 	const char *interface;
 	const char *version;
 
 	/* Packet instances. */
 	NbusTxPacket txpacket;
-	NbusRxPacket rxpacket;
+	NbusRxPacket rxpacket[NBUS_RX_CONTEXTS];
+
+	/* Indices of completely received rxpacket contexts in the order of completion. */
+	QueueHandle_t rxdone;
+
+	/* Stream of the last packet returned by nbus_channel_receive. Responses
+	 * are sent over the same stream. */
+	uint8_t rx_stream;
 
 	/* RPC client instance for EP 0 channel C&C. */
 	CborRpc ccrpc;
@@ -164,10 +358,18 @@ typedef struct nbus_channel {
 
 	uint32_t packet_counter;
 
-	/* Blake2s-SIV message authentication and ancryption */
-	// uint8_t key[NBUS_KEY_SIZE];
-	// uint8_t ke[B2S_KE_LEN];
-	// uint8_t km[B2S_KM_LEN];
+	/* Data fragment size used when sending to the peer. Negotiated using the
+	 * NBUS_LF_FLAG_FD flag of the last received leading frame. */
+	size_t frag_size;
+
+	/* Serialises packet transmission. */
+	SemaphoreHandle_t tx_lock;
+
+	struct nbus_reliable reliable;
+
+	/* Message authentication and replay protection. */
+	struct nbus_auth auth;
+
 	time_t adv_time;
 
 
@@ -177,16 +379,43 @@ typedef struct nbus_channel {
 typedef struct nbus {
 	/* Linked list of all associated channels */
 	NbusChannel *first;
+	size_t channels;
+
+	/* Channels with a valid channel-id hashed by the channel-id (open addressing,
+	 * linear probing). Modified by the housekeeping task only. */
+	NbusChannel *chtable[NBUS_CHANNEL_SLOTS];
 
 	Can *can;
 
+	/* The CAN interface supports CAN-FD frames (and bit-rate switching). */
+	bool fd;
+	bool brs;
+
 	TaskHandle_t receive_task;
 	TaskHandle_t housekeeping_task;
 } Nbus;
 
 
 nbus_ret_t nbus_init(Nbus *self, Can *can);
+
+/**
+ * @brief Add an initialised channel to the nbus instance
+ *
+ * Channels cannot be removed. Adding more than NBUS_MAX_CHANNELS channels
+ * fails, the limit is set by CONFIG_NBUS_CHANNEL_SLOTS_LOG2.
+ */
 nbus_ret_t nbus_add_channel(Nbus *self, NbusChannel *channel);
+
+/**
+ * @brief Enable CAN-FD fragments
+ *
+ * If enabled, nbus advertises CAN-FD support in its leading frames and sends
+ * NBUS_FRAG_SIZE_FD long fragments to peers advertising the same. Classic
+ * CAN peers still get NBUS_FRAG_SIZE_CLASSIC fragments.
+ *
+ * @param brs Use bit-rate switching for CAN-FD frames
+ */
+nbus_ret_t nbus_set_fd(Nbus *self, bool fd, bool brs);
 nbus_ret_t nbus_channel_process_cc(NbusChannel *self, void *buf, size_t len);
 nbus_ret_t nbus_irq_handler(Nbus *self);
 
@@ -201,9 +430,81 @@ nbus_ret_t nbus_channel_init(NbusChannel *self, const char *name);
  * until the lock is acquired.
  */
 nbus_ret_t nbus_channel_send(NbusChannel *self, nbus_endpoint_t ep, void *buf, size_t len);
+
+/**
+ * @brief Send packet over the selected stream
+ *
+ * nbus_channel_send uses the stream of the last received packet, which is correct
+ * for responses. Senders which may have several packets in flight to the same
+ * peer at once (eg. multiple clients of a single channel) must select different
+ * streams to let the peer reassemble the packets concurrently.
+ *
+ * @param stream Stream number, 0 to NBUS_STREAMS - 1
+ */
+nbus_ret_t nbus_channel_send_stream(NbusChannel *self, uint8_t stream, nbus_endpoint_t ep, void *buf, size_t len);
+
+/**
+ * @brief Enable or disable the reliable mode for packets sent over the channel
+ *
+ * In the reliable mode, nbus_channel_send copies the packet into a window of
+ * up to @p window unacknowledged packets and returns without waiting for the
+ * acknowledgement. It blocks only if the window is full. Lost packets are
+ * retransmitted selectively. The peer must be able to hold @p window packets
+ * received out of order (NBUS_RX_CONTEXTS) to take full advantage of the window.
+ *
+ * @param window Maximum number of packets in flight (1 to NBUS_RELIABLE_MAX_WINDOW),
+ *               0 to disable the reliable mode
+ */
+nbus_ret_t nbus_channel_set_reliable(NbusChannel *self, size_t window);
+
+/**
+ * @brief Wait until all packets sent in the reliable mode are acknowledged
+ */
+nbus_ret_t nbus_channel_flush(NbusChannel *self, uint32_t timeout_ms);
 nbus_ret_t nbus_channel_receive(NbusChannel *self, nbus_endpoint_t *ep, void *buf, size_t buf_size, size_t *len, uint32_t timeout_ms);
 
+/**
+ * @brief Authenticate all packets sent and received over the channel
+ *
+ * Every packet is sent with a message counter and a single MAC computed using the
+ * whole @p key over the epochs of both sides, the packet header, the counter and
+ * the packet data. The counter and the MAC are sent in the trailing frame, no
+ * additional frames are required. Received packets with a wrong MAC or with an
+ * already received counter are dropped.
+ *
+ * Both sides exchange their epochs in authenticated NBUS_OP_SYNC frames after the
+ * key is set, the response includes the epoch of the requester. Packets recorded
+ * before either side was restarted are therefore never accepted again, even if
+ * the counters restart from zero. Packets are not sent until the peer epoch is
+ * known (NBUS_RET_FAILED is returned).
+ *
+ * Not authenticated: channel-id advertisements and the short-ID assignment. A forged
+ * advertisement makes the channel drop its channel-id and pick a new one (denial
+ * of service), it cannot be used to inject or modify packets. An attacker able to
+ * send frames can always prevent the communication, it is not protected against.
+ * Packets and SYNC frames of this side reflected back to it are rejected as the MAC
+ * covers the direction of the sender, which differs between the sides.
+ *
+ * @param mac Algorithm used, NBUS_MAC_BLAKE2S requires CAN-FD capable peers.
+ *            NBUS_MAC_NONE disables the authentication.
+ * @param key NBUS_KEY_SIZE bytes long key
+ * The two sides must send packets in different directions, one of them must be
+ * an initiator (nbus_channel_set_initiator). Their epochs may be equal.
+ *
+ * @param epoch A value never repeated with the same key, eg. a boot counter kept
+ *              in a persistent storage.
+ */
+nbus_ret_t nbus_channel_set_key(NbusChannel *self, enum nbus_mac mac, const uint8_t *key, size_t len, uint32_t epoch);
+
 nbus_ret_t nbus_channel_set_explicit_short_id(NbusChannel *self, nbus_short_id_t short_id);
+
+/**
+ * @brief Send packets as requests of an initiator instead of peripheral responses
+ *
+ * Channels are peripherals by default. The direction of the packets sent is
+ * authenticated, set it before the key.
+ */
+nbus_ret_t nbus_channel_set_initiator(NbusChannel *self, bool initiator);
 nbus_ret_t nbus_channel_set_parent(NbusChannel *self, NbusChannel *parent);
 nbus_ret_t nbus_channel_set_interface(NbusChannel *self, const char *interface, const char *version);
 
@@ -0,0 +1,105 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Incremental SipHash-2-4
+ *
+ * Copyright (c) 2023, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "siphash.h"
+
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+
+static uint64_t load64_le(const uint8_t *p) {
+	uint64_t r = 0;
+	for (size_t i = 0; i < 8; i++) {
+		r |= (uint64_t)p[i] << (8 * i);
+	}
+	return r;
+}
+
+
+static void sipround(struct siphash_state *self) {
+	self->v0 += self->v1;
+	self->v1 = ROTL(self->v1, 13);
+	self->v1 ^= self->v0;
+	self->v0 = ROTL(self->v0, 32);
+	self->v2 += self->v3;
+	self->v3 = ROTL(self->v3, 16);
+	self->v3 ^= self->v2;
+	self->v0 += self->v3;
+	self->v3 = ROTL(self->v3, 21);
+	self->v3 ^= self->v0;
+	self->v2 += self->v1;
+	self->v1 = ROTL(self->v1, 17);
+	self->v1 ^= self->v2;
+	self->v2 = ROTL(self->v2, 32);
+}
+
+
+static void compress(struct siphash_state *self, uint64_t m) {
+	self->v3 ^= m;
+	sipround(self);
+	sipround(self);
+	self->v0 ^= m;
+}
+
+
+void siphash_init(struct siphash_state *self, const uint8_t key[SIPHASH_KEY_SIZE]) {
+	uint64_t k0 = load64_le(key);
+	uint64_t k1 = load64_le(key + 8);
+
+	self->v0 = k0 ^ 0x736f6d6570736575ULL;
+	self->v1 = k1 ^ 0x646f72616e646f6dULL;
+	self->v2 = k0 ^ 0x6c7967656e657261ULL;
+	self->v3 = k1 ^ 0x7465646279746573ULL;
+	self->m = 0;
+	self->len = 0;
+}
+
+
+void siphash_update(struct siphash_state *self, const void *in, size_t len) {
+	const uint8_t *p = (const uint8_t *)in;
+
+	/* Complete the word left over from the previous update first. */
+	while (len > 0 && (self->len % 8) != 0) {
+		self->m |= (uint64_t)*p << (8 * (self->len % 8));
+		self->len++;
+		p++;
+		len--;
+		if ((self->len % 8) == 0) {
+			compress(self, self->m);
+			self->m = 0;
+		}
+	}
+
+	while (len >= 8) {
+		compress(self, load64_le(p));
+		self->len += 8;
+		p += 8;
+		len -= 8;
+	}
+
+	while (len > 0) {
+		self->m |= (uint64_t)*p << (8 * (self->len % 8));
+		self->len++;
+		p++;
+		len--;
+	}
+}
+
+
+uint64_t siphash_final(struct siphash_state *self) {
+	compress(self, self->m | ((uint64_t)(self->len & 0xff) << 56));
+
+	self->v2 ^= 0xff;
+	for (size_t i = 0; i < 4; i++) {
+		sipround(self);
+	}
+
+	return self->v0 ^ self->v1 ^ self->v2 ^ self->v3;
+}
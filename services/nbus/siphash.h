@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Incremental SipHash-2-4
+ *
+ * Copyright (c) 2023, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SIPHASH_KEY_SIZE 16
+
+struct siphash_state {
+	uint64_t v0, v1, v2, v3;
+
+	/* Bytes of the last incomplete word and the total input length. */
+	uint64_t m;
+	size_t len;
+};
+
+
+void siphash_init(struct siphash_state *self, const uint8_t key[SIPHASH_KEY_SIZE]);
+void siphash_update(struct siphash_state *self, const void *in, size_t len);
+
+/**
+ * @brief Finish the computation and return the 64 bit SipHash-2-4 value
+ *
+ * The value is equal to the reference implementation output read as a little
+ * endian integer.
+ */
+uint64_t siphash_final(struct siphash_state *self);
@@ -0,0 +1,68 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Numeric pre-compression codecs for packaged sample arrays
+ *
+ * Copyright (c) 2021, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <types/ndarray.h>
+
+/* Codec IDs are the same as the Msg.Codec enum in pkg.proto */
+enum pkg_codec {
+	PKG_CODEC_NONE = 0,
+	PKG_CODEC_DELTA_ZIGZAG = 1,
+	PKG_CODEC_XOR_FLOAT = 2,
+	PKG_CODEC_ZFP = 3,
+};
+
+typedef enum {
+	PKG_CODEC_RET_OK = 0,
+	PKG_CODEC_RET_FAILED,
+	PKG_CODEC_RET_BAD_ARG,
+	PKG_CODEC_RET_UNSUPPORTED,
+	PKG_CODEC_RET_NO_SPACE,
+} pkg_codec_ret_t;
+
+
+/**
+ * @brief Check if the codec can be used to encode arrays of the given dtype
+ *
+ * Delta+zigzag is defined for all integer dtypes, XOR float coding and zfp
+ * for FLOAT and DOUBLE only. zfp requires the LIB_ZFP library to be enabled.
+ */
+bool pkg_codec_supported(enum pkg_codec codec, enum dtype dtype);
+
+/**
+ * @brief Select a lossless codec suitable for the dtype
+ *
+ * Used if no codec is configured for a topic explicitly.
+ */
+enum pkg_codec pkg_codec_auto(enum dtype dtype);
+
+/**
+ * @brief Encode @p src into the @p dst buffer
+ *
+ * @param tolerance Absolute error bound used by lossy codecs (zfp), ignored otherwise
+ * @param dst_used Number of bytes written to @p dst
+ *
+ * @return PKG_CODEC_RET_NO_SPACE if the encoded array doesn't fit. The caller
+ *         is expected to fall back to PKG_CODEC_NONE in this case.
+ */
+pkg_codec_ret_t pkg_codec_encode(enum pkg_codec codec, float tolerance, const NdArray *src, uint8_t *dst, size_t dst_size, size_t *dst_used);
+
+/**
+ * @brief Decode @p count values encoded with @p codec into an already initialized @p dst
+ *
+ * @p dst dtype must be the same as the dtype of the encoded array and it must
+ * have enough space for @p count values.
+ */
+pkg_codec_ret_t pkg_codec_decode(enum pkg_codec codec, float tolerance, const uint8_t *src, size_t src_size, NdArray *dst, size_t count);
+
+const char *pkg_codec_str(enum pkg_codec codec);
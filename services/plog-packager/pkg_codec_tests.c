@@ -0,0 +1,289 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Numeric pre-compression codec tests
+ *
+ * Copyright (c) 2021, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "config.h"
+#include "u_assert.h"
+#include "u_log.h"
+#include "u_test.h"
+
+#include <types/ndarray.h>
+#include "pkg_codec.h"
+#include "pkg_codec_tests.h"
+
+#ifdef MODULE_NAME
+#undef MODULE_NAME
+#endif
+#define MODULE_NAME "pkg-codec-tests"
+
+#define PKG_CODEC_TEST_COUNT 256
+#define PKG_CODEC_TEST_BUF_SIZE (PKG_CODEC_TEST_COUNT * 8 * 2 + 64)
+
+static const enum dtype pkg_codec_test_dtypes[] = {
+	DTYPE_INT8, DTYPE_UINT8, DTYPE_INT16, DTYPE_UINT16, DTYPE_INT32, DTYPE_UINT32,
+	DTYPE_INT64, DTYPE_UINT64, DTYPE_FLOAT, DTYPE_DOUBLE,
+};
+#define PKG_CODEC_TEST_DTYPES (sizeof(pkg_codec_test_dtypes) / sizeof(pkg_codec_test_dtypes[0]))
+
+static const enum pkg_codec pkg_codec_test_codecs[] = {
+	PKG_CODEC_NONE, PKG_CODEC_DELTA_ZIGZAG, PKG_CODEC_XOR_FLOAT, PKG_CODEC_ZFP,
+};
+#define PKG_CODEC_TEST_CODECS (sizeof(pkg_codec_test_codecs) / sizeof(pkg_codec_test_codecs[0]))
+
+static uint8_t pkg_codec_test_buf[PKG_CODEC_TEST_BUF_SIZE];
+
+
+static uint32_t rnd_state = 1;
+static int32_t rnd(int32_t range) {
+	rnd_state = rnd_state * 1103515245 + 12345;
+	return (int32_t)((rnd_state >> 8) % (2 * range + 1)) - range;
+}
+
+
+/* Random walk around the middle of the dtype range, the usual shape of
+ * a sampled signal. Integer arrays wrap around if the walk leaves the range,
+ * the codec must handle it. */
+static void fill_random_walk(NdArray *a, int32_t noise) {
+	int64_t v = 0;
+	double f = 1000.0;
+	for (size_t i = 0; i < a->asize; i++) {
+		v += rnd(noise);
+		f += rnd(noise) / 8.0;
+		switch (a->dtype) {
+			case DTYPE_INT8: ((int8_t *)a->buf)[i] = (int8_t)v; break;
+			case DTYPE_UINT8: ((uint8_t *)a->buf)[i] = (uint8_t)(v + 0x80); break;
+			case DTYPE_INT16: ((int16_t *)a->buf)[i] = (int16_t)v; break;
+			case DTYPE_UINT16: ((uint16_t *)a->buf)[i] = (uint16_t)(v + 0x8000); break;
+			case DTYPE_INT32: ((int32_t *)a->buf)[i] = (int32_t)v; break;
+			case DTYPE_UINT32: ((uint32_t *)a->buf)[i] = (uint32_t)(v + 0x80000000); break;
+			case DTYPE_INT64: ((int64_t *)a->buf)[i] = v; break;
+			case DTYPE_UINT64: ((uint64_t *)a->buf)[i] = (uint64_t)v + 0x8000000000000000ull; break;
+			case DTYPE_FLOAT: ((float *)a->buf)[i] = (float)f; break;
+			case DTYPE_DOUBLE: ((double *)a->buf)[i] = f; break;
+			default: break;
+		}
+	}
+}
+
+
+/* Alternate the minimum and the maximum value of the dtype. The worst case
+ * for the delta coding. */
+static void fill_extremes(NdArray *a) {
+	memset(a->buf, 0, a->asize * a->dsize);
+	for (size_t i = 0; i < a->asize; i += 2) {
+		memset((uint8_t *)a->buf + i * a->dsize, 0xff, a->dsize);
+	}
+	if (a->dtype == DTYPE_FLOAT || a->dtype == DTYPE_DOUBLE) {
+		/* Not a NaN pattern, it wouldn't compare equal after decoding
+		 * with a lossy codec. */
+		for (size_t i = 0; i < a->asize; i++) {
+			if (a->dtype == DTYPE_FLOAT) {
+				((float *)a->buf)[i] = (i % 2) ? -3.0e38f : 3.0e38f;
+			} else {
+				((double *)a->buf)[i] = (i % 2) ? -1.0e300 : 1.0e300;
+			}
+		}
+	}
+}
+
+
+static bool arrays_equal(const NdArray *a, const NdArray *b, float tolerance) {
+	if (a->dtype == DTYPE_FLOAT || a->dtype == DTYPE_DOUBLE) {
+		for (size_t i = 0; i < a->asize; i++) {
+			double x = (a->dtype == DTYPE_FLOAT) ? ((float *)a->buf)[i] : ((double *)a->buf)[i];
+			double y = (a->dtype == DTYPE_FLOAT) ? ((float *)b->buf)[i] : ((double *)b->buf)[i];
+			double d = x - y;
+			if (tolerance == 0.0f) {
+				if (memcmp((uint8_t *)a->buf + i * a->dsize, (uint8_t *)b->buf + i * a->dsize, a->dsize)) {
+					return false;
+				}
+			} else if (d > tolerance || d < -tolerance) {
+				return false;
+			}
+		}
+		return true;
+	}
+	return memcmp(a->buf, b->buf, a->asize * a->dsize) == 0;
+}
+
+
+static bool round_trip(enum pkg_codec codec, float tolerance, NdArray *a) {
+	NdArray b;
+	if (ndarray_init_zero(&b, a->dtype, a->asize) != NDARRAY_RET_OK) {
+		return false;
+	}
+	size_t used = 0;
+	bool ret = pkg_codec_encode(codec, tolerance, a, pkg_codec_test_buf, sizeof(pkg_codec_test_buf), &used) == PKG_CODEC_RET_OK &&
+		used > 0 && used <= sizeof(pkg_codec_test_buf) &&
+		pkg_codec_decode(codec, tolerance, pkg_codec_test_buf, used, &b, a->asize) == PKG_CODEC_RET_OK &&
+		arrays_equal(a, &b, tolerance);
+	if (!ret) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("%s %s round trip failed"), pkg_codec_str(codec), ndarray_dtype_str(a));
+	}
+	ndarray_free(&b);
+	return ret;
+}
+
+
+static float codec_tolerance(enum pkg_codec codec) {
+	return (codec == PKG_CODEC_ZFP) ? 0.01f : 0.0f;
+}
+
+
+static bool pkg_codec_test_round_trip_if_equal(void) {
+	bool ret = true;
+	for (size_t i = 0; i < PKG_CODEC_TEST_DTYPES; i++) {
+		NdArray a;
+		if (ndarray_init_zero(&a, pkg_codec_test_dtypes[i], PKG_CODEC_TEST_COUNT) != NDARRAY_RET_OK) {
+			return false;
+		}
+		for (size_t c = 0; c < PKG_CODEC_TEST_CODECS; c++) {
+			enum pkg_codec codec = pkg_codec_test_codecs[c];
+			if (!pkg_codec_supported(codec, a.dtype)) {
+				continue;
+			}
+			fill_random_walk(&a, 64);
+			ret &= round_trip(codec, codec_tolerance(codec), &a);
+			if (codec != PKG_CODEC_ZFP) {
+				fill_extremes(&a);
+				ret &= round_trip(codec, codec_tolerance(codec), &a);
+			}
+		}
+		ndarray_free(&a);
+	}
+	return ret;
+}
+
+
+static bool pkg_codec_test_auto_if_supported(void) {
+	for (size_t i = 0; i < PKG_CODEC_TEST_DTYPES; i++) {
+		if (!pkg_codec_supported(pkg_codec_auto(pkg_codec_test_dtypes[i]), pkg_codec_test_dtypes[i])) {
+			return false;
+		}
+	}
+	/* The automatic codec must be lossless. */
+	return pkg_codec_auto(DTYPE_FLOAT) != PKG_CODEC_ZFP && pkg_codec_auto(DTYPE_DOUBLE) != PKG_CODEC_ZFP;
+}
+
+
+static bool pkg_codec_test_encode_if_no_space(void) {
+	bool ret = true;
+	for (size_t i = 0; i < PKG_CODEC_TEST_DTYPES; i++) {
+		NdArray a;
+		if (ndarray_init_zero(&a, pkg_codec_test_dtypes[i], PKG_CODEC_TEST_COUNT) != NDARRAY_RET_OK) {
+			return false;
+		}
+		fill_random_walk(&a, 64);
+		enum pkg_codec codec = pkg_codec_auto(a.dtype);
+		size_t used = 0;
+		if (pkg_codec_encode(codec, 0.0f, &a, pkg_codec_test_buf, sizeof(pkg_codec_test_buf), &used) != PKG_CODEC_RET_OK) {
+			ret = false;
+		}
+		/* The encoder must not write beyond the end of the buffer. */
+		memset(pkg_codec_test_buf, 0xa5, sizeof(pkg_codec_test_buf));
+		size_t used2 = 0;
+		if (pkg_codec_encode(codec, 0.0f, &a, pkg_codec_test_buf, used - 1, &used2) != PKG_CODEC_RET_NO_SPACE ||
+		    pkg_codec_test_buf[used - 1] != 0xa5) {
+			u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("%s %s buffer overflow not detected"), pkg_codec_str(codec), ndarray_dtype_str(&a));
+			ret = false;
+		}
+		ndarray_free(&a);
+	}
+	return ret;
+}
+
+
+static bool pkg_codec_test_decode_if_truncated(void) {
+	NdArray a, b;
+	if (ndarray_init_zero(&a, DTYPE_INT32, PKG_CODEC_TEST_COUNT) != NDARRAY_RET_OK) {
+		return false;
+	}
+	if (ndarray_init_zero(&b, DTYPE_INT32, PKG_CODEC_TEST_COUNT) != NDARRAY_RET_OK) {
+		ndarray_free(&a);
+		return false;
+	}
+	fill_random_walk(&a, 64);
+	size_t used = 0;
+	bool ret = pkg_codec_encode(PKG_CODEC_DELTA_ZIGZAG, 0.0f, &a, pkg_codec_test_buf, sizeof(pkg_codec_test_buf), &used) == PKG_CODEC_RET_OK &&
+		pkg_codec_decode(PKG_CODEC_DELTA_ZIGZAG, 0.0f, pkg_codec_test_buf, used / 2, &b, PKG_CODEC_TEST_COUNT) != PKG_CODEC_RET_OK &&
+		/* More values requested than the destination can hold. */
+		pkg_codec_decode(PKG_CODEC_DELTA_ZIGZAG, 0.0f, pkg_codec_test_buf, used, &b, PKG_CODEC_TEST_COUNT + 1) != PKG_CODEC_RET_OK;
+	ndarray_free(&a);
+	ndarray_free(&b);
+	return ret;
+}
+
+
+static bool pkg_codec_test_encode_if_unsupported(void) {
+	NdArray a;
+	if (ndarray_init_zero(&a, DTYPE_INT16, 16) != NDARRAY_RET_OK) {
+		return false;
+	}
+	size_t used = 0;
+	bool ret = pkg_codec_encode(PKG_CODEC_XOR_FLOAT, 0.0f, &a, pkg_codec_test_buf, sizeof(pkg_codec_test_buf), &used) == PKG_CODEC_RET_UNSUPPORTED &&
+		pkg_codec_encode(PKG_CODEC_ZFP, 0.1f, &a, pkg_codec_test_buf, sizeof(pkg_codec_test_buf), &used) == PKG_CODEC_RET_UNSUPPORTED;
+	ndarray_free(&a);
+
+	if (ndarray_init_zero(&a, DTYPE_FLOAT, 16) != NDARRAY_RET_OK) {
+		return false;
+	}
+	ret &= pkg_codec_encode(PKG_CODEC_DELTA_ZIGZAG, 0.0f, &a, pkg_codec_test_buf, sizeof(pkg_codec_test_buf), &used) == PKG_CODEC_RET_UNSUPPORTED;
+	ndarray_free(&a);
+
+	return ret;
+}
+
+
+bool pkg_codec_tests(void) {
+	bool res = true;
+
+	res &= u_test(pkg_codec_test_round_trip_if_equal());
+	res &= u_test(pkg_codec_test_auto_if_supported());
+	res &= u_test(pkg_codec_test_encode_if_no_space());
+	res &= u_test(pkg_codec_test_decode_if_truncated());
+	res &= u_test(pkg_codec_test_encode_if_unsupported());
+
+	return res;
+}
+
+
+bool pkg_codec_tests_ratio(void) {
+	const int32_t noise[] = {1, 8, 64};
+	bool res = true;
+
+	for (size_t i = 0; i < PKG_CODEC_TEST_DTYPES; i++) {
+		NdArray a;
+		if (ndarray_init_zero(&a, pkg_codec_test_dtypes[i], PKG_CODEC_TEST_COUNT) != NDARRAY_RET_OK) {
+			return false;
+		}
+		for (size_t c = 0; c < PKG_CODEC_TEST_CODECS; c++) {
+			enum pkg_codec codec = pkg_codec_test_codecs[c];
+			if (codec == PKG_CODEC_NONE || !pkg_codec_supported(codec, a.dtype)) {
+				continue;
+			}
+			for (size_t n = 0; n < sizeof(noise) / sizeof(noise[0]); n++) {
+				fill_random_walk(&a, noise[n]);
+				size_t used = 0;
+				bool r = pkg_codec_encode(codec, codec_tolerance(codec), &a, pkg_codec_test_buf, sizeof(pkg_codec_test_buf), &used) == PKG_CODEC_RET_OK;
+				size_t raw = a.asize * a.dsize;
+				u_log(system_log, r ? LOG_TYPE_INFO : LOG_TYPE_ERROR,
+					U_LOG_MODULE_PREFIX("%s %s, noise %d: %u B -> %u B (%u%%)"),
+					pkg_codec_str(codec), ndarray_dtype_str(&a), noise[n], raw, used, used * 100 / raw
+				);
+				res &= r;
+			}
+		}
+		ndarray_free(&a);
+	}
+
+	return res;
+}
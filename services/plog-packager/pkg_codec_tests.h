@@ -0,0 +1,25 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Numeric pre-compression codec tests
+ *
+ * Copyright (c) 2021, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * Encode and decode random walk arrays of every dtype with all codecs
+ * supporting it. Check the decoded arrays are equal (within the tolerance
+ * for zfp), that too small buffers are detected and unsupported dtypes
+ * are refused.
+ */
+bool pkg_codec_tests(void);
+
+/**
+ * Log the encoded size relative to the raw array size for every dtype and
+ * several noise levels.
+ */
+bool pkg_codec_tests_ratio(void);
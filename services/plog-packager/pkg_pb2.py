@@ -1,10 +1,10 @@
 # -*- coding: utf-8 -*-
 # Generated by the protocol buffer compiler.  DO NOT EDIT!
 # source: services/plog-packager/pkg.proto
-
+"""Generated protocol buffer code."""
+from google.protobuf.internal import builder as _builder
 from google.protobuf import descriptor as _descriptor
-from google.protobuf import message as _message
-from google.protobuf import reflection as _reflection
+from google.protobuf import descriptor_pool as _descriptor_pool
 from google.protobuf import symbol_database as _symbol_database
 # @@protoc_insertion_point(imports)
 
@@ -13,449 +13,29 @@ _sym_db = _symbol_database.Default()
 
 
 
-DESCRIPTOR = _descriptor.FileDescriptor(
-  name='services/plog-packager/pkg.proto',
-  package='',
-  syntax='proto2',
-  serialized_options=None,
-  create_key=_descriptor._internal_create_key,
-  serialized_pb=b'\n services/plog-packager/pkg.proto\"5\n\x04Time\x12\t\n\x01s\x18\x01 \x02(\r\x12\n\n\x02ms\x18\x02 \x01(\r\x12\n\n\x02us\x18\x03 \x01(\r\x12\n\n\x02ns\x18\x04 \x01(\r\"\xdd\x01\n\x03Msg\x12\x17\n\x04type\x18\x01 \x01(\x0e\x32\t.Msg.Type\x12\x13\n\x04time\x18\x02 \x01(\x0b\x32\x05.Time\x12\x0b\n\x03\x62uf\x18\x03 \x01(\x0c\x12\r\n\x05topic\x18\x04 \x01(\t\"\x8b\x01\n\x04Type\x12\x08\n\x04\x43HAR\x10\x00\x12\x08\n\x04\x42YTE\x10\x01\x12\x08\n\x04INT8\x10\x02\x12\t\n\x05UINT8\x10\x03\x12\t\n\x05INT16\x10\x04\x12\n\n\x06UINT16\x10\x05\x12\t\n\x05INT32\x10\x06\x12\n\n\x06UINT32\x10\x07\x12\t\n\x05INT64\x10\x08\x12\n\n\x06UINT64\x10\t\x12\t\n\x05\x46LOAT\x10\n\x12\n\n\x06\x44OUBLE\x10\x0b\"\x1c\n\x07RawData\x12\x11\n\x03msg\x18\x01 \x03(\x0b\x32\x04.Msg\"J\n\x0eHeatshrinkData\x12\x13\n\x0bwindow_size\x18\x01 \x02(\r\x12\x16\n\x0elookahead_size\x18\x02 \x02(\r\x12\x0b\n\x03msg\x18\x03 \x02(\x0c\"\x8e\x01\n\x0bPackageData\x12\x11\n\tpkg_index\x18\x01 \x01(\r\x12\r\n\x05nonce\x18\x02 \x01(\x0c\x12\x11\n\tmsg_count\x18\x03 \x01(\r\x12\x17\n\x03raw\x18\x04 \x01(\x0b\x32\x08.RawDataH\x00\x12%\n\nheatshrink\x18\x05 \x01(\x0b\x32\x0f.HeatshrinkDataH\x00\x42\n\n\x08\x65ncoding\"A\n\x07Package\x12\x13\n\x0b\x62lake2s_mac\x18\x01 \x01(\x0c\x12\x13\n\x0b\x62lake2s_siv\x18\x02 \x01(\x0c\x12\x0c\n\x04\x64\x61ta\x18\x03 \x01(\x0c'
-)
-
-
-
-_MSG_TYPE = _descriptor.EnumDescriptor(
-  name='Type',
-  full_name='Msg.Type',
-  filename=None,
-  file=DESCRIPTOR,
-  create_key=_descriptor._internal_create_key,
-  values=[
-    _descriptor.EnumValueDescriptor(
-      name='CHAR', index=0, number=0,
-      serialized_options=None,
-      type=None,
-      create_key=_descriptor._internal_create_key),
-    _descriptor.EnumValueDescriptor(
-      name='BYTE', index=1, number=1,
-      serialized_options=None,
-      type=None,
-      create_key=_descriptor._internal_create_key),
-    _descriptor.EnumValueDescriptor(
-      name='INT8', index=2, number=2,
-      serialized_options=None,
-      type=None,
-      create_key=_descriptor._internal_create_key),
-    _descriptor.EnumValueDescriptor(
-      name='UINT8', index=3, number=3,
-      serialized_options=None,
-      type=None,
-      create_key=_descriptor._internal_create_key),
-    _descriptor.EnumValueDescriptor(
-      name='INT16', index=4, number=4,
-      serialized_options=None,
-      type=None,
-      create_key=_descriptor._internal_create_key),
-    _descriptor.EnumValueDescriptor(
-      name='UINT16', index=5, number=5,
-      serialized_options=None,
-      type=None,
-      create_key=_descriptor._internal_create_key),
-    _descriptor.EnumValueDescriptor(
-      name='INT32', index=6, number=6,
-      serialized_options=None,
-      type=None,
-      create_key=_descriptor._internal_create_key),
-    _descriptor.EnumValueDescriptor(
-      name='UINT32', index=7, number=7,
-      serialized_options=None,
-      type=None,
-      create_key=_descriptor._internal_create_key),
-    _descriptor.EnumValueDescriptor(
-      name='INT64', index=8, number=8,
-      serialized_options=None,
-      type=None,
-      create_key=_descriptor._internal_create_key),
-    _descriptor.EnumValueDescriptor(
-      name='UINT64', index=9, number=9,
-      serialized_options=None,
-      type=None,
-      create_key=_descriptor._internal_create_key),
-    _descriptor.EnumValueDescriptor(
-      name='FLOAT', index=10, number=10,
-      serialized_options=None,
-      type=None,
-      create_key=_descriptor._internal_create_key),
-    _descriptor.EnumValueDescriptor(
-      name='DOUBLE', index=11, number=11,
-      serialized_options=None,
-      type=None,
-      create_key=_descriptor._internal_create_key),
-  ],
-  containing_type=None,
-  serialized_options=None,
-  serialized_start=174,
-  serialized_end=313,
-)
-_sym_db.RegisterEnumDescriptor(_MSG_TYPE)
-
-
-_TIME = _descriptor.Descriptor(
-  name='Time',
-  full_name='Time',
-  filename=None,
-  file=DESCRIPTOR,
-  containing_type=None,
-  create_key=_descriptor._internal_create_key,
-  fields=[
-    _descriptor.FieldDescriptor(
-      name='s', full_name='Time.s', index=0,
-      number=1, type=13, cpp_type=3, label=2,
-      has_default_value=False, default_value=0,
-      message_type=None, enum_type=None, containing_type=None,
-      is_extension=False, extension_scope=None,
-      serialized_options=None, file=DESCRIPTOR,  create_key=_descriptor._internal_create_key),
-    _descriptor.FieldDescriptor(
-      name='ms', full_name='Time.ms', index=1,
-      number=2, type=13, cpp_type=3, label=1,
-      has_default_value=False, default_value=0,
-      message_type=None, enum_type=None, containing_type=None,
-      is_extension=False, extension_scope=None,
-      serialized_options=None, file=DESCRIPTOR,  create_key=_descriptor._internal_create_key),
-    _descriptor.FieldDescriptor(
-      name='us', full_name='Time.us', index=2,
-      number=3, type=13, cpp_type=3, label=1,
-      has_default_value=False, default_value=0,
-      message_type=None, enum_type=None, containing_type=None,
-      is_extension=False, extension_scope=None,
-      serialized_options=None, file=DESCRIPTOR,  create_key=_descriptor._internal_create_key),
-    _descriptor.FieldDescriptor(
-      name='ns', full_name='Time.ns', index=3,
-      number=4, type=13, cpp_type=3, label=1,
-      has_default_value=False, default_value=0,
-      message_type=None, enum_type=None, containing_type=None,
-      is_extension=False, extension_scope=None,
-      serialized_options=None, file=DESCRIPTOR,  create_key=_descriptor._internal_create_key),
-  ],
-  extensions=[
-  ],
-  nested_types=[],
-  enum_types=[
-  ],
-  serialized_options=None,
-  is_extendable=False,
-  syntax='proto2',
-  extension_ranges=[],
-  oneofs=[
-  ],
-  serialized_start=36,
-  serialized_end=89,
-)
-
-
-_MSG = _descriptor.Descriptor(
-  name='Msg',
-  full_name='Msg',
-  filename=None,
-  file=DESCRIPTOR,
-  containing_type=None,
-  create_key=_descriptor._internal_create_key,
-  fields=[
-    _descriptor.FieldDescriptor(
-      name='type', full_name='Msg.type', index=0,
-      number=1, type=14, cpp_type=8, label=1,
-      has_default_value=False, default_value=0,
-      message_type=None, enum_type=None, containing_type=None,
-      is_extension=False, extension_scope=None,
-      serialized_options=None, file=DESCRIPTOR,  create_key=_descriptor._internal_create_key),
-    _descriptor.FieldDescriptor(
-      name='time', full_name='Msg.time', index=1,
-      number=2, type=11, cpp_type=10, label=1,
-      has_default_value=False, default_value=None,
-      message_type=None, enum_type=None, containing_type=None,
-      is_extension=False, extension_scope=None,
-      serialized_options=None, file=DESCRIPTOR,  create_key=_descriptor._internal_create_key),
-    _descriptor.FieldDescriptor(
-      name='buf', full_name='Msg.buf', index=2,
-      number=3, type=12, cpp_type=9, label=1,
-      has_default_value=False, default_value=b"",
-      message_type=None, enum_type=None, containing_type=None,
-      is_extension=False, extension_scope=None,
-      serialized_options=None, file=DESCRIPTOR,  create_key=_descriptor._internal_create_key),
-    _descriptor.FieldDescriptor(
-      name='topic', full_name='Msg.topic', index=3,
-      number=4, type=9, cpp_type=9, label=1,
-      has_default_value=False, default_value=b"".decode('utf-8'),
-      message_type=None, enum_type=None, containing_type=None,
-      is_extension=False, extension_scope=None,
-      serialized_options=None, file=DESCRIPTOR,  create_key=_descriptor._internal_create_key),
-  ],
-  extensions=[
-  ],
-  nested_types=[],
-  enum_types=[
-    _MSG_TYPE,
-  ],
-  serialized_options=None,
-  is_extendable=False,
-  syntax='proto2',
-  extension_ranges=[],
-  oneofs=[
-  ],
-  serialized_start=92,
-  serialized_end=313,
-)
-
-
-_RAWDATA = _descriptor.Descriptor(
-  name='RawData',
-  full_name='RawData',
-  filename=None,
-  file=DESCRIPTOR,
-  containing_type=None,
-  create_key=_descriptor._internal_create_key,
-  fields=[
-    _descriptor.FieldDescriptor(
-      name='msg', full_name='RawData.msg', index=0,
-      number=1, type=11, cpp_type=10, label=3,
-      has_default_value=False, default_value=[],
-      message_type=None, enum_type=None, containing_type=None,
-      is_extension=False, extension_scope=None,
-      serialized_options=None, file=DESCRIPTOR,  create_key=_descriptor._internal_create_key),
-  ],
-  extensions=[
-  ],
-  nested_types=[],
-  enum_types=[
-  ],
-  serialized_options=None,
-  is_extendable=False,
-  syntax='proto2',
-  extension_ranges=[],
-  oneofs=[
-  ],
-  serialized_start=315,
-  serialized_end=343,
-)
-
-
-_HEATSHRINKDATA = _descriptor.Descriptor(
-  name='HeatshrinkData',
-  full_name='HeatshrinkData',
-  filename=None,
-  file=DESCRIPTOR,
-  containing_type=None,
-  create_key=_descriptor._internal_create_key,
-  fields=[
-    _descriptor.FieldDescriptor(
-      name='window_size', full_name='HeatshrinkData.window_size', index=0,
-      number=1, type=13, cpp_type=3, label=2,
-      has_default_value=False, default_value=0,
-      message_type=None, enum_type=None, containing_type=None,
-      is_extension=False, extension_scope=None,
-      serialized_options=None, file=DESCRIPTOR,  create_key=_descriptor._internal_create_key),
-    _descriptor.FieldDescriptor(
-      name='lookahead_size', full_name='HeatshrinkData.lookahead_size', index=1,
-      number=2, type=13, cpp_type=3, label=2,
-      has_default_value=False, default_value=0,
-      message_type=None, enum_type=None, containing_type=None,
-      is_extension=False, extension_scope=None,
-      serialized_options=None, file=DESCRIPTOR,  create_key=_descriptor._internal_create_key),
-    _descriptor.FieldDescriptor(
-      name='msg', full_name='HeatshrinkData.msg', index=2,
-      number=3, type=12, cpp_type=9, label=2,
-      has_default_value=False, default_value=b"",
-      message_type=None, enum_type=None, containing_type=None,
-      is_extension=False, extension_scope=None,
-      serialized_options=None, file=DESCRIPTOR,  create_key=_descriptor._internal_create_key),
-  ],
-  extensions=[
-  ],
-  nested_types=[],
-  enum_types=[
-  ],
-  serialized_options=None,
-  is_extendable=False,
-  syntax='proto2',
-  extension_ranges=[],
-  oneofs=[
-  ],
-  serialized_start=345,
-  serialized_end=419,
-)
-
-
-_PACKAGEDATA = _descriptor.Descriptor(
-  name='PackageData',
-  full_name='PackageData',
-  filename=None,
-  file=DESCRIPTOR,
-  containing_type=None,
-  create_key=_descriptor._internal_create_key,
-  fields=[
-    _descriptor.FieldDescriptor(
-      name='pkg_index', full_name='PackageData.pkg_index', index=0,
-      number=1, type=13, cpp_type=3, label=1,
-      has_default_value=False, default_value=0,
-      message_type=None, enum_type=None, containing_type=None,
-      is_extension=False, extension_scope=None,
-      serialized_options=None, file=DESCRIPTOR,  create_key=_descriptor._internal_create_key),
-    _descriptor.FieldDescriptor(
-      name='nonce', full_name='PackageData.nonce', index=1,
-      number=2, type=12, cpp_type=9, label=1,
-      has_default_value=False, default_value=b"",
-      message_type=None, enum_type=None, containing_type=None,
-      is_extension=False, extension_scope=None,
-      serialized_options=None, file=DESCRIPTOR,  create_key=_descriptor._internal_create_key),
-    _descriptor.FieldDescriptor(
-      name='msg_count', full_name='PackageData.msg_count', index=2,
-      number=3, type=13, cpp_type=3, label=1,
-      has_default_value=False, default_value=0,
-      message_type=None, enum_type=None, containing_type=None,
-      is_extension=False, extension_scope=None,
-      serialized_options=None, file=DESCRIPTOR,  create_key=_descriptor._internal_create_key),
-    _descriptor.FieldDescriptor(
-      name='raw', full_name='PackageData.raw', index=3,
-      number=4, type=11, cpp_type=10, label=1,
-      has_default_value=False, default_value=None,
-      message_type=None, enum_type=None, containing_type=None,
-      is_extension=False, extension_scope=None,
-      serialized_options=None, file=DESCRIPTOR,  create_key=_descriptor._internal_create_key),
-    _descriptor.FieldDescriptor(
-      name='heatshrink', full_name='PackageData.heatshrink', index=4,
-      number=5, type=11, cpp_type=10, label=1,
-      has_default_value=False, default_value=None,
-      message_type=None, enum_type=None, containing_type=None,
-      is_extension=False, extension_scope=None,
-      serialized_options=None, file=DESCRIPTOR,  create_key=_descriptor._internal_create_key),
-  ],
-  extensions=[
-  ],
-  nested_types=[],
-  enum_types=[
-  ],
-  serialized_options=None,
-  is_extendable=False,
-  syntax='proto2',
-  extension_ranges=[],
-  oneofs=[
-    _descriptor.OneofDescriptor(
-      name='encoding', full_name='PackageData.encoding',
-      index=0, containing_type=None,
-      create_key=_descriptor._internal_create_key,
-    fields=[]),
-  ],
-  serialized_start=422,
-  serialized_end=564,
-)
-
-
-_PACKAGE = _descriptor.Descriptor(
-  name='Package',
-  full_name='Package',
-  filename=None,
-  file=DESCRIPTOR,
-  containing_type=None,
-  create_key=_descriptor._internal_create_key,
-  fields=[
-    _descriptor.FieldDescriptor(
-      name='blake2s_mac', full_name='Package.blake2s_mac', index=0,
-      number=1, type=12, cpp_type=9, label=1,
-      has_default_value=False, default_value=b"",
-      message_type=None, enum_type=None, containing_type=None,
-      is_extension=False, extension_scope=None,
-      serialized_options=None, file=DESCRIPTOR,  create_key=_descriptor._internal_create_key),
-    _descriptor.FieldDescriptor(
-      name='blake2s_siv', full_name='Package.blake2s_siv', index=1,
-      number=2, type=12, cpp_type=9, label=1,
-      has_default_value=False, default_value=b"",
-      message_type=None, enum_type=None, containing_type=None,
-      is_extension=False, extension_scope=None,
-      serialized_options=None, file=DESCRIPTOR,  create_key=_descriptor._internal_create_key),
-    _descriptor.FieldDescriptor(
-      name='data', full_name='Package.data', index=2,
-      number=3, type=12, cpp_type=9, label=1,
-      has_default_value=False, default_value=b"",
-      message_type=None, enum_type=None, containing_type=None,
-      is_extension=False, extension_scope=None,
-      serialized_options=None, file=DESCRIPTOR,  create_key=_descriptor._internal_create_key),
-  ],
-  extensions=[
-  ],
-  nested_types=[],
-  enum_types=[
-  ],
-  serialized_options=None,
-  is_extendable=False,
-  syntax='proto2',
-  extension_ranges=[],
-  oneofs=[
-  ],
-  serialized_start=566,
-  serialized_end=631,
-)
-
-_MSG.fields_by_name['type'].enum_type = _MSG_TYPE
-_MSG.fields_by_name['time'].message_type = _TIME
-_MSG_TYPE.containing_type = _MSG
-_RAWDATA.fields_by_name['msg'].message_type = _MSG
-_PACKAGEDATA.fields_by_name['raw'].message_type = _RAWDATA
-_PACKAGEDATA.fields_by_name['heatshrink'].message_type = _HEATSHRINKDATA
-_PACKAGEDATA.oneofs_by_name['encoding'].fields.append(
-  _PACKAGEDATA.fields_by_name['raw'])
-_PACKAGEDATA.fields_by_name['raw'].containing_oneof = _PACKAGEDATA.oneofs_by_name['encoding']
-_PACKAGEDATA.oneofs_by_name['encoding'].fields.append(
-  _PACKAGEDATA.fields_by_name['heatshrink'])
-_PACKAGEDATA.fields_by_name['heatshrink'].containing_oneof = _PACKAGEDATA.oneofs_by_name['encoding']
-DESCRIPTOR.message_types_by_name['Time'] = _TIME
-DESCRIPTOR.message_types_by_name['Msg'] = _MSG
-DESCRIPTOR.message_types_by_name['RawData'] = _RAWDATA
-DESCRIPTOR.message_types_by_name['HeatshrinkData'] = _HEATSHRINKDATA
-DESCRIPTOR.message_types_by_name['PackageData'] = _PACKAGEDATA
-DESCRIPTOR.message_types_by_name['Package'] = _PACKAGE
-_sym_db.RegisterFileDescriptor(DESCRIPTOR)
-
-Time = _reflection.GeneratedProtocolMessageType('Time', (_message.Message,), {
-  'DESCRIPTOR' : _TIME,
-  '__module__' : 'services.plog_packager.pkg_pb2'
-  # @@protoc_insertion_point(class_scope:Time)
-  })
-_sym_db.RegisterMessage(Time)
-
-Msg = _reflection.GeneratedProtocolMessageType('Msg', (_message.Message,), {
-  'DESCRIPTOR' : _MSG,
-  '__module__' : 'services.plog_packager.pkg_pb2'
-  # @@protoc_insertion_point(class_scope:Msg)
-  })
-_sym_db.RegisterMessage(Msg)
-
-RawData = _reflection.GeneratedProtocolMessageType('RawData', (_message.Message,), {
-  'DESCRIPTOR' : _RAWDATA,
-  '__module__' : 'services.plog_packager.pkg_pb2'
-  # @@protoc_insertion_point(class_scope:RawData)
-  })
-_sym_db.RegisterMessage(RawData)
-
-HeatshrinkData = _reflection.GeneratedProtocolMessageType('HeatshrinkData', (_message.Message,), {
-  'DESCRIPTOR' : _HEATSHRINKDATA,
-  '__module__' : 'services.plog_packager.pkg_pb2'
-  # @@protoc_insertion_point(class_scope:HeatshrinkData)
-  })
-_sym_db.RegisterMessage(HeatshrinkData)
-
-PackageData = _reflection.GeneratedProtocolMessageType('PackageData', (_message.Message,), {
-  'DESCRIPTOR' : _PACKAGEDATA,
-  '__module__' : 'services.plog_packager.pkg_pb2'
-  # @@protoc_insertion_point(class_scope:PackageData)
-  })
-_sym_db.RegisterMessage(PackageData)
-
-Package = _reflection.GeneratedProtocolMessageType('Package', (_message.Message,), {
-  'DESCRIPTOR' : _PACKAGE,
-  '__module__' : 'services.plog_packager.pkg_pb2'
-  # @@protoc_insertion_point(class_scope:Package)
-  })
-_sym_db.RegisterMessage(Package)
-
-
+DESCRIPTOR = _descriptor_pool.Default().AddSerializedFile(b'\n services/plog-packager/pkg.proto\"5\n\x04Time\x12\t\n\x01s\x18\x01 \x02(\r\x12\n\n\x02ms\x18\x02 \x01(\r\x12\n\n\x02us\x18\x03 \x01(\r\x12\n\n\x02ns\x18\x04 \x01(\r\"\x80\x03\n\x03Msg\x12\x17\n\x04type\x18\x01 \x01(\x0e\x32\t.Msg.Type\x12\x13\n\x04time\x18\x02 \x01(\x0b\x32\x05.Time\x12\x0b\n\x03\x62uf\x18\x03 \x01(\x0c\x12\r\n\x05topic\x18\x04 \x01(\t\x12\x19\n\x05\x63odec\x18\x05 \x01(\x0e\x32\n.Msg.Codec\x12\r\n\x05\x63ount\x18\x06 \x01(\r\x12\x11\n\ttolerance\x18\x07 \x01(\x02\x12\x10\n\x08topic_id\x18\x08 \x01(\r\x12\x15\n\rtime_delta_us\x18\t \x01(\x12\"\x8b\x01\n\x04Type\x12\x08\n\x04\x43HAR\x10\x00\x12\x08\n\x04\x42YTE\x10\x01\x12\x08\n\x04INT8\x10\x02\x12\t\n\x05UINT8\x10\x03\x12\t\n\x05INT16\x10\x04\x12\n\n\x06UINT16\x10\x05\x12\t\n\x05INT32\x10\x06\x12\n\n\x06UINT32\x10\x07\x12\t\n\x05INT64\x10\x08\x12\n\n\x06UINT64\x10\t\x12\t\n\x05\x46LOAT\x10\n\x12\n\n\x06\x44OUBLE\x10\x0b\";\n\x05\x43odec\x12\x08\n\x04NONE\x10\x00\x12\x10\n\x0c\x44\x45LTA_ZIGZAG\x10\x01\x12\r\n\tXOR_FLOAT\x10\x02\x12\x07\n\x03ZFP\x10\x03\"%\n\x08TopicDef\x12\n\n\x02id\x18\x01 \x02(\r\x12\r\n\x05topic\x18\x02 \x02(\t\"6\n\x07RawData\x12\x11\n\x03msg\x18\x01 \x03(\x0b\x32\x04.Msg\x12\x18\n\x05topic\x18\x02 \x03(\x0b\x32\t.TopicDef\"J\n\x0eHeatshrinkData\x12\x13\n\x0bwindow_size\x18\x01 \x02(\r\x12\x16\n\x0elookahead_size\x18\x02 \x02(\r\x12\x0b\n\x03msg\x18\x03 \x02(\x0c\"\xa8\x01\n\x0bPackageData\x12\x11\n\tpkg_index\x18\x01 \x01(\r\x12\r\n\x05nonce\x18\x02 \x01(\x0c\x12\x11\n\tmsg_count\x18\x03 \x01(\r\x12\x17\n\x03raw\x18\x04 \x01(\x0b\x32\x08.RawDataH\x00\x12%\n\nheatshrink\x18\x05 \x01(\x0b\x32\x0f.HeatshrinkDataH\x00\x12\x18\n\tbase_time\x18\x06 \x01(\x0b\x32\x05.TimeB\n\n\x08\x65ncoding\"*\n\x07Package\x12\x0b\n\x03mac\x18\x01 \x01(\x0c\x12\x0c\n\x04\x64\x61ta\x18\x03 \x01(\x0cJ\x04\x08\x02\x10\x03')
+
+_builder.BuildMessageAndEnumDescriptors(DESCRIPTOR, globals())
+_builder.BuildTopDescriptorsAndMessages(DESCRIPTOR, 'services.plog_packager.pkg_pb2', globals())
+if _descriptor._USE_C_DESCRIPTORS == False:
+
+  DESCRIPTOR._options = None
+  _TIME._serialized_start=36
+  _TIME._serialized_end=89
+  _MSG._serialized_start=92
+  _MSG._serialized_end=476
+  _MSG_TYPE._serialized_start=276
+  _MSG_TYPE._serialized_end=415
+  _MSG_CODEC._serialized_start=417
+  _MSG_CODEC._serialized_end=476
+  _TOPICDEF._serialized_start=478
+  _TOPICDEF._serialized_end=515
+  _RAWDATA._serialized_start=517
+  _RAWDATA._serialized_end=571
+  _HEATSHRINKDATA._serialized_start=573
+  _HEATSHRINKDATA._serialized_end=647
+  _PACKAGEDATA._serialized_start=650
+  _PACKAGEDATA._serialized_end=818
+  _PACKAGE._serialized_start=820
+  _PACKAGE._serialized_end=862
 # @@protoc_insertion_point(module_scope)
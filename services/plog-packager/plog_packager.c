@@ -17,7 +17,7 @@
 #include "u_assert.h"
 #include "u_log.h"
 
-#include "sha3.h"
+#include "blake2.h"
 #include "chacha20.h"
 #include "poly1305.h"
 
@@ -64,13 +64,95 @@ static plog_packager_ret_t package_free(struct plog_packager_package *self) {
 		return PLOG_PACKAGER_RET_NULL;
 	}
 
+	if (self->data == NULL) {
+		return PLOG_PACKAGER_RET_OK;
+	}
+
 	/* Free the buffer including the header. */
 	free(self->data - self->header_size);
+	self->data = NULL;
 
 	return PLOG_PACKAGER_RET_OK;
 }
 
 
+/* Packages are sealed using ChaCha20-Poly1305. The construction follows
+ * RFC 8439 with a 64 bit nonce (the upper 32 bits of the 96 bit nonce
+ * are zero). As the package header is known only after all data is
+ * compressed, the MAC is computed over the ciphertext first and the
+ * header (additional data) afterwards:
+ *
+ *   mac = Poly1305(otk, ct | pad16 | ad | pad16 | le64(len(ct)) | le64(len(ad)))
+ */
+static void package_seal_start(struct plog_packager_package *self) {
+	PlogPackager *parent = self->parent;
+
+	/* Session nonce prefix followed by the package index. */
+	memset(self->nonce, 0, PLOG_PACKAGER_SEAL_NONCE_SIZE);
+	memcpy(self->nonce, parent->nonce, (parent->nonce_size < PLOG_PACKAGER_SEAL_NONCE_PREFIX_SIZE) ? parent->nonce_size : PLOG_PACKAGER_SEAL_NONCE_PREFIX_SIZE);
+	for (size_t i = 0; i < sizeof(self->index); i++) {
+		self->nonce[PLOG_PACKAGER_SEAL_NONCE_PREFIX_SIZE + i] = (self->index >> (i * 8)) & 0xff;
+	}
+
+	chacha20_keysetup(&self->seal_cipher, parent->seal_key, 256);
+	chacha20_nonce(&self->seal_cipher, self->nonce);
+
+	/* The first keystream block is used to derive the one-time Poly1305 key. */
+	chacha20_counter(&self->seal_cipher, 0);
+	chacha20_keystream(&self->seal_cipher, self->seal_keystream);
+	poly1305_init(&self->seal_mac, self->seal_keystream);
+
+	self->seal_counter = 1;
+	self->seal_keystream_used = sizeof(self->seal_keystream);
+	self->seal_data_len = 0;
+}
+
+
+/* Encrypt the data in place and update the MAC. */
+static void package_seal_data(struct plog_packager_package *self, uint8_t *buf, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		if (self->seal_keystream_used == sizeof(self->seal_keystream)) {
+			chacha20_counter(&self->seal_cipher, self->seal_counter++);
+			chacha20_keystream(&self->seal_cipher, self->seal_keystream);
+			self->seal_keystream_used = 0;
+		}
+		buf[i] ^= self->seal_keystream[self->seal_keystream_used++];
+	}
+	poly1305_update(&self->seal_mac, buf, len);
+	self->seal_data_len += len;
+}
+
+
+static void seal_mac_pad16(poly1305_context *mac, size_t len) {
+	const uint8_t zero[16] = {0};
+	if (len % 16) {
+		poly1305_update(mac, zero, 16 - (len % 16));
+	}
+}
+
+
+static void seal_mac_le64(poly1305_context *mac, uint64_t v) {
+	uint8_t b[8];
+	for (size_t i = 0; i < sizeof(b); i++) {
+		b[i] = (v >> (i * 8)) & 0xff;
+	}
+	poly1305_update(mac, b, sizeof(b));
+}
+
+
+static void package_seal_finish(struct plog_packager_package *self, const uint8_t *ad, size_t ad_len, uint8_t mac[PLOG_PACKAGER_SEAL_MAC_SIZE]) {
+	seal_mac_pad16(&self->seal_mac, self->seal_data_len);
+	poly1305_update(&self->seal_mac, ad, ad_len);
+	seal_mac_pad16(&self->seal_mac, ad_len);
+	seal_mac_le64(&self->seal_mac, self->seal_data_len);
+	seal_mac_le64(&self->seal_mac, ad_len);
+	poly1305_finish(&self->seal_mac, mac);
+
+	/* Do not leave the keystream in memory. */
+	memset(self->seal_keystream, 0, sizeof(self->seal_keystream));
+}
+
+
 /* Check if the LZSS compressor has anything to output. If yes, read the compressed
  * data and APPEND it to the buffer moving data_used forward. */
 static plog_packager_ret_t package_poll_compress_data(struct plog_packager_package *self) {
@@ -94,6 +176,9 @@ static plog_packager_ret_t package_poll_compress_data(struct plog_packager_packa
 		if (pres < 0) {
 			return PLOG_PACKAGER_RET_FAILED;
 		}
+		if (self->parent->seal) {
+			package_seal_data(self, self->data + self->data_used, poll_size);
+		}
 		self->data_used += poll_size;
 	} while (pres == HSER_POLL_MORE);
 
@@ -172,7 +257,12 @@ static plog_packager_ret_t package_prepare(struct plog_packager_package *self) {
 	self->index = self->parent->package_counter;
 	self->parent->package_counter++;
 
+	if (self->parent->seal) {
+		package_seal_start(self);
+	}
+
 	self->message_count = 0;
+	self->topics_used = 0;
 	self->data_used = 0;
 	self->data_used_raw = 0;
 	self->header_used = 0;
@@ -226,24 +316,44 @@ static plog_packager_ret_t package_finish(struct plog_packager_package *self) {
 	pb_encode_varint(&stream, self->data_used);
 	package_prepend_raw_data(self, buf, stream.bytes_written);
 
+	/* Base time of the package. Zero if the package contains no messages. */
+	uint8_t tbuf[16];
+	pb_ostream_t tstream = pb_ostream_from_buffer(tbuf, sizeof(tbuf));
+	pb_encode_tag(&tstream, PB_WT_VARINT, Time_s_tag);
+	pb_encode_varint(&tstream, self->base_time.tv_sec);
+	pb_encode_tag(&tstream, PB_WT_VARINT, Time_us_tag);
+	pb_encode_varint(&tstream, self->base_time.tv_nsec / 1000);
+
 	stream = pb_ostream_from_buffer(buf, sizeof(buf));
+	pb_encode_tag(&stream, PB_WT_STRING, PackageData_base_time_tag);
+	pb_encode_varint(&stream, tstream.bytes_written);
+	pb_write(&stream, tbuf, tstream.bytes_written);
 	pb_encode_tag(&stream, PB_WT_VARINT, PackageData_pkg_index_tag);
 	pb_encode_varint(&stream, self->index);
 	pb_encode_tag(&stream, PB_WT_VARINT, PackageData_msg_count_tag);
 	pb_encode_varint(&stream, self->message_count);
+	if (self->parent->seal) {
+		pb_encode_tag(&stream, PB_WT_STRING, PackageData_nonce_tag);
+		pb_encode_varint(&stream, PLOG_PACKAGER_SEAL_NONCE_SIZE);
+		pb_write(&stream, self->nonce, PLOG_PACKAGER_SEAL_NONCE_SIZE);
+	}
 	pb_encode_tag(&stream, PB_WT_STRING, PackageData_heatshrink_tag);
 	pb_encode_varint(&stream, self->data_used + self->header_used);
 	package_prepend_raw_data(self, buf, stream.bytes_written);
 
-	/** @todo compute MAC here */
-
+	/* The whole PackageData header prepended so far is authenticated. */
 	stream = pb_ostream_from_buffer(buf, sizeof(buf));
+	if (self->parent->seal) {
+		uint8_t mac[PLOG_PACKAGER_SEAL_MAC_SIZE];
+		package_seal_finish(self, self->data - self->header_used, self->header_used, mac);
+		pb_encode_tag(&stream, PB_WT_STRING, Package_mac_tag);
+		pb_encode_varint(&stream, PLOG_PACKAGER_SEAL_MAC_SIZE);
+		pb_write(&stream, mac, PLOG_PACKAGER_SEAL_MAC_SIZE);
+	}
 	pb_encode_tag(&stream, PB_WT_STRING, Package_data_tag);
 	pb_encode_varint(&stream, self->data_used + self->header_used);
 	package_prepend_raw_data(self, buf, stream.bytes_written);
 
-	/** @todo prepend MAC here */
-
 	package_prepend_raw_data(self, PLOG_PACKAGER_PACKAGE_MAGIC, PLOG_PACKAGER_PACKAGE_MAGIC_SIZE);
 
 	self->finished = true;
@@ -251,6 +361,150 @@ static plog_packager_ret_t package_finish(struct plog_packager_package *self) {
 }
 
 
+/* Get the position the next write goes to. Filesystems without fstat are
+ * assumed to continue where the last write ended. */
+static void file_update_pos(PlogPackager *self) {
+	Fs *fs = self->dst_fs;
+	struct fs_stat st = {0};
+	if (fs->vmt->fstat != NULL && fs->vmt->fstat(fs, &self->dst_file, &st) == FS_RET_OK) {
+		self->dst_file_pos = st.size;
+	}
+}
+
+
+/* The file is opened on the first write and kept open. It is reopened after
+ * a failure. */
+static plog_packager_ret_t file_open(PlogPackager *self) {
+	Fs *fs = self->dst_fs;
+
+	if (self->dst_file_open) {
+		return PLOG_PACKAGER_RET_OK;
+	}
+	if (fs->vmt->open(fs, &self->dst_file, self->dst_path, FS_MODE_APPEND | FS_MODE_CREATE | FS_MODE_WRITEONLY) != FS_RET_OK) {
+		return PLOG_PACKAGER_RET_FAILED;
+	}
+	self->dst_file_open = true;
+
+	/* The file is opened for appending, continue at its end to keep the writes aligned. */
+	self->dst_file_pos = 0;
+	file_update_pos(self);
+
+	return PLOG_PACKAGER_RET_OK;
+}
+
+
+/* Write directly to the destination file. */
+static plog_packager_ret_t file_write(PlogPackager *self, const uint8_t *buf, size_t len) {
+	Fs *fs = self->dst_fs;
+
+	if (file_open(self) != PLOG_PACKAGER_RET_OK) {
+		return PLOG_PACKAGER_RET_FAILED;
+	}
+
+	/* A write may be shorter than requested, eg. at the end of a flash FIFO block. */
+	while (len > 0) {
+		size_t written = 0;
+		if (fs->vmt->write(fs, &self->dst_file, buf, len, &written) != FS_RET_OK || written == 0) {
+			fs->vmt->close(fs, &self->dst_file);
+			self->dst_file_open = false;
+			return PLOG_PACKAGER_RET_FAILED;
+		}
+		buf += written;
+		len -= written;
+		self->dst_file_pos += written;
+	}
+	file_update_pos(self);
+
+	return PLOG_PACKAGER_RET_OK;
+}
+
+
+/* Write the buffered data. Must be called with the file lock held. */
+static plog_packager_ret_t file_flush_buffer(PlogPackager *self) {
+	plog_packager_ret_t ret = PLOG_PACKAGER_RET_OK;
+	if (self->wbuf_used > 0) {
+		ret = file_write(self, self->wbuf, self->wbuf_used);
+		if (ret != PLOG_PACKAGER_RET_OK) {
+			u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("file write failed, %u B lost"), self->wbuf_used);
+		}
+		/* Drop the data on failure, the buffer would overflow otherwise. */
+		self->wbuf_used = 0;
+	}
+	self->last_flush = xTaskGetTickCount();
+	return ret;
+}
+
+
+static plog_packager_ret_t file_append(PlogPackager *self, const uint8_t *buf, size_t len) {
+	xSemaphoreTake(self->file_lock, portMAX_DELAY);
+	plog_packager_ret_t ret = PLOG_PACKAGER_RET_OK;
+
+	if (self->wbuf == NULL) {
+		ret = file_write(self, buf, len);
+		goto out;
+	}
+
+	/* The alignment depends on the real file position, open the file first. */
+	if (file_open(self) != PLOG_PACKAGER_RET_OK) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("cannot open the file, %u B lost"), len);
+		ret = PLOG_PACKAGER_RET_FAILED;
+		goto out;
+	}
+
+	while (len > 0) {
+		/* The buffer is full when its end reaches the next file position
+		 * aligned to the buffer size. */
+		size_t cap = self->wbuf_size - (self->dst_file_pos % self->wbuf_size);
+		if (self->wbuf_used >= cap) {
+			if (file_flush_buffer(self) != PLOG_PACKAGER_RET_OK) {
+				ret = PLOG_PACKAGER_RET_FAILED;
+			}
+			continue;
+		}
+		size_t n = cap - self->wbuf_used;
+		if (n > len) {
+			n = len;
+		}
+		memcpy(self->wbuf + self->wbuf_used, buf, n);
+		self->wbuf_used += n;
+		buf += n;
+		len -= n;
+
+		if (self->wbuf_used == cap) {
+			if (file_flush_buffer(self) != PLOG_PACKAGER_RET_OK) {
+				ret = PLOG_PACKAGER_RET_FAILED;
+			}
+		}
+	}
+
+out:
+	xSemaphoreGive(self->file_lock);
+	return ret;
+}
+
+
+static plog_packager_ret_t file_flush(PlogPackager *self) {
+	xSemaphoreTake(self->file_lock, portMAX_DELAY);
+	plog_packager_ret_t ret = file_flush_buffer(self);
+	if (self->dst_file_open && self->dst_fs->vmt->fflush != NULL) {
+		self->dst_fs->vmt->fflush(self->dst_fs, &self->dst_file);
+	}
+	xSemaphoreGive(self->file_lock);
+	return ret;
+}
+
+
+static void file_close(PlogPackager *self) {
+	file_flush(self);
+	xSemaphoreTake(self->file_lock, portMAX_DELAY);
+	if (self->dst_file_open) {
+		self->dst_fs->vmt->close(self->dst_fs, &self->dst_file);
+		self->dst_file_open = false;
+	}
+	xSemaphoreGive(self->file_lock);
+}
+
+
 static plog_packager_ret_t package_publish(struct plog_packager_package *self) {
 	if (self == NULL) {
 		return PLOG_PACKAGER_RET_NULL;
@@ -267,15 +521,7 @@ static plog_packager_ret_t package_publish(struct plog_packager_package *self) {
 
 	/* Write to file */
 	if (self->parent->dst_fs != NULL && strlen(self->parent->dst_path) > 0) {
-		File f;
-		Fs *fs = self->parent->dst_fs;
-		if (fs->vmt->open(fs, &f, self->parent->dst_path, FS_MODE_APPEND | FS_MODE_CREATE | FS_MODE_WRITEONLY) == FS_RET_OK) {
-			size_t w = 0;
-			/** @TODO: write properly */
-			if (fs->vmt->write(fs, &f, self->data - self->header_used, self->data_used + self->header_used, &w) == FS_RET_OK) {
-			}
-			fs->vmt->close(fs, &f);
-		}
+		file_append(self->parent, self->data - self->header_used, self->data_used + self->header_used);
 	}
 
 	return PLOG_PACKAGER_RET_OK;
@@ -288,36 +534,161 @@ static bool nanopb_write_callback_compressed(pb_ostream_t *stream, const uint8_t
 }
 
 
-static void encode_message(pb_ostream_t *stream, NdArray *msg, const char *topic) {
+static void encode_topic_def(pb_ostream_t *stream, uint32_t id, const char *topic) {
+	pb_encode_tag(stream, PB_WT_VARINT, TopicDef_id_tag);
+	pb_encode_varint(stream, id);
+	pb_encode_tag(stream, PB_WT_STRING, TopicDef_topic_tag);
+	pb_encode_varint(stream, strlen(topic));
+	pb_write(stream, (const uint8_t *)topic, strlen(topic));
+}
+
+
+static void encode_message(pb_ostream_t *stream, NdArray *msg, const char *topic, int32_t topic_id, int64_t time_delta_us, enum pkg_codec codec, float tolerance, const uint8_t *buf, size_t len) {
 	/* Write the message type. Proto file Msg Type enum is the same as ndarray.dtype */
 	pb_encode_tag(stream, PB_WT_VARINT, Msg_type_tag);
 	pb_encode_varint(stream, msg->dtype);
-	/** @todo add time here */
 
-	/* Encode the topic */
-	pb_encode_tag(stream, PB_WT_STRING, Msg_topic_tag);
-	pb_encode_varint(stream, strlen(topic));
-	pb_write(stream, (const uint8_t *)topic, strlen(topic));
+	/* Omitted if the message has the same time as the previous one. */
+	if (time_delta_us != 0) {
+		pb_encode_tag(stream, PB_WT_VARINT, Msg_time_delta_us_tag);
+		pb_encode_svarint(stream, time_delta_us);
+	}
+
+	/* Encode the topic. Use the dictionary if possible. */
+	if (topic_id >= 0) {
+		pb_encode_tag(stream, PB_WT_VARINT, Msg_topic_id_tag);
+		pb_encode_varint(stream, topic_id);
+	} else {
+		pb_encode_tag(stream, PB_WT_STRING, Msg_topic_tag);
+		pb_encode_varint(stream, strlen(topic));
+		pb_write(stream, (const uint8_t *)topic, strlen(topic));
+	}
+
+	/* Codec parameters are required to decode the message data. Omitted
+	 * if the data is stored raw. */
+	if (codec != PKG_CODEC_NONE) {
+		pb_encode_tag(stream, PB_WT_VARINT, Msg_codec_tag);
+		pb_encode_varint(stream, codec);
+		pb_encode_tag(stream, PB_WT_VARINT, Msg_count_tag);
+		pb_encode_varint(stream, msg->asize);
+		if (codec == PKG_CODEC_ZFP) {
+			pb_encode_tag(stream, PB_WT_32BIT, Msg_tolerance_tag);
+			pb_encode_fixed32(stream, &tolerance);
+		}
+	}
 
 	/* Encode the message data */
 	pb_encode_tag(stream, PB_WT_STRING, Msg_buf_tag);
-	pb_encode_varint(stream, msg->asize * msg->dsize);
-	pb_write(stream, msg->buf, msg->asize * msg->dsize);
-	// pb_write(stream, test_vector, 32);
+	pb_encode_varint(stream, len);
+	pb_write(stream, buf, len);
+}
+
+
+/* Simplified MQTT-style matching. The filter either matches the topic
+ * exactly or it ends with a '#' wildcard and matches the topic prefix. */
+static bool codec_match_topic(const char *filter, const char *topic) {
+	size_t flen = strlen(filter);
+	if (flen > 0 && filter[flen - 1] == '#') {
+		return strncmp(filter, topic, flen - 1) == 0;
+	}
+	return strcmp(filter, topic) == 0;
+}
+
+
+static enum pkg_codec package_select_codec(PlogPackager *self, NdArray *msg, const char *topic, float *tolerance) {
+	*tolerance = 0.0f;
+	for (size_t i = 0; i < self->codecs_used; i++) {
+		struct plog_packager_codec *c = &self->codecs[i];
+		if (codec_match_topic(c->topic_filter, topic)) {
+			if (!pkg_codec_supported(c->codec, msg->dtype)) {
+				return PKG_CODEC_NONE;
+			}
+			*tolerance = c->tolerance;
+			return c->codec;
+		}
+	}
+	if (self->auto_codec) {
+		return pkg_codec_auto(msg->dtype);
+	}
+	return PKG_CODEC_NONE;
+}
+
+
+/* Find the topic in the package topic dictionary. Returns -1 if the topic
+ * is not found. */
+static int32_t package_find_topic(struct plog_packager_package *self, const char *topic) {
+	for (size_t i = 0; i < self->topics_used; i++) {
+		if (!strcmp(self->topics[i], topic)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
 
+static int64_t timespec_diff_us(const struct timespec *a, const struct timespec *b) {
+	return ((int64_t)a->tv_sec - b->tv_sec) * 1000000 + ((int64_t)a->tv_nsec - b->tv_nsec) / 1000;
 }
 
-static plog_packager_ret_t package_add_message(struct plog_packager_package *self, NdArray *msg, const char *topic) {
+
+static plog_packager_ret_t package_add_message(struct plog_packager_package *self, NdArray *msg, const char *topic, const struct timespec *ts) {
 	if (self == NULL) {
 		return PLOG_PACKAGER_RET_NULL;
 	}
+	PlogPackager *parent = self->parent;
+
+	/* Run the numeric codec first. If the encoded data doesn't fit into the
+	 * scratch buffer, it is bigger than the raw data. Store the raw data then. */
+	float tolerance = 0.0f;
+	enum pkg_codec codec = package_select_codec(parent, msg, topic, &tolerance);
+	const uint8_t *buf = msg->buf;
+	size_t len = msg->asize * msg->dsize;
+	if (codec != PKG_CODEC_NONE) {
+		size_t coded_len = 0;
+		if (pkg_codec_encode(codec, tolerance, msg, parent->codec_buf, parent->codec_buf_size, &coded_len) == PKG_CODEC_RET_OK && coded_len < len) {
+			buf = parent->codec_buf;
+			len = coded_len;
+		} else {
+			codec = PKG_CODEC_NONE;
+		}
+	}
 
-	pb_ostream_t len_stream = {0};
-	encode_message(&len_stream, msg, topic);
-	size_t msg_len = len_stream.bytes_written;
+	int32_t topic_id = -1;
+	bool new_topic = false;
+	int64_t time_delta_us = 0;
+	size_t msg_len = 0;
+	size_t def_len = 0;
+	while (true) {
+		/* Add the topic to the dictionary if it is not there. The topic
+		 * definition must precede the first message using it. */
+		topic_id = package_find_topic(self, topic);
+		new_topic = topic_id < 0 && self->topics_used < PLOG_PACKAGER_MAX_TOPICS && strlen(topic) < PLOG_PACKAGER_TOPIC_FILTER_SIZE;
+		if (new_topic) {
+			topic_id = self->topics_used;
+		}
+
+		if (self->message_count == 0) {
+			self->base_time = *ts;
+			self->last_time = *ts;
+		}
+		time_delta_us = timespec_diff_us(ts, &self->last_time);
 
-	// u_log(system_log, LOG_TYPE_DEBUG, U_LOG_MODULE_PREFIX("remaining %u"), remaining);
-	if ((msg_len + self->data_used) > (self->data_size / 2)) {
+		pb_ostream_t len_stream = {0};
+		encode_message(&len_stream, msg, topic, topic_id, time_delta_us, codec, tolerance, buf, len);
+		msg_len = len_stream.bytes_written;
+
+		pb_ostream_t def_len_stream = {0};
+		if (new_topic) {
+			encode_topic_def(&def_len_stream, topic_id, topic);
+		}
+		def_len = def_len_stream.bytes_written;
+
+		// u_log(system_log, LOG_TYPE_DEBUG, U_LOG_MODULE_PREFIX("remaining %u"), remaining);
+		if (self->message_count == 0 || (msg_len + def_len + self->data_used) <= (self->data_size / 2)) {
+			break;
+		}
+
+		/* The new package starts with an empty dictionary and a new base time. */
 		package_finish(self);
 		package_publish(self);
 		package_prepare(self);
@@ -325,10 +696,19 @@ static plog_packager_ret_t package_add_message(struct plog_packager_package *sel
 
 	pb_ostream_t stream = {nanopb_write_callback_compressed, self, self->data_size - self->data_used, 0};
 
+	if (new_topic) {
+		pb_encode_tag(&stream, PB_WT_STRING, RawData_topic_tag);
+		pb_encode_varint(&stream, def_len);
+		encode_topic_def(&stream, topic_id, topic);
+		strlcpy(self->topics[topic_id], topic, PLOG_PACKAGER_TOPIC_FILTER_SIZE);
+		self->topics_used++;
+	}
+
 	/* Message header */
 	pb_encode_tag(&stream, PB_WT_STRING, RawData_msg_tag);
 	pb_encode_varint(&stream, msg_len);
-	encode_message(&stream, msg, topic);
+	encode_message(&stream, msg, topic, topic_id, time_delta_us, codec, tolerance, buf, len);
+	self->last_time = *ts;
 
 	self->message_count++;
 
@@ -345,11 +725,26 @@ static void plog_packager_task(void *p) {
 		struct timespec ts = {0};
 		char topic[PLOG_PACKAGER_TOPIC_FILTER_SIZE] = {0};
 		if (self->mqc->vmt->receive(self->mqc, topic, PLOG_PACKAGER_TOPIC_FILTER_SIZE, &self->rxbuf, &ts) == MQ_RET_OK) {
-			package_add_message(&self->package, &self->rxbuf, topic);
+			package_add_message(&self->package, &self->rxbuf, topic, &ts);
+		}
+
+		/* Time bound of the buffered file data. */
+		if (self->wbuf_used > 0 && (xTaskGetTickCount() - self->last_flush) >= pdMS_TO_TICKS(self->flush_interval_ms)) {
+			file_flush(self);
 		}
 	}
-	vTaskDelete(NULL);
+
+	/* Do not lose the unfinished package on shutdown. */
+	if (self->package.message_count > 0) {
+		package_finish(&self->package);
+		package_publish(&self->package);
+	}
+	if (self->dst_fs != NULL) {
+		file_close(self);
+	}
+
 	self->running = false;
+	vTaskDelete(NULL);
 }
 
 
@@ -360,14 +755,43 @@ plog_packager_ret_t plog_packager_init(PlogPackager *self, Mq *mq) {
 
 	memset(self, 0, sizeof(PlogPackager));
 	self->mq = mq;
+	self->auto_codec = true;
+	self->wbuf_size = CONFIG_PLOG_PACKAGER_FILE_BUFFER_SIZE;
+	self->flush_interval_ms = CONFIG_PLOG_PACKAGER_FILE_FLUSH_INTERVAL_MS;
+
+	self->file_lock = xSemaphoreCreateMutex();
+	if (self->file_lock == NULL) {
+		return PLOG_PACKAGER_RET_FAILED;
+	}
 
 	return PLOG_PACKAGER_RET_OK;
 }
 
 
-plog_packager_ret_t plog_packager_free(PlogPackager *self) {
+/* Release everything allocated in plog_packager_start. The packager may be
+ * started again afterwards. */
+static void packager_release(PlogPackager *self) {
+	if (self->mqc != NULL) {
+		self->mqc->vmt->close(self->mqc);
+		self->mqc = NULL;
+	}
+	ndarray_free(&self->rxbuf);
 	package_free(&self->package);
-	heatshrink_encoder_free(self->hs_encoder);
+	if (self->hs_encoder != NULL) {
+		heatshrink_encoder_free(self->hs_encoder);
+		self->hs_encoder = NULL;
+	}
+	free(self->codec_buf);
+	self->codec_buf = NULL;
+	free(self->wbuf);
+	self->wbuf = NULL;
+	self->wbuf_used = 0;
+}
+
+
+plog_packager_ret_t plog_packager_free(PlogPackager *self) {
+	packager_release(self);
+	vSemaphoreDelete(self->file_lock);
 	self->mq = NULL;
 
 	return PLOG_PACKAGER_RET_OK;
@@ -379,7 +803,34 @@ plog_packager_ret_t plog_packager_start(PlogPackager *self, size_t msg_size, siz
 		return PLOG_PACKAGER_RET_FAILED;
 	}
 
-	/* We are counting packages from the start of the process. Init and prepare the first one. */
+	/* Derive the sealing key. Packages are sealed only if a key is set. */
+	self->seal = false;
+	if (self->key_size > 0) {
+		if (self->nonce_size < PLOG_PACKAGER_SEAL_NONCE_PREFIX_SIZE) {
+			u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("sealing key set without a nonce prefix"));
+			return PLOG_PACKAGER_RET_FAILED;
+		}
+		if (self->nonce_used) {
+			u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("nonce prefix already used, load a new one"));
+			return PLOG_PACKAGER_RET_FAILED;
+		}
+		blake2s(self->seal_key, PLOG_PACKAGER_SEAL_KEY_SIZE, self->key, self->key_size, NULL, 0);
+		self->seal = true;
+		self->nonce_used = true;
+	}
+
+	/* Using heatshrink to compress data */
+	self->hs_window_size = 8;
+	self->hs_lookahead_size = 5;
+	self->hs_encoder = heatshrink_encoder_alloc(self->hs_window_size, self->hs_lookahead_size);
+
+	if (self->hs_encoder == NULL) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("cannot allocate compression encoder"));
+		return PLOG_PACKAGER_RET_FAILED;
+	}
+
+	/* We are counting packages from the start of the process. Init and prepare the first one,
+	 * it resets the encoder. */
 	self->package_counter = 0;
 	if (package_init(&self->package, self, package_size, PLOG_PACKAGER_HEADER_SIZE) != PLOG_PACKAGER_RET_OK) {
 		goto err;
@@ -392,21 +843,30 @@ plog_packager_ret_t plog_packager_start(PlogPackager *self, size_t msg_size, siz
 		goto err;
 	}
 	self->mqc->vmt->subscribe(self->mqc, self->topic_filter);
+	/* Do not block forever, the file buffer flush is time bound. */
+	self->mqc->vmt->set_timeout(self->mqc, PLOG_PACKAGER_RX_TIMEOUT_MS);
 
-	/* Using heatshrink to compress data */
-	self->hs_window_size = 8;
-	self->hs_lookahead_size = 5;
-	self->hs_encoder = heatshrink_encoder_alloc(self->hs_window_size, self->hs_lookahead_size);
-
-	if (self->hs_encoder == NULL) {
-		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("cannot allocate compression encoder"));
-		return PLOG_PACKAGER_RET_FAILED;
+	if (ndarray_init_empty(&self->rxbuf, DTYPE_BYTE, msg_size) != NDARRAY_RET_OK) {
+		goto err;
 	}
 
-	if (ndarray_init_empty(&self->rxbuf, DTYPE_BYTE, msg_size) != NDARRAY_RET_OK) {
+	/* Codecs may slightly expand the data (zfp requires space for the worst
+	 * case). Anything bigger than the raw message is discarded anyway. */
+	self->codec_buf_size = msg_size + msg_size / 4 + 64;
+	self->codec_buf = malloc(self->codec_buf_size);
+	if (self->codec_buf == NULL) {
 		goto err;
 	}
 
+	if (self->dst_fs != NULL && self->wbuf_size > 0) {
+		self->wbuf = malloc(self->wbuf_size);
+		if (self->wbuf == NULL) {
+			goto err;
+		}
+		self->wbuf_used = 0;
+	}
+	self->last_flush = xTaskGetTickCount();
+
 	/* Run the packager main thread. Messages are being received inside. */
 	xTaskCreate(plog_packager_task, "plog-packager", configMINIMAL_STACK_SIZE + 512, (void *)self, 1, &(self->task));
 	if (self->task == NULL) {
@@ -418,10 +878,14 @@ plog_packager_ret_t plog_packager_start(PlogPackager *self, size_t msg_size, siz
 		u_log(system_log, LOG_TYPE_INFO, U_LOG_MODULE_PREFIX("  -> mq '%s'"), self->dst_topic);
 	}
 	if (self->dst_fs) {
-		u_log(system_log, LOG_TYPE_INFO, U_LOG_MODULE_PREFIX("  -> file '%s'"), self->dst_path);
+		u_log(system_log, LOG_TYPE_INFO, U_LOG_MODULE_PREFIX("  -> file '%s', buffer %u B, flush %u ms"), self->dst_path, self->wbuf_size, self->flush_interval_ms);
+	}
+	for (size_t i = 0; i < self->codecs_used; i++) {
+		u_log(system_log, LOG_TYPE_INFO, U_LOG_MODULE_PREFIX("  codec %s for '%s'"), pkg_codec_str(self->codecs[i].codec), self->codecs[i].topic_filter);
 	}
 	return PLOG_PACKAGER_RET_OK;
 err:
+	packager_release(self);
 	u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("cannot start"));
 	return PLOG_PACKAGER_RET_FAILED;
 }
@@ -437,11 +901,7 @@ plog_packager_ret_t plog_packager_stop(PlogPackager *self) {
 		vTaskDelay(100);
 	}
 
-	if (self->mqc) {
-		self->mqc->vmt->close(self->mqc);
-	}
-
-	ndarray_free(&self->rxbuf);
+	packager_release(self);
 
 	return PLOG_PACKAGER_RET_OK;
 }
@@ -459,6 +919,7 @@ plog_packager_ret_t plog_packager_set_nonce(PlogPackager *self, const uint8_t *n
 	}
 	memcpy(self->nonce, nonce, len);
 	self->nonce_size = len;
+	self->nonce_used = false;
 	return PLOG_PACKAGER_RET_OK;
 }
 
@@ -473,6 +934,69 @@ plog_packager_ret_t plog_packager_set_key(PlogPackager *self, const uint8_t *key
 }
 
 
+plog_packager_ret_t plog_packager_load_key(PlogPackager *self, Fs *fs, const char *key_path, const char *counter_path) {
+	if (u_assert(self != NULL) ||
+	    u_assert(fs != NULL)) {
+		return PLOG_PACKAGER_RET_NULL;
+	}
+
+	uint8_t key[PLOG_PACKAGER_MAX_KEY_SIZE] = {0};
+	size_t key_size = 0;
+	File f;
+	if (fs->vmt->open(fs, &f, key_path, FS_MODE_READONLY) != FS_RET_OK) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("cannot open the key file '%s'"), key_path);
+		return PLOG_PACKAGER_RET_FAILED;
+	}
+	fs_ret_t ret = fs->vmt->read(fs, &f, key, sizeof(key), &key_size);
+	fs->vmt->close(fs, &f);
+	if (ret != FS_RET_OK || key_size == 0) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("cannot read the key file '%s'"), key_path);
+		return PLOG_PACKAGER_RET_FAILED;
+	}
+
+	/* A missing counter file is a first boot. */
+	uint32_t counter = 0;
+	if (fs->vmt->open(fs, &f, counter_path, FS_MODE_READONLY) == FS_RET_OK) {
+		size_t read = 0;
+		ret = fs->vmt->read(fs, &f, &counter, sizeof(counter), &read);
+		fs->vmt->close(fs, &f);
+		if (ret != FS_RET_OK || read != sizeof(counter)) {
+			/* Do not start over from 0, the nonce would repeat. */
+			u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("boot counter '%s' is corrupted"), counter_path);
+			return PLOG_PACKAGER_RET_FAILED;
+		}
+	}
+	if (counter == UINT32_MAX) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("boot counter exhausted, change the key"));
+		return PLOG_PACKAGER_RET_FAILED;
+	}
+	counter++;
+
+	/* Persist the new value before it is used. */
+	size_t written = 0;
+	if (fs->vmt->open(fs, &f, counter_path, FS_MODE_CREATE | FS_MODE_TRUNCATE | FS_MODE_WRITEONLY) != FS_RET_OK) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("cannot open the boot counter '%s'"), counter_path);
+		return PLOG_PACKAGER_RET_FAILED;
+	}
+	ret = fs->vmt->write(fs, &f, &counter, sizeof(counter), &written);
+	if (ret == FS_RET_OK) {
+		ret = fs->vmt->fflush(fs, &f);
+	}
+	fs->vmt->close(fs, &f);
+	if (ret != FS_RET_OK || written != sizeof(counter)) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("cannot save the boot counter '%s'"), counter_path);
+		return PLOG_PACKAGER_RET_FAILED;
+	}
+
+	plog_packager_set_nonce(self, (uint8_t *)&counter, sizeof(counter));
+	plog_packager_set_key(self, key, key_size);
+	memset(key, 0, sizeof(key));
+	u_log(system_log, LOG_TYPE_INFO, U_LOG_MODULE_PREFIX("sealing key loaded, boot counter %lu"), (unsigned long)counter);
+
+	return PLOG_PACKAGER_RET_OK;
+}
+
+
 plog_packager_ret_t plog_packager_add_dst_mq(PlogPackager *self, const char *dst_topic) {
 	strlcpy(self->dst_topic, dst_topic, PLOG_PACKAGER_TOPIC_FILTER_SIZE);
 	return PLOG_PACKAGER_RET_OK;
@@ -485,3 +1009,42 @@ plog_packager_ret_t plog_packager_add_dst_file(PlogPackager *self, Fs *fs, const
 	return PLOG_PACKAGER_RET_OK;
 }
 
+
+plog_packager_ret_t plog_packager_add_codec(PlogPackager *self, const char *topic_filter, enum pkg_codec codec, float tolerance) {
+	if (self->codecs_used >= PLOG_PACKAGER_MAX_CODECS) {
+		return PLOG_PACKAGER_RET_FAILED;
+	}
+	if (codec == PKG_CODEC_ZFP && !(tolerance > 0.0f)) {
+		return PLOG_PACKAGER_RET_BAD_ARG;
+	}
+	struct plog_packager_codec *c = &self->codecs[self->codecs_used];
+	strlcpy(c->topic_filter, topic_filter, PLOG_PACKAGER_TOPIC_FILTER_SIZE);
+	c->codec = codec;
+	c->tolerance = tolerance;
+	self->codecs_used++;
+	return PLOG_PACKAGER_RET_OK;
+}
+
+
+plog_packager_ret_t plog_packager_set_auto_codec(PlogPackager *self, bool auto_codec) {
+	self->auto_codec = auto_codec;
+	return PLOG_PACKAGER_RET_OK;
+}
+
+
+plog_packager_ret_t plog_packager_set_file_buffer(PlogPackager *self, size_t buffer_size, uint32_t flush_interval_ms) {
+	if (self->running) {
+		return PLOG_PACKAGER_RET_FAILED;
+	}
+	self->wbuf_size = buffer_size;
+	self->flush_interval_ms = flush_interval_ms;
+	return PLOG_PACKAGER_RET_OK;
+}
+
+
+plog_packager_ret_t plog_packager_flush(PlogPackager *self) {
+	if (self->dst_fs == NULL) {
+		return PLOG_PACKAGER_RET_OK;
+	}
+	return file_flush(self);
+}
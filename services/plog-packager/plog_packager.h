@@ -20,13 +20,23 @@
 #include <types/ndarray.h>
 #include <interfaces/fs.h>
 #include "heatshrink_encoder.h"
+#include "chacha20.h"
+#include "poly1305.h"
+#include "pkg_codec.h"
 
 
 #define PLOG_PACKAGER_NONCE_SIZE 16
 #define PLOG_PACKAGER_MAX_KEY_SIZE 32
 #define PLOG_PACKAGER_TOPIC_FILTER_SIZE 32
-#define PLOG_PACKAGER_HEADER_SIZE 64
+#define PLOG_PACKAGER_HEADER_SIZE 96
+#define PLOG_PACKAGER_SEAL_KEY_SIZE 32
+#define PLOG_PACKAGER_SEAL_NONCE_SIZE 8
+#define PLOG_PACKAGER_SEAL_NONCE_PREFIX_SIZE 4
+#define PLOG_PACKAGER_SEAL_MAC_SIZE 16
 #define PLOG_PACKAGER_PATH_MAX 32
+#define PLOG_PACKAGER_MAX_CODECS 4
+#define PLOG_PACKAGER_MAX_TOPICS 16
+#define PLOG_PACKAGER_RX_TIMEOUT_MS 1000
 
 /* Randomly generated header allows us to find the package in arbitrary data. */
 #define PLOG_PACKAGER_PACKAGE_MAGIC ((uint8_t[]){'P', 'K', 'G'})
@@ -40,6 +50,15 @@ typedef enum {
 } plog_packager_ret_t;
 
 
+/* Numeric codec applied to messages matching the topic filter before the
+ * data is compressed. */
+struct plog_packager_codec {
+	char topic_filter[PLOG_PACKAGER_TOPIC_FILTER_SIZE];
+	enum pkg_codec codec;
+	float tolerance;
+};
+
+
 struct plog_packager;
 struct plog_packager_package {
 
@@ -55,9 +74,29 @@ struct plog_packager_package {
 	size_t header_size;
 	size_t header_used;
 
-	uint16_t index;
+	uint32_t index;
 	uint32_t message_count;
 	volatile bool finished;
+
+	/* Per-package topic dictionary. Messages reference topics by their index.
+	 * Topics not fitting in the dictionary are stored in the message. */
+	char topics[PLOG_PACKAGER_MAX_TOPICS][PLOG_PACKAGER_TOPIC_FILTER_SIZE];
+	size_t topics_used;
+
+	/* Time of the first message in the package and of the last one added.
+	 * Message time is encoded relative to the previous message. */
+	struct timespec base_time;
+	struct timespec last_time;
+
+	/* Sealing state. Compressed data is encrypted and authenticated as soon
+	 * as it leaves the compressor. */
+	uint8_t nonce[PLOG_PACKAGER_SEAL_NONCE_SIZE];
+	chacha20_context seal_cipher;
+	poly1305_context seal_mac;
+	uint8_t seal_keystream[64];
+	uint8_t seal_keystream_used;
+	uint32_t seal_counter;
+	size_t seal_data_len;
 };
 
 
@@ -79,15 +118,42 @@ typedef struct plog_packager {
 	Fs *dst_fs;
 	char dst_path[PLOG_PACKAGER_PATH_MAX];
 
+	/* The destination file is kept open and finished packages are coalesced
+	 * in the write buffer. The buffer is written when it reaches the next
+	 * file position aligned to its size, after the flush interval elapses
+	 * or on an explicit flush. No buffer = write every package. */
+	SemaphoreHandle_t file_lock;
+	File dst_file;
+	bool dst_file_open;
+	size_t dst_file_pos;
+	uint8_t *wbuf;
+	size_t wbuf_size;
+	size_t wbuf_used;
+	uint32_t flush_interval_ms;
+	TickType_t last_flush;
+
 	uint8_t nonce[PLOG_PACKAGER_NONCE_SIZE];
 	size_t nonce_size;
+	/* The nonce prefix was used by a previous start. The package index
+	 * restarts from 0, sealing again would repeat the nonces. */
+	bool nonce_used;
+	/* ChaCha20-Poly1305 key derived from the key set by plog_packager_set_key */
+	bool seal;
+	uint8_t seal_key[PLOG_PACKAGER_SEAL_KEY_SIZE];
 	uint32_t package_counter;
 	struct plog_packager_package package;
 
 	heatshrink_encoder *hs_encoder;
 	uint32_t hs_window_size;
 	uint32_t hs_lookahead_size;
-	
+
+	struct plog_packager_codec codecs[PLOG_PACKAGER_MAX_CODECS];
+	size_t codecs_used;
+	bool auto_codec;
+	/* Scratch buffer for the encoded message data */
+	uint8_t *codec_buf;
+	size_t codec_buf_size;
+
 	NdArray rxbuf;
 
 } PlogPackager;
@@ -98,8 +164,71 @@ plog_packager_ret_t plog_packager_free(PlogPackager *self);
 plog_packager_ret_t plog_packager_start(PlogPackager *self, size_t msg_size, size_t package_size);
 plog_packager_ret_t plog_packager_stop(PlogPackager *self);
 plog_packager_ret_t plog_packager_add_filter(PlogPackager *self, const char *topic_filter);
+
+/**
+ * @brief Set the session nonce prefix used for package sealing
+ *
+ * The first PLOG_PACKAGER_SEAL_NONCE_PREFIX_SIZE bytes are combined with the
+ * package index to form a unique nonce for every package. The prefix must
+ * never repeat for the same key. The package index restarts on every start,
+ * use a persistent boot counter (see plog_packager_load_key). The RTC time
+ * is not suitable, it may be reset or repeat within a second.
+ *
+ * A new prefix must be set before every plog_packager_start if sealing
+ * is enabled, the packager refuses to start with a used one.
+ */
 plog_packager_ret_t plog_packager_set_nonce(PlogPackager *self, const uint8_t *nonce, size_t len);
+
+/**
+ * @brief Set the key used to seal packages
+ *
+ * Packages are sealed with ChaCha20-Poly1305 using a key derived from @p key
+ * using BLAKE2s-256. Packages are not sealed if no key is set.
+ */
 plog_packager_ret_t plog_packager_set_key(PlogPackager *self, const uint8_t *key, size_t len);
+
+/**
+ * @brief Load the sealing key and a unique nonce prefix from a filesystem
+ *
+ * The key is read from @p key_path. The boot counter in @p counter_path is
+ * incremented and written back before it is used as the nonce prefix. If
+ * any of the steps fails, no key is set and packages are not sealed.
+ */
+plog_packager_ret_t plog_packager_load_key(PlogPackager *self, Fs *fs, const char *key_path, const char *counter_path);
 plog_packager_ret_t plog_packager_add_dst_mq(PlogPackager *self, const char *dst_topic);
 plog_packager_ret_t plog_packager_add_dst_file(PlogPackager *self, Fs *fs, const char *path);
 
+/**
+ * @brief Configure coalescing of the file writes
+ *
+ * Must be called before plog_packager_start. Defaults are set from the
+ * Kconfig configuration.
+ *
+ * @param buffer_size Size of the write buffer. Should be a multiple of the
+ *                    flash page size. Set to 0 to write every package
+ *                    immediately.
+ * @param flush_interval_ms Maximum time the data is kept in the buffer.
+ */
+plog_packager_ret_t plog_packager_set_file_buffer(PlogPackager *self, size_t buffer_size, uint32_t flush_interval_ms);
+
+/**
+ * @brief Write all buffered data to the destination file and flush it
+ */
+plog_packager_ret_t plog_packager_flush(PlogPackager *self);
+
+/**
+ * @brief Use a numeric codec for messages matching the topic filter
+ *
+ * Filters are matched in the order they were added. Messages with a dtype
+ * not supported by the codec are stored without any transformation.
+ *
+ * @param tolerance Absolute error bound for lossy codecs (PKG_CODEC_ZFP)
+ */
+plog_packager_ret_t plog_packager_add_codec(PlogPackager *self, const char *topic_filter, enum pkg_codec codec, float tolerance);
+
+/**
+ * @brief Enable/disable automatic lossless codec selection for messages
+ *        not matching any codec topic filter (enabled by default)
+ */
+plog_packager_ret_t plog_packager_set_auto_codec(PlogPackager *self, bool auto_codec);
+
@@ -0,0 +1,1074 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * plog message packager tests
+ *
+ * Copyright (c) 2021, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "config.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+#include "u_assert.h"
+#include "u_log.h"
+#include "u_test.h"
+
+#include <interfaces/mq.h>
+#include <interfaces/fs.h>
+#include <types/ndarray.h>
+#include "heatshrink_decoder.h"
+#include "blake2.h"
+#include "chacha20.h"
+#include "poly1305.h"
+
+#include "plog_packager.h"
+#include "pkg_codec.h"
+#include "pkg.pb.h"
+#include "plog_packager_tests.h"
+
+#ifdef MODULE_NAME
+#undef MODULE_NAME
+#endif
+#define MODULE_NAME "plog-packager-tests"
+
+
+/**
+ * The packager receives messages from a Mq stand-in. Published packages are
+ * decoded immediately in the publish call. Message number i of a test run
+ * has its topic, time, dtype and data generated from i, decoded messages
+ * are compared with the generated ones.
+ */
+#define PACKAGER_TEST_MSG_SIZE 256
+#define PACKAGER_TEST_QUEUE_LEN 4
+#define PACKAGER_TEST_RAW_SIZE 4096
+#define PACKAGER_TEST_HSD_BUFFER_SIZE 64
+#define PACKAGER_TEST_BASE_TIME 1600000000
+#define PACKAGER_TEST_TIMEOUT_MS 10000
+#define PACKAGER_TEST_PKG_SIZE (3072 + PLOG_PACKAGER_HEADER_SIZE)
+#define PACKAGER_TEST_MAX_NONCES 64
+#define PACKAGER_TEST_KEY "plog-packager test key"
+#define PACKAGER_TEST_FILE_SIZE 32768
+#define PACKAGER_TEST_FILE_BUFFER_SIZE 512
+
+struct packager_test_msg {
+	char topic[PLOG_PACKAGER_TOPIC_FILTER_SIZE];
+	struct timespec ts;
+	enum dtype dtype;
+	size_t asize;
+	uint8_t data[PACKAGER_TEST_MSG_SIZE];
+};
+
+struct packager_test {
+	Mq mq;
+	MqClient client;
+	QueueHandle_t rx;
+	uint32_t timeout_ms;
+	PlogPackager packager;
+
+	/* Test run parameters */
+	size_t topics;
+	size_t msg_values;
+
+	/* Decoder state */
+	uint32_t next_msg;
+	uint32_t next_index;
+	uint32_t packages;
+	uint32_t errors;
+	size_t package_bytes;
+	size_t raw_bytes;
+	char dict[PLOG_PACKAGER_MAX_TOPICS][PLOG_PACKAGER_TOPIC_FILTER_SIZE];
+	size_t dict_used;
+	uint32_t inline_topics;
+	uint8_t raw[PACKAGER_TEST_RAW_SIZE];
+	struct packager_test_msg msg;
+	struct packager_test_msg expected;
+
+	/* Sealing key used to authenticate packages and nonces used so far. */
+	bool seal;
+	uint8_t seal_key[PLOG_PACKAGER_SEAL_KEY_SIZE];
+	uint32_t session;
+	uint8_t nonce_prefix[PLOG_PACKAGER_SEAL_NONCE_PREFIX_SIZE];
+	uint8_t nonces[PACKAGER_TEST_MAX_NONCES][PLOG_PACKAGER_SEAL_NONCE_SIZE];
+	size_t nonces_used;
+
+	/* The last published package and a copy used for decoding */
+	uint8_t pkg[PACKAGER_TEST_PKG_SIZE];
+	uint8_t work[PACKAGER_TEST_PKG_SIZE];
+	size_t pkg_len;
+
+	/* Messages passed through the queue are copied here. */
+	struct packager_test_msg tx_msg;
+	struct packager_test_msg rx_msg;
+
+	/* All published packages concatenated, the file must contain the same. */
+	uint8_t stream[PACKAGER_TEST_FILE_SIZE];
+	size_t stream_len;
+
+	/* In-memory file written by the packager and its access statistics. */
+	Fs fs;
+	uint8_t file[PACKAGER_TEST_FILE_SIZE];
+	size_t file_len;
+	uint32_t file_opens;
+	uint32_t file_writes;
+	uint32_t file_unaligned;
+	uint32_t file_flushes;
+};
+
+/* Allocated only when the tests are running. */
+static struct packager_test *packager_test;
+
+
+static void make_message(struct packager_test *self, uint32_t i, struct packager_test_msg *msg) {
+	memset(msg, 0, sizeof(struct packager_test_msg));
+	snprintf(msg->topic, sizeof(msg->topic), "channel/%u/value", (unsigned int)(i % self->topics));
+
+	/* Some messages go back in time, the time delta is signed. */
+	msg->ts.tv_sec = PACKAGER_TEST_BASE_TIME + i / 4 - ((i % 5 == 4) ? 3 : 0);
+	msg->ts.tv_nsec = (i % 4) * 250000000 + (i % 3) * 1000;
+
+	const enum dtype dtypes[] = {DTYPE_INT16, DTYPE_FLOAT, DTYPE_UINT8};
+	msg->dtype = dtypes[i % 3];
+	msg->asize = self->msg_values + (i * 7) % 24;
+	int16_t v = i * 100;
+	for (size_t j = 0; j < msg->asize; j++) {
+		v += (int16_t)((i + j) % 5) - 2;
+		switch (msg->dtype) {
+			case DTYPE_INT16: ((int16_t *)msg->data)[j] = v; break;
+			case DTYPE_FLOAT: ((float *)msg->data)[j] = v / 16.0f; break;
+			default: msg->data[j] = (uint8_t)v; break;
+		}
+	}
+}
+
+
+/* Protobuf wire format reader. Length delimited fields are returned as
+ * another reader spanning the field data. */
+struct pb_reader {
+	const uint8_t *buf;
+	size_t len;
+};
+
+static bool reader_varint(struct pb_reader *r, uint64_t *v) {
+	*v = 0;
+	for (uint8_t shift = 0; shift < 64; shift += 7) {
+		if (r->len == 0) {
+			return false;
+		}
+		uint8_t b = *r->buf++;
+		r->len--;
+		*v |= (uint64_t)(b & 0x7f) << shift;
+		if ((b & 0x80) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+
+static bool reader_field(struct pb_reader *r, uint32_t *tag, uint64_t *v, struct pb_reader *sub) {
+	uint64_t key = 0;
+	if (!reader_varint(r, &key)) {
+		return false;
+	}
+	*tag = key >> 3;
+	switch (key & 0x07) {
+		case PB_WT_VARINT:
+			return reader_varint(r, v);
+		case PB_WT_STRING:
+			if (!reader_varint(r, v) || *v > r->len) {
+				return false;
+			}
+			sub->buf = r->buf;
+			sub->len = *v;
+			r->buf += *v;
+			r->len -= *v;
+			return true;
+		case PB_WT_32BIT:
+			if (r->len < 4) {
+				return false;
+			}
+			*v = r->buf[0] | (r->buf[1] << 8) | (r->buf[2] << 16) | ((uint32_t)r->buf[3] << 24);
+			r->buf += 4;
+			r->len -= 4;
+			return true;
+		default:
+			return false;
+	}
+}
+
+
+static bool decompress_poll(heatshrink_decoder *hsd, uint8_t *out, size_t out_size, size_t *out_len) {
+	HSD_poll_res pres = 0;
+	do {
+		size_t n = 0;
+		if (*out_len >= out_size) {
+			return false;
+		}
+		pres = heatshrink_decoder_poll(hsd, out + *out_len, out_size - *out_len, &n);
+		if (pres < 0) {
+			return false;
+		}
+		*out_len += n;
+	} while (pres == HSDR_POLL_MORE);
+	return true;
+}
+
+
+static bool decompress(const uint8_t *in, size_t in_len, uint32_t window, uint32_t lookahead, uint8_t *out, size_t out_size, size_t *out_len) {
+	heatshrink_decoder *hsd = heatshrink_decoder_alloc(PACKAGER_TEST_HSD_BUFFER_SIZE, window, lookahead);
+	if (hsd == NULL) {
+		return false;
+	}
+	bool ret = true;
+	*out_len = 0;
+	while (ret && in_len > 0) {
+		size_t sunk = 0;
+		if (heatshrink_decoder_sink(hsd, (uint8_t *)in, in_len, &sunk) < 0) {
+			ret = false;
+		}
+		in += sunk;
+		in_len -= sunk;
+		ret = ret && decompress_poll(hsd, out, out_size, out_len);
+	}
+	while (ret && heatshrink_decoder_finish(hsd) == HSDR_FINISH_MORE) {
+		ret = decompress_poll(hsd, out, out_size, out_len);
+	}
+	heatshrink_decoder_free(hsd);
+	return ret;
+}
+
+
+static bool parse_time(struct pb_reader *r, struct timespec *ts) {
+	uint32_t tag = 0;
+	uint64_t v = 0;
+	struct pb_reader sub;
+	ts->tv_sec = 0;
+	ts->tv_nsec = 0;
+	while (r->len > 0) {
+		if (!reader_field(r, &tag, &v, &sub)) {
+			return false;
+		}
+		if (tag == Time_s_tag) {
+			ts->tv_sec = v;
+		} else if (tag == Time_us_tag) {
+			ts->tv_nsec = v * 1000;
+		}
+	}
+	return true;
+}
+
+
+static bool parse_topic_def(struct packager_test *self, struct pb_reader *r) {
+	uint32_t tag = 0;
+	uint64_t v = 0;
+	uint64_t id = UINT64_MAX;
+	struct pb_reader sub, topic = {0};
+	while (r->len > 0) {
+		if (!reader_field(r, &tag, &v, &sub)) {
+			return false;
+		}
+		if (tag == TopicDef_id_tag) {
+			id = v;
+		} else if (tag == TopicDef_topic_tag) {
+			topic = sub;
+		}
+	}
+	/* Topics are numbered in the order they are defined. */
+	if (id != self->dict_used || topic.len == 0 || topic.len >= PLOG_PACKAGER_TOPIC_FILTER_SIZE) {
+		return false;
+	}
+	memcpy(self->dict[id], topic.buf, topic.len);
+	self->dict[id][topic.len] = '\0';
+	/* The same topic must not be defined twice in a package. */
+	for (size_t i = 0; i < self->dict_used; i++) {
+		if (!strcmp(self->dict[i], self->dict[id])) {
+			return false;
+		}
+	}
+	self->dict_used++;
+	return true;
+}
+
+
+static bool parse_msg(struct packager_test *self, struct pb_reader *r, struct timespec *time) {
+	struct packager_test_msg *msg = &self->msg;
+	uint32_t tag = 0;
+	uint64_t v = 0;
+	struct pb_reader sub, buf = {0};
+	enum pkg_codec codec = PKG_CODEC_NONE;
+	uint64_t count = 0;
+	int64_t delta_us = 0;
+	bool has_topic = false;
+
+	memset(msg, 0, sizeof(struct packager_test_msg));
+	while (r->len > 0) {
+		if (!reader_field(r, &tag, &v, &sub)) {
+			return false;
+		}
+		switch (tag) {
+			case Msg_type_tag:
+				msg->dtype = v;
+				break;
+			case Msg_buf_tag:
+				buf = sub;
+				break;
+			case Msg_topic_tag:
+				if (sub.len >= sizeof(msg->topic)) {
+					return false;
+				}
+				memcpy(msg->topic, sub.buf, sub.len);
+				has_topic = true;
+				self->inline_topics++;
+				/* Inline topics are used only if the dictionary is full. */
+				if (self->dict_used < PLOG_PACKAGER_MAX_TOPICS) {
+					return false;
+				}
+				break;
+			case Msg_topic_id_tag:
+				if (v >= self->dict_used) {
+					return false;
+				}
+				strlcpy(msg->topic, self->dict[v], sizeof(msg->topic));
+				has_topic = true;
+				break;
+			case Msg_codec_tag:
+				codec = v;
+				break;
+			case Msg_count_tag:
+				count = v;
+				break;
+			case Msg_time_delta_us_tag:
+				/* zigzag encoded sint64 */
+				delta_us = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+				break;
+			default:
+				break;
+		}
+	}
+	if (!has_topic) {
+		return false;
+	}
+
+	int64_t ns = (int64_t)time->tv_nsec + delta_us * 1000;
+	time->tv_sec += ns / 1000000000;
+	ns %= 1000000000;
+	if (ns < 0) {
+		time->tv_sec--;
+		ns += 1000000000;
+	}
+	time->tv_nsec = ns;
+	msg->ts = *time;
+
+	size_t dsize = ndarray_get_dsize(msg->dtype);
+	if (dsize == 0) {
+		return false;
+	}
+	if (codec == PKG_CODEC_NONE) {
+		count = buf.len / dsize;
+	}
+	NdArray a;
+	if (ndarray_init_view(&a, msg->dtype, 0, msg->data, sizeof(msg->data)) != NDARRAY_RET_OK ||
+	    pkg_codec_decode(codec, 0.0f, buf.buf, buf.len, &a, count) != PKG_CODEC_RET_OK) {
+		return false;
+	}
+	msg->asize = count;
+	self->raw_bytes += count * dsize;
+
+	return true;
+}
+
+
+static bool messages_equal(const struct packager_test_msg *a, const struct packager_test_msg *b) {
+	return !strcmp(a->topic, b->topic) &&
+		a->ts.tv_sec == b->ts.tv_sec &&
+		a->ts.tv_nsec == b->ts.tv_nsec &&
+		a->dtype == b->dtype &&
+		a->asize == b->asize &&
+		!memcmp(a->data, b->data, a->asize * ndarray_get_dsize(a->dtype));
+}
+
+
+static bool parse_raw_data(struct packager_test *self, struct pb_reader *r, struct timespec *base_time, uint32_t msg_count) {
+	uint32_t tag = 0;
+	uint64_t v = 0;
+	struct pb_reader sub;
+	struct timespec time = *base_time;
+	uint32_t count = 0;
+
+	self->dict_used = 0;
+	while (r->len > 0) {
+		if (!reader_field(r, &tag, &v, &sub)) {
+			return false;
+		}
+		if (tag == RawData_topic_tag) {
+			if (!parse_topic_def(self, &sub)) {
+				return false;
+			}
+		} else if (tag == RawData_msg_tag) {
+			if (!parse_msg(self, &sub, &time)) {
+				return false;
+			}
+			make_message(self, self->next_msg, &self->expected);
+			if (!messages_equal(&self->msg, &self->expected)) {
+				u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("message %u differs"), self->next_msg);
+				return false;
+			}
+			self->next_msg++;
+			count++;
+		}
+	}
+	return count == msg_count;
+}
+
+
+/* Package fields needed to authenticate and decode it. */
+struct package_view {
+	struct pb_reader mac;
+	struct pb_reader data;
+	struct pb_reader nonce;
+	struct pb_reader msg;
+	struct timespec base_time;
+	uint64_t index;
+	uint64_t msg_count;
+	uint64_t window;
+	uint64_t lookahead;
+};
+
+static bool read_package(const uint8_t *buf, size_t len, struct package_view *v) {
+	uint32_t tag = 0;
+	uint64_t val = 0;
+	struct pb_reader sub, hs = {0};
+
+	memset(v, 0, sizeof(struct package_view));
+	v->index = UINT64_MAX;
+	if (len < PLOG_PACKAGER_PACKAGE_MAGIC_SIZE || memcmp(buf, PLOG_PACKAGER_PACKAGE_MAGIC, PLOG_PACKAGER_PACKAGE_MAGIC_SIZE)) {
+		return false;
+	}
+	struct pb_reader r = {buf + PLOG_PACKAGER_PACKAGE_MAGIC_SIZE, len - PLOG_PACKAGER_PACKAGE_MAGIC_SIZE};
+	while (r.len > 0) {
+		if (!reader_field(&r, &tag, &val, &sub)) {
+			return false;
+		}
+		if (tag == Package_mac_tag) {
+			v->mac = sub;
+		} else if (tag == Package_data_tag) {
+			v->data = sub;
+		}
+	}
+
+	r = v->data;
+	while (r.len > 0) {
+		if (!reader_field(&r, &tag, &val, &sub)) {
+			return false;
+		}
+		switch (tag) {
+			case PackageData_pkg_index_tag:
+				v->index = val;
+				break;
+			case PackageData_msg_count_tag:
+				v->msg_count = val;
+				break;
+			case PackageData_nonce_tag:
+				v->nonce = sub;
+				break;
+			case PackageData_base_time_tag:
+				if (!parse_time(&sub, &v->base_time)) {
+					return false;
+				}
+				break;
+			case PackageData_heatshrink_tag:
+				hs = sub;
+				break;
+			default:
+				break;
+		}
+	}
+	while (hs.len > 0) {
+		if (!reader_field(&hs, &tag, &val, &sub)) {
+			return false;
+		}
+		if (tag == HeatshrinkData_window_size_tag) {
+			v->window = val;
+		} else if (tag == HeatshrinkData_lookahead_size_tag) {
+			v->lookahead = val;
+		} else if (tag == HeatshrinkData_msg_tag) {
+			v->msg = sub;
+		}
+	}
+	return v->msg.buf != NULL;
+}
+
+
+static void mac_pad16(poly1305_context *mac, size_t len) {
+	const uint8_t zero[16] = {0};
+	if (len % 16) {
+		poly1305_update(mac, zero, 16 - (len % 16));
+	}
+}
+
+
+static void mac_le64(poly1305_context *mac, uint64_t v) {
+	uint8_t b[8];
+	for (size_t i = 0; i < sizeof(b); i++) {
+		b[i] = (v >> (i * 8)) & 0xff;
+	}
+	poly1305_update(mac, b, sizeof(b));
+}
+
+
+/* Check the Poly1305 tag as described in pkg.proto. The ciphertext is the
+ * last field, the additional data is the part of PackageData in front of it. */
+static bool package_authentic(struct packager_test *self, const struct package_view *v) {
+	if (v->mac.len != PLOG_PACKAGER_SEAL_MAC_SIZE || v->nonce.len != PLOG_PACKAGER_SEAL_NONCE_SIZE ||
+	    v->msg.buf + v->msg.len != v->data.buf + v->data.len) {
+		return false;
+	}
+	const uint8_t *ad = v->data.buf;
+	size_t ad_len = v->msg.buf - v->data.buf;
+
+	chacha20_context cipher;
+	poly1305_context mac;
+	uint8_t block[64];
+	uint8_t tag[PLOG_PACKAGER_SEAL_MAC_SIZE];
+	chacha20_keysetup(&cipher, self->seal_key, 256);
+	chacha20_nonce(&cipher, v->nonce.buf);
+	chacha20_counter(&cipher, 0);
+	chacha20_keystream(&cipher, block);
+	poly1305_init(&mac, block);
+	poly1305_update(&mac, v->msg.buf, v->msg.len);
+	mac_pad16(&mac, v->msg.len);
+	poly1305_update(&mac, ad, ad_len);
+	mac_pad16(&mac, ad_len);
+	mac_le64(&mac, v->msg.len);
+	mac_le64(&mac, ad_len);
+	poly1305_finish(&mac, tag);
+
+	return !memcmp(tag, v->mac.buf, sizeof(tag));
+}
+
+
+/* Decrypt the ciphertext in place. Keystream blocks start at counter 1. */
+static void package_decrypt(struct packager_test *self, const struct package_view *v) {
+	chacha20_context cipher;
+	uint8_t block[64];
+	uint8_t *buf = (uint8_t *)v->msg.buf;
+	chacha20_keysetup(&cipher, self->seal_key, 256);
+	chacha20_nonce(&cipher, v->nonce.buf);
+	for (size_t i = 0; i < v->msg.len; i++) {
+		if ((i % sizeof(block)) == 0) {
+			chacha20_counter(&cipher, 1 + i / sizeof(block));
+			chacha20_keystream(&cipher, block);
+		}
+		buf[i] ^= block[i % sizeof(block)];
+	}
+}
+
+
+/* Nonces must never repeat for the same key, not even after a restart. */
+static bool nonce_unique(struct packager_test *self, const struct package_view *v) {
+	uint8_t expected[PLOG_PACKAGER_SEAL_NONCE_SIZE] = {0};
+	memcpy(expected, self->nonce_prefix, PLOG_PACKAGER_SEAL_NONCE_PREFIX_SIZE);
+	for (size_t i = 0; i < 4; i++) {
+		expected[PLOG_PACKAGER_SEAL_NONCE_PREFIX_SIZE + i] = (v->index >> (i * 8)) & 0xff;
+	}
+	if (memcmp(v->nonce.buf, expected, sizeof(expected))) {
+		return false;
+	}
+	for (size_t i = 0; i < self->nonces_used; i++) {
+		if (!memcmp(self->nonces[i], expected, sizeof(expected))) {
+			return false;
+		}
+	}
+	if (self->nonces_used < PACKAGER_TEST_MAX_NONCES) {
+		memcpy(self->nonces[self->nonces_used], expected, sizeof(expected));
+		self->nonces_used++;
+	}
+	return true;
+}
+
+
+static bool parse_package(struct packager_test *self, uint8_t *buf, size_t len) {
+	struct package_view v;
+	if (!read_package(buf, len, &v)) {
+		return false;
+	}
+
+	if (self->seal) {
+		if (!package_authentic(self, &v) || !nonce_unique(self, &v)) {
+			return false;
+		}
+		package_decrypt(self, &v);
+	} else if (v.mac.len > 0 || v.nonce.len > 0) {
+		return false;
+	}
+
+	/* Packages are numbered consecutively. */
+	if (v.index != self->next_index) {
+		return false;
+	}
+	self->next_index++;
+
+	struct pb_reader raw = {self->raw, 0};
+	if (!decompress(v.msg.buf, v.msg.len, v.window, v.lookahead, self->raw, sizeof(self->raw), &raw.len)) {
+		return false;
+	}
+	return parse_raw_data(self, &raw, &v.base_time, v.msg_count);
+}
+
+
+/* Mq stand-in. The packager is the only client. */
+static mq_ret_t test_mq_subscribe(MqClient *self, const char *filter) {
+	(void)self;
+	(void)filter;
+	return MQ_RET_OK;
+}
+
+
+static mq_ret_t test_mq_unsubscribe(MqClient *self, const char *filter) {
+	(void)self;
+	(void)filter;
+	return MQ_RET_OK;
+}
+
+
+static mq_ret_t test_mq_receive(MqClient *client, char *topic, size_t topic_size, struct ndarray *array, struct timespec *ts) {
+	struct packager_test *self = (struct packager_test *)client->parent->parent;
+	struct packager_test_msg *msg = &self->rx_msg;
+
+	if (xQueueReceive(self->rx, msg, pdMS_TO_TICKS(self->timeout_ms)) != pdTRUE) {
+		return MQ_RET_TIMEOUT;
+	}
+	size_t dsize = ndarray_get_dsize(msg->dtype);
+	if (msg->asize * dsize > array->bufsize) {
+		return MQ_RET_FAILED;
+	}
+	strlcpy(topic, msg->topic, topic_size);
+	*ts = msg->ts;
+	array->dtype = msg->dtype;
+	array->dsize = dsize;
+	array->asize = msg->asize;
+	memcpy(array->buf, msg->data, msg->asize * dsize);
+	return MQ_RET_OK;
+}
+
+
+static mq_ret_t test_mq_publish(MqClient *client, const char *topic, const struct ndarray *array, const struct timespec *ts) {
+	struct packager_test *self = (struct packager_test *)client->parent->parent;
+	(void)topic;
+	(void)ts;
+
+	self->packages++;
+	self->package_bytes += array->asize;
+	if (array->asize > sizeof(self->pkg)) {
+		self->errors++;
+		return MQ_RET_OK;
+	}
+	/* Keep the original package, it is decrypted during parsing. */
+	memcpy(self->pkg, array->buf, array->asize);
+	memcpy(self->work, array->buf, array->asize);
+	if (self->stream_len + array->asize <= sizeof(self->stream)) {
+		memcpy(self->stream + self->stream_len, array->buf, array->asize);
+		self->stream_len += array->asize;
+	}
+	self->pkg_len = array->asize;
+	if (!parse_package(self, self->work, self->pkg_len)) {
+		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("package %u cannot be decoded"), self->packages - 1);
+		self->errors++;
+	}
+	return MQ_RET_OK;
+}
+
+
+static mq_ret_t test_mq_close(MqClient *self) {
+	(void)self;
+	return MQ_RET_OK;
+}
+
+
+static mq_ret_t test_mq_set_timeout(MqClient *client, uint32_t timeout_ms) {
+	struct packager_test *self = (struct packager_test *)client->parent->parent;
+	self->timeout_ms = timeout_ms;
+	return MQ_RET_OK;
+}
+
+
+static struct mq_client_vmt test_mq_client_vmt = {
+	.subscribe = test_mq_subscribe,
+	.unsubscribe = test_mq_unsubscribe,
+	.receive = test_mq_receive,
+	.publish = test_mq_publish,
+	.close = test_mq_close,
+	.set_timeout = test_mq_set_timeout,
+};
+
+
+static MqClient *test_mq_open(Mq *mq) {
+	struct packager_test *self = (struct packager_test *)mq->parent;
+	return &self->client;
+}
+
+
+static const struct mq_vmt test_mq_vmt = {
+	.open = test_mq_open,
+};
+
+
+/* Fs stand-in with a single file kept in memory. Opening, writing and
+ * flushing is counted. A write ending at an unaligned position which is
+ * not the last one is counted as unaligned. */
+static fs_ret_t test_fs_open(Fs *fs, File *f, const char *path, enum fs_mode mode) {
+	struct packager_test *self = (struct packager_test *)fs->parent;
+	(void)path;
+	(void)mode;
+	f->ptr = self;
+	self->file_opens++;
+	return FS_RET_OK;
+}
+
+
+static fs_ret_t test_fs_write(Fs *fs, File *f, const void *buf, size_t len, size_t *written) {
+	struct packager_test *self = (struct packager_test *)fs->parent;
+	(void)f;
+	if (self->file_len + len > sizeof(self->file)) {
+		return FS_RET_FAILED;
+	}
+	/* The previous write was not the last one, check its alignment. */
+	if (self->file_writes > 0 && (self->file_len % PACKAGER_TEST_FILE_BUFFER_SIZE) != 0) {
+		self->file_unaligned++;
+	}
+	memcpy(self->file + self->file_len, buf, len);
+	self->file_len += len;
+	self->file_writes++;
+	*written = len;
+	return FS_RET_OK;
+}
+
+
+static fs_ret_t test_fs_fstat(Fs *fs, File *f, struct fs_stat *st) {
+	struct packager_test *self = (struct packager_test *)fs->parent;
+	(void)f;
+	st->size = self->file_len;
+	return FS_RET_OK;
+}
+
+
+static fs_ret_t test_fs_fflush(Fs *fs, File *f) {
+	struct packager_test *self = (struct packager_test *)fs->parent;
+	(void)f;
+	self->file_flushes++;
+	return FS_RET_OK;
+}
+
+
+static fs_ret_t test_fs_close(Fs *fs, File *f) {
+	(void)fs;
+	f->ptr = NULL;
+	return FS_RET_OK;
+}
+
+
+static const struct fs_vmt test_fs_vmt = {
+	.open = test_fs_open,
+	.write = test_fs_write,
+	.fstat = test_fs_fstat,
+	.fflush = test_fs_fflush,
+	.close = test_fs_close,
+};
+
+
+/* The file already contains @p len bytes of other data. */
+static void test_file_reset(struct packager_test *self, size_t len) {
+	memset(self->file, 0xaa, len);
+	self->file_len = len;
+	self->file_opens = 0;
+	self->file_writes = 0;
+	self->file_unaligned = 0;
+	self->file_flushes = 0;
+}
+
+
+static struct packager_test *packager_test_alloc(void) {
+	struct packager_test *self = calloc(1, sizeof(struct packager_test));
+	if (self == NULL) {
+		return NULL;
+	}
+	self->rx = xQueueCreate(PACKAGER_TEST_QUEUE_LEN, sizeof(struct packager_test_msg));
+	if (self->rx == NULL) {
+		free(self);
+		return NULL;
+	}
+	self->mq.vmt = &test_mq_vmt;
+	self->mq.parent = self;
+	self->client.vmt = &test_mq_client_vmt;
+	self->client.parent = &self->mq;
+	self->fs.vmt = &test_fs_vmt;
+	self->fs.parent = self;
+	return self;
+}
+
+
+static void packager_test_free(struct packager_test *self) {
+	vQueueDelete(self->rx);
+	free(self);
+}
+
+
+/* Set a new nonce prefix. The package index restarts from 0. */
+static void packager_new_nonce(struct packager_test *self) {
+	self->session++;
+	for (size_t i = 0; i < sizeof(self->nonce_prefix); i++) {
+		self->nonce_prefix[i] = (self->session >> (i * 8)) & 0xff;
+	}
+	plog_packager_set_nonce(&self->packager, self->nonce_prefix, sizeof(self->nonce_prefix));
+	self->next_index = 0;
+}
+
+
+/* Packages are sealed with the test key if @p seal is set. */
+static void packager_setup(struct packager_test *self, size_t topics, size_t msg_values, bool seal) {
+	self->topics = topics;
+	self->msg_values = msg_values;
+	self->next_msg = 0;
+	self->next_index = 0;
+	self->packages = 0;
+	self->errors = 0;
+	self->package_bytes = 0;
+	self->raw_bytes = 0;
+	self->inline_topics = 0;
+	self->nonces_used = 0;
+	self->pkg_len = 0;
+	self->stream_len = 0;
+
+	plog_packager_init(&self->packager, &self->mq);
+	plog_packager_add_filter(&self->packager, "#");
+	plog_packager_add_dst_mq(&self->packager, "pkg");
+
+	self->seal = seal;
+	if (seal) {
+		plog_packager_set_key(&self->packager, (const uint8_t *)PACKAGER_TEST_KEY, strlen(PACKAGER_TEST_KEY));
+		blake2s(self->seal_key, sizeof(self->seal_key), PACKAGER_TEST_KEY, strlen(PACKAGER_TEST_KEY), NULL, 0);
+		packager_new_nonce(self);
+	}
+}
+
+
+static bool packager_start(struct packager_test *self, size_t package_size) {
+	xQueueReset(self->rx);
+	return plog_packager_start(&self->packager, PACKAGER_TEST_MSG_SIZE, package_size) == PLOG_PACKAGER_RET_OK;
+}
+
+
+static bool packager_send(struct packager_test *self, uint32_t from, uint32_t count) {
+	for (uint32_t i = from; i < from + count; i++) {
+		make_message(self, i, &self->tx_msg);
+		if (xQueueSend(self->rx, &self->tx_msg, pdMS_TO_TICKS(PACKAGER_TEST_TIMEOUT_MS)) != pdTRUE) {
+			return false;
+		}
+	}
+	/* The last message is being processed when the queue is empty. Stopping
+	 * the packager finishes and publishes it. */
+	while (uxQueueMessagesWaiting(self->rx) > 0) {
+		vTaskDelay(10);
+	}
+	return true;
+}
+
+
+static void packager_stop(struct packager_test *self) {
+	plog_packager_stop(&self->packager);
+	plog_packager_free(&self->packager);
+}
+
+
+/* All messages must be decoded exactly as they were published. */
+static bool packager_run(struct packager_test *self, size_t topics, size_t msg_values, size_t package_size, uint32_t count, bool seal) {
+	packager_setup(self, topics, msg_values, seal);
+	if (!packager_start(self, package_size)) {
+		plog_packager_free(&self->packager);
+		return false;
+	}
+	bool ret = packager_send(self, 0, count);
+	packager_stop(self);
+	return ret && self->errors == 0 && self->next_msg == count;
+}
+
+
+static bool plog_packager_test_messages_if_equal(void) {
+	struct packager_test *self = packager_test;
+	return packager_run(self, 3, 8, 3072, 20, false);
+}
+
+
+static bool plog_packager_test_split_if_equal(void) {
+	struct packager_test *self = packager_test;
+	/* Every package starts with an empty dictionary and a new base time. */
+	return packager_run(self, 5, 24, 1024, 200, false) && self->packages > 4;
+}
+
+
+static bool plog_packager_test_topics_if_inline(void) {
+	struct packager_test *self = packager_test;
+	/* Topics not fitting in the dictionary are stored in the message. */
+	return packager_run(self, PLOG_PACKAGER_MAX_TOPICS + 4, 1, 3072, 40, false) && self->inline_topics > 0;
+}
+
+
+static bool plog_packager_test_seal_if_ok(void) {
+	struct packager_test *self = packager_test;
+	return packager_run(self, 5, 24, 1024, 100, true) && self->packages > 2;
+}
+
+
+static bool plog_packager_test_seal_if_tampered(void) {
+	struct packager_test *self = packager_test;
+	struct package_view v;
+	if (!packager_run(self, 3, 8, 3072, 20, true) ||
+	    !read_package(self->pkg, self->pkg_len, &v) ||
+	    !package_authentic(self, &v)) {
+		return false;
+	}
+
+	/* Every single bit flip in the package must be detected. */
+	for (size_t i = 0; i < self->pkg_len; i++) {
+		memcpy(self->work, self->pkg, self->pkg_len);
+		self->work[i] ^= 1 << (i % 8);
+		if (read_package(self->work, self->pkg_len, &v) && package_authentic(self, &v)) {
+			u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("bit flip at %u not detected"), i);
+			return false;
+		}
+	}
+
+	/* A package sealed with a different key is refused. */
+	blake2s(self->seal_key, sizeof(self->seal_key), "wrong key", 9, NULL, 0);
+	return read_package(self->pkg, self->pkg_len, &v) && !package_authentic(self, &v);
+}
+
+
+static bool plog_packager_test_seal_if_restarted(void) {
+	struct packager_test *self = packager_test;
+	packager_setup(self, 3, 8, true);
+	bool ret = packager_start(self, 1024) && packager_send(self, 0, 60);
+	plog_packager_stop(&self->packager);
+
+	/* The package index starts from 0 again, the nonce prefix used by
+	 * the first run must be refused. */
+	ret = ret && !packager_start(self, 1024);
+
+	/* All nonces must be unique with a new prefix. */
+	packager_new_nonce(self);
+	ret = ret && packager_start(self, 1024) && packager_send(self, 60, 60);
+	packager_stop(self);
+
+	return ret && self->errors == 0 && self->next_msg == 120 && self->nonces_used > 2;
+}
+
+
+/* Packages are written to a file with some data already present. Writes must
+ * be aligned to the buffer size, the file contents must be the same as the
+ * published packages. The file is opened once and flushed on stop. */
+static bool plog_packager_test_file_if_aligned(void) {
+	struct packager_test *self = packager_test;
+	test_file_reset(self, 100);
+	packager_setup(self, 5, 24, false);
+	plog_packager_add_dst_file(&self->packager, &self->fs, "test.pkg");
+	plog_packager_set_file_buffer(&self->packager, PACKAGER_TEST_FILE_BUFFER_SIZE, 60000);
+
+	bool ret = packager_start(self, 1024) && packager_send(self, 0, 200);
+	packager_stop(self);
+
+	u_log(system_log, LOG_TYPE_DEBUG, U_LOG_MODULE_PREFIX("%u B in %u packages, %u writes, %u opens, %u unaligned, %u flushes"),
+		self->stream_len, self->packages, self->file_writes, self->file_opens, self->file_unaligned, self->file_flushes
+	);
+	return ret && self->errors == 0 && self->packages > 4 &&
+	       self->file_len == 100 + self->stream_len &&
+	       memcmp(self->file + 100, self->stream, self->stream_len) == 0 &&
+	       self->file_opens == 1 && self->file_unaligned == 0 && self->file_flushes > 0 &&
+	       self->file_writes <= self->stream_len / PACKAGER_TEST_FILE_BUFFER_SIZE + 2;
+}
+
+
+/* The buffered data must be written within the flush interval even if no
+ * new package arrives. Another start must continue in the same file. */
+static bool plog_packager_test_file_if_flushed(void) {
+	struct packager_test *self = packager_test;
+	test_file_reset(self, 0);
+	packager_setup(self, 3, 8, false);
+	plog_packager_add_dst_file(&self->packager, &self->fs, "test.pkg");
+	plog_packager_set_file_buffer(&self->packager, PACKAGER_TEST_FILE_BUFFER_SIZE, 100);
+
+	/* Small packages, the buffer is not filled by a single one. */
+	bool ret = packager_start(self, 256) && packager_send(self, 0, 20) && self->packages > 0;
+	vTaskDelay(pdMS_TO_TICKS(PLOG_PACKAGER_RX_TIMEOUT_MS * 2));
+	ret = ret && self->file_len == self->stream_len && memcmp(self->file, self->stream, self->stream_len) == 0;
+	plog_packager_stop(&self->packager);
+
+	/* Packages are numbered from 0 again. */
+	self->next_index = 0;
+	ret = ret && packager_start(self, 256) && packager_send(self, 20, 20);
+	packager_stop(self);
+
+	return ret && self->errors == 0 && self->next_msg == 40 &&
+	       self->file_len == self->stream_len && memcmp(self->file, self->stream, self->stream_len) == 0 &&
+	       self->file_opens == 2;
+}
+
+
+bool plog_packager_tests(void) {
+	packager_test = packager_test_alloc();
+	if (packager_test == NULL) {
+		return false;
+	}
+	bool res = true;
+
+	res &= u_test(plog_packager_test_messages_if_equal());
+	res &= u_test(plog_packager_test_split_if_equal());
+	res &= u_test(plog_packager_test_topics_if_inline());
+	res &= u_test(plog_packager_test_seal_if_ok());
+	res &= u_test(plog_packager_test_seal_if_tampered());
+	res &= u_test(plog_packager_test_seal_if_restarted());
+	res &= u_test(plog_packager_test_file_if_aligned());
+	res &= u_test(plog_packager_test_file_if_flushed());
+
+	packager_test_free(packager_test);
+	packager_test = NULL;
+
+	return res;
+}
+
+
+bool plog_packager_tests_size(void) {
+	struct packager_test *self = packager_test_alloc();
+	if (self == NULL) {
+		return false;
+	}
+	const size_t topics[] = {1, 4, PLOG_PACKAGER_MAX_TOPICS};
+	const size_t msg_values[] = {1, 16, 40};
+	const uint32_t count = 200;
+	bool res = true;
+
+	for (size_t i = 0; i < sizeof(topics) / sizeof(topics[0]); i++) {
+		for (size_t j = 0; j < sizeof(msg_values) / sizeof(msg_values[0]); j++) {
+			bool r = packager_run(self, topics[i], msg_values[j], 3072, count, false);
+			if (self->raw_bytes == 0) {
+				self->raw_bytes = 1;
+			}
+			u_log(system_log, r ? LOG_TYPE_INFO : LOG_TYPE_ERROR,
+				U_LOG_MODULE_PREFIX("%u topics, %u+ values: %u messages, %u B of data in %u packages, %u B (%u%%, %u B/msg)"),
+				topics[i], msg_values[j], count, self->raw_bytes, self->packages, self->package_bytes,
+				self->package_bytes * 100 / self->raw_bytes, self->package_bytes / count
+			);
+			res &= r;
+		}
+	}
+
+	packager_test_free(self);
+	return res;
+}
@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * plog message packager tests
+ *
+ * Copyright (c) 2021, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * Run the packager with an in-memory Mq stand-in. Messages of several
+ * topics and dtypes are published, the resulting packages are decompressed
+ * and decoded. Message data, topics and times must be the same as the
+ * published ones. The topic dictionary and the package split are checked.
+ * Packages written to an in-memory file must be the same as the published
+ * ones, writes must be aligned to the file buffer size and flushed in time.
+ */
+bool plog_packager_tests(void);
+
+/**
+ * Log the package size relative to the raw message data size for several
+ * message sizes and topic counts.
+ */
+bool plog_packager_tests_size(void);
@@ -38,18 +38,81 @@
 #define ASSERT(c, r) if (u_assert(c)) return r
 
 
+static size_t nbtable_bucket(NbTable *self, uint32_t id) {
+	/* Fibonacci hashing, node IDs are not required to be random. */
+	return ((id * 2654435769U) >> 16) & (self->bucket_count - 1);
+}
+
+
+static void nbtable_lru_unlink(NbTable *self, struct nbtable_item *item) {
+	if (item->lru_prev != NULL) {
+		item->lru_prev->lru_next = item->lru_next;
+	} else {
+		self->lru_head = item->lru_next;
+	}
+	if (item->lru_next != NULL) {
+		item->lru_next->lru_prev = item->lru_prev;
+	} else {
+		self->lru_tail = item->lru_prev;
+	}
+	item->lru_prev = NULL;
+	item->lru_next = NULL;
+}
+
+
+static void nbtable_lru_push(NbTable *self, struct nbtable_item *item) {
+	item->lru_prev = NULL;
+	item->lru_next = self->lru_head;
+	if (self->lru_head != NULL) {
+		self->lru_head->lru_prev = item;
+	} else {
+		self->lru_tail = item;
+	}
+	self->lru_head = item;
+}
+
+
+/* Remove a used item from its bucket and from the LRU list. */
+static void nbtable_unlink(NbTable *self, struct nbtable_item *item) {
+	struct nbtable_item **p = &self->buckets[nbtable_bucket(self, item->id)];
+	while (*p != NULL && *p != item) {
+		p = &(*p)->hnext;
+	}
+	if (*p != NULL) {
+		*p = item->hnext;
+	}
+	item->hnext = NULL;
+	nbtable_lru_unlink(self, item);
+	self->used--;
+}
+
+
 nbtable_ret_t nbtable_init(NbTable *self, size_t items) {
 	ASSERT(self != NULL, NBTABLE_RET_FAILED);
+	ASSERT(items > 0, NBTABLE_RET_BAD_ARG);
 
 	memset(self, 0, sizeof(NbTable));
 
+	self->bucket_count = 1;
+	while (self->bucket_count < items) {
+		self->bucket_count *= 2;
+	}
+
 	self->items = calloc(items, sizeof(struct nbtable_item));
-	if (self->items == NULL) {
+	self->buckets = calloc(self->bucket_count, sizeof(struct nbtable_item *));
+	if (self->items == NULL || self->buckets == NULL) {
+		free(self->items);
+		free(self->buckets);
 		return NBTABLE_RET_FAILED;
 	}
 	self->count = items;
-	for (size_t i = 0; i < items; i++) {
-		nbtable_init_nb(self, &(self->items[i]), false);
+
+	/* All items are empty now, chain them. */
+	for (size_t i = items; i > 0; i--) {
+		struct nbtable_item *item = &(self->items[i - 1]);
+		nbtable_init_nb(self, item, false);
+		item->hnext = self->empty;
+		self->empty = item;
 	}
 
 	return NBTABLE_RET_OK;
@@ -60,6 +123,9 @@ nbtable_ret_t nbtable_free(NbTable *self) {
 	ASSERT(self != NULL, NBTABLE_RET_NULL);
 
 	free(self->items);
+	free(self->buckets);
+	self->items = NULL;
+	self->buckets = NULL;
 	self->count = 0;
 
 	return NBTABLE_RET_OK;
@@ -69,9 +135,14 @@ nbtable_ret_t nbtable_free(NbTable *self) {
 struct nbtable_item *nbtable_find_id(NbTable *self, uint32_t id) {
 	ASSERT(self != NULL, NULL);
 
-	for (size_t i = 0; i < self->count; i++) {
-		if (self->items[i].used && self->items[i].id == id) {
-			return &(self->items[i]);
+	for (struct nbtable_item *item = self->buckets[nbtable_bucket(self, id)]; item != NULL; item = item->hnext) {
+		if (item->id == id) {
+			/* Mark the neighbor as the most recently used. */
+			if (item != self->lru_head) {
+				nbtable_lru_unlink(self, item);
+				nbtable_lru_push(self, item);
+			}
+			return item;
 		}
 	}
 	return NULL;
@@ -81,12 +152,7 @@ struct nbtable_item *nbtable_find_id(NbTable *self, uint32_t id) {
 struct nbtable_item *nbtable_find_empty(NbTable *self) {
 	ASSERT(self != NULL, NULL);
 
-	for (size_t i = 0; i < self->count; i++) {
-		if (self->items[i].used ==false) {
-			return &(self->items[i]);
-		}
-	}
-	return NULL;
+	return self->empty;
 }
 
 
@@ -94,20 +160,38 @@ struct nbtable_item *nbtable_find_or_add_id(NbTable *self, uint32_t id) {
 	ASSERT(self != NULL, NULL);
 
 	struct nbtable_item *item = nbtable_find_id(self, id);
-	if (item == NULL) {
-		/* If not item is found, try to find an empty one to add it. */
-		item = nbtable_find_empty(self);
+	if (item != NULL) {
+		return item;
+	}
+
+	/* If not item is found, try to find an empty one to add it. */
+	item = self->empty;
+	if (item != NULL) {
+		self->empty = item->hnext;
+	} else {
+		/* Table is full, replace the least recently used neighbor. */
+		item = self->lru_tail;
 		if (item == NULL) {
-			/* Tabel is full. */
 			return NULL;
 		}
-		nbtable_init_nb(self, item, true);
-		item->id = id;
+		nbtable_unlink(self, item);
+		self->evicted++;
 	}
+
+	nbtable_init_nb(self, item, true);
+	item->id = id;
+
+	size_t b = nbtable_bucket(self, id);
+	item->hnext = self->buckets[b];
+	self->buckets[b] = item;
+	nbtable_lru_push(self, item);
+	self->used++;
+
 	return item;
 }
 
 
+/* The item must not be linked in the table. */
 nbtable_ret_t nbtable_init_nb(NbTable *self, struct nbtable_item *item, bool used) {
 	ASSERT(self != NULL, NBTABLE_RET_NULL);
 	ASSERT(item != NULL, NBTABLE_RET_BAD_ARG);
@@ -123,8 +207,15 @@ nbtable_ret_t nbtable_free_nb(NbTable *self, struct nbtable_item *item) {
 	ASSERT(self != NULL, NBTABLE_RET_NULL);
 	ASSERT(item != NULL, NBTABLE_RET_BAD_ARG);
 
+	if (item->used == false) {
+		return NBTABLE_RET_OK;
+	}
+	nbtable_unlink(self, item);
+
 	memset(item, 0, sizeof(struct nbtable_item));
 	item->used = false;
+	item->hnext = self->empty;
+	self->empty = item;
 
 	return NBTABLE_RET_OK;
 }
@@ -36,7 +36,7 @@
 #include "pb_encode.h"
 #include "pb_decode.h"
 #include "rmac_pbuf.pb.h"
-#include "lib/crypto/blake2.h"
+#include "blake2.h"
 
 
 #define MODULE_NAME "rmac-pbuf"
@@ -46,7 +46,7 @@
 rmac_pbuf_ret_t rmac_pbuf_clear(RmacPbuf *self) {
 	ASSERT(self != NULL, RMAC_PBUF_RET_NULL);
 
-	memset(self, 0, sizeof(RmacPbuf));
+	self->used = false;
 	self->msg = (RmacPacket)RmacPacket_init_default;
 	return RMAC_PBUF_RET_OK;
 }
@@ -78,31 +78,40 @@ rmac_pbuf_ret_t rmac_pbuf_universe_key(RmacPbuf *self, uint8_t *key, size_t len)
 	memcpy(self->key_encrypt, res, RMAC_PBUF_KE_LEN);
 	memcpy(self->key_mac, res + RMAC_PBUF_KE_LEN, RMAC_PBUF_KM_LEN);
 
+	/* Initialise the keyed states once, they are copied for every use. The reference
+	 * implementation only buffers the key block here, it is compressed by the first
+	 * update of each copy. */
+	blake2s_init_key(&self->ke_state, BLAKE2S_OUTBYTES, self->key_encrypt, RMAC_PBUF_KE_LEN);
+	blake2s_init_key(&self->km_state, RMAC_PBUF_SIV_LEN, self->key_mac, RMAC_PBUF_KM_LEN);
+
 	return RMAC_PBUF_RET_OK;
 }
 
 
 /* The encryption is reversible. This single function can be used bot for
- * encryption and decryption. */
-static rmac_pbuf_ret_t crypt_in_place(uint8_t *buf, size_t len, uint8_t siv[RMAC_PBUF_SIV_LEN], uint8_t key[RMAC_PBUF_KE_LEN]) {
+ * encryption and decryption. Keystream block i is BLAKE2s(Ke, SIV || 000i). */
+static rmac_pbuf_ret_t crypt_in_place(uint8_t *buf, size_t len, uint8_t siv[RMAC_PBUF_SIV_LEN], const blake2s_state *ke_state) {
 	ASSERT(buf != NULL, RMAC_PBUF_RET_BAD_ARG);
 	ASSERT(len > 0, RMAC_PBUF_RET_BAD_ARG);
 	ASSERT(siv != NULL, RMAC_PBUF_RET_BAD_ARG);
-	ASSERT(key != NULL, RMAC_PBUF_RET_BAD_ARG);
+	ASSERT(ke_state != NULL, RMAC_PBUF_RET_BAD_ARG);
+
+	/* The key block is compressed together with the SIV once per packet. The SIV
+	 * and the counter fit in the second block, every keystream block costs
+	 * a single compression. */
+	blake2s_state siv_state = *ke_state;
+	blake2s_update(&siv_state, siv, RMAC_PBUF_SIV_LEN);
 
 	/* A single byte block counter. */
 	uint8_t i = 0;
 	while (len > 0) {
 		/* Generate a BLAKE2S_OUTBYTES of keystream. */
 		uint8_t keystream[BLAKE2S_OUTBYTES] = {0};
-		blake2s_state s;
-		blake2s_init_key(&s, BLAKE2S_OUTBYTES, key, RMAC_PBUF_KE_LEN);
-		blake2s_update(&s, siv, RMAC_PBUF_SIV_LEN);
+		blake2s_state s = siv_state;
 		uint8_t b[4] = {0, 0, 0, i};
 		blake2s_update(&s, b, sizeof(b));
 		blake2s_final(&s, keystream, BLAKE2S_OUTBYTES);
 
-
 		/* Crunch BLAKE2S_OUTBYTES or less in one step. */
 		size_t block_len = len;
 		if (block_len > BLAKE2S_OUTBYTES) {
@@ -123,6 +132,14 @@ static rmac_pbuf_ret_t crypt_in_place(uint8_t *buf, size_t len, uint8_t siv[RMAC
 }
 
 
+/* Keyed BLAKE2s of the data used as a MAC and SIV. */
+static void compute_mac(const blake2s_state *km_state, const uint8_t *data, size_t len, uint8_t mac[RMAC_PBUF_SIV_LEN]) {
+	blake2s_state s = *km_state;
+	blake2s_update(&s, data, len);
+	blake2s_final(&s, mac, RMAC_PBUF_SIV_LEN);
+}
+
+
 rmac_pbuf_ret_t rmac_pbuf_read(RmacPbuf *self, uint8_t *buf, size_t len) {
 	ASSERT(self != NULL, RMAC_PBUF_RET_NULL);
 	ASSERT(buf != NULL, RMAC_PBUF_RET_BAD_ARG);
@@ -142,16 +159,20 @@ rmac_pbuf_ret_t rmac_pbuf_read(RmacPbuf *self, uint8_t *buf, size_t len) {
 	uint8_t *data = buf + RMAC_PBUF_SIV_LEN;
 	size_t data_len = len - RMAC_PBUF_SIV_LEN;
 
-	if (crypt_in_place(data, data_len, siv, self->key_encrypt) != RMAC_PBUF_RET_OK) {
+	if (crypt_in_place(data, data_len, siv, &self->ke_state) != RMAC_PBUF_RET_OK) {
 		return RMAC_PBUF_RET_DECRYPT_FAILED;
 	}
 
 	/* Now compute H() of the received data and compare to the received SIV. */
 	uint8_t mac_received[RMAC_PBUF_SIV_LEN] = {0};
-	blake2s(mac_received, sizeof(mac_received), data, data_len, self->key_mac, RMAC_PBUF_KM_LEN);
+	compute_mac(&self->km_state, data, data_len, mac_received);
 
-	/** @todo constant-time compare */
-	if (memcmp(siv, mac_received, RMAC_PBUF_SIV_LEN)) {
+	/* Compare in constant time. */
+	uint8_t diff = 0;
+	for (size_t i = 0; i < RMAC_PBUF_SIV_LEN; i++) {
+		diff |= siv[i] ^ mac_received[i];
+	}
+	if (diff != 0) {
 		/* Just to be sure nobody processes the fake data. */
 		memset(data, 0, data_len);
 		return RMAC_PBUF_RET_MAC_FAILED;
@@ -202,10 +223,10 @@ rmac_pbuf_ret_t rmac_pbuf_write(RmacPbuf *self, uint8_t *buf, size_t buf_size, s
 	ASSERT(RMAC_PBUF_SIV_LEN + data_len <= buf_size, RMAC_PBUF_RET_ENCODING_FAILED);
 
 	/* Data is serialized, compute the MAC (used as a SIV). */
-	blake2s(siv, RMAC_PBUF_SIV_LEN, data, data_len, self->key_mac, RMAC_PBUF_KM_LEN);
+	compute_mac(&self->km_state, data, data_len, siv);
 
 	/* And finally encrypt the serialized packet in-place using the computed SIV. */
-	if (crypt_in_place(data, data_len, siv, self->key_encrypt) != RMAC_PBUF_RET_OK) {
+	if (crypt_in_place(data, data_len, siv, &self->ke_state) != RMAC_PBUF_RET_OK) {
 		return RMAC_PBUF_RET_ENCRYPT_FAILED;
 	}
 
@@ -36,7 +36,10 @@
 #include "interfaces/radio.h"
 #include "interfaces/radio-mac/host.h"
 #include "crc.h"
-#include "fec_golay.h"
+
+#if defined(CONFIG_SERVICE_RADIO_MAC_SIMPLE_FEC)
+	#include "fec_golay.h"
+#endif
 
 
 #define MODULE_NAME "rmac-rsch"
@@ -56,20 +59,67 @@ static uint64_t rmac_time(Rmac *self) {
 }
 
 
-/** @todo -> pbuf */
-/* For golay encoding/decoding. */
-static uint32_t btu24(const uint8_t bytes[3]) {
-	return (bytes[0] << 16) | (bytes[1] << 8) | bytes[2];
+#if defined(CONFIG_SERVICE_RADIO_MAC_SIMPLE_FEC)
+/* Replace the packet in buf with its FEC encoded form. The packet length
+ * is saved in the first byte, the rest is padded with zeroes. */
+static rmac_ret_t rmac_fec_encode(uint8_t *buf, size_t *len, size_t buf_size) {
+	if (*len > RMAC_FEC_PACKET_LEN_MAX) {
+		return RMAC_RET_FAILED;
+	}
+	uint8_t data[RMAC_FEC_PACKET_LEN_MAX + 1];
+	data[0] = *len;
+	memcpy(data + 1, buf, *len);
+
+	size_t enc_len = fec_golay_encoded_len(*len + 1);
+	if (enc_len > buf_size) {
+		return RMAC_RET_FAILED;
+	}
+
+	#if defined(CONFIG_SERVICE_RADIO_MAC_SIMPLE_FEC_INTERLEAVE)
+		uint8_t enc[RMAC_PBUF_PACKET_LEN_MAX];
+		fec_golay_encode_buf(data, *len + 1, enc);
+		if (!fec_golay_interleave(enc, enc_len, buf)) {
+			return RMAC_RET_FAILED;
+		}
+	#else
+		fec_golay_encode_buf(data, *len + 1, buf);
+	#endif
+	*len = enc_len;
+
+	return RMAC_RET_OK;
 }
 
 
-/** @todo -> pbuf */
-/* For golay encoding/decoding. */
-static void u24tb(uint32_t v, uint8_t bytes[3]) {
-	bytes[0] = (v >> 16) & 0xff;
-	bytes[1] = (v >> 8) & 0xff;
-	bytes[2] = v & 0xff;
+/* Correct errors and decode the packet in place. */
+static rmac_ret_t rmac_fec_decode(uint8_t *buf, size_t *len) {
+	if (*len == 0 || (*len % 6) != 0 || *len > RMAC_PBUF_PACKET_LEN_MAX) {
+		return RMAC_RET_FAILED;
+	}
+	uint8_t data[RMAC_FEC_PACKET_LEN_MAX + 1];
+
+	#if defined(CONFIG_SERVICE_RADIO_MAC_SIMPLE_FEC_INTERLEAVE)
+		uint8_t enc[RMAC_PBUF_PACKET_LEN_MAX];
+		if (!fec_golay_deinterleave(buf, *len, enc)) {
+			return RMAC_RET_FAILED;
+		}
+		size_t failed = fec_golay_decode_buf(enc, *len, data, NULL);
+	#else
+		size_t failed = fec_golay_decode_buf(buf, *len, data, NULL);
+	#endif
+	if (failed > 0) {
+		return RMAC_RET_FAILED;
+	}
+
+	size_t data_len = *len / 2;
+	if (data[0] == 0 || data[0] >= data_len) {
+		return RMAC_RET_FAILED;
+	}
+	*len = data[0];
+	memcpy(buf, data + 1, *len);
+
+	return RMAC_RET_OK;
 }
+#endif
 
 
 static rmac_ret_t rmac_slot_exec(Rmac *self, struct rmac_slot *slot) {
@@ -295,28 +345,13 @@ rmac_ret_t process_packet(Rmac *self, struct radio_scheduler_rxpacket *packet) {
 	ASSERT(self != NULL, RMAC_RET_NULL);
 	ASSERT(packet != NULL, RMAC_RET_BAD_ARG);
 
-	#if 0
-	if (false) {
-		if ((packet->len % 6) != 0) {
+	#if defined(CONFIG_SERVICE_RADIO_MAC_SIMPLE_FEC)
+		if (rmac_fec_decode(packet->buf, &packet->len) != RMAC_RET_OK) {
 			return RMAC_RET_FAILED;
 		}
-		for (size_t i = 0; i < (packet->len / 6); i++) {
-			uint32_t g1 = fec_golay_correct(btu24(&buf[i * 6]));
-			uint32_t g2 = fec_golay_correct(btu24(&buf[i * 6 + 3]));
-			uint32_t triplet = ((g1 & 0x0fff) << 12) | (g2 & 0x0fff);
-			u24tb(triplet, &(buf[i * 3]));
-		}
-		len /= 2;
-
-		len = buf[0];
-		for (size_t i = 0; i < len; i++) {
-			buf[i] = buf[i + 1];
-		}
-	}
 	#endif
 
 	rmac_pbuf_clear(&self->rx_pbuf);
-	rmac_pbuf_universe_key(&self->rx_pbuf, self->universe_key, self->universe_key_len);
 	rmac_pbuf_ret_t ret = rmac_pbuf_read(&self->rx_pbuf, packet->buf, packet->len);
 	if (ret != RMAC_PBUF_RET_OK) {
 		return RMAC_RET_FAILED;
@@ -400,7 +435,6 @@ static void tx_process_task(void *p) {
 			}
 
 			rmac_pbuf_clear(&self->tx_pbuf);
-			rmac_pbuf_universe_key(&self->tx_pbuf, self->universe_key, self->universe_key_len);
 			self->tx_pbuf.msg.source = self->node_id;
 			self->tx_pbuf.msg.has_context = true;
 			self->tx_pbuf.msg.context = msg.context;
@@ -415,41 +449,22 @@ static void tx_process_task(void *p) {
 			memcpy(self->tx_pbuf.msg.data.bytes, msg.buf, msg.len);
 			self->tx_pbuf.msg.data.size = msg.len;
 
-			rmac_pbuf_ret_t ret = rmac_pbuf_write(&self->tx_pbuf, packet->txpacket.buf, 256, &packet->txpacket.len);
+			#if defined(CONFIG_SERVICE_RADIO_MAC_SIMPLE_FEC)
+				/* Drop the packet if it is too large to be encoded. */
+				size_t pbuf_size = RMAC_FEC_PACKET_LEN_MAX;
+			#else
+				size_t pbuf_size = sizeof(packet->txpacket.buf);
+			#endif
+			rmac_pbuf_ret_t ret = rmac_pbuf_write(&self->tx_pbuf, packet->txpacket.buf, pbuf_size, &packet->txpacket.len);
 			if (ret != RMAC_PBUF_RET_OK) {
 				continue;
 			}
 
-			if (false) {
-				/* 125B is the maximum message length when using Golay encoding.
-				 * Drop the packet if it is larger. */
-				if (packet->txpacket.len > 125) {
+			#if defined(CONFIG_SERVICE_RADIO_MAC_SIMPLE_FEC)
+				if (rmac_fec_encode(packet->txpacket.buf, &packet->txpacket.len, sizeof(packet->txpacket.buf)) != RMAC_RET_OK) {
 					continue;
 				}
-
-				/* Save the packet length in the first byte. We have to move
-				 * the rest. */
-				/** @todo unoptimal */
-				for (size_t i = packet->txpacket.len; i > 0; i--) {
-					packet->txpacket.buf[i] = packet->txpacket.buf[i - 1];
-				}
-				packet->txpacket.buf[0] = packet->txpacket.len;
-				packet->txpacket.len++;
-
-				/* Pad the length to be divisible by 3. */
-				while (packet->txpacket.len % 3) {
-					packet->txpacket.len++;
-				}
-
-				for (int32_t i = packet->txpacket.len; i >= 0; i--) {
-					uint32_t triplet = btu24(&(packet->txpacket.buf[i * 3]));
-					uint32_t g1 = fec_golay_encode((triplet >> 12) & 0x0fff);
-					uint32_t g2 = fec_golay_encode(triplet & 0x0fff);
-					u24tb(g1, &(packet->txpacket.buf[i * 6]));
-					u24tb(g2, &(packet->txpacket.buf[i * 6 + 3]));
-				}
-				packet->txpacket.len *= 2;
-			}
+			#endif
 		}
 
 		if (self->state == RMAC_STATE_STOP_REQ) {
@@ -720,6 +735,12 @@ rmac_ret_t rmac_packet_pool_init(RmacPacketPool *self, size_t size) {
 		return RMAC_RET_FAILED;
 	}
 
+	/* Chain all packets in the free list. */
+	for (size_t i = 0; i < size; i++) {
+		self->pool[i].next = self->free;
+		self->free = &(self->pool[i]);
+	}
+
 	return RMAC_RET_OK;
 }
 
@@ -729,7 +750,12 @@ rmac_ret_t rmac_packet_pool_free(RmacPacketPool *self) {
 
 	free(self->pool);
 	self->pool = NULL;
+	self->free = NULL;
 	self->size = 0;
+	if (self->lock != NULL) {
+		vSemaphoreDelete(self->lock);
+		self->lock = NULL;
+	}
 
 	return RMAC_RET_OK;
 }
@@ -739,15 +765,22 @@ struct radio_scheduler_packet *rmac_packet_pool_get(RmacPacketPool *self) {
 	ASSERT(self != NULL, NULL);
 
 	xSemaphoreTake(self->lock, portMAX_DELAY);
-	for (size_t i = 0; i < self->size; i++) {
-		if (self->pool[i].used == false) {
-			self->pool[i].used = true;
-			xSemaphoreGive(self->lock);
-			return &(self->pool[i]);
+	struct radio_scheduler_packet *packet = self->free;
+	self->stats.get++;
+	if (packet != NULL) {
+		self->free = packet->next;
+		packet->next = NULL;
+		packet->used = true;
+		self->stats.used++;
+		if (self->stats.used > self->stats.used_max) {
+			self->stats.used_max = self->stats.used;
 		}
+	} else {
+		self->stats.empty++;
 	}
 	xSemaphoreGive(self->lock);
-	return NULL;
+
+	return packet;
 }
 
 
@@ -755,9 +788,17 @@ rmac_ret_t rmac_packet_pool_release(RmacPacketPool *self, struct radio_scheduler
 	ASSERT(self != NULL, RMAC_RET_NULL);
 
 	if (packet != NULL) {
+		ASSERT(packet >= self->pool && packet < self->pool + self->size, RMAC_RET_BAD_ARG);
 		xSemaphoreTake(self->lock, portMAX_DELAY);
-		ASSERT(packet->used == true, RMAC_RET_FAILED);
+		if (u_assert(packet->used == true)) {
+			/* Double release would corrupt the free list. */
+			xSemaphoreGive(self->lock);
+			return RMAC_RET_FAILED;
+		}
 		packet->used = false;
+		packet->next = self->free;
+		self->free = packet;
+		self->stats.used--;
 		xSemaphoreGive(self->lock);
 	}
 
@@ -765,6 +806,13 @@ rmac_ret_t rmac_packet_pool_release(RmacPacketPool *self, struct radio_scheduler
 }
 
 
+rmac_ret_t rmac_packet_pool_get_stats(RmacPacketPool *self, struct rmac_packet_pool_stats *stats) {
+	ASSERT(self != NULL, RMAC_RET_NULL);
+	ASSERT(stats != NULL, RMAC_RET_BAD_ARG);
 
+	xSemaphoreTake(self->lock, portMAX_DELAY);
+	*stats = self->stats;
+	xSemaphoreGive(self->lock);
 
-
+	return RMAC_RET_OK;
+}
@@ -0,0 +1,264 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * rMAC Golay FEC tests
+ *
+ * Copyright (c) 2023, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "main.h"
+#include "u_test.h"
+#include "u_log.h"
+
+#include "rmac-fec-tests.h"
+
+#if defined(CONFIG_SERVICE_RADIO_MAC_SIMPLE_FEC)
+
+#include <fec_golay.h>
+
+#ifdef MODULE_NAME
+#undef MODULE_NAME
+#endif
+#define MODULE_NAME "rmac-fec-tests"
+
+/* The largest frame encoded by the MAC (the length byte and
+ * RMAC_FEC_PACKET_LEN_MAX bytes), 84 codewords. */
+#define RMAC_FEC_TEST_LEN 126
+#define RMAC_FEC_TEST_ENCODED_LEN (RMAC_FEC_TEST_LEN * 2)
+#define RMAC_FEC_TEST_CODEWORDS (RMAC_FEC_TEST_LEN * 2 / 3)
+#define RMAC_FEC_TEST_FRAMES 200
+#define RMAC_FEC_TEST_BENCH_FRAMES 5000
+
+struct rmac_fec_test {
+	uint8_t data[RMAC_FEC_TEST_LEN];
+	uint8_t encoded[RMAC_FEC_TEST_ENCODED_LEN];
+	uint8_t interleaved[RMAC_FEC_TEST_ENCODED_LEN];
+	uint8_t decoded[RMAC_FEC_TEST_LEN];
+	uint32_t rand;
+};
+
+
+/* Deterministic xorshift, failures are reproducible. */
+static uint32_t rmac_fec_test_rand(struct rmac_fec_test *self, uint32_t n) {
+	self->rand ^= self->rand << 13;
+	self->rand ^= self->rand >> 17;
+	self->rand ^= self->rand << 5;
+	return self->rand % n;
+}
+
+
+static void rmac_fec_test_fill(struct rmac_fec_test *self, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		self->data[i] = rmac_fec_test_rand(self, 256);
+	}
+}
+
+
+/* Codeword c occupies 3 bytes, bit b counts from its MSB. */
+static void rmac_fec_test_flip(uint8_t *buf, size_t c, uint32_t b) {
+	buf[c * 3 + b / 8] ^= 0x80 >> (b % 8);
+}
+
+
+/* Flip n distinct bits of the codeword. */
+static void rmac_fec_test_inject(struct rmac_fec_test *self, size_t c, uint32_t n) {
+	uint32_t mask = 0;
+	while (n > 0) {
+		uint32_t b = rmac_fec_test_rand(self, 24);
+		if (mask & (1UL << b)) {
+			continue;
+		}
+		mask |= 1UL << b;
+		rmac_fec_test_flip(self->encoded, c, b);
+		n--;
+	}
+}
+
+
+static bool rmac_fec_test_correct_if_3_errors(struct rmac_fec_test *self) {
+	bool ret = true;
+	for (uint32_t f = 0; f < RMAC_FEC_TEST_FRAMES; f++) {
+		rmac_fec_test_fill(self, RMAC_FEC_TEST_LEN);
+		fec_golay_encode_buf(self->data, RMAC_FEC_TEST_LEN, self->encoded);
+
+		uint32_t injected = 0;
+		for (size_t c = 0; c < RMAC_FEC_TEST_CODEWORDS; c++) {
+			uint32_t n = rmac_fec_test_rand(self, 4);
+			rmac_fec_test_inject(self, c, n);
+			injected += n;
+		}
+
+		uint32_t corrected = 0;
+		ret &= fec_golay_decode_buf(self->encoded, RMAC_FEC_TEST_ENCODED_LEN, self->decoded, &corrected) == 0;
+		ret &= corrected == injected;
+		ret &= memcmp(self->data, self->decoded, RMAC_FEC_TEST_LEN) == 0;
+	}
+	return ret;
+}
+
+
+static bool rmac_fec_test_detect_if_4_errors(struct rmac_fec_test *self) {
+	bool ret = true;
+	for (uint32_t f = 0; f < RMAC_FEC_TEST_FRAMES; f++) {
+		rmac_fec_test_fill(self, RMAC_FEC_TEST_LEN);
+		fec_golay_encode_buf(self->data, RMAC_FEC_TEST_LEN, self->encoded);
+
+		/* 4 errors are always detected thanks to the parity bit, never miscorrected. */
+		size_t c = rmac_fec_test_rand(self, RMAC_FEC_TEST_CODEWORDS);
+		rmac_fec_test_inject(self, c, 4);
+		ret &= fec_golay_decode_buf(self->encoded, RMAC_FEC_TEST_ENCODED_LEN, self->decoded, NULL) == 1;
+	}
+	return ret;
+}
+
+
+static bool rmac_fec_test_burst_if_interleaved(struct rmac_fec_test *self) {
+	bool ret = true;
+	/* The longest burst corrupting at most 3 bits of every codeword. */
+	const uint32_t burst = 3 * RMAC_FEC_TEST_CODEWORDS;
+	for (uint32_t f = 0; f < RMAC_FEC_TEST_FRAMES; f++) {
+		rmac_fec_test_fill(self, RMAC_FEC_TEST_LEN);
+		fec_golay_encode_buf(self->data, RMAC_FEC_TEST_LEN, self->encoded);
+		ret &= fec_golay_interleave(self->encoded, RMAC_FEC_TEST_ENCODED_LEN, self->interleaved);
+
+		uint32_t start = rmac_fec_test_rand(self, RMAC_FEC_TEST_ENCODED_LEN * 8 - burst);
+		for (uint32_t b = start; b < start + burst; b++) {
+			self->interleaved[b / 8] ^= 0x80 >> (b % 8);
+		}
+
+		ret &= fec_golay_deinterleave(self->interleaved, RMAC_FEC_TEST_ENCODED_LEN, self->encoded);
+		uint32_t corrected = 0;
+		ret &= fec_golay_decode_buf(self->encoded, RMAC_FEC_TEST_ENCODED_LEN, self->decoded, &corrected) == 0;
+		ret &= corrected == burst;
+		ret &= memcmp(self->data, self->decoded, RMAC_FEC_TEST_LEN) == 0;
+
+		/* The same burst in a stream which is not interleaved is not recoverable.
+		 * A fully inverted codeword is a valid one, it is not always detected. */
+		fec_golay_encode_buf(self->data, RMAC_FEC_TEST_LEN, self->encoded);
+		for (uint32_t b = start; b < start + burst; b++) {
+			self->encoded[b / 8] ^= 0x80 >> (b % 8);
+		}
+		size_t failed = fec_golay_decode_buf(self->encoded, RMAC_FEC_TEST_ENCODED_LEN, self->decoded, NULL);
+		ret &= failed > 0 || memcmp(self->data, self->decoded, RMAC_FEC_TEST_LEN) != 0;
+	}
+
+	/* Blocks longer than the interleaver are refused. */
+	const size_t too_long = (FEC_GOLAY_INTERLEAVE_MAX + 2) * 3;
+	uint8_t *big = calloc(1, too_long);
+	if (big == NULL) {
+		return false;
+	}
+	ret &= !fec_golay_interleave(big, too_long, big);
+	ret &= !fec_golay_deinterleave(big, too_long, big);
+	free(big);
+
+	return ret;
+}
+
+
+static bool rmac_fec_test_pad_if_unaligned(struct rmac_fec_test *self) {
+	bool ret = true;
+	for (size_t len = 1; len <= 8; len++) {
+		rmac_fec_test_fill(self, len);
+		size_t encoded_len = fec_golay_encoded_len(len);
+		ret &= encoded_len == (len + 2) / 3 * 6;
+
+		fec_golay_encode_buf(self->data, len, self->encoded);
+		rmac_fec_test_inject(self, 0, 3);
+		memset(self->decoded, 0xff, sizeof(self->decoded));
+		ret &= fec_golay_decode_buf(self->encoded, encoded_len, self->decoded, NULL) == 0;
+		ret &= memcmp(self->data, self->decoded, len) == 0;
+
+		/* The data is padded with zeroes. */
+		for (size_t i = len; i < encoded_len / 2; i++) {
+			ret &= self->decoded[i] == 0;
+		}
+	}
+	return ret;
+}
+
+
+bool rmac_fec_tests(void) {
+	struct rmac_fec_test *self = calloc(1, sizeof(struct rmac_fec_test));
+	if (self == NULL) {
+		return false;
+	}
+	self->rand = 0x12345678;
+	fec_golay_table_fill();
+
+	bool res = true;
+	res &= u_test(rmac_fec_test_correct_if_3_errors(self));
+	res &= u_test(rmac_fec_test_detect_if_4_errors(self));
+	res &= u_test(rmac_fec_test_burst_if_interleaved(self));
+	res &= u_test(rmac_fec_test_pad_if_unaligned(self));
+
+	free(self);
+	return res;
+}
+
+
+/* Data bytes processed per second, in kB/s. */
+static uint32_t rmac_fec_test_kbps(TickType_t start) {
+	uint32_t ms = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+	if (ms == 0) {
+		ms = 1;
+	}
+	return (uint64_t)RMAC_FEC_TEST_BENCH_FRAMES * RMAC_FEC_TEST_LEN / ms;
+}
+
+
+bool rmac_fec_tests_throughput(void) {
+	struct rmac_fec_test *self = calloc(1, sizeof(struct rmac_fec_test));
+	if (self == NULL) {
+		return false;
+	}
+	self->rand = 0x12345678;
+	fec_golay_table_fill();
+	rmac_fec_test_fill(self, RMAC_FEC_TEST_LEN);
+
+	TickType_t start = xTaskGetTickCount();
+	for (uint32_t i = 0; i < RMAC_FEC_TEST_BENCH_FRAMES; i++) {
+		fec_golay_encode_buf(self->data, RMAC_FEC_TEST_LEN, self->encoded);
+	}
+	uint32_t encode = rmac_fec_test_kbps(start);
+
+	start = xTaskGetTickCount();
+	for (uint32_t i = 0; i < RMAC_FEC_TEST_BENCH_FRAMES; i++) {
+		fec_golay_interleave(self->encoded, RMAC_FEC_TEST_ENCODED_LEN, self->interleaved);
+	}
+	uint32_t interleave = rmac_fec_test_kbps(start);
+
+	start = xTaskGetTickCount();
+	for (uint32_t i = 0; i < RMAC_FEC_TEST_BENCH_FRAMES; i++) {
+		fec_golay_deinterleave(self->interleaved, RMAC_FEC_TEST_ENCODED_LEN, self->encoded);
+	}
+	uint32_t deinterleave = rmac_fec_test_kbps(start);
+
+	/* Decoding is measured with 3 errors in every codeword, the worst case
+	 * which is still corrected. */
+	for (size_t c = 0; c < RMAC_FEC_TEST_CODEWORDS; c++) {
+		rmac_fec_test_inject(self, c, 3);
+	}
+	bool ret = true;
+	start = xTaskGetTickCount();
+	for (uint32_t i = 0; i < RMAC_FEC_TEST_BENCH_FRAMES; i++) {
+		ret &= fec_golay_decode_buf(self->encoded, RMAC_FEC_TEST_ENCODED_LEN, self->decoded, NULL) == 0;
+	}
+	uint32_t decode = rmac_fec_test_kbps(start);
+	ret &= memcmp(self->data, self->decoded, RMAC_FEC_TEST_LEN) == 0;
+
+	u_log(system_log, ret ? LOG_TYPE_INFO : LOG_TYPE_ERROR,
+		U_LOG_MODULE_PREFIX("%u B frames: encode %u kB/s, interleave %u kB/s, deinterleave %u kB/s, decode %u kB/s"),
+		RMAC_FEC_TEST_LEN, encode, interleave, deinterleave, decode
+	);
+
+	free(self);
+	return ret;
+}
+
+#endif
@@ -0,0 +1,25 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * rMAC Golay FEC tests
+ *
+ * Copyright (c) 2023, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * Inject up to 3 random bit errors into every codeword of encoded frames and
+ * check all of them are corrected and counted. Check 4 errors in a codeword
+ * are detected and a burst spanning many codewords is corrected only if the
+ * codewords are interleaved.
+ */
+bool rmac_fec_tests(void);
+
+/**
+ * Log the encoding, decoding, interleaving and deinterleaving throughput
+ * of the largest frames the MAC can encode.
+ */
+bool rmac_fec_tests_throughput(void);
@@ -0,0 +1,475 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * rMAC packet pool, neighbor table and packet buffer tests
+ *
+ * Copyright (c) 2023, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "main.h"
+#include "u_test.h"
+#include "u_log.h"
+
+#include "rmac.h"
+#include "rmac-tests.h"
+
+#ifdef MODULE_NAME
+#undef MODULE_NAME
+#endif
+#define MODULE_NAME "rmac-tests"
+
+#define RMAC_TEST_POOL_SIZE 4
+#define RMAC_TEST_NBTABLE_SIZE 16
+#define RMAC_TEST_LRU_SIZE 4
+
+/* The cost is measured with a pool and a neighbor table larger than the
+ * default ones, the pool is almost exhausted. Received frames are prepared
+ * in advance and decrypted repeatedly. */
+#define RMAC_TEST_COST_POOL_SIZE 32
+#define RMAC_TEST_COST_NBTABLE_SIZE 256
+#define RMAC_TEST_COST_GETS 100000
+#define RMAC_TEST_COST_LOOKUPS 200000
+#define RMAC_TEST_COST_PACKETS 5000
+#define RMAC_TEST_COST_FRAMES 16
+#define RMAC_TEST_COST_DATA_LEN 32
+#define RMAC_TEST_KEY "Universe"
+#define RMAC_TEST_VECTOR_LEN_MAX 96
+
+/* Crypto cost per byte is measured with 16, 64 and 239 B of serialized
+ * message after the SIV. The last one is the longest frame the pbuf can write. */
+#define RMAC_TEST_COST_CRYPTO_PACKETS 2000
+#define RMAC_TEST_COST_CRYPTO_SIZES 3
+
+struct rmac_test_cost_crypto_size {
+	size_t data_len;
+	size_t frame_len;
+};
+
+static const struct rmac_test_cost_crypto_size rmac_test_cost_crypto_sizes[RMAC_TEST_COST_CRYPTO_SIZES] = {
+	{.data_len = 11, .frame_len = 32},
+	{.data_len = 59, .frame_len = 80},
+	{.data_len = 233, .frame_len = RMAC_PBUF_PACKET_LEN_MAX},
+};
+
+/* Frames written with the RMAC_TEST_KEY by the pbuf.c version which derived
+ * the keys and keyed the BLAKE2s state for every packet and keystream block.
+ * The current version must write and read the same on-air format.
+ * Data byte i is data_seed + 7 * i. */
+struct rmac_test_vector {
+	uint32_t destination;
+	uint32_t source;
+	uint32_t context;
+	uint32_t counter;
+	size_t data_len;
+	uint8_t data_seed;
+	size_t len;
+	uint8_t frame[RMAC_TEST_VECTOR_LEN_MAX];
+};
+
+static const struct rmac_test_vector rmac_test_vectors[] = {
+	{
+		/* No data, a single keystream block. */
+		.source = 0x1234, .counter = 1,
+		.len = 21,
+		.frame = {
+			0x2a, 0x61, 0x64, 0x01, 0xa5, 0xbe, 0xd9, 0x83, 0xf7, 0xc5, 0xe4, 0x85,
+			0x68, 0x8b, 0x04, 0x13, 0x9e, 0x7c, 0xf2, 0xc8, 0xe2,
+		},
+	}, {
+		.source = 0x1234, .context = 1, .counter = 2,
+		.data_len = 16, .data_seed = 0x10,
+		.len = 41,
+		.frame = {
+			0x3e, 0xc1, 0xff, 0x28, 0xa1, 0x41, 0x0a, 0x49, 0xae, 0xa5, 0x5f, 0x42,
+			0x84, 0x58, 0x6f, 0xc9, 0xda, 0x1c, 0x09, 0xca, 0xe8, 0x17, 0x86, 0x0c,
+			0xc7, 0x45, 0xce, 0xd1, 0xc4, 0x94, 0x4b, 0xed, 0x39, 0x9f, 0x3a, 0xe8,
+			0x0b, 0x2b, 0xf5, 0xf0, 0x9e,
+		},
+	}, {
+		/* All fields, 3 keystream blocks. */
+		.destination = 0x55aa, .source = 0x1234, .context = 1, .counter = 300,
+		.data_len = 64, .data_seed = 0x40,
+		.len = 94,
+		.frame = {
+			0xb9, 0x35, 0x70, 0x19, 0xf3, 0x12, 0xdf, 0x8a, 0xd8, 0xc8, 0x3b, 0x58,
+			0x5a, 0xad, 0x1a, 0x25, 0x84, 0x1b, 0xea, 0x11, 0xfb, 0x84, 0x07, 0x78,
+			0x67, 0x00, 0x09, 0xe3, 0xd5, 0x6f, 0x53, 0x83, 0x91, 0x85, 0xf3, 0x92,
+			0xe6, 0x66, 0xd9, 0xde, 0xb9, 0xd9, 0xab, 0x1e, 0xfd, 0x1f, 0x6f, 0x4c,
+			0xcc, 0x38, 0x25, 0xe8, 0xae, 0xa6, 0xee, 0x29, 0x44, 0x15, 0x28, 0x48,
+			0xd8, 0x75, 0x76, 0x0b, 0xb2, 0x15, 0x2c, 0x78, 0x93, 0xca, 0xde, 0xeb,
+			0x47, 0x45, 0x13, 0xbd, 0x3d, 0xe8, 0x49, 0x91, 0x35, 0x58, 0x76, 0x8f,
+			0x49, 0xc3, 0xa2, 0x9d, 0xcf, 0xe1, 0x78, 0xa8, 0xf0, 0xea,
+		},
+	},
+};
+
+struct rmac_test_pbuf {
+	RmacPbuf tx_pbuf;
+	RmacPbuf rx_pbuf;
+	uint8_t buf[RMAC_PBUF_PACKET_LEN_MAX];
+};
+
+struct rmac_test_cost {
+	NbTable nbtable;
+	RmacPbuf tx_pbuf;
+	RmacPbuf rx_pbuf;
+	uint8_t frames[RMAC_TEST_COST_FRAMES][RMAC_PBUF_PACKET_LEN_MAX];
+	size_t frame_len[RMAC_TEST_COST_FRAMES];
+	uint8_t buf[RMAC_PBUF_PACKET_LEN_MAX];
+};
+
+
+/* Neighbor IDs are spread over the whole range. */
+static uint32_t rmac_test_id(size_t i) {
+	return 0x1000 + i * 7919;
+}
+
+
+static uint32_t rmac_test_ns(TickType_t start, uint32_t n) {
+	return (uint64_t)(xTaskGetTickCount() - start) * portTICK_PERIOD_MS * 1000000 / n;
+}
+
+
+static bool rmac_test_pool_if_exhausted(void) {
+	RmacPacketPool pool;
+	if (rmac_packet_pool_init(&pool, RMAC_TEST_POOL_SIZE) != RMAC_RET_OK) {
+		return false;
+	}
+
+	bool ret = true;
+	struct radio_scheduler_packet *packets[RMAC_TEST_POOL_SIZE];
+	for (size_t i = 0; i < RMAC_TEST_POOL_SIZE; i++) {
+		packets[i] = rmac_packet_pool_get(&pool);
+		ret &= packets[i] != NULL && packets[i]->used;
+		for (size_t j = 0; j < i; j++) {
+			ret &= packets[j] != packets[i];
+		}
+	}
+	ret &= rmac_packet_pool_get(&pool) == NULL;
+
+	/* The packet released last is returned first. */
+	ret &= rmac_packet_pool_release(&pool, packets[1]) == RMAC_RET_OK;
+	ret &= rmac_packet_pool_get(&pool) == packets[1];
+
+	struct rmac_packet_pool_stats stats;
+	rmac_packet_pool_get_stats(&pool, &stats);
+	ret &= stats.get == RMAC_TEST_POOL_SIZE + 2 && stats.empty == 1;
+	ret &= stats.used == RMAC_TEST_POOL_SIZE && stats.used_max == RMAC_TEST_POOL_SIZE;
+
+	for (size_t i = 0; i < RMAC_TEST_POOL_SIZE; i++) {
+		ret &= rmac_packet_pool_release(&pool, packets[i]) == RMAC_RET_OK;
+	}
+	/* A double release is refused, the free list is not corrupted. */
+	ret &= rmac_packet_pool_release(&pool, packets[0]) == RMAC_RET_FAILED;
+	rmac_packet_pool_get_stats(&pool, &stats);
+	ret &= stats.used == 0 && stats.used_max == RMAC_TEST_POOL_SIZE;
+	for (size_t i = 0; i < RMAC_TEST_POOL_SIZE; i++) {
+		ret &= rmac_packet_pool_get(&pool) != NULL;
+	}
+	ret &= rmac_packet_pool_get(&pool) == NULL;
+
+	rmac_packet_pool_free(&pool);
+	return ret;
+}
+
+
+static bool rmac_test_nbtable_if_found(void) {
+	NbTable t;
+	if (nbtable_init(&t, RMAC_TEST_NBTABLE_SIZE) != NBTABLE_RET_OK) {
+		return false;
+	}
+
+	bool ret = true;
+	struct nbtable_item *items[RMAC_TEST_NBTABLE_SIZE];
+	for (size_t i = 0; i < RMAC_TEST_NBTABLE_SIZE; i++) {
+		items[i] = nbtable_find_or_add_id(&t, rmac_test_id(i));
+		ret &= items[i] != NULL && items[i]->used && items[i]->id == rmac_test_id(i);
+	}
+	ret &= t.used == RMAC_TEST_NBTABLE_SIZE && nbtable_find_empty(&t) == NULL;
+	for (size_t i = 0; i < RMAC_TEST_NBTABLE_SIZE; i++) {
+		ret &= nbtable_find_id(&t, rmac_test_id(i)) == items[i];
+		ret &= nbtable_find_or_add_id(&t, rmac_test_id(i)) == items[i];
+	}
+	ret &= nbtable_find_id(&t, rmac_test_id(RMAC_TEST_NBTABLE_SIZE)) == NULL;
+
+	/* A removed neighbor is not found, its item is reused without evicting. */
+	ret &= nbtable_free_nb(&t, items[3]) == NBTABLE_RET_OK;
+	ret &= nbtable_find_id(&t, rmac_test_id(3)) == NULL && t.used == RMAC_TEST_NBTABLE_SIZE - 1;
+	ret &= nbtable_find_empty(&t) == items[3];
+	ret &= nbtable_find_or_add_id(&t, rmac_test_id(RMAC_TEST_NBTABLE_SIZE)) == items[3] && t.evicted == 0;
+	ret &= items[3]->rxpackets == 0;
+
+	/* Missed packets are counted from gaps in the counter. */
+	const uint8_t counters[] = {1, 2, 5};
+	for (size_t i = 0; i < sizeof(counters); i++) {
+		nbtable_update_rx_counter(&t, items[0], counters[i], 10);
+	}
+	ret &= items[0]->rxpackets == 3 && items[0]->rxbytes == 30 && items[0]->rxmissed == 2;
+
+	nbtable_free(&t);
+	return ret;
+}
+
+
+static bool rmac_test_nbtable_lru_if_full(void) {
+	NbTable t;
+	if (nbtable_init(&t, RMAC_TEST_LRU_SIZE) != NBTABLE_RET_OK) {
+		return false;
+	}
+
+	bool ret = true;
+	for (size_t i = 0; i < RMAC_TEST_LRU_SIZE; i++) {
+		ret &= nbtable_find_or_add_id(&t, rmac_test_id(i)) != NULL;
+	}
+
+	/* The first neighbor is used again, the second one is replaced. */
+	ret &= nbtable_find_id(&t, rmac_test_id(0)) != NULL;
+	ret &= nbtable_find_or_add_id(&t, rmac_test_id(RMAC_TEST_LRU_SIZE)) != NULL;
+	ret &= t.evicted == 1 && t.used == RMAC_TEST_LRU_SIZE;
+	ret &= nbtable_find_id(&t, rmac_test_id(1)) == NULL;
+
+	/* Every lookup moves the neighbor to the front, the first one is the oldest now. */
+	ret &= nbtable_find_id(&t, rmac_test_id(0)) != NULL;
+	for (size_t i = 2; i <= RMAC_TEST_LRU_SIZE; i++) {
+		ret &= nbtable_find_id(&t, rmac_test_id(i)) != NULL;
+	}
+	ret &= nbtable_find_or_add_id(&t, rmac_test_id(RMAC_TEST_LRU_SIZE + 1)) != NULL;
+	ret &= t.evicted == 2 && nbtable_find_id(&t, rmac_test_id(0)) == NULL;
+	for (size_t i = 2; i <= RMAC_TEST_LRU_SIZE + 1; i++) {
+		ret &= nbtable_find_id(&t, rmac_test_id(i)) != NULL;
+	}
+
+	nbtable_free(&t);
+	return ret;
+}
+
+
+static void rmac_test_vector_msg(RmacPbuf *pbuf, const struct rmac_test_vector *v) {
+	rmac_pbuf_clear(pbuf);
+	pbuf->msg.has_destination = v->destination != 0;
+	pbuf->msg.destination = v->destination;
+	pbuf->msg.source = v->source;
+	pbuf->msg.has_context = v->context != 0;
+	pbuf->msg.context = v->context;
+	pbuf->msg.has_counter = true;
+	pbuf->msg.counter = v->counter;
+	pbuf->msg.has_data = v->data_len > 0;
+	pbuf->msg.data.size = v->data_len;
+	for (size_t i = 0; i < v->data_len; i++) {
+		pbuf->msg.data.bytes[i] = v->data_seed + 7 * i;
+	}
+}
+
+
+static bool rmac_test_pbuf_if_old_vectors(void) {
+	struct rmac_test_pbuf *self = calloc(1, sizeof(struct rmac_test_pbuf));
+	if (self == NULL) {
+		return false;
+	}
+	rmac_pbuf_universe_key(&self->tx_pbuf, (uint8_t *)RMAC_TEST_KEY, strlen(RMAC_TEST_KEY));
+	rmac_pbuf_universe_key(&self->rx_pbuf, (uint8_t *)RMAC_TEST_KEY, strlen(RMAC_TEST_KEY));
+
+	bool ret = true;
+	for (size_t i = 0; i < sizeof(rmac_test_vectors) / sizeof(rmac_test_vectors[0]); i++) {
+		const struct rmac_test_vector *v = &rmac_test_vectors[i];
+
+		/* Written byte for byte the same. */
+		rmac_test_vector_msg(&self->tx_pbuf, v);
+		size_t len = 0;
+		ret &= rmac_pbuf_write(&self->tx_pbuf, self->buf, sizeof(self->buf), &len) == RMAC_PBUF_RET_OK;
+		ret &= len == v->len && memcmp(self->buf, v->frame, v->len) == 0;
+
+		/* And read back, the keys are kept by rmac_pbuf_clear. */
+		memcpy(self->buf, v->frame, v->len);
+		rmac_pbuf_clear(&self->rx_pbuf);
+		ret &= rmac_pbuf_read(&self->rx_pbuf, self->buf, v->len) == RMAC_PBUF_RET_OK;
+		RmacPacket *msg = &self->rx_pbuf.msg;
+		ret &= msg->destination == v->destination && msg->source == v->source;
+		ret &= msg->context == v->context && msg->has_counter && msg->counter == v->counter;
+		ret &= msg->data.size == v->data_len;
+		ret &= memcmp(msg->data.bytes, self->tx_pbuf.msg.data.bytes, v->data_len) == 0;
+
+		/* A flipped bit of the tag or of the ciphertext is not authenticated. */
+		for (size_t j = 0; j < RMAC_PBUF_SIV_LEN; j++) {
+			memcpy(self->buf, v->frame, v->len);
+			self->buf[j] ^= 1 << ((i + j) % 8);
+			ret &= rmac_pbuf_read(&self->rx_pbuf, self->buf, v->len) == RMAC_PBUF_RET_MAC_FAILED;
+		}
+		memcpy(self->buf, v->frame, v->len);
+		self->buf[v->len - 1] ^= 0x80;
+		ret &= rmac_pbuf_read(&self->rx_pbuf, self->buf, v->len) == RMAC_PBUF_RET_MAC_FAILED;
+	}
+
+	/* A different key does not authenticate the frame. */
+	rmac_pbuf_universe_key(&self->rx_pbuf, (uint8_t *)"universe", strlen("universe"));
+	memcpy(self->buf, rmac_test_vectors[0].frame, rmac_test_vectors[0].len);
+	ret &= rmac_pbuf_read(&self->rx_pbuf, self->buf, rmac_test_vectors[0].len) == RMAC_PBUF_RET_MAC_FAILED;
+
+	free(self);
+	return ret;
+}
+
+
+bool rmac_tests(void) {
+	bool res = true;
+
+	res &= u_test(rmac_test_pool_if_exhausted());
+	res &= u_test(rmac_test_nbtable_if_found());
+	res &= u_test(rmac_test_nbtable_lru_if_full());
+	res &= u_test(rmac_test_pbuf_if_old_vectors());
+
+	return res;
+}
+
+
+static bool rmac_test_cost_pool(void) {
+	RmacPacketPool pool;
+	if (rmac_packet_pool_init(&pool, RMAC_TEST_COST_POOL_SIZE) != RMAC_RET_OK) {
+		return false;
+	}
+	for (size_t i = 0; i < RMAC_TEST_COST_POOL_SIZE - 1; i++) {
+		rmac_packet_pool_get(&pool);
+	}
+
+	bool ret = true;
+	TickType_t start = xTaskGetTickCount();
+	for (uint32_t i = 0; i < RMAC_TEST_COST_GETS; i++) {
+		ret &= rmac_packet_pool_release(&pool, rmac_packet_pool_get(&pool)) == RMAC_RET_OK;
+	}
+	u_log(system_log, LOG_TYPE_INFO,
+		U_LOG_MODULE_PREFIX("pool get+release: %u ns (%u of %u used)"),
+		rmac_test_ns(start, RMAC_TEST_COST_GETS), RMAC_TEST_COST_POOL_SIZE - 1, RMAC_TEST_COST_POOL_SIZE
+	);
+
+	rmac_packet_pool_free(&pool);
+	return ret;
+}
+
+
+/* Populate the table and prepare frames of the neighbors. */
+static bool rmac_test_cost_prepare(struct rmac_test_cost *self, size_t neighbors) {
+	if (nbtable_init(&self->nbtable, RMAC_TEST_COST_NBTABLE_SIZE) != NBTABLE_RET_OK) {
+		return false;
+	}
+	for (size_t i = 0; i < neighbors; i++) {
+		nbtable_find_or_add_id(&self->nbtable, rmac_test_id(i));
+	}
+
+	for (size_t i = 0; i < RMAC_TEST_COST_FRAMES; i++) {
+		rmac_pbuf_clear(&self->tx_pbuf);
+		self->tx_pbuf.msg.source = rmac_test_id((i * 37) % neighbors);
+		self->tx_pbuf.msg.has_counter = true;
+		self->tx_pbuf.msg.counter = i;
+		self->tx_pbuf.msg.has_data = true;
+		self->tx_pbuf.msg.data.size = RMAC_TEST_COST_DATA_LEN;
+		memset(self->tx_pbuf.msg.data.bytes, i, RMAC_TEST_COST_DATA_LEN);
+		if (rmac_pbuf_write(&self->tx_pbuf, self->frames[i], RMAC_PBUF_PACKET_LEN_MAX, &self->frame_len[i]) != RMAC_PBUF_RET_OK) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+static bool rmac_test_cost_neighbors(struct rmac_test_cost *self, size_t neighbors) {
+	if (!rmac_test_cost_prepare(self, neighbors)) {
+		nbtable_free(&self->nbtable);
+		return false;
+	}
+
+	bool ret = true;
+	TickType_t start = xTaskGetTickCount();
+	for (uint32_t i = 0; i < RMAC_TEST_COST_LOOKUPS; i++) {
+		struct nbtable_item *item = nbtable_find_or_add_id(&self->nbtable, rmac_test_id(i % neighbors));
+		nbtable_update_rx_counter(&self->nbtable, item, i, RMAC_TEST_COST_DATA_LEN);
+	}
+	uint32_t lookup_ns = rmac_test_ns(start, RMAC_TEST_COST_LOOKUPS);
+
+	/* The same steps as in process_packet, without the FEC and the host delivery. */
+	start = xTaskGetTickCount();
+	for (uint32_t i = 0; i < RMAC_TEST_COST_PACKETS; i++) {
+		size_t f = i % RMAC_TEST_COST_FRAMES;
+		memcpy(self->buf, self->frames[f], self->frame_len[f]);
+		rmac_pbuf_clear(&self->rx_pbuf);
+		if (rmac_pbuf_read(&self->rx_pbuf, self->buf, self->frame_len[f]) != RMAC_PBUF_RET_OK) {
+			ret = false;
+			break;
+		}
+		struct nbtable_item *item = nbtable_find_or_add_id(&self->nbtable, self->rx_pbuf.msg.source);
+		nbtable_update_rx_counter(&self->nbtable, item, self->rx_pbuf.msg.counter, self->rx_pbuf.msg.data.size);
+		nbtable_update_rssi(&self->nbtable, item, -80.0);
+	}
+	uint32_t packet_ns = rmac_test_ns(start, RMAC_TEST_COST_PACKETS);
+
+	u_log(system_log, ret ? LOG_TYPE_INFO : LOG_TYPE_ERROR,
+		U_LOG_MODULE_PREFIX("%u neighbors: lookup %u ns, received %u B packet %u ns, %u evicted"),
+		neighbors, lookup_ns, self->frame_len[0], packet_ns, self->nbtable.evicted
+	);
+	ret &= self->nbtable.evicted == 0;
+
+	nbtable_free(&self->nbtable);
+	return ret;
+}
+
+
+/* CPU cycles per on-air byte, computed from the elapsed time and the core clock. */
+static uint32_t rmac_test_cycles_per_byte(TickType_t start, uint32_t bytes) {
+	uint64_t ms = (uint64_t)(xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+	return ms * (configCPU_CLOCK_HZ / 1000) / bytes;
+}
+
+
+static bool rmac_test_cost_crypto(struct rmac_test_cost *self, const struct rmac_test_cost_crypto_size *size) {
+	rmac_pbuf_clear(&self->tx_pbuf);
+	self->tx_pbuf.msg.source = rmac_test_id(0);
+	self->tx_pbuf.msg.has_data = true;
+	self->tx_pbuf.msg.data.size = size->data_len;
+	memset(self->tx_pbuf.msg.data.bytes, 0x55, size->data_len);
+
+	bool ret = true;
+	size_t len = 0;
+	TickType_t start = xTaskGetTickCount();
+	for (uint32_t i = 0; i < RMAC_TEST_COST_CRYPTO_PACKETS; i++) {
+		ret &= rmac_pbuf_write(&self->tx_pbuf, self->frames[0], RMAC_PBUF_PACKET_LEN_MAX, &len) == RMAC_PBUF_RET_OK;
+	}
+	uint32_t write_cpb = rmac_test_cycles_per_byte(start, RMAC_TEST_COST_CRYPTO_PACKETS * len);
+	ret &= len == size->frame_len;
+
+	start = xTaskGetTickCount();
+	for (uint32_t i = 0; i < RMAC_TEST_COST_CRYPTO_PACKETS; i++) {
+		memcpy(self->buf, self->frames[0], len);
+		ret &= rmac_pbuf_read(&self->rx_pbuf, self->buf, len) == RMAC_PBUF_RET_OK;
+	}
+	uint32_t read_cpb = rmac_test_cycles_per_byte(start, RMAC_TEST_COST_CRYPTO_PACKETS * len);
+
+	u_log(system_log, ret ? LOG_TYPE_INFO : LOG_TYPE_ERROR,
+		U_LOG_MODULE_PREFIX("%u B frame (%u B data): write %u cycles/B, read %u cycles/B"),
+		len, size->data_len, write_cpb, read_cpb
+	);
+	return ret;
+}
+
+
+bool rmac_tests_cost(void) {
+	struct rmac_test_cost *self = calloc(1, sizeof(struct rmac_test_cost));
+	if (self == NULL) {
+		return false;
+	}
+	rmac_pbuf_universe_key(&self->tx_pbuf, (uint8_t *)RMAC_TEST_KEY, strlen(RMAC_TEST_KEY));
+	rmac_pbuf_universe_key(&self->rx_pbuf, (uint8_t *)RMAC_TEST_KEY, strlen(RMAC_TEST_KEY));
+
+	bool res = rmac_test_cost_pool();
+	res &= rmac_test_cost_neighbors(self, 5);
+	res &= rmac_test_cost_neighbors(self, 200);
+	for (size_t i = 0; i < RMAC_TEST_COST_CRYPTO_SIZES; i++) {
+		res &= rmac_test_cost_crypto(self, &rmac_test_cost_crypto_sizes[i]);
+	}
+
+	free(self);
+	return res;
+}
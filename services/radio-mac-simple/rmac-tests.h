@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: BSD-2-Clause
+ *
+ * rMAC packet pool, neighbor table and packet buffer tests
+ *
+ * Copyright (c) 2023, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * Exhaust the packet pool and check its statistics and the double release
+ * rejection. Add, find and remove neighbors in the neighbor table, check
+ * the least recently used neighbor is replaced if the table is full.
+ * Check the packet buffer writes and reads frames of the previous version
+ * byte for byte and rejects modified frames.
+ */
+bool rmac_tests(void);
+
+/**
+ * Log the cost of a packet pool get and release, of a neighbor lookup and
+ * of a whole received packet (decryption, decoding and the neighbor lookup)
+ * with 5 and 200 neighbors. Log the encryption and decryption cycles per byte
+ * of 32, 80 and 255 B frames.
+ */
+bool rmac_tests_cost(void);
@@ -37,6 +37,10 @@
 #include "interfaces/radio-mac/host.h"
 #include "interfaces/clock/descriptor.h"
 
+#if defined(CONFIG_SERVICE_RADIO_MAC_SIMPLE_FEC)
+	#include "fec_golay.h"
+#endif
+
 
 
 #define MODULE_NAME "rmac"
@@ -86,17 +90,24 @@ rmac_ret_t rmac_init(Rmac *self, Radio *radio) {
 
 	self->debug = false;
 
-	if (radio_scheduler_start(self) != RMAC_RET_OK) {
-		goto err;
-	}
-
-	self->state = RMAC_STATE_STOPPED;
+	#if defined(CONFIG_SERVICE_RADIO_MAC_SIMPLE_FEC)
+		/* The decoding table is shared, fill it before the scheduler starts. */
+		fec_golay_table_fill();
+	#endif
 
+	/* The scheduler uses the keys and the radio sync as soon as it runs,
+	 * set the defaults first. */
 	/** @todo set default parameters here. */
 	rmac_set_universe_key(self, (uint8_t *)"Universe", 8);
 	rmac_set_fhss_algo(self, RMAC_FHSS_ALGO_SINGLE);
 	rmac_set_tdma_algo(self, RMAC_TDMA_ALGO_CSMA);
 
+	if (radio_scheduler_start(self) != RMAC_RET_OK) {
+		goto err;
+	}
+
+	self->state = RMAC_STATE_STOPPED;
+
 	u_log(system_log, LOG_TYPE_INFO, U_LOG_MODULE_PREFIX("service started"));
 	return RMAC_RET_OK;
 
@@ -191,9 +202,11 @@ rmac_ret_t rmac_set_universe_key(Rmac *self, uint8_t *key, size_t len) {
 		return RMAC_RET_FAILED;
 	}
 
-	/* Copy the universe key - it will be used for rx_pbuf and tx_pbuf. */
+	/* Copy the universe key and derive the rx_pbuf and tx_pbuf keys. */
 	memcpy(self->universe_key, key, len);
 	self->universe_key_len = len;
+	rmac_pbuf_universe_key(&self->rx_pbuf, key, len);
+	rmac_pbuf_universe_key(&self->tx_pbuf, key, len);
 
 	/* And set the radio sync. */
 	memcpy(self->radio_sync, "abcd", 4);
@@ -63,6 +63,7 @@
 #include "interfaces/radio-mac/host.h"
 #include "interfaces/clock/descriptor.h"
 #include "rmac_pbuf.pb.h"
+#include "blake2.h"
 
 
 #define MAC_SIMPLE_MAC_KEY_LEN 32
@@ -82,6 +83,14 @@ typedef enum {
 struct nbtable_item {
 	bool used;
 	uint32_t id;
+
+	/* Next item in the same hash bucket or in the list of empty items. */
+	struct nbtable_item *hnext;
+
+	/* Used items are kept in the LRU order, the most recently used first. */
+	struct nbtable_item *lru_prev;
+	struct nbtable_item *lru_next;
+
 	float rssi_dbm;
 	uint32_t rxpackets;
 	uint32_t rxbytes;
@@ -93,10 +102,22 @@ struct nbtable_item {
 };
 
 
+/* Neighbors are looked up by their ID in a hash table with chained buckets.
+ * If the table is full, the least recently used neighbor is replaced. */
 typedef struct {
 	size_t count;
 	struct nbtable_item *items;
 
+	struct nbtable_item **buckets;
+	/* Power of 2 not lower than count. */
+	size_t bucket_count;
+
+	struct nbtable_item *empty;
+	struct nbtable_item *lru_head;
+	struct nbtable_item *lru_tail;
+
+	size_t used;
+	uint32_t evicted;
 } NbTable;
 
 
@@ -136,6 +157,10 @@ struct rmac_mcs {
 #define RMAC_PBUF_SIV_LEN 16
 #define RMAC_PBUF_PACKET_LEN_MAX 255
 
+/* Golay coding doubles the packet length, one byte is used to save
+ * the original packet length. */
+#define RMAC_FEC_PACKET_LEN_MAX 125
+
 typedef enum {
 	RMAC_PBUF_RET_OK = 0,
 	RMAC_PBUF_RET_FAILED,
@@ -158,6 +183,10 @@ typedef struct rmac_pbuf {
 	uint8_t key_encrypt[RMAC_PBUF_KE_LEN];
 	uint8_t key_mac[RMAC_PBUF_KM_LEN];
 
+	/* Keyed BLAKE2s states initialised when the key is set and copied
+	 * for every use. The key block is buffered, not compressed yet. */
+	blake2s_state ke_state;
+	blake2s_state km_state;
 } RmacPbuf;
 
 
@@ -284,6 +313,8 @@ struct radio_scheduler_txpacket {
 
 struct radio_scheduler_packet {
 	volatile bool used;
+	/* Next free packet in the pool. */
+	struct radio_scheduler_packet *next;
 	union {
 		struct radio_scheduler_rxpacket rxpacket;
 		struct radio_scheduler_txpacket txpacket;
@@ -291,11 +322,22 @@ struct radio_scheduler_packet {
 };
 
 
+struct rmac_packet_pool_stats {
+	uint32_t get;
+	/* Number of requests which found the pool empty. */
+	uint32_t empty;
+	size_t used;
+	size_t used_max;
+};
+
 /* Preallocated pool of serialized/received packets to avoid
- * allocating/deallocating in runtime. */
+ * allocating/deallocating in runtime. Free packets are kept
+ * in a singly linked list. */
 typedef struct {
 	struct radio_scheduler_packet *pool;
 	size_t size;
+	struct radio_scheduler_packet *free;
+	struct rmac_packet_pool_stats stats;
 	SemaphoreHandle_t lock;
 } RmacPacketPool;
 
@@ -362,6 +404,7 @@ rmac_ret_t rmac_packet_pool_init(RmacPacketPool *self, size_t size);
 rmac_ret_t rmac_packet_pool_free(RmacPacketPool *self);
 struct radio_scheduler_packet *rmac_packet_pool_get(RmacPacketPool *self);
 rmac_ret_t rmac_packet_pool_release(RmacPacketPool *self, struct radio_scheduler_packet *packet);
+rmac_ret_t rmac_packet_pool_get_stats(RmacPacketPool *self, struct rmac_packet_pool_stats *stats);
 
 
 /* Functions for managing the slot queue. */
@@ -393,6 +436,7 @@ nbtable_ret_t nbtable_update_rssi(NbTable *self, struct nbtable_item *item, floa
 
 /* Packet buffer/encoder/decoder. */
 /* There is no pbuf_init nor pbuf_free. No data are allocated inside. */
+/* Clear the message, keys are retained. */
 rmac_pbuf_ret_t rmac_pbuf_clear(RmacPbuf *self);
 rmac_pbuf_ret_t rmac_pbuf_use(RmacPbuf *self);
 rmac_pbuf_ret_t rmac_pbuf_universe_key(RmacPbuf *self, uint8_t *key, size_t len);
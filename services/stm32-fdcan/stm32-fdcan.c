@@ -32,7 +32,9 @@ static can_ret_t stm32_fdcan_send(Can *can, const struct can_message *msg, uint3
 	while (!fdcan_available_tx(self->fdcan)) {
 		;
 	}
-	if (fdcan_transmit(self->fdcan, msg->id, true, false, false, false, msg->len, msg->buf) < 0) {
+	/* Frames longer than 8 bytes can be sent as CAN-FD frames only. */
+	bool fd = msg->fd || msg->len > 8;
+	if (fdcan_transmit(self->fdcan, msg->id, true, false, fd, fd && msg->brs, msg->len, msg->buf) < 0) {
 		u_log(system_log, LOG_TYPE_ERROR, U_LOG_MODULE_PREFIX("transmit error"));
 		return CAN_RET_FAILED;
 	}
@@ -56,6 +58,10 @@ static can_ret_t stm32_fdcan_receive(Can *can, struct can_message *msg, uint32_t
 	}
 	msg->len = rx_length;
 	msg->timestamp = rx_timestamp;
+	/* The FDF/BRS flags of the received frame are not reported by the driver,
+	 * only frames longer than 8 bytes are known to be CAN-FD. */
+	msg->fd = rx_length > 8;
+	msg->brs = false;
 
 	/* Check if the fifo is empty. If not, set the semaphore again. */
 	uint32_t frames = (FDCAN_RXFIS(self->fdcan, FDCAN_FIFO0) >> FDCAN_RXFIFO_FL_SHIFT) & FDCAN_RXFIFO_FL_MASK;
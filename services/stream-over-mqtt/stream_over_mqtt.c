@@ -95,13 +95,16 @@ static int32_t mqtt_cli_write(void *context, const uint8_t *buf, uint32_t len) {
 	size_t i = 0;
 	while (i < len) {
 		if (buf[i] == '\n' || self->line_buffer_len >= STREAM_OVER_MQTT_TX_QUEUE_LEN) {
-			queue_publish_send_message(&self->pub, self->line_buffer, self->line_buffer_len);
+			/* Do not wait for the acknowledgement, the message is copied to the queue. */
+			queue_publish_enqueue_message(&self->pub, self->line_buffer, self->line_buffer_len, STREAM_OVER_MQTT_PUBLISH_TIMEOUT_MS);
 			self->line_buffer_len = 0;
-			/* Eat the newline. */
-			i++;
+			/* Eat the newline, a full line buffer is split without losing the character. */
+			if (buf[i] == '\n') {
+				i++;
+			}
 			continue;
 		}
-		if (self->line_buffer_len <= STREAM_OVER_MQTT_TX_QUEUE_LEN) {
+		if (self->line_buffer_len < STREAM_OVER_MQTT_TX_QUEUE_LEN) {
 			self->line_buffer[self->line_buffer_len] = buf[i];
 			self->line_buffer_len++;
 		}
@@ -30,11 +30,14 @@
 #include "interface_stream.h"
 
 
-#define STREAM_OVER_MQTT_TX_QUEUE_LEN 128
+/* Lines longer than a single queued MQTT message are split. */
+#define STREAM_OVER_MQTT_TX_QUEUE_LEN MQTT_OUT_MESSAGE_SIZE
 #define STREAM_OVER_MQTT_RX_QUEUE_LEN 128
 #define STREAM_OVER_MQTT_TOPIC_LEN 64
 #define STREAM_OVER_MQTT_SUB_TOPIC "in"
 #define STREAM_OVER_MQTT_PUB_TOPIC "out"
+/* Output lines are dropped if the MQTT queue stays full (eg. when disconnected). */
+#define STREAM_OVER_MQTT_PUBLISH_TIMEOUT_MS 1000
 
 
 typedef enum {
@@ -6,6 +6,9 @@ import sys
 import mmap
 import struct
 import logging
+import argparse
+import hashlib
+import hmac
 
 def printProgressBar(iteration, total, prefix = '', suffix = '', decimals = 1, length = 100, fill = '#', printEnd = "\r"):
     """
@@ -29,21 +32,188 @@ def printProgressBar(iteration, total, prefix = '', suffix = '', decimals = 1, l
         print()
 
 
+STRUCT_FMT = {
+	pkg_pb2.Msg.Type.INT8: 'b',
+	pkg_pb2.Msg.Type.UINT8: 'B',
+	pkg_pb2.Msg.Type.INT16: 'h',
+	pkg_pb2.Msg.Type.UINT16: 'H',
+	pkg_pb2.Msg.Type.INT32: 'i',
+	pkg_pb2.Msg.Type.UINT32: 'I',
+	pkg_pb2.Msg.Type.INT64: 'q',
+	pkg_pb2.Msg.Type.UINT64: 'Q',
+	pkg_pb2.Msg.Type.FLOAT: 'f',
+	pkg_pb2.Msg.Type.DOUBLE: 'd',
+}
+
+
 def format_data(data, dtype):
-	if dtype == pkg_pb2.Msg.Type.INT16:
-		return struct.unpack("h" * (len(data) // 2), data)
-	if dtype == pkg_pb2.Msg.Type.INT32:
-		return struct.unpack("i" * (len(data) // 4), data)
+	fmt = STRUCT_FMT.get(dtype)
+	if fmt is None:
+		return []
+	return struct.unpack(fmt * (len(data) // struct.calcsize(fmt)), data)
+
+
+def decode_delta_zigzag(data, dtype, count):
+	fmt = STRUCT_FMT[dtype]
+	bits = struct.calcsize(fmt) * 8
+	values = []
+	prev = 0
+	pos = 0
+	for _ in range(count):
+		z = 0
+		shift = 0
+		while True:
+			b = data[pos]
+			pos += 1
+			z |= (b & 0x7f) << shift
+			shift += 7
+			if not b & 0x80:
+				break
+		prev = (prev + ((z >> 1) ^ -(z & 1))) & ((1 << 64) - 1)
+		v = prev & ((1 << bits) - 1)
+		if fmt.islower() and v >= 1 << (bits - 1):
+			v -= 1 << bits
+		values.append(v)
+	return values
+
+
+def decode_xor_float(data, dtype, count):
 	if dtype == pkg_pb2.Msg.Type.FLOAT:
-		return struct.unpack("f" * (len(data) // 4), data)
-	return []
+		width, field, fmt, ifmt = 32, 5, 'f', 'I'
+	else:
+		width, field, fmt, ifmt = 64, 6, 'd', 'Q'
+	bits = int.from_bytes(data, 'big')
+	nbits = len(data) * 8
+	pos = 0
+
+	def get(n):
+		nonlocal pos
+		pos += n
+		if pos > nbits:
+			raise Exception('XOR float data truncated')
+		return (bits >> (nbits - pos)) & ((1 << n) - 1)
 
+	if count == 0:
+		return []
+	prev = get(width)
+	raw = [prev]
+	lead = width
+	trail = 0
+	for _ in range(1, count):
+		if get(1):
+			if get(1):
+				lead = get(field)
+				trail = width - lead - (get(field) + 1)
+			prev ^= get(width - lead - trail) << trail
+		raw.append(prev)
+	return [struct.unpack(fmt, struct.pack(ifmt, v))[0] for v in raw]
 
-def unpack_msg(topic='', dtype='', data='', timestamp=0):
+
+def decode_zfp(data, dtype, count):
+	import zfpy
+	return list(zfpy.decompress_numpy(bytes(data)))
+
+
+def decode_data(m):
+	if m.codec == pkg_pb2.Msg.Codec.DELTA_ZIGZAG:
+		return decode_delta_zigzag(m.buf, m.type, m.count)
+	if m.codec == pkg_pb2.Msg.Codec.XOR_FLOAT:
+		return decode_xor_float(m.buf, m.type, m.count)
+	if m.codec == pkg_pb2.Msg.Codec.ZFP:
+		return decode_zfp(m.buf, m.type, m.count)
+	return format_data(m.buf, m.type)
+
+
+def unpack_msg(m, topic, timestamp):
 	if topic_filter and topic != topic_filter:
 		return
 
-	print(topic, len(data), timestamp, " ".join([str(i) for i in format_data(data, dtype)]))
+	print(topic, len(m.buf), '%.6f' % timestamp, " ".join([str(i) for i in decode_data(m)]))
+
+def chacha20_block(key, nonce, counter):
+	def rotl(v, c):
+		return ((v << c) & 0xffffffff) | (v >> (32 - c))
+
+	def qr(x, a, b, c, d):
+		x[a] = (x[a] + x[b]) & 0xffffffff; x[d] = rotl(x[d] ^ x[a], 16)
+		x[c] = (x[c] + x[d]) & 0xffffffff; x[b] = rotl(x[b] ^ x[c], 12)
+		x[a] = (x[a] + x[b]) & 0xffffffff; x[d] = rotl(x[d] ^ x[a], 8)
+		x[c] = (x[c] + x[d]) & 0xffffffff; x[b] = rotl(x[b] ^ x[c], 7)
+
+	state = list(struct.unpack('<4I', b'expand 32-byte k')) + list(struct.unpack('<8I', key)) + [counter, 0] + list(struct.unpack('<2I', nonce))
+	x = list(state)
+	for _ in range(10):
+		qr(x, 0, 4, 8, 12); qr(x, 1, 5, 9, 13); qr(x, 2, 6, 10, 14); qr(x, 3, 7, 11, 15)
+		qr(x, 0, 5, 10, 15); qr(x, 1, 6, 11, 12); qr(x, 2, 7, 8, 13); qr(x, 3, 4, 9, 14)
+	return struct.pack('<16I', *[(a + b) & 0xffffffff for a, b in zip(x, state)])
+
+
+def poly1305(key, data):
+	r = int.from_bytes(key[:16], 'little') & 0x0ffffffc0ffffffc0ffffffc0fffffff
+	s = int.from_bytes(key[16:], 'little')
+	p = (1 << 130) - 5
+	h = 0
+	for i in range(0, len(data), 16):
+		h = ((h + int.from_bytes(data[i:i + 16] + b'\x01', 'little')) * r) % p
+	return ((h + s) & ((1 << 128) - 1)).to_bytes(16, 'little')
+
+
+def pad16(b):
+	return b'\x00' * (-len(b) % 16)
+
+
+def unseal(p, pdata):
+	"""
+	Verify the package MAC and decrypt the compressed data in place. See
+	plog_packager.c for the construction.
+	"""
+	if seal_key is None:
+		raise Exception('Package is sealed, no key given')
+	ct = pdata.heatshrink.msg
+	if not p.data.endswith(ct):
+		raise Exception('Unexpected package layout')
+	ad = p.data[:len(p.data) - len(ct)]
+
+	otk = chacha20_block(seal_key, pdata.nonce, 0)[:32]
+	mac = poly1305(otk, ct + pad16(ct) + ad + pad16(ad) + struct.pack('<QQ', len(ct), len(ad)))
+	if not hmac.compare_digest(mac, p.mac):
+		raise Exception('Package MAC verification failed')
+
+	keystream = b''.join(chacha20_block(seal_key, pdata.nonce, 1 + i) for i in range((len(ct) + 63) // 64))
+	pdata.heatshrink.msg = bytes(a ^ b for a, b in zip(ct, keystream))
+
+
+def package_len(pd):
+	"""
+	Return the length of the Package message. Packages are followed by
+	arbitrary data (erased flash) which cannot be stripped reliably as the
+	sealed data may end with 0xff bytes. Package ends with the data field.
+	"""
+	pos = 0
+	while pos < len(pd):
+		tag = 0
+		shift = 0
+		while True:
+			tag |= (pd[pos] & 0x7f) << shift
+			shift += 7
+			pos += 1
+			if not pd[pos - 1] & 0x80:
+				break
+		if tag & 7 != 2:
+			break
+		ln = 0
+		shift = 0
+		while True:
+			ln |= (pd[pos] & 0x7f) << shift
+			shift += 7
+			pos += 1
+			if not pd[pos - 1] & 0x80:
+				break
+		pos += ln
+		if tag >> 3 == pkg_pb2.Package.DATA_FIELD_NUMBER:
+			return pos
+	raise Exception('Package data not found')
+
 
 def parse_pkg(pd):
 	if pd[:3] != b'PKG':
@@ -51,27 +221,53 @@ def parse_pkg(pd):
 	pd = pd[3:]
 	rd = None
 
-	# Crop 0xff from the end
-	pd = pd.rstrip(b"\xff")
+	pd = pd[:package_len(pd)]
 
 	p = pkg_pb2.Package()
 	p.ParseFromString(pd)
 	if p.data:
 		pdata = pkg_pb2.PackageData()
 		pdata.ParseFromString(p.data)
+		if p.mac:
+			unseal(p, pdata)
+		elif seal_key is not None:
+			raise Exception('Package is not sealed')
 		if pdata.heatshrink:
 			rd = heatshrink2.decode(pdata.heatshrink.msg, window_sz2=pdata.heatshrink.window_size, lookahead_sz2=pdata.heatshrink.lookahead_size)
 			if rd:
 				rawdata = pkg_pb2.RawData()
 				rawdata.ParseFromString(rd)
+
+				# Messages reference topics in the package dictionary, time
+				# is delta-encoded starting at the package base time.
+				topics = {t.id: t.topic for t in rawdata.topic}
+				timestamp = pdata.base_time.s + pdata.base_time.us / 1e6
 				for m in rawdata.msg:
-					unpack_msg(m.topic, m.type, m.buf, m.time)
+					timestamp += m.time_delta_us / 1e6
+					if m.HasField('topic_id'):
+						topic = topics[m.topic_id]
+					else:
+						topic = m.topic
+					unpack_msg(m, topic, timestamp)
+
 
+parser = argparse.ArgumentParser(description='Unpack plog-packager packages')
+parser.add_argument('file', help='file containing packages')
+parser.add_argument('topic', nargs='?', default=None, help='print only messages with this topic')
+key_group = parser.add_mutually_exclusive_group()
+key_group.add_argument('-k', '--key', default=None, help='key used to seal the packages (as passed to plog_packager_set_key)')
+key_group.add_argument('-K', '--key-file', default=None, help='file containing the raw key bytes (the pkg.key file loaded by plog_packager_load_key)')
+args = parser.parse_args()
 
-fname = sys.argv[1]
-topic_filter = None
-if len(sys.argv) > 2:
-	topic_filter = sys.argv[2]
+fname = args.file
+topic_filter = args.topic
+seal_key = None
+if args.key is not None:
+	seal_key = hashlib.blake2s(args.key.encode()).digest()
+if args.key_file is not None:
+	with open(args.key_file, 'rb') as kf:
+		# The device reads at most 32 bytes of the key file.
+		seal_key = hashlib.blake2s(kf.read()[:32]).digest()
 
 
 with open(fname, "r+b") as f: